@@ -0,0 +1,325 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "MediaBenchmark.h"
+
+#ifdef USE_FFMPEG
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+#include "FFMPEGReaderNative.h"
+#include "FFMPEGWriterNative.h"
+
+using namespace Microsoft::Psi::Media::Native::Windows;
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Benchmark {
+
+  // Synthetic clips are this many frames, at 30fps
+  static const int SyntheticClipFrames = 90;
+
+  // Number of distinct synthetic frames cycled through when encoding
+  static const int NumPatternFrames = 8;
+
+  static const int VideoBitrate = 8000000;
+
+  //**********************************************************************
+  static std::string JoinPath(const std::string &dir, const std::string &name)
+  {
+      if (dir.empty())
+      {
+          return name;
+      }
+      char last = dir[dir.size() - 1];
+      return (last == '/' || last == '\\') ? dir + name : dir + "/" + name;
+  }
+
+  //**********************************************************************
+  static std::string GetBaseName(const std::string &path)
+  {
+      size_t slash = path.find_last_of("/\\");
+      return (slash == std::string::npos) ? path : path.substr(slash + 1);
+  }
+
+  //**********************************************************************
+  // Fills a BGRA frame with gradients that move from frame to frame, so
+  // that the encoder sees motion it can predict, like it would in camera
+  // footage, rather than noise it can't compress.
+  //**********************************************************************
+  static void FillPattern(std::vector<uint8_t> &frame, int width, int height, int frameIndex)
+  {
+      frame.resize((size_t)width * height * 4);
+      uint8_t *pixel = frame.data();
+      for (int y = 0; y < height; y++)
+      {
+          for (int x = 0; x < width; x++)
+          {
+              pixel[0] = (uint8_t)(x + frameIndex * 4);
+              pixel[1] = (uint8_t)(y + frameIndex * 2);
+              pixel[2] = (uint8_t)((x + y) / 2 - frameIndex * 3);
+              pixel[3] = 255;
+              pixel += 4;
+          }
+      }
+  }
+
+  //**********************************************************************
+  // Writes frames to 'filename' until 'keepGoing(framesWritten, seconds)'
+  // returns false, then closes the file. 'result' gets the frame count and
+  // the time and allocations from the first frame to the end of Close(),
+  // which flushes the frames the encoder still holds.
+  //**********************************************************************
+  template <typename KeepGoingFunc>
+  static HRESULT EncodeClip(const std::string &filename, const char *codec, int width, int height, const KeepGoingFunc &keepGoing, BenchmarkResult *result, std::string *encoderName)
+  {
+      std::vector<uint8_t> frames[NumPatternFrames];
+      for (int i = 0; i < NumPatternFrames; i++)
+      {
+          FillPattern(frames[i], width, height, i);
+      }
+
+      FFMPEGWriterNative writer;
+      HRESULT hr = writer.SetVideoEncoder(codec, "auto", VideoBitrate, -1, -1, nullptr);
+      if (SUCCEEDED(hr))
+      {
+          hr = writer.Open(filename.c_str(), width, height, 30, 1);
+      }
+      if (FAILED(hr))
+      {
+          return hr;
+      }
+      *encoderName = writer.GetEncoderName();
+
+      result->width = width;
+      result->height = height;
+      result->frames = 0;
+      long long startAllocations = GetAllocationCount();
+      double start = GetSeconds();
+      while (SUCCEEDED(hr) && keepGoing(result->frames, GetSeconds() - start))
+      {
+          // 100ns ticks at 30fps
+          int64_t timestamp = result->frames * 10000000 / 30;
+          const std::vector<uint8_t> &frame = frames[result->frames % NumPatternFrames];
+          hr = writer.WriteVideoFrame(timestamp, frame.data(), width, height, width * 4, FFMPEGWriterPixelFormat_BGRA_32bpp);
+          result->frames++;
+      }
+      HRESULT closeResult = writer.Close();
+      result->seconds = GetSeconds() - start;
+      result->allocations = (startAllocations < 0) ? -1 : GetAllocationCount() - startAllocations;
+      return FAILED(hr) ? hr : closeResult;
+  }
+
+  //**********************************************************************
+  // FFMPEGWriterNative::WriteVideoFrame() with synthetic BGRA frames,
+  // encoded on the caller's thread with the first encoder that opens
+  //**********************************************************************
+  static void RunEncodeBenchmarks(BenchmarkRunner &runner)
+  {
+      static const char *codecs[] = { "h264", "hevc" };
+      const BenchmarkOptions &options = runner.GetOptions();
+      std::string filename = JoinPath(options.tempDir, "psi-benchmark-encode.mp4");
+      for (size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++)
+      {
+          for (int i = 0; i < NumBenchmarkResolutions; i++)
+          {
+              const BenchmarkResolution &resolution = BenchmarkResolutions[i];
+              std::string name = std::string("encode.") + codecs[c] + "." + resolution.name;
+              if (!runner.IsSelected(name))
+              {
+                  continue;
+              }
+
+              BenchmarkResult result;
+              result.name = name;
+              std::string encoderName;
+              HRESULT hr = EncodeClip(filename, codecs[c], resolution.width, resolution.height, [&](long long frames, double seconds)
+              {
+                  return seconds < options.minSeconds || frames < options.minFrames;
+              }, &result, &encoderName);
+              remove(filename.c_str());
+              if (FAILED(hr))
+              {
+                  runner.Fail(name, "no encoder could encode the frames");
+                  continue;
+              }
+              fprintf(stderr, "%s: encoded with %s\n", name.c_str(), encoderName.c_str());
+              runner.Report(result);
+          }
+      }
+  }
+
+  //**********************************************************************
+  // Decodes 'filename' with FFMPEGReaderNative's NextFrame()/ReadFrameData()
+  // loop, replaying it until the minimum time and number of frames are
+  // reached. Only video frames are counted, but the audio is decoded too,
+  // as it would be by the Psi components.
+  //**********************************************************************
+  static void RunDecodeBenchmark(BenchmarkRunner &runner, const std::string &name, const std::string &filename)
+  {
+      const BenchmarkOptions &options = runner.GetOptions();
+      FFMPEGReaderNative reader;
+      std::vector<char> path(filename.begin(), filename.end());
+      path.push_back('\0');
+      HRESULT hr = reader.Initialize(24, 0, 0);
+      if (SUCCEEDED(hr))
+      {
+          hr = reader.Open(path.data());
+      }
+      if (FAILED(hr))
+      {
+          runner.Fail(name, "can't open the clip");
+          return;
+      }
+
+      // Sized up front, so that growing it isn't counted
+      std::vector<uint8_t> buffer((size_t)reader.GetWidth() * reader.GetHeight() * 4 + (1 << 20));
+
+      BenchmarkResult result;
+      result.name = name;
+      result.width = reader.GetWidth();
+      result.height = reader.GetHeight();
+      result.frames = 0;
+      long long passStartFrames = 0;
+      long long startAllocations = GetAllocationCount();
+      double start = GetSeconds();
+      for (;;)
+      {
+          int frameType;
+          int requiredBufferSize;
+          bool eos = false;
+          hr = reader.NextFrame(&frameType, &requiredBufferSize, &eos);
+          if (FAILED(hr))
+          {
+              break;
+          }
+          if (eos)
+          {
+              if (result.frames == passStartFrames)
+              {
+                  hr = E_FAIL; /* No video frames, replaying would never finish */
+                  break;
+              }
+              if (GetSeconds() - start >= options.minSeconds && result.frames >= options.minFrames)
+              {
+                  break;
+              }
+              passStartFrames = result.frames;
+              hr = reader.Seek(0);
+              if (FAILED(hr))
+              {
+                  break;
+              }
+              continue;
+          }
+          if (hr == S_FALSE)
+          {
+              continue;
+          }
+          if ((size_t)requiredBufferSize > buffer.size())
+          {
+              buffer.resize(requiredBufferSize);
+          }
+
+          int bytesRead = 0;
+          double timestamp;
+          hr = reader.ReadFrameData(buffer.data(), &bytesRead, &timestamp);
+          if (FAILED(hr))
+          {
+              break;
+          }
+          if (hr == S_OK && frameType == 0)
+          {
+              result.frames++;
+          }
+      }
+      result.seconds = GetSeconds() - start;
+      result.allocations = (startAllocations < 0) ? -1 : GetAllocationCount() - startAllocations;
+      reader.Close();
+
+      if (FAILED(hr))
+      {
+          runner.Fail(name, "decoding failed");
+          return;
+      }
+      runner.Report(result);
+  }
+
+  //**********************************************************************
+  // Decodes the clips given on the command line or, without any, clips
+  // encoded here from the synthetic frames (so their decode cost depends
+  // on the encoder that was available)
+  //**********************************************************************
+  static void RunDecodeBenchmarks(BenchmarkRunner &runner)
+  {
+      const BenchmarkOptions &options = runner.GetOptions();
+      for (size_t i = 0; i < options.clips.size(); i++)
+      {
+          std::string name = "decode." + GetBaseName(options.clips[i]);
+          if (runner.IsSelected(name))
+          {
+              RunDecodeBenchmark(runner, name, options.clips[i]);
+          }
+      }
+      if (!options.clips.empty())
+      {
+          return;
+      }
+
+      for (int i = 0; i < NumBenchmarkResolutions; i++)
+      {
+          const BenchmarkResolution &resolution = BenchmarkResolutions[i];
+          std::string name = std::string("decode.synthetic.h264.") + resolution.name;
+          if (!runner.IsSelected(name))
+          {
+              continue;
+          }
+
+          std::string filename = JoinPath(options.tempDir, std::string("psi-benchmark-") + resolution.name + ".mp4");
+          BenchmarkResult encoded;
+          std::string encoderName;
+          HRESULT hr = EncodeClip(filename, "h264", resolution.width, resolution.height, [](long long frames, double)
+          {
+              return frames < SyntheticClipFrames;
+          }, &encoded, &encoderName);
+          if (SUCCEEDED(hr))
+          {
+              RunDecodeBenchmark(runner, name, filename);
+          }
+          else
+          {
+              runner.Fail(name, "can't encode the synthetic clip");
+          }
+          remove(filename.c_str());
+      }
+  }
+
+  //**********************************************************************
+  void RunCodecBenchmarks(BenchmarkRunner &runner)
+  {
+      // Registers FFMPEG's codecs and formats, which the writer relies on
+      FFMPEGReaderNative registration;
+      registration.Initialize(24, 0, 0);
+
+      RunEncodeBenchmarks(runner);
+      RunDecodeBenchmarks(runner);
+  }
+}}}}
+
+#else // USE_FFMPEG
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Benchmark {
+
+  //**********************************************************************
+  void RunCodecBenchmarks(BenchmarkRunner &)
+  {
+      fprintf(stderr, "Built without FFMPEG: skipping the decode and encode benchmarks\n");
+  }
+}}}}
+
+#endif // USE_FFMPEG
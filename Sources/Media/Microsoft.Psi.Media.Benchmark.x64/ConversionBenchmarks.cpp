@@ -0,0 +1,187 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "MediaBenchmark.h"
+#include "MediaConversion.h"
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Benchmark {
+
+  //**********************************************************************
+  // The camera capture conversions: SourceReaderCallback on Windows and
+  // V4L2CaptureNative on Linux turn YUY2, UYVY and NV12 (which the MJPEG
+  // decoder also produces) frames into BGR24 images.
+  //**********************************************************************
+  static void RunCaptureBenchmarks(BenchmarkRunner &runner, const BenchmarkResolution &resolution)
+  {
+      std::string suffix = std::string(".") + resolution.name;
+      if (!runner.IsAnySelected({ "capture.YUY2ToBGR24" + suffix, "capture.UYVYToBGR24" + suffix, "capture.NV12ToBGR24" + suffix }))
+      {
+          return;
+      }
+
+      int w = resolution.width;
+      int h = resolution.height;
+      std::vector<uint8_t> src(w * h * 2);
+      std::vector<uint8_t> dst(w * h * 3);
+      FillRandom(src, 1);
+
+      runner.RunFrames("capture.YUY2ToBGR24" + suffix, w, h, [&]
+      {
+          Conversion::ConvertYUY2ToBGR24(src.data(), w * 2, dst.data(), w * 3, w, h);
+      });
+      runner.RunFrames("capture.UYVYToBGR24" + suffix, w, h, [&]
+      {
+          Conversion::ConvertUYVYToBGR24(src.data(), w * 2, dst.data(), w * 3, w, h);
+      });
+      runner.RunFrames("capture.NV12ToBGR24" + suffix, w, h, [&]
+      {
+          // The chroma plane follows the luma plane, as in MF's NV12 buffers
+          Conversion::ConvertNV12ToBGR24(src.data(), w, src.data() + w * h, w, dst.data(), w * 3, w, h);
+      });
+  }
+
+  //**********************************************************************
+  // MP4WriterUnmanagedData::CopyImageDataToMediaBuffer(): Psi images are
+  // converted to NV12 for the encoder, or copied as is when the encoder
+  // takes the image's own format. The conversions are the ones it calls;
+  // the writer itself is C++/CLI and can't be driven from here.
+  //**********************************************************************
+  static void RunMP4WriterBenchmarks(BenchmarkRunner &runner, const BenchmarkResolution &resolution)
+  {
+      static const struct
+      {
+          const char *name;
+          int pixelFormat;
+      } formats[] =
+      {
+          { "BGRA32", Conversion::ConversionPixelFormat_BGRA_32bpp },
+          { "BGR24", Conversion::ConversionPixelFormat_BGR_24bpp },
+          { "Gray8", Conversion::ConversionPixelFormat_Gray_8bpp },
+          { "Gray16", Conversion::ConversionPixelFormat_Gray_16bpp },
+      };
+
+      const int numFormats = sizeof(formats) / sizeof(formats[0]);
+      std::string suffix = std::string(".") + resolution.name;
+      std::vector<std::string> names;
+      for (int i = 0; i < numFormats; i++)
+      {
+          names.push_back(std::string("mp4writer.") + formats[i].name + "ToNV12" + suffix);
+      }
+      names.push_back("mp4writer.CopyBGRA32" + suffix);
+      if (!runner.IsAnySelected(names))
+      {
+          return;
+      }
+
+      int w = resolution.width;
+      int h = resolution.height;
+      std::vector<uint8_t> src(w * h * 4);
+      std::vector<uint8_t> dst(w * h * 4);
+      FillRandom(src, 2);
+
+      for (int i = 0; i < numFormats; i++)
+      {
+          int pixelFormat = formats[i].pixelFormat;
+          int stride = w * Conversion::GetBytesPerPixel(pixelFormat);
+          runner.RunFrames(names[i], w, h, [&]
+          {
+              Conversion::ConvertToNV12(src.data(), stride, pixelFormat, dst.data(), w, dst.data() + w * h, w, w, h);
+          });
+      }
+      runner.RunFrames(names[numFormats], w, h, [&]
+      {
+          Conversion::CopyRows(src.data(), w * 4, dst.data(), w * 4, w * 4, h);
+      });
+  }
+
+  //**********************************************************************
+  // RealSenseDeviceUnmanaged::CopyFrameset(): the RGB to BGR swizzle of
+  // color frames, into a destination with 4 byte aligned rows, and the
+  // copy of the 16-bit depth frame
+  //**********************************************************************
+  static void RunRealSenseBenchmarks(BenchmarkRunner &runner, const BenchmarkResolution &resolution)
+  {
+      std::string suffix = std::string(".") + resolution.name;
+      if (!runner.IsAnySelected({ "realsense.RGB24ToBGR24" + suffix, "realsense.RGBA32ToBGRA32" + suffix, "realsense.CopyDepth16" + suffix }))
+      {
+          return;
+      }
+
+      int w = resolution.width;
+      int h = resolution.height;
+      int bgrStride = (w * 3 + 3) & ~3;
+      std::vector<uint8_t> src(w * h * 4);
+      std::vector<uint8_t> dst(w * h * 4);
+      FillRandom(src, 3);
+
+      runner.RunFrames("realsense.RGB24ToBGR24" + suffix, w, h, [&]
+      {
+          Conversion::ConvertRGB24ToBGR24(src.data(), w * 3, dst.data(), bgrStride, w, h);
+      });
+      runner.RunFrames("realsense.RGBA32ToBGRA32" + suffix, w, h, [&]
+      {
+          Conversion::ConvertRGBA32ToBGRA32(src.data(), w * 4, dst.data(), w * 4, w, h);
+      });
+      runner.RunFrames("realsense.CopyDepth16" + suffix, w, h, [&]
+      {
+          Conversion::CopyRows(src.data(), w * 2, dst.data(), w * 2, w * 2, h);
+      });
+  }
+
+  //**********************************************************************
+  // FFMPEGAudioConverter: decoded float audio to 16-bit PCM, one AAC frame
+  // (1024 samples per channel) at a time, and interleaving of planar
+  // multichannel audio
+  //**********************************************************************
+  static void RunAudioBenchmarks(BenchmarkRunner &runner)
+  {
+      const int samples = 1024;
+      std::vector<float> left(samples);
+      std::vector<float> right(samples);
+      std::vector<int16_t> output(samples * 2);
+      for (int i = 0; i < samples; i++)
+      {
+          // A little over full scale, so that the clamping is exercised
+          left[i] = 1.2f * (float)((i * 37) % 200 - 100) / 100.0f;
+          right[i] = -left[i];
+      }
+
+      runner.RunFrames("audio.FloatToInt16", samples, 1, [&]
+      {
+          Conversion::ConvertFloatToInt16(left.data(), output.data(), samples);
+      });
+      runner.RunFrames("audio.StereoFloatToInt16", samples, 2, [&]
+      {
+          Conversion::ConvertStereoFloatToInt16(left.data(), right.data(), output.data(), samples);
+      });
+
+      // 5.1 planar 16-bit audio, the multichannel layout decoders produce
+      const int channels = 6;
+      std::vector<int16_t> planeData(samples * channels);
+      std::vector<const int16_t*> planes(channels);
+      std::vector<int16_t> interleaved(samples * channels);
+      for (int c = 0; c < channels; c++)
+      {
+          planes[c] = planeData.data() + c * samples;
+      }
+      runner.RunFrames("audio.Interleave5.1Int16", samples, channels, [&]
+      {
+          Conversion::InterleaveInt16(planes.data(), channels, samples, interleaved.data());
+      });
+  }
+
+  //**********************************************************************
+  void RunConversionBenchmarks(BenchmarkRunner &runner)
+  {
+      for (int i = 0; i < NumBenchmarkResolutions; i++)
+      {
+          RunCaptureBenchmarks(runner, BenchmarkResolutions[i]);
+          RunMP4WriterBenchmarks(runner, BenchmarkResolutions[i]);
+          RunRealSenseBenchmarks(runner, BenchmarkResolutions[i]);
+      }
+      RunAudioBenchmarks(runner);
+  }
+}}}}
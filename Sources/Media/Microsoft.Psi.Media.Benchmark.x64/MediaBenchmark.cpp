@@ -0,0 +1,394 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+// Micro-benchmarks for the native media paths: decoding and encoding
+// through FFMPEGReaderNative and FFMPEGWriterNative, and the capture, MP4
+// writer, RealSense and audio conversions in Microsoft.Psi.Media.Conversion.
+// Each benchmark writes one line (JSON, or CSV with --csv) with its frame
+// rate, time per pixel, heap allocations per frame and the process' peak
+// RSS so far. Run a single benchmark (--filter) for a peak RSS of its own.
+
+#include "MediaBenchmark.h"
+#include "MediaConversion.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#include <crtdbg.h>
+#else
+#include <sys/resource.h>
+#endif
+
+//**********************************************************************
+// Allocation counting. With glibc the benchmark replaces malloc() and
+// friends with wrappers around glibc's own allocator, which catches every
+// allocation in the process: ours, FFMPEG's and the native media
+// library's. On Windows each module has its own operator new, so we can
+// only hook the shared debug CRT heap; Release builds don't count.
+//**********************************************************************
+static std::atomic<long long> allocationCount(0);
+
+#if defined(__GLIBC__)
+extern "C" {
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void *__libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void *ptr);
+
+    void *malloc(size_t size) noexcept
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t count, size_t size) noexcept
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_calloc(count, size);
+    }
+
+    // Every realloc() counts, since growing a buffer usually moves it
+    void *realloc(void *ptr, size_t size) noexcept
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_realloc(ptr, size);
+    }
+
+    void *memalign(size_t alignment, size_t size) noexcept
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_memalign(alignment, size);
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size) noexcept
+    {
+        return memalign(alignment, size);
+    }
+
+    int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept
+    {
+        if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0)
+        {
+            return EINVAL;
+        }
+        void *result = memalign(alignment, size);
+        if (result == nullptr)
+        {
+            return ENOMEM;
+        }
+        *ptr = result;
+        return 0;
+    }
+
+    void free(void *ptr) noexcept
+    {
+        __libc_free(ptr);
+    }
+}
+#define PSI_BENCHMARK_COUNTS_ALLOCATIONS
+#elif defined(_WIN32) && defined(_DEBUG)
+static int CountAllocation(int allocType, void*, size_t, int, long, const unsigned char*, int)
+{
+    if (allocType == _HOOK_ALLOC || allocType == _HOOK_REALLOC)
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    return TRUE;
+}
+#define PSI_BENCHMARK_COUNTS_ALLOCATIONS
+#endif
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Benchmark {
+
+  const BenchmarkResolution BenchmarkResolutions[] =
+  {
+      { "480p", 640, 480 },
+      { "720p", 1280, 720 },
+      { "1080p", 1920, 1080 },
+      { "2160p", 3840, 2160 },
+  };
+  const int NumBenchmarkResolutions = sizeof(BenchmarkResolutions) / sizeof(BenchmarkResolutions[0]);
+
+  //**********************************************************************
+  long long GetAllocationCount()
+  {
+#ifdef PSI_BENCHMARK_COUNTS_ALLOCATIONS
+      return allocationCount.load(std::memory_order_relaxed);
+#else
+      return -1;
+#endif
+  }
+
+  //**********************************************************************
+  long long GetPeakRssKB()
+  {
+#ifdef _WIN32
+      PROCESS_MEMORY_COUNTERS counters;
+      if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+      {
+          return -1;
+      }
+      return (long long)(counters.PeakWorkingSetSize / 1024);
+#else
+      struct rusage usage;
+      if (getrusage(RUSAGE_SELF, &usage) != 0)
+      {
+          return -1;
+      }
+      return usage.ru_maxrss; /* Already in KB on Linux */
+#endif
+  }
+
+  //**********************************************************************
+  // xorshift32, so that every run converts the same data
+  //**********************************************************************
+  void FillRandom(std::vector<uint8_t> &buffer, uint32_t seed)
+  {
+      uint32_t state = (seed != 0) ? seed : 1;
+      for (size_t i = 0; i < buffer.size(); i++)
+      {
+          state ^= state << 13;
+          state ^= state >> 17;
+          state ^= state << 5;
+          buffer[i] = (uint8_t)state;
+      }
+  }
+
+  //**********************************************************************
+  BenchmarkRunner::BenchmarkRunner(const BenchmarkOptions &options, FILE *output) :
+      options(options),
+      output(output),
+      numFailed(0)
+  {
+      if (options.csv)
+      {
+          fprintf(output, "benchmark,width,height,frames,seconds,fps,nsPerPixel,allocsPerFrame,peakRssKB\n");
+          fflush(output);
+      }
+  }
+
+  //**********************************************************************
+  bool BenchmarkRunner::IsSelected(const std::string &name) const
+  {
+      if (options.filters.empty())
+      {
+          return true;
+      }
+      for (size_t i = 0; i < options.filters.size(); i++)
+      {
+          if (name.find(options.filters[i]) != std::string::npos)
+          {
+              return true;
+          }
+      }
+      return false;
+  }
+
+  //**********************************************************************
+  bool BenchmarkRunner::IsAnySelected(const std::vector<std::string> &names) const
+  {
+      for (size_t i = 0; i < names.size(); i++)
+      {
+          if (IsSelected(names[i]))
+          {
+              return true;
+          }
+      }
+      return false;
+  }
+
+  //**********************************************************************
+  // Escapes the characters JSON strings can't hold as is. Benchmark names
+  // include clip file names, which may contain anything.
+  //**********************************************************************
+  static std::string EscapeJson(const std::string &text)
+  {
+      std::string escaped;
+      for (size_t i = 0; i < text.size(); i++)
+      {
+          char c = text[i];
+          if (c == '"' || c == '\\')
+          {
+              escaped += '\\';
+              escaped += c;
+          }
+          else if ((unsigned char)c < 0x20)
+          {
+              char code[8];
+              snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+              escaped += code;
+          }
+          else
+          {
+              escaped += c;
+          }
+      }
+      return escaped;
+  }
+
+  //**********************************************************************
+  void BenchmarkRunner::Report(const BenchmarkResult &result)
+  {
+      double seconds = (result.seconds > 0) ? result.seconds : 1e-9;
+      double fps = result.frames / seconds;
+      double pixels = (double)result.frames * result.width * result.height;
+      double nsPerPixel = (pixels > 0) ? seconds * 1e9 / pixels : 0;
+      double allocsPerFrame = (result.allocations < 0 || result.frames == 0) ? -1 : (double)result.allocations / result.frames;
+      long long peakRss = GetPeakRssKB();
+      if (options.csv)
+      {
+          fprintf(output, "%s,%d,%d,%lld,%.6f,%.3f,%.4f,%.3f,%lld\n",
+              result.name.c_str(), result.width, result.height, result.frames, result.seconds, fps, nsPerPixel, allocsPerFrame, peakRss);
+      }
+      else
+      {
+          char allocs[32] = "null";
+          if (allocsPerFrame >= 0)
+          {
+              snprintf(allocs, sizeof(allocs), "%.3f", allocsPerFrame);
+          }
+          fprintf(output, "{\"benchmark\":\"%s\",\"width\":%d,\"height\":%d,\"frames\":%lld,\"seconds\":%.6f,\"fps\":%.3f,\"nsPerPixel\":%.4f,\"allocsPerFrame\":%s,\"peakRssKB\":%lld}\n",
+              EscapeJson(result.name).c_str(), result.width, result.height, result.frames, result.seconds, fps, nsPerPixel, allocs, peakRss);
+      }
+      fflush(output);
+      fprintf(stderr, "%-40s %10.1f fps %9.4f ns/pixel\n", result.name.c_str(), fps, nsPerPixel);
+  }
+
+  //**********************************************************************
+  void BenchmarkRunner::Fail(const std::string &name, const char *reason)
+  {
+      numFailed++;
+      if (!options.csv)
+      {
+          fprintf(output, "{\"benchmark\":\"%s\",\"error\":\"%s\"}\n", EscapeJson(name).c_str(), EscapeJson(reason).c_str());
+          fflush(output);
+      }
+      fprintf(stderr, "%-40s FAILED: %s\n", name.c_str(), reason);
+  }
+}}}}
+
+using namespace Microsoft::Psi::Media;
+using namespace Microsoft::Psi::Media::Benchmark;
+
+static void PrintUsage()
+{
+    fprintf(stderr,
+        "Usage: Microsoft.Psi.Media.Benchmark [options]\n"
+        "  --filter <text>   Only run benchmarks whose name contains <text> (repeatable)\n"
+        "  --clip <file>     Decode <file> rather than the synthetic clips (repeatable)\n"
+        "  --seconds <s>     Minimum time per benchmark (default 1)\n"
+        "  --frames <n>      Minimum frames per benchmark (default 10)\n"
+        "  --threads <n>     Threads for tiled conversions (default: library default, 1 = off)\n"
+        "  --temp <dir>      Directory for encoded output and synthetic clips\n"
+        "  --output <file>   Write the results to <file> rather than stdout\n"
+        "  --csv             Write CSV rather than JSON lines\n");
+}
+
+static std::string GetDefaultTempDir()
+{
+#ifdef _WIN32
+    char path[MAX_PATH + 1];
+    DWORD length = GetTempPathA(sizeof(path), path);
+    if (length > 0 && length <= MAX_PATH)
+    {
+        return std::string(path, length);
+    }
+    return ".";
+#else
+    const char *tmp = getenv("TMPDIR");
+    return (tmp != nullptr && tmp[0] != '\0') ? tmp : "/tmp";
+#endif
+}
+
+int main(int argc, char **argv)
+{
+#if defined(_WIN32) && defined(_DEBUG)
+    _CrtSetAllocHook(CountAllocation);
+#endif
+
+    BenchmarkOptions options;
+    options.tempDir = GetDefaultTempDir();
+    options.minSeconds = 1.0;
+    options.minFrames = 10;
+    options.tilingThreads = 0;
+    options.csv = false;
+    const char *outputPath = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--filter" && hasValue)
+        {
+            options.filters.push_back(argv[++i]);
+        }
+        else if (arg == "--clip" && hasValue)
+        {
+            options.clips.push_back(argv[++i]);
+        }
+        else if (arg == "--seconds" && hasValue)
+        {
+            options.minSeconds = atof(argv[++i]);
+        }
+        else if (arg == "--frames" && hasValue)
+        {
+            options.minFrames = atoi(argv[++i]);
+        }
+        else if (arg == "--threads" && hasValue)
+        {
+            options.tilingThreads = atoi(argv[++i]);
+        }
+        else if (arg == "--temp" && hasValue)
+        {
+            options.tempDir = argv[++i];
+        }
+        else if (arg == "--output" && hasValue)
+        {
+            outputPath = argv[++i];
+        }
+        else if (arg == "--csv")
+        {
+            options.csv = true;
+        }
+        else
+        {
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    FILE *output = stdout;
+    if (outputPath != nullptr)
+    {
+        output = fopen(outputPath, "w");
+        if (output == nullptr)
+        {
+            fprintf(stderr, "Can't open %s: %s\n", outputPath, strerror(errno));
+            return 2;
+        }
+    }
+
+    if (options.tilingThreads != 0)
+    {
+        Conversion::SetTiling(options.tilingThreads, 0);
+    }
+
+    BenchmarkRunner runner(options, output);
+    RunConversionBenchmarks(runner);
+    RunCodecBenchmarks(runner);
+
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+    return (runner.GetNumFailed() == 0) ? 0 : 1;
+}
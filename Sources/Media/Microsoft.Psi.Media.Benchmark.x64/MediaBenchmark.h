@@ -0,0 +1,146 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Benchmark {
+
+  //**********************************************************************
+  // Command line settings shared by all of the benchmarks
+  //**********************************************************************
+  struct BenchmarkOptions
+  {
+      std::vector<std::string> filters;   /* Only benchmarks whose name contains one of these run (all if empty) */
+      std::vector<std::string> clips;     /* Reference clips for the decode benchmarks (synthetic clips if empty) */
+      std::string tempDir;                /* Where encoded and synthetic clips are written */
+      double minSeconds;                  /* Each benchmark runs for at least this long ... */
+      int minFrames;                      /* ... and at least this many frames */
+      int tilingThreads;                  /* Passed to Conversion::SetTiling() (0 = library default) */
+      bool csv;                           /* Report CSV rather than JSON lines */
+  };
+
+  //**********************************************************************
+  // One line of benchmark output. For the audio benchmarks a "pixel" is a
+  // sample and the frame size is samples x channels.
+  //   allocations - heap allocations made while timing, or -1 if they
+  //                 can't be counted in this build (see MediaBenchmark.cpp)
+  //**********************************************************************
+  struct BenchmarkResult
+  {
+      std::string name;
+      int width;
+      int height;
+      long long frames;
+      double seconds;
+      long long allocations;
+  };
+
+  //**********************************************************************
+  // Process wide measurements
+  //   GetAllocationCount - heap allocations so far, or -1 if not counted
+  //   GetPeakRssKB - peak resident set (working set on Windows) so far
+  //**********************************************************************
+  long long GetAllocationCount();
+  long long GetPeakRssKB();
+
+  // Returns the current time in seconds, from an arbitrary origin
+  inline double GetSeconds()
+  {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  //**********************************************************************
+  // BenchmarkRunner selects, times and reports the benchmarks. Results go
+  // to 'output' as they finish, one line each; progress and errors go to
+  // stderr so the output stays machine-readable.
+  //**********************************************************************
+  class BenchmarkRunner
+  {
+      BenchmarkOptions options;
+      FILE *output;
+      int numFailed;
+
+  public:
+      BenchmarkRunner(const BenchmarkOptions &options, FILE *output);
+      const BenchmarkOptions &GetOptions() const { return options; }
+      int GetNumFailed() const { return numFailed; }
+
+      // Returns true if a benchmark of this name (or any of these names) should run
+      bool IsSelected(const std::string &name) const;
+      bool IsAnySelected(const std::vector<std::string> &names) const;
+
+      // Writes out 'result' with its rates and the peak RSS so far
+      void Report(const BenchmarkResult &result);
+
+      // Reports that a benchmark could not run
+      void Fail(const std::string &name, const char *reason);
+
+      //**********************************************************************
+      // Times runFrame() until both the minimum time and the minimum number
+      // of frames are reached. The first call is an untimed warm-up, so that
+      // one-off work (kernel selection, starting the tiling pool, touching
+      // the buffers) isn't counted.
+      //**********************************************************************
+      template <typename FrameFunc>
+      void RunFrames(const std::string &name, int width, int height, const FrameFunc &runFrame)
+      {
+          if (!IsSelected(name))
+          {
+              return;
+          }
+          runFrame();
+
+          BenchmarkResult result;
+          result.name = name;
+          result.width = width;
+          result.height = height;
+          result.frames = 0;
+          long long startAllocations = GetAllocationCount();
+          double start = GetSeconds();
+          double elapsed;
+          do
+          {
+              runFrame();
+              result.frames++;
+              elapsed = GetSeconds() - start;
+          } while (elapsed < options.minSeconds || result.frames < options.minFrames);
+          result.seconds = elapsed;
+          result.allocations = (startAllocations < 0) ? -1 : GetAllocationCount() - startAllocations;
+          Report(result);
+      }
+  };
+
+  //**********************************************************************
+  // Frame sizes the image benchmarks run at
+  //**********************************************************************
+  struct BenchmarkResolution
+  {
+      const char *name;
+      int width;
+      int height;
+  };
+  extern const BenchmarkResolution BenchmarkResolutions[];
+  extern const int NumBenchmarkResolutions;
+
+  // Fills 'buffer' with repeatable pseudo-random bytes
+  void FillRandom(std::vector<uint8_t> &buffer, uint32_t seed);
+
+  //**********************************************************************
+  // Benchmark suites
+  //   RunConversionBenchmarks - the capture, MP4 writer, RealSense and
+  //                             audio conversions in Microsoft.Psi.Media.Conversion
+  //   RunCodecBenchmarks - FFMPEGReaderNative decoding and FFMPEGWriterNative
+  //                        encoding (only in builds with USE_FFMPEG)
+  //**********************************************************************
+  void RunConversionBenchmarks(BenchmarkRunner &runner);
+  void RunCodecBenchmarks(BenchmarkRunner &runner);
+}}}}
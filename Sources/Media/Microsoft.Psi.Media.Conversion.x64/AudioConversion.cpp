@@ -0,0 +1,383 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "MediaConversionInternal.h"
+#include <string.h>
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Conversion {
+
+  typedef void (*ConvertFloatToInt16Func)(const float *input, int16_t *output, int count);
+  typedef void (*ConvertStereoFloatToInt16Func)(const float *left, const float *right, int16_t *output, int count);
+  typedef void (*InterleaveInt16Func)(const int16_t *const *planes, int numChannels, int count, int16_t *output);
+
+  //**********************************************************************
+  // Scalar kernels. Used for the tails of the vector loops and on CPUs
+  // without any of the vector extensions below.
+  //**********************************************************************
+  static inline int16_t ConvertSample(float sample)
+  {
+      if (sample < -1.0f)
+      {
+          sample = -1.0f;
+      }
+      else if (sample > +1.0f)
+      {
+          sample = +1.0f;
+      }
+      return (int16_t)(sample * 32767.0f);
+  }
+
+  static void ConvertFloatToInt16Scalar(const float *input, int16_t *output, int count)
+  {
+      for (int i = 0; i < count; i++)
+      {
+          output[i] = ConvertSample(input[i]);
+      }
+  }
+
+  static void ConvertStereoFloatToInt16Scalar(const float *left, const float *right, int16_t *output, int count)
+  {
+      for (int i = 0; i < count; i++)
+      {
+          output[2 * i + 0] = ConvertSample(left[i]);
+          output[2 * i + 1] = ConvertSample(right[i]);
+      }
+  }
+
+  // Interleaves samples [start, count) of each plane into 'output', which
+  // points at the first of those samples
+  static void InterleaveInt16Range(const int16_t *const *planes, int numChannels, int start, int count, int16_t *output)
+  {
+      for (int i = start; i < count; i++)
+      {
+          for (int c = 0; c < numChannels; c++)
+          {
+              output[c] = planes[c][i];
+          }
+          output += numChannels;
+      }
+  }
+
+  static void InterleaveInt16Scalar(const int16_t *const *planes, int numChannels, int count, int16_t *output)
+  {
+      InterleaveInt16Range(planes, numChannels, 0, count, output);
+  }
+
+#ifdef PSI_CONVERSION_X86
+  //**********************************************************************
+  // SSE2 kernels (always available on x64). Clamp, scale and truncate 8
+  // samples at a time, matching the scalar conversion exactly.
+  //**********************************************************************
+  static inline __m128i ConvertFloat8SSE2(const float *input)
+  {
+      const __m128 minValue = _mm_set1_ps(-1.0f);
+      const __m128 maxValue = _mm_set1_ps(+1.0f);
+      const __m128 scale = _mm_set1_ps(32767.0f);
+      __m128 a = _mm_loadu_ps(input);
+      __m128 b = _mm_loadu_ps(input + 4);
+      a = _mm_mul_ps(_mm_min_ps(_mm_max_ps(a, minValue), maxValue), scale);
+      b = _mm_mul_ps(_mm_min_ps(_mm_max_ps(b, minValue), maxValue), scale);
+      return _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+  }
+
+  static void ConvertFloatToInt16SSE2(const float *input, int16_t *output, int count)
+  {
+      int i = 0;
+      for (; i + 8 <= count; i += 8)
+      {
+          _mm_storeu_si128((__m128i*)(output + i), ConvertFloat8SSE2(input + i));
+      }
+      ConvertFloatToInt16Scalar(input + i, output + i, count - i);
+  }
+
+  static void ConvertStereoFloatToInt16SSE2(const float *left, const float *right, int16_t *output, int count)
+  {
+      int i = 0;
+      for (; i + 8 <= count; i += 8)
+      {
+          __m128i l = ConvertFloat8SSE2(left + i);
+          __m128i r = ConvertFloat8SSE2(right + i);
+          _mm_storeu_si128((__m128i*)(output + 2 * i), _mm_unpacklo_epi16(l, r));
+          _mm_storeu_si128((__m128i*)(output + 2 * i + 8), _mm_unpackhi_epi16(l, r));
+      }
+      ConvertStereoFloatToInt16Scalar(left + i, right + i, output + 2 * i, count - i);
+  }
+
+  //**********************************************************************
+  // Interleaves 8 samples of each channel at a time. Each group of 4
+  // channels is transposed into one 64-bit run per sample, and a leftover
+  // pair into one 32-bit run per sample; with exactly 4 channels the runs
+  // are contiguous and are stored 128 bits at a time.
+  //**********************************************************************
+  static inline void StoreInt32(int16_t *output, __m128i value)
+  {
+      int32_t pair = _mm_cvtsi128_si32(value);
+      memcpy(output, &pair, sizeof(pair));
+  }
+
+  static void InterleaveInt16SSE2(const int16_t *const *planes, int numChannels, int count, int16_t *output)
+  {
+      int i = 0;
+      for (; i + 8 <= count; i += 8)
+      {
+          int16_t *out = output + (size_t)i * numChannels;
+          int c = 0;
+          for (; c + 4 <= numChannels; c += 4)
+          {
+              __m128i a = _mm_loadu_si128((const __m128i*)(planes[c + 0] + i));
+              __m128i b = _mm_loadu_si128((const __m128i*)(planes[c + 1] + i));
+              __m128i d = _mm_loadu_si128((const __m128i*)(planes[c + 2] + i));
+              __m128i e = _mm_loadu_si128((const __m128i*)(planes[c + 3] + i));
+              __m128i ab0 = _mm_unpacklo_epi16(a, b);
+              __m128i ab1 = _mm_unpackhi_epi16(a, b);
+              __m128i de0 = _mm_unpacklo_epi16(d, e);
+              __m128i de1 = _mm_unpackhi_epi16(d, e);
+              __m128i s01 = _mm_unpacklo_epi32(ab0, de0);
+              __m128i s23 = _mm_unpackhi_epi32(ab0, de0);
+              __m128i s45 = _mm_unpacklo_epi32(ab1, de1);
+              __m128i s67 = _mm_unpackhi_epi32(ab1, de1);
+              if (numChannels == 4)
+              {
+                  _mm_storeu_si128((__m128i*)(out + 0), s01);
+                  _mm_storeu_si128((__m128i*)(out + 8), s23);
+                  _mm_storeu_si128((__m128i*)(out + 16), s45);
+                  _mm_storeu_si128((__m128i*)(out + 24), s67);
+              }
+              else
+              {
+                  int16_t *p = out + c;
+                  _mm_storel_epi64((__m128i*)(p + 0 * numChannels), s01);
+                  _mm_storel_epi64((__m128i*)(p + 1 * numChannels), _mm_unpackhi_epi64(s01, s01));
+                  _mm_storel_epi64((__m128i*)(p + 2 * numChannels), s23);
+                  _mm_storel_epi64((__m128i*)(p + 3 * numChannels), _mm_unpackhi_epi64(s23, s23));
+                  _mm_storel_epi64((__m128i*)(p + 4 * numChannels), s45);
+                  _mm_storel_epi64((__m128i*)(p + 5 * numChannels), _mm_unpackhi_epi64(s45, s45));
+                  _mm_storel_epi64((__m128i*)(p + 6 * numChannels), s67);
+                  _mm_storel_epi64((__m128i*)(p + 7 * numChannels), _mm_unpackhi_epi64(s67, s67));
+              }
+          }
+          if (c + 2 <= numChannels)
+          {
+              __m128i a = _mm_loadu_si128((const __m128i*)(planes[c + 0] + i));
+              __m128i b = _mm_loadu_si128((const __m128i*)(planes[c + 1] + i));
+              __m128i ab0 = _mm_unpacklo_epi16(a, b);
+              __m128i ab1 = _mm_unpackhi_epi16(a, b);
+              int16_t *p = out + c;
+              StoreInt32(p + 0 * numChannels, ab0);
+              StoreInt32(p + 1 * numChannels, _mm_srli_si128(ab0, 4));
+              StoreInt32(p + 2 * numChannels, _mm_srli_si128(ab0, 8));
+              StoreInt32(p + 3 * numChannels, _mm_srli_si128(ab0, 12));
+              StoreInt32(p + 4 * numChannels, ab1);
+              StoreInt32(p + 5 * numChannels, _mm_srli_si128(ab1, 4));
+              StoreInt32(p + 6 * numChannels, _mm_srli_si128(ab1, 8));
+              StoreInt32(p + 7 * numChannels, _mm_srli_si128(ab1, 12));
+              c += 2;
+          }
+          if (c < numChannels)
+          {
+              for (int k = 0; k < 8; k++)
+              {
+                  out[k * numChannels + c] = planes[c][i + k];
+              }
+          }
+      }
+      InterleaveInt16Range(planes, numChannels, i, count, output + (size_t)i * numChannels);
+  }
+
+  //**********************************************************************
+  // AVX2 kernels. The 256-bit pack and unpack instructions work within
+  // 128-bit lanes, so the results are permuted back into sample order
+  // before being stored.
+  //**********************************************************************
+  PSI_TARGET_AVX2 static inline __m256i ConvertFloat16AVX2(const float *input)
+  {
+      const __m256 minValue = _mm256_set1_ps(-1.0f);
+      const __m256 maxValue = _mm256_set1_ps(+1.0f);
+      const __m256 scale = _mm256_set1_ps(32767.0f);
+      __m256 a = _mm256_loadu_ps(input);
+      __m256 b = _mm256_loadu_ps(input + 8);
+      a = _mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(a, minValue), maxValue), scale);
+      b = _mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(b, minValue), maxValue), scale);
+      __m256i packed = _mm256_packs_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b));
+      return _mm256_permute4x64_epi64(packed, 0xD8);
+  }
+
+  PSI_TARGET_AVX2 static void ConvertFloatToInt16AVX2(const float *input, int16_t *output, int count)
+  {
+      int i = 0;
+      for (; i + 16 <= count; i += 16)
+      {
+          _mm256_storeu_si256((__m256i*)(output + i), ConvertFloat16AVX2(input + i));
+      }
+      ConvertFloatToInt16SSE2(input + i, output + i, count - i);
+  }
+
+  PSI_TARGET_AVX2 static void ConvertStereoFloatToInt16AVX2(const float *left, const float *right, int16_t *output, int count)
+  {
+      int i = 0;
+      for (; i + 16 <= count; i += 16)
+      {
+          __m256i l = ConvertFloat16AVX2(left + i);
+          __m256i r = ConvertFloat16AVX2(right + i);
+          __m256i lo = _mm256_unpacklo_epi16(l, r);
+          __m256i hi = _mm256_unpackhi_epi16(l, r);
+          _mm256_storeu_si256((__m256i*)(output + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+          _mm256_storeu_si256((__m256i*)(output + 2 * i + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+      }
+      ConvertStereoFloatToInt16SSE2(left + i, right + i, output + 2 * i, count - i);
+  }
+#endif // PSI_CONVERSION_X86
+
+#ifdef PSI_CONVERSION_NEON
+  //**********************************************************************
+  // NEON kernels. vcvtq_s32_f32 truncates like the scalar cast, and vst2q
+  // interleaves the two channels for free.
+  //**********************************************************************
+  static inline int16x8_t ConvertFloat8NEON(const float *input)
+  {
+      const float32x4_t minValue = vdupq_n_f32(-1.0f);
+      const float32x4_t maxValue = vdupq_n_f32(+1.0f);
+      const float32x4_t scale = vdupq_n_f32(32767.0f);
+      float32x4_t a = vld1q_f32(input);
+      float32x4_t b = vld1q_f32(input + 4);
+      a = vmulq_f32(vminq_f32(vmaxq_f32(a, minValue), maxValue), scale);
+      b = vmulq_f32(vminq_f32(vmaxq_f32(b, minValue), maxValue), scale);
+      return vcombine_s16(vqmovn_s32(vcvtq_s32_f32(a)), vqmovn_s32(vcvtq_s32_f32(b)));
+  }
+
+  static void ConvertFloatToInt16NEON(const float *input, int16_t *output, int count)
+  {
+      int i = 0;
+      for (; i + 8 <= count; i += 8)
+      {
+          vst1q_s16(output + i, ConvertFloat8NEON(input + i));
+      }
+      ConvertFloatToInt16Scalar(input + i, output + i, count - i);
+  }
+
+  static void ConvertStereoFloatToInt16NEON(const float *left, const float *right, int16_t *output, int count)
+  {
+      int i = 0;
+      for (; i + 8 <= count; i += 8)
+      {
+          int16x8x2_t samples;
+          samples.val[0] = ConvertFloat8NEON(left + i);
+          samples.val[1] = ConvertFloat8NEON(right + i);
+          vst2q_s16(output + 2 * i, samples);
+      }
+      ConvertStereoFloatToInt16Scalar(left + i, right + i, output + 2 * i, count - i);
+  }
+
+  //**********************************************************************
+  // Interleaves 4 samples of each channel at a time: vst4_lane stores one
+  // sample of a group of 4 channels, vst2_lane one of a leftover pair.
+  //**********************************************************************
+  static void InterleaveInt16NEON(const int16_t *const *planes, int numChannels, int count, int16_t *output)
+  {
+      int i = 0;
+      for (; i + 4 <= count; i += 4)
+      {
+          int16_t *out = output + (size_t)i * numChannels;
+          int c = 0;
+          for (; c + 4 <= numChannels; c += 4)
+          {
+              int16x4x4_t samples;
+              samples.val[0] = vld1_s16(planes[c + 0] + i);
+              samples.val[1] = vld1_s16(planes[c + 1] + i);
+              samples.val[2] = vld1_s16(planes[c + 2] + i);
+              samples.val[3] = vld1_s16(planes[c + 3] + i);
+              int16_t *p = out + c;
+              vst4_lane_s16(p + 0 * numChannels, samples, 0);
+              vst4_lane_s16(p + 1 * numChannels, samples, 1);
+              vst4_lane_s16(p + 2 * numChannels, samples, 2);
+              vst4_lane_s16(p + 3 * numChannels, samples, 3);
+          }
+          if (c + 2 <= numChannels)
+          {
+              int16x4x2_t samples;
+              samples.val[0] = vld1_s16(planes[c + 0] + i);
+              samples.val[1] = vld1_s16(planes[c + 1] + i);
+              int16_t *p = out + c;
+              vst2_lane_s16(p + 0 * numChannels, samples, 0);
+              vst2_lane_s16(p + 1 * numChannels, samples, 1);
+              vst2_lane_s16(p + 2 * numChannels, samples, 2);
+              vst2_lane_s16(p + 3 * numChannels, samples, 3);
+              c += 2;
+          }
+          if (c < numChannels)
+          {
+              for (int k = 0; k < 4; k++)
+              {
+                  out[k * numChannels + c] = planes[c][i + k];
+              }
+          }
+      }
+      InterleaveInt16Range(planes, numChannels, i, count, output + (size_t)i * numChannels);
+  }
+#endif // PSI_CONVERSION_NEON
+
+  //**********************************************************************
+  // AudioKernels holds the best implementation of each kernel for the CPU
+  // we're running on. Chosen once, on first use.
+  //**********************************************************************
+  struct AudioKernels
+  {
+      ConvertFloatToInt16Func convertFloatToInt16;
+      ConvertStereoFloatToInt16Func convertStereoFloatToInt16;
+      InterleaveInt16Func interleaveInt16;
+  };
+
+  static AudioKernels SelectAudioKernels()
+  {
+      AudioKernels kernels = { ConvertFloatToInt16Scalar, ConvertStereoFloatToInt16Scalar, InterleaveInt16Scalar };
+#if defined(PSI_CONVERSION_X86)
+      int cpuLevel = GetCpuLevel();
+      if (cpuLevel >= CpuLevel_SSE2)
+      {
+          kernels.interleaveInt16 = InterleaveInt16SSE2;
+      }
+      if (cpuLevel >= CpuLevel_AVX2)
+      {
+          kernels.convertFloatToInt16 = ConvertFloatToInt16AVX2;
+          kernels.convertStereoFloatToInt16 = ConvertStereoFloatToInt16AVX2;
+      }
+      else if (cpuLevel >= CpuLevel_SSE2)
+      {
+          kernels.convertFloatToInt16 = ConvertFloatToInt16SSE2;
+          kernels.convertStereoFloatToInt16 = ConvertStereoFloatToInt16SSE2;
+      }
+#elif defined(PSI_CONVERSION_NEON)
+      kernels.convertFloatToInt16 = ConvertFloatToInt16NEON;
+      kernels.convertStereoFloatToInt16 = ConvertStereoFloatToInt16NEON;
+      kernels.interleaveInt16 = InterleaveInt16NEON;
+#endif
+      return kernels;
+  }
+
+  static const AudioKernels &GetAudioKernels()
+  {
+      static const AudioKernels kernels = SelectAudioKernels();
+      return kernels;
+  }
+
+  //**********************************************************************
+  void ConvertFloatToInt16(const float *input, int16_t *output, int count)
+  {
+      GetAudioKernels().convertFloatToInt16(input, output, count);
+  }
+
+  //**********************************************************************
+  void ConvertStereoFloatToInt16(const float *left, const float *right, int16_t *output, int count)
+  {
+      GetAudioKernels().convertStereoFloatToInt16(left, right, output, count);
+  }
+
+  //**********************************************************************
+  void InterleaveInt16(const int16_t *const *planes, int numChannels, int count, int16_t *output)
+  {
+      GetAudioKernels().interleaveInt16(planes, numChannels, count, output);
+  }
+}}}}
@@ -0,0 +1,302 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "MediaConversionInternal.h"
+#include <string.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Conversion {
+
+  //**********************************************************************
+  // The result is cached; racing first calls compute the same value, so
+  // no locking is needed.
+  //**********************************************************************
+  int GetCpuLevel()
+  {
+      static volatile int cpuLevel = -1;
+      if (cpuLevel < 0)
+      {
+#if defined(PSI_CONVERSION_X86) && defined(_MSC_VER)
+          int info[4];
+          __cpuid(info, 0);
+          int maxLeaf = info[0];
+          __cpuid(info, 1);
+          bool sse2 = (info[3] & (1 << 26)) != 0;
+          bool ssse3 = (info[2] & (1 << 9)) != 0;
+          bool osxsave = (info[2] & (1 << 27)) != 0;
+          bool avx = (info[2] & (1 << 28)) != 0;
+          bool avx2 = false;
+          if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+          {
+              __cpuidex(info, 7, 0);
+              avx2 = (info[1] & (1 << 5)) != 0;
+          }
+          cpuLevel = avx2 ? CpuLevel_AVX2 : (ssse3 ? CpuLevel_SSSE3 : (sse2 ? CpuLevel_SSE2 : CpuLevel_Scalar));
+#elif defined(PSI_CONVERSION_X86)
+          // __builtin_cpu_supports() also checks that the OS saves the YMM registers
+          __builtin_cpu_init();
+          cpuLevel = __builtin_cpu_supports("avx2") ? CpuLevel_AVX2 :
+              (__builtin_cpu_supports("ssse3") ? CpuLevel_SSSE3 :
+              (__builtin_cpu_supports("sse2") ? CpuLevel_SSE2 : CpuLevel_Scalar));
+#elif defined(PSI_CONVERSION_NEON)
+          cpuLevel = CpuLevel_NEON;
+#else
+          cpuLevel = CpuLevel_Scalar;
+#endif
+      }
+      return cpuLevel;
+  }
+
+  //**********************************************************************
+  int GetBytesPerPixel(int pixelFormat)
+  {
+      switch (pixelFormat)
+      {
+      case ConversionPixelFormat_Gray_8bpp:
+          return 1;
+      case ConversionPixelFormat_Gray_16bpp:
+          return 2;
+      case ConversionPixelFormat_BGR_24bpp:
+          return 3;
+      case ConversionPixelFormat_BGRX_32bpp:
+      case ConversionPixelFormat_BGRA_32bpp:
+          return 4;
+      case ConversionPixelFormat_RGBA_64bpp:
+          return 8;
+      default:
+          return 0;
+      }
+  }
+
+  //**********************************************************************
+  // Tiling settings. Below about 1080p a frame converts in well under a
+  // millisecond on one core and waking workers costs more than it saves.
+  //**********************************************************************
+  static const int DefaultTilingThreads = 4;
+  static const int DefaultTilingMinPixels = 1920 * 1080;
+  static volatile int tilingThreads = DefaultTilingThreads;
+  static volatile int tilingMinPixels = DefaultTilingMinPixels;
+
+  void SetTiling(int maxThreads, int minPixels)
+  {
+      if (maxThreads != 0)
+      {
+          tilingThreads = (maxThreads < 1) ? 1 : maxThreads;
+      }
+      if (minPixels > 0)
+      {
+          tilingMinPixels = minPixels;
+      }
+  }
+
+  //**********************************************************************
+  // TilePool runs the tiles of parallel conversions. Each RunTiles() call
+  // queues a TileJob; idle workers and the calling thread then claim its
+  // tiles one at a time until none are left. Several conversions (e.g.
+  // from different cameras) can share the pool, since a job is only
+  // queued while it has unclaimed tiles and its caller helps run it.
+  //**********************************************************************
+  struct TileJob
+  {
+      TileFunc tileFunc;
+      void *context;
+      int numTiles;
+      int nextTile;               /* Next tile to claim */
+      int pendingTiles;           /* Tiles not finished yet */
+  };
+
+  class TilePool
+  {
+      std::mutex lock;
+      std::condition_variable workAvailable;
+      std::condition_variable tileFinished;
+      std::deque<TileJob*> jobs;
+      int numWorkers;
+
+      // Claims the next tile of the job at the front of the queue, taking
+      // the job off the queue once all of its tiles are claimed. Called
+      // with 'lock' held.
+      TileJob *ClaimTile(int *tile)
+      {
+          TileJob *job = jobs.front();
+          *tile = job->nextTile++;
+          if (job->nextTile == job->numTiles)
+          {
+              jobs.pop_front();
+          }
+          return job;
+      }
+
+      // Marks a tile done. Called with 'lock' held; once pendingTiles
+      // reaches 0 no worker touches the job again, so its caller can return.
+      void FinishTile(TileJob *job)
+      {
+          if (--job->pendingTiles == 0)
+          {
+              tileFinished.notify_all();
+          }
+      }
+
+      void WorkerProc()
+      {
+          std::unique_lock<std::mutex> guard(lock);
+          for (;;)
+          {
+              workAvailable.wait(guard, [this] { return !jobs.empty(); });
+              int tile;
+              TileJob *job = ClaimTile(&tile);
+              guard.unlock();
+              job->tileFunc(job->context, tile);
+              guard.lock();
+              FinishTile(job);
+          }
+      }
+
+  public:
+      explicit TilePool(int workers) :
+          numWorkers(workers)
+      {
+          for (int i = 0; i < workers; i++)
+          {
+              std::thread(&TilePool::WorkerProc, this).detach();
+          }
+      }
+
+      int GetNumWorkers() const
+      {
+          return numWorkers;
+      }
+
+      void Run(TileJob *job)
+      {
+          std::unique_lock<std::mutex> guard(lock);
+          jobs.push_back(job);
+          if (job->numTiles > 2)
+          {
+              workAvailable.notify_all();
+          }
+          else
+          {
+              workAvailable.notify_one();
+          }
+
+          // Work on our own tiles rather than waiting for others to
+          while (job->nextTile < job->numTiles)
+          {
+              int tile = job->nextTile++;
+              if (job->nextTile == job->numTiles)
+              {
+                  for (std::deque<TileJob*>::iterator it = jobs.begin(); it != jobs.end(); ++it)
+                  {
+                      if (*it == job)
+                      {
+                          jobs.erase(it);
+                          break;
+                      }
+                  }
+              }
+              guard.unlock();
+              job->tileFunc(job->context, tile);
+              guard.lock();
+              FinishTile(job);
+          }
+          tileFinished.wait(guard, [job] { return job->pendingTiles == 0; });
+      }
+  };
+
+  //**********************************************************************
+  // The pool is created the first time a frame is tiled and never
+  // destroyed: its workers are detached and just sleep when idle, which
+  // avoids joining threads while a DLL is being unloaded.
+  //**********************************************************************
+  static TilePool *GetTilePool()
+  {
+      static TilePool *pool = nullptr;
+      static std::once_flag created;
+      std::call_once(created, []
+      {
+          int numCores = (int)std::thread::hardware_concurrency();
+          int maxThreads = tilingThreads;
+          int workers = ((numCores < maxThreads) ? numCores : maxThreads) - 1;
+          pool = new TilePool((workers > 0) ? workers : 0);
+      });
+      return pool;
+  }
+
+  //**********************************************************************
+  int GetTileCount(int width, int height)
+  {
+      int maxThreads = tilingThreads;
+      if (maxThreads <= 1 || (long long)width * height < tilingMinPixels)
+      {
+          return 1;
+      }
+
+      int numTiles = GetTilePool()->GetNumWorkers() + 1;
+      if (numTiles > maxThreads)
+      {
+          numTiles = maxThreads;
+      }
+      if (numTiles > height / MinTileRows)
+      {
+          numTiles = height / MinTileRows;
+      }
+      return (numTiles > 1) ? numTiles : 1;
+  }
+
+  //**********************************************************************
+  void RunTiles(int numTiles, TileFunc tileFunc, void *context)
+  {
+      if (numTiles <= 1)
+      {
+          if (numTiles == 1)
+          {
+              tileFunc(context, 0);
+          }
+          return;
+      }
+
+      TileJob job;
+      job.tileFunc = tileFunc;
+      job.context = context;
+      job.numTiles = numTiles;
+      job.nextTile = 0;
+      job.pendingTiles = numTiles;
+      GetTilePool()->Run(&job);
+  }
+
+  //**********************************************************************
+  void CopyRows(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int rowBytes, int height)
+  {
+      if (srcStride == rowBytes && dstStride == rowBytes && GetTileCount(rowBytes / 4, height) <= 1)
+      {
+          memcpy(dst, src, (size_t)rowBytes * height);
+          return;
+      }
+
+      // Tiled by bytes rather than pixels (at 4 bytes per pixel), since the
+      // copy only costs memory bandwidth
+      ForEachBand(rowBytes / 4, height, [=](int firstRow, int endRow)
+      {
+          const uint8_t *srcRow = src + (ptrdiff_t)firstRow * srcStride;
+          uint8_t *dstRow = dst + (ptrdiff_t)firstRow * dstStride;
+          if (srcStride == rowBytes && dstStride == rowBytes)
+          {
+              memcpy(dstRow, srcRow, (size_t)rowBytes * (endRow - firstRow));
+              return;
+          }
+          for (int y = firstRow; y < endRow; y++)
+          {
+              memcpy(dstRow, srcRow, rowBytes);
+              srcRow += srcStride;
+              dstRow += dstStride;
+          }
+      });
+  }
+}}}}
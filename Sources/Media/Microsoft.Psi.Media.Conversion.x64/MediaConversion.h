@@ -0,0 +1,113 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Conversion {
+
+  //**********************************************************************
+  // Pixel and sample format conversions shared by the Media and RealSense
+  // interop modules and the Linux native media library. Everything here
+  // is plain native code with no dependencies beyond the CRT, so this
+  // header can be included from C++/CLI files as well.
+  //
+  // Kernels are picked once at runtime for the CPU we run on (SSE2, SSSE3
+  // or AVX2 on x64, NEON on ARM64, scalar otherwise); all of them produce
+  // identical output. Image conversions of frames at or above the tiling
+  // threshold (see SetTiling()) are split into bands of rows that are
+  // converted in parallel on a shared pool of worker threads.
+  //**********************************************************************
+
+  //**********************************************************************
+  // Pixel formats. NOTE: These must match Microsoft.Psi.Imaging.PixelFormat
+  // (and so the interop modules' NativePixelFormat_* constants).
+  //**********************************************************************
+  static const int ConversionPixelFormat_Undefined = 0;
+  static const int ConversionPixelFormat_Gray_8bpp = 1;
+  static const int ConversionPixelFormat_Gray_16bpp = 2;
+  static const int ConversionPixelFormat_BGR_24bpp = 3;
+  static const int ConversionPixelFormat_BGRX_32bpp = 4;
+  static const int ConversionPixelFormat_BGRA_32bpp = 5;
+  static const int ConversionPixelFormat_RGBA_64bpp = 6;
+
+  // Returns the bytes per pixel of a ConversionPixelFormat_* value (0 if unknown)
+  int GetBytesPerPixel(int pixelFormat);
+
+  //**********************************************************************
+  // Instruction sets the kernels are written for. The x64 levels are
+  // ordered, so a kernel needing SSSE3 may test >= CpuLevel_SSSE3.
+  //**********************************************************************
+  static const int CpuLevel_Scalar = 0;
+  static const int CpuLevel_SSE2 = 1;
+  static const int CpuLevel_SSSE3 = 2;
+  static const int CpuLevel_AVX2 = 3;
+  static const int CpuLevel_NEON = 16;
+
+  // Returns the best instruction set the CPU (and, for AVX2, the OS) supports
+  int GetCpuLevel();
+
+  //**********************************************************************
+  // Sets up the parallel image conversions. Frames of at least 'minPixels'
+  // pixels are converted on up to 'maxThreads' threads (including the
+  // caller's); maxThreads <= 1 turns tiling off and 0 for either keeps the
+  // current value. The defaults are 4 threads from 1920x1080 up.
+  //**********************************************************************
+  void SetTiling(int maxThreads, int minPixels);
+
+  //**********************************************************************
+  // Copies rows of 'rowBytes' bytes between buffers with different strides
+  // (a single memcpy when both are packed)
+  //**********************************************************************
+  void CopyRows(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int rowBytes, int height);
+
+  //**********************************************************************
+  // Conversions from the YUV formats cameras deliver to the BGR24 and
+  // BGRA32 Psi image formats. Input is BT.601 limited range. For NV12
+  // 'srcUV' is the interleaved chroma plane and width and height must be
+  // even; for YUY2 and UYVY width must be even.
+  //**********************************************************************
+  void ConvertYUY2ToBGR24(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height);
+  void ConvertYUY2ToBGRA32(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height);
+  void ConvertUYVYToBGR24(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height);
+  void ConvertUYVYToBGRA32(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height);
+  void ConvertNV12ToBGR24(const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride, uint8_t *dst, int dstStride, int width, int height);
+  void ConvertNV12ToBGRA32(const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride, uint8_t *dst, int dstStride, int width, int height);
+
+  //**********************************************************************
+  // Channel order swaps between RGB and BGR. The swap is its own inverse,
+  // so the same calls convert BGR to RGB.
+  //**********************************************************************
+  void ConvertRGB24ToBGR24(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height);
+  void ConvertRGBA32ToBGRA32(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height);
+
+  //**********************************************************************
+  // Conversions from the Psi image formats to NV12, the video encoders'
+  // native input format. Output is BT.709 limited range; width and height
+  // must be even. ConvertToNV12() picks the conversion for a
+  // ConversionPixelFormat_* value, returning false for formats it can't
+  // convert (Undefined and RGBA_64bpp).
+  //**********************************************************************
+  void ConvertBGRAToNV12(const uint8_t *src, int srcStride, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height);
+  void ConvertBGRToNV12(const uint8_t *src, int srcStride, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height);
+  void ConvertGray8ToNV12(const uint8_t *src, int srcStride, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height);
+  void ConvertGray16ToNV12(const uint8_t *src, int srcStride, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height);
+  bool ConvertToNV12(const uint8_t *src, int srcStride, int pixelFormat, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height);
+
+  //**********************************************************************
+  // Audio sample conversions to 16-bit PCM. Floats are clamped to
+  // [-1, +1], scaled by 32767 and truncated.
+  //   ConvertFloatToInt16 - converts 'count' samples
+  //   ConvertStereoFloatToInt16 - converts and interleaves 'count' samples
+  //                               from each of two planes
+  //   InterleaveInt16 - interleaves 'count' samples from each of
+  //                     'numChannels' 16-bit planes
+  //**********************************************************************
+  void ConvertFloatToInt16(const float *input, int16_t *output, int count);
+  void ConvertStereoFloatToInt16(const float *left, const float *right, int16_t *output, int count);
+  void InterleaveInt16(const int16_t *const *planes, int numChannels, int count, int16_t *output);
+}}}}
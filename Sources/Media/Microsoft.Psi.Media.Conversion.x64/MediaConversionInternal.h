@@ -0,0 +1,96 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "MediaConversion.h"
+#include <stddef.h>
+
+//**********************************************************************
+// Instruction set plumbing shared by the kernel files. MSVC compiles any
+// intrinsic anywhere; GCC and Clang need the functions using (and the
+// inline helpers taking) SSSE3 and AVX2 types marked for that target.
+//**********************************************************************
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PSI_CONVERSION_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PSI_TARGET_SSSE3
+#define PSI_TARGET_AVX2
+#else
+#define PSI_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define PSI_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define PSI_CONVERSION_NEON
+#include <arm_neon.h>
+#endif
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Conversion {
+
+  //**********************************************************************
+  // Returns the number of bands to split a width x height image into: 1
+  // below the tiling threshold, otherwise up to the configured number of
+  // threads, keeping bands at least MinTileRows rows high.
+  //**********************************************************************
+  static const int MinTileRows = 16;
+  int GetTileCount(int width, int height);
+
+  //**********************************************************************
+  // Calls tileFunc(context, tile) for tile = 0 .. numTiles - 1, on the
+  // calling thread and the tiling pool's workers. Returns once all of the
+  // calls have returned.
+  //**********************************************************************
+  typedef void (*TileFunc)(void *context, int tile);
+  void RunTiles(int numTiles, TileFunc tileFunc, void *context);
+
+  //**********************************************************************
+  // ForEachBand() calls convertBand(firstRow, endRow) for bands of rows
+  // covering [0, height), in parallel for large frames. Bands start on
+  // even rows so that 4:2:0 conversions can work on row pairs.
+  //**********************************************************************
+  template <typename BandFunc>
+  struct BandContext
+  {
+      const BandFunc *convertBand;
+      int height;
+      int rowsPerBand;
+  };
+
+  template <typename BandFunc>
+  static void ConvertBand(void *context, int band)
+  {
+      const BandContext<BandFunc> *bands = (const BandContext<BandFunc>*)context;
+      int firstRow = band * bands->rowsPerBand;
+      int endRow = firstRow + bands->rowsPerBand;
+      if (endRow > bands->height)
+      {
+          endRow = bands->height;
+      }
+      if (firstRow < endRow)
+      {
+          (*bands->convertBand)(firstRow, endRow);
+      }
+  }
+
+  template <typename BandFunc>
+  static void ForEachBand(int width, int height, const BandFunc &convertBand)
+  {
+      int numBands = GetTileCount(width, height);
+      if (numBands <= 1)
+      {
+          convertBand(0, height);
+          return;
+      }
+
+      BandContext<BandFunc> bands;
+      bands.convertBand = &convertBand;
+      bands.height = height;
+      bands.rowsPerBand = ((height + numBands - 1) / numBands + 1) & ~1;
+      RunTiles(numBands, ConvertBand<BandFunc>, &bands);
+  }
+}}}}
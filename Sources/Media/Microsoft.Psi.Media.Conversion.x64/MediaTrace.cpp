@@ -0,0 +1,304 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "MediaTrace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Tracing {
+
+  volatile long traceState = 0;
+
+  static const char *const TraceEventNames[NumTraceEvents] =
+  {
+      "FFMPEGReader.NextFrame",
+      "FFMPEGReader.ReadFrameData",
+      "MP4Writer.WriteVideoFrame",
+      "MP4Writer.WriteAudioSample",
+      "MediaCapture.OnReadSample",
+      "RealSense.ReadFrame",
+  };
+
+  // Guards the trace file, and the state derived from it and the ETW sessions
+  static std::mutex traceMutex;
+  static std::once_flag traceInitialized;
+  static FILE *traceFile = nullptr;
+  static bool traceFileEmpty = true;  /* No event written to traceFile yet */
+  static volatile bool etwEnabled = false;
+
+#ifdef _WIN32
+  // The GUID is the ETW hash of the provider name
+  TRACELOGGING_DEFINE_PROVIDER(traceProvider, "Microsoft.Psi.Media",
+      (0x96bba8dd, 0x9edd, 0x5d6f, 0xf2, 0xbb, 0x95, 0xeb, 0xda, 0x19, 0x67, 0x56));
+  static bool providerRegistered = false;
+#endif
+
+  // Called with traceMutex held
+  static void UpdateTraceState()
+  {
+      traceState = (etwEnabled || traceFile != nullptr) ? 2 : 1;
+  }
+
+#ifdef _WIN32
+  //**********************************************************************
+  // Called by ETW as sessions enable and disable the provider (also from
+  // within TraceLoggingRegisterEx() if one already has)
+  //**********************************************************************
+  static void NTAPI EtwEnableCallback(LPCGUID, ULONG isEnabled, UCHAR, ULONGLONG, ULONGLONG, PEVENT_FILTER_DESCRIPTOR, PVOID)
+  {
+      // 2 is a capture state request, which leaves the enabled state as it is
+      if (isEnabled == EVENT_CONTROL_CODE_ENABLE_PROVIDER || isEnabled == EVENT_CONTROL_CODE_DISABLE_PROVIDER)
+      {
+          std::lock_guard<std::mutex> lock(traceMutex);
+          etwEnabled = (isEnabled == EVENT_CONTROL_CODE_ENABLE_PROVIDER);
+          UpdateTraceState();
+      }
+  }
+#endif
+
+  //**********************************************************************
+  // Starts writing events to 'filename', completing any other file first
+  //**********************************************************************
+  static bool OpenTraceFile(const char *filename)
+  {
+      FILE *file = nullptr;
+#ifdef _WIN32
+      if (fopen_s(&file, filename, "w") != 0)
+      {
+          file = nullptr;
+      }
+#else
+      file = fopen(filename, "w");
+#endif
+      if (file == nullptr)
+      {
+          return false;
+      }
+      fputs("[", file);
+
+      FILE *previous;
+      {
+          std::lock_guard<std::mutex> lock(traceMutex);
+          previous = traceFile;
+          traceFile = file;
+          traceFileEmpty = true;
+          UpdateTraceState();
+      }
+      if (previous != nullptr)
+      {
+          fputs("\n]\n", previous);
+          fclose(previous);
+      }
+      return true;
+  }
+
+  //**********************************************************************
+  // Every module linking this library traces on its own, so each one gets
+  // its own file from PSI_MEDIA_TRACE: the name of the module (without
+  // its extension) goes before the extension of the file, e.g.
+  // "trace.json" becomes "trace.Microsoft.Psi.Media.Native.json".
+  //**********************************************************************
+  static std::string GetModuleTraceFileName(const std::string &filename)
+  {
+      std::string module;
+#ifdef _WIN32
+      HMODULE handle = nullptr;
+      char path[MAX_PATH];
+      if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, (LPCSTR)&traceState, &handle))
+      {
+          DWORD length = GetModuleFileNameA(handle, path, MAX_PATH);
+          if (length > 0 && length < MAX_PATH)
+          {
+              module = path;
+          }
+      }
+#else
+      Dl_info info;
+      if (dladdr((const void*)&traceState, &info) != 0 && info.dli_fname != nullptr)
+      {
+          module = info.dli_fname;
+      }
+#endif
+      size_t slash = module.find_last_of("/\\");
+      if (slash != std::string::npos)
+      {
+          module = module.substr(slash + 1);
+      }
+      size_t dot = module.find_last_of('.');
+      if (dot != std::string::npos)
+      {
+          module = module.substr(0, dot);
+      }
+      if (module.empty())
+      {
+          return filename;
+      }
+
+      size_t extension = filename.find_last_of('.');
+      slash = filename.find_last_of("/\\");
+      if (extension == std::string::npos || (slash != std::string::npos && extension < slash))
+      {
+          return filename + "." + module;
+      }
+      return filename.substr(0, extension) + "." + module + filename.substr(extension);
+  }
+
+  //**********************************************************************
+  // Registers the ETW provider and opens this module's file named by
+  // PSI_MEDIA_TRACE. Runs once, on the first IsTraceEnabled() call.
+  //**********************************************************************
+  static void InitializeOnce()
+  {
+#ifdef _WIN32
+      providerRegistered = SUCCEEDED(TraceLoggingRegisterEx(traceProvider, EtwEnableCallback, nullptr));
+      char filename[MAX_PATH];
+      DWORD length = GetEnvironmentVariableA("PSI_MEDIA_TRACE", filename, MAX_PATH);
+      if (length > 0 && length < MAX_PATH)
+      {
+          OpenTraceFile(GetModuleTraceFileName(filename).c_str());
+      }
+#else
+      const char *filename = getenv("PSI_MEDIA_TRACE");
+      if (filename != nullptr && filename[0] != '\0')
+      {
+          OpenTraceFile(GetModuleTraceFileName(filename).c_str());
+      }
+#endif
+
+      std::lock_guard<std::mutex> lock(traceMutex);
+      UpdateTraceState();
+  }
+
+  //**********************************************************************
+  bool InitializeTracing()
+  {
+      std::call_once(traceInitialized, InitializeOnce);
+      return traceState == 2;
+  }
+
+  //**********************************************************************
+  // Completes the trace file and unregisters the provider when the module
+  // is unloaded (ETW must not call back into a module that has gone)
+  //**********************************************************************
+  static struct TraceShutdown
+  {
+      ~TraceShutdown()
+      {
+          StopTraceFile();
+#ifdef _WIN32
+          if (providerRegistered)
+          {
+              TraceLoggingUnregister(traceProvider);
+              providerRegistered = false;
+          }
+#endif
+      }
+  } traceShutdown;
+
+  //**********************************************************************
+  int64_t GetTraceTime()
+  {
+      return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  //**********************************************************************
+  bool StartTraceFile(const char *filename)
+  {
+      // The provider has to be registered even if the file is all that's asked for
+      InitializeTracing();
+      return OpenTraceFile(filename);
+  }
+
+  //**********************************************************************
+  void StopTraceFile()
+  {
+      FILE *file;
+      {
+          std::lock_guard<std::mutex> lock(traceMutex);
+          file = traceFile;
+          traceFile = nullptr;
+          UpdateTraceState();
+      }
+      if (file != nullptr)
+      {
+          fputs("\n]\n", file);
+          fclose(file);
+      }
+  }
+
+#ifdef _WIN32
+  // TraceLoggingWrite() needs the event name as a literal
+#define WRITE_ETW_EVENT(name) \
+      TraceLoggingWrite(traceProvider, name, \
+          TraceLoggingInt64(startTime, "StartMicrosecs"), \
+          TraceLoggingInt64(duration, "DurationMicrosecs"), \
+          TraceLoggingInt32(streamId, "StreamId"), \
+          TraceLoggingInt64(frameTime, "FrameTime"))
+
+  static void WriteEtwEvent(int eventId, int64_t startTime, int64_t duration, int streamId, int64_t frameTime)
+  {
+      switch (eventId)
+      {
+      case TraceEvent_ReaderNextFrame: WRITE_ETW_EVENT("FFMPEGReader.NextFrame"); break;
+      case TraceEvent_ReaderReadFrameData: WRITE_ETW_EVENT("FFMPEGReader.ReadFrameData"); break;
+      case TraceEvent_WriterWriteVideoFrame: WRITE_ETW_EVENT("MP4Writer.WriteVideoFrame"); break;
+      case TraceEvent_WriterWriteAudioSample: WRITE_ETW_EVENT("MP4Writer.WriteAudioSample"); break;
+      case TraceEvent_CaptureReadSample: WRITE_ETW_EVENT("MediaCapture.OnReadSample"); break;
+      case TraceEvent_RealSenseReadFrame: WRITE_ETW_EVENT("RealSense.ReadFrame"); break;
+      }
+  }
+#undef WRITE_ETW_EVENT
+#endif
+
+  //**********************************************************************
+  // Events go out as Chrome "complete" events: one line each, with the
+  // start and duration in microseconds and the frame in "args"
+  //**********************************************************************
+  void WriteTraceEvent(int eventId, int64_t startTime, int streamId, int64_t frameTime)
+  {
+      if (eventId < 0 || eventId >= NumTraceEvents)
+      {
+          return;
+      }
+      int64_t duration = GetTraceTime() - startTime;
+
+#ifdef _WIN32
+      if (etwEnabled)
+      {
+          WriteEtwEvent(eventId, startTime, duration, streamId, frameTime);
+      }
+      unsigned int processId = (unsigned int)GetCurrentProcessId();
+      unsigned int threadId = (unsigned int)GetCurrentThreadId();
+#else
+      unsigned int processId = (unsigned int)getpid();
+      unsigned int threadId = (unsigned int)syscall(SYS_gettid);
+#endif
+
+      std::lock_guard<std::mutex> lock(traceMutex);
+      if (traceFile == nullptr)
+      {
+          return;
+      }
+      fprintf(traceFile, "%s\n{\"name\":\"%s\",\"cat\":\"media\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%u,\"tid\":%u,\"args\":{\"stream\":%d,\"frameTime\":%lld}}",
+          traceFileEmpty ? "" : ",", TraceEventNames[eventId], (long long)startTime, (long long)duration, processId, threadId, streamId, (long long)frameTime);
+      traceFileEmpty = false;
+  }
+}}}}
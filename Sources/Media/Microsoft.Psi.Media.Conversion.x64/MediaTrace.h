@@ -0,0 +1,135 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Tracing {
+
+  //**********************************************************************
+  // Scoped trace events for the per-frame paths of the native media code
+  // (demux/decode in FFMPEGReaderNative, the MF sink writer behind
+  // MP4Writer, the MF capture callback and RealSense frame reads), so that
+  // a latency problem can be pinned on one of them. Each event records
+  // when the call started, how long it took, the thread, and the stream
+  // and timestamp of the frame it handled.
+  //
+  // Events are compiled in but off until something listens:
+  //   Windows - an ETW session enabling the TraceLogging provider
+  //             "Microsoft.Psi.Media" (GUID 96bba8dd-9edd-5d6f-f2bb-95ebda196756,
+  //             the name hash, so "*Microsoft.Psi.Media" works in tracelog,
+  //             xperf and PerfView).
+  //   All platforms - a Chrome trace file (JSON array format, for
+  //             chrome://tracing or Perfetto), started with StartTraceFile()
+  //             or by naming the file in the PSI_MEDIA_TRACE environment
+  //             variable. Each module linking this library writes its own
+  //             file, as "name.<module>.ext" for PSI_MEDIA_TRACE=name.ext;
+  //             all of them are stamped with the same clock.
+  // While nobody listens an event costs a load and a compare.
+  //**********************************************************************
+
+  //**********************************************************************
+  // The traced calls. Names in the trace are those in the comments.
+  //**********************************************************************
+  static const int TraceEvent_ReaderNextFrame = 0;        /* FFMPEGReader.NextFrame */
+  static const int TraceEvent_ReaderReadFrameData = 1;    /* FFMPEGReader.ReadFrameData */
+  static const int TraceEvent_WriterWriteVideoFrame = 2;  /* MP4Writer.WriteVideoFrame */
+  static const int TraceEvent_WriterWriteAudioSample = 3; /* MP4Writer.WriteAudioSample */
+  static const int TraceEvent_CaptureReadSample = 4;      /* MediaCapture.OnReadSample */
+  static const int TraceEvent_RealSenseReadFrame = 5;     /* RealSense.ReadFrame */
+  static const int NumTraceEvents = 6;
+
+  //**********************************************************************
+  // Trace state (each module linking this library has its own):
+  //   0 - not initialized yet (the first IsTraceEnabled() call does it)
+  //   1 - nobody is listening
+  //   2 - events are being recorded
+  //**********************************************************************
+  extern volatile long traceState;
+  bool InitializeTracing();
+
+  // Returns true if events should be recorded
+  inline bool IsTraceEnabled()
+  {
+      long state = traceState;
+      return state == 2 || (state == 0 && InitializeTracing());
+  }
+
+  //**********************************************************************
+  // GetTraceTime() returns the time events are stamped with, in
+  // microseconds from an arbitrary origin. WriteTraceEvent() records one
+  // event; 'frameTime' is in 100ns ticks and -1 when not known, as is a
+  // 'streamId' of -1.
+  //**********************************************************************
+  int64_t GetTraceTime();
+  void WriteTraceEvent(int eventId, int64_t startTime, int streamId, int64_t frameTime);
+
+  //**********************************************************************
+  // StartTraceFile() writes this module's events to a Chrome trace file
+  // from now on, replacing any file being written, so no two modules may
+  // be given the same name. StopTraceFile() completes and closes it (also
+  // done at exit). Returns false if the file can't be created.
+  //**********************************************************************
+  bool StartTraceFile(const char *filename);
+  void StopTraceFile();
+
+  //**********************************************************************
+  // TraceScope records one event for the scope it lives in. The frame is
+  // usually known only once the traced call has done its work, so it is
+  // set with SetFrame() before the scope ends. Does nothing (and doesn't
+  // read the clock) unless tracing is enabled when it is created.
+  //**********************************************************************
+  class TraceScope
+  {
+      int eventId;
+      bool active;
+      int streamId;
+      int64_t frameTime;
+      int64_t startTime;
+
+      TraceScope(const TraceScope &);
+      TraceScope &operator=(const TraceScope &);
+  public:
+      explicit TraceScope(int eventId) :
+          eventId(eventId),
+          active(IsTraceEnabled()),
+          streamId(-1),
+          frameTime(-1),
+          startTime(0)
+      {
+          if (active)
+          {
+              startTime = GetTraceTime();
+          }
+      }
+
+      ~TraceScope()
+      {
+          if (active)
+          {
+              WriteTraceEvent(eventId, startTime, streamId, frameTime);
+          }
+      }
+
+      // Returns true if the event will be recorded, i.e. if working out the frame is worth it
+      bool IsActive() const { return active; }
+
+      // Sets the frame the event is about; 'ticks' is in 100ns units
+      void SetFrame(int stream, int64_t ticks)
+      {
+          streamId = stream;
+          frameTime = ticks;
+      }
+
+      // Same as SetFrame(), for timestamps in milliseconds
+      void SetFrameMillisecs(int stream, double millisecs)
+      {
+          streamId = stream;
+          frameTime = (int64_t)(millisecs * 10000.0);
+      }
+  };
+}}}}
@@ -0,0 +1,1043 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "MediaConversionInternal.h"
+#include <string.h>
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Conversion {
+
+  //**********************************************************************
+  // BT.601 limited range YUV -> RGB coefficients, scaled by 256:
+  //   B = (298 (Y - 16) + 516 (U - 128)                  + 128) / 256
+  //   G = (298 (Y - 16) - 100 (U - 128) - 208 (V - 128)  + 128) / 256
+  //   R = (298 (Y - 16)                 + 409 (V - 128)  + 128) / 256
+  // The SIMD kernels evaluate exactly the same integer expressions.
+  //**********************************************************************
+  static inline uint8_t Clip(int value)
+  {
+      return (uint8_t)(value < 0 ? 0 : (value > 255 ? 255 : value));
+  }
+
+  static inline void YUVToBGR(int y, int u, int v, uint8_t *dst, int bytesPerPixel)
+  {
+      int c = y - 16;
+      int d = u - 128;
+      int e = v - 128;
+      dst[0] = Clip((298 * c + 516 * d + 128) >> 8);
+      dst[1] = Clip((298 * c - 100 * d - 208 * e + 128) >> 8);
+      dst[2] = Clip((298 * c + 409 * e + 128) >> 8);
+      if (bytesPerPixel == 4)
+      {
+          dst[3] = 0xFF;
+      }
+  }
+
+  //**********************************************************************
+  // BT.709 limited range RGB -> YUV coefficients, scaled by 256:
+  //   Y = 16  + ( 47 R + 157 G +  16 B) / 256
+  //   U = 128 + (-26 R -  86 G + 112 B) / 256
+  //   V = 128 + (112 R - 102 G -  10 B) / 256
+  //**********************************************************************
+  static inline uint8_t RGBToY(int r, int g, int b)
+  {
+      return (uint8_t)(((47 * r + 157 * g + 16 * b + 128) >> 8) + 16);
+  }
+
+  static inline uint8_t RGBToU(int r, int g, int b)
+  {
+      return (uint8_t)(((-26 * r - 86 * g + 112 * b + 128) >> 8) + 128);
+  }
+
+  static inline uint8_t RGBToV(int r, int g, int b)
+  {
+      return (uint8_t)(((112 * r - 102 * g - 10 * b + 128) >> 8) + 128);
+  }
+
+  // Maps a full range gray level to limited range luma
+  static inline uint8_t GrayToY(int gray)
+  {
+      return (uint8_t)(((gray * 220 + 128) >> 8) + 16);
+  }
+
+  //**********************************************************************
+  // Scalar row conversions, starting at (for the 4:2:x formats, even)
+  // pixel 'x'. Used when the CPU has none of the vector extensions below,
+  // and for the right edge of rows the vector loops don't cover.
+  //**********************************************************************
+  template <bool UYVY>
+  static void ConvertPacked422Pixels(const uint8_t *src, uint8_t *dst, int bytesPerPixel, int x, int width)
+  {
+      // Byte order is Y0 U0 Y1 V0 for YUY2 and U0 Y0 V0 Y1 for UYVY
+      const int lumaOffset = UYVY ? 1 : 0;
+      const int chromaOffset = UYVY ? 0 : 1;
+      for (; x + 1 < width; x += 2)
+      {
+          const uint8_t *p = src + 2 * x;
+          int u = p[chromaOffset];
+          int v = p[chromaOffset + 2];
+          YUVToBGR(p[lumaOffset], u, v, dst + x * bytesPerPixel, bytesPerPixel);
+          YUVToBGR(p[lumaOffset + 2], u, v, dst + (x + 1) * bytesPerPixel, bytesPerPixel);
+      }
+  }
+
+  static void ConvertNV12Pixels(const uint8_t *srcY, const uint8_t *srcUV, uint8_t *dst, int bytesPerPixel, int x, int width)
+  {
+      for (; x < width; x++)
+      {
+          YUVToBGR(srcY[x], srcUV[x & ~1], srcUV[x | 1], dst + x * bytesPerPixel, bytesPerPixel);
+      }
+  }
+
+  static void SwapRGB24Pixels(const uint8_t *src, uint8_t *dst, int x, int width)
+  {
+      for (; x < width; x++)
+      {
+          dst[3 * x + 0] = src[3 * x + 2];
+          dst[3 * x + 1] = src[3 * x + 1];
+          dst[3 * x + 2] = src[3 * x + 0];
+      }
+  }
+
+  static void SwapRGBA32Pixels(const uint8_t *src, uint8_t *dst, int x, int width)
+  {
+      for (; x < width; x++)
+      {
+          dst[4 * x + 0] = src[4 * x + 2];
+          dst[4 * x + 1] = src[4 * x + 1];
+          dst[4 * x + 2] = src[4 * x + 0];
+          dst[4 * x + 3] = src[4 * x + 3];
+      }
+  }
+
+  // Converts a pair of rows of packed BGR(A) pixels to NV12
+  static void ConvertRowPairToNV12(const uint8_t *row0, const uint8_t *row1, int bytesPerPixel, uint8_t *y0, uint8_t *y1, uint8_t *uv, int x, int width)
+  {
+      for (; x < width; x += 2)
+      {
+          const uint8_t *p00 = row0 + x * bytesPerPixel;
+          const uint8_t *p01 = p00 + bytesPerPixel;
+          const uint8_t *p10 = row1 + x * bytesPerPixel;
+          const uint8_t *p11 = p10 + bytesPerPixel;
+          y0[x] = RGBToY(p00[2], p00[1], p00[0]);
+          y0[x + 1] = RGBToY(p01[2], p01[1], p01[0]);
+          y1[x] = RGBToY(p10[2], p10[1], p10[0]);
+          y1[x + 1] = RGBToY(p11[2], p11[1], p11[0]);
+
+          int b = (p00[0] + p01[0] + p10[0] + p11[0] + 2) >> 2;
+          int g = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+          int r = (p00[2] + p01[2] + p10[2] + p11[2] + 2) >> 2;
+          uv[x] = RGBToU(r, g, b);
+          uv[x + 1] = RGBToV(r, g, b);
+      }
+  }
+
+  //**********************************************************************
+  // Row kernel types. The image conversions below pick one of each kind
+  // for the CPU we run on and then run it over bands of rows.
+  //**********************************************************************
+  typedef void (*PackedRowFunc)(const uint8_t *src, uint8_t *dst, int width);
+  typedef void (*NV12RowFunc)(const uint8_t *srcY, const uint8_t *srcUV, uint8_t *dst, int width);
+  typedef void (*RowPairToNV12Func)(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int width);
+  typedef void (*GrayRowToLumaFunc)(const uint8_t *src, uint8_t *luma, int width);
+
+  // Output writers for the two Psi formats. The SSSE3/AVX2 stores are
+  // defined with the x64 kernels below.
+  struct BGR24Writer
+  {
+      static const int BytesPerPixel = 3;
+#ifdef PSI_CONVERSION_X86
+      PSI_TARGET_SSSE3 static inline void Store16(uint8_t *dst, __m128i b, __m128i g, __m128i r);
+      PSI_TARGET_AVX2 static inline void Store32(uint8_t *dst, __m256i b, __m256i g, __m256i r);
+#endif
+#ifdef PSI_CONVERSION_NEON
+      static inline void Store16(uint8_t *dst, uint8x16_t b, uint8x16_t g, uint8x16_t r)
+      {
+          uint8x16x3_t pixels;
+          pixels.val[0] = b;
+          pixels.val[1] = g;
+          pixels.val[2] = r;
+          vst3q_u8(dst, pixels);
+      }
+#endif
+  };
+
+  struct BGRA32Writer
+  {
+      static const int BytesPerPixel = 4;
+#ifdef PSI_CONVERSION_X86
+      PSI_TARGET_SSSE3 static inline void Store16(uint8_t *dst, __m128i b, __m128i g, __m128i r);
+      PSI_TARGET_AVX2 static inline void Store32(uint8_t *dst, __m256i b, __m256i g, __m256i r);
+#endif
+#ifdef PSI_CONVERSION_NEON
+      static inline void Store16(uint8_t *dst, uint8x16_t b, uint8x16_t g, uint8x16_t r)
+      {
+          uint8x16x4_t pixels;
+          pixels.val[0] = b;
+          pixels.val[1] = g;
+          pixels.val[2] = r;
+          pixels.val[3] = vdupq_n_u8(0xFF);
+          vst4q_u8(dst, pixels);
+      }
+#endif
+  };
+
+  template <typename Writer, bool UYVY>
+  static void ConvertPacked422RowScalar(const uint8_t *src, uint8_t *dst, int width)
+  {
+      ConvertPacked422Pixels<UYVY>(src, dst, Writer::BytesPerPixel, 0, width);
+  }
+
+  template <typename Writer>
+  static void ConvertNV12RowScalar(const uint8_t *srcY, const uint8_t *srcUV, uint8_t *dst, int width)
+  {
+      ConvertNV12Pixels(srcY, srcUV, dst, Writer::BytesPerPixel, 0, width);
+  }
+
+  static void SwapRGB24RowScalar(const uint8_t *src, uint8_t *dst, int width)
+  {
+      SwapRGB24Pixels(src, dst, 0, width);
+  }
+
+  static void SwapRGBA32RowScalar(const uint8_t *src, uint8_t *dst, int width)
+  {
+      SwapRGBA32Pixels(src, dst, 0, width);
+  }
+
+  template <int BytesPerPixel>
+  static void ConvertRowPairToNV12Scalar(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int width)
+  {
+      ConvertRowPairToNV12(row0, row1, BytesPerPixel, y0, y1, uv, 0, width);
+  }
+
+  static void ConvertGray8RowScalar(const uint8_t *src, uint8_t *luma, int width)
+  {
+      for (int x = 0; x < width; x++)
+      {
+          luma[x] = GrayToY(src[x]);
+      }
+  }
+
+  static void ConvertGray16RowScalar(const uint8_t *src, uint8_t *luma, int width)
+  {
+      const uint16_t *row = (const uint16_t*)src;
+      for (int x = 0; x < width; x++)
+      {
+          luma[x] = GrayToY(row[x] >> 8);
+      }
+  }
+
+#ifdef PSI_CONVERSION_X86
+  //**********************************************************************
+  // SSSE3 kernels. YUVToBGR8() converts 8 pixels given as 16-bit luma
+  // and 16-bit chroma (U0 V0 U1 V1 ...) lanes. Each pixel's (Y, U) and
+  // (V, 1) pairs are multiplied by a coefficient pair and summed with
+  // _mm_madd_epi16, which gives the 32-bit results of the scalar
+  // expressions above; the saturating packs then do the clipping.
+  //**********************************************************************
+  static inline __m128i CoefficientPair(short lo, short hi)
+  {
+      return _mm_set1_epi32((int)(((unsigned int)(unsigned short)hi << 16) | (unsigned short)lo));
+  }
+
+  static inline __m128i Channel4(__m128i cd, __m128i e1, __m128i cdCoefficients, __m128i e1Coefficients)
+  {
+      return _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cd, cdCoefficients), _mm_madd_epi16(e1, e1Coefficients)), 8);
+  }
+
+  static inline void YUVToBGR8(__m128i y16, __m128i chroma16, __m128i *b16, __m128i *g16, __m128i *r16)
+  {
+      const __m128i c = _mm_sub_epi16(y16, _mm_set1_epi16(16));
+      const __m128i d = _mm_sub_epi16(_mm_shufflehi_epi16(_mm_shufflelo_epi16(chroma16, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0)), _mm_set1_epi16(128));
+      const __m128i e = _mm_sub_epi16(_mm_shufflehi_epi16(_mm_shufflelo_epi16(chroma16, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1)), _mm_set1_epi16(128));
+      const __m128i one = _mm_set1_epi16(1);
+      const __m128i cdLo = _mm_unpacklo_epi16(c, d);
+      const __m128i cdHi = _mm_unpackhi_epi16(c, d);
+      const __m128i e1Lo = _mm_unpacklo_epi16(e, one);
+      const __m128i e1Hi = _mm_unpackhi_epi16(e, one);
+
+      const __m128i cdB = CoefficientPair(298, 516);
+      const __m128i e1B = CoefficientPair(0, 128);
+      const __m128i cdG = CoefficientPair(298, -100);
+      const __m128i e1G = CoefficientPair(-208, 128);
+      const __m128i cdR = CoefficientPair(298, 0);
+      const __m128i e1R = CoefficientPair(409, 128);
+      *b16 = _mm_packs_epi32(Channel4(cdLo, e1Lo, cdB, e1B), Channel4(cdHi, e1Hi, cdB, e1B));
+      *g16 = _mm_packs_epi32(Channel4(cdLo, e1Lo, cdG, e1G), Channel4(cdHi, e1Hi, cdG, e1G));
+      *r16 = _mm_packs_epi32(Channel4(cdLo, e1Lo, cdR, e1R), Channel4(cdHi, e1Hi, cdR, e1R));
+  }
+
+  //**********************************************************************
+  // AVX2 counterpart of YUVToBGR8() for 16 pixels. All the operations
+  // work within 128-bit lanes, so pixel order is preserved.
+  //**********************************************************************
+  PSI_TARGET_AVX2 static inline __m256i CoefficientPair256(short lo, short hi)
+  {
+      return _mm256_set1_epi32((int)(((unsigned int)(unsigned short)hi << 16) | (unsigned short)lo));
+  }
+
+  PSI_TARGET_AVX2 static inline __m256i Channel8(__m256i cd, __m256i e1, __m256i cdCoefficients, __m256i e1Coefficients)
+  {
+      return _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cd, cdCoefficients), _mm256_madd_epi16(e1, e1Coefficients)), 8);
+  }
+
+  PSI_TARGET_AVX2 static inline void YUVToBGR16(__m256i y16, __m256i chroma16, __m256i *b16, __m256i *g16, __m256i *r16)
+  {
+      const __m256i c = _mm256_sub_epi16(y16, _mm256_set1_epi16(16));
+      const __m256i d = _mm256_sub_epi16(_mm256_shufflehi_epi16(_mm256_shufflelo_epi16(chroma16, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0)), _mm256_set1_epi16(128));
+      const __m256i e = _mm256_sub_epi16(_mm256_shufflehi_epi16(_mm256_shufflelo_epi16(chroma16, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1)), _mm256_set1_epi16(128));
+      const __m256i one = _mm256_set1_epi16(1);
+      const __m256i cdLo = _mm256_unpacklo_epi16(c, d);
+      const __m256i cdHi = _mm256_unpackhi_epi16(c, d);
+      const __m256i e1Lo = _mm256_unpacklo_epi16(e, one);
+      const __m256i e1Hi = _mm256_unpackhi_epi16(e, one);
+
+      const __m256i cdB = CoefficientPair256(298, 516);
+      const __m256i e1B = CoefficientPair256(0, 128);
+      const __m256i cdG = CoefficientPair256(298, -100);
+      const __m256i e1G = CoefficientPair256(-208, 128);
+      const __m256i cdR = CoefficientPair256(298, 0);
+      const __m256i e1R = CoefficientPair256(409, 128);
+      *b16 = _mm256_packs_epi32(Channel8(cdLo, e1Lo, cdB, e1B), Channel8(cdHi, e1Hi, cdB, e1B));
+      *g16 = _mm256_packs_epi32(Channel8(cdLo, e1Lo, cdG, e1G), Channel8(cdHi, e1Hi, cdG, e1G));
+      *r16 = _mm256_packs_epi32(Channel8(cdLo, e1Lo, cdR, e1R), Channel8(cdHi, e1Hi, cdR, e1R));
+  }
+
+  // Packs two sets of 16 16-bit values into 32 bytes in pixel order
+  PSI_TARGET_AVX2 static inline __m256i PackPixels32(__m256i lo, __m256i hi)
+  {
+      return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+  }
+
+  //**********************************************************************
+  // Writers for the two output formats. Each takes the B, G and R bytes
+  // of 16 (SSSE3) or 32 (AVX2) consecutive pixels.
+  //**********************************************************************
+  PSI_TARGET_SSSE3 inline void BGR24Writer::Store16(uint8_t *dst, __m128i b, __m128i g, __m128i r)
+  {
+      const __m128i b0 = _mm_setr_epi8(0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128, -128, 5);
+      const __m128i g0 = _mm_setr_epi8(-128, 0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128, -128);
+      const __m128i r0 = _mm_setr_epi8(-128, -128, 0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128);
+      const __m128i b1 = _mm_setr_epi8(-128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128, 10, -128);
+      const __m128i g1 = _mm_setr_epi8(5, -128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128, 10);
+      const __m128i r1 = _mm_setr_epi8(-128, 5, -128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128);
+      const __m128i b2 = _mm_setr_epi8(-128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15, -128, -128);
+      const __m128i g2 = _mm_setr_epi8(-128, -128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15, -128);
+      const __m128i r2 = _mm_setr_epi8(10, -128, -128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15);
+      _mm_storeu_si128((__m128i*)dst, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b0), _mm_shuffle_epi8(g, g0)), _mm_shuffle_epi8(r, r0)));
+      _mm_storeu_si128((__m128i*)(dst + 16), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b1), _mm_shuffle_epi8(g, g1)), _mm_shuffle_epi8(r, r1)));
+      _mm_storeu_si128((__m128i*)(dst + 32), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b2), _mm_shuffle_epi8(g, g2)), _mm_shuffle_epi8(r, r2)));
+  }
+
+  // Each 128-bit lane is interleaved on its own (pixels 0-15 and 16-31)
+  // and the six 16 byte pieces then put back in order
+  PSI_TARGET_AVX2 inline void BGR24Writer::Store32(uint8_t *dst, __m256i b, __m256i g, __m256i r)
+  {
+      const __m256i b0 = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128, -128, 5));
+      const __m256i g0 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-128, 0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128, -128));
+      const __m256i r0 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-128, -128, 0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128));
+      const __m256i b1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128, 10, -128));
+      const __m256i g1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(5, -128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128, 10));
+      const __m256i r1 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-128, 5, -128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128));
+      const __m256i b2 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15, -128, -128));
+      const __m256i g2 = _mm256_broadcastsi128_si256(_mm_setr_epi8(-128, -128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15, -128));
+      const __m256i r2 = _mm256_broadcastsi128_si256(_mm_setr_epi8(10, -128, -128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15));
+      const __m256i out0 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(b, b0), _mm256_shuffle_epi8(g, g0)), _mm256_shuffle_epi8(r, r0));
+      const __m256i out1 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(b, b1), _mm256_shuffle_epi8(g, g1)), _mm256_shuffle_epi8(r, r1));
+      const __m256i out2 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(b, b2), _mm256_shuffle_epi8(g, g2)), _mm256_shuffle_epi8(r, r2));
+      _mm256_storeu_si256((__m256i*)dst, _mm256_permute2x128_si256(out0, out1, 0x20));
+      _mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(out2, out0, 0x30));
+      _mm256_storeu_si256((__m256i*)(dst + 64), _mm256_permute2x128_si256(out1, out2, 0x31));
+  }
+
+  PSI_TARGET_SSSE3 inline void BGRA32Writer::Store16(uint8_t *dst, __m128i b, __m128i g, __m128i r)
+  {
+      const __m128i alpha = _mm_set1_epi8(-1);
+      const __m128i bgLo = _mm_unpacklo_epi8(b, g);
+      const __m128i bgHi = _mm_unpackhi_epi8(b, g);
+      const __m128i raLo = _mm_unpacklo_epi8(r, alpha);
+      const __m128i raHi = _mm_unpackhi_epi8(r, alpha);
+      _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(bgLo, raLo));
+      _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(bgLo, raLo));
+      _mm_storeu_si128((__m128i*)(dst + 32), _mm_unpacklo_epi16(bgHi, raHi));
+      _mm_storeu_si128((__m128i*)(dst + 48), _mm_unpackhi_epi16(bgHi, raHi));
+  }
+
+  PSI_TARGET_AVX2 inline void BGRA32Writer::Store32(uint8_t *dst, __m256i b, __m256i g, __m256i r)
+  {
+      const __m256i alpha = _mm256_set1_epi8(-1);
+      const __m256i bgLo = _mm256_unpacklo_epi8(b, g);
+      const __m256i bgHi = _mm256_unpackhi_epi8(b, g);
+      const __m256i raLo = _mm256_unpacklo_epi8(r, alpha);
+      const __m256i raHi = _mm256_unpackhi_epi8(r, alpha);
+      const __m256i p0 = _mm256_unpacklo_epi16(bgLo, raLo);   // Pixels 0-3 and 16-19
+      const __m256i p1 = _mm256_unpackhi_epi16(bgLo, raLo);   // Pixels 4-7 and 20-23
+      const __m256i p2 = _mm256_unpacklo_epi16(bgHi, raHi);   // Pixels 8-11 and 24-27
+      const __m256i p3 = _mm256_unpackhi_epi16(bgHi, raHi);   // Pixels 12-15 and 28-31
+      _mm256_storeu_si256((__m256i*)dst, _mm256_permute2x128_si256(p0, p1, 0x20));
+      _mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(p2, p3, 0x20));
+      _mm256_storeu_si256((__m256i*)(dst + 64), _mm256_permute2x128_si256(p0, p1, 0x31));
+      _mm256_storeu_si256((__m256i*)(dst + 96), _mm256_permute2x128_si256(p2, p3, 0x31));
+  }
+
+  //**********************************************************************
+  // YUV -> BGR row kernels. For YUY2 luma is in the low byte of each
+  // 16-bit word and chroma in the high byte; UYVY is the other way round.
+  //**********************************************************************
+  template <typename Writer, bool UYVY>
+  PSI_TARGET_SSSE3 static void ConvertPacked422RowSSSE3(const uint8_t *src, uint8_t *dst, int width)
+  {
+      const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+          const __m128i p0 = _mm_loadu_si128((const __m128i*)(src + 2 * x));
+          const __m128i p1 = _mm_loadu_si128((const __m128i*)(src + 2 * x + 16));
+          __m128i b0, g0, r0, b1, g1, r1;
+          if (UYVY)
+          {
+              YUVToBGR8(_mm_srli_epi16(p0, 8), _mm_and_si128(p0, lowBytes), &b0, &g0, &r0);
+              YUVToBGR8(_mm_srli_epi16(p1, 8), _mm_and_si128(p1, lowBytes), &b1, &g1, &r1);
+          }
+          else
+          {
+              YUVToBGR8(_mm_and_si128(p0, lowBytes), _mm_srli_epi16(p0, 8), &b0, &g0, &r0);
+              YUVToBGR8(_mm_and_si128(p1, lowBytes), _mm_srli_epi16(p1, 8), &b1, &g1, &r1);
+          }
+          Writer::Store16(dst + x * Writer::BytesPerPixel, _mm_packus_epi16(b0, b1), _mm_packus_epi16(g0, g1), _mm_packus_epi16(r0, r1));
+      }
+      ConvertPacked422Pixels<UYVY>(src, dst, Writer::BytesPerPixel, x, width);
+  }
+
+  template <typename Writer, bool UYVY>
+  PSI_TARGET_AVX2 static void ConvertPacked422RowAVX2(const uint8_t *src, uint8_t *dst, int width)
+  {
+      const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+      int x = 0;
+      for (; x + 32 <= width; x += 32)
+      {
+          const __m256i p0 = _mm256_loadu_si256((const __m256i*)(src + 2 * x));
+          const __m256i p1 = _mm256_loadu_si256((const __m256i*)(src + 2 * x + 32));
+          __m256i b0, g0, r0, b1, g1, r1;
+          if (UYVY)
+          {
+              YUVToBGR16(_mm256_srli_epi16(p0, 8), _mm256_and_si256(p0, lowBytes), &b0, &g0, &r0);
+              YUVToBGR16(_mm256_srli_epi16(p1, 8), _mm256_and_si256(p1, lowBytes), &b1, &g1, &r1);
+          }
+          else
+          {
+              YUVToBGR16(_mm256_and_si256(p0, lowBytes), _mm256_srli_epi16(p0, 8), &b0, &g0, &r0);
+              YUVToBGR16(_mm256_and_si256(p1, lowBytes), _mm256_srli_epi16(p1, 8), &b1, &g1, &r1);
+          }
+          Writer::Store32(dst + x * Writer::BytesPerPixel, PackPixels32(b0, b1), PackPixels32(g0, g1), PackPixels32(r0, r1));
+      }
+      ConvertPacked422Pixels<UYVY>(src, dst, Writer::BytesPerPixel, x, width);
+  }
+
+  template <typename Writer>
+  PSI_TARGET_SSSE3 static void ConvertNV12RowSSSE3(const uint8_t *srcY, const uint8_t *srcUV, uint8_t *dst, int width)
+  {
+      const __m128i zero = _mm_setzero_si128();
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+          const __m128i y = _mm_loadu_si128((const __m128i*)(srcY + x));
+          const __m128i uv = _mm_loadu_si128((const __m128i*)(srcUV + x));
+          __m128i b0, g0, r0, b1, g1, r1;
+          YUVToBGR8(_mm_unpacklo_epi8(y, zero), _mm_unpacklo_epi8(uv, zero), &b0, &g0, &r0);
+          YUVToBGR8(_mm_unpackhi_epi8(y, zero), _mm_unpackhi_epi8(uv, zero), &b1, &g1, &r1);
+          Writer::Store16(dst + x * Writer::BytesPerPixel, _mm_packus_epi16(b0, b1), _mm_packus_epi16(g0, g1), _mm_packus_epi16(r0, r1));
+      }
+      ConvertNV12Pixels(srcY, srcUV, dst, Writer::BytesPerPixel, x, width);
+  }
+
+  template <typename Writer>
+  PSI_TARGET_AVX2 static void ConvertNV12RowAVX2(const uint8_t *srcY, const uint8_t *srcUV, uint8_t *dst, int width)
+  {
+      const __m256i zero = _mm256_setzero_si256();
+      int x = 0;
+      for (; x + 32 <= width; x += 32)
+      {
+          // Reorder the 8 byte blocks so that the in-lane unpacks below
+          // yield pixels 0-15 and 16-31
+          const __m256i y = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*)(srcY + x)), _MM_SHUFFLE(3, 1, 2, 0));
+          const __m256i uv = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*)(srcUV + x)), _MM_SHUFFLE(3, 1, 2, 0));
+          __m256i b0, g0, r0, b1, g1, r1;
+          YUVToBGR16(_mm256_unpacklo_epi8(y, zero), _mm256_unpacklo_epi8(uv, zero), &b0, &g0, &r0);
+          YUVToBGR16(_mm256_unpackhi_epi8(y, zero), _mm256_unpackhi_epi8(uv, zero), &b1, &g1, &r1);
+          Writer::Store32(dst + x * Writer::BytesPerPixel, PackPixels32(b0, b1), PackPixels32(g0, g1), PackPixels32(r0, r1));
+      }
+      ConvertNV12Pixels(srcY, srcUV, dst, Writer::BytesPerPixel, x, width);
+  }
+
+  //**********************************************************************
+  // RGB <-> BGR swaps. 16 packed 24-bit pixels span three registers, and
+  // a pixel can straddle two of them, so each output register is put
+  // together from pshufb's of the (up to) two inputs it draws on. A mask
+  // byte of -128 zeroes that output byte, so the pieces just OR. The
+  // 24-bit swap would need cross-lane permutes under AVX2 that cost about
+  // what they save, so only the 32-bit swap has an AVX2 kernel.
+  //**********************************************************************
+  PSI_TARGET_SSSE3 static void SwapRGB24RowSSSE3(const uint8_t *src, uint8_t *dst, int width)
+  {
+      const __m128i m00 = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, -128);
+      const __m128i m01 = _mm_setr_epi8(-128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, 1);
+      const __m128i m10 = _mm_setr_epi8(-128, 15, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128);
+      const __m128i m11 = _mm_setr_epi8(0, -128, 4, 3, 2, 7, 6, 5, 10, 9, 8, 13, 12, 11, -128, 15);
+      const __m128i m12 = _mm_setr_epi8(-128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, 0, -128);
+      const __m128i m21 = _mm_setr_epi8(14, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128, -128);
+      const __m128i m22 = _mm_setr_epi8(-128, 3, 2, 1, 6, 5, 4, 9, 8, 7, 12, 11, 10, 15, 14, 13);
+
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+          __m128i a = _mm_loadu_si128((const __m128i*)(src + 3 * x));
+          __m128i b = _mm_loadu_si128((const __m128i*)(src + 3 * x + 16));
+          __m128i c = _mm_loadu_si128((const __m128i*)(src + 3 * x + 32));
+          _mm_storeu_si128((__m128i*)(dst + 3 * x), _mm_or_si128(_mm_shuffle_epi8(a, m00), _mm_shuffle_epi8(b, m01)));
+          _mm_storeu_si128((__m128i*)(dst + 3 * x + 16), _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, m10), _mm_shuffle_epi8(b, m11)), _mm_shuffle_epi8(c, m12)));
+          _mm_storeu_si128((__m128i*)(dst + 3 * x + 32), _mm_or_si128(_mm_shuffle_epi8(b, m21), _mm_shuffle_epi8(c, m22)));
+      }
+      SwapRGB24Pixels(src, dst, x, width);
+  }
+
+  PSI_TARGET_SSSE3 static void SwapRGBA32RowSSSE3(const uint8_t *src, uint8_t *dst, int width)
+  {
+      const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+      int x = 0;
+      for (; x + 4 <= width; x += 4)
+      {
+          __m128i p = _mm_loadu_si128((const __m128i*)(src + 4 * x));
+          _mm_storeu_si128((__m128i*)(dst + 4 * x), _mm_shuffle_epi8(p, mask));
+      }
+      SwapRGBA32Pixels(src, dst, x, width);
+  }
+
+  PSI_TARGET_AVX2 static void SwapRGBA32RowAVX2(const uint8_t *src, uint8_t *dst, int width)
+  {
+      const __m256i mask = _mm256_setr_epi8(
+          2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+          2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+      int x = 0;
+      for (; x + 8 <= width; x += 8)
+      {
+          __m256i p = _mm256_loadu_si256((const __m256i*)(src + 4 * x));
+          _mm256_storeu_si256((__m256i*)(dst + 4 * x), _mm256_shuffle_epi8(p, mask));
+      }
+      SwapRGBA32Pixels(src, dst, x, width);
+  }
+
+  //**********************************************************************
+  // BGR(X) -> NV12 kernels. Luma4() computes the luma of 4 BGRX pixels as
+  // 32-bit lanes: _mm_madd_epi16 leaves (16 B + 157 G) and (47 R + 0 X)
+  // in adjacent lanes, which are then folded together.
+  //**********************************************************************
+  static inline __m128i Luma4(__m128i pixels, __m128i zero, __m128i coefficients)
+  {
+      __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients);
+      __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coefficients);
+      lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+      hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+      return _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+
+  // Converts 8 BGRX pixels to 8 luma bytes (in the low half of the result)
+  static inline __m128i Luma8(__m128i pixels0, __m128i pixels1, __m128i zero, __m128i coefficients)
+  {
+      const __m128i round = _mm_set1_epi32(128);
+      const __m128i offset = _mm_set1_epi16(16);
+      __m128i y0 = _mm_srai_epi32(_mm_add_epi32(Luma4(pixels0, zero, coefficients), round), 8);
+      __m128i y1 = _mm_srai_epi32(_mm_add_epi32(Luma4(pixels1, zero, coefficients), round), 8);
+      return _mm_packus_epi16(_mm_add_epi16(_mm_packs_epi32(y0, y1), offset), zero);
+  }
+
+  // Averages the two 2x2 blocks of 4 BGRX pixels from each of two rows,
+  // leaving them as 16-bit BGRX lanes. The 4 samples are summed exactly
+  // and rounded once, as (a + b + c + d + 2) >> 2 in the scalar code.
+  static inline __m128i AverageBlocks2(__m128i row0, __m128i row1, __m128i zero)
+  {
+      const __m128i round = _mm_set1_epi16(2);
+      __m128i left = _mm_add_epi16(_mm_unpacklo_epi8(row0, zero), _mm_unpacklo_epi8(row1, zero));
+      __m128i right = _mm_add_epi16(_mm_unpackhi_epi8(row0, zero), _mm_unpackhi_epi8(row1, zero));
+      left = _mm_add_epi16(left, _mm_srli_si128(left, 8));
+      right = _mm_add_epi16(right, _mm_srli_si128(right, 8));
+      return _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(left, right), round), 2);
+  }
+
+  // Computes U (or V, depending on 'coefficients') for 2 averaged pixels
+  // held as 16-bit BGRX lanes, leaving the results in 32-bit lanes 0 and 2
+  static inline __m128i Chroma2(__m128i pixels, __m128i coefficients)
+  {
+      __m128i sum = _mm_madd_epi16(pixels, coefficients);
+      return _mm_add_epi32(sum, _mm_srli_epi64(sum, 32));
+  }
+
+  //**********************************************************************
+  // Converts an 8x2 block of BGRX pixels (row0 and row1 hold 4 pixels per
+  // register) to 16 luma samples and 4 interleaved UV pairs
+  //**********************************************************************
+  static inline void ConvertBlockToNV12(__m128i row0a, __m128i row0b, __m128i row1a, __m128i row1b, uint8_t *y0, uint8_t *y1, uint8_t *uv)
+  {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i yCoefficients = _mm_set_epi16(0, 47, 157, 16, 0, 47, 157, 16);
+      const __m128i uCoefficients = _mm_set_epi16(0, -26, -86, 112, 0, -26, -86, 112);
+      const __m128i vCoefficients = _mm_set_epi16(0, 112, -102, -10, 0, 112, -102, -10);
+      const __m128i round = _mm_set1_epi32(128);
+      const __m128i offset = _mm_set1_epi32(128);
+
+      _mm_storel_epi64((__m128i*)y0, Luma8(row0a, row0b, zero, yCoefficients));
+      _mm_storel_epi64((__m128i*)y1, Luma8(row1a, row1b, zero, yCoefficients));
+
+      __m128i blocks01 = AverageBlocks2(row0a, row1a, zero);
+      __m128i blocks23 = AverageBlocks2(row0b, row1b, zero);
+
+      // Lanes 0 and 2 of u01 hold U for blocks 0 and 1, and so on. Interleaving
+      // U with V (shifted up one lane) gives U0 V0 U1 V1 in lanes 0..3.
+      __m128i u01 = Chroma2(blocks01, uCoefficients);
+      __m128i v01 = Chroma2(blocks01, vCoefficients);
+      __m128i u23 = Chroma2(blocks23, uCoefficients);
+      __m128i v23 = Chroma2(blocks23, vCoefficients);
+      __m128i uv01 = _mm_or_si128(_mm_and_si128(u01, _mm_set_epi32(0, -1, 0, -1)), _mm_slli_epi64(v01, 32));
+      __m128i uv23 = _mm_or_si128(_mm_and_si128(u23, _mm_set_epi32(0, -1, 0, -1)), _mm_slli_epi64(v23, 32));
+      uv01 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(uv01, round), 8), offset);
+      uv23 = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(uv23, round), 8), offset);
+      _mm_storel_epi64((__m128i*)uv, _mm_packus_epi16(_mm_packs_epi32(uv01, uv23), zero));
+  }
+
+  static void ConvertBGRARowPairToNV12SSE2(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int width)
+  {
+      int x = 0;
+      for (; x + 8 <= width; x += 8)
+      {
+          ConvertBlockToNV12(
+              _mm_loadu_si128((const __m128i*)(row0 + x * 4)), _mm_loadu_si128((const __m128i*)(row0 + x * 4 + 16)),
+              _mm_loadu_si128((const __m128i*)(row1 + x * 4)), _mm_loadu_si128((const __m128i*)(row1 + x * 4 + 16)),
+              y0 + x, y1 + x, uv + x);
+      }
+      ConvertRowPairToNV12(row0, row1, 4, y0, y1, uv, x, width);
+  }
+
+  //**********************************************************************
+  // 8 BGR pixels are 24 bytes: pixels 0-3 are bytes 0-11 of a load at the
+  // start, and pixels 4-7 bytes 4-15 of a load 8 bytes in (which keeps
+  // the loads within the 24 bytes). pshufb spreads them to BGRX.
+  //**********************************************************************
+  PSI_TARGET_SSSE3 static void ConvertBGRRowPairToNV12SSSE3(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1, uint8_t *uv, int width)
+  {
+      const __m128i expandLo = _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+      const __m128i expandHi = _mm_setr_epi8(4, 5, 6, -128, 7, 8, 9, -128, 10, 11, 12, -128, 13, 14, 15, -128);
+      int x = 0;
+      for (; x + 8 <= width; x += 8)
+      {
+          const uint8_t *p0 = row0 + x * 3;
+          const uint8_t *p1 = row1 + x * 3;
+          ConvertBlockToNV12(
+              _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p0), expandLo), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p0 + 8)), expandHi),
+              _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p1), expandLo), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p1 + 8)), expandHi),
+              y0 + x, y1 + x, uv + x);
+      }
+      ConvertRowPairToNV12(row0, row1, 3, y0, y1, uv, x, width);
+  }
+
+  // Rescales 16 gray levels held in 16-bit lanes to luma bytes
+  static inline __m128i GrayToLuma16(__m128i lo, __m128i hi)
+  {
+      const __m128i scale = _mm_set1_epi16(220);
+      const __m128i round = _mm_set1_epi16(128);
+      const __m128i offset = _mm_set1_epi16(16);
+      lo = _mm_add_epi16(_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(lo, scale), round), 8), offset);
+      hi = _mm_add_epi16(_mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(hi, scale), round), 8), offset);
+      return _mm_packus_epi16(lo, hi);
+  }
+
+  static void ConvertGray8RowSSE2(const uint8_t *src, uint8_t *luma, int width)
+  {
+      const __m128i zero = _mm_setzero_si128();
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+          __m128i gray = _mm_loadu_si128((const __m128i*)(src + x));
+          _mm_storeu_si128((__m128i*)(luma + x), GrayToLuma16(_mm_unpacklo_epi8(gray, zero), _mm_unpackhi_epi8(gray, zero)));
+      }
+      for (; x < width; x++)
+      {
+          luma[x] = GrayToY(src[x]);
+      }
+  }
+
+  static void ConvertGray16RowSSE2(const uint8_t *src, uint8_t *luma, int width)
+  {
+      const uint16_t *row = (const uint16_t*)src;
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+          __m128i lo = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)(row + x)), 8);
+          __m128i hi = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)(row + x + 8)), 8);
+          _mm_storeu_si128((__m128i*)(luma + x), GrayToLuma16(lo, hi));
+      }
+      for (; x < width; x++)
+      {
+          luma[x] = GrayToY(row[x] >> 8);
+      }
+  }
+#endif // PSI_CONVERSION_X86
+
+#ifdef PSI_CONVERSION_NEON
+  //**********************************************************************
+  // NEON kernels. The structured loads (vld2/3/4) split pixels into their
+  // channels and the stores put them back together, so no shuffles are
+  // needed. YUVToBGR8NEON() evaluates the scalar expressions in 32-bit
+  // lanes for 8 pixels, given their luma and the (signed) chroma offsets
+  // d = U - 128 and e = V - 128.
+  //**********************************************************************
+  static inline int16x8_t ChromaOffsets(uint8x8_t chroma)
+  {
+      return vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(chroma)), vdupq_n_s16(128));
+  }
+
+  static inline uint8x8_t NarrowChannel(int32x4_t lo, int32x4_t hi)
+  {
+      return vqmovun_s16(vcombine_s16(vshrn_n_s32(lo, 8), vshrn_n_s32(hi, 8)));
+  }
+
+  static inline void YUVToBGR8NEON(uint8x8_t y, int16x8_t d, int16x8_t e, uint8x8_t *b, uint8x8_t *g, uint8x8_t *r)
+  {
+      const int16x8_t c = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y)), vdupq_n_s16(16));
+      const int32x4_t round = vdupq_n_s32(128);
+      const int32x4_t cLo = vmlal_n_s16(round, vget_low_s16(c), 298);
+      const int32x4_t cHi = vmlal_n_s16(round, vget_high_s16(c), 298);
+      *b = NarrowChannel(vmlal_n_s16(cLo, vget_low_s16(d), 516), vmlal_n_s16(cHi, vget_high_s16(d), 516));
+      *g = NarrowChannel(
+          vmlsl_n_s16(vmlsl_n_s16(cLo, vget_low_s16(d), 100), vget_low_s16(e), 208),
+          vmlsl_n_s16(vmlsl_n_s16(cHi, vget_high_s16(d), 100), vget_high_s16(e), 208));
+      *r = NarrowChannel(vmlal_n_s16(cLo, vget_low_s16(e), 409), vmlal_n_s16(cHi, vget_high_s16(e), 409));
+  }
+
+  //**********************************************************************
+  // Converts 16 pixels given as their even and odd luma and the chroma
+  // they share, and writes them out in pixel order
+  //**********************************************************************
+  template <typename Writer>
+  static inline void ConvertPixelPairs16NEON(uint8x8_t yEven, uint8x8_t yOdd, uint8x8_t u, uint8x8_t v, uint8_t *dst)
+  {
+      const int16x8_t d = ChromaOffsets(u);
+      const int16x8_t e = ChromaOffsets(v);
+      uint8x8_t bEven, gEven, rEven, bOdd, gOdd, rOdd;
+      YUVToBGR8NEON(yEven, d, e, &bEven, &gEven, &rEven);
+      YUVToBGR8NEON(yOdd, d, e, &bOdd, &gOdd, &rOdd);
+      const uint8x8x2_t b = vzip_u8(bEven, bOdd);
+      const uint8x8x2_t g = vzip_u8(gEven, gOdd);
+      const uint8x8x2_t r = vzip_u8(rEven, rOdd);
+      Writer::Store16(dst, vcombine_u8(b.val[0], b.val[1]), vcombine_u8(g.val[0], g.val[1]), vcombine_u8(r.val[0], r.val[1]));
+  }
+
+  template <typename Writer, bool UYVY>
+  static void ConvertPacked422RowNEON(const uint8_t *src, uint8_t *dst, int width)
+  {
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+          // Lanes hold Y0 U Y1 V (YUY2) or U Y0 V Y1 (UYVY) for 8 pixel pairs
+          const uint8x8x4_t p = vld4_u8(src + 2 * x);
+          if (UYVY)
+          {
+              ConvertPixelPairs16NEON<Writer>(p.val[1], p.val[3], p.val[0], p.val[2], dst + x * Writer::BytesPerPixel);
+          }
+          else
+          {
+              ConvertPixelPairs16NEON<Writer>(p.val[0], p.val[2], p.val[1], p.val[3], dst + x * Writer::BytesPerPixel);
+          }
+      }
+      ConvertPacked422Pixels<UYVY>(src, dst, Writer::BytesPerPixel, x, width);
+  }
+
+  template <typename Writer>
+  static void ConvertNV12RowNEON(const uint8_t *srcY, const uint8_t *srcUV, uint8_t *dst, int width)
+  {
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+          const uint8x8x2_t y = vld2_u8(srcY + x);
+          const uint8x8x2_t uv = vld2_u8(srcUV + x);
+          ConvertPixelPairs16NEON<Writer>(y.val[0], y.val[1], uv.val[0], uv.val[1], dst + x * Writer::BytesPerPixel);
+      }
+      ConvertNV12Pixels(srcY, srcUV, dst, Writer::BytesPerPixel, x, width);
+  }
+
+  static void SwapRGB24RowNEON(const uint8_t *src, uint8_t *dst, int width)
+  {
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+          uint8x16x3_t p = vld3q_u8(src + 3 * x);
+          uint8x16_t red = p.val[0];
+          p.val[0] = p.val[2];
+          p.val[2] = red;
+          vst3q_u8(dst + 3 * x, p);
+      }
+      SwapRGB24Pixels(src, dst, x, width);
+  }
+
+  static void SwapRGBA32RowNEON(const uint8_t *src, uint8_t *dst, int width)
+  {
+      int x = 0;
+      for (; x + 16 <= width; x += 16)
+      {
+          uint8x16x4_t p = vld4q_u8(src + 4 * x);
+          uint8x16_t red = p.val[0];
+          p.val[0] = p.val[2];
+          p.val[2] = red;
+          vst4q_u8(dst + 4 * x, p);
+      }
+      SwapRGBA32Pixels(src, dst, x, width);
+  }
+#endif // PSI_CONVERSION_NEON
+
+  //**********************************************************************
+  // Kernel selection. The NV12 encode kernels have no NEON versions:
+  // the only encoder fed from here on ARM64 would be the Linux FFMPEG
+  // writer, which converts with swscale.
+  //**********************************************************************
+  template <typename Writer, bool UYVY>
+  static PackedRowFunc SelectPacked422Row()
+  {
+#if defined(PSI_CONVERSION_X86)
+      int cpuLevel = GetCpuLevel();
+      return (cpuLevel >= CpuLevel_AVX2) ? ConvertPacked422RowAVX2<Writer, UYVY> :
+          (cpuLevel >= CpuLevel_SSSE3) ? ConvertPacked422RowSSSE3<Writer, UYVY> :
+          ConvertPacked422RowScalar<Writer, UYVY>;
+#elif defined(PSI_CONVERSION_NEON)
+      return ConvertPacked422RowNEON<Writer, UYVY>;
+#else
+      return ConvertPacked422RowScalar<Writer, UYVY>;
+#endif
+  }
+
+  template <typename Writer>
+  static NV12RowFunc SelectNV12Row()
+  {
+#if defined(PSI_CONVERSION_X86)
+      int cpuLevel = GetCpuLevel();
+      return (cpuLevel >= CpuLevel_AVX2) ? ConvertNV12RowAVX2<Writer> :
+          (cpuLevel >= CpuLevel_SSSE3) ? ConvertNV12RowSSSE3<Writer> :
+          ConvertNV12RowScalar<Writer>;
+#elif defined(PSI_CONVERSION_NEON)
+      return ConvertNV12RowNEON<Writer>;
+#else
+      return ConvertNV12RowScalar<Writer>;
+#endif
+  }
+
+  static PackedRowFunc SelectSwapRGB24Row()
+  {
+#if defined(PSI_CONVERSION_X86)
+      return (GetCpuLevel() >= CpuLevel_SSSE3) ? SwapRGB24RowSSSE3 : SwapRGB24RowScalar;
+#elif defined(PSI_CONVERSION_NEON)
+      return SwapRGB24RowNEON;
+#else
+      return SwapRGB24RowScalar;
+#endif
+  }
+
+  static PackedRowFunc SelectSwapRGBA32Row()
+  {
+#if defined(PSI_CONVERSION_X86)
+      int cpuLevel = GetCpuLevel();
+      return (cpuLevel >= CpuLevel_AVX2) ? SwapRGBA32RowAVX2 :
+          (cpuLevel >= CpuLevel_SSSE3) ? SwapRGBA32RowSSSE3 :
+          SwapRGBA32RowScalar;
+#elif defined(PSI_CONVERSION_NEON)
+      return SwapRGBA32RowNEON;
+#else
+      return SwapRGBA32RowScalar;
+#endif
+  }
+
+  static RowPairToNV12Func SelectBGRARowPairToNV12()
+  {
+#if defined(PSI_CONVERSION_X86)
+      return (GetCpuLevel() >= CpuLevel_SSE2) ? ConvertBGRARowPairToNV12SSE2 : ConvertRowPairToNV12Scalar<4>;
+#else
+      return ConvertRowPairToNV12Scalar<4>;
+#endif
+  }
+
+  static RowPairToNV12Func SelectBGRRowPairToNV12()
+  {
+#if defined(PSI_CONVERSION_X86)
+      return (GetCpuLevel() >= CpuLevel_SSSE3) ? ConvertBGRRowPairToNV12SSSE3 : ConvertRowPairToNV12Scalar<3>;
+#else
+      return ConvertRowPairToNV12Scalar<3>;
+#endif
+  }
+
+  static GrayRowToLumaFunc SelectGray8Row()
+  {
+#if defined(PSI_CONVERSION_X86)
+      return (GetCpuLevel() >= CpuLevel_SSE2) ? ConvertGray8RowSSE2 : ConvertGray8RowScalar;
+#else
+      return ConvertGray8RowScalar;
+#endif
+  }
+
+  static GrayRowToLumaFunc SelectGray16Row()
+  {
+#if defined(PSI_CONVERSION_X86)
+      return (GetCpuLevel() >= CpuLevel_SSE2) ? ConvertGray16RowSSE2 : ConvertGray16RowScalar;
+#else
+      return ConvertGray16RowScalar;
+#endif
+  }
+
+  //**********************************************************************
+  // Image conversions. Each picks its row kernel, then runs it over bands
+  // of rows (see ForEachBand()).
+  //**********************************************************************
+  static void ConvertPackedImage(PackedRowFunc convertRow, const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height)
+  {
+      ForEachBand(width, height, [=](int firstRow, int endRow)
+      {
+          for (int row = firstRow; row < endRow; row++)
+          {
+              convertRow(src + (ptrdiff_t)row * srcStride, dst + (ptrdiff_t)row * dstStride, width);
+          }
+      });
+  }
+
+  static void ConvertNV12Image(NV12RowFunc convertRow, const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride, uint8_t *dst, int dstStride, int width, int height)
+  {
+      ForEachBand(width, height, [=](int firstRow, int endRow)
+      {
+          for (int row = firstRow; row < endRow; row++)
+          {
+              convertRow(srcY + (ptrdiff_t)row * yStride, srcUV + (ptrdiff_t)(row / 2) * uvStride, dst + (ptrdiff_t)row * dstStride, width);
+          }
+      });
+  }
+
+  static void ConvertImageToNV12(RowPairToNV12Func convertRowPair, const uint8_t *src, int srcStride, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height)
+  {
+      ForEachBand(width, height, [=](int firstRow, int endRow)
+      {
+          for (int y = firstRow; y < endRow; y += 2)
+          {
+              const uint8_t *row0 = src + (ptrdiff_t)y * srcStride;
+              uint8_t *y0 = dstY + (ptrdiff_t)y * yStride;
+              convertRowPair(row0, row0 + srcStride, y0, y0 + yStride, dstUV + (ptrdiff_t)(y / 2) * uvStride, width);
+          }
+      });
+  }
+
+  // Gray maps to luma alone; chroma is neutral
+  static void ConvertGrayImageToNV12(GrayRowToLumaFunc convertRow, const uint8_t *src, int srcStride, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height)
+  {
+      ForEachBand(width, height, [=](int firstRow, int endRow)
+      {
+          for (int y = firstRow; y < endRow; y++)
+          {
+              convertRow(src + (ptrdiff_t)y * srcStride, dstY + (ptrdiff_t)y * yStride, width);
+          }
+          for (int y = firstRow / 2; y < endRow / 2; y++)
+          {
+              memset(dstUV + (ptrdiff_t)y * uvStride, 128, width);
+          }
+      });
+  }
+
+  //**********************************************************************
+  void ConvertYUY2ToBGR24(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height)
+  {
+      ConvertPackedImage(SelectPacked422Row<BGR24Writer, false>(), src, srcStride, dst, dstStride, width, height);
+  }
+
+  //**********************************************************************
+  void ConvertYUY2ToBGRA32(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height)
+  {
+      ConvertPackedImage(SelectPacked422Row<BGRA32Writer, false>(), src, srcStride, dst, dstStride, width, height);
+  }
+
+  //**********************************************************************
+  void ConvertUYVYToBGR24(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height)
+  {
+      ConvertPackedImage(SelectPacked422Row<BGR24Writer, true>(), src, srcStride, dst, dstStride, width, height);
+  }
+
+  //**********************************************************************
+  void ConvertUYVYToBGRA32(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height)
+  {
+      ConvertPackedImage(SelectPacked422Row<BGRA32Writer, true>(), src, srcStride, dst, dstStride, width, height);
+  }
+
+  //**********************************************************************
+  void ConvertNV12ToBGR24(const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride, uint8_t *dst, int dstStride, int width, int height)
+  {
+      ConvertNV12Image(SelectNV12Row<BGR24Writer>(), srcY, yStride, srcUV, uvStride, dst, dstStride, width, height);
+  }
+
+  //**********************************************************************
+  void ConvertNV12ToBGRA32(const uint8_t *srcY, int yStride, const uint8_t *srcUV, int uvStride, uint8_t *dst, int dstStride, int width, int height)
+  {
+      ConvertNV12Image(SelectNV12Row<BGRA32Writer>(), srcY, yStride, srcUV, uvStride, dst, dstStride, width, height);
+  }
+
+  //**********************************************************************
+  void ConvertRGB24ToBGR24(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height)
+  {
+      ConvertPackedImage(SelectSwapRGB24Row(), src, srcStride, dst, dstStride, width, height);
+  }
+
+  //**********************************************************************
+  void ConvertRGBA32ToBGRA32(const uint8_t *src, int srcStride, uint8_t *dst, int dstStride, int width, int height)
+  {
+      ConvertPackedImage(SelectSwapRGBA32Row(), src, srcStride, dst, dstStride, width, height);
+  }
+
+  //**********************************************************************
+  void ConvertBGRAToNV12(const uint8_t *src, int srcStride, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height)
+  {
+      ConvertImageToNV12(SelectBGRARowPairToNV12(), src, srcStride, dstY, yStride, dstUV, uvStride, width, height);
+  }
+
+  //**********************************************************************
+  void ConvertBGRToNV12(const uint8_t *src, int srcStride, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height)
+  {
+      ConvertImageToNV12(SelectBGRRowPairToNV12(), src, srcStride, dstY, yStride, dstUV, uvStride, width, height);
+  }
+
+  //**********************************************************************
+  void ConvertGray8ToNV12(const uint8_t *src, int srcStride, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height)
+  {
+      ConvertGrayImageToNV12(SelectGray8Row(), src, srcStride, dstY, yStride, dstUV, uvStride, width, height);
+  }
+
+  //**********************************************************************
+  void ConvertGray16ToNV12(const uint8_t *src, int srcStride, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height)
+  {
+      ConvertGrayImageToNV12(SelectGray16Row(), src, srcStride, dstY, yStride, dstUV, uvStride, width, height);
+  }
+
+  //**********************************************************************
+  bool ConvertToNV12(const uint8_t *src, int srcStride, int pixelFormat, uint8_t *dstY, int yStride, uint8_t *dstUV, int uvStride, int width, int height)
+  {
+      switch (pixelFormat)
+      {
+      case ConversionPixelFormat_BGRA_32bpp:
+      case ConversionPixelFormat_BGRX_32bpp:
+          ConvertBGRAToNV12(src, srcStride, dstY, yStride, dstUV, uvStride, width, height);
+          return true;
+      case ConversionPixelFormat_BGR_24bpp:
+          ConvertBGRToNV12(src, srcStride, dstY, yStride, dstUV, uvStride, width, height);
+          return true;
+      case ConversionPixelFormat_Gray_8bpp:
+          ConvertGray8ToNV12(src, srcStride, dstY, yStride, dstUV, uvStride, width, height);
+          return true;
+      case ConversionPixelFormat_Gray_16bpp:
+          ConvertGray16ToNV12(src, srcStride, dstY, yStride, dstUV, uvStride, width, height);
+          return true;
+      default:
+          return false;
+      }
+  }
+}}}}
@@ -0,0 +1,291 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "ThreadPolicy.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <avrt.h>
+#pragma comment(lib, "avrt.lib")
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Threading {
+
+#ifndef _WIN32
+  // SCHED_FIFO priorities of Highest threads. Kept low: any real-time
+  // priority beats every normal thread, and audio servers (which run at
+  // up to the 20 rtkit allows) should still beat video.
+  static const int CaptureRealtimePriority = 10;
+  static const int PlaybackRealtimePriority = 5;
+#endif
+
+  //**********************************************************************
+  // What ApplyThreadPolicy() did to the calling thread, so that it can be
+  // undone. Plain data, so that the thread_local is zero initialized and
+  // needs no per-thread constructor or destructor in the DLLs linking us.
+  //**********************************************************************
+  struct ThreadPolicyState
+  {
+      bool applied;                   /* Has a policy been applied to this thread? */
+      bool succeeded;                 /* Did it apply in full? */
+      ThreadPolicy policy;            /* The policy last applied */
+#ifdef _WIN32
+      HANDLE mmcssHandle;             /* MMCSS registration (nullptr if none) */
+      int originalPriority;           /* GetThreadPriority() before the first policy */
+      DWORD_PTR originalAffinity;     /* Affinity before the thread was pinned (0 if it isn't) */
+#else
+      bool realtime;                  /* Was the thread switched to SCHED_FIFO? */
+      bool reniced;                   /* Was its nice value changed? */
+      bool pinned;                    /* Was its affinity changed? */
+      int originalNice;
+      int originalScheduler;
+      int originalSchedPriority;
+      cpu_set_t originalAffinity;
+#endif
+  };
+
+  static thread_local ThreadPolicyState threadState;
+
+  static bool IsSamePolicy(const ThreadPolicy &a, const ThreadPolicy &b)
+  {
+      return a.priority == b.priority && a.task == b.task && a.affinityMask == b.affinityMask;
+  }
+
+#ifdef _WIN32
+  //**********************************************************************
+  const wchar_t *GetMmcssTaskName(const ThreadPolicy &policy)
+  {
+      if (policy.priority != ThreadPriority_AboveNormal && policy.priority != ThreadPriority_Highest)
+      {
+          return nullptr;
+      }
+      return (policy.task == ThreadTask_Playback) ? L"Playback" : L"Capture";
+  }
+
+  //**********************************************************************
+  int GetMmcssPriority(const ThreadPolicy &policy)
+  {
+      return (policy.priority == ThreadPriority_Highest) ? AVRT_PRIORITY_HIGH : AVRT_PRIORITY_NORMAL;
+  }
+
+  static void SaveOriginalScheduling(ThreadPolicyState &state)
+  {
+      state.mmcssHandle = nullptr;
+      state.originalPriority = GetThreadPriority(GetCurrentThread());
+      state.originalAffinity = 0;
+  }
+
+  static bool SetPriority(ThreadPolicyState &state, const ThreadPolicy &policy)
+  {
+      HANDLE thread = GetCurrentThread();
+      switch (policy.priority)
+      {
+      case ThreadPriority_Normal:
+          return true;
+      case ThreadPriority_Lowest:
+          return SetThreadPriority(thread, THREAD_PRIORITY_LOWEST) != FALSE;
+      case ThreadPriority_BelowNormal:
+          return SetThreadPriority(thread, THREAD_PRIORITY_BELOW_NORMAL) != FALSE;
+      case ThreadPriority_AboveNormal:
+      case ThreadPriority_Highest:
+          {
+              DWORD taskIndex = 0;
+              state.mmcssHandle = AvSetMmThreadCharacteristicsW(GetMmcssTaskName(policy), &taskIndex);
+              if (state.mmcssHandle != nullptr)
+              {
+                  return AvSetMmThreadPriority(state.mmcssHandle, (AVRT_PRIORITY)GetMmcssPriority(policy)) != FALSE;
+              }
+
+              // No MMCSS (the service may be disabled): at least raise the thread
+              SetThreadPriority(thread, (policy.priority == ThreadPriority_Highest) ? THREAD_PRIORITY_HIGHEST : THREAD_PRIORITY_ABOVE_NORMAL);
+              return false;
+          }
+      default:
+          return false;
+      }
+  }
+
+  static bool SetAffinity(ThreadPolicyState &state, const ThreadPolicy &policy)
+  {
+      if (policy.affinityMask == 0)
+      {
+          return true;
+      }
+      DWORD_PTR previous = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)policy.affinityMask);
+      if (previous == 0)
+      {
+          return false;
+      }
+      state.originalAffinity = previous;
+      return true;
+  }
+
+  static void RestoreOriginalScheduling(ThreadPolicyState &state)
+  {
+      HANDLE thread = GetCurrentThread();
+      if (state.mmcssHandle != nullptr)
+      {
+          AvRevertMmThreadCharacteristics(state.mmcssHandle);
+          state.mmcssHandle = nullptr;
+      }
+      SetThreadPriority(thread, state.originalPriority);
+      if (state.originalAffinity != 0)
+      {
+          SetThreadAffinityMask(thread, state.originalAffinity);
+          state.originalAffinity = 0;
+      }
+  }
+#else
+  // Nice values are per thread on Linux, set through the thread id
+  static bool SetNice(int nice)
+  {
+      return setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) == 0;
+  }
+
+  static void SaveOriginalScheduling(ThreadPolicyState &state)
+  {
+      state.realtime = false;
+      state.reniced = false;
+      state.pinned = false;
+      state.originalNice = getpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid));
+
+      sched_param param;
+      if (pthread_getschedparam(pthread_self(), &state.originalScheduler, &param) == 0)
+      {
+          state.originalSchedPriority = param.sched_priority;
+      }
+      else
+      {
+          state.originalScheduler = SCHED_OTHER;
+          state.originalSchedPriority = 0;
+      }
+      if (pthread_getaffinity_np(pthread_self(), sizeof(state.originalAffinity), &state.originalAffinity) != 0)
+      {
+          CPU_ZERO(&state.originalAffinity);
+      }
+  }
+
+  static bool SetPriority(ThreadPolicyState &state, const ThreadPolicy &policy)
+  {
+      switch (policy.priority)
+      {
+      case ThreadPriority_Normal:
+          return true;
+      case ThreadPriority_Lowest:
+          state.reniced = true;
+          return SetNice(10);
+      case ThreadPriority_BelowNormal:
+          state.reniced = true;
+          return SetNice(5);
+      case ThreadPriority_AboveNormal:
+          state.reniced = true;
+          return SetNice(-5);
+      case ThreadPriority_Highest:
+          {
+              sched_param param;
+              param.sched_priority = (policy.task == ThreadTask_Playback) ? PlaybackRealtimePriority : CaptureRealtimePriority;
+              if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+              {
+                  state.realtime = true;
+                  return true;
+              }
+
+              // Not allowed real-time scheduling: the best normal priority we can get
+              state.reniced = true;
+              SetNice(-10);
+              return false;
+          }
+      default:
+          return false;
+      }
+  }
+
+  static bool SetAffinity(ThreadPolicyState &state, const ThreadPolicy &policy)
+  {
+      if (policy.affinityMask == 0)
+      {
+          return true;
+      }
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      for (int cpu = 0; cpu < 64; cpu++)
+      {
+          if ((policy.affinityMask >> cpu) & 1)
+          {
+              CPU_SET(cpu, &cpus);
+          }
+      }
+      state.pinned = true;
+      return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+  }
+
+  static void RestoreOriginalScheduling(ThreadPolicyState &state)
+  {
+      if (state.realtime)
+      {
+          sched_param param;
+          param.sched_priority = state.originalSchedPriority;
+          pthread_setschedparam(pthread_self(), state.originalScheduler, &param);
+          state.realtime = false;
+      }
+      if (state.reniced)
+      {
+          SetNice(state.originalNice);
+          state.reniced = false;
+      }
+      if (state.pinned && CPU_COUNT(&state.originalAffinity) > 0)
+      {
+          pthread_setaffinity_np(pthread_self(), sizeof(state.originalAffinity), &state.originalAffinity);
+      }
+      state.pinned = false;
+  }
+#endif
+
+  //**********************************************************************
+  bool ApplyThreadPolicy(const ThreadPolicy &policy)
+  {
+      ThreadPolicyState &state = threadState;
+      if (state.applied)
+      {
+          if (IsSamePolicy(state.policy, policy))
+          {
+              return state.succeeded;
+          }
+          RestoreOriginalScheduling(state);
+      }
+      else
+      {
+          SaveOriginalScheduling(state);
+      }
+
+      state.applied = true;
+      state.policy = policy;
+      bool prioritySet = SetPriority(state, policy);
+      bool affinitySet = SetAffinity(state, policy);
+      state.succeeded = prioritySet && affinitySet;
+      return state.succeeded;
+  }
+
+  //**********************************************************************
+  void RevertThreadPolicy()
+  {
+      ThreadPolicyState &state = threadState;
+      if (state.applied)
+      {
+          RestoreOriginalScheduling(state);
+          state.applied = false;
+      }
+  }
+}}}}
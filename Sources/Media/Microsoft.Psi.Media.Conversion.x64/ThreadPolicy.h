@@ -0,0 +1,109 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Threading {
+
+  //**********************************************************************
+  // Scheduling policies for the threads that capture, encode and decode
+  // media: the Media Foundation capture callbacks, the RealSense frame
+  // threads, the MP4 and FFMPEG encode threads, the V4L2 capture thread
+  // and the FFMPEG decode-ahead thread. Like the conversions this lives in
+  // Microsoft.Psi.Media.Conversion so that every native media module can
+  // use it, and the header is plain enough to include from C++/CLI.
+  //
+  // A policy raises (or lowers) the priority of a thread and may pin it
+  // to a set of cores:
+  //   AboveNormal - Windows: registers the thread with the MMCSS task of
+  //                 the policy ("Capture" or "Playback"). Linux: nice -5.
+  //   Highest - Windows: the MMCSS task at AVRT_PRIORITY_HIGH. Linux:
+  //             SCHED_FIFO, which needs CAP_SYS_NICE or an RLIMIT_RTPRIO
+  //             allowance; without one the thread gets nice -10 instead.
+  //   BelowNormal, Lowest - normal scheduling at a lower priority (nice 5
+  //                         and 10 on Linux)
+  //   Normal - the priority is left as it is
+  // Where MMCSS isn't available (e.g. the service is disabled) the Windows
+  // thread priority is raised instead. Failures never stop the thread; it
+  // just runs with whatever the OS allowed.
+  //**********************************************************************
+
+  //**********************************************************************
+  // Thread priorities. NOTE: These must match System.Threading.ThreadPriority,
+  // which the configuration objects use.
+  //**********************************************************************
+  static const int ThreadPriority_Lowest = 0;
+  static const int ThreadPriority_BelowNormal = 1;
+  static const int ThreadPriority_Normal = 2;
+  static const int ThreadPriority_AboveNormal = 3;
+  static const int ThreadPriority_Highest = 4;
+
+  //**********************************************************************
+  // What a thread does, which picks its MMCSS task on Windows and its
+  // real-time priority on Linux (capture threads outrank playback threads)
+  //**********************************************************************
+  static const int ThreadTask_Capture = 0;
+  static const int ThreadTask_Playback = 1;
+
+  //**********************************************************************
+  // ThreadPolicy describes how a thread should be scheduled. Bit n of
+  // affinityMask lets the thread run on logical processor n; 0 lets it run
+  // anywhere. (On Windows machines with more than 64 logical processors
+  // the mask applies to the thread's processor group.)
+  //**********************************************************************
+  struct ThreadPolicy
+  {
+      int priority;                   /* ThreadPriority_* */
+      int task;                       /* ThreadTask_* */
+      uint64_t affinityMask;          /* Cores the thread may run on (0 = any) */
+  };
+
+  // Returns a policy of the given priority, task and affinity
+  inline ThreadPolicy MakeThreadPolicy(int priority, int task, uint64_t affinityMask)
+  {
+      ThreadPolicy policy;
+      policy.priority = priority;
+      policy.task = task;
+      policy.affinityMask = affinityMask;
+      return policy;
+  }
+
+  // Returns true if the policy leaves threads exactly as the OS made them
+  inline bool IsDefaultThreadPolicy(const ThreadPolicy &policy)
+  {
+      return policy.priority == ThreadPriority_Normal && policy.affinityMask == 0;
+  }
+
+  //**********************************************************************
+  // ApplyThreadPolicy() puts the calling thread under 'policy', first
+  // undoing any other policy it applied to the thread before. Calling it
+  // again with the same policy costs a comparison, so threads we don't own
+  // (Media Foundation's and librealsense's callback threads) can simply
+  // call it on every frame; failed attempts aren't retried either. Returns
+  // false if any part of the policy could not be applied.
+  // RevertThreadPolicy() restores the priority and affinity the thread had
+  // before the first ApplyThreadPolicy() call. Threads we own call it
+  // before they exit; otherwise MMCSS registrations end with the thread.
+  // (Lowering the nice value again after BelowNormal or Lowest needs
+  // CAP_SYS_NICE on Linux, so without it those threads stay lowered.)
+  //**********************************************************************
+  bool ApplyThreadPolicy(const ThreadPolicy &policy);
+  void RevertThreadPolicy();
+
+#ifdef _WIN32
+  //**********************************************************************
+  // The MMCSS task name (L"Capture" or L"Playback") and AVRT_PRIORITY_*
+  // value a policy registers threads with, for the MF_READWRITE_MMCSS_*
+  // attributes that put Media Foundation's own work queue threads under
+  // MMCSS. GetMmcssTaskName() returns nullptr for policies that don't use
+  // MMCSS (priorities below AboveNormal).
+  //**********************************************************************
+  const wchar_t *GetMmcssTaskName(const ThreadPolicy &policy);
+  int GetMmcssPriority(const ThreadPolicy &policy);
+#endif
+}}}}
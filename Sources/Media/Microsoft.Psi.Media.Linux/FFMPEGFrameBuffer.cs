@@ -0,0 +1,80 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#if FFMPEG
+
+namespace Microsoft.Psi.Media.Native.Linux
+{
+    using System;
+    using System.Runtime.InteropServices;
+
+    /// <summary>
+    /// Holds a frame decoded by FFMPEGReader.ReadFrameBuffer(). The data lives
+    /// in a buffer owned by the reader's frame pool and stays valid until this
+    /// object is disposed, which hands the buffer back to the pool. Disposing
+    /// after the reader has been closed is fine.
+    /// </summary>
+    public class FFMPEGFrameBuffer : IDisposable
+    {
+        private IntPtr buffer;
+
+        internal FFMPEGFrameBuffer(IntPtr buffer, IntPtr data, int size, double timestamp)
+        {
+            this.buffer = buffer;
+            this.Data = data;
+            this.Size = size;
+            this.Timestamp = timestamp;
+        }
+
+        /// <summary>
+        /// Finalizes an instance of the <see cref="FFMPEGFrameBuffer"/> class.
+        /// </summary>
+        ~FFMPEGFrameBuffer()
+        {
+            this.ReleaseBuffer();
+        }
+
+        /// <summary>
+        /// Gets the pointer to the decoded (and converted) frame data
+        /// </summary>
+        public IntPtr Data { get; private set; }
+
+        /// <summary>
+        /// Gets the number of bytes of frame data
+        /// </summary>
+        public int Size { get; private set; }
+
+        /// <summary>
+        /// Gets the presentation time of the frame in milliseconds
+        /// </summary>
+        public double Timestamp { get; private set; }
+
+        /// <summary>
+        /// Gets the native pool buffer holding the frame, for handing it to FFMPEGWriter without a copy
+        /// </summary>
+        internal IntPtr Buffer => this.buffer;
+
+        /// <summary>
+        /// Returns the buffer to the reader's frame pool
+        /// </summary>
+        public void Dispose()
+        {
+            this.ReleaseBuffer();
+            GC.SuppressFinalize(this);
+        }
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_ReleaseFrameBuffer")]
+        private static extern void FFMPEGReaderNative_ReleaseFrameBuffer(IntPtr buffer);
+
+        private void ReleaseBuffer()
+        {
+            if (this.buffer != IntPtr.Zero)
+            {
+                FFMPEGReaderNative_ReleaseFrameBuffer(this.buffer);
+                this.buffer = IntPtr.Zero;
+                this.Data = IntPtr.Zero;
+            }
+        }
+    }
+}
+#endif
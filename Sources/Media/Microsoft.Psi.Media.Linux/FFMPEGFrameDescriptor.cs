@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#if FFMPEG
+
+namespace Microsoft.Psi.Media.Native.Linux
+{
+    using System.Runtime.InteropServices;
+
+    /// <summary>
+    /// Describes one frame decoded by FFMPEGReader.ReadFrames(). The layout
+    /// matches the native reader's FFMPEGFrameDescriptorNative
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public struct FFMPEGFrameDescriptor
+    {
+        /// <summary>
+        /// Gets or sets the type of frame (FFMPEGFrameInfo.FrameTypeVideo or FFMPEGFrameInfo.FrameTypeAudio)
+        /// </summary>
+        public int FrameType { get; set; }
+
+        /// <summary>
+        /// Gets or sets the index of the stream the frame came from
+        /// </summary>
+        public int StreamId { get; set; }
+
+        /// <summary>
+        /// Gets or sets the byte offset of the frame's data in the arena
+        /// </summary>
+        public int Offset { get; set; }
+
+        /// <summary>
+        /// Gets or sets the number of bytes of frame data
+        /// </summary>
+        public int Size { get; set; }
+
+        /// <summary>
+        /// Gets or sets the presentation time of the frame in milliseconds
+        /// </summary>
+        public double Timestamp { get; set; }
+
+        /// <summary>
+        /// Gets or sets the wall clock time the frame arrived, in microseconds since 1/1/1970 UTC (see FFMPEGReader.FrameArrivalTime)
+        /// </summary>
+        public long ArrivalMicrosecs { get; set; }
+    }
+}
+#endif
@@ -29,6 +29,11 @@ namespace Microsoft.Psi.Media.Native.Linux
         /// Gets or sets the buffer size of the current frame
         /// </summary>
         public int BufferSize { get; set; } // The size of the buffer required to hold the decompressed data
+
+        /// <summary>
+        /// Gets or sets the index of the stream the frame came from
+        /// </summary>
+        public int StreamId { get; set; } // See FFMPEGReader.SelectStreams
     }
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#if FFMPEG
+
+namespace Microsoft.Psi.Media.Native.Linux
+{
+    using System;
+
+    /// <summary>
+    /// Contains the planes of a video frame decoded in planar output mode.
+    /// The plane pointers are owned by the reader and are only valid until
+    /// the next call to ReadFrameData()
+    /// </summary>
+    public class FFMPEGFramePlanes
+    {
+        /// <summary>
+        /// Gets the pointer to each plane (IntPtr.Zero if unused)
+        /// </summary>
+        public IntPtr[] Planes { get; } = new IntPtr[4];
+
+        /// <summary>
+        /// Gets the stride in bytes of each plane
+        /// </summary>
+        public int[] Strides { get; } = new int[4];
+
+        /// <summary>
+        /// Gets or sets FFMPEG's AVPixelFormat for the frame
+        /// </summary>
+        public int PixelFormat { get; set; }
+
+        /// <summary>
+        /// Gets or sets FFMPEG's name for the pixel format (e.g. "yuv420p")
+        /// </summary>
+        public string PixelFormatName { get; set; }
+
+        /// <summary>
+        /// Gets or sets the width of the frame in pixels
+        /// </summary>
+        public int Width { get; set; }
+
+        /// <summary>
+        /// Gets or sets the height of the frame in pixels
+        /// </summary>
+        public int Height { get; set; }
+    }
+}
+#endif
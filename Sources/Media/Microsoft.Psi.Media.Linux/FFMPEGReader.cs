@@ -6,6 +6,7 @@
 namespace Microsoft.Psi.Media.Native.Linux
 {
     using System;
+    using System.IO;
     using System.Runtime.InteropServices;
 
     /// <summary>
@@ -14,14 +15,25 @@ namespace Microsoft.Psi.Media.Native.Linux
     public class FFMPEGReader
     {
         private IntPtr unmanagedData;
+        private FFMPEGStreamInput streamInput; // Keeps the callbacks of a stream opened with Open(Stream) alive
 
         /// <summary>
         /// Initializes a new instance of the <see cref="FFMPEGReader"/> class.
         /// </summary>
         /// <param name="imageDepth">Depth of requested output images. Must be 24 or 32</param>
         public FFMPEGReader(int imageDepth)
+            : this(imageDepth, new FFMPEGReaderConfiguration())
         {
-            this.unmanagedData = FFMPEGReaderNative_Alloc(imageDepth);
+        }
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="FFMPEGReader"/> class.
+        /// </summary>
+        /// <param name="imageDepth">Depth of requested output images. Must be 24 or 32</param>
+        /// <param name="config">Configuration used to set up the decoders</param>
+        public FFMPEGReader(int imageDepth, FFMPEGReaderConfiguration config)
+        {
+            this.unmanagedData = FFMPEGReaderNative_Alloc(imageDepth, config.DecodingThreads, config.DecodingThreadType);
         }
 
         /// <summary>
@@ -92,7 +104,7 @@ namespace Microsoft.Psi.Media.Native.Linux
         }
 
         [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_Alloc")]
-        public static extern IntPtr FFMPEGReaderNative_Alloc(int imageDepth);
+        public static extern IntPtr FFMPEGReaderNative_Alloc(int imageDepth, int decodingThreads, int decodingThreadType);
 
         [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_Dealloc")]
         public static extern void FFMPEGReaderNative_Dealloc(IntPtr obj);
@@ -112,15 +124,193 @@ namespace Microsoft.Psi.Media.Native.Linux
         [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_GetAudioNumChannels")]
         public static extern int FFMPEGReaderNative_GetAudioNumChannels(IntPtr obj);
 
+        /// <summary>
+        /// Gets a value indicating whether video is being decoded on a hardware device
+        /// </summary>
+        public bool IsHardwareAccelerated
+        {
+            get
+            {
+                return (this.unmanagedData != IntPtr.Zero) ? FFMPEGReaderNative_IsHardwareAccelerated(this.unmanagedData) != 0 : false;
+            }
+        }
+
+        /// <summary>
+        /// Gets the wall clock time (UTC) at which the last frame read arrived. For live streams this is when
+        /// the frame was received, which unlike the stream's own timestamps can be compared with local sensors.
+        /// </summary>
+        public DateTime FrameArrivalTime
+        {
+            get
+            {
+                long micros = (this.unmanagedData != IntPtr.Zero) ? FFMPEGReaderNative_GetFrameArrivalTime(this.unmanagedData) : 0;
+                return new DateTime(1970, 1, 1, 0, 0, 0, DateTimeKind.Utc).AddTicks(micros * 10);
+            }
+        }
+
+        /// <summary>
+        /// Gets the number of times a live stream has been reconnected since it was opened
+        /// </summary>
+        public int ReconnectCount
+        {
+            get
+            {
+                return (this.unmanagedData != IntPtr.Zero) ? FFMPEGReaderNative_GetReconnectCount(this.unmanagedData) : 0;
+            }
+        }
+
+        /// <summary>
+        /// Gets the number of video frames converted to the output pixel format since the file was opened
+        /// </summary>
+        public long ScaledFrameCount
+        {
+            get
+            {
+                long frames = 0, micros = 0;
+                int rebuilds = 0;
+                if (this.unmanagedData != IntPtr.Zero)
+                {
+                    FFMPEGReaderNative_GetScalerStats(this.unmanagedData, ref frames, ref micros, ref rebuilds);
+                }
+
+                return frames;
+            }
+        }
+
+        /// <summary>
+        /// Gets the total time spent converting video frames to the output pixel format since the file was opened
+        /// </summary>
+        public TimeSpan ScaleTime
+        {
+            get
+            {
+                long frames = 0, micros = 0;
+                int rebuilds = 0;
+                if (this.unmanagedData != IntPtr.Zero)
+                {
+                    FFMPEGReaderNative_GetScalerStats(this.unmanagedData, ref frames, ref micros, ref rebuilds);
+                }
+
+                return TimeSpan.FromTicks(micros * 10);
+            }
+        }
+
+        /// <summary>
+        /// Gets the number of times the video scaler was rebuilt because the decoded resolution or format changed
+        /// </summary>
+        public int ScalerRebuildCount
+        {
+            get
+            {
+                long frames = 0, micros = 0;
+                int rebuilds = 0;
+                if (this.unmanagedData != IntPtr.Zero)
+                {
+                    FFMPEGReaderNative_GetScalerStats(this.unmanagedData, ref frames, ref micros, ref rebuilds);
+                }
+
+                return rebuilds;
+            }
+        }
+
+        /// <summary>
+        /// Gets the number of streams in the opened file
+        /// </summary>
+        public int StreamCount
+        {
+            get
+            {
+                return (this.unmanagedData != IntPtr.Zero) ? FFMPEGReaderNative_GetStreamCount(this.unmanagedData) : 0;
+            }
+        }
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_SetHardwareAcceleration", CharSet=CharSet.Ansi)]
+        public static extern int FFMPEGReaderNative_SetHardwareAcceleration(IntPtr obj, [MarshalAs(UnmanagedType.LPStr)]string deviceType);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_IsHardwareAccelerated")]
+        public static extern int FFMPEGReaderNative_IsHardwareAccelerated(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_SetPlanarOutput")]
+        public static extern int FFMPEGReaderNative_SetPlanarOutput(IntPtr obj, int planar);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_GetFramePlanes")]
+        public static extern int FFMPEGReaderNative_GetFramePlanes(IntPtr obj, [Out] IntPtr[] planes, [Out] int[] strides, ref int pixelFormat, ref int width, ref int height);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_GetFramePixelFormatName")]
+        public static extern IntPtr FFMPEGReaderNative_GetFramePixelFormatName(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_SetDecodeAheadDepth")]
+        public static extern int FFMPEGReaderNative_SetDecodeAheadDepth(IntPtr obj, int depth);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_SetDecodeAheadThreadPolicy")]
+        public static extern int FFMPEGReaderNative_SetDecodeAheadThreadPolicy(IntPtr obj, int priority, ulong affinityMask);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_SetKeyframesOnly")]
+        public static extern int FFMPEGReaderNative_SetKeyframesOnly(IntPtr obj, int keyframes);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_SetOutputSize")]
+        public static extern int FFMPEGReaderNative_SetOutputSize(IntPtr obj, int maxWidth, int maxHeight);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_SetIOBufferSize")]
+        public static extern int FFMPEGReaderNative_SetIOBufferSize(IntPtr obj, int bufferSize);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_SetLiveMode", CharSet=CharSet.Ansi)]
+        public static extern int FFMPEGReaderNative_SetLiveMode(IntPtr obj, int live, [MarshalAs(UnmanagedType.LPStr)]string transport, int probeSize, int analyzeDurationMs, int timeoutMs, int maxReconnects);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_GetFrameArrivalTime")]
+        public static extern long FFMPEGReaderNative_GetFrameArrivalTime(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_GetReconnectCount")]
+        public static extern int FFMPEGReaderNative_GetReconnectCount(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_GetScalerStats")]
+        public static extern void FFMPEGReaderNative_GetScalerStats(IntPtr obj, ref long frames, ref long microsecs, ref int rebuilds);
+
         [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_Open", CharSet=CharSet.Ansi)]
         public static extern int FFMPEGReaderNative_Open(IntPtr obj, [MarshalAs(UnmanagedType.LPStr)]string fn);
 
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_OpenFromBuffer")]
+        public static extern int FFMPEGReaderNative_OpenFromBuffer(IntPtr obj, IntPtr data, long size);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_OpenMappedFile", CharSet=CharSet.Ansi)]
+        public static extern int FFMPEGReaderNative_OpenMappedFile(IntPtr obj, [MarshalAs(UnmanagedType.LPStr)]string fn);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_GetStreamCount")]
+        public static extern int FFMPEGReaderNative_GetStreamCount(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_GetStreamInfo")]
+        public static extern int FFMPEGReaderNative_GetStreamInfo(IntPtr obj, int streamId, ref int frameType, ref int width, ref int height, ref int sampleRate, ref int numChannels);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_GetStreamCodecName")]
+        public static extern IntPtr FFMPEGReaderNative_GetStreamCodecName(IntPtr obj, int streamId);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_SelectStreams")]
+        public static extern int FFMPEGReaderNative_SelectStreams(IntPtr obj, int[] streamIds, int numStreams);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_GetFrameStreamId")]
+        public static extern int FFMPEGReaderNative_GetFrameStreamId(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_Seek")]
+        public static extern int FFMPEGReaderNative_Seek(IntPtr obj, double timestampMillisecs);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_SetReadRange")]
+        public static extern int FFMPEGReaderNative_SetReadRange(IntPtr obj, double startMillisecs, double endMillisecs);
+
         [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_NextFrame")]
         public static extern int FFMPEGReaderNative_NextFrame(IntPtr obj, ref int frameType, ref int requiredBufferSize, ref bool eos);
 
         [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_ReadFrameData")]
         public static extern int FFMPEGReaderNative_ReadFrameData(IntPtr obj, IntPtr buffer, ref int bytesRead, ref double timestamp);
 
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_SetFramePoolCapacity")]
+        public static extern int FFMPEGReaderNative_SetFramePoolCapacity(IntPtr obj, int capacity);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_ReadFrameBuffer")]
+        public static extern int FFMPEGReaderNative_ReadFrameBuffer(IntPtr obj, ref IntPtr buffer, ref IntPtr data, ref int bytesRead, ref double timestamp);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_ReadFrames")]
+        public static extern int FFMPEGReaderNative_ReadFrames(IntPtr obj, IntPtr arena, int arenaSize, [Out] FFMPEGFrameDescriptor[] descriptors, int maxFrames, ref int framesRead, [MarshalAs(UnmanagedType.U1)] ref bool eos);
+
         [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_Close")]
         public static extern int FFMPEGReaderNative_Close(IntPtr obj);
 
@@ -131,6 +321,7 @@ namespace Microsoft.Psi.Media.Native.Linux
         /// <param name="config">Configuration</param>
         public void Open(string fn, FFMPEGReaderConfiguration config)
         {
+            this.Configure(config);
             int hr = FFMPEGReaderNative_Open(this.unmanagedData, fn);
             if (hr < 0)
             {
@@ -138,6 +329,142 @@ namespace Microsoft.Psi.Media.Native.Linux
             }
         }
 
+        /// <summary>
+        /// Opens a file read from a stream (e.g. a MemoryStream over a message from a
+        /// Psi store), without going through a temporary file. The stream is read on
+        /// the thread doing the demuxing, and must stay open until the reader is closed.
+        /// Streams that can't seek can only be read front to back.
+        /// </summary>
+        /// <param name="stream">Stream to read the file from</param>
+        /// <param name="config">Configuration</param>
+        public void Open(Stream stream, FFMPEGReaderConfiguration config)
+        {
+            this.Configure(config);
+            var input = new FFMPEGStreamInput(stream);
+            int hr = FFMPEGReaderNative_OpenWithCallbacks(this.unmanagedData, input.Read, input.Seek, IntPtr.Zero);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to open stream. HRESULT=" + hr.ToString());
+            }
+
+            this.streamInput = input;
+        }
+
+        /// <summary>
+        /// Opens a file held in memory. The caller keeps ownership of the memory, which
+        /// must stay valid (e.g. pinned) until the reader is closed.
+        /// </summary>
+        /// <param name="data">Start of the file</param>
+        /// <param name="size">Size of the file in bytes</param>
+        /// <param name="config">Configuration</param>
+        public void OpenFromBuffer(IntPtr data, long size, FFMPEGReaderConfiguration config)
+        {
+            this.Configure(config);
+            int hr = FFMPEGReaderNative_OpenFromBuffer(this.unmanagedData, data, size);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to open buffer. HRESULT=" + hr.ToString());
+            }
+        }
+
+        /// <summary>
+        /// Opens a file by memory mapping it. The file is read ahead of the demuxer in
+        /// large requests, which suits slow (e.g. network) storage.
+        /// </summary>
+        /// <param name="fn">File to open</param>
+        /// <param name="config">Configuration</param>
+        public void OpenMappedFile(string fn, FFMPEGReaderConfiguration config)
+        {
+            this.Configure(config);
+            int hr = FFMPEGReaderNative_OpenMappedFile(this.unmanagedData, fn);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to open mapped file. HRESULT=" + hr.ToString());
+            }
+        }
+
+        /// <summary>
+        /// GetStreamInfo() describes one of the streams in the opened file,
+        /// whether or not it is selected.
+        /// </summary>
+        /// <param name="streamId">Index of the stream</param>
+        /// <returns>Description of the stream</returns>
+        public FFMPEGStreamInfo GetStreamInfo(int streamId)
+        {
+            int frameType = 0;
+            int width = 0;
+            int height = 0;
+            int sampleRate = 0;
+            int numChannels = 0;
+            int hr = FFMPEGReaderNative_GetStreamInfo(this.unmanagedData, streamId, ref frameType, ref width, ref height, ref sampleRate, ref numChannels);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to get stream info. HRESULT=" + hr.ToString());
+            }
+
+            IntPtr codecName = FFMPEGReaderNative_GetStreamCodecName(this.unmanagedData, streamId);
+            FFMPEGStreamInfo info = new FFMPEGStreamInfo();
+            info.StreamId = streamId;
+            info.FrameType = frameType;
+            info.CodecName = (codecName != IntPtr.Zero) ? Marshal.PtrToStringAnsi(codecName) : null;
+            info.Width = width;
+            info.Height = height;
+            info.AudioSampleRate = sampleRate;
+            info.AudioNumChannels = numChannels;
+            return info;
+        }
+
+        /// <summary>
+        /// SelectStreams() selects which audio and video streams are decoded
+        /// (by default the last audio and the last video stream in the file).
+        /// All other streams are dropped by the demuxer. FFMPEGFrameInfo's
+        /// StreamId says which stream each frame came from.
+        /// </summary>
+        /// <param name="streamIds">Indices of the streams to decode</param>
+        public void SelectStreams(int[] streamIds)
+        {
+            if (streamIds.Length == 0)
+            {
+                throw new ArgumentException("At least one stream must be selected");
+            }
+
+            int hr = FFMPEGReaderNative_SelectStreams(this.unmanagedData, streamIds, streamIds.Length);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to select streams. HRESULT=" + hr.ToString());
+            }
+        }
+
+        /// <summary>
+        /// Seek() repositions playback so the next frame returned is the first
+        /// one at or after 'timestampMillisecs' (measured from the start of the
+        /// file, like the timestamps returned by ReadFrameData()).
+        /// </summary>
+        /// <param name="timestampMillisecs">Time to seek to</param>
+        public void Seek(double timestampMillisecs)
+        {
+            int hr = FFMPEGReaderNative_Seek(this.unmanagedData, timestampMillisecs);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to seek. HRESULT=" + hr.ToString());
+            }
+        }
+
+        /// <summary>
+        /// SetReadRange() limits playback to [startMillisecs, endMillisecs).
+        /// NextFrame() reports end of stream once the range has been read.
+        /// </summary>
+        /// <param name="startMillisecs">Start of the range</param>
+        /// <param name="endMillisecs">End of the range. Negative reads to the end of the file</param>
+        public void SetReadRange(double startMillisecs, double endMillisecs)
+        {
+            int hr = FFMPEGReaderNative_SetReadRange(this.unmanagedData, startMillisecs, endMillisecs);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to set read range. HRESULT=" + hr.ToString());
+            }
+        }
+
         /// <summary>
         /// NextFrame() advances the playback engine to the next audio or video
         /// packet to be processed. This method will fill in 'info' with the type
@@ -170,6 +497,7 @@ namespace Microsoft.Psi.Media.Native.Linux
 
             info.FrameType = frameType;
             info.BufferSize = requiredBufferSize;
+            info.StreamId = FFMPEGReaderNative_GetFrameStreamId(this.unmanagedData);
             if (hr < 0)
             {
                 throw new Exception("Failed to read video frame. HRESULT=" + hr.ToString());
@@ -209,6 +537,91 @@ namespace Microsoft.Psi.Media.Native.Linux
             return false;
         }
 
+        /// <summary>
+        /// ReadFrameBuffer() is ReadFrameData() without the copy: the frame is
+        /// decoded into a pooled buffer owned by the reader, which is returned
+        /// to the pool when 'frameBuffer' is disposed. In planar mode video
+        /// frames have no data and 'frameBuffer' is null.
+        /// </summary>
+        /// <param name="frameBuffer">Receives the decoded frame</param>
+        /// <returns>true if we successfully decoded a frame</returns>
+        public bool ReadFrameBuffer(out FFMPEGFrameBuffer frameBuffer)
+        {
+            IntPtr buffer = IntPtr.Zero;
+            IntPtr data = IntPtr.Zero;
+            int bytesRead = 0;
+            double ts = 0.0;
+            frameBuffer = null;
+            int hr = FFMPEGReaderNative_ReadFrameBuffer(this.unmanagedData, ref buffer, ref data, ref bytesRead, ref ts);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to read video frame. HRESULT=" + hr.ToString());
+            }
+
+            if (hr == 1)
+            {
+                return false;
+            }
+
+            if (buffer != IntPtr.Zero)
+            {
+                frameBuffer = new FFMPEGFrameBuffer(buffer, data, bytesRead, ts);
+            }
+
+            return true; // Successfully decoded frame
+        }
+
+        /// <summary>
+        /// GetFramePlanes() returns the planes of the video frame decoded by the
+        /// last call to ReadFrameData(). Only valid in planar output mode. The
+        /// data is not copied; the pointers are valid until the next call to
+        /// ReadFrameData().
+        /// </summary>
+        /// <param name="planes">Filled with the planes of the current frame</param>
+        public void GetFramePlanes(ref FFMPEGFramePlanes planes)
+        {
+            int pixelFormat = 0;
+            int width = 0;
+            int height = 0;
+            int hr = FFMPEGReaderNative_GetFramePlanes(this.unmanagedData, planes.Planes, planes.Strides, ref pixelFormat, ref width, ref height);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to get video frame planes. HRESULT=" + hr.ToString());
+            }
+
+            IntPtr name = FFMPEGReaderNative_GetFramePixelFormatName(this.unmanagedData);
+            planes.PixelFormat = pixelFormat;
+            planes.PixelFormatName = (name != IntPtr.Zero) ? Marshal.PtrToStringAnsi(name) : null;
+            planes.Width = width;
+            planes.Height = height;
+        }
+
+        /// <summary>
+        /// ReadFrames() decodes as many frames as fit in 'arena' (up to the length
+        /// of 'descriptors') in one call into the native reader. Each frame is
+        /// described by the matching entry in 'descriptors'. Throws if the arena
+        /// can't hold even one frame; the frame is kept, and NextFrame() reports
+        /// the buffer size it needs.
+        /// </summary>
+        /// <param name="arena">Buffer to fill with frame data</param>
+        /// <param name="arenaSize">Size of arena in bytes</param>
+        /// <param name="descriptors">Filled with a description of each frame read</param>
+        /// <param name="endOfStream">Returns true if the end of stream was reached</param>
+        /// <returns>Number of frames read</returns>
+        public int ReadFrames(IntPtr arena, int arenaSize, FFMPEGFrameDescriptor[] descriptors, out bool endOfStream)
+        {
+            int framesRead = 0;
+            bool eos = false;
+            int hr = FFMPEGReaderNative_ReadFrames(this.unmanagedData, arena, arenaSize, descriptors, descriptors.Length, ref framesRead, ref eos);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to read frames. HRESULT=" + hr.ToString());
+            }
+
+            endOfStream = eos;
+            return framesRead;
+        }
+
         /// <summary>
         /// Close the reader
         /// </summary>
@@ -222,11 +635,43 @@ namespace Microsoft.Psi.Media.Native.Linux
                 this.unmanagedData = IntPtr.Zero;
             }
 
+            this.streamInput = null;
             if (hr < 0)
             {
                 throw new Exception("Failed to read video frame. HRESULT=" + hr.ToString());
             }
         }
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGReaderNative_OpenWithCallbacks")]
+        internal static extern int FFMPEGReaderNative_OpenWithCallbacks(IntPtr obj, FFMPEGStreamInput.ReadCallback read, FFMPEGStreamInput.SeekCallback seek, IntPtr opaque);
+
+        private static void CheckConfigure(int hr, string setting)
+        {
+            if (hr < 0)
+            {
+                throw new Exception("Failed to set " + setting + ". HRESULT=" + hr.ToString());
+            }
+        }
+
+        private void Configure(FFMPEGReaderConfiguration config)
+        {
+            if (config != null && config.HardwareAcceleration != null)
+            {
+                CheckConfigure(FFMPEGReaderNative_SetHardwareAcceleration(this.unmanagedData, config.HardwareAcceleration), "hardware acceleration");
+            }
+
+            if (config != null)
+            {
+                CheckConfigure(FFMPEGReaderNative_SetPlanarOutput(this.unmanagedData, config.PlanarOutput ? 1 : 0), "planar output");
+                CheckConfigure(FFMPEGReaderNative_SetDecodeAheadDepth(this.unmanagedData, config.DecodeAheadDepth), "decode-ahead depth");
+                CheckConfigure(FFMPEGReaderNative_SetDecodeAheadThreadPolicy(this.unmanagedData, (int)config.DecodeAheadThreadPriority, config.DecodeAheadThreadAffinity), "decode-ahead thread policy");
+                CheckConfigure(FFMPEGReaderNative_SetFramePoolCapacity(this.unmanagedData, config.FramePoolCapacity), "frame pool capacity");
+                CheckConfigure(FFMPEGReaderNative_SetIOBufferSize(this.unmanagedData, config.IOBufferSize), "I/O buffer size");
+                CheckConfigure(FFMPEGReaderNative_SetKeyframesOnly(this.unmanagedData, config.KeyframesOnly ? 1 : 0), "keyframes only");
+                CheckConfigure(FFMPEGReaderNative_SetOutputSize(this.unmanagedData, config.MaxOutputWidth, config.MaxOutputHeight), "output size");
+                CheckConfigure(FFMPEGReaderNative_SetLiveMode(this.unmanagedData, config.LiveMode ? 1 : 0, config.LiveTransport, config.LiveProbeSize, config.LiveAnalyzeDurationMs, config.LiveTimeoutMs, config.LiveMaxReconnects), "live mode");
+            }
+        }
     }
 }
 #pragma warning restore SA1615, SA1600
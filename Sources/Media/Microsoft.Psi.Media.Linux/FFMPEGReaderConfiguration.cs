@@ -5,11 +5,112 @@
 
 namespace Microsoft.Psi.Media.Native.Linux
 {
+    using System.Threading;
+
     /// <summary>
     /// Defines configuration parameters for FFMPEG
     /// </summary>
     public class FFMPEGReaderConfiguration
     {
+        /// <summary>
+        /// Thread type flag for decoding multiple frames in parallel. Adds latency.
+        /// </summary>
+        public const int ThreadTypeFrame = 1;
+
+        /// <summary>
+        /// Thread type flag for decoding slices of a single frame in parallel.
+        /// </summary>
+        public const int ThreadTypeSlice = 2;
+
+        /// <summary>
+        /// Gets or sets the number of video decoding threads (0 = one per core, 1 = single threaded)
+        /// </summary>
+        public int DecodingThreads { get; set; } = 1;
+
+        /// <summary>
+        /// Gets or sets the combination of ThreadTypeFrame/ThreadTypeSlice to use (0 = codec default)
+        /// </summary>
+        public int DecodingThreadType { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the device used for video decoding: null (software), "auto", or an FFMPEG device type (e.g. "vaapi" or "cuda")
+        /// </summary>
+        public string HardwareAcceleration { get; set; } = null;
+
+        /// <summary>
+        /// Gets or sets a value indicating whether video is handed out in the decoder's own format (see FFMPEGReader.GetFramePlanes) instead of being converted to RGB
+        /// </summary>
+        public bool PlanarOutput { get; set; } = false;
+
+        /// <summary>
+        /// Gets or sets the number of frames decoded ahead on a background thread (0 = decode on the caller's thread)
+        /// </summary>
+        public int DecodeAheadDepth { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the priority of the decode-ahead thread (see <see cref="DecodeAheadDepth"/>). Highest asks for SCHED_FIFO real-time scheduling
+        /// </summary>
+        public ThreadPriority DecodeAheadThreadPriority { get; set; } = ThreadPriority.Normal;
+
+        /// <summary>
+        /// Gets or sets the CPUs the decode-ahead thread may run on, as a bit mask (bit n for CPU n, 0 for any)
+        /// </summary>
+        public ulong DecodeAheadThreadAffinity { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the number of released frame buffers kept for reuse by FFMPEGReader.ReadFrameBuffer()
+        /// </summary>
+        public int FramePoolCapacity { get; set; } = 8;
+
+        /// <summary>
+        /// Gets or sets the size of the buffer files opened from streams, memory or mappings are read through (0 = 64KB, or 1MB for mapped files)
+        /// </summary>
+        public int IOBufferSize { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets a value indicating whether only video keyframes are decoded (for fast scrubbing and thumbnails; seeks land on the keyframe at or before the target)
+        /// </summary>
+        public bool KeyframesOnly { get; set; } = false;
+
+        /// <summary>
+        /// Gets or sets the width video frames are scaled down to fit within, keeping their aspect ratio (0 = unconstrained)
+        /// </summary>
+        public int MaxOutputWidth { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the height video frames are scaled down to fit within, keeping their aspect ratio (0 = unconstrained)
+        /// </summary>
+        public int MaxOutputHeight { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets a value indicating whether the file name is the URL of a live stream (RTSP, RTP, SRT, ...) to ingest with low latency and reconnect to when it drops out
+        /// </summary>
+        public bool LiveMode { get; set; } = false;
+
+        /// <summary>
+        /// Gets or sets the RTSP transport used in live mode ("tcp", "udp", "udp_multicast" or "http"; null = FFMPEG's default)
+        /// </summary>
+        public string LiveTransport { get; set; } = null;
+
+        /// <summary>
+        /// Gets or sets the number of bytes of a live stream probed for stream info when it is opened (0 = 32KB)
+        /// </summary>
+        public int LiveProbeSize { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the length of a live stream analyzed for stream info when it is opened, in milliseconds (0 = 500ms)
+        /// </summary>
+        public int LiveAnalyzeDurationMs { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the longest a read from a live stream may block before reconnecting, in milliseconds (0 = 5s)
+        /// </summary>
+        public int LiveTimeoutMs { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the number of attempts made to reconnect a live stream that drops out (-1 = keep trying, 0 = never)
+        /// </summary>
+        public int LiveMaxReconnects { get; set; } = 10;
     }
 }
 #endif
\ No newline at end of file
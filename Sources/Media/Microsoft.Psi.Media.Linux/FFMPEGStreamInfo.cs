@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#if FFMPEG
+
+namespace Microsoft.Psi.Media.Native.Linux
+{
+    /// <summary>
+    /// Describes one of the streams in a file opened by FFMPEGReader
+    /// </summary>
+    public class FFMPEGStreamInfo
+    {
+        /// <summary>
+        /// Gets or sets the index of the stream in the file
+        /// </summary>
+        public int StreamId { get; set; }
+
+        /// <summary>
+        /// Gets or sets the type of stream (FFMPEGFrameInfo.FrameTypeVideo, FFMPEGFrameInfo.FrameTypeAudio or -1 for other streams)
+        /// </summary>
+        public int FrameType { get; set; }
+
+        /// <summary>
+        /// Gets or sets FFMPEG's name for the stream's codec (e.g. "h264")
+        /// </summary>
+        public string CodecName { get; set; }
+
+        /// <summary>
+        /// Gets or sets the width of the video in pixels (0 for audio)
+        /// </summary>
+        public int Width { get; set; }
+
+        /// <summary>
+        /// Gets or sets the height of the video in pixels (0 for audio)
+        /// </summary>
+        public int Height { get; set; }
+
+        /// <summary>
+        /// Gets or sets the audio sample rate (0 for video)
+        /// </summary>
+        public int AudioSampleRate { get; set; }
+
+        /// <summary>
+        /// Gets or sets the number of audio channels (0 for video)
+        /// </summary>
+        public int AudioNumChannels { get; set; }
+    }
+}
+#endif
@@ -0,0 +1,97 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#if FFMPEG
+
+namespace Microsoft.Psi.Media.Native.Linux
+{
+    using System;
+    using System.IO;
+    using System.Runtime.InteropServices;
+
+    /// <summary>
+    /// Adapts a Stream to the read/seek callbacks of FFMPEGReaderNative_OpenWithCallbacks(). The
+    /// reader keeps this alive for as long as the native reader may call back into it
+    /// </summary>
+    internal class FFMPEGStreamInput
+    {
+        private const int SeekSize = 0x10000; // FFMPEGSeekSize: asks for the size of the stream
+
+        private readonly Stream stream;
+        private byte[] buffer = new byte[0];
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="FFMPEGStreamInput"/> class.
+        /// </summary>
+        /// <param name="stream">Stream to read</param>
+        public FFMPEGStreamInput(Stream stream)
+        {
+            this.stream = stream;
+            this.Read = this.ReadStream;
+            this.Seek = stream.CanSeek ? this.SeekStream : (SeekCallback)null;
+        }
+
+        /// <summary>
+        /// Native read callback (see FFMPEGReadCallback)
+        /// </summary>
+        /// <param name="opaque">Unused</param>
+        /// <param name="buffer">Buffer to read into</param>
+        /// <param name="size">Size of the buffer</param>
+        /// <returns>Number of bytes read, 0 at the end of the stream or -1 on error</returns>
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        public delegate int ReadCallback(IntPtr opaque, IntPtr buffer, int size);
+
+        /// <summary>
+        /// Native seek callback (see FFMPEGSeekCallback)
+        /// </summary>
+        /// <param name="opaque">Unused</param>
+        /// <param name="offset">Offset to seek to</param>
+        /// <param name="whence">Origin of the offset, or FFMPEGSeekSize</param>
+        /// <returns>New position (or the size of the stream), or -1 on error</returns>
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        public delegate long SeekCallback(IntPtr opaque, long offset, int whence);
+
+        /// <summary>
+        /// Gets the read callback
+        /// </summary>
+        public ReadCallback Read { get; }
+
+        /// <summary>
+        /// Gets the seek callback (null if the stream can't seek)
+        /// </summary>
+        public SeekCallback Seek { get; }
+
+        // Exceptions must not unwind into the native reader, so failures are reported as -1
+        private int ReadStream(IntPtr opaque, IntPtr data, int size)
+        {
+            try
+            {
+                if (this.buffer.Length < size)
+                {
+                    this.buffer = new byte[size];
+                }
+
+                int bytesRead = this.stream.Read(this.buffer, 0, size);
+                Marshal.Copy(this.buffer, 0, data, bytesRead);
+                return bytesRead;
+            }
+            catch (Exception)
+            {
+                return -1;
+            }
+        }
+
+        private long SeekStream(IntPtr opaque, long offset, int whence)
+        {
+            try
+            {
+                return (whence == SeekSize) ? this.stream.Length : this.stream.Seek(offset, (SeekOrigin)whence);
+            }
+            catch (Exception)
+            {
+                return -1;
+            }
+        }
+    }
+}
+#endif
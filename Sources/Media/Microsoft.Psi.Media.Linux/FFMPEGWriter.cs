@@ -0,0 +1,241 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#if FFMPEG
+#pragma warning disable SA1615, SA1600
+namespace Microsoft.Psi.Media.Native.Linux
+{
+    using System;
+    using System.Runtime.InteropServices;
+    using Microsoft.Psi.Imaging;
+
+    /// <summary>
+    /// Defines our wrapper class for calling into our Native FFMPEG writer
+    /// </summary>
+    public class FFMPEGWriter
+    {
+        private IntPtr unmanagedData;
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="FFMPEGWriter"/> class.
+        /// </summary>
+        public FFMPEGWriter()
+        {
+            this.unmanagedData = FFMPEGWriterNative_Alloc();
+        }
+
+        /// <summary>
+        /// Finalizes an instance of the <see cref="FFMPEGWriter"/> class.
+        /// </summary>
+        ~FFMPEGWriter()
+        {
+            if (this.unmanagedData != IntPtr.Zero)
+            {
+                FFMPEGWriterNative_Dealloc(this.unmanagedData);
+                this.unmanagedData = IntPtr.Zero;
+            }
+        }
+
+        /// <summary>
+        /// Gets the number of samples waiting for the encode thread
+        /// </summary>
+        public int QueueDepth
+        {
+            get
+            {
+                return (this.unmanagedData != IntPtr.Zero) ? FFMPEGWriterNative_GetQueueDepth(this.unmanagedData) : 0;
+            }
+        }
+
+        /// <summary>
+        /// Gets the number of video frames dropped because the write queue was full
+        /// </summary>
+        public int DroppedFrames
+        {
+            get
+            {
+                return (this.unmanagedData != IntPtr.Zero) ? FFMPEGWriterNative_GetNumFramesDropped(this.unmanagedData) : 0;
+            }
+        }
+
+        /// <summary>
+        /// Gets the FFMPEG name of the video encoder in use (e.g. "h264_nvenc")
+        /// </summary>
+        public string EncoderName
+        {
+            get
+            {
+                return (this.unmanagedData != IntPtr.Zero) ? Marshal.PtrToStringAnsi(FFMPEGWriterNative_GetEncoderName(this.unmanagedData)) : null;
+            }
+        }
+
+        /// <summary>
+        /// Gets a value indicating whether video is being encoded on a hardware device
+        /// </summary>
+        public bool IsHardwareAccelerated
+        {
+            get
+            {
+                return (this.unmanagedData != IntPtr.Zero) ? FFMPEGWriterNative_IsHardwareAccelerated(this.unmanagedData) != 0 : false;
+            }
+        }
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_Alloc")]
+        public static extern IntPtr FFMPEGWriterNative_Alloc();
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_Dealloc")]
+        public static extern void FFMPEGWriterNative_Dealloc(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_SetVideoEncoder", CharSet=CharSet.Ansi)]
+        public static extern int FFMPEGWriterNative_SetVideoEncoder(IntPtr obj, [MarshalAs(UnmanagedType.LPStr)]string codec, [MarshalAs(UnmanagedType.LPStr)]string encoder, int bitrate, int gopSize, int bFrames, [MarshalAs(UnmanagedType.LPStr)]string preset);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_SetAudio")]
+        public static extern int FFMPEGWriterNative_SetAudio(IntPtr obj, int inputSampleRate, int inputChannels, int bitrate);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_SetWriteQueue")]
+        public static extern int FFMPEGWriterNative_SetWriteQueue(IntPtr obj, int queueSize, int dropWhenFull);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_SetThreadPolicy")]
+        public static extern int FFMPEGWriterNative_SetThreadPolicy(IntPtr obj, int priority, ulong affinityMask);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_Open", CharSet=CharSet.Ansi)]
+        public static extern int FFMPEGWriterNative_Open(IntPtr obj, [MarshalAs(UnmanagedType.LPStr)]string filename, int width, int height, int frameRateNum, int frameRateDenom);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_WriteVideoFrame")]
+        public static extern int FFMPEGWriterNative_WriteVideoFrame(IntPtr obj, long timestamp, IntPtr data, int width, int height, int stride, int pixelFormat);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_WriteVideoFrameBuffer")]
+        public static extern int FFMPEGWriterNative_WriteVideoFrameBuffer(IntPtr obj, long timestamp, IntPtr buffer, int width, int height, int stride, int pixelFormat);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_WriteAudio")]
+        public static extern int FFMPEGWriterNative_WriteAudio(IntPtr obj, long timestamp, IntPtr pcmData, int numBytes);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_GetQueueDepth")]
+        public static extern int FFMPEGWriterNative_GetQueueDepth(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_GetNumFramesDropped")]
+        public static extern int FFMPEGWriterNative_GetNumFramesDropped(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_GetEncoderName")]
+        public static extern IntPtr FFMPEGWriterNative_GetEncoderName(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_IsHardwareAccelerated")]
+        public static extern int FFMPEGWriterNative_IsHardwareAccelerated(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="FFMPEGWriterNative_Close")]
+        public static extern int FFMPEGWriterNative_Close(IntPtr obj);
+
+        /// <summary>
+        /// Creates the output file. The container is picked from the file name's extension (.mp4, .mkv, ...)
+        /// </summary>
+        /// <param name="fn">Name of the file to write</param>
+        /// <param name="config">Encoder and output settings</param>
+        public void Open(string fn, FFMPEGWriterConfiguration config)
+        {
+            int hr = FFMPEGWriterNative_SetVideoEncoder(this.unmanagedData, config.VideoCodec, config.Encoder, config.TargetBitrate, config.GopSize, config.BFrameCount, config.Preset);
+            if (hr >= 0 && config.ContainsAudio)
+            {
+                hr = FFMPEGWriterNative_SetAudio(this.unmanagedData, config.AudioSampleRate, config.AudioChannels, config.AudioBitrate);
+            }
+
+            if (hr >= 0)
+            {
+                hr = FFMPEGWriterNative_SetWriteQueue(this.unmanagedData, config.WriteQueueSize, config.DropFramesWhenQueueFull ? 1 : 0);
+            }
+
+            if (hr >= 0)
+            {
+                hr = FFMPEGWriterNative_SetThreadPolicy(this.unmanagedData, (int)config.EncodeThreadPriority, config.EncodeThreadAffinity);
+            }
+
+            if (hr >= 0)
+            {
+                hr = FFMPEGWriterNative_Open(this.unmanagedData, fn, config.Width, config.Height, config.FrameRateNumerator, config.FrameRateDenominator);
+            }
+
+            if (hr < 0)
+            {
+                throw new Exception("Failed to open video file for writing. HRESULT=" + hr.ToString());
+            }
+        }
+
+        /// <summary>
+        /// Writes an image. With a write queue the image is copied, so the caller may reuse it as soon as this returns
+        /// </summary>
+        /// <param name="timestamp">Time of the frame in 100ns ticks (the first time written becomes 0)</param>
+        /// <param name="data">Image data</param>
+        /// <param name="width">Width of the image</param>
+        /// <param name="height">Height of the image</param>
+        /// <param name="stride">Bytes from one row to the next</param>
+        /// <param name="pixelFormat">Gray_8bpp, BGR_24bpp, BGRX_32bpp or BGRA_32bpp</param>
+        /// <returns>False if the frame was dropped because the write queue was full</returns>
+        public bool WriteVideoFrame(long timestamp, IntPtr data, int width, int height, int stride, PixelFormat pixelFormat)
+        {
+            int hr = FFMPEGWriterNative_WriteVideoFrame(this.unmanagedData, timestamp, data, width, height, stride, (int)pixelFormat);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to write video frame. HRESULT=" + hr.ToString());
+            }
+
+            return hr == 0;
+        }
+
+        /// <summary>
+        /// Writes a frame returned by FFMPEGReader.ReadFrameBuffer() without copying it. The writer holds its own
+        /// reference to the buffer, so the frame may be disposed as soon as this returns
+        /// </summary>
+        /// <param name="timestamp">Time of the frame in 100ns ticks (the first time written becomes 0)</param>
+        /// <param name="frame">Frame to write</param>
+        /// <param name="width">Width of the image</param>
+        /// <param name="height">Height of the image</param>
+        /// <param name="pixelFormat">BGR_24bpp or BGRX_32bpp, matching the reader's image depth</param>
+        /// <returns>False if the frame was dropped because the write queue was full</returns>
+        public bool WriteVideoFrame(long timestamp, FFMPEGFrameBuffer frame, int width, int height, PixelFormat pixelFormat)
+        {
+            int stride = width * ((pixelFormat == PixelFormat.BGR_24bpp) ? 3 : 4);
+            int hr = FFMPEGWriterNative_WriteVideoFrameBuffer(this.unmanagedData, timestamp, frame.Buffer, width, height, stride, (int)pixelFormat);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to write video frame. HRESULT=" + hr.ToString());
+            }
+
+            return hr == 0;
+        }
+
+        /// <summary>
+        /// Writes a block of interleaved 16-bit PCM in the format given by the configuration
+        /// </summary>
+        /// <param name="timestamp">Time of the first sample in 100ns ticks</param>
+        /// <param name="pcmData">Audio data</param>
+        /// <param name="numBytes">Number of bytes of audio data</param>
+        public void WriteAudio(long timestamp, IntPtr pcmData, int numBytes)
+        {
+            int hr = FFMPEGWriterNative_WriteAudio(this.unmanagedData, timestamp, pcmData, numBytes);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to write audio. HRESULT=" + hr.ToString());
+            }
+        }
+
+        /// <summary>
+        /// Encodes whatever is still queued and finishes the file
+        /// </summary>
+        public void Close()
+        {
+            int hr = 0;
+            if (this.unmanagedData != IntPtr.Zero)
+            {
+                hr = FFMPEGWriterNative_Close(this.unmanagedData);
+                FFMPEGWriterNative_Dealloc(this.unmanagedData);
+                this.unmanagedData = IntPtr.Zero;
+            }
+
+            if (hr < 0)
+            {
+                throw new Exception("Failed to finish video file. HRESULT=" + hr.ToString());
+            }
+        }
+    }
+}
+#pragma warning restore SA1615, SA1600
+#endif // FFMPEG
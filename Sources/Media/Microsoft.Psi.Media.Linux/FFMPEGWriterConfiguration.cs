@@ -0,0 +1,106 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#if FFMPEG
+
+namespace Microsoft.Psi.Media.Native.Linux
+{
+    using System.Threading;
+
+    /// <summary>
+    /// Defines configuration parameters for the FFMPEG writer
+    /// </summary>
+    public class FFMPEGWriterConfiguration
+    {
+        /// <summary>
+        /// Gets or sets the width of the encoded video (frames of other sizes are scaled)
+        /// </summary>
+        public int Width { get; set; } = 1920;
+
+        /// <summary>
+        /// Gets or sets the height of the encoded video (frames of other sizes are scaled)
+        /// </summary>
+        public int Height { get; set; } = 1080;
+
+        /// <summary>
+        /// Gets or sets the numerator of the nominal frame rate
+        /// </summary>
+        public int FrameRateNumerator { get; set; } = 30;
+
+        /// <summary>
+        /// Gets or sets the denominator of the nominal frame rate
+        /// </summary>
+        public int FrameRateDenominator { get; set; } = 1;
+
+        /// <summary>
+        /// Gets or sets the video codec ("h264" or "hevc")
+        /// </summary>
+        public string VideoCodec { get; set; } = "h264";
+
+        /// <summary>
+        /// Gets or sets the video encoder: "auto" tries NVENC, then VAAPI, then software (libx264/libx265); anything else is an FFMPEG encoder name (e.g. "h264_nvenc")
+        /// </summary>
+        public string Encoder { get; set; } = "auto";
+
+        /// <summary>
+        /// Gets or sets the target video bitrate in bits/sec
+        /// </summary>
+        public int TargetBitrate { get; set; } = 10000000;
+
+        /// <summary>
+        /// Gets or sets the number of frames from one keyframe to the next (-1 = encoder default)
+        /// </summary>
+        public int GopSize { get; set; } = -1;
+
+        /// <summary>
+        /// Gets or sets the number of B frames between reference frames (-1 = encoder default)
+        /// </summary>
+        public int BFrameCount { get; set; } = -1;
+
+        /// <summary>
+        /// Gets or sets the encoder preset (null = "veryfast" for software encoders, the encoder's default otherwise)
+        /// </summary>
+        public string Preset { get; set; } = null;
+
+        /// <summary>
+        /// Gets or sets a value indicating whether the file contains an AAC audio stream
+        /// </summary>
+        public bool ContainsAudio { get; set; } = false;
+
+        /// <summary>
+        /// Gets or sets the sample rate of the 16-bit PCM audio written
+        /// </summary>
+        public int AudioSampleRate { get; set; } = 48000;
+
+        /// <summary>
+        /// Gets or sets the number of channels of the 16-bit PCM audio written
+        /// </summary>
+        public int AudioChannels { get; set; } = 2;
+
+        /// <summary>
+        /// Gets or sets the AAC bitrate in bits/sec
+        /// </summary>
+        public int AudioBitrate { get; set; } = 192000;
+
+        /// <summary>
+        /// Gets or sets the number of frames that may wait for the encode thread (0 = encode on the caller's thread)
+        /// </summary>
+        public int WriteQueueSize { get; set; } = 8;
+
+        /// <summary>
+        /// Gets or sets a value indicating whether video frames arriving at a full write queue are dropped (otherwise the caller waits)
+        /// </summary>
+        public bool DropFramesWhenQueueFull { get; set; } = false;
+
+        /// <summary>
+        /// Gets or sets the priority of the encode thread (see <see cref="WriteQueueSize"/>). Highest asks for SCHED_FIFO real-time scheduling
+        /// </summary>
+        public ThreadPriority EncodeThreadPriority { get; set; } = ThreadPriority.Normal;
+
+        /// <summary>
+        /// Gets or sets the CPUs the encode thread may run on, as a bit mask (bit n for CPU n, 0 for any)
+        /// </summary>
+        public ulong EncodeThreadAffinity { get; set; } = 0;
+    }
+}
+#endif
@@ -8,9 +8,13 @@ namespace Microsoft.Psi.Media
     using System;
     using System.IO;
     using System.Runtime.InteropServices;
+    using System.Threading;
     using Microsoft.Psi;
     using Microsoft.Psi.Components;
     using Microsoft.Psi.Imaging;
+#if FFMPEG
+    using Microsoft.Psi.Media.Native.Linux;
+#endif
     using SkiaSharp;
 
     /// <summary>
@@ -18,10 +22,18 @@ namespace Microsoft.Psi.Media
     /// </summary>
     public class MediaCapture : IProducer<Shared<Image>>, ISourceComponent, IDisposable
     {
+        private const int NativeCaptureBufferCount = 4;
+        private const int NativeCaptureTimeoutMs = 100;
+
         private readonly Pipeline pipeline;
         private readonly MediaCaptureConfiguration configuration;
 
         private MediaCaptureInternal camera;
+#if FFMPEG
+        private V4L2Capture nativeCamera;
+        private Thread nativeCaptureThread;
+        private volatile bool isNativeCaptureStopping;
+#endif
 
         /// <summary>
         /// Initializes a new instance of the <see cref="MediaCapture"/> class.
@@ -96,6 +108,8 @@ namespace Microsoft.Psi.Media
         /// </summary>
         public void Dispose()
         {
+            this.StopNativeCapture();
+
             // check for null since it's possible that Start was never called
             if (this.camera != null)
             {
@@ -111,6 +125,12 @@ namespace Microsoft.Psi.Media
             // notify that this is an infinite source component
             notifyCompletionTime(DateTime.MaxValue);
 
+            if (this.configuration.UseNativeCapture)
+            {
+                this.StartNativeCapture();
+                return;
+            }
+
             this.camera = new MediaCaptureInternal(this.configuration.DeviceId);
             this.camera.Open();
             var isFormatSupported = false;
@@ -230,6 +250,7 @@ namespace Microsoft.Psi.Media
         /// <inheritdoc/>
         public void Stop(DateTime finalOriginatingTime, Action notifyCompleted)
         {
+            this.StopNativeCapture();
             if (this.camera != null)
             {
                 this.camera.Close();
@@ -239,6 +260,122 @@ namespace Microsoft.Psi.Media
 
             notifyCompleted();
         }
+
+        private void StartNativeCapture()
+        {
+#if FFMPEG
+            var pixelFormat = this.configuration.PixelFormat;
+            if (pixelFormat != PixelFormatId.BGR24 && pixelFormat != PixelFormatId.YUYV && pixelFormat != PixelFormatId.MJPEG)
+            {
+                throw new ArgumentException("Only BGR24, YUYV and MJPEG are supported by native capture");
+            }
+
+            this.nativeCamera = new V4L2Capture();
+            try
+            {
+                this.nativeCamera.Open(this.configuration.DeviceId);
+                if (!this.nativeCamera.SupportedPixelFormats().Contains(pixelFormat))
+                {
+                    throw new ArgumentException($"Pixel format {pixelFormat} is not supported by the camera");
+                }
+
+                this.nativeCamera.SetFormat(this.configuration.Width, this.configuration.Height, pixelFormat);
+                this.nativeCamera.GetFormat(out int width, out int height, out PixelFormatId currentFormat, out int stride, out int imageSize);
+                if (width != this.configuration.Width || height != this.configuration.Height || currentFormat != pixelFormat)
+                {
+                    throw new ArgumentException($"Width/height {this.configuration.Width}x{this.configuration.Height} is not supported by the camera");
+                }
+
+                this.nativeCamera.SetThreadPolicy(this.configuration.CaptureThreadPriority, this.configuration.CaptureThreadAffinity);
+                this.nativeCamera.Start(NativeCaptureBufferCount, false);
+            }
+            catch
+            {
+                this.nativeCamera.Dispose();
+                this.nativeCamera = null;
+                throw;
+            }
+
+            this.isNativeCaptureStopping = false;
+            this.nativeCaptureThread = new Thread(new ThreadStart(this.ProcessNativeFrames)) { IsBackground = true };
+            this.nativeCaptureThread.Start();
+#else
+            throw new NotSupportedException("Native capture needs Microsoft.Psi.Media.Linux to be built with FFMPEG");
+#endif
+        }
+
+        private void StopNativeCapture()
+        {
+#if FFMPEG
+            if (this.nativeCamera != null)
+            {
+                this.isNativeCaptureStopping = true;
+                this.nativeCaptureThread?.Join();
+                this.nativeCaptureThread = null;
+                this.nativeCamera.Dispose();
+                this.nativeCamera = null;
+            }
+#endif
+        }
+
+#if FFMPEG
+        private void ProcessNativeFrames()
+        {
+            while (!this.isNativeCaptureStopping)
+            {
+                if (!this.Raw.HasSubscribers && !this.Out.HasSubscribers)
+                {
+                    // drain the driver's queue so we post fresh frames once someone subscribes
+                    if (this.nativeCamera.AcquireFrame(NativeCaptureTimeoutMs, out V4L2Frame skipped))
+                    {
+                        this.nativeCamera.ReleaseFrame(skipped);
+                    }
+
+                    continue;
+                }
+
+                using (var sharedImage = ImagePool.GetOrCreate(this.configuration.Width, this.configuration.Height, PixelFormat.BGR_24bpp))
+                {
+                    var image = sharedImage.Resource;
+                    if (!this.Raw.HasSubscribers)
+                    {
+                        // convert straight into the pooled image, in a single call to the native engine
+                        if (this.nativeCamera.ReadFrame(NativeCaptureTimeoutMs, image.ImageData, image.Stride, image.Size, out _))
+                        {
+                            this.Out.Post(sharedImage, this.pipeline.GetCurrentTime());
+                        }
+
+                        continue;
+                    }
+
+                    if (!this.nativeCamera.AcquireFrame(NativeCaptureTimeoutMs, out V4L2Frame frame))
+                    {
+                        continue;
+                    }
+
+                    var originatingTime = this.pipeline.GetCurrentTime();
+                    try
+                    {
+                        using (Shared<byte[]> shared = SharedArrayPool<byte>.GetOrCreate(frame.BytesUsed))
+                        {
+                            Marshal.Copy(frame.Data, shared.Resource, 0, frame.BytesUsed);
+                            this.Raw.Post(shared, originatingTime);
+                        }
+
+                        if (this.Out.HasSubscribers)
+                        {
+                            this.nativeCamera.ConvertFrame(frame, image.ImageData, image.Stride, image.Size);
+                            this.Out.Post(sharedImage, originatingTime);
+                        }
+                    }
+                    finally
+                    {
+                        this.nativeCamera.ReleaseFrame(frame); // release back to driver!
+                    }
+                }
+            }
+        }
+#endif
     }
 }
 
@@ -3,6 +3,8 @@
 
 namespace Microsoft.Psi.Media
 {
+    using System.Threading;
+
     /// <summary>
     /// Encapsulates configuration for Video Camera component.
     /// </summary>
@@ -38,5 +40,29 @@ namespace Microsoft.Psi.Media
         /// Gets or sets device pixel format.
         /// </summary>
         public PixelFormatId PixelFormat { get; set; }
+
+        /// <summary>
+        /// Gets or sets a value indicating whether to capture with the native V4L2 engine in Microsoft.Psi.Media.Native.so.
+        /// </summary>
+        /// <remarks>
+        /// The native engine converts YUYV and MJPEG frames to BGR24 straight into pooled images,
+        /// instead of converting them in managed code. It needs the native library to have been built with FFMPEG.
+        /// </remarks>
+        public bool UseNativeCapture { get; set; }
+
+        /// <summary>
+        /// Gets or sets the priority of the native capture thread (see <see cref="UseNativeCapture"/>).
+        /// </summary>
+        /// <remarks>
+        /// AboveNormal raises the thread to nice -5. Highest gives it SCHED_FIFO real-time scheduling,
+        /// which needs CAP_SYS_NICE or an RLIMIT_RTPRIO allowance; without one it gets nice -10.
+        /// </remarks>
+        public ThreadPriority CaptureThreadPriority { get; set; } = ThreadPriority.Normal;
+
+        /// <summary>
+        /// Gets or sets the CPUs the native capture thread may run on, as a bit mask (bit n for CPU n).
+        /// Zero lets it run on any CPU.
+        /// </summary>
+        public ulong CaptureThreadAffinity { get; set; } = 0;
     }
 }
\ No newline at end of file
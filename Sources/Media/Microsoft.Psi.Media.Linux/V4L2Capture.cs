@@ -0,0 +1,315 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#if FFMPEG
+#pragma warning disable SA1615, SA1600
+namespace Microsoft.Psi.Media.Native.Linux
+{
+    using System;
+    using System.Collections.Generic;
+    using System.Runtime.InteropServices;
+
+    /// <summary>
+    /// Defines our wrapper class for calling into our native V4L2 capture engine,
+    /// which streams from memory mapped driver buffers and converts frames to
+    /// BGR24 without going through managed memory
+    /// </summary>
+    public class V4L2Capture : IDisposable
+    {
+        private IntPtr unmanagedData;
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="V4L2Capture"/> class.
+        /// </summary>
+        public V4L2Capture()
+        {
+            this.unmanagedData = V4L2CaptureNative_Alloc();
+        }
+
+        /// <summary>
+        /// Finalizes an instance of the <see cref="V4L2Capture"/> class.
+        /// </summary>
+        ~V4L2Capture()
+        {
+            this.Dispose(false);
+        }
+
+        /// <summary>
+        /// Gets the name of the device's driver
+        /// </summary>
+        public string Driver => Marshal.PtrToStringAnsi(V4L2CaptureNative_GetDriver(this.unmanagedData));
+
+        /// <summary>
+        /// Gets the name of the device
+        /// </summary>
+        public string Card => Marshal.PtrToStringAnsi(V4L2CaptureNative_GetCard(this.unmanagedData));
+
+        /// <summary>
+        /// Gets the bus the device is on
+        /// </summary>
+        public string Bus => Marshal.PtrToStringAnsi(V4L2CaptureNative_GetBus(this.unmanagedData));
+
+        /// <summary>
+        /// Gets the native object, for V4L2CapturePoller
+        /// </summary>
+        internal IntPtr UnmanagedData => this.unmanagedData;
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_Alloc")]
+        public static extern IntPtr V4L2CaptureNative_Alloc();
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_Dealloc")]
+        public static extern void V4L2CaptureNative_Dealloc(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_Open", CharSet=CharSet.Ansi)]
+        public static extern int V4L2CaptureNative_Open(IntPtr obj, [MarshalAs(UnmanagedType.LPStr)]string device);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_Close")]
+        public static extern int V4L2CaptureNative_Close(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_GetLastError")]
+        public static extern int V4L2CaptureNative_GetLastError(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_GetDriver")]
+        public static extern IntPtr V4L2CaptureNative_GetDriver(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_GetCard")]
+        public static extern IntPtr V4L2CaptureNative_GetCard(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_GetBus")]
+        public static extern IntPtr V4L2CaptureNative_GetBus(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_EnumerateFormat")]
+        public static extern int V4L2CaptureNative_EnumerateFormat(IntPtr obj, int index, ref uint pixelFormat, ref uint flags);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_SetFormat")]
+        public static extern int V4L2CaptureNative_SetFormat(IntPtr obj, int width, int height, uint pixelFormat);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_GetFormat")]
+        public static extern int V4L2CaptureNative_GetFormat(IntPtr obj, ref int width, ref int height, ref uint pixelFormat, ref int stride, ref int imageSize);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_SetFrameRate")]
+        public static extern int V4L2CaptureNative_SetFrameRate(IntPtr obj, int numerator, int denominator);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_SetThreadPolicy")]
+        public static extern int V4L2CaptureNative_SetThreadPolicy(IntPtr obj, int priority, ulong affinityMask);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_Start")]
+        public static extern int V4L2CaptureNative_Start(IntPtr obj, int bufferCount, int exportDmabuf);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_Stop")]
+        public static extern int V4L2CaptureNative_Stop(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_AcquireFrame")]
+        public static extern int V4L2CaptureNative_AcquireFrame(IntPtr obj, int timeoutMs, ref V4L2Frame frame, [MarshalAs(UnmanagedType.U1)] ref bool acquired);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_ReleaseFrame")]
+        public static extern int V4L2CaptureNative_ReleaseFrame(IntPtr obj, int index);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_ConvertFrame")]
+        public static extern int V4L2CaptureNative_ConvertFrame(IntPtr obj, ref V4L2Frame frame, IntPtr output, int outputStride, int outputSize);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CaptureNative_ReadFrame")]
+        public static extern int V4L2CaptureNative_ReadFrame(IntPtr obj, int timeoutMs, IntPtr output, int outputStride, int outputSize, ref V4L2Frame frame, [MarshalAs(UnmanagedType.U1)] ref bool frameRead);
+
+        /// <summary>
+        /// Opens a V4L2 capture device
+        /// </summary>
+        /// <param name="device">Device to open (e.g. "/dev/video0")</param>
+        public void Open(string device)
+        {
+            this.Check(V4L2CaptureNative_Open(this.unmanagedData, device), "Failed to open " + device);
+        }
+
+        /// <summary>
+        /// Stops streaming and closes the device
+        /// </summary>
+        public void Close()
+        {
+            if (this.unmanagedData != IntPtr.Zero)
+            {
+                V4L2CaptureNative_Close(this.unmanagedData);
+            }
+        }
+
+        /// <summary>
+        /// Lists the pixel formats the device can capture in
+        /// </summary>
+        /// <returns>The device's pixel formats</returns>
+        public List<PixelFormatId> SupportedPixelFormats()
+        {
+            var formats = new List<PixelFormatId>();
+            uint pixelFormat = 0;
+            uint flags = 0;
+            for (int i = 0; ; i++)
+            {
+                int hr = V4L2CaptureNative_EnumerateFormat(this.unmanagedData, i, ref pixelFormat, ref flags);
+                if (hr != 0)
+                {
+                    this.Check(hr, "Failed to enumerate formats");
+                    break;
+                }
+
+                formats.Add((PixelFormatId)pixelFormat);
+            }
+
+            return formats;
+        }
+
+        /// <summary>
+        /// Requests a capture format. The driver may pick the nearest format it supports,
+        /// so check the result with GetFormat()
+        /// </summary>
+        /// <param name="width">Width in pixels</param>
+        /// <param name="height">Height in pixels</param>
+        /// <param name="pixelFormat">Pixel format</param>
+        public void SetFormat(int width, int height, PixelFormatId pixelFormat)
+        {
+            this.Check(V4L2CaptureNative_SetFormat(this.unmanagedData, width, height, (uint)pixelFormat), "Failed to set format");
+        }
+
+        /// <summary>
+        /// Gets the current capture format
+        /// </summary>
+        /// <param name="width">Width in pixels</param>
+        /// <param name="height">Height in pixels</param>
+        /// <param name="pixelFormat">Pixel format</param>
+        /// <param name="stride">Bytes per row of uncompressed formats</param>
+        /// <param name="imageSize">Largest frame the driver will produce</param>
+        public void GetFormat(out int width, out int height, out PixelFormatId pixelFormat, out int stride, out int imageSize)
+        {
+            width = 0;
+            height = 0;
+            uint format = 0;
+            stride = 0;
+            imageSize = 0;
+            this.Check(V4L2CaptureNative_GetFormat(this.unmanagedData, ref width, ref height, ref format, ref stride, ref imageSize), "Failed to get format");
+            pixelFormat = (PixelFormatId)format;
+        }
+
+        /// <summary>
+        /// Requests a frame rate
+        /// </summary>
+        /// <param name="numerator">Frame rate numerator</param>
+        /// <param name="denominator">Frame rate denominator</param>
+        /// <returns>False if the driver doesn't support setting the frame rate</returns>
+        public bool SetFrameRate(int numerator, int denominator)
+        {
+            int hr = V4L2CaptureNative_SetFrameRate(this.unmanagedData, numerator, denominator);
+            this.Check(hr, "Failed to set frame rate");
+            return hr == 0;
+        }
+
+        /// <summary>
+        /// Sets the scheduling of the thread capturing frames, applied the first time it acquires or reads one
+        /// </summary>
+        /// <param name="priority">Priority of the thread (Highest asks for SCHED_FIFO real-time scheduling)</param>
+        /// <param name="affinityMask">CPUs the thread may run on, bit n for CPU n (0 for any)</param>
+        public void SetThreadPolicy(System.Threading.ThreadPriority priority, ulong affinityMask)
+        {
+            this.Check(V4L2CaptureNative_SetThreadPolicy(this.unmanagedData, (int)priority, affinityMask), "Failed to set thread policy");
+        }
+
+        /// <summary>
+        /// Maps the driver's buffers and starts streaming
+        /// </summary>
+        /// <param name="bufferCount">Number of driver buffers to ask for</param>
+        /// <param name="exportDmabuf">Whether to export each buffer as a DMABUF, where the driver supports it</param>
+        public void Start(int bufferCount, bool exportDmabuf)
+        {
+            this.Check(V4L2CaptureNative_Start(this.unmanagedData, bufferCount, exportDmabuf ? 1 : 0), "Failed to start streaming");
+        }
+
+        /// <summary>
+        /// Stops streaming. Frames that haven't been released are no longer valid
+        /// </summary>
+        public void Stop()
+        {
+            V4L2CaptureNative_Stop(this.unmanagedData);
+        }
+
+        /// <summary>
+        /// AcquireFrame() waits for the next frame and hands the driver buffer holding
+        /// it to the caller, who must pass it back with ReleaseFrame()
+        /// </summary>
+        /// <param name="timeoutMs">Longest time to wait, or -1 to wait for ever</param>
+        /// <param name="frame">The frame acquired</param>
+        /// <returns>False if no frame arrived in time</returns>
+        public bool AcquireFrame(int timeoutMs, out V4L2Frame frame)
+        {
+            frame = default(V4L2Frame);
+            bool acquired = false;
+            this.Check(V4L2CaptureNative_AcquireFrame(this.unmanagedData, timeoutMs, ref frame, ref acquired), "Failed to acquire frame");
+            return acquired;
+        }
+
+        /// <summary>
+        /// Hands an acquired frame's buffer back to the driver. May be called from any thread
+        /// </summary>
+        /// <param name="frame">Frame returned by AcquireFrame()</param>
+        public void ReleaseFrame(V4L2Frame frame)
+        {
+            this.Check(V4L2CaptureNative_ReleaseFrame(this.unmanagedData, frame.Index), "Failed to release frame");
+        }
+
+        /// <summary>
+        /// Converts an acquired frame to BGR24
+        /// </summary>
+        /// <param name="frame">Frame returned by AcquireFrame()</param>
+        /// <param name="output">Buffer to write the image to</param>
+        /// <param name="outputStride">Bytes per row of the output</param>
+        /// <param name="outputSize">Size of the output buffer</param>
+        public void ConvertFrame(V4L2Frame frame, IntPtr output, int outputStride, int outputSize)
+        {
+            this.Check(V4L2CaptureNative_ConvertFrame(this.unmanagedData, ref frame, output, outputStride, outputSize), "Failed to convert frame");
+        }
+
+        /// <summary>
+        /// ReadFrame() waits for the next frame, converts it to BGR24 and releases it
+        /// in a single call to the native engine
+        /// </summary>
+        /// <param name="timeoutMs">Longest time to wait, or -1 to wait for ever</param>
+        /// <param name="output">Buffer to write the image to</param>
+        /// <param name="outputStride">Bytes per row of the output</param>
+        /// <param name="outputSize">Size of the output buffer</param>
+        /// <param name="frame">Describes the frame read (its data is no longer valid)</param>
+        /// <returns>False if no frame arrived in time</returns>
+        public bool ReadFrame(int timeoutMs, IntPtr output, int outputStride, int outputSize, out V4L2Frame frame)
+        {
+            frame = default(V4L2Frame);
+            bool frameRead = false;
+            this.Check(V4L2CaptureNative_ReadFrame(this.unmanagedData, timeoutMs, output, outputStride, outputSize, ref frame, ref frameRead), "Failed to read frame");
+            return frameRead;
+        }
+
+        /// <summary>
+        /// Closes the device and frees the native engine
+        /// </summary>
+        public void Dispose()
+        {
+            this.Dispose(true);
+            GC.SuppressFinalize(this);
+        }
+
+        /// <summary>
+        /// Frees the native engine
+        /// </summary>
+        /// <param name="disposing">Whether called from Dispose()</param>
+        protected virtual void Dispose(bool disposing)
+        {
+            if (this.unmanagedData != IntPtr.Zero)
+            {
+                V4L2CaptureNative_Dealloc(this.unmanagedData);
+                this.unmanagedData = IntPtr.Zero;
+            }
+        }
+
+        private void Check(int hr, string message)
+        {
+            if (hr < 0)
+            {
+                throw new Exception(message + ". HRESULT=" + hr.ToString() + " errno=" + V4L2CaptureNative_GetLastError(this.unmanagedData).ToString());
+            }
+        }
+    }
+}
+#endif
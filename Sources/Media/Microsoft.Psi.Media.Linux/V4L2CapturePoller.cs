@@ -0,0 +1,114 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#if FFMPEG
+#pragma warning disable SA1615, SA1600
+namespace Microsoft.Psi.Media.Native.Linux
+{
+    using System;
+    using System.Runtime.InteropServices;
+
+    /// <summary>
+    /// Waits on several V4L2Capture devices at once, so a single thread can
+    /// service all of them
+    /// </summary>
+    public class V4L2CapturePoller : IDisposable
+    {
+        private IntPtr unmanagedData;
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="V4L2CapturePoller"/> class.
+        /// </summary>
+        public V4L2CapturePoller()
+        {
+            this.unmanagedData = V4L2CapturePollerNative_Alloc();
+        }
+
+        /// <summary>
+        /// Finalizes an instance of the <see cref="V4L2CapturePoller"/> class.
+        /// </summary>
+        ~V4L2CapturePoller()
+        {
+            this.Dispose(false);
+        }
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CapturePollerNative_Alloc")]
+        public static extern IntPtr V4L2CapturePollerNative_Alloc();
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CapturePollerNative_Dealloc")]
+        public static extern void V4L2CapturePollerNative_Dealloc(IntPtr obj);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CapturePollerNative_Add")]
+        public static extern int V4L2CapturePollerNative_Add(IntPtr obj, IntPtr capture, int tag);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CapturePollerNative_Remove")]
+        public static extern int V4L2CapturePollerNative_Remove(IntPtr obj, IntPtr capture);
+
+        [DllImport("Microsoft.Psi.Media.Native.so", EntryPoint="V4L2CapturePollerNative_Wait")]
+        public static extern int V4L2CapturePollerNative_Wait(IntPtr obj, int timeoutMs, [Out] int[] tags, int maxTags, ref int count);
+
+        /// <summary>
+        /// Adds an open device
+        /// </summary>
+        /// <param name="capture">Device to wait on</param>
+        /// <param name="tag">Value Wait() returns when the device has a frame</param>
+        public void Add(V4L2Capture capture, int tag)
+        {
+            int hr = V4L2CapturePollerNative_Add(this.unmanagedData, capture.UnmanagedData, tag);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to add capture device. HRESULT=" + hr.ToString());
+            }
+        }
+
+        /// <summary>
+        /// Removes a device
+        /// </summary>
+        /// <param name="capture">Device to stop waiting on</param>
+        public void Remove(V4L2Capture capture)
+        {
+            V4L2CapturePollerNative_Remove(this.unmanagedData, capture.UnmanagedData);
+        }
+
+        /// <summary>
+        /// Waits for any of the devices to have a frame
+        /// </summary>
+        /// <param name="timeoutMs">Longest time to wait, or -1 to wait for ever</param>
+        /// <param name="tags">Receives the tags of the devices with a frame ready</param>
+        /// <returns>The number of tags returned (0 on timeout)</returns>
+        public int Wait(int timeoutMs, int[] tags)
+        {
+            int count = 0;
+            int hr = V4L2CapturePollerNative_Wait(this.unmanagedData, timeoutMs, tags, tags.Length, ref count);
+            if (hr < 0)
+            {
+                throw new Exception("Failed to wait for capture devices. HRESULT=" + hr.ToString());
+            }
+
+            return count;
+        }
+
+        /// <summary>
+        /// Frees the native poller
+        /// </summary>
+        public void Dispose()
+        {
+            this.Dispose(true);
+            GC.SuppressFinalize(this);
+        }
+
+        /// <summary>
+        /// Frees the native poller
+        /// </summary>
+        /// <param name="disposing">Whether called from Dispose()</param>
+        protected virtual void Dispose(bool disposing)
+        {
+            if (this.unmanagedData != IntPtr.Zero)
+            {
+                V4L2CapturePollerNative_Dealloc(this.unmanagedData);
+                this.unmanagedData = IntPtr.Zero;
+            }
+        }
+    }
+}
+#endif
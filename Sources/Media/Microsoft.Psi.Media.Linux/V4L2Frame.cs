@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#if FFMPEG
+
+namespace Microsoft.Psi.Media.Native.Linux
+{
+    using System;
+    using System.Runtime.InteropServices;
+
+    /// <summary>
+    /// Describes one frame acquired by V4L2Capture. The layout matches the
+    /// native engine's V4L2FrameNative
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public struct V4L2Frame
+    {
+        /// <summary>
+        /// Gets or sets the driver buffer index, passed back to V4L2Capture.ReleaseFrame()
+        /// </summary>
+        public int Index { get; set; }
+
+        /// <summary>
+        /// Gets or sets the number of bytes of frame data
+        /// </summary>
+        public int BytesUsed { get; set; }
+
+        /// <summary>
+        /// Gets or sets the driver timestamp in microseconds (CLOCK_MONOTONIC for most drivers)
+        /// </summary>
+        public long TimestampMicrosecs { get; set; }
+
+        /// <summary>
+        /// Gets or sets the driver frame counter; gaps mean dropped frames
+        /// </summary>
+        public uint Sequence { get; set; }
+
+        /// <summary>
+        /// Gets or sets the DMABUF file descriptor exported for the buffer, or -1
+        /// </summary>
+        public int DmabufFd { get; set; }
+
+        /// <summary>
+        /// Gets or sets the start of the frame data, which is only valid until the frame is released
+        /// </summary>
+        public IntPtr Data { get; set; }
+    }
+}
+#endif
@@ -0,0 +1,181 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "stdafx.h"
+#ifdef USE_FFMPEG
+#include "FFMPEGAudioConverter.h"
+#include "MediaConversion.h"
+#include <string.h>
+
+#pragma warning(push)
+#pragma warning(disable:4996)
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Native {
+namespace Windows {
+
+  // Number of samples per channel converted at a time before interleaving.
+  // Small enough that the blocks for 16 channels stay in L1.
+  static const int BlockSamples = 256;
+
+  using Microsoft::Psi::Media::Conversion::ConvertFloatToInt16;
+  using Microsoft::Psi::Media::Conversion::ConvertStereoFloatToInt16;
+  using Microsoft::Psi::Media::Conversion::InterleaveInt16;
+
+  FFMPEGAudioConverter::FFMPEGAudioConverter() :
+      resampleCtx(nullptr),
+      resampleFormat(AV_SAMPLE_FMT_NONE),
+      resampleChannels(0),
+      resampleSampleRate(0)
+  {
+  }
+
+  FFMPEGAudioConverter::~FFMPEGAudioConverter()
+  {
+      Reset();
+  }
+
+  //**********************************************************************
+  // Reset() releases the cached resampler. Called when the stream is closed.
+  //**********************************************************************
+  void FFMPEGAudioConverter::Reset()
+  {
+      if (resampleCtx != nullptr)
+      {
+          swr_free(&resampleCtx);
+          resampleCtx = nullptr;
+      }
+      resampleFormat = AV_SAMPLE_FMT_NONE;
+      resampleChannels = 0;
+      resampleSampleRate = 0;
+  }
+
+  //**********************************************************************
+  // GetOutputBufferSize() returns the number of bytes Convert() writes for
+  // a frame with the given number of channels and samples.
+  //**********************************************************************
+  int FFMPEGAudioConverter::GetOutputBufferSize(int numChannels, int numSamples)
+  {
+      return numChannels * numSamples * (int)sizeof(int16_t);
+  }
+
+  //**********************************************************************
+  // Convert() writes 'frame' to 'output' as interleaved 16-bit PCM with the
+  // frame's channel count and sample rate. 'output' holds 'outputSize'
+  // bytes; if that is less than GetOutputBufferSize(frame->channels,
+  // frame->nb_samples) nothing is written and AVERROR_BUFFER_TOO_SMALL is
+  // returned. Returns the number of bytes written, or a negative AVERROR
+  // code.
+  //**********************************************************************
+  int FFMPEGAudioConverter::Convert(const AVFrame *frame, int16_t *output, int outputSize)
+  {
+      int numChannels = frame->channels;
+      int numSamples = frame->nb_samples;
+      if (numChannels <= 0 || numSamples <= 0)
+      {
+          return 0;
+      }
+      if (output == nullptr || GetOutputBufferSize(numChannels, numSamples) > outputSize)
+      {
+          return AVERROR_BUFFER_TOO_SMALL;
+      }
+
+      switch (frame->format)
+      {
+      case AV_SAMPLE_FMT_FLT:
+          ConvertFloatToInt16((const float*)frame->extended_data[0], output, numSamples * numChannels);
+          break;
+
+      case AV_SAMPLE_FMT_FLTP:
+          if (numChannels == 1)
+          {
+              ConvertFloatToInt16((const float*)frame->extended_data[0], output, numSamples);
+          }
+          else if (numChannels == 2)
+          {
+              ConvertStereoFloatToInt16((const float*)frame->extended_data[0], (const float*)frame->extended_data[1], output, numSamples);
+          }
+          else
+          {
+              // Convert a block of each channel with the vector kernel, then
+              // interleave the (now much smaller) 16-bit blocks.
+              scratch.resize((size_t)numChannels * BlockSamples);
+              std::vector<const int16_t*> blocks(numChannels);
+              for (int c = 0; c < numChannels; c++)
+              {
+                  blocks[c] = scratch.data() + (size_t)c * BlockSamples;
+              }
+              for (int start = 0; start < numSamples; start += BlockSamples)
+              {
+                  int count = (numSamples - start < BlockSamples) ? numSamples - start : BlockSamples;
+                  for (int c = 0; c < numChannels; c++)
+                  {
+                      ConvertFloatToInt16((const float*)frame->extended_data[c] + start, scratch.data() + (size_t)c * BlockSamples, count);
+                  }
+                  InterleaveInt16(blocks.data(), numChannels, count, output + (size_t)start * numChannels);
+              }
+          }
+          break;
+
+      case AV_SAMPLE_FMT_S16:
+          memcpy(output, frame->extended_data[0], GetOutputBufferSize(numChannels, numSamples));
+          break;
+
+      case AV_SAMPLE_FMT_S16P:
+          InterleaveInt16((const int16_t *const *)frame->extended_data, numChannels, numSamples, output);
+          break;
+
+      default:
+          {
+              int samplesWritten = ResampleFrame(frame, output);
+              if (samplesWritten < 0)
+              {
+                  return samplesWritten;
+              }
+              return GetOutputBufferSize(numChannels, samplesWritten);
+          }
+      }
+      return GetOutputBufferSize(numChannels, numSamples);
+  }
+
+  //**********************************************************************
+  // ResampleFrame() converts formats we don't have kernels for (U8, S32,
+  // double, ...) with swresample. The sample rate and channel layout are
+  // kept; only the sample format changes. Returns the number of samples
+  // per channel written, or a negative AVERROR code.
+  //**********************************************************************
+  int FFMPEGAudioConverter::ResampleFrame(const AVFrame *frame, int16_t *output)
+  {
+      if (resampleCtx == nullptr ||
+          resampleFormat != frame->format ||
+          resampleChannels != frame->channels ||
+          resampleSampleRate != frame->sample_rate)
+      {
+          Reset();
+          int64_t channelLayout = (frame->channel_layout != 0) ? (int64_t)frame->channel_layout : av_get_default_channel_layout(frame->channels);
+          resampleCtx = swr_alloc_set_opts(nullptr,
+              channelLayout, AV_SAMPLE_FMT_S16, frame->sample_rate,
+              channelLayout, (AVSampleFormat)frame->format, frame->sample_rate,
+              0, nullptr);
+          if (resampleCtx == nullptr)
+          {
+              return AVERROR(ENOMEM);
+          }
+          int avResult = swr_init(resampleCtx);
+          if (avResult < 0)
+          {
+              Reset();
+              return avResult;
+          }
+          resampleFormat = frame->format;
+          resampleChannels = frame->channels;
+          resampleSampleRate = frame->sample_rate;
+      }
+
+      uint8_t *outputPlanes[1] = { (uint8_t*)output };
+      return swr_convert(resampleCtx, outputPlanes, frame->nb_samples, (const uint8_t**)frame->extended_data, frame->nb_samples);
+  }
+}}}}}
+#pragma warning(pop)
+#endif // USE_FFMPEG
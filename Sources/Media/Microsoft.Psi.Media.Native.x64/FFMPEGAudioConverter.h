@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#ifdef USE_FFMPEG
+
+#pragma warning(push)
+#pragma warning(disable:4634 4635 4244 4996)
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+}
+#include <stdint.h>
+#include <vector>
+#pragma warning(pop)
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Native {
+namespace Windows {
+
+  //**********************************************************************
+  // FFMPEGAudioConverter converts decoded audio frames of any sample format
+  // and channel count to interleaved 16-bit PCM. Float and 16-bit input (the
+  // formats our decoders actually produce) go through the SSE2/AVX2/NEON
+  // kernels in Microsoft.Psi.Media.Conversion; anything else is handed to
+  // swresample.
+  //**********************************************************************
+  class FFMPEGAudioConverter
+  {
+      SwrContext *resampleCtx;                /* Cached resampler for formats we don't convert ourselves */
+      int resampleFormat;                     /* Input sample format the resampler was built for */
+      int resampleChannels;                   /* Input channel count the resampler was built for */
+      int resampleSampleRate;                 /* Input sample rate the resampler was built for */
+      std::vector<int16_t> scratch;           /* Per-channel blocks of converted samples waiting to be interleaved */
+
+      int ResampleFrame(const AVFrame *frame, int16_t *output);
+  public:
+      FFMPEGAudioConverter();
+      ~FFMPEGAudioConverter();
+      int Convert(const AVFrame *frame, int16_t *output, int outputSize);
+      void Reset();
+      static int GetOutputBufferSize(int numChannels, int numSamples);
+  };
+}}}}}
+#endif // USE_FFMPEG
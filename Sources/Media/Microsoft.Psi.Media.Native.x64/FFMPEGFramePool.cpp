@@ -0,0 +1,176 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "stdafx.h"
+#ifdef USE_FFMPEG
+#include "FFMPEGFramePool.h"
+
+#pragma warning(push)
+#pragma warning(disable:4634 4635 4244 4996)
+extern "C" {
+#include <libavutil/mem.h>
+}
+#pragma warning(pop)
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Native {
+namespace Windows {
+
+  //**********************************************************************
+  // Create() returns a new pool holding on to at most 'capacity' free
+  // buffers. The caller owns the initial reference.
+  //**********************************************************************
+  FFMPEGFramePool *FFMPEGFramePool::Create(int capacity)
+  {
+      return new FFMPEGFramePool(capacity);
+  }
+
+  FFMPEGFramePool::FFMPEGFramePool(int capacity) :
+      refCount(1),
+      numFreeBuffers(0),
+      capacity((capacity < 0) ? 0 : capacity)
+  {
+  }
+
+  FFMPEGFramePool::~FFMPEGFramePool()
+  {
+      for (int i = 0; i < NumSizeClasses; i++)
+      {
+          for (size_t j = 0; j < freeBuffers[i].size(); j++)
+          {
+              av_free(freeBuffers[i][j]->data);
+              delete freeBuffers[i][j];
+          }
+      }
+  }
+
+  void FFMPEGFramePool::AddRef()
+  {
+      refCount.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void FFMPEGFramePool::Release()
+  {
+      if (refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      {
+          delete this;
+      }
+  }
+
+  //**********************************************************************
+  // SetCapacity() changes the number of free buffers we keep. Any excess
+  // is freed as buffers come back.
+  //**********************************************************************
+  void FFMPEGFramePool::SetCapacity(int capacity)
+  {
+      std::lock_guard<std::mutex> lock(mutex);
+      this->capacity = (capacity < 0) ? 0 : capacity;
+  }
+
+  //**********************************************************************
+  // GetSizeClass() returns the smallest size class that holds 'size'
+  // bytes, or -1 if 'size' is negative or larger than our biggest class.
+  //**********************************************************************
+  int FFMPEGFramePool::GetSizeClass(int size)
+  {
+      if (size < 0)
+      {
+          return -1;
+      }
+      int64_t classBytes = MinSizeClassBytes;
+      for (int sizeClass = 0; sizeClass < NumSizeClasses; sizeClass++)
+      {
+          if (size <= classBytes)
+          {
+              return sizeClass;
+          }
+          classBytes <<= 1;
+      }
+      return -1;
+  }
+
+  //**********************************************************************
+  // Acquire() returns a buffer of at least 'size' bytes with a reference
+  // count of 1, reusing a free buffer of the same size class if there is
+  // one. Returns nullptr if 'size' is out of the classes' range (over 1GB)
+  // or we run out of memory.
+  //**********************************************************************
+  FFMPEGFrameBufferNative *FFMPEGFramePool::Acquire(int size)
+  {
+      int sizeClass = GetSizeClass(size);
+      if (sizeClass < 0)
+      {
+          return nullptr;
+      }
+
+      FFMPEGFrameBufferNative *buffer = nullptr;
+      {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!freeBuffers[sizeClass].empty())
+          {
+              buffer = freeBuffers[sizeClass].back();
+              freeBuffers[sizeClass].pop_back();
+              numFreeBuffers--;
+          }
+      }
+
+      if (buffer == nullptr)
+      {
+          int classBytes = MinSizeClassBytes << sizeClass;
+          uint8_t *data = (uint8_t*)av_malloc(classBytes);
+          if (data == nullptr)
+          {
+              return nullptr;
+          }
+          buffer = new FFMPEGFrameBufferNative();
+          buffer->pool = this;
+          buffer->sizeClass = sizeClass;
+          buffer->capacity = classBytes;
+          buffer->data = data;
+      }
+
+      // Every buffer that is out keeps the pool alive
+      AddRef();
+      buffer->refCount.store(1, std::memory_order_relaxed);
+      return buffer;
+  }
+
+  void FFMPEGFramePool::Recycle(FFMPEGFrameBufferNative *buffer)
+  {
+      {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (numFreeBuffers < capacity)
+          {
+              freeBuffers[buffer->sizeClass].push_back(buffer);
+              numFreeBuffers++;
+              buffer = nullptr;
+          }
+      }
+      if (buffer != nullptr)
+      {
+          av_free(buffer->data);
+          delete buffer;
+      }
+      Release();
+  }
+
+  void FFMPEGFramePool::AddRef(FFMPEGFrameBufferNative *buffer)
+  {
+      buffer->refCount.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  //**********************************************************************
+  // Release() drops a reference to 'buffer'. The last reference returns the
+  // buffer to its pool. Safe to call from any thread.
+  //**********************************************************************
+  void FFMPEGFramePool::Release(FFMPEGFrameBufferNative *buffer)
+  {
+      if (buffer != nullptr && buffer->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      {
+          buffer->pool->Recycle(buffer);
+      }
+  }
+}}}}}
+#endif // USE_FFMPEG
@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#ifdef USE_FFMPEG
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Native {
+namespace Windows {
+
+  class FFMPEGFramePool;
+
+  //**********************************************************************
+  // A reference counted buffer handed out by FFMPEGFramePool. Whoever holds
+  // the last reference returns it to its pool with FFMPEGFramePool::Release().
+  //**********************************************************************
+  struct FFMPEGFrameBufferNative
+  {
+      FFMPEGFramePool *pool;          /* Pool the buffer goes back to */
+      std::atomic<int> refCount;      /* Number of outstanding references */
+      int sizeClass;                  /* Index of the size class the buffer belongs to */
+      int capacity;                   /* Number of bytes allocated at data */
+      uint8_t *data;                  /* The buffer itself */
+  };
+
+  //**********************************************************************
+  // FFMPEGFramePool recycles the buffers decoded frames are written into.
+  // Buffers are bucketed into power-of-two size classes and, once released,
+  // up to 'capacity' of them are kept for reuse; beyond that they are freed.
+  // The pool is itself reference counted (by its owner and by every buffer
+  // that is out), so buffers may be released on any thread, and after the
+  // reader that produced them has been destroyed.
+  //**********************************************************************
+  class FFMPEGFramePool
+  {
+      static const int MinSizeClassBytes = 4096;
+      static const int NumSizeClasses = 19;       /* 4KB .. 1GB, so every class size fits in an int */
+
+      std::atomic<int> refCount;
+      std::mutex mutex;
+      std::vector<FFMPEGFrameBufferNative*> freeBuffers[NumSizeClasses];
+      int numFreeBuffers;                         /* Total number of buffers across freeBuffers */
+      int capacity;                               /* Maximum number of free buffers we hold on to */
+
+      FFMPEGFramePool(int capacity);
+      ~FFMPEGFramePool();
+      static int GetSizeClass(int size);
+      void Recycle(FFMPEGFrameBufferNative *buffer);
+  public:
+      static FFMPEGFramePool *Create(int capacity);
+      void AddRef();
+      void Release();
+      void SetCapacity(int capacity);
+      FFMPEGFrameBufferNative *Acquire(int size);
+      static void AddRef(FFMPEGFrameBufferNative *buffer);
+      static void Release(FFMPEGFrameBufferNative *buffer);
+  };
+}}}}}
+#endif // USE_FFMPEG
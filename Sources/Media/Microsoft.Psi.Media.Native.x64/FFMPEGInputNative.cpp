@@ -0,0 +1,289 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "stdafx.h"
+#ifdef USE_FFMPEG
+#include "FFMPEGInputNative.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Native {
+namespace Windows {
+
+  FFMPEGInputNative::FFMPEGInputNative() :
+      readCallback(nullptr),
+      seekCallback(nullptr),
+      opaque(nullptr),
+      data(nullptr),
+      size(0),
+      position(0),
+      prefetchedTo(0),
+      mappedView(nullptr),
+#ifdef LINUX
+      mappedFd(-1),
+#else
+      mappedFile(INVALID_HANDLE_VALUE),
+      mapping(nullptr),
+#endif
+      ioCtx(nullptr)
+  {
+  }
+
+  FFMPEGInputNative::~FFMPEGInputNative()
+  {
+      if (ioCtx != nullptr)
+      {
+          // FFMPEG may have swapped the buffer we gave it for another one
+          av_freep(&ioCtx->buffer);
+          av_freep(&ioCtx);
+      }
+#ifdef LINUX
+      if (mappedView != nullptr)
+      {
+          munmap(mappedView, (size_t)size);
+      }
+      if (mappedFd != -1)
+      {
+          close(mappedFd);
+      }
+#else
+      if (mappedView != nullptr)
+      {
+          UnmapViewOfFile(mappedView);
+      }
+      if (mapping != nullptr)
+      {
+          CloseHandle(mapping);
+      }
+      if (mappedFile != INVALID_HANDLE_VALUE)
+      {
+          CloseHandle(mappedFile);
+      }
+#endif
+  }
+
+  //**********************************************************************
+  // CreateFromCallbacks() creates an input read through 'read'. 'seek'
+  // may be nullptr for inputs that can only be read front to back, in
+  // which case the reader can't Seek() either.
+  //**********************************************************************
+  HRESULT FFMPEGInputNative::CreateFromCallbacks(FFMPEGReadCallback read, FFMPEGSeekCallback seek, void *opaque, FFMPEGInputNative **input)
+  {
+      if (read == nullptr || input == nullptr)
+      {
+          return E_INVALIDARG;
+      }
+      FFMPEGInputNative *result = new FFMPEGInputNative();
+      result->readCallback = read;
+      result->seekCallback = seek;
+      result->opaque = opaque;
+      *input = result;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // CreateFromBuffer() creates an input over 'size' bytes at 'data'. The
+  // caller keeps ownership, and the memory must stay valid (and unchanged)
+  // until the reader is destroyed.
+  //**********************************************************************
+  HRESULT FFMPEGInputNative::CreateFromBuffer(const uint8_t *data, int64_t size, FFMPEGInputNative **input)
+  {
+      if ((data == nullptr && size != 0) || size < 0 || input == nullptr)
+      {
+          return E_INVALIDARG;
+      }
+      FFMPEGInputNative *result = new FFMPEGInputNative();
+      result->data = data;
+      result->size = size;
+      *input = result;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // CreateFromMappedFile() maps 'filename' read only. Pages are faulted in
+  // by the reads themselves, with the OS told to read ahead aggressively,
+  // so slow (e.g. network) storage is read in large requests instead of
+  // FFMPEG's small buffer sized ones.
+  //**********************************************************************
+  HRESULT FFMPEGInputNative::CreateFromMappedFile(const char *filename, FFMPEGInputNative **input)
+  {
+      if (filename == nullptr || input == nullptr)
+      {
+          return E_INVALIDARG;
+      }
+
+      FFMPEGInputNative *result = new FFMPEGInputNative();
+#ifdef LINUX
+      result->mappedFd = open(filename, O_RDONLY | O_CLOEXEC);
+      struct stat info;
+      if (result->mappedFd == -1 || fstat(result->mappedFd, &info) == -1)
+      {
+          delete result;
+          return E_FAIL;
+      }
+      result->size = info.st_size;
+      if (result->size > 0)
+      {
+          void *view = mmap(nullptr, (size_t)result->size, PROT_READ, MAP_PRIVATE, result->mappedFd, 0);
+          if (view == MAP_FAILED)
+          {
+              delete result;
+              return E_FAIL;
+          }
+          result->mappedView = view;
+          madvise(view, (size_t)result->size, MADV_SEQUENTIAL);
+      }
+#else
+      result->mappedFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+      LARGE_INTEGER fileSize;
+      if (result->mappedFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(result->mappedFile, &fileSize))
+      {
+          delete result;
+          return E_FAIL;
+      }
+      result->size = fileSize.QuadPart;
+      if (result->size > 0)
+      {
+          result->mapping = CreateFileMapping(result->mappedFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+          result->mappedView = (result->mapping != nullptr) ? MapViewOfFile(result->mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+          if (result->mappedView == nullptr)
+          {
+              delete result;
+              return E_FAIL;
+          }
+      }
+#endif
+      result->data = (const uint8_t*)result->mappedView;
+      result->Prefetch();
+      *input = result;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // CreateIOContext() creates the AVIOContext the reader demuxes from,
+  // with a 'bufferSize' byte buffer (0 picks a default for the input).
+  // The context belongs to the input.
+  //**********************************************************************
+  HRESULT FFMPEGInputNative::CreateIOContext(int bufferSize, AVIOContext **ioCtx)
+  {
+      if (this->ioCtx != nullptr)
+      {
+          return E_UNEXPECTED;
+      }
+      if (bufferSize <= 0)
+      {
+          bufferSize = (mappedView != nullptr) ? DefaultMappedBufferSize : DefaultBufferSize;
+      }
+
+      uint8_t *buffer = (uint8_t*)av_malloc(bufferSize);
+      if (buffer == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+      bool seekable = (readCallback == nullptr) || (seekCallback != nullptr);
+      this->ioCtx = avio_alloc_context(buffer, bufferSize, 0, this, ReadPacket, nullptr, seekable ? Seek : nullptr);
+      if (this->ioCtx == nullptr)
+      {
+          av_free(buffer);
+          return E_OUTOFMEMORY;
+      }
+      this->ioCtx->seekable = seekable ? AVIO_SEEKABLE_NORMAL : 0;
+      *ioCtx = this->ioCtx;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // Prefetch() asks the OS to start reading the next MappedReadahead bytes
+  // of a mapped file once we get near the end of what was last prefetched.
+  // (On Windows FILE_FLAG_SEQUENTIAL_SCAN already makes the cache manager
+  // read ahead of us.)
+  //**********************************************************************
+  void FFMPEGInputNative::Prefetch()
+  {
+#ifdef LINUX
+      if (mappedView == nullptr || position + MappedReadahead / 2 < prefetchedTo || prefetchedTo >= size)
+      {
+          return;
+      }
+      long pageSize = sysconf(_SC_PAGESIZE);
+      int64_t start = (position / pageSize) * pageSize;
+      int64_t end = (position + MappedReadahead < size) ? position + MappedReadahead : size;
+      madvise((uint8_t*)mappedView + start, (size_t)(end - start), MADV_WILLNEED);
+      prefetchedTo = end;
+#endif
+  }
+
+  int FFMPEGInputNative::ReadPacket(void *opaque, uint8_t *buffer, int bufferSize)
+  {
+      FFMPEGInputNative *input = (FFMPEGInputNative*)opaque;
+      if (input->readCallback != nullptr)
+      {
+          int bytesRead = input->readCallback(input->opaque, buffer, bufferSize);
+          if (bytesRead < 0)
+          {
+              return AVERROR_EXTERNAL;
+          }
+          return (bytesRead == 0) ? AVERROR_EOF : bytesRead;
+      }
+
+      int64_t remaining = input->size - input->position;
+      if (remaining <= 0)
+      {
+          return AVERROR_EOF;
+      }
+      int bytesRead = (remaining < bufferSize) ? (int)remaining : bufferSize;
+      memcpy(buffer, input->data + input->position, bytesRead);
+      input->position += bytesRead;
+      input->Prefetch();
+      return bytesRead;
+  }
+
+  int64_t FFMPEGInputNative::Seek(void *opaque, int64_t offset, int whence)
+  {
+      FFMPEGInputNative *input = (FFMPEGInputNative*)opaque;
+      whence &= ~AVSEEK_FORCE;
+      if (input->seekCallback != nullptr)
+      {
+          int64_t result = input->seekCallback(input->opaque, offset, whence);
+          return (result < 0) ? AVERROR_EXTERNAL : result;
+      }
+
+      int64_t newPosition;
+      switch (whence)
+      {
+      case AVSEEK_SIZE:
+          return input->size;
+      case SEEK_SET:
+          newPosition = offset;
+          break;
+      case SEEK_CUR:
+          newPosition = input->position + offset;
+          break;
+      case SEEK_END:
+          newPosition = input->size + offset;
+          break;
+      default:
+          return AVERROR(EINVAL);
+      }
+      if (newPosition < 0 || newPosition > input->size)
+      {
+          return AVERROR(EINVAL);
+      }
+      input->position = newPosition;
+
+      // A seek starts a new sequential run, so restart the readahead from here
+      input->prefetchedTo = 0;
+      input->Prefetch();
+      return newPosition;
+  }
+}}}}}
+#endif // USE_FFMPEG
@@ -0,0 +1,61 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#ifdef USE_FFMPEG
+
+#include "FFMPEGReaderNative.h"
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Native {
+namespace Windows {
+
+  //**********************************************************************
+  // FFMPEGInputNative feeds FFMPEGReaderNative through a custom AVIOContext
+  // instead of a file name, from one of:
+  //   - caller supplied read/seek callbacks (see FFMPEGReadCallback)
+  //   - a caller owned memory span, which must outlive the reader
+  //   - a memory mapped file, read sequentially with a large readahead
+  // The reader owns the input, and the AVIOContext it creates.
+  //**********************************************************************
+  class FFMPEGInputNative
+  {
+      // Default AVIO buffer sizes (FFMPEG's own file protocol uses 32KB)
+      static const int DefaultBufferSize = 64 * 1024;
+      static const int DefaultMappedBufferSize = 1024 * 1024;
+
+      // How far ahead of the read position mapped files are prefetched
+      static const int64_t MappedReadahead = 16 * 1024 * 1024;
+
+      FFMPEGReadCallback readCallback;  /* Callback mode (nullptr otherwise) */
+      FFMPEGSeekCallback seekCallback;  /* nullptr if the callback input can't seek */
+      void *opaque;                     /* Passed back to the callbacks */
+      const uint8_t *data;              /* Memory and mapped modes: the bytes we read from */
+      int64_t size;
+      int64_t position;                 /* Memory and mapped modes: next byte to read */
+      int64_t prefetchedTo;             /* Mapped mode: end of the range already prefetched */
+      void *mappedView;                 /* Mapped mode: start of the mapping (nullptr otherwise) */
+#ifdef LINUX
+      int mappedFd;
+#else
+      void *mappedFile;                 /* HANDLE of the file */
+      void *mapping;                    /* HANDLE of the file mapping */
+#endif
+      AVIOContext *ioCtx;
+
+      FFMPEGInputNative();
+      void Prefetch();
+      static int ReadPacket(void *opaque, uint8_t *buffer, int bufferSize);
+      static int64_t Seek(void *opaque, int64_t offset, int whence);
+  public:
+      ~FFMPEGInputNative();
+      static HRESULT CreateFromCallbacks(FFMPEGReadCallback read, FFMPEGSeekCallback seek, void *opaque, FFMPEGInputNative **input);
+      static HRESULT CreateFromBuffer(const uint8_t *data, int64_t size, FFMPEGInputNative **input);
+      static HRESULT CreateFromMappedFile(const char *filename, FFMPEGInputNative **input);
+      HRESULT CreateIOContext(int bufferSize, AVIOContext **ioCtx);
+  };
+}}}}}
+#endif // USE_FFMPEG
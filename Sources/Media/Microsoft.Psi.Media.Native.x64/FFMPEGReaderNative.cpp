@@ -4,9 +4,21 @@
 #include "stdafx.h"
 #ifdef USE_FFMPEG
 #include "FFMPEGReaderNative.h"
+#include "FFMPEGAudioConverter.h"
+#include "FFMPEGFramePool.h"
+#include "FFMPEGInputNative.h"
+#include "MediaTrace.h"
 #include <locale>
 #include <codecvt>
 #include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+extern "C" {
+#include <libavutil/time.h>
+}
 
 #pragma warning(push)
 #pragma warning(disable:4996)
@@ -17,10 +29,10 @@ namespace Native {
 namespace Windows {
 
 extern "C" {
-    void *FFMPEGReaderNative_Alloc(int imageDepth)
+    void *FFMPEGReaderNative_Alloc(int imageDepth, int decodingThreads, int decodingThreadType)
     {
         FFMPEGReaderNative *pObj = new FFMPEGReaderNative();
-        pObj->Initialize(imageDepth);
+        pObj->Initialize(imageDepth, decodingThreads, decodingThreadType);
         return pObj;
     }
     
@@ -60,11 +72,158 @@ extern "C" {
         return pObj->GetAudioNumChannels();
     }
     
+    int FFMPEGReaderNative_SetHardwareAcceleration(void *obj, char *deviceType)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->SetHardwareAcceleration(deviceType);
+    }
+    
+    int FFMPEGReaderNative_IsHardwareAccelerated(void *obj)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->IsHardwareAccelerated() ? 1 : 0;
+    }
+    
+    int FFMPEGReaderNative_SetPlanarOutput(void *obj, int planar)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->SetPlanarOutput(planar != 0);
+    }
+    
+    int FFMPEGReaderNative_GetFramePlanes(void *obj, void **planes, int *strides, int *pixelFormat, int *width, int *height)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->GetFramePlanes((uint8_t**)planes, strides, pixelFormat, width, height);
+    }
+    
+    const char *FFMPEGReaderNative_GetFramePixelFormatName(void *obj)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->GetFramePixelFormatName();
+    }
+    
+    int FFMPEGReaderNative_SetDecodeAheadDepth(void *obj, int depth)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->SetDecodeAheadDepth(depth);
+    }
+
+    int FFMPEGReaderNative_SetDecodeAheadThreadPolicy(void *obj, int priority, uint64_t affinityMask)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->SetDecodeAheadThreadPolicy(priority, affinityMask);
+    }
+    
+    int FFMPEGReaderNative_SetKeyframesOnly(void *obj, int keyframes)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->SetKeyframesOnly(keyframes != 0);
+    }
+    
+    int FFMPEGReaderNative_SetOutputSize(void *obj, int maxWidth, int maxHeight)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->SetOutputSize(maxWidth, maxHeight);
+    }
+    
+    int FFMPEGReaderNative_SetIOBufferSize(void *obj, int bufferSize)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->SetIOBufferSize(bufferSize);
+    }
+
     int FFMPEGReaderNative_Open(void *obj, char *fn)
     {
         FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
         return pObj->Open(fn);
     }
+
+    int FFMPEGReaderNative_SetLiveMode(void *obj, int live, char *transport, int probeSize, int analyzeDurationMs, int timeoutMs, int maxReconnects)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->SetLiveMode(live != 0, transport, probeSize, analyzeDurationMs, timeoutMs, maxReconnects);
+    }
+
+    long long FFMPEGReaderNative_GetFrameArrivalTime(void *obj)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->GetFrameArrivalTime();
+    }
+
+    int FFMPEGReaderNative_GetReconnectCount(void *obj)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->GetReconnectCount();
+    }
+
+    void FFMPEGReaderNative_GetScalerStats(void *obj, long long *frames, long long *microsecs, int *rebuilds)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        int64_t framesScaled, scaleMicrosecs;
+        pObj->GetScalerStats(&framesScaled, &scaleMicrosecs, rebuilds);
+        *frames = framesScaled;
+        *microsecs = scaleMicrosecs;
+    }
+
+    int FFMPEGReaderNative_OpenWithCallbacks(void *obj, FFMPEGReadCallback read, FFMPEGSeekCallback seek, void *opaque)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->OpenWithCallbacks(read, seek, opaque);
+    }
+
+    int FFMPEGReaderNative_OpenFromBuffer(void *obj, void *data, int64_t size)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->OpenFromBuffer((const uint8_t*)data, size);
+    }
+
+    int FFMPEGReaderNative_OpenMappedFile(void *obj, char *fn)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->OpenMappedFile(fn);
+    }
+    
+    int FFMPEGReaderNative_GetStreamCount(void *obj)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->GetStreamCount();
+    }
+    
+    int FFMPEGReaderNative_GetStreamInfo(void *obj, int streamId, int *frameType, int *width, int *height, int *sampleRate, int *numChannels)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->GetStreamInfo(streamId, frameType, width, height, sampleRate, numChannels);
+    }
+    
+    const char *FFMPEGReaderNative_GetStreamCodecName(void *obj, int streamId)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->GetStreamCodecName(streamId);
+    }
+    
+    int FFMPEGReaderNative_SelectStreams(void *obj, int *streamIds, int numStreams)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->SelectStreams(streamIds, numStreams);
+    }
+    
+    int FFMPEGReaderNative_GetFrameStreamId(void *obj)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->GetFrameStreamId();
+    }
+    
+    int FFMPEGReaderNative_Seek(void *obj, double timestampMillisecs)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->Seek(timestampMillisecs);
+    }
+    
+    int FFMPEGReaderNative_SetReadRange(void *obj, double startMillisecs, double endMillisecs)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->SetReadRange(startMillisecs, endMillisecs);
+    }
     
     int FFMPEGReaderNative_NextFrame(void *obj, int *frameType, int *requiredBufferSize, bool *eos)
     {
@@ -78,6 +237,29 @@ extern "C" {
         return pObj->ReadFrameData((uint8_t*)buffer, bytesRead, timestamp);
     }
     
+    int FFMPEGReaderNative_SetFramePoolCapacity(void *obj, int capacity)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->SetFramePoolCapacity(capacity);
+    }
+    
+    int FFMPEGReaderNative_ReadFrameBuffer(void *obj, void **buffer, void **data, int *bytesRead, double *timestamp)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->ReadFrameBuffer((FFMPEGFrameBufferNative**)buffer, (uint8_t**)data, bytesRead, timestamp);
+    }
+    
+    void FFMPEGReaderNative_ReleaseFrameBuffer(void *buffer)
+    {
+        FFMPEGReaderNative::ReleaseFrameBuffer((FFMPEGFrameBufferNative*)buffer);
+    }
+    
+    int FFMPEGReaderNative_ReadFrames(void *obj, void *arena, int arenaSize, FFMPEGFrameDescriptorNative *descriptors, int maxFrames, int *framesRead, bool *eos)
+    {
+        FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
+        return pObj->ReadFrames((uint8_t*)arena, arenaSize, descriptors, maxFrames, framesRead, eos);
+    }
+    
     int FFMPEGReaderNative_Close(void *obj)
     {
         FFMPEGReaderNative *pObj = (FFMPEGReaderNative*)obj;
@@ -85,29 +267,149 @@ extern "C" {
     }
 }
   
+  //**********************************************************************
+  // DecodeAheadQueue is the state shared between the caller and our
+  // background decode thread. The slots are allocated up front; the decode
+  // thread fills them in order and NextFrame()/ReadFrameData() drain them.
+  // The decode thread blocks once all slots are full.
+  //**********************************************************************
+  struct DecodeAheadQueue
+  {
+      struct Slot
+      {
+          int streamIndex;               /* 0 = video, 1 = audio (same as NextFrame()) */
+          int streamId;                  /* Index of the stream the frame came from */
+          FFMPEGFrameBufferNative *buffer; /* Decoded (and converted) frame data. nullptr once handed out by ReadFrameBuffer() */
+          int dataSize;                  /* Number of valid bytes in data */
+          double timestampMillisecs;     /* Presentation time of the frame */
+          int64_t arrivalMicrosecs;      /* Wall clock time the frame's packet was demuxed (see GetFrameArrivalTime()) */
+      };
+      std::vector<Slot> slots;
+      int readIndex;                     /* Next slot to hand to the caller */
+      int writeIndex;                    /* Next slot for the decode thread to fill */
+      int count;                         /* Number of filled slots */
+      bool stopRequested;                /* Set to ask the decode thread to exit */
+      bool finished;                     /* Set by the decode thread at end of stream or on error */
+      HRESULT result;                    /* Error that stopped the decode thread (S_OK at end of stream) */
+      std::mutex mutex;
+      std::condition_variable frameQueued;
+      std::condition_variable slotFreed;
+      std::thread thread;
+  };
+
+  //**********************************************************************
+  // StreamDecoder holds everything needed to decode one selected stream.
+  // Each selected stream gets its own decoder, scaler and audio clock;
+  // packets from streams that aren't selected are dropped by the demuxer.
+  //**********************************************************************
+  struct StreamDecoder
+  {
+      StreamDecoder() :
+          streamId(-1),
+          frameType(0),
+          codec(nullptr),
+          codecCtx(nullptr),
+          frame(nullptr),
+          pastEnd(false),
+          drained(false),
+          hwPixelFormat(AV_PIX_FMT_NONE),
+          convertorCtx(nullptr),
+          convertorWidth(0),
+          convertorHeight(0),
+          convertorSourceFormat(AV_PIX_FMT_NONE),
+          convertorOutputFormat(AV_PIX_FMT_NONE),
+          convertorFlags(0),
+          convertorOutputWidth(0),
+          convertorOutputHeight(0),
+          audioClock(0.0),
+          audioClockValid(false),
+          audioBufferSize(0)
+      {
+      }
+
+      int streamId;                          /* Index of the stream in formatCtx->streams */
+      int frameType;                         /* 0 = video, 1 = audio (same as NextFrame()) */
+      AVCodec *codec;                        /* This appears to be a weak reference from FFMPEG */
+      AVCodecContext *codecCtx;              /* Owned by the stream, so only ever closed, never freed */
+      AVFrame *frame;                        /* Frame the decoder decodes into */
+      bool pastEnd;                          /* Set once the stream has reached readRangeEndMillisecs */
+      bool drained;                          /* Set once a video decoder has returned all of its delayed frames */
+      AVPixelFormat hwPixelFormat;           /* Pixel format of frames that live on the hardware device (AV_PIX_FMT_NONE in software) */
+      SwsContext *convertorCtx;              /* Cached scaler used to convert decoded frames to outputFormat */
+      int convertorWidth;                    /* Source width the cached scaler was built for */
+      int convertorHeight;                   /* Source height the cached scaler was built for */
+      AVPixelFormat convertorSourceFormat;   /* Source pixel format the cached scaler was built for */
+      AVPixelFormat convertorOutputFormat;   /* Output pixel format the cached scaler was built for */
+      int convertorFlags;                    /* Scaling flags the cached scaler was built with */
+      int convertorOutputWidth;              /* Output width the cached scaler was built for */
+      int convertorOutputHeight;             /* Output height the cached scaler was built for */
+      double audioClock;                     /* Presentation time (in ms) of the next audio sample */
+      bool audioClockValid;                  /* Set once audioClock has been synced to a decoded frame's timestamp */
+      int audioBufferSize;                   /* Buffer size needed for one converted audio frame */
+      FFMPEGAudioConverter audioConverter;   /* Converts decoded audio to interleaved 16-bit PCM */
+  };
+
+  // Number of free frame buffers we keep around by default
+  static const int DefaultFramePoolCapacity = 8;
+
+  // Live mode defaults (see SetLiveMode())
+  static const int DefaultLiveProbeSize = 32 * 1024;
+  static const int DefaultLiveAnalyzeDurationMs = 500;
+  static const int DefaultLiveTimeoutMs = 5000;
+
   //**********************************************************************  
   // Define ctor for object that contains the unmanaged data associated
   // with a MP4Writer object
   //**********************************************************************  
   FFMPEGReaderNative::FFMPEGReaderNative() :
       formatCtx(nullptr),
-      videoStreamIndex(-1),
-      videoCodec(nullptr),
-      videoCodecCtx(nullptr),
-      videoFrame(nullptr),
-      convertedVideoFrame(nullptr),
-      convertedVideoBuffer(nullptr),
-      audioStreamIndex(-1),
-      audioCodec(nullptr),
-      audioCodecCtx(nullptr),
-      audioFrame(nullptr),
-      audioBufferSize(0),
+      videoDecoder(nullptr),
+      audioDecoder(nullptr),
+      currentStreamId(-1),
+      currentRequiredBufferSize(0),
+      framePool(FFMPEGFramePool::Create(DefaultFramePoolCapacity)),
       outputFormat(AV_PIX_FMT_BGR32),
-      bytesPerPixel(4)
+      bytesPerPixel(4),
+      discardBeforeMillisecs(-1.0),
+      readRangeEndMillisecs(-1.0),
+      decodeAheadDepth(0),
+      decodeAhead(nullptr),
+      pendingFrame(false),
+      pendingFrameType(0),
+      pendingStreamId(-1),
+      pendingRequiredBufferSize(0),
+      scalingFlags(SWS_POINT),
+      decodingThreads(1),
+      decodingThreadType(0),
+      demuxStarted(false),
+      draining(false),
+      hwDeviceCtx(nullptr),
+      transferFrame(nullptr),
+      planarOutput(false),
+      currentVideoFrame(nullptr),
+      unconvertedDecoder(nullptr),
+      unconvertedTimestampMillisecs(0.0),
+      input(nullptr),
+      ioBufferSize(0),
+      liveMode(false),
+      liveProbeSize(DefaultLiveProbeSize),
+      liveAnalyzeDurationMs(DefaultLiveAnalyzeDurationMs),
+      liveTimeoutMs(DefaultLiveTimeoutMs),
+      liveMaxReconnects(0),
+      ioDeadline(0),
+      abortRequested(false),
+      reconnectCount(0),
+      packetArrivalMicrosecs(0),
+      decodedArrivalMicrosecs(0),
+      frameArrivalMicrosecs(0),
+      keyframesOnly(false),
+      maxOutputWidth(0),
+      maxOutputHeight(0),
+      framesScaled(0),
+      scaleMicrosecs(0),
+      scalerRebuilds(0)
   {
-      audioBuffers[0] = nullptr;
-      audioBuffers[1] = nullptr;
-      audioClock = 0.0;
+      decodeAheadThreadPolicy = Media::Threading::MakeThreadPolicy(Media::Threading::ThreadPriority_Normal, Media::Threading::ThreadTask_Playback, 0);
   }
 
   //**********************************************************************
@@ -115,45 +417,19 @@ extern "C" {
   //**********************************************************************
   FFMPEGReaderNative::~FFMPEGReaderNative()
   {
+      StopDecodeAhead();
+      CloseDecoders(); // The codec contexts belong to formatCtx, so close them first
       if (formatCtx != nullptr)
       {
           avformat_close_input(&formatCtx);
           formatCtx = nullptr; // NOTE: The formatCtx is freed by the call to avformat_close_input()
       }
-      videoCodec = nullptr; // This appears to be a weak reference from FFMPEG
-      videoCodecCtx = nullptr;
-      audioCodec = nullptr; // This appears to be a weak reference from FFMPEG
-      audioCodecCtx = nullptr;
-      if (videoFrame != nullptr)
-      {
-          av_frame_free(&videoFrame);
-          videoFrame = nullptr;
-      }
-      if (convertedVideoFrame != nullptr)
-      {
-          av_frame_free(&convertedVideoFrame);
-          convertedVideoFrame = nullptr;
-      }
-      if (convertedVideoBuffer != nullptr)
-      {
-          av_free(convertedVideoBuffer);
-          convertedVideoBuffer = nullptr;
-      }
-      if (audioFrame != nullptr)
-      {
-          av_frame_free(&audioFrame);
-          audioFrame = nullptr;
-      }
-      if (audioBuffers[0] != nullptr)
-      {
-          av_freep(&audioBuffers[0]);
-          audioBuffers[0] = nullptr;
-      }
-      if (audioBuffers[1] != nullptr)
-      {
-          av_freep(&audioBuffers[1]);
-          audioBuffers[1] = nullptr;
-      }
+      FreeInput(); // A custom AVIOContext isn't freed by avformat_close_input()
+      FreeHardwareDecoder();
+
+      // Buffers still held by the caller keep the pool alive until released
+      framePool->Release();
+      framePool = nullptr;
   }
   
   HRESULT FFMPEGReaderNative::ConvertFFMPEGError(int error)
@@ -192,8 +468,20 @@ extern "C" {
       return hr;
   }
   
-  HRESULT FFMPEGReaderNative::Initialize(int imageDepth)
+  //**********************************************************************
+  // Initialize() sets up the output format and decoder threading.
+  // Parameters:
+  //   imageDepth - Output image depth. Must be 24 or 32
+  //   decodingThreads - Number of threads used to decode video. 1 decodes on
+  //                     the calling thread; 0 lets FFMPEG pick based on the
+  //                     number of cores
+  //   decodingThreadType - FF_THREAD_FRAME and/or FF_THREAD_SLICE. 0 uses
+  //                        whatever the codec supports
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::Initialize(int imageDepth, int decodingThreads, int decodingThreadType)
   {
+      this->decodingThreads = (decodingThreads < 0) ? 1 : decodingThreads;
+      this->decodingThreadType = decodingThreadType & (FF_THREAD_FRAME | FF_THREAD_SLICE);
       switch (imageDepth)
       {
       case 24:
@@ -217,22 +505,33 @@ extern "C" {
   //**********************************************************************
   int FFMPEGReaderNative::GetWidth()
   {
-      return (videoCodecCtx == nullptr) ? 0 : videoCodecCtx->width;
+      if (videoDecoder == nullptr)
+      {
+          return 0;
+      }
+      int width, height;
+      GetOutputSize(videoDecoder->codecCtx->width, videoDecoder->codecCtx->height, &width, &height);
+      return width;
   }
   
+  //**********************************************************************
+  // GetAudioBitsPerSample() returns the sample size of the audio returned by
+  // ReadFrameData(). Audio is always converted to 16-bit PCM, whatever the
+  // codec's own sample format is.
+  //**********************************************************************
   int FFMPEGReaderNative::GetAudioBitsPerSample()
   {
-      return (audioCodecCtx == nullptr) ? 0 : audioCodecCtx->bits_per_coded_sample;
+      return (audioDecoder == nullptr) ? 0 : 16;
   }
   
   int FFMPEGReaderNative::GetAudioSampleRate()
   {
-      return (audioCodecCtx == nullptr) ? 0 : audioCodecCtx->sample_rate;
+      return (audioDecoder == nullptr) ? 0 : audioDecoder->codecCtx->sample_rate;
   }
   
   int FFMPEGReaderNative::GetAudioNumChannels()
   {
-      return (audioCodecCtx == nullptr) ? 0 : audioCodecCtx->channels;
+      return (audioDecoder == nullptr) ? 0 : audioDecoder->codecCtx->channels;
   }
   
   //**********************************************************************
@@ -241,290 +540,2034 @@ extern "C" {
   //**********************************************************************
   int FFMPEGReaderNative::GetHeight()
   {
-      return (videoCodecCtx == nullptr) ? 0 : videoCodecCtx->height;
+      if (videoDecoder == nullptr)
+      {
+          return 0;
+      }
+      int width, height;
+      GetOutputSize(videoDecoder->codecCtx->width, videoDecoder->codecCtx->height, &width, &height);
+      return height;
   }
-  
-  HRESULT FFMPEGReaderNative::InitializeVideoStream()
+
+  //**********************************************************************
+  // GetOutputSize() works out the size video frames of 'width' x 'height'
+  // are converted to: the source size, or with SetOutputSize() the largest
+  // size that fits the requested box with the same aspect ratio. Frames
+  // are never scaled up, and planar output is never scaled.
+  //**********************************************************************
+  void FFMPEGReaderNative::GetOutputSize(int width, int height, int *outputWidth, int *outputHeight)
   {
-      if (videoStreamIndex == -1)
+      *outputWidth = width;
+      *outputHeight = height;
+      if (planarOutput || width <= 0 || height <= 0 || (maxOutputWidth <= 0 && maxOutputHeight <= 0))
       {
-          return S_OK;
+          return;
       }
 
-      // Next find the codec associated with each stream
-      videoCodec = avcodec_find_decoder(formatCtx->streams[videoStreamIndex]->codec->codec_id);
-      if (videoCodec == nullptr)
+      double scale = 1.0;
+      if (maxOutputWidth > 0 && maxOutputWidth < width * scale)
       {
-          return PSIERR_DECODER_NOT_FOUND;
+          scale = (double)maxOutputWidth / width;
       }
-      videoCodecCtx = formatCtx->streams[videoStreamIndex]->codec;
-      
-      /*if (videoCodec->capabilities & AV_CODEC_CAP_TRUNCATED)
-        {
-        videoCodecCtx->flags |= AV_CODEC_FLAG_TRUNCATED;
-        }*/
-      
-      // Open the video codec
-      int avResult = avcodec_open2(videoCodecCtx, videoCodec, nullptr);
-      if (avResult < 0)
+      if (maxOutputHeight > 0 && maxOutputHeight < height * scale)
       {
-          return ConvertFFMPEGError(avResult);
+          scale = (double)maxOutputHeight / height;
       }
-      
-      // Allocate our video frame
-      videoFrame = av_frame_alloc();
-      if (videoFrame == nullptr)
+      *outputWidth = (int)(width * scale + 0.5);
+      *outputHeight = (int)(height * scale + 0.5);
+      *outputWidth = (*outputWidth > 0) ? *outputWidth : 1;
+      *outputHeight = (*outputHeight > 0) ? *outputHeight : 1;
+  }
+  
+  //**********************************************************************
+  // UpdateConvertor() makes sure our cached scaler matches the frames the
+  // decoder is currently producing. The scaler is only rebuilt if the
+  // source size, source pixel format, output format or scaling flags
+  // have changed since it was last built (e.g. on a mid-stream resolution
+  // change), so in steady state this is just a few comparisons per frame.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::UpdateConvertor(StreamDecoder *decoder, int width, int height, AVPixelFormat sourceFormat)
+  {
+      int outputWidth, outputHeight;
+      GetOutputSize(width, height, &outputWidth, &outputHeight);
+
+      // Point sampling is fine (and fastest) for a straight format conversion,
+      // but aliases badly when shrinking to thumbnail sizes
+      int flags = (outputWidth < width || outputHeight < height) ? SWS_AREA : scalingFlags;
+      if (decoder->convertorCtx != nullptr &&
+          decoder->convertorWidth == width &&
+          decoder->convertorHeight == height &&
+          decoder->convertorSourceFormat == sourceFormat &&
+          decoder->convertorOutputFormat == outputFormat &&
+          decoder->convertorFlags == flags &&
+          decoder->convertorOutputWidth == outputWidth &&
+          decoder->convertorOutputHeight == outputHeight)
       {
-          return E_OUTOFMEMORY;
+          return S_OK;
       }
-      convertedVideoFrame = av_frame_alloc();
-      if (convertedVideoFrame == nullptr)
+
+      if (decoder->convertorCtx != nullptr)
       {
-          return E_OUTOFMEMORY;
+          scalerRebuilds++;
       }
-      avResult = avpicture_get_size(outputFormat, videoCodecCtx->width, videoCodecCtx->height);
-      if (avResult < 0)
+
+      // sws_getCachedContext() frees the old context if it can't be reused
+      decoder->convertorCtx = sws_getCachedContext(decoder->convertorCtx, width, height, sourceFormat,
+          outputWidth, outputHeight, outputFormat, flags, nullptr, nullptr, nullptr);
+      if (decoder->convertorCtx == nullptr)
       {
-          return ConvertFFMPEGError(avResult);
+          FreeConvertor(decoder);
+          return E_OUTOFMEMORY;
       }
-      convertedVideoBuffer = (uint8_t*)av_malloc(avResult);
-      avpicture_fill((AVPicture*)convertedVideoFrame, convertedVideoBuffer, outputFormat, videoCodecCtx->width, videoCodecCtx->height);
+      decoder->convertorWidth = width;
+      decoder->convertorHeight = height;
+      decoder->convertorSourceFormat = sourceFormat;
+      decoder->convertorOutputFormat = outputFormat;
+      decoder->convertorFlags = flags;
+      decoder->convertorOutputWidth = outputWidth;
+      decoder->convertorOutputHeight = outputHeight;
       return S_OK;
   }
-  
-  HRESULT FFMPEGReaderNative::InitializeAudioStream()
+
+  void FFMPEGReaderNative::FreeConvertor(StreamDecoder *decoder)
   {
-      if (audioStreamIndex == -1)
+      if (decoder->convertorCtx != nullptr)
       {
-          return S_OK;
+          sws_freeContext(decoder->convertorCtx);
+          decoder->convertorCtx = nullptr;
       }
-      
-      // Find the audio codec
-      audioCodec = avcodec_find_decoder(formatCtx->streams[audioStreamIndex]->codec->codec_id);
-      if (audioCodec == nullptr)
+      decoder->convertorWidth = 0;
+      decoder->convertorHeight = 0;
+      decoder->convertorSourceFormat = AV_PIX_FMT_NONE;
+      decoder->convertorOutputFormat = AV_PIX_FMT_NONE;
+      decoder->convertorFlags = 0;
+      decoder->convertorOutputWidth = 0;
+      decoder->convertorOutputHeight = 0;
+  }
+
+  //**********************************************************************
+  // SetHardwareAcceleration() selects the device used for video decoding.
+  // Must be called before Open().
+  // Parameters:
+  //   deviceType - nullptr or "" decodes in software. "auto" tries the
+  //                devices available on this platform (D3D11VA/DXVA2 on
+  //                Windows, VAAPI/CUDA on Linux). Anything else is taken
+  //                as an FFMPEG device type name (e.g. "cuda").
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::SetHardwareAcceleration(const char *deviceType)
+  {
+      hwDeviceType = (deviceType == nullptr) ? "" : deviceType;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // IsHardwareAccelerated() returns true if the (first selected) video
+  // decoder was opened on a hardware device. Returns false if we fell back
+  // to software.
+  //**********************************************************************
+  bool FFMPEGReaderNative::IsHardwareAccelerated()
+  {
+      return videoDecoder != nullptr && videoDecoder->codecCtx->hw_device_ctx != nullptr;
+  }
+
+  //**********************************************************************
+  // SetPlanarOutput() selects whether video frames are converted to RGB
+  // (the default) or handed out unchanged in the decoder's own pixel format
+  // (e.g. YUV420P or NV12). In planar mode NextFrame() reports a required
+  // buffer size of 0 for video, ReadFrameData() ignores the data buffer, and
+  // the planes are retrieved with GetFramePlanes(). Must be called before Open().
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::SetPlanarOutput(bool planar)
+  {
+      planarOutput = planar;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // SetDecodeAheadDepth() enables decode-ahead. With a depth > 0 a background
+  // thread demuxes, decodes and converts up to 'depth' frames ahead of the
+  // caller, and NextFrame()/ReadFrameData() just dequeue them. Planar output
+  // hands out the decoder's own buffers and so always decodes on the
+  // caller's thread. Must be called before Open().
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::SetDecodeAheadDepth(int depth)
+  {
+      decodeAheadDepth = (depth < 0) ? 0 : depth;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // SetDecodeAheadThreadPolicy() sets the scheduling of the decode-ahead
+  // thread (see ThreadPolicy.h). It runs under the MMCSS "Playback" task
+  // on Windows, and below capture threads when real-time on Linux.
+  // 'priority' is a System.Threading.ThreadPriority value. Must be called
+  // before Open().
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::SetDecodeAheadThreadPolicy(int priority, uint64_t affinityMask)
+  {
+      if (priority < Media::Threading::ThreadPriority_Lowest || priority > Media::Threading::ThreadPriority_Highest)
       {
-          return PSIERR_DECODER_NOT_FOUND;
+          return E_INVALIDARG;
       }
-      audioCodecCtx = formatCtx->streams[audioStreamIndex]->codec;
+      decodeAheadThreadPolicy = Media::Threading::MakeThreadPolicy(priority, Media::Threading::ThreadTask_Playback, affinityMask);
+      return S_OK;
+  }
 
-      int avResult = avcodec_open2(audioCodecCtx, audioCodec, nullptr);
-      if (avResult < 0)
+  //**********************************************************************
+  // SetKeyframesOnly() restricts video decoding to keyframes, for fast
+  // scrubbing and thumbnails. Other video packets are dropped as they are
+  // demuxed, the decoder skips non-key frames (skip_frame) and deblocking
+  // (skip_loop_filter), and Seek() returns the keyframe at or before the
+  // target instead of decoding forward to it. Audio is unaffected. Must
+  // be called before Open().
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::SetKeyframesOnly(bool keyframes)
+  {
+      keyframesOnly = keyframes;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // SetOutputSize() scales video frames down to fit within 'maxWidth' x
+  // 'maxHeight', keeping their aspect ratio (0 leaves that dimension
+  // unconstrained, both 0 = source size). GetWidth()/GetHeight() and the
+  // buffer sizes NextFrame() reports are for the scaled frames. Decoders
+  // that support it (e.g. MJPEG) decode at the smallest 'lowres' reduction
+  // that is still at least the output size, so the shrinking is mostly
+  // done by not decoding full resolution in the first place. Planar output
+  // isn't scaled. Must be called before Open().
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::SetOutputSize(int maxWidth, int maxHeight)
+  {
+      if (maxWidth < 0 || maxHeight < 0)
       {
-          return ConvertFFMPEGError(avResult);
+          return E_INVALIDARG;
       }
-      
-      // Allocate our audio frame
-      audioFrame = av_frame_alloc();
-      if (audioFrame == nullptr)
+      maxOutputWidth = maxWidth;
+      maxOutputHeight = maxHeight;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // GetFramePlanes() returns the planes of the last video frame decoded by
+  // ReadFrameData() in planar mode. The pointers are owned by the decoder
+  // and are only valid until the next call to ReadFrameData() or Close().
+  // Parameters:
+  //   planes - Receives up to 4 plane pointers (unused planes are nullptr)
+  //   strides - Receives the stride in bytes of each plane
+  //   pixelFormat - Receives the frame's AVPixelFormat
+  //   width, height - Receive the frame's size
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::GetFramePlanes(uint8_t *planes[4], int strides[4], int *pixelFormat, int *width, int *height)
+  {
+      if (currentVideoFrame == nullptr || currentVideoFrame->data[0] == nullptr)
       {
-          return E_OUTOFMEMORY;
+          return E_UNEXPECTED;
       }
-      
-      avResult = av_samples_alloc(audioBuffers, nullptr, audioCodecCtx->channels, audioCodecCtx->sample_rate, audioCodecCtx->sample_fmt, 0);
-      if (avResult < 0)
+      for (int i = 0; i < 4; i++)
       {
-          return ConvertFFMPEGError(avResult);
+          planes[i] = currentVideoFrame->data[i];
+          strides[i] = currentVideoFrame->linesize[i];
       }
-      audioBufferSize = avResult;
-      audioFrame->linesize[0] = avResult;
-      audioFrame->linesize[1] = avResult;
-      audioFrame->data[0] = audioBuffers[0];
-      audioFrame->data[1] = audioBuffers[1];
-      
+      *pixelFormat = currentVideoFrame->format;
+      *width = currentVideoFrame->width;
+      *height = currentVideoFrame->height;
       return S_OK;
   }
-  
+
   //**********************************************************************
-  // Open() opens an MPEG file for playback via FFMPEG
-  // Parameters:
-  //   filename - Name of .mp4 file to playback
+  // GetFramePixelFormatName() returns FFMPEG's name for the pixel format of
+  // the last decoded video frame (e.g. "yuv420p"), or nullptr if none. The
+  // AVPixelFormat values themselves are not stable across FFMPEG versions.
   //**********************************************************************
-  HRESULT FFMPEGReaderNative::Open(char *filename)
+  const char *FFMPEGReaderNative::GetFramePixelFormatName()
   {
-      std::string fn(filename);
-      int avResult = avformat_open_input(&formatCtx, fn.c_str(), nullptr, nullptr);
-      if (avResult < 0)
+      if (currentVideoFrame == nullptr || currentVideoFrame->data[0] == nullptr)
       {
-          return ConvertFFMPEGError(avResult);
+          return nullptr;
       }
-      
-      avResult = avformat_find_stream_info(formatCtx, nullptr);
-      if (avResult < 0)
+      return av_get_pix_fmt_name((AVPixelFormat)currentVideoFrame->format);
+  }
+
+  //**********************************************************************
+  // GetHardwareFormat() is called by the decoder to negotiate its output
+  // format. We pick the hardware surface format if it is offered; otherwise
+  // (e.g. a profile the device can't handle) we fall back to the first
+  // software format so decoding still works.
+  //**********************************************************************
+  AVPixelFormat FFMPEGReaderNative::GetHardwareFormat(AVCodecContext *ctx, const AVPixelFormat *formats)
+  {
+      StreamDecoder *decoder = (StreamDecoder*)ctx->opaque;
+      for (const AVPixelFormat *format = formats; *format != AV_PIX_FMT_NONE; format++)
       {
-          return ConvertFFMPEGError(avResult);
+          if (*format == decoder->hwPixelFormat)
+          {
+              return *format;
+          }
       }
-      
-      // Find which stream is our audio stream and which is our video stream
-      videoStreamIndex = -1;
-      audioStreamIndex = -1;
+      for (const AVPixelFormat *format = formats; *format != AV_PIX_FMT_NONE; format++)
+      {
+          const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(*format);
+          if (desc != nullptr && (desc->flags & AV_PIX_FMT_FLAG_HWACCEL) == 0)
+          {
+              return *format;
+          }
+      }
+      return AV_PIX_FMT_NONE;
+  }
+
+  //**********************************************************************
+  // InitializeHardwareDecoder() attaches a hardware device to a video
+  // decoder. Must be called before the codec is opened. All of our video
+  // decoders share the device created for the first one. Returns S_FALSE
+  // if no suitable device could be created, in which case we decode in
+  // software.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::InitializeHardwareDecoder(StreamDecoder *decoder)
+  {
+      if (hwDeviceType.empty())
+      {
+          return S_FALSE;
+      }
+
+#ifdef LINUX
+      static const char *platformDevices[] = { "vaapi", "cuda" };
+#else
+      static const char *platformDevices[] = { "d3d11va", "dxva2" };
+#endif
+      const char *requestedDevice = hwDeviceType.c_str();
+      const char **devices = &requestedDevice;
+      int numDevices = 1;
+      if (hwDeviceType == "auto")
+      {
+          devices = platformDevices;
+          numDevices = sizeof(platformDevices) / sizeof(platformDevices[0]);
+      }
+
+      for (int i = 0; i < numDevices; i++)
+      {
+          AVHWDeviceType type = av_hwdevice_find_type_by_name(devices[i]);
+          if (type == AV_HWDEVICE_TYPE_NONE)
+          {
+              continue;
+          }
+          if (hwDeviceCtx != nullptr && ((AVHWDeviceContext*)hwDeviceCtx->data)->type != type)
+          {
+              continue;
+          }
+
+          // Find the surface format this decoder produces on that device
+          AVPixelFormat format = AV_PIX_FMT_NONE;
+          for (int j = 0;; j++)
+          {
+              const AVCodecHWConfig *config = avcodec_get_hw_config(decoder->codec, j);
+              if (config == nullptr)
+              {
+                  break;
+              }
+              if ((config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) != 0 && config->device_type == type)
+              {
+                  format = config->pix_fmt;
+                  break;
+              }
+          }
+          if (format == AV_PIX_FMT_NONE)
+          {
+              continue;
+          }
+
+          if (hwDeviceCtx == nullptr)
+          {
+              if (av_hwdevice_ctx_create(&hwDeviceCtx, type, nullptr, nullptr, 0) < 0)
+              {
+                  hwDeviceCtx = nullptr;
+                  continue;
+              }
+
+              transferFrame = av_frame_alloc();
+              if (transferFrame == nullptr)
+              {
+                  FreeHardwareDecoder();
+                  return E_OUTOFMEMORY;
+              }
+          }
+          decoder->hwPixelFormat = format;
+          decoder->codecCtx->hw_device_ctx = av_buffer_ref(hwDeviceCtx);
+          decoder->codecCtx->opaque = decoder;
+          decoder->codecCtx->get_format = GetHardwareFormat;
+          return S_OK;
+      }
+      return S_FALSE;
+  }
+
+  void FFMPEGReaderNative::FreeHardwareDecoder()
+  {
+      if (transferFrame != nullptr)
+      {
+          av_frame_free(&transferFrame);
+          transferFrame = nullptr;
+      }
+      if (hwDeviceCtx != nullptr)
+      {
+          av_buffer_unref(&hwDeviceCtx);
+          hwDeviceCtx = nullptr;
+      }
+  }
+
+  //**********************************************************************
+  // OpenDecoder() creates and opens the decoder for an audio or video
+  // stream and adds it to the selection.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::OpenDecoder(int streamId)
+  {
+      StreamDecoder *decoder = new StreamDecoder();
+      decoder->streamId = streamId;
+      decoder->codecCtx = formatCtx->streams[streamId]->codec;
+      decoder->frameType = (decoder->codecCtx->codec_type == AVMEDIA_TYPE_VIDEO) ? 0 : 1;
+      decoders[streamId] = decoder;
+
+      // Next find the codec associated with the stream
+      decoder->codec = avcodec_find_decoder(decoder->codecCtx->codec_id);
+      if (decoder->codec == nullptr)
+      {
+          CloseDecoder(streamId);
+          return PSIERR_DECODER_NOT_FOUND;
+      }
+
+      HRESULT hr = S_OK;
+      if (decoder->frameType == 0)
+      {
+          // Threading must be configured before the codec is opened. Frame threading
+          // adds (thread_count - 1) frames of latency, which we flush out at EOF.
+          decoder->codecCtx->thread_count = decodingThreads;
+          if (decodingThreadType != 0)
+          {
+              decoder->codecCtx->thread_type = decodingThreadType;
+          }
+          if (liveMode)
+          {
+              // Hand each frame out as soon as its packet has been decoded
+              decoder->codecCtx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+              decoder->codecCtx->thread_type = FF_THREAD_SLICE;
+          }
+          if (keyframesOnly)
+          {
+              decoder->codecCtx->skip_frame = AVDISCARD_NONKEY;
+              decoder->codecCtx->skip_loop_filter = AVDISCARD_ALL;
+          }
+
+          // Let the decoder shrink the image by up to 2^max_lowres while it is still
+          // at least the output size. Decoded frames are never scaled up.
+          int outputWidth, outputHeight;
+          GetOutputSize(decoder->codecCtx->width, decoder->codecCtx->height, &outputWidth, &outputHeight);
+          int lowres = 0;
+          while (lowres < decoder->codec->max_lowres &&
+                 (decoder->codecCtx->width >> (lowres + 1)) >= outputWidth &&
+                 (decoder->codecCtx->height >> (lowres + 1)) >= outputHeight)
+          {
+              lowres++;
+          }
+          decoder->codecCtx->lowres = lowres;
+
+          // Optionally decode on the GPU. If no device is available we silently
+          // fall back to software decoding.
+          hr = InitializeHardwareDecoder(decoder);
+          if (FAILED(hr))
+          {
+              CloseDecoder(streamId);
+              return hr;
+          }
+      }
+
+      int avResult = avcodec_open2(decoder->codecCtx, decoder->codec, nullptr);
+      if (avResult < 0)
+      {
+          CloseDecoder(streamId);
+          return ConvertFFMPEGError(avResult);
+      }
+
+      decoder->frame = av_frame_alloc();
+      if (decoder->frame == nullptr)
+      {
+          CloseDecoder(streamId);
+          return E_OUTOFMEMORY;
+      }
+
+      if (decoder->frameType == 1)
+      {
+          // Room for one second of converted output, which is far more than any
+          // single decoded frame holds
+          decoder->audioBufferSize = FFMPEGAudioConverter::GetOutputBufferSize(decoder->codecCtx->channels, decoder->codecCtx->sample_rate);
+          return S_OK;
+      }
+
+      // Build our scaler up front so the first frame doesn't pay for it. With a
+      // hardware decoder the source format isn't known until the first frame
+      // has been downloaded, and in planar mode we never convert at all.
+      if (decoder->codecCtx->hw_device_ctx != nullptr || planarOutput)
+      {
+          return S_OK;
+      }
+      hr = UpdateConvertor(decoder, decoder->codecCtx->width, decoder->codecCtx->height, decoder->codecCtx->pix_fmt);
+      if (FAILED(hr))
+      {
+          CloseDecoder(streamId);
+      }
+      return hr;
+  }
+
+  //**********************************************************************
+  // CloseDecoder() closes a stream's decoder and removes it from the
+  // selection. The codec context belongs to the stream, so it is closed
+  // (and can be reopened later) but not freed.
+  //**********************************************************************
+  void FFMPEGReaderNative::CloseDecoder(int streamId)
+  {
+      StreamDecoder *decoder = decoders[streamId];
+      if (decoder == nullptr)
+      {
+          return;
+      }
+      avcodec_close(decoder->codecCtx);
+      av_buffer_unref(&decoder->codecCtx->hw_device_ctx);
+      decoder->codecCtx->get_format = avcodec_default_get_format;
+      decoder->codecCtx->opaque = nullptr;
+      decoder->codecCtx->skip_frame = AVDISCARD_DEFAULT;
+      decoder->codecCtx->skip_loop_filter = AVDISCARD_DEFAULT;
+      decoder->codecCtx->lowres = 0;
+      if (decoder->frame != nullptr)
+      {
+          av_frame_free(&decoder->frame);
+          decoder->frame = nullptr;
+      }
+      FreeConvertor(decoder);
+      delete decoder;
+      decoders[streamId] = nullptr;
+      currentVideoFrame = nullptr;
+      unconvertedDecoder = nullptr;
+  }
+
+  void FFMPEGReaderNative::CloseDecoders()
+  {
+      for (int i = 0; i < (int)decoders.size(); i++)
+      {
+          CloseDecoder(i);
+      }
+      decoders.clear();
+      videoDecoder = nullptr;
+      audioDecoder = nullptr;
+  }
+
+  //**********************************************************************
+  // UpdateStreamSelection() tells the demuxer to drop every packet from
+  // streams we have no decoder for, so they cost neither I/O nor a trip
+  // through ReadPacket(), and picks the streams GetWidth() etc. describe.
+  //**********************************************************************
+  void FFMPEGReaderNative::UpdateStreamSelection()
+  {
+      videoDecoder = nullptr;
+      audioDecoder = nullptr;
       for (int i = 0; i < (int)formatCtx->nb_streams; i++)
       {
-          if (formatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO)
+          StreamDecoder *decoder = (i < (int)decoders.size()) ? decoders[i] : nullptr;
+          formatCtx->streams[i]->discard = (decoder != nullptr) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+          if (decoder != nullptr && decoder->frameType == 0 && videoDecoder == nullptr)
+          {
+              videoDecoder = decoder;
+          }
+          else if (decoder != nullptr && decoder->frameType == 1 && audioDecoder == nullptr)
+          {
+              audioDecoder = decoder;
+          }
+      }
+  }
+
+  int FFMPEGReaderNative::GetRequiredBufferSize(StreamDecoder *decoder)
+  {
+      if (decoder->frameType == 1)
+      {
+          return decoder->audioBufferSize;
+      }
+      if (planarOutput)
+      {
+          return 0;
+      }
+      int width, height;
+      GetOutputSize(decoder->codecCtx->width, decoder->codecCtx->height, &width, &height);
+      return width * height * bytesPerPixel;
+  }
+  
+  //**********************************************************************
+  // Open() opens an MPEG file for playback via FFMPEG
+  // Parameters:
+  //   filename - Name of .mp4 file to playback
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::Open(char *filename)
+  {
+      std::string fn(filename);
+      if (liveMode)
+      {
+          url = fn;
+          reconnectCount = 0;
+          HRESULT hr = OpenLiveInput();
+          return SUCCEEDED(hr) ? OpenStreams() : hr;
+      }
+      int avResult = avformat_open_input(&formatCtx, fn.c_str(), nullptr, nullptr);
+      if (avResult < 0)
+      {
+          return ConvertFFMPEGError(avResult);
+      }
+      return OpenStreams();
+  }
+
+  //**********************************************************************
+  // SetIOBufferSize() sets the size of the buffer FFMPEG reads custom
+  // inputs (OpenWithCallbacks(), OpenFromBuffer() and OpenMappedFile())
+  // through. 0 picks a default for the input: 64KB, or 1MB for mapped
+  // files. Must be called before Open*().
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::SetIOBufferSize(int bufferSize)
+  {
+      if (bufferSize < 0)
+      {
+          return E_INVALIDARG;
+      }
+      ioBufferSize = bufferSize;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // OpenWithCallbacks() opens input read through caller supplied
+  // callbacks (see FFMPEGReadCallback) instead of a file. 'seek' may be
+  // nullptr for input that can only be read front to back, which can't be
+  // seeked in either.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::OpenWithCallbacks(FFMPEGReadCallback read, FFMPEGSeekCallback seek, void *opaque)
+  {
+      FFMPEGInputNative *newInput;
+      HRESULT hr = FFMPEGInputNative::CreateFromCallbacks(read, seek, opaque, &newInput);
+      return SUCCEEDED(hr) ? OpenInput(newInput) : hr;
+  }
+
+  //**********************************************************************
+  // OpenFromBuffer() opens a file held in memory. The caller keeps
+  // ownership of the 'size' bytes at 'data', which must stay valid until
+  // the reader is destroyed.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::OpenFromBuffer(const uint8_t *data, int64_t size)
+  {
+      FFMPEGInputNative *newInput;
+      HRESULT hr = FFMPEGInputNative::CreateFromBuffer(data, size, &newInput);
+      return SUCCEEDED(hr) ? OpenInput(newInput) : hr;
+  }
+
+  //**********************************************************************
+  // OpenMappedFile() opens a local or network file by memory mapping it,
+  // reading ahead of the demuxer in large requests.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::OpenMappedFile(const char *filename)
+  {
+      FFMPEGInputNative *newInput;
+      HRESULT hr = FFMPEGInputNative::CreateFromMappedFile(filename, &newInput);
+      return SUCCEEDED(hr) ? OpenInput(newInput) : hr;
+  }
+
+  //**********************************************************************
+  // OpenInput() takes ownership of 'newInput' and opens the container it
+  // holds through a custom AVIOContext.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::OpenInput(FFMPEGInputNative *newInput)
+  {
+      if (formatCtx != nullptr)
+      {
+          delete newInput;
+          return E_UNEXPECTED;
+      }
+      FreeInput();
+      input = newInput;
+
+      AVIOContext *ioCtx;
+      HRESULT hr = input->CreateIOContext(ioBufferSize, &ioCtx);
+      if (FAILED(hr))
+      {
+          FreeInput();
+          return hr;
+      }
+      formatCtx = avformat_alloc_context();
+      if (formatCtx == nullptr)
+      {
+          FreeInput();
+          return E_OUTOFMEMORY;
+      }
+      formatCtx->pb = ioCtx;
+      formatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+      // On failure avformat_open_input() frees formatCtx, but not our AVIOContext
+      int avResult = avformat_open_input(&formatCtx, "", nullptr, nullptr);
+      if (avResult < 0)
+      {
+          FreeInput();
+          return ConvertFFMPEGError(avResult);
+      }
+      return OpenStreams();
+  }
+
+  void FFMPEGReaderNative::FreeInput()
+  {
+      delete input;
+      input = nullptr;
+  }
+
+  //**********************************************************************
+  // OpenStreams() finds the streams of the container just opened into
+  // formatCtx, opens the default decoders and resets the read position
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::OpenStreams()
+  {
+      HRESULT hr = FindStreams();
+      if (FAILED(hr))
+      {
+          return hr;
+      }
+      
+      av_init_packet(&packet);
+      packet.data = nullptr;
+      packet.size = 0;
+      currentStreamId = -1;
+      demuxStarted = false;
+      draining = false;
+      pendingFrame = false;
+      discardBeforeMillisecs = -1.0;
+      readRangeEndMillisecs = -1.0;
+      framesScaled = 0;
+      scaleMicrosecs = 0;
+      scalerRebuilds = 0;
+      
+      // Decode-ahead starts with the first NextFrame(), so that streams can be
+      // selected before anything has been demuxed.
+      av_read_play(formatCtx);
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // FindStreams() probes the streams of the container in formatCtx and
+  // opens decoders for the default selection
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::FindStreams()
+  {
+      SetIODeadline();
+      int avResult = avformat_find_stream_info(formatCtx, nullptr);
+      if (avResult < 0)
+      {
+          return ConvertFFMPEGError(avResult);
+      }
+      
+      // By default we decode the last audio and the last video stream in the
+      // file. SelectStreams() can pick any others.
+      int videoStreamId = -1;
+      int audioStreamId = -1;
+      for (int i = 0; i < (int)formatCtx->nb_streams; i++)
+      {
+          if (formatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO)
+          {
+              videoStreamId = i;
+          }
+          else if (formatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO)
+          {
+              audioStreamId = i;
+          }
+      }
+      if (audioStreamId == -1 && videoStreamId == -1)
+      {
+          return E_UNEXPECTED;
+      }
+      
+      // A stream whose decoder can't be opened is left out of the selection
+      decoders.assign(formatCtx->nb_streams, nullptr);
+      HRESULT videoResult = (videoStreamId != -1) ? OpenDecoder(videoStreamId) : S_FALSE;
+      HRESULT audioResult = (audioStreamId != -1) ? OpenDecoder(audioStreamId) : S_FALSE;
+      UpdateStreamSelection();
+      if (videoDecoder == nullptr && audioDecoder == nullptr)
+      {
+          return FAILED(videoResult) ? videoResult : audioResult;
+      }
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // SetLiveMode() switches the reader to low latency ingest of a live
+  // network stream (RTSP, RTP, SRT, ...). Must be called before Open().
+  // In live mode:
+  //   - the demuxer doesn't buffer (fflags=nobuffer), and probes only
+  //     'probeSize' bytes / 'analyzeDurationMs' of the stream on open
+  //   - video decoders run with AV_CODEC_FLAG_LOW_DELAY and without frame
+  //     threading, so each packet comes straight back out as a frame
+  //   - a network read blocking for more than 'timeoutMs', or the stream
+  //     ending, reconnects to the URL (up to 'maxReconnects' times per
+  //     dropout, -1 to keep trying), keeping the same streams selected
+  // Parameters:
+  //   transport - RTSP transport ("tcp", "udp", "udp_multicast" or "http").
+  //               nullptr or "" uses FFMPEG's default. Ignored by other
+  //               protocols
+  //   probeSize, analyzeDurationMs, timeoutMs - 0 picks a default (32KB,
+  //               500ms and 5s)
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::SetLiveMode(bool live, const char *transport, int probeSize, int analyzeDurationMs, int timeoutMs, int maxReconnects)
+  {
+      if (probeSize < 0 || analyzeDurationMs < 0 || timeoutMs < 0 || maxReconnects < -1)
+      {
+          return E_INVALIDARG;
+      }
+      liveMode = live;
+      liveTransport = (transport != nullptr) ? transport : "";
+      liveProbeSize = (probeSize > 0) ? probeSize : DefaultLiveProbeSize;
+      liveAnalyzeDurationMs = (analyzeDurationMs > 0) ? analyzeDurationMs : DefaultLiveAnalyzeDurationMs;
+      liveTimeoutMs = (timeoutMs > 0) ? timeoutMs : DefaultLiveTimeoutMs;
+      liveMaxReconnects = maxReconnects;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // OpenLiveInput() opens 'url' into a new formatCtx with the low latency
+  // demuxer options, and an interrupt callback that enforces our timeout
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::OpenLiveInput()
+  {
+      formatCtx = avformat_alloc_context();
+      if (formatCtx == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+      formatCtx->interrupt_callback.callback = InterruptCallback;
+      formatCtx->interrupt_callback.opaque = this;
+
+      AVDictionary *options = nullptr;
+      av_dict_set(&options, "fflags", "nobuffer", 0);
+      av_dict_set_int(&options, "probesize", liveProbeSize, 0);
+      av_dict_set_int(&options, "analyzeduration", (int64_t)liveAnalyzeDurationMs * 1000, 0);
+      // RTP reorders packets for up to max_delay (500ms by default over UDP). A
+      // short window still fixes up local reordering without the added latency.
+      av_dict_set(&options, "max_delay", "100000", 0);
+      if (!liveTransport.empty())
+      {
+          av_dict_set(&options, "rtsp_transport", liveTransport.c_str(), 0);
+      }
+
+      // On failure avformat_open_input() frees formatCtx and sets it to nullptr
+      SetIODeadline();
+      int avResult = avformat_open_input(&formatCtx, url.c_str(), nullptr, &options);
+      av_dict_free(&options);
+      if (avResult < 0)
+      {
+          return ConvertFFMPEGError(avResult);
+      }
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // Reconnect() reopens a live stream that has dropped out, retrying with
+  // a growing delay, and reselects the streams that were being decoded.
+  // Runs on whichever thread is demuxing (the decoders belong to it).
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::Reconnect()
+  {
+      std::vector<int> selection;
+      for (int i = 0; i < (int)decoders.size(); i++)
+      {
+          if (decoders[i] != nullptr)
+          {
+              selection.push_back(i);
+          }
+      }
+
+      HRESULT hr = PSIERR_EOF;
+      for (int attempt = 0; liveMaxReconnects < 0 || attempt < liveMaxReconnects; attempt++)
+      {
+          CloseDecoders(); // The codec contexts belong to formatCtx, so close them first
+          if (formatCtx != nullptr)
+          {
+              avformat_close_input(&formatCtx);
+          }
+
+          // Back off 250ms, 500ms, ... up to 4s between attempts
+          int64_t delay = (int64_t)250000 << ((attempt < 4) ? attempt : 4);
+          int64_t resumeAt = av_gettime_relative() + delay;
+          while (!abortRequested && av_gettime_relative() < resumeAt)
+          {
+              av_usleep(10000);
+          }
+          if (abortRequested)
+          {
+              return PSIERR_EXIT;
+          }
+
+          hr = OpenLiveInput();
+          if (SUCCEEDED(hr))
+          {
+              hr = FindStreams();
+          }
+          if (FAILED(hr))
+          {
+              continue;
+          }
+
+          // Keep decoding the streams that were selected, if the stream still has them
+          bool sameStreams = !selection.empty() && selection.back() < (int)formatCtx->nb_streams;
+          for (size_t i = 0; sameStreams && i < selection.size(); i++)
+          {
+              AVMediaType type = formatCtx->streams[selection[i]]->codec->codec_type;
+              sameStreams = (type == AVMEDIA_TYPE_VIDEO || type == AVMEDIA_TYPE_AUDIO);
+          }
+          if (sameStreams)
+          {
+              std::vector<bool> selected(formatCtx->nb_streams, false);
+              for (size_t i = 0; i < selection.size(); i++)
+              {
+                  selected[selection[i]] = true;
+              }
+              for (int i = 0; i < (int)formatCtx->nb_streams; i++)
+              {
+                  if (!selected[i])
+                  {
+                      CloseDecoder(i);
+                  }
+                  else if (decoders[i] == nullptr)
+                  {
+                      OpenDecoder(i);
+                  }
+              }
+              UpdateStreamSelection();
+          }
+
+          draining = false;
+          av_read_play(formatCtx);
+          reconnectCount++;
+          return S_OK;
+      }
+      return hr;
+  }
+
+  //**********************************************************************
+  // Live streams get a deadline for each blocking network operation;
+  // InterruptCallback() makes FFMPEG give up once it has passed, or as
+  // soon as the decode thread is being stopped.
+  //**********************************************************************
+  void FFMPEGReaderNative::SetIODeadline()
+  {
+      ioDeadline = liveMode ? av_gettime_relative() + (int64_t)liveTimeoutMs * 1000 : 0;
+  }
+
+  int FFMPEGReaderNative::InterruptCallback(void *opaque)
+  {
+      FFMPEGReaderNative *reader = (FFMPEGReaderNative*)opaque;
+      if (reader->abortRequested)
+      {
+          return 1;
+      }
+      return (reader->ioDeadline != 0 && av_gettime_relative() > reader->ioDeadline) ? 1 : 0;
+  }
+
+  //**********************************************************************
+  // GetFrameArrivalTime() returns the wall clock time (microseconds since
+  // 1/1/1970 UTC) at which the packet that produced the frame last returned
+  // by ReadFrameData()/ReadFrameBuffer() was demuxed. For live streams this
+  // is when the frame arrived over the network, which (unlike the stream's
+  // own timestamps) can be fused with local sensors.
+  //**********************************************************************
+  int64_t FFMPEGReaderNative::GetFrameArrivalTime()
+  {
+      return frameArrivalMicrosecs;
+  }
+
+  //**********************************************************************
+  // GetReconnectCount() returns how many times a live stream has been
+  // reconnected since Open()
+  //**********************************************************************
+  int FFMPEGReaderNative::GetReconnectCount()
+  {
+      return reconnectCount;
+  }
+
+  //**********************************************************************
+  // GetScalerStats() returns what converting decoded video frames to the
+  // output format has cost since Open(): the number of frames converted,
+  // the total time spent in sws_scale() (microseconds) and how often the
+  // cached scaler had to be rebuilt because the decoder's output changed.
+  // With decode-ahead the counts are updated by the decode thread, so they
+  // may be a frame behind.
+  //**********************************************************************
+  void FFMPEGReaderNative::GetScalerStats(int64_t *frames, int64_t *microsecs, int *rebuilds)
+  {
+      *frames = framesScaled;
+      *microsecs = scaleMicrosecs;
+      *rebuilds = scalerRebuilds;
+  }
+
+  //**********************************************************************
+  // GetStreamCount() returns the number of streams in the opened file.
+  // Streams are identified by their index, from 0 to GetStreamCount() - 1.
+  //**********************************************************************
+  int FFMPEGReaderNative::GetStreamCount()
+  {
+      return (formatCtx == nullptr) ? 0 : (int)formatCtx->nb_streams;
+  }
+
+  //**********************************************************************
+  // GetStreamInfo() describes one of the streams in the opened file,
+  // whether or not it is selected.
+  // Parameters:
+  //   streamId - Index of the stream
+  //   frameType - Receives 0 for video, 1 for audio, -1 for anything else
+  //   width, height - Receive the video frame size (0 for audio)
+  //   sampleRate, numChannels - Receive the audio format (0 for video)
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::GetStreamInfo(int streamId, int *frameType, int *width, int *height, int *sampleRate, int *numChannels)
+  {
+      if (streamId < 0 || streamId >= GetStreamCount())
+      {
+          return E_INVALIDARG;
+      }
+      AVCodecContext *codecCtx = formatCtx->streams[streamId]->codec;
+      *frameType = -1;
+      *width = 0;
+      *height = 0;
+      *sampleRate = 0;
+      *numChannels = 0;
+      if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+      {
+          *frameType = 0;
+          *width = codecCtx->width;
+          *height = codecCtx->height;
+      }
+      else if (codecCtx->codec_type == AVMEDIA_TYPE_AUDIO)
+      {
+          *frameType = 1;
+          *sampleRate = codecCtx->sample_rate;
+          *numChannels = codecCtx->channels;
+      }
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // GetStreamCodecName() returns FFMPEG's name for a stream's codec (e.g.
+  // "h264"), or nullptr if there is no such stream.
+  //**********************************************************************
+  const char *FFMPEGReaderNative::GetStreamCodecName(int streamId)
+  {
+      if (streamId < 0 || streamId >= GetStreamCount())
+      {
+          return nullptr;
+      }
+      return avcodec_get_name(formatCtx->streams[streamId]->codec->codec_id);
+  }
+
+  //**********************************************************************
+  // SelectStreams() replaces the set of streams we decode. Any number of
+  // audio and video streams may be selected; every other stream is dropped
+  // by the demuxer. Use GetFrameStreamId() (or the descriptors returned by
+  // ReadFrames()) to tell which stream each frame came from. If reading has
+  // already started we seek back to the last seek position (or the start of
+  // the file) so that the newly selected streams don't miss any frames.
+  // Parameters:
+  //   streamIds - Indices of the streams to decode
+  //   numStreams - Number of entries in 'streamIds'
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::SelectStreams(const int *streamIds, int numStreams)
+  {
+      if (formatCtx == nullptr)
+      {
+          return E_UNEXPECTED;
+      }
+      if (numStreams <= 0)
+      {
+          return E_INVALIDARG;
+      }
+      std::vector<bool> selected(formatCtx->nb_streams, false);
+      for (int i = 0; i < numStreams; i++)
+      {
+          int streamId = streamIds[i];
+          if (streamId < 0 || streamId >= (int)formatCtx->nb_streams)
+          {
+              return E_INVALIDARG;
+          }
+          AVMediaType type = formatCtx->streams[streamId]->codec->codec_type;
+          if (type != AVMEDIA_TYPE_VIDEO && type != AVMEDIA_TYPE_AUDIO)
+          {
+              return E_INVALIDARG;
+          }
+          selected[streamId] = true;
+      }
+
+      // The decode thread owns the decoders while it runs
+      StopDecodeAhead();
+      av_packet_unref(&packet);
+      pendingFrame = false;
+      currentVideoFrame = nullptr;
+      unconvertedDecoder = nullptr;
+
+      decoders.resize(formatCtx->nb_streams, nullptr);
+      HRESULT hr = S_OK;
+      for (int i = 0; i < (int)formatCtx->nb_streams; i++)
+      {
+          if (!selected[i])
+          {
+              CloseDecoder(i);
+          }
+          else if (decoders[i] == nullptr && SUCCEEDED(hr))
+          {
+              hr = OpenDecoder(i);
+          }
+      }
+      UpdateStreamSelection();
+      if (FAILED(hr))
+      {
+          return hr;
+      }
+
+      if (demuxStarted)
+      {
+          hr = SeekStreams((discardBeforeMillisecs < 0.0) ? 0.0 : discardBeforeMillisecs);
+      }
+      return hr;
+  }
+  
+  //**********************************************************************
+  // StreamTimeToMillisecs() converts a timestamp in a stream's time base to
+  // milliseconds since the start of the file. All streams share the same
+  // origin so they stay aligned.
+  //**********************************************************************
+  double FFMPEGReaderNative::StreamTimeToMillisecs(int64_t timestamp, int streamIndex)
+  {
+      double millisecs = 1000.0 * (double)timestamp * av_q2d(formatCtx->streams[streamIndex]->time_base);
+      if (formatCtx->start_time != AV_NOPTS_VALUE)
+      {
+          millisecs -= (double)formatCtx->start_time * 1000.0 / AV_TIME_BASE;
+      }
+      return millisecs;
+  }
+
+  int64_t FFMPEGReaderNative::MillisecsToStreamTime(double timestampMillisecs, int streamIndex)
+  {
+      if (formatCtx->start_time != AV_NOPTS_VALUE)
+      {
+          timestampMillisecs += (double)formatCtx->start_time * 1000.0 / AV_TIME_BASE;
+      }
+      return (int64_t)(timestampMillisecs / (1000.0 * av_q2d(formatCtx->streams[streamIndex]->time_base)));
+  }
+
+  bool FFMPEGReaderNative::IsPastReadRange()
+  {
+      for (int i = 0; i < (int)decoders.size(); i++)
+      {
+          if (decoders[i] != nullptr && !decoders[i]->pastEnd)
+          {
+              return false;
+          }
+      }
+      return true;
+  }
+
+  //**********************************************************************
+  // Seek() repositions playback so that the next frame returned by
+  // ReadFrameData() is the first one at or after 'timestampMillisecs'
+  // (measured from the start of the file, like the timestamps we return).
+  // We seek the demuxer to the preceding keyframe, flush the decoders and
+  // then decode and drop frames until we reach the target.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::Seek(double timestampMillisecs)
+  {
+      return Reposition(timestampMillisecs, readRangeEndMillisecs);
+  }
+
+  //**********************************************************************
+  // Reposition() seeks to 'startMillisecs' and sets the end of the read
+  // range. The decode thread owns the demuxer and decoders while it runs,
+  // and everything it has queued is from before the seek, so it is stopped
+  // first. The next NextFrame() starts it again.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::Reposition(double startMillisecs, double endMillisecs)
+  {
+      if (formatCtx == nullptr)
+      {
+          return E_UNEXPECTED;
+      }
+
+      StopDecodeAhead();
+      readRangeEndMillisecs = endMillisecs;
+      return SeekStreams(startMillisecs);
+  }
+
+  HRESULT FFMPEGReaderNative::SeekStreams(double timestampMillisecs)
+  {
+      if (timestampMillisecs < 0.0)
+      {
+          timestampMillisecs = 0.0;
+      }
+
+      StreamDecoder *seekDecoder = (videoDecoder != nullptr) ? videoDecoder : audioDecoder;
+      if (seekDecoder == nullptr)
+      {
+          return E_UNEXPECTED;
+      }
+      int64_t target = MillisecsToStreamTime(timestampMillisecs, seekDecoder->streamId);
+      int avResult = av_seek_frame(formatCtx, seekDecoder->streamId, target, AVSEEK_FLAG_BACKWARD);
+      if (avResult < 0)
+      {
+          return ConvertFFMPEGError(avResult);
+      }
+
+      // Throw away anything buffered from before the seek, and resync each
+      // audio clock from the first frame decoded after it
+      av_packet_unref(&packet);
+      for (int i = 0; i < (int)decoders.size(); i++)
+      {
+          StreamDecoder *decoder = decoders[i];
+          if (decoder == nullptr)
+          {
+              continue;
+          }
+          avcodec_flush_buffers(decoder->codecCtx);
+          decoder->pastEnd = false;
+          decoder->drained = false;
+          decoder->audioClock = timestampMillisecs;
+          decoder->audioClockValid = false;
+      }
+      currentVideoFrame = nullptr;
+      unconvertedDecoder = nullptr;
+      demuxStarted = false;
+      draining = false;
+      pendingFrame = false;
+      discardBeforeMillisecs = timestampMillisecs;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // SetReadRange() limits playback to [startMillisecs, endMillisecs). Seeks
+  // to 'startMillisecs' and reports end of stream once every stream has
+  // reached 'endMillisecs'. Pass a negative 'endMillisecs' to read to the
+  // end of the file.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::SetReadRange(double startMillisecs, double endMillisecs)
+  {
+      return Reposition(startMillisecs, endMillisecs);
+  }
+
+  //**********************************************************************
+  // StartDecodeAhead() allocates the frame queue and starts the decode
+  // thread if decode-ahead is enabled and the thread isn't already running.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::StartDecodeAhead()
+  {
+      if (decodeAheadDepth == 0 || planarOutput || decodeAhead != nullptr || formatCtx == nullptr)
+      {
+          return S_OK;
+      }
+
+      // Size the slots for the biggest frame any selected stream produces so
+      // that, unless the resolution changes mid-stream, the decode thread
+      // never allocates.
+      int slotSize = 0;
+      for (int i = 0; i < (int)decoders.size(); i++)
+      {
+          if (decoders[i] != nullptr && GetRequiredBufferSize(decoders[i]) > slotSize)
+          {
+              slotSize = GetRequiredBufferSize(decoders[i]);
+          }
+      }
+
+      decodeAhead = new DecodeAheadQueue();
+      decodeAhead->slots.resize(decodeAheadDepth);
+      for (int i = 0; i < decodeAheadDepth; i++)
+      {
+          decodeAhead->slots[i].streamIndex = 0;
+          decodeAhead->slots[i].streamId = -1;
+          decodeAhead->slots[i].buffer = nullptr;
+          decodeAhead->slots[i].dataSize = 0;
+          decodeAhead->slots[i].timestampMillisecs = 0.0;
+          decodeAhead->slots[i].arrivalMicrosecs = 0;
+      }
+      for (int i = 0; i < decodeAheadDepth; i++)
+      {
+          decodeAhead->slots[i].buffer = framePool->Acquire(slotSize);
+          if (decodeAhead->slots[i].buffer == nullptr)
+          {
+              StopDecodeAhead();
+              return E_OUTOFMEMORY;
+          }
+      }
+      decodeAhead->readIndex = 0;
+      decodeAhead->writeIndex = 0;
+      decodeAhead->count = 0;
+      decodeAhead->stopRequested = false;
+      decodeAhead->finished = false;
+      decodeAhead->result = S_OK;
+      decodeAhead->thread = std::thread(&FFMPEGReaderNative::DecodeAheadThreadProc, this);
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // StopDecodeAhead() stops the decode thread, waits for it to exit and
+  // discards any frames still queued.
+  //**********************************************************************
+  void FFMPEGReaderNative::StopDecodeAhead()
+  {
+      if (decodeAhead == nullptr)
+      {
+          return;
+      }
+      {
+          std::lock_guard<std::mutex> lock(decodeAhead->mutex);
+          decodeAhead->stopRequested = true;
+      }
+      decodeAhead->slotFreed.notify_all();
+
+      // The decode thread may be blocked reading a live stream
+      abortRequested = true;
+      if (decodeAhead->thread.joinable())
+      {
+          decodeAhead->thread.join();
+      }
+      abortRequested = false;
+      for (size_t i = 0; i < decodeAhead->slots.size(); i++)
+      {
+          FFMPEGFramePool::Release(decodeAhead->slots[i].buffer);
+      }
+      delete decodeAhead;
+      decodeAhead = nullptr;
+  }
+
+  //**********************************************************************
+  // DecodeAheadThreadProc() is the body of the decode thread. It runs the
+  // same demux/decode path as the synchronous mode, writing into the next
+  // free slot, and blocks while the queue is full.
+  //**********************************************************************
+  void FFMPEGReaderNative::DecodeAheadThreadProc()
+  {
+      DecodeAheadQueue *queue = decodeAhead;
+      HRESULT hr = S_OK;
+      if (!Media::Threading::IsDefaultThreadPolicy(decodeAheadThreadPolicy))
+      {
+          Media::Threading::ApplyThreadPolicy(decodeAheadThreadPolicy);
+      }
+      for (;;)
+      {
+          DecodeAheadQueue::Slot *slot;
+          {
+              std::unique_lock<std::mutex> lock(queue->mutex);
+              queue->slotFreed.wait(lock, [queue] { return queue->stopRequested || queue->count < (int)queue->slots.size(); });
+              if (queue->stopRequested)
+              {
+                  Media::Threading::RevertThreadPolicy();
+                  return;
+              }
+              slot = &queue->slots[queue->writeIndex];
+          }
+
+          int streamIndex = 0;
+          int requiredBufferSize = 0;
+          bool eos = false;
+          hr = ReadPacket(&streamIndex, &requiredBufferSize, &eos);
+          if (hr == S_FALSE)
           {
-              videoStreamIndex = i;
+              continue;
           }
-          else if (formatCtx->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO)
+          if (FAILED(hr) || eos)
+          {
+              break;
+          }
+          int streamId = packet.stream_index;
+
+          // The slot's buffer is gone if the caller took it with ReadFrameBuffer(),
+          // or too small if the resolution has changed
+          if (slot->buffer == nullptr || slot->buffer->capacity < requiredBufferSize)
+          {
+              FFMPEGFramePool::Release(slot->buffer);
+              slot->buffer = framePool->Acquire(requiredBufferSize);
+              if (slot->buffer == nullptr)
+              {
+                  av_packet_unref(&packet);
+                  hr = E_OUTOFMEMORY;
+                  break;
+              }
+          }
+          hr = DecodePacket(slot->buffer->data, slot->buffer->capacity, &slot->dataSize, &slot->timestampMillisecs);
+          if (hr == PSIERR_BUFFER_TOO_SMALL)
+          {
+              // The frame is bigger than the stream's format said (the resolution
+              // or channel layout changed mid-stream); it was kept, so convert it
+              // into a bigger buffer
+              FFMPEGFramePool::Release(slot->buffer);
+              slot->buffer = framePool->Acquire(slot->dataSize);
+              if (slot->buffer == nullptr)
+              {
+                  hr = E_OUTOFMEMORY;
+                  break;
+              }
+              hr = DecodePacket(slot->buffer->data, slot->buffer->capacity, &slot->dataSize, &slot->timestampMillisecs);
+          }
+          if (hr == S_FALSE)
+          {
+              continue;
+          }
+          if (FAILED(hr))
+          {
+              break;
+          }
+          slot->streamIndex = streamIndex;
+          slot->streamId = streamId;
+          slot->arrivalMicrosecs = decodedArrivalMicrosecs;
+
           {
-              audioStreamIndex = i;
+              std::lock_guard<std::mutex> lock(queue->mutex);
+              queue->writeIndex = (queue->writeIndex + 1) % (int)queue->slots.size();
+              queue->count++;
           }
+          queue->frameQueued.notify_one();
       }
-      if (audioStreamIndex == -1 && videoStreamIndex == -1)
+
       {
-          return E_UNEXPECTED;
+          std::lock_guard<std::mutex> lock(queue->mutex);
+          queue->finished = true;
+          queue->result = FAILED(hr) ? hr : S_OK;
       }
-      
-      InitializeVideoStream();
-      InitializeAudioStream();
-      
-      av_init_packet(&packet);
-      
-      av_read_play(formatCtx);
-      return S_OK;
+      queue->frameQueued.notify_one();
+      Media::Threading::RevertThreadPolicy();
   }
-  
+
+  //**********************************************************************
+  // NextFrame() advances to the next audio or video frame. Reports which
+  // type of stream it belongs to and the size of buffer ReadFrameData()
+  // needs; GetFrameStreamId() then says which stream. Returns S_FALSE if
+  // the packet read belongs to a stream we ignore.
+  //**********************************************************************
   HRESULT FFMPEGReaderNative::NextFrame(int *streamIndex, int *requiredBufferSize, bool *eos)
   {
+      Media::Tracing::TraceScope trace(Media::Tracing::TraceEvent_ReaderNextFrame);
+
+      // A frame ReadFrames() had no room for is still waiting to be decoded
+      if (pendingFrame)
+      {
+          pendingFrame = false;
+          *streamIndex = pendingFrameType;
+          *requiredBufferSize = pendingRequiredBufferSize;
+          currentStreamId = pendingStreamId;
+          currentRequiredBufferSize = pendingRequiredBufferSize;
+          trace.SetFrame(currentStreamId, -1);
+          return S_OK;
+      }
+
+      HRESULT hr = StartDecodeAhead();
+      if (FAILED(hr))
+      {
+          return hr;
+      }
+      if (decodeAhead == nullptr)
+      {
+          // A frame ReadFrameData() had no room for is dropped by moving on
+          unconvertedDecoder = nullptr;
+          hr = ReadPacket(streamIndex, requiredBufferSize, eos);
+          if (hr == S_OK && !*eos)
+          {
+              currentStreamId = packet.stream_index;
+              currentRequiredBufferSize = *requiredBufferSize;
+              if (trace.IsActive() && packet.pts != AV_NOPTS_VALUE)
+              {
+                  // Not decoded yet, so this is the packet's time
+                  trace.SetFrameMillisecs(currentStreamId, StreamTimeToMillisecs(packet.pts, packet.stream_index));
+              }
+          }
+          return hr;
+      }
+
+      std::unique_lock<std::mutex> lock(decodeAhead->mutex);
+      decodeAhead->frameQueued.wait(lock, [this] { return decodeAhead->count > 0 || decodeAhead->finished; });
+      if (decodeAhead->count == 0)
+      {
+          if (FAILED(decodeAhead->result))
+          {
+              return decodeAhead->result;
+          }
+          *eos = true;
+          return S_OK;
+      }
+      DecodeAheadQueue::Slot &slot = decodeAhead->slots[decodeAhead->readIndex];
+      *streamIndex = slot.streamIndex;
+      *requiredBufferSize = slot.dataSize;
+      currentStreamId = slot.streamId;
+      currentRequiredBufferSize = slot.dataSize;
+      trace.SetFrameMillisecs(slot.streamId, slot.timestampMillisecs);
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // GetFrameStreamId() returns the index of the stream that the frame last
+  // reported by NextFrame() came from, or -1 if there is none.
+  //**********************************************************************
+  int FFMPEGReaderNative::GetFrameStreamId()
+  {
+      return currentStreamId;
+  }
+
+  //**********************************************************************
+  // ReadFrameData() decodes the frame found by NextFrame() into 'dataBuffer'
+  // (or, with decode-ahead, copies out the frame already decoded). Returns
+  // S_FALSE if no frame was produced. 'dataBuffer' must hold the number of
+  // bytes NextFrame() asked for; if the video resolution or the audio
+  // channel layout or frame length has grown since, so that the frame
+  // doesn't fit, returns PSIERR_BUFFER_TOO_SMALL with
+  // the size needed in 'bytesRead' and keeps the frame, which the next
+  // call (with a buffer that big) then returns.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::ReadFrameData(uint8_t *dataBuffer, int *bytesRead, double *timestampMillisecs)
+  {
+      Media::Tracing::TraceScope trace(Media::Tracing::TraceEvent_ReaderReadFrameData);
+      if (decodeAhead == nullptr)
+      {
+          HRESULT hr = DecodePacket(dataBuffer, currentRequiredBufferSize, bytesRead, timestampMillisecs);
+          if (hr == PSIERR_BUFFER_TOO_SMALL)
+          {
+              currentRequiredBufferSize = *bytesRead;
+          }
+          frameArrivalMicrosecs = decodedArrivalMicrosecs;
+          if (hr == S_OK)
+          {
+              trace.SetFrameMillisecs(currentStreamId, *timestampMillisecs);
+          }
+          return hr;
+      }
+
+      DecodeAheadQueue::Slot *slot;
+      {
+          std::lock_guard<std::mutex> lock(decodeAhead->mutex);
+          if (decodeAhead->count == 0)
+          {
+              return E_UNEXPECTED;
+          }
+          slot = &decodeAhead->slots[decodeAhead->readIndex];
+      }
+
+      // The decode thread won't touch this slot until we release it below
+      if (slot->dataSize > 0)
+      {
+          memcpy(dataBuffer, slot->buffer->data, slot->dataSize);
+      }
+      *bytesRead = slot->dataSize;
+      *timestampMillisecs = slot->timestampMillisecs;
+      frameArrivalMicrosecs = slot->arrivalMicrosecs;
+      trace.SetFrameMillisecs(slot->streamId, slot->timestampMillisecs);
+
+      {
+          std::lock_guard<std::mutex> lock(decodeAhead->mutex);
+          decodeAhead->readIndex = (decodeAhead->readIndex + 1) % (int)decodeAhead->slots.size();
+          decodeAhead->count--;
+      }
+      decodeAhead->slotFreed.notify_one();
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // SetFramePoolCapacity() sets how many free frame buffers we keep for
+  // reuse. Buffers handed out by ReadFrameBuffer() (and the decode-ahead
+  // slots) don't count until they have been released.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::SetFramePoolCapacity(int capacity)
+  {
+      framePool->SetCapacity(capacity);
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // ReadFrameBuffer() is ReadFrameData() without the copy: the frame found
+  // by NextFrame() is decoded into a buffer from our frame pool (with
+  // decode-ahead, the buffer it was already decoded into) and ownership of
+  // that buffer passes to the caller, who must hand it back with
+  // ReleaseFrameBuffer() once done with it. In planar mode video frames
+  // have no data, so 'buffer' is nullptr; use GetFramePlanes() instead.
+  // Returns S_FALSE if no frame was produced.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::ReadFrameBuffer(FFMPEGFrameBufferNative **buffer, uint8_t **data, int *bytesRead, double *timestampMillisecs)
+  {
+      *buffer = nullptr;
+      *data = nullptr;
+      if (decodeAhead == nullptr)
+      {
+          FFMPEGFrameBufferNative *frameBuffer = nullptr;
+          if (currentRequiredBufferSize > 0)
+          {
+              frameBuffer = framePool->Acquire(currentRequiredBufferSize);
+              if (frameBuffer == nullptr)
+              {
+                  av_packet_unref(&packet);
+                  return E_OUTOFMEMORY;
+              }
+          }
+          HRESULT hr = DecodePacket((frameBuffer != nullptr) ? frameBuffer->data : nullptr, (frameBuffer != nullptr) ? frameBuffer->capacity : 0, bytesRead, timestampMillisecs);
+          if (hr == PSIERR_BUFFER_TOO_SMALL)
+          {
+              // The format changed mid-stream; the frame was kept for a bigger buffer
+              FFMPEGFramePool::Release(frameBuffer);
+              frameBuffer = framePool->Acquire(*bytesRead);
+              if (frameBuffer == nullptr)
+              {
+                  unconvertedDecoder = nullptr;
+                  return E_OUTOFMEMORY;
+              }
+              hr = DecodePacket(frameBuffer->data, frameBuffer->capacity, bytesRead, timestampMillisecs);
+          }
+          frameArrivalMicrosecs = decodedArrivalMicrosecs;
+          if (hr != S_OK || frameBuffer == nullptr)
+          {
+              FFMPEGFramePool::Release(frameBuffer);
+              return hr;
+          }
+          *buffer = frameBuffer;
+          *data = frameBuffer->data;
+          return S_OK;
+      }
+
+      DecodeAheadQueue::Slot *slot;
+      {
+          std::lock_guard<std::mutex> lock(decodeAhead->mutex);
+          if (decodeAhead->count == 0)
+          {
+              return E_UNEXPECTED;
+          }
+          slot = &decodeAhead->slots[decodeAhead->readIndex];
+      }
+
+      // The decode thread gets a fresh buffer from the pool when it next
+      // fills this slot
+      *buffer = slot->buffer;
+      *data = slot->buffer->data;
+      *bytesRead = slot->dataSize;
+      *timestampMillisecs = slot->timestampMillisecs;
+      frameArrivalMicrosecs = slot->arrivalMicrosecs;
+      slot->buffer = nullptr;
+
+      {
+          std::lock_guard<std::mutex> lock(decodeAhead->mutex);
+          decodeAhead->readIndex = (decodeAhead->readIndex + 1) % (int)decodeAhead->slots.size();
+          decodeAhead->count--;
+      }
+      decodeAhead->slotFreed.notify_one();
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // ReleaseFrameBuffer() hands a buffer returned by ReadFrameBuffer() back
+  // to its pool. May be called on any thread, even after the reader has
+  // been closed or destroyed.
+  //**********************************************************************
+  void FFMPEGReaderNative::ReleaseFrameBuffer(FFMPEGFrameBufferNative *buffer)
+  {
+      FFMPEGFramePool::Release(buffer);
+  }
+
+  //**********************************************************************
+  // ReadFrames() decodes up to 'maxFrames' frames into 'arena' in a single
+  // call, so callers on the far side of an interop boundary pay for one
+  // transition per batch rather than two or more per frame. Each decoded
+  // frame is described by an entry in 'descriptors'. Packets that don't
+  // produce a frame are skipped internally.
+  // The batch stops early if the next frame doesn't fit in the arena (it is
+  // kept and returned first by the next call) and, in planar mode, after
+  // each video frame since its planes are only valid until the next decode.
+  // Returns PSIERR_BUFFER_TOO_SMALL if the arena can't hold even one frame.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::ReadFrames(uint8_t *arena, int arenaSize, FFMPEGFrameDescriptorNative *descriptors, int maxFrames, int *framesRead, bool *eos)
+  {
+      *framesRead = 0;
+      int offset = 0;
+      while (*framesRead < maxFrames)
+      {
+          int frameType = 0;
+          int requiredBufferSize = 0;
+          bool endOfStream = false;
+          HRESULT hr = NextFrame(&frameType, &requiredBufferSize, &endOfStream);
+          if (hr == S_FALSE)
+          {
+              continue;
+          }
+          if (FAILED(hr))
+          {
+              return hr;
+          }
+          if (endOfStream)
+          {
+              *eos = true;
+              break;
+          }
+
+          // Until an audio frame is decoded, NextFrame() can only ask for room
+          // for a whole second of audio. Rather than reserving that, audio
+          // frames go straight to the decode below, which reports the
+          // frame's actual size if it doesn't fit. With decode-ahead every
+          // frame has already been decoded, so its size is exact.
+          int streamId = currentStreamId;
+          bool sizeKnown = (frameType == 0 || decodeAhead != nullptr);
+          if (sizeKnown && offset + requiredBufferSize > arenaSize)
+          {
+              pendingFrame = true;
+              pendingFrameType = frameType;
+              pendingStreamId = streamId;
+              pendingRequiredBufferSize = requiredBufferSize;
+              return (*framesRead == 0) ? PSIERR_BUFFER_TOO_SMALL : S_OK;
+          }
+
+          int bytesRead = 0;
+          double timestampMillisecs = 0.0;
+          if (decodeAhead == nullptr)
+          {
+              // Decode into whatever room the arena has left
+              currentRequiredBufferSize = (offset < arenaSize) ? arenaSize - offset : 0;
+          }
+          hr = ReadFrameData(arena + offset, &bytesRead, &timestampMillisecs);
+          if (hr == PSIERR_BUFFER_TOO_SMALL)
+          {
+              // The frame needs more room than the arena has left (or, if the
+              // format changed mid-stream, than NextFrame() said). It was kept,
+              // like one that didn't fit at all.
+              pendingFrame = true;
+              pendingFrameType = frameType;
+              pendingStreamId = streamId;
+              pendingRequiredBufferSize = bytesRead;
+              return (*framesRead == 0) ? PSIERR_BUFFER_TOO_SMALL : S_OK;
+          }
+          if (hr == S_FALSE)
+          {
+              continue;
+          }
+          if (FAILED(hr))
+          {
+              return hr;
+          }
+
+          FFMPEGFrameDescriptorNative &descriptor = descriptors[*framesRead];
+          descriptor.frameType = frameType;
+          descriptor.streamId = streamId;
+          descriptor.offset = offset;
+          descriptor.size = bytesRead;
+          descriptor.timestampMillisecs = timestampMillisecs;
+          descriptor.arrivalMicrosecs = frameArrivalMicrosecs;
+          (*framesRead)++;
+
+          // Keep each frame 16-byte aligned for whoever processes it next
+          offset += (bytesRead + 15) & ~15;
+
+          if (planarOutput && frameType == 0)
+          {
+              break;
+          }
+      }
+      return S_OK;
+  }
+
+  HRESULT FFMPEGReaderNative::ReadPacket(int *streamIndex, int *requiredBufferSize, bool *eos)
+  {
+      if (IsPastReadRange())
+      {
+          *eos = true;
+          return S_OK;
+      }
+
+      demuxStarted = true;
+      if (formatCtx == nullptr)
+      {
+          // A reconnect was interrupted by stopping the decode thread; pick it up again
+          HRESULT hr = Reconnect();
+          return SUCCEEDED(hr) ? S_FALSE : hr;
+      }
+      SetIODeadline();
       int avResult = av_read_frame(formatCtx, &packet);
+      if (avResult < 0 && liveMode && liveMaxReconnects != 0 && !abortRequested)
+      {
+          // A live stream that ends or stalls has dropped out rather than finished
+          HRESULT hr = Reconnect();
+          return SUCCEEDED(hr) ? S_FALSE : hr;
+      }
       if (avResult < 0)
       {
           if (avResult == AVERROR_EOF)
           {
+              // The video decoders may still be holding frames (B-frame reordering
+              // or frame threading). Feed each one empty packets until it runs dry.
+              for (int i = 0; i < (int)decoders.size(); i++)
+              {
+                  StreamDecoder *decoder = decoders[i];
+                  if (decoder != nullptr && decoder->frameType == 0 && !decoder->drained && !decoder->pastEnd)
+                  {
+                      draining = true;
+                      packet.data = nullptr;
+                      packet.size = 0;
+                      packet.stream_index = decoder->streamId;
+                      *streamIndex = 0;
+                      *requiredBufferSize = GetRequiredBufferSize(decoder);
+                      return S_OK;
+                  }
+              }
               *eos = true;
               return S_OK;
           }
           return ConvertFFMPEGError(avResult);
       }
-      if (packet.stream_index == videoStreamIndex)
+
+      packetArrivalMicrosecs = av_gettime();
+
+      // Unselected streams are discarded by the demuxer, but streams that
+      // only show up mid-file have no decoder either
+      StreamDecoder *decoder = (packet.stream_index < (int)decoders.size()) ? decoders[packet.stream_index] : nullptr;
+      if (decoder == nullptr || decoder->pastEnd)
       {
-          *streamIndex = 0;
-          *requiredBufferSize = videoCodecCtx->width * videoCodecCtx->height * bytesPerPixel;
+          av_packet_unref(&packet);
+          return S_FALSE;
       }
-      else if (packet.stream_index == audioStreamIndex)
+
+      // In keyframe mode other video packets never reach the decoder (which
+      // would skip them anyway, but only after parsing them)
+      if (keyframesOnly && decoder->frameType == 0 && (packet.flags & AV_PKT_FLAG_KEY) == 0)
       {
-          *streamIndex = 1;
-          *requiredBufferSize = audioBufferSize;
+          av_packet_unref(&packet);
+          return S_FALSE;
       }
-      else
+      *streamIndex = decoder->frameType;
+      *requiredBufferSize = GetRequiredBufferSize(decoder);
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // ConvertVideoFrame() converts currentVideoFrame into 'dataBuffer' in our
+  // output format. If the converted frame needs more than 'bufferSize'
+  // bytes, returns PSIERR_BUFFER_TOO_SMALL with the size needed in
+  // 'bytesRead' and remembers the frame, so that the next DecodePacket()
+  // converts it instead of decoding.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::ConvertVideoFrame(StreamDecoder *decoder, uint8_t *dataBuffer, int bufferSize, int *bytesRead)
+  {
+      // The decoder reports the frame's actual size/format, which may change mid-stream
+      AVFrame *sourceFrame = currentVideoFrame;
+      HRESULT hr = UpdateConvertor(decoder, sourceFrame->width, sourceFrame->height, (AVPixelFormat)sourceFrame->format);
+      if (FAILED(hr))
       {
-          return S_FALSE;
+          unconvertedDecoder = nullptr;
+          return hr;
       }
-      
+
+      int size = decoder->convertorOutputWidth * decoder->convertorOutputHeight * bytesPerPixel;
+      if (dataBuffer == nullptr || size > bufferSize)
+      {
+          unconvertedDecoder = decoder;
+          *bytesRead = size;
+          return PSIERR_BUFFER_TOO_SMALL;
+      }
+      unconvertedDecoder = nullptr;
+
+      uint8_t *const data[2] = {(uint8_t*)dataBuffer, nullptr};
+      const int linesize[2] = {decoder->convertorOutputWidth * bytesPerPixel, 0};
+      int64_t scaleStart = av_gettime_relative();
+      sws_scale(decoder->convertorCtx, ((AVPicture*)sourceFrame)->data, ((AVPicture*)sourceFrame)->linesize,
+                0, sourceFrame->height, data, linesize);
+      scaleMicrosecs += av_gettime_relative() - scaleStart;
+      framesScaled++;
+      *bytesRead = size;
       return S_OK;
   }
 
-  HRESULT FFMPEGReaderNative::ReadFrameData(uint8_t *dataBuffer, int *bytesRead, double *timestampMillisecs)
+  //**********************************************************************
+  // ConvertAudioFrame() is ConvertVideoFrame() for the decoder's current
+  // audio frame. Audio buffers are sized for a second of audio at the
+  // stream's opening channel count, which a longer frame or a mid-stream
+  // channel layout change can exceed.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::ConvertAudioFrame(StreamDecoder *decoder, uint8_t *dataBuffer, int bufferSize, int *bytesRead)
+  {
+      AVFrame *audioFrame = decoder->frame;
+      int bytesConverted = decoder->audioConverter.Convert(audioFrame, (int16_t*)dataBuffer, bufferSize);
+      if (bytesConverted == AVERROR_BUFFER_TOO_SMALL)
+      {
+          unconvertedDecoder = decoder;
+          *bytesRead = FFMPEGAudioConverter::GetOutputBufferSize(audioFrame->channels, audioFrame->nb_samples);
+          return PSIERR_BUFFER_TOO_SMALL;
+      }
+      unconvertedDecoder = nullptr;
+      if (bytesConverted < 0)
+      {
+          return ConvertFFMPEGError(bytesConverted);
+      }
+      *bytesRead = bytesConverted;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // DecodePacket() decodes the packet read by ReadPacket() into 'dataBuffer',
+  // which holds 'bufferSize' bytes. Returns S_FALSE if no frame was
+  // produced, and PSIERR_BUFFER_TOO_SMALL (see ConvertVideoFrame()) if the
+  // frame doesn't fit.
+  //**********************************************************************
+  HRESULT FFMPEGReaderNative::DecodePacket(uint8_t *dataBuffer, int bufferSize, int *bytesRead, double *timestampMillisecs)
   {
+      // A frame that didn't fit the last buffer is now converted into this one
+      if (unconvertedDecoder != nullptr)
+      {
+          *timestampMillisecs = unconvertedTimestampMillisecs;
+          if (unconvertedDecoder->frameType == 1)
+          {
+              return ConvertAudioFrame(unconvertedDecoder, dataBuffer, bufferSize, bytesRead);
+          }
+          return ConvertVideoFrame(unconvertedDecoder, dataBuffer, bufferSize, bytesRead);
+      }
+
+      HRESULT hr = S_OK;
       int decodedFrame;
-      if (packet.stream_index == videoStreamIndex)
+      StreamDecoder *decoder = (packet.stream_index >= 0 && packet.stream_index < (int)decoders.size()) ? decoders[packet.stream_index] : nullptr;
+      if (decoder == nullptr)
+      {
+          hr = S_FALSE;
+      }
+      else if (decoder->frameType == 0)
       {
+          AVFrame *videoFrame = decoder->frame;
 #pragma warning(disable:4189)
-          int dataRead = avcodec_decode_video2(videoCodecCtx, videoFrame, &decodedFrame, &packet);
+          // The arrival time travels through the decoder with the packet, so it
+          // comes out with the right frame when frames are reordered
+          decoder->codecCtx->reordered_opaque = packetArrivalMicrosecs;
+          int dataRead = avcodec_decode_video2(decoder->codecCtx, videoFrame, &decodedFrame, &packet);
           if (dataRead < 0)
           {
-              return ConvertFFMPEGError(dataRead);
+              // An error while flushing just means the decoder has nothing left
+              decoder->drained = draining;
+              hr = draining ? S_FALSE : ConvertFFMPEGError(dataRead);
           }
-          
-          if (decodedFrame != 0)
+          else if (decodedFrame != 0)
           {
-              double presentationTimestamp;
-              if (packet.dts != AV_NOPTS_VALUE)
+              // With frame threading (or B-frames) the frame we get back belongs to an
+              // earlier packet, so the timestamp must come from the frame, not the packet.
+              int64_t pts = av_frame_get_best_effort_timestamp(videoFrame);
+              double presentationTimestamp = 0.0;
+              if (pts != AV_NOPTS_VALUE)
               {
-                  presentationTimestamp = (double)av_frame_get_best_effort_timestamp(videoFrame);
+                  presentationTimestamp = StreamTimeToMillisecs(pts, decoder->streamId);
               }
-              else
+              *timestampMillisecs = presentationTimestamp;
+              decodedArrivalMicrosecs = videoFrame->reordered_opaque;
+
+              // Frames between the keyframe we seeked to and the seek target are
+              // decoded (they're needed as references) but not returned. In keyframe
+              // mode the keyframe itself is the closest frame we have.
+              if (discardBeforeMillisecs >= 0.0 && presentationTimestamp < discardBeforeMillisecs && !keyframesOnly)
               {
-                  presentationTimestamp = 0.0;
+                  hr = S_FALSE;
+              }
+              else if (readRangeEndMillisecs >= 0.0 && presentationTimestamp >= readRangeEndMillisecs)
+              {
+                  decoder->pastEnd = true;
+                  hr = S_FALSE;
               }
-              presentationTimestamp *= av_q2d(videoCodecCtx->time_base);
-              *timestampMillisecs = presentationTimestamp;
               
-              // Convert the image from raw format to RGB
-              struct SwsContext *convertorCtx = sws_getCachedContext(nullptr, videoCodecCtx->width, videoCodecCtx->height, videoCodecCtx->pix_fmt,
-                     videoCodecCtx->width, videoCodecCtx->height, outputFormat, SWS_POINT, nullptr, nullptr, nullptr);
-              uint8_t *const data[2] = {(uint8_t*)dataBuffer, nullptr};
-              sws_scale(convertorCtx, ((AVPicture*)videoFrame)->data, ((AVPicture*)videoFrame)->linesize,
-                        0, videoCodecCtx->height, data, ((AVPicture *)convertedVideoFrame)->linesize);
-              sws_freeContext(convertorCtx);
-              *bytesRead = videoCodecCtx->width * videoCodecCtx->height * bytesPerPixel;
+              // Frames decoded on the GPU have to be downloaded before we can
+              // use them. We only pull down the decoder's native surface
+              // (typically NV12), which is smaller than the RGB output.
+              AVFrame *sourceFrame = videoFrame;
+              if (hr == S_OK && decoder->codecCtx->hw_device_ctx != nullptr && videoFrame->format == decoder->hwPixelFormat)
+              {
+                  av_frame_unref(transferFrame);
+                  int avResult = av_hwframe_transfer_data(transferFrame, videoFrame, 0);
+                  if (avResult < 0)
+                  {
+                      hr = ConvertFFMPEGError(avResult);
+                  }
+                  sourceFrame = transferFrame;
+              }
+              currentVideoFrame = (hr == S_OK) ? sourceFrame : nullptr;
+
+              if (hr == S_OK && planarOutput)
+              {
+                  // Planes are handed out as-is via GetFramePlanes()
+                  *bytesRead = 0;
+              }
+              else if (hr == S_OK)
+              {
+                  // Convert the image from raw format to RGB
+                  unconvertedTimestampMillisecs = presentationTimestamp;
+                  hr = ConvertVideoFrame(decoder, dataBuffer, bufferSize, bytesRead);
+              }
           }
           else
           {
-              return S_FALSE;
+              // Decoder is still filling its pipeline, or has been fully flushed
+              decoder->drained = draining;
+              hr = S_FALSE;
           }
       }
-      else if (packet.stream_index == audioStreamIndex)
+      else
       {
-          int samplesDecoded = avcodec_decode_audio4(audioCodecCtx, audioFrame, &decodedFrame, &packet);
+          AVFrame *audioFrame = decoder->frame;
+          int samplesDecoded = avcodec_decode_audio4(decoder->codecCtx, audioFrame, &decodedFrame, &packet);
           if (samplesDecoded < 0)
           {
-              return ConvertFFMPEGError(samplesDecoded);
+              hr = ConvertFFMPEGError(samplesDecoded);
           }
-          if (decodedFrame != 0)
+          else if (decodedFrame != 0)
           {
-              auto ConvertSample = [&](float sample)
+              // The clock is synced to the frame timestamps at open and after every
+              // seek, then advanced by the number of samples so it doesn't jitter.
+              int64_t pts = av_frame_get_best_effort_timestamp(audioFrame);
+              if (!decoder->audioClockValid)
               {
-                  if (sample < -1.0f)
+                  if (pts != AV_NOPTS_VALUE)
                   {
-                      sample = -1.0f;
+                      decoder->audioClock = StreamTimeToMillisecs(pts, decoder->streamId);
                   }
-                  else if (sample > +1.0f)
-                  {
-                      sample = +1.0f;
-                  }
-                  return (int16_t)(sample * 32767.0f);
-              };
-              int16_t *outputBuffer = (int16_t*)dataBuffer;
-              if (audioFrame->channels == 1)
+                  decoder->audioClockValid = true;
+              }
+              double presentationTimestamp = decoder->audioClock;
+              double duration = 1000.0 * ((double)audioFrame->nb_samples / (double)decoder->codecCtx->sample_rate);
+              decoder->audioClock += duration;
+              *timestampMillisecs = presentationTimestamp;
+              decodedArrivalMicrosecs = packetArrivalMicrosecs;
+
+              if (discardBeforeMillisecs >= 0.0 && presentationTimestamp + duration <= discardBeforeMillisecs)
               {
-                  float *inputChannel0 = (float*)audioFrame->extended_data[0];
-                  for (int i = 0; i < audioFrame->nb_samples; i++)
-                  {
-                      outputBuffer[i] = ConvertSample(*inputChannel0++);
-                  }
+                  hr = S_FALSE;
               }
-              else
+              else if (readRangeEndMillisecs >= 0.0 && presentationTimestamp >= readRangeEndMillisecs)
               {
-                  float *inputChannel0 = (float*)audioFrame->extended_data[0];
-                  float *inputChannel1 = (float*)audioFrame->extended_data[1];
-                  for (int i = 0; i < audioFrame->nb_samples; i++)
-                  {
-                      outputBuffer[2 * i + 0] = ConvertSample(*inputChannel0++);
-                      outputBuffer[2 * i + 1] = ConvertSample(*inputChannel1++);
-                  }
+                  decoder->pastEnd = true;
+                  hr = S_FALSE;
               }
-              *bytesRead = audioFrame->channels * 2 * audioFrame->nb_samples;
-              double presentationTimestamp = audioClock;
-              audioClock += 1000.0 * ((double)audioFrame->nb_samples / (double)audioCodecCtx->sample_rate);
-              *timestampMillisecs = presentationTimestamp;
-              return S_OK;
           }
           else
           {
-              return S_FALSE;
+              hr = S_FALSE;
+          }
+
+          if (hr == S_OK)
+          {
+              unconvertedTimestampMillisecs = *timestampMillisecs;
+              hr = ConvertAudioFrame(decoder, dataBuffer, bufferSize, bytesRead);
           }
       }
       av_packet_unref(&packet);
       
-      return S_OK;
+      return hr;
   }
 
   //**********************************************************************
-  // Closes the current file. This must be called to ensure the MP4 file
-  // is written properly.
+  // Closes the current file, releasing the demuxer and whatever it reads
+  // from, so that the reader can be opened again.
   //**********************************************************************
   HRESULT FFMPEGReaderNative::Close()
   {
-      if (videoCodecCtx != nullptr)
-      {
-          avcodec_close(videoCodecCtx);
-          av_free(videoCodecCtx);
-          videoCodecCtx = nullptr;
-      }
-      if (videoFrame != nullptr)
+      StopDecodeAhead();
+      CloseDecoders(); // The codec contexts belong to formatCtx, so close them first
+      if (formatCtx != nullptr)
       {
-          av_frame_free(&videoFrame);
-          videoFrame = nullptr;
+          avformat_close_input(&formatCtx);
+          formatCtx = nullptr;
       }
+      FreeInput(); // A custom AVIOContext isn't freed by avformat_close_input()
+      currentVideoFrame = nullptr;
+      unconvertedDecoder = nullptr;
+      FreeHardwareDecoder();
       return S_OK;
   }
 }}}}}
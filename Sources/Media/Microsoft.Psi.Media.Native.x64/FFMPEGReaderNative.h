@@ -14,8 +14,13 @@ extern "C" {
 #include <libswresample/swresample.h>
 #include <libavutil/dict.h>
 #include <libavutil/opt.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
 }
+#include <atomic>
 #include <string>
+#include "ThreadPolicy.h"
+#include <vector>
 #pragma warning(pop)
 
 #ifdef LINUX
@@ -26,6 +31,9 @@ extern "C" {
 #define E_FAIL -100
 #define E_OUTOFMEMORY -101
 #define E_UNEXPECTED -102
+#define E_INVALIDARG -103
+#define SUCCEEDED(hr) ((hr) >= 0)
+#define FAILED(hr) ((hr) < 0)
 #define MAKE_HRESULT(X,Y,N) -(N)
 #endif
 
@@ -62,45 +70,181 @@ namespace Windows {
 #define PSIERR_HTTP_OTHER_4XX       MAKE_HRESULT(SEVERITY_ERROR, FACILITY_ITF, 26)
 #define PSIERR_HTTP_SERVER_ERROR    MAKE_HRESULT(SEVERITY_ERROR, FACILITY_ITF, 27)
 
+  // State for the decode-ahead thread. Defined in FFMPEGReaderNative.cpp since
+  // this header is also compiled as managed code, where <thread> isn't available.
+  struct DecodeAheadQueue;
+
+  // Decoder state for one selected stream. Defined in FFMPEGReaderNative.cpp.
+  struct StreamDecoder;
+
+  // Pooled frame buffers. Defined in FFMPEGFramePool.h.
+  class FFMPEGFramePool;
+  struct FFMPEGFrameBufferNative;
+
+  // Custom AVIO input (callbacks, memory or a mapped file). Defined in FFMPEGInputNative.h.
+  class FFMPEGInputNative;
+
+  //**********************************************************************
+  // Callbacks FFMPEGReaderNative::OpenWithCallbacks() reads its input with.
+  // Both are called on the thread doing the demuxing (the decode-ahead
+  // thread, if there is one).
+  //   FFMPEGReadCallback - Copies up to 'size' bytes into 'buffer'. Returns the
+  //                        number of bytes copied, 0 at the end of the input,
+  //                        or a negative value on error
+  //   FFMPEGSeekCallback - Moves to 'offset' relative to 'whence' (SEEK_SET,
+  //                        SEEK_CUR or SEEK_END) and returns the new position,
+  //                        or returns the total size when 'whence' is
+  //                        FFMPEGSeekSize. Negative on error (or unknown size)
+  //**********************************************************************
+  typedef int (*FFMPEGReadCallback)(void *opaque, uint8_t *buffer, int size);
+  typedef int64_t (*FFMPEGSeekCallback)(void *opaque, int64_t offset, int whence);
+  static const int FFMPEGSeekSize = 0x10000; /* Same as AVSEEK_SIZE */
+
+  //**********************************************************************
+  // Describes one frame decoded by FFMPEGReaderNative::ReadFrames(). Shared
+  // with the managed wrappers, so the layout must not change.
+  //**********************************************************************
+  struct FFMPEGFrameDescriptorNative
+  {
+      int frameType;              /* 0 = video, 1 = audio (same as NextFrame()) */
+      int streamId;               /* Index of the stream the frame came from (see SelectStreams()) */
+      int offset;                 /* Byte offset of the frame's data in the arena */
+      int size;                   /* Number of bytes of frame data */
+      double timestampMillisecs;  /* Presentation time of the frame */
+      long long arrivalMicrosecs; /* Wall clock arrival time of the frame (see GetFrameArrivalTime()) */
+  };
+
   //**********************************************************************
   // Define our unmanaged data associated with the MP4Writer object
   //**********************************************************************
   class __declspec(dllexport) FFMPEGReaderNative
   {
       AVFormatContext *formatCtx;
-      int videoStreamIndex;
-      int audioStreamIndex;
-      AVCodec *audioCodec;
-      AVCodec *videoCodec;
+      std::vector<StreamDecoder*> decoders; /* Decoder for each selected stream, indexed by stream id (nullptr if not selected) */
+      StreamDecoder *videoDecoder;          /* First selected video stream (the one GetWidth()/GetHeight() describe) */
+      StreamDecoder *audioDecoder;          /* First selected audio stream (the one GetAudio*() describe) */
+      int currentStreamId;                  /* Stream of the frame last reported by NextFrame() */
+      int currentRequiredBufferSize;        /* Buffer size the frame last reported by NextFrame() needs */
       AVPacket packet;
-      AVCodecContext *videoCodecCtx;
-      AVCodecContext *audioCodecCtx;
-      AVFrame *videoFrame;
-      AVFrame *convertedVideoFrame;
-      uint8_t *convertedVideoBuffer;
-      AVFrame *audioFrame;
-      uint8_t *audioBuffers[2];
-      int audioBufferSize;
+      FFMPEGFramePool *framePool;           /* Recycles the buffers frames are decoded into */
       AVPixelFormat outputFormat; /* Pixel format for our output image */
       int bytesPerPixel;
-      double audioClock;
+      double discardBeforeMillisecs;        /* Decoded frames before this time are dropped (after a seek). -1 if none */
+      double readRangeEndMillisecs;         /* Decoded frames at or after this time end the stream. -1 if none */
+      int decodeAheadDepth;                 /* Number of frames decoded ahead on a background thread (0 = decode on the caller's thread) */
+      DecodeAheadQueue *decodeAhead;        /* Decode-ahead thread and its frame queue (nullptr when decoding synchronously) */
+      Media::Threading::ThreadPolicy decodeAheadThreadPolicy; /* Scheduling of the decode-ahead thread */
+      bool pendingFrame;                    /* Set if ReadFrames() read a frame it had no room for; it is returned next */
+      int pendingFrameType;                 /* Type of the pending frame */
+      int pendingStreamId;                  /* Stream the pending frame came from */
+      int pendingRequiredBufferSize;        /* Buffer size the pending frame needs */
+      int scalingFlags;                     /* Scaling flags (SWS_*) used when converting decoded frames */
+      int decodingThreads;                  /* Number of decoder threads (0 = let FFMPEG pick, 1 = single threaded) */
+      int decodingThreadType;               /* FF_THREAD_FRAME and/or FF_THREAD_SLICE (0 = codec default) */
+      bool demuxStarted;                    /* Set once a packet has been read since Open() or the last seek */
+      bool draining;                        /* Set once the demuxer hits EOF and we are flushing delayed frames out of the video decoders */
+      std::string hwDeviceType;             /* Requested hardware decoder ("" = software, "auto" = first available, or an FFMPEG device type name) */
+      AVBufferRef *hwDeviceCtx;             /* Hardware device shared by the video decoders (nullptr when decoding in software) */
+      AVFrame *transferFrame;               /* System memory copy of the last hardware frame */
+      bool planarOutput;                    /* If true video frames are handed out in the decoder's own format via GetFramePlanes() */
+      AVFrame *currentVideoFrame;           /* Last decoded video frame in system memory (videoFrame or transferFrame) */
+      StreamDecoder *unconvertedDecoder;    /* Decoder whose last frame (currentVideoFrame for video) didn't fit its buffer and is still to be converted (nullptr if none) */
+      double unconvertedTimestampMillisecs; /* Presentation time of that frame */
+      FFMPEGInputNative *input;             /* Custom input we demux from (nullptr when opened by file name) */
+      int ioBufferSize;                     /* AVIO buffer size for custom inputs (0 = input's default) */
+      bool liveMode;                        /* Low latency ingest of a live network stream, with reconnects (see SetLiveMode()) */
+      std::string liveTransport;            /* RTSP transport ("" = FFMPEG's default) */
+      int liveProbeSize;                    /* Bytes probed for stream info when a live stream is opened */
+      int liveAnalyzeDurationMs;            /* Length of live stream analyzed for stream info */
+      int liveTimeoutMs;                    /* Longest a live stream read may block before we reconnect */
+      int liveMaxReconnects;                /* Reconnect attempts per dropout (-1 = keep trying, 0 = never) */
+      std::string url;                      /* URL of the live stream, for reconnecting */
+      int64_t ioDeadline;                   /* av_gettime_relative() after which blocking I/O is interrupted (0 = never) */
+      volatile bool abortRequested;         /* Interrupts blocking I/O so the decode thread can be stopped */
+      int reconnectCount;                   /* Number of reconnects since Open() */
+      int64_t packetArrivalMicrosecs;       /* Wall clock time (av_gettime()) the current packet was demuxed */
+      int64_t decodedArrivalMicrosecs;      /* Arrival time of the packet the last decoded frame came from */
+      int64_t frameArrivalMicrosecs;        /* Arrival time of the frame last handed to the caller */
+      bool keyframesOnly;                   /* Only video keyframes are decoded (see SetKeyframesOnly()) */
+      int maxOutputWidth;                   /* Box video frames are scaled down to fit (0 = unconstrained, see SetOutputSize()) */
+      int maxOutputHeight;
+      std::atomic<int64_t> framesScaled;    /* Video frames converted to outputFormat since Open() (updated by the decode-ahead thread) */
+      std::atomic<int64_t> scaleMicrosecs;  /* Time spent in sws_scale() on those frames */
+      std::atomic<int> scalerRebuilds;      /* Number of times a cached scaler had to be rebuilt (resolution/format changes) */
       
-      HRESULT ConvertFFMPEGError(int error);
-      HRESULT InitializeVideoStream();
-      HRESULT InitializeAudioStream();
+      HRESULT OpenInput(FFMPEGInputNative *input);
+      HRESULT OpenStreams();
+      HRESULT FindStreams();
+      HRESULT OpenLiveInput();
+      HRESULT Reconnect();
+      void SetIODeadline();
+      static int InterruptCallback(void *opaque);
+      void FreeInput();
+      HRESULT OpenDecoder(int streamId);
+      void CloseDecoder(int streamId);
+      void CloseDecoders();
+      void UpdateStreamSelection();
+      int GetRequiredBufferSize(StreamDecoder *decoder);
+      void GetOutputSize(int width, int height, int *outputWidth, int *outputHeight);
+      HRESULT UpdateConvertor(StreamDecoder *decoder, int width, int height, AVPixelFormat sourceFormat);
+      void FreeConvertor(StreamDecoder *decoder);
+      HRESULT InitializeHardwareDecoder(StreamDecoder *decoder);
+      void FreeHardwareDecoder();
+      static AVPixelFormat GetHardwareFormat(AVCodecContext *ctx, const AVPixelFormat *formats);
+      double StreamTimeToMillisecs(int64_t timestamp, int streamIndex);
+      int64_t MillisecsToStreamTime(double timestampMillisecs, int streamIndex);
+      bool IsPastReadRange();
+      HRESULT Reposition(double startMillisecs, double endMillisecs);
+      HRESULT SeekStreams(double timestampMillisecs);
+      HRESULT ReadPacket(int *streamIndex, int *requiredBufferSize, bool *eos);
+      HRESULT DecodePacket(uint8_t *dataBuffer, int bufferSize, int *bytesRead, double *timestampMillisecs);
+      HRESULT ConvertVideoFrame(StreamDecoder *decoder, uint8_t *dataBuffer, int bufferSize, int *bytesRead);
+      HRESULT ConvertAudioFrame(StreamDecoder *decoder, uint8_t *dataBuffer, int bufferSize, int *bytesRead);
+      HRESULT StartDecodeAhead();
+      void StopDecodeAhead();
+      void DecodeAheadThreadProc();
   public:
+      static HRESULT ConvertFFMPEGError(int error);
       FFMPEGReaderNative();
       ~FFMPEGReaderNative();
-      HRESULT Initialize(int outputDepth);
+      HRESULT Initialize(int outputDepth, int decodingThreads, int decodingThreadType);
+      HRESULT SetHardwareAcceleration(const char *deviceType);
+      HRESULT SetPlanarOutput(bool planar);
+      HRESULT SetDecodeAheadDepth(int depth);
+      HRESULT SetDecodeAheadThreadPolicy(int priority, uint64_t affinityMask);
+      HRESULT SetKeyframesOnly(bool keyframes);
+      HRESULT SetOutputSize(int maxWidth, int maxHeight);
+      HRESULT SetIOBufferSize(int bufferSize);
+      HRESULT SetLiveMode(bool live, const char *transport, int probeSize, int analyzeDurationMs, int timeoutMs, int maxReconnects);
       HRESULT Open(char *filename);
+      HRESULT OpenWithCallbacks(FFMPEGReadCallback read, FFMPEGSeekCallback seek, void *opaque);
+      HRESULT OpenFromBuffer(const uint8_t *data, int64_t size);
+      HRESULT OpenMappedFile(const char *filename);
+      int GetStreamCount();
+      HRESULT GetStreamInfo(int streamId, int *frameType, int *width, int *height, int *sampleRate, int *numChannels);
+      const char *GetStreamCodecName(int streamId);
+      HRESULT SelectStreams(const int *streamIds, int numStreams);
+      HRESULT Seek(double timestampMillisecs);
+      HRESULT SetReadRange(double startMillisecs, double endMillisecs);
       HRESULT NextFrame(int *streamIndex, int *requiredBufferSize, bool *eos);
       HRESULT ReadFrameData(uint8_t *imageData, int *bytesRead, double *timestampMillisecs);
+      int GetFrameStreamId();
+      HRESULT SetFramePoolCapacity(int capacity);
+      HRESULT ReadFrameBuffer(FFMPEGFrameBufferNative **buffer, uint8_t **data, int *bytesRead, double *timestampMillisecs);
+      static void ReleaseFrameBuffer(FFMPEGFrameBufferNative *buffer);
+      HRESULT ReadFrames(uint8_t *arena, int arenaSize, FFMPEGFrameDescriptorNative *descriptors, int maxFrames, int *framesRead, bool *eos);
+      HRESULT GetFramePlanes(uint8_t *planes[4], int strides[4], int *pixelFormat, int *width, int *height);
+      const char *GetFramePixelFormatName();
       HRESULT Close();
       int GetWidth();
       int GetHeight();
       int GetAudioSampleRate();
       int GetAudioBitsPerSample();
       int GetAudioNumChannels();
+      bool IsHardwareAccelerated();
+      int64_t GetFrameArrivalTime();
+      int GetReconnectCount();
+      void GetScalerStats(int64_t *frames, int64_t *microsecs, int *rebuilds);
   };
 }}}}}
 #endif // USE_FFMPEG
@@ -0,0 +1,1216 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "stdafx.h"
+#ifdef USE_FFMPEG
+#include "FFMPEGWriterNative.h"
+#include "FFMPEGFramePool.h"
+#include <string.h>
+#include <limits.h>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#pragma warning(push)
+#pragma warning(disable:4996)
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Native {
+namespace Windows {
+
+extern "C" {
+    void *FFMPEGWriterNative_Alloc()
+    {
+        return new FFMPEGWriterNative();
+    }
+
+    void FFMPEGWriterNative_Dealloc(void *obj)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        delete pObj;
+    }
+
+    int FFMPEGWriterNative_SetVideoEncoder(void *obj, char *codec, char *encoder, int bitrate, int gopSize, int bFrames, char *preset)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->SetVideoEncoder(codec, encoder, bitrate, gopSize, bFrames, preset);
+    }
+
+    int FFMPEGWriterNative_SetAudio(void *obj, int inputSampleRate, int inputChannels, int bitrate)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->SetAudio(inputSampleRate, inputChannels, bitrate);
+    }
+
+    int FFMPEGWriterNative_SetWriteQueue(void *obj, int queueSize, int dropWhenFull)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->SetWriteQueue(queueSize, dropWhenFull != 0);
+    }
+
+    int FFMPEGWriterNative_SetThreadPolicy(void *obj, int priority, uint64_t affinityMask)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->SetThreadPolicy(priority, affinityMask);
+    }
+
+    int FFMPEGWriterNative_Open(void *obj, char *filename, int width, int height, int frameRateNum, int frameRateDenom)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->Open(filename, width, height, frameRateNum, frameRateDenom);
+    }
+
+    int FFMPEGWriterNative_WriteVideoFrame(void *obj, long long timestamp, uint8_t *data, int width, int height, int stride, int pixelFormat)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->WriteVideoFrame(timestamp, data, width, height, stride, pixelFormat);
+    }
+
+    int FFMPEGWriterNative_WriteVideoFrameBuffer(void *obj, long long timestamp, void *buffer, int width, int height, int stride, int pixelFormat)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->WriteVideoFrameBuffer(timestamp, (FFMPEGFrameBufferNative*)buffer, width, height, stride, pixelFormat);
+    }
+
+    int FFMPEGWriterNative_WriteAudio(void *obj, long long timestamp, uint8_t *pcmData, int numBytes)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->WriteAudio(timestamp, pcmData, numBytes);
+    }
+
+    int FFMPEGWriterNative_GetQueueDepth(void *obj)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->GetQueueDepth();
+    }
+
+    int FFMPEGWriterNative_GetNumFramesDropped(void *obj)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->GetNumFramesDropped();
+    }
+
+    const char *FFMPEGWriterNative_GetEncoderName(void *obj)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->GetEncoderName();
+    }
+
+    int FFMPEGWriterNative_IsHardwareAccelerated(void *obj)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->IsHardwareAccelerated() ? 1 : 0;
+    }
+
+    int FFMPEGWriterNative_Close(void *obj)
+    {
+        FFMPEGWriterNative *pObj = (FFMPEGWriterNative*)obj;
+        return pObj->Close();
+    }
+}
+
+  //**********************************************************************
+  // A video frame or block of audio waiting for the encode thread. Its data
+  // is in 'buffer', which the entry holds a reference to.
+  //**********************************************************************
+  struct EncodeQueueEntry
+  {
+      int frameType;                         /* 0 = video, 1 = audio */
+      int64_t timestamp;                     /* Ticks, as passed to WriteVideoFrame()/WriteAudio() */
+      FFMPEGFrameBufferNative *buffer;       /* Image or PCM data */
+      int width;                             /* Video only: image size, stride and format */
+      int height;
+      int stride;
+      int pixelFormat;
+      int size;                              /* Audio only: number of bytes of PCM */
+  };
+
+  //**********************************************************************
+  // The encode thread and the queue it works off. Every call into the
+  // encoders and the muxer after Open() happens on this thread.
+  //**********************************************************************
+  struct EncodeQueue
+  {
+      std::thread thread;
+      std::mutex mutex;
+      std::condition_variable notEmpty;      /* Signaled when an entry is queued or stopRequested is set */
+      std::condition_variable notFull;       /* Signaled when the encode thread takes an entry, or fails */
+      std::deque<EncodeQueueEntry> entries;
+      bool stopRequested;                    /* Set by Close(); the thread exits once the queue is empty */
+      HRESULT result;                        /* First error the encode thread hit */
+      int numFramesDropped;                  /* Video frames dropped because the queue was full */
+  };
+
+  // Number of free buffers the writer keeps for queued frames
+  static const int WriterFramePoolCapacity = 8;
+
+  // Psi timestamps are in 100ns ticks
+  static const AVRational TicksTimeBase = { 1, 10000000 };
+
+  // Video is encoded with the 90kHz clock MPEG uses, which is much finer than
+  // any frame rate so jittery capture timestamps survive
+  static const AVRational VideoTimeBase = { 1, 90000 };
+
+  const char *FFMPEGWriterNative::DefaultSoftwarePreset = "veryfast";
+
+  FFMPEGWriterNative::FFMPEGWriterNative() :
+      formatCtx(nullptr),
+      videoCtx(nullptr),
+      videoStream(nullptr),
+      audioCtx(nullptr),
+      audioStream(nullptr),
+      hwDeviceCtx(nullptr),
+      videoFrame(nullptr),
+      hwFrame(nullptr),
+      audioFrame(nullptr),
+      convertorCtx(nullptr),
+      resampleCtx(nullptr),
+      audioFifo(nullptr),
+      resampleBuffer(nullptr),
+      resampleBufferSamples(0),
+      framePool(FFMPEGFramePool::Create(WriterFramePoolCapacity)),
+      videoCodecName("h264"),
+      encoderName("auto"),
+      videoBitrate(10000000),
+      gopSize(-1),
+      bFrames(-1),
+      width(0),
+      height(0),
+      hasAudio(false),
+      audioInputSampleRate(0),
+      audioInputChannels(0),
+      audioBitrate(192000),
+      firstTimestamp(-1),
+      lastVideoPts(AV_NOPTS_VALUE),
+      audioPts(0),
+      audioPtsValid(false),
+      writeQueueSize(0),
+      dropFramesWhenQueueFull(false),
+      encodeQueue(nullptr),
+      opened(false)
+  {
+      frameRate.num = 30;
+      frameRate.den = 1;
+      encodeThreadPolicy = Media::Threading::MakeThreadPolicy(Media::Threading::ThreadPriority_Normal, Media::Threading::ThreadTask_Capture, 0);
+      av_init_packet(&packet);
+      packet.data = nullptr;
+      packet.size = 0;
+  }
+
+  FFMPEGWriterNative::~FFMPEGWriterNative()
+  {
+      Close();
+      framePool->Release();
+  }
+
+  //**********************************************************************
+  // SetVideoEncoder() picks the video codec and encoder. Must be called
+  // before Open().
+  // Parameters:
+  //   codec - "h264" (the default) or "hevc"
+  //   encoder - nullptr, "" or "auto" tries NVENC, then VAAPI, then the
+  //             software encoder (libx264/libx265). Anything else is taken
+  //             as an FFMPEG encoder name (e.g. "h264_nvenc")
+  //   bitrate - Target bitrate in bits/sec
+  //   gopSize, bFrames - -1 leaves them at the encoder's default
+  //   preset - Encoder preset (e.g. "veryfast" for libx264, "p4" for NVENC).
+  //            nullptr or "" uses "veryfast" for the software encoders, and
+  //            the encoder's default otherwise
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::SetVideoEncoder(const char *codec, const char *encoder, int bitrate, int gopSize, int bFrames, const char *preset)
+  {
+      std::string codecName = (codec == nullptr || codec[0] == '\0') ? "h264" : codec;
+      if ((codecName != "h264" && codecName != "hevc") || bitrate <= 0 || gopSize < -1 || bFrames < -1)
+      {
+          return E_INVALIDARG;
+      }
+      videoCodecName = codecName;
+      encoderName = (encoder == nullptr || encoder[0] == '\0') ? "auto" : encoder;
+      videoBitrate = bitrate;
+      this->gopSize = gopSize;
+      this->bFrames = bFrames;
+      this->preset = (preset == nullptr) ? "" : preset;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // SetAudio() adds an AAC audio stream, fed with interleaved 16-bit PCM at
+  // 'inputSampleRate' with 'inputChannels' channels (what FFMPEGReaderNative
+  // produces). The AAC stream keeps the input's rate when the encoder
+  // supports it (48kHz otherwise) and its channel count. Must be called
+  // before Open().
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::SetAudio(int inputSampleRate, int inputChannels, int bitrate)
+  {
+      if (inputSampleRate <= 0 || inputChannels <= 0 || bitrate <= 0)
+      {
+          return E_INVALIDARG;
+      }
+      hasAudio = true;
+      audioInputSampleRate = inputSampleRate;
+      audioInputChannels = inputChannels;
+      audioBitrate = bitrate;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // SetWriteQueue() moves encoding onto a background thread. The Write*()
+  // calls then copy (or, for pooled buffers, reference) the data and queue
+  // it; up to 'queueSize' entries wait for the encoder. When the queue is
+  // full video frames are dropped if 'dropWhenFull' is set (audio never
+  // is), otherwise the caller waits. 0 encodes on the caller's thread.
+  // Must be called before Open().
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::SetWriteQueue(int queueSize, bool dropWhenFull)
+  {
+      if (queueSize < 0)
+      {
+          return E_INVALIDARG;
+      }
+      writeQueueSize = queueSize;
+      dropFramesWhenQueueFull = dropWhenFull;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // SetThreadPolicy() sets the scheduling of the encode thread started
+  // when SetWriteQueue() asks for one (see ThreadPolicy.h); it has no
+  // effect on synchronous encoding, which runs on the caller's thread.
+  // 'priority' is a System.Threading.ThreadPriority value. Must be called
+  // before Open().
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::SetThreadPolicy(int priority, uint64_t affinityMask)
+  {
+      if (priority < Media::Threading::ThreadPriority_Lowest || priority > Media::Threading::ThreadPriority_Highest)
+      {
+          return E_INVALIDARG;
+      }
+      encodeThreadPolicy = Media::Threading::MakeThreadPolicy(priority, Media::Threading::ThreadTask_Capture, affinityMask);
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // GetInputPixelFormat() maps a Psi pixel format to FFMPEG's. BGRX is
+  // encoded the same as BGRA (the alpha channel is ignored).
+  //**********************************************************************
+  AVPixelFormat FFMPEGWriterNative::GetInputPixelFormat(int pixelFormat)
+  {
+      switch (pixelFormat)
+      {
+      case FFMPEGWriterPixelFormat_Gray_8bpp: return AV_PIX_FMT_GRAY8;
+      case FFMPEGWriterPixelFormat_BGR_24bpp: return AV_PIX_FMT_BGR24;
+      case FFMPEGWriterPixelFormat_BGRX_32bpp: return AV_PIX_FMT_BGRA;
+      case FFMPEGWriterPixelFormat_BGRA_32bpp: return AV_PIX_FMT_BGRA;
+      }
+      return AV_PIX_FMT_NONE;
+  }
+
+  //**********************************************************************
+  // IsValidFrameLayout() returns true if the pixel format is one we take
+  // and each row of 'stride' bytes holds the full width, so reading
+  // 'stride' * 'frameHeight' bytes neither runs short of the image nor
+  // overflows an int.
+  //**********************************************************************
+  bool FFMPEGWriterNative::IsValidFrameLayout(int frameWidth, int frameHeight, int stride, int pixelFormat)
+  {
+      if (frameWidth <= 0 || frameHeight <= 0 || GetInputPixelFormat(pixelFormat) == AV_PIX_FMT_NONE)
+      {
+          return false;
+      }
+      int bytesPerPixel = (pixelFormat == FFMPEGWriterPixelFormat_Gray_8bpp) ? 1 : (pixelFormat == FFMPEGWriterPixelFormat_BGR_24bpp) ? 3 : 4;
+      return (int64_t)stride >= (int64_t)frameWidth * bytesPerPixel && (int64_t)stride * frameHeight <= INT_MAX;
+  }
+
+  //**********************************************************************
+  // Open() creates the output file and opens the encoders. The container
+  // is picked from the file name's extension (.mp4, .mkv, ...).
+  // Parameters:
+  //   width, height - Size of the encoded video. Frames of any other size
+  //                   are scaled to it
+  //   frameRateNum, frameRateDenom - Nominal frame rate. Frames are stamped
+  //                   with the timestamps they are written with, so the
+  //                   actual rate may vary
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::Open(const char *filename, int width, int height, int frameRateNum, int frameRateDenom)
+  {
+      if (opened || formatCtx != nullptr)
+      {
+          return E_UNEXPECTED;
+      }
+      if (filename == nullptr || width <= 0 || height <= 0 || frameRateNum <= 0 || frameRateDenom <= 0)
+      {
+          return E_INVALIDARG;
+      }
+      this->width = width;
+      this->height = height;
+      frameRate.num = frameRateNum;
+      frameRate.den = frameRateDenom;
+
+      int avResult = avformat_alloc_output_context2(&formatCtx, nullptr, nullptr, filename);
+      if (avResult < 0 || formatCtx == nullptr)
+      {
+          formatCtx = nullptr;
+          return (avResult < 0) ? FFMPEGReaderNative::ConvertFFMPEGError(avResult) : PSIERR_MUXER_NOT_FOUND;
+      }
+
+      // Try each candidate encoder in turn. A hardware encoder that is
+      // present in the FFMPEG build may still have no device to run on.
+      std::vector<std::string> candidates;
+      if (encoderName == "auto")
+      {
+          candidates.push_back(videoCodecName + "_nvenc");
+          candidates.push_back(videoCodecName + "_vaapi");
+          candidates.push_back((videoCodecName == "h264") ? "libx264" : "libx265");
+      }
+      else
+      {
+          candidates.push_back(encoderName);
+      }
+      HRESULT hr = PSIERR_ENCODER_NOT_FOUND;
+      for (size_t i = 0; i < candidates.size(); i++)
+      {
+          const AVCodec *codec = avcodec_find_encoder_by_name(candidates[i].c_str());
+          if (codec == nullptr)
+          {
+              continue;
+          }
+          hr = OpenVideoEncoder(codec);
+          if (SUCCEEDED(hr))
+          {
+              encoderName = codec->name;
+              break;
+          }
+          FreeVideoEncoder();
+      }
+      if (SUCCEEDED(hr) && hasAudio)
+      {
+          hr = OpenAudioEncoder();
+      }
+
+      if (SUCCEEDED(hr) && (formatCtx->oformat->flags & AVFMT_NOFILE) == 0)
+      {
+          avResult = avio_open(&formatCtx->pb, filename, AVIO_FLAG_WRITE);
+          if (avResult < 0)
+          {
+              hr = FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+          }
+      }
+      if (SUCCEEDED(hr))
+      {
+          avResult = avformat_write_header(formatCtx, nullptr);
+          if (avResult < 0)
+          {
+              hr = FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+          }
+      }
+      if (FAILED(hr))
+      {
+          FreeOutput();
+          return hr;
+      }
+
+      firstTimestamp = -1;
+      lastVideoPts = AV_NOPTS_VALUE;
+      audioPtsValid = false;
+      opened = true;
+      if (writeQueueSize > 0)
+      {
+          hr = StartEncodeThread();
+      }
+      return hr;
+  }
+
+  //**********************************************************************
+  // OpenVideoEncoder() opens 'codec' for our output settings and adds the
+  // video stream to the file. On failure the caller frees whatever was
+  // allocated with FreeVideoEncoder() and moves on to the next encoder.
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::OpenVideoEncoder(const AVCodec *codec)
+  {
+      videoCtx = avcodec_alloc_context3(codec);
+      if (videoCtx == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+      videoCtx->width = width;
+      videoCtx->height = height;
+      videoCtx->time_base = VideoTimeBase;
+      videoCtx->framerate = frameRate;
+      videoCtx->bit_rate = videoBitrate;
+      if (gopSize >= 0)
+      {
+          videoCtx->gop_size = gopSize;
+      }
+      if (bFrames >= 0)
+      {
+          videoCtx->max_b_frames = bFrames;
+      }
+      if (formatCtx->oformat->flags & AVFMT_GLOBALHEADER)
+      {
+          videoCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+      }
+
+      // VAAPI encoders only take frames on the device. Everything else gets
+      // planar 4:2:0 (or NV12, or whatever the encoder lists first).
+      bool vaapi = false;
+      AVPixelFormat pixelFormat = AV_PIX_FMT_YUV420P;
+      if (codec->pix_fmts != nullptr)
+      {
+          pixelFormat = codec->pix_fmts[0];
+          for (const AVPixelFormat *format = codec->pix_fmts; *format != AV_PIX_FMT_NONE; format++)
+          {
+              vaapi = vaapi || (*format == AV_PIX_FMT_VAAPI);
+              if (*format == AV_PIX_FMT_YUV420P || (*format == AV_PIX_FMT_NV12 && pixelFormat != AV_PIX_FMT_YUV420P))
+              {
+                  pixelFormat = *format;
+              }
+          }
+      }
+      videoCtx->pix_fmt = pixelFormat;
+      if (vaapi)
+      {
+          HRESULT hr = InitializeHardwareEncoder(codec);
+          if (FAILED(hr))
+          {
+              return hr;
+          }
+      }
+
+      // Software encoders use every core; hardware ones ignore this
+      videoCtx->thread_count = 0;
+      bool software = strncmp(codec->name, "lib", 3) == 0;
+      if (!preset.empty())
+      {
+          av_opt_set(videoCtx->priv_data, "preset", preset.c_str(), 0);
+      }
+      else if (software)
+      {
+          av_opt_set(videoCtx->priv_data, "preset", DefaultSoftwarePreset, 0);
+      }
+
+      int avResult = avcodec_open2(videoCtx, codec, nullptr);
+      if (avResult < 0)
+      {
+          return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+      }
+
+      videoFrame = av_frame_alloc();
+      if (videoFrame == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+      videoFrame->format = vaapi ? AV_PIX_FMT_NV12 : videoCtx->pix_fmt;
+      videoFrame->width = width;
+      videoFrame->height = height;
+      avResult = av_frame_get_buffer(videoFrame, 32);
+      if (avResult < 0)
+      {
+          return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+      }
+      if (vaapi)
+      {
+          hwFrame = av_frame_alloc();
+          if (hwFrame == nullptr)
+          {
+              return E_OUTOFMEMORY;
+          }
+      }
+
+      // Only add the stream once the encoder has opened; streams can't be
+      // taken back out of the file
+      videoStream = avformat_new_stream(formatCtx, nullptr);
+      if (videoStream == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+      videoStream->time_base = videoCtx->time_base;
+      avResult = avcodec_parameters_from_context(videoStream->codecpar, videoCtx);
+      if (avResult < 0)
+      {
+          return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+      }
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // InitializeHardwareEncoder() opens the VAAPI device and the pool of
+  // device frames the encoder takes its input from. We convert to NV12 in
+  // system memory and upload it.
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::InitializeHardwareEncoder(const AVCodec *codec)
+  {
+      int avResult = av_hwdevice_ctx_create(&hwDeviceCtx, AV_HWDEVICE_TYPE_VAAPI, nullptr, nullptr, 0);
+      if (avResult < 0)
+      {
+          hwDeviceCtx = nullptr;
+          return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+      }
+
+      AVBufferRef *framesRef = av_hwframe_ctx_alloc(hwDeviceCtx);
+      if (framesRef == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+      AVHWFramesContext *framesCtx = (AVHWFramesContext*)framesRef->data;
+      framesCtx->format = AV_PIX_FMT_VAAPI;
+      framesCtx->sw_format = AV_PIX_FMT_NV12;
+      framesCtx->width = width;
+      framesCtx->height = height;
+      framesCtx->initial_pool_size = HardwareFramePoolSize;
+      avResult = av_hwframe_ctx_init(framesRef);
+      if (avResult < 0)
+      {
+          av_buffer_unref(&framesRef);
+          return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+      }
+      videoCtx->hw_frames_ctx = framesRef;
+      videoCtx->pix_fmt = AV_PIX_FMT_VAAPI;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // OpenAudioEncoder() opens the AAC encoder, the resampler that converts
+  // our 16-bit input to what it takes, and the FIFO that collects resampled
+  // audio into the encoder's fixed size frames.
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::OpenAudioEncoder()
+  {
+      const AVCodec *codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+      if (codec == nullptr)
+      {
+          return PSIERR_ENCODER_NOT_FOUND;
+      }
+      audioCtx = avcodec_alloc_context3(codec);
+      if (audioCtx == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+
+      int sampleRate = 48000;
+      for (const int *rate = codec->supported_samplerates; rate != nullptr && *rate != 0; rate++)
+      {
+          if (*rate == audioInputSampleRate)
+          {
+              sampleRate = audioInputSampleRate;
+          }
+      }
+      int64_t channelLayout = av_get_default_channel_layout(audioInputChannels);
+      audioCtx->sample_fmt = (codec->sample_fmts != nullptr) ? codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+      audioCtx->sample_rate = sampleRate;
+      audioCtx->channels = audioInputChannels;
+      audioCtx->channel_layout = channelLayout;
+      audioCtx->bit_rate = audioBitrate;
+      audioCtx->time_base.num = 1;
+      audioCtx->time_base.den = sampleRate;
+      if (formatCtx->oformat->flags & AVFMT_GLOBALHEADER)
+      {
+          audioCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+      }
+      int avResult = avcodec_open2(audioCtx, codec, nullptr);
+      if (avResult < 0)
+      {
+          return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+      }
+
+      audioStream = avformat_new_stream(formatCtx, nullptr);
+      if (audioStream == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+      audioStream->time_base = audioCtx->time_base;
+      avResult = avcodec_parameters_from_context(audioStream->codecpar, audioCtx);
+      if (avResult < 0)
+      {
+          return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+      }
+
+      resampleCtx = swr_alloc_set_opts(nullptr,
+          channelLayout, audioCtx->sample_fmt, sampleRate,
+          channelLayout, AV_SAMPLE_FMT_S16, audioInputSampleRate, 0, nullptr);
+      if (resampleCtx == nullptr || swr_init(resampleCtx) < 0)
+      {
+          return E_OUTOFMEMORY;
+      }
+      audioFifo = av_audio_fifo_alloc(audioCtx->sample_fmt, audioInputChannels, audioCtx->frame_size);
+      audioFrame = av_frame_alloc();
+      if (audioFifo == nullptr || audioFrame == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+      audioFrame->nb_samples = audioCtx->frame_size;
+      audioFrame->format = audioCtx->sample_fmt;
+      audioFrame->channel_layout = channelLayout;
+      audioFrame->channels = audioInputChannels;
+      audioFrame->sample_rate = sampleRate;
+      avResult = av_frame_get_buffer(audioFrame, 0);
+      if (avResult < 0)
+      {
+          return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+      }
+      return S_OK;
+  }
+
+  void FFMPEGWriterNative::FreeVideoEncoder()
+  {
+      if (videoCtx != nullptr)
+      {
+          avcodec_free_context(&videoCtx);
+          videoCtx = nullptr;
+      }
+      if (videoFrame != nullptr)
+      {
+          av_frame_free(&videoFrame);
+          videoFrame = nullptr;
+      }
+      if (hwFrame != nullptr)
+      {
+          av_frame_free(&hwFrame);
+          hwFrame = nullptr;
+      }
+      if (hwDeviceCtx != nullptr)
+      {
+          av_buffer_unref(&hwDeviceCtx);
+          hwDeviceCtx = nullptr;
+      }
+      if (convertorCtx != nullptr)
+      {
+          sws_freeContext(convertorCtx);
+          convertorCtx = nullptr;
+      }
+  }
+
+  //**********************************************************************
+  // FreeOutput() frees the encoders and closes the file, whether or not
+  // Open() got as far as writing its header.
+  //**********************************************************************
+  void FFMPEGWriterNative::FreeOutput()
+  {
+      FreeVideoEncoder();
+      if (audioCtx != nullptr)
+      {
+          avcodec_free_context(&audioCtx);
+          audioCtx = nullptr;
+      }
+      if (audioFrame != nullptr)
+      {
+          av_frame_free(&audioFrame);
+          audioFrame = nullptr;
+      }
+      if (resampleCtx != nullptr)
+      {
+          swr_free(&resampleCtx);
+          resampleCtx = nullptr;
+      }
+      if (audioFifo != nullptr)
+      {
+          av_audio_fifo_free(audioFifo);
+          audioFifo = nullptr;
+      }
+      if (resampleBuffer != nullptr)
+      {
+          av_freep(&resampleBuffer[0]);
+          av_freep(&resampleBuffer);
+          resampleBufferSamples = 0;
+      }
+      av_packet_unref(&packet);
+      if (formatCtx != nullptr)
+      {
+          if (formatCtx->pb != nullptr && (formatCtx->oformat->flags & AVFMT_NOFILE) == 0)
+          {
+              avio_closep(&formatCtx->pb);
+          }
+          avformat_free_context(formatCtx);
+          formatCtx = nullptr;
+      }
+      videoStream = nullptr;
+      audioStream = nullptr;
+  }
+
+  //**********************************************************************
+  // TicksToPts() converts a timestamp to a time base, relative to the first
+  // timestamp written. Samples from before it are clamped to 0.
+  //**********************************************************************
+  int64_t FFMPEGWriterNative::TicksToPts(int64_t timestamp, AVRational timeBase)
+  {
+      if (firstTimestamp < 0)
+      {
+          firstTimestamp = timestamp;
+      }
+      int64_t elapsed = timestamp - firstTimestamp;
+      return av_rescale_q((elapsed > 0) ? elapsed : 0, TicksTimeBase, timeBase);
+  }
+
+  //**********************************************************************
+  // WriteVideoFrame() writes an image. With a write queue the image is
+  // copied into a pooled buffer, so the caller can reuse 'data' as soon as
+  // this returns. Returns S_FALSE if the frame was dropped.
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::WriteVideoFrame(int64_t timestamp, const uint8_t *data, int frameWidth, int frameHeight, int stride, int pixelFormat)
+  {
+      if (!opened)
+      {
+          return E_UNEXPECTED;
+      }
+      if (data == nullptr || !IsValidFrameLayout(frameWidth, frameHeight, stride, pixelFormat))
+      {
+          return E_INVALIDARG;
+      }
+      if (encodeQueue == nullptr)
+      {
+          return EncodeVideo(timestamp, data, frameWidth, frameHeight, stride, pixelFormat);
+      }
+
+      EncodeQueueEntry entry;
+      entry.frameType = 0;
+      entry.timestamp = timestamp;
+      entry.buffer = framePool->Acquire(stride * frameHeight);
+      entry.width = frameWidth;
+      entry.height = frameHeight;
+      entry.stride = stride;
+      entry.pixelFormat = pixelFormat;
+      entry.size = stride * frameHeight;
+      if (entry.buffer == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+      memcpy(entry.buffer->data, data, entry.size);
+      return Enqueue(&entry, true);
+  }
+
+  //**********************************************************************
+  // WriteVideoFrameBuffer() writes an image held in a pooled buffer, such
+  // as one returned by FFMPEGReaderNative::ReadFrameBuffer(). The writer
+  // takes its own reference instead of copying the image, so the caller
+  // may release the buffer as soon as this returns.
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::WriteVideoFrameBuffer(int64_t timestamp, FFMPEGFrameBufferNative *buffer, int frameWidth, int frameHeight, int stride, int pixelFormat)
+  {
+      if (!opened)
+      {
+          return E_UNEXPECTED;
+      }
+      if (buffer == nullptr || !IsValidFrameLayout(frameWidth, frameHeight, stride, pixelFormat) || stride * frameHeight > buffer->capacity)
+      {
+          return E_INVALIDARG;
+      }
+      if (encodeQueue == nullptr)
+      {
+          return EncodeVideo(timestamp, buffer->data, frameWidth, frameHeight, stride, pixelFormat);
+      }
+
+      FFMPEGFramePool::AddRef(buffer);
+      EncodeQueueEntry entry;
+      entry.frameType = 0;
+      entry.timestamp = timestamp;
+      entry.buffer = buffer;
+      entry.width = frameWidth;
+      entry.height = frameHeight;
+      entry.stride = stride;
+      entry.pixelFormat = pixelFormat;
+      entry.size = stride * frameHeight;
+      return Enqueue(&entry, true);
+  }
+
+  //**********************************************************************
+  // WriteAudio() writes a block of interleaved 16-bit PCM in the format
+  // given to SetAudio(). 'timestamp' is the time of the first sample. The
+  // audio track is laid down contiguously from the first block's time, as
+  // AAC has no way to express gaps.
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::WriteAudio(int64_t timestamp, const uint8_t *pcmData, int numBytes)
+  {
+      if (!opened || audioCtx == nullptr)
+      {
+          return E_UNEXPECTED;
+      }
+      if (pcmData == nullptr || numBytes < 0)
+      {
+          return E_INVALIDARG;
+      }
+      if (encodeQueue == nullptr)
+      {
+          return EncodeAudio(timestamp, pcmData, numBytes);
+      }
+
+      EncodeQueueEntry entry;
+      entry.frameType = 1;
+      entry.timestamp = timestamp;
+      entry.buffer = framePool->Acquire(numBytes);
+      entry.width = 0;
+      entry.height = 0;
+      entry.stride = 0;
+      entry.pixelFormat = 0;
+      entry.size = numBytes;
+      if (entry.buffer == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+      memcpy(entry.buffer->data, pcmData, numBytes);
+      return Enqueue(&entry, false);
+  }
+
+  //**********************************************************************
+  // EncodeVideo() converts an image to the encoder's format and size,
+  // uploads it if the encoder runs on a device, and encodes it
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::EncodeVideo(int64_t timestamp, const uint8_t *data, int frameWidth, int frameHeight, int stride, int pixelFormat)
+  {
+      // sws_getCachedContext() only rebuilds the scaler if the input changed
+      convertorCtx = sws_getCachedContext(convertorCtx, frameWidth, frameHeight, GetInputPixelFormat(pixelFormat),
+          width, height, (AVPixelFormat)videoFrame->format, SWS_BILINEAR, nullptr, nullptr, nullptr);
+      if (convertorCtx == nullptr)
+      {
+          return E_OUTOFMEMORY;
+      }
+
+      // The encoder may still hold a reference to the previous frame
+      int avResult = av_frame_make_writable(videoFrame);
+      if (avResult < 0)
+      {
+          return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+      }
+      const uint8_t *const srcData[4] = { data, nullptr, nullptr, nullptr };
+      const int srcStride[4] = { stride, 0, 0, 0 };
+      sws_scale(convertorCtx, srcData, srcStride, 0, frameHeight, videoFrame->data, videoFrame->linesize);
+
+      // Encoders need strictly increasing timestamps
+      int64_t pts = TicksToPts(timestamp, videoCtx->time_base);
+      if (lastVideoPts != AV_NOPTS_VALUE && pts <= lastVideoPts)
+      {
+          pts = lastVideoPts + 1;
+      }
+      lastVideoPts = pts;
+      videoFrame->pts = pts;
+
+      AVFrame *frame = videoFrame;
+      if (hwFrame != nullptr)
+      {
+          av_frame_unref(hwFrame);
+          avResult = av_hwframe_get_buffer(videoCtx->hw_frames_ctx, hwFrame, 0);
+          if (avResult >= 0)
+          {
+              avResult = av_hwframe_transfer_data(hwFrame, videoFrame, 0);
+          }
+          if (avResult < 0)
+          {
+              return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+          }
+          hwFrame->pts = pts;
+          frame = hwFrame;
+      }
+      return SendFrame(videoCtx, videoStream, frame);
+  }
+
+  //**********************************************************************
+  // EncodeAudio() resamples a block of PCM into the FIFO and encodes every
+  // full frame's worth. Close() flushes the resampler by passing nullptr.
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::EncodeAudio(int64_t timestamp, const uint8_t *pcmData, int numBytes)
+  {
+      // An empty block is valid input, but handing swr_convert() no samples
+      // would flush the resampler mid-stream
+      int numSamples = numBytes / (2 * audioInputChannels);
+      if (numSamples == 0 && pcmData != nullptr)
+      {
+          return S_OK;
+      }
+
+      if (!audioPtsValid)
+      {
+          AVRational timeBase = { 1, audioCtx->sample_rate };
+          audioPts = TicksToPts(timestamp, timeBase);
+          audioPtsValid = true;
+      }
+
+      int maxSamples = swr_get_out_samples(resampleCtx, numSamples);
+      if (maxSamples > resampleBufferSamples)
+      {
+          if (resampleBuffer != nullptr)
+          {
+              av_freep(&resampleBuffer[0]);
+              av_freep(&resampleBuffer);
+          }
+          resampleBufferSamples = 0;
+          int avResult = av_samples_alloc_array_and_samples(&resampleBuffer, nullptr, audioInputChannels, maxSamples, audioCtx->sample_fmt, 0);
+          if (avResult < 0)
+          {
+              resampleBuffer = nullptr;
+              return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+          }
+          resampleBufferSamples = maxSamples;
+      }
+
+      const uint8_t *input[1] = { pcmData };
+      int converted = swr_convert(resampleCtx, resampleBuffer, resampleBufferSamples, (numSamples > 0) ? input : nullptr, numSamples);
+      if (converted < 0)
+      {
+          return FFMPEGReaderNative::ConvertFFMPEGError(converted);
+      }
+      if (converted > 0 && av_audio_fifo_write(audioFifo, (void**)resampleBuffer, converted) < converted)
+      {
+          return E_OUTOFMEMORY;
+      }
+      return EncodeAudioFrames(false);
+  }
+
+  //**********************************************************************
+  // EncodeAudioFrames() encodes the audio in the FIFO, one encoder frame
+  // at a time. With 'flush' set the last partial frame is padded with
+  // silence and encoded too.
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::EncodeAudioFrames(bool flush)
+  {
+      int frameSize = audioFrame->nb_samples;
+      while (av_audio_fifo_size(audioFifo) >= frameSize || (flush && av_audio_fifo_size(audioFifo) > 0))
+      {
+          int avResult = av_frame_make_writable(audioFrame);
+          if (avResult < 0)
+          {
+              return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+          }
+          int samplesRead = av_audio_fifo_read(audioFifo, (void**)audioFrame->data, frameSize);
+          if (samplesRead < frameSize)
+          {
+              av_samples_set_silence(audioFrame->data, samplesRead, frameSize - samplesRead, audioCtx->channels, audioCtx->sample_fmt);
+          }
+          audioFrame->pts = audioPts;
+          audioPts += frameSize;
+          HRESULT hr = SendFrame(audioCtx, audioStream, audioFrame);
+          if (FAILED(hr))
+          {
+              return hr;
+          }
+      }
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // SendFrame() hands a frame to an encoder (nullptr to flush it) and muxes
+  // every packet the encoder has ready
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::SendFrame(AVCodecContext *codecCtx, AVStream *stream, AVFrame *frame)
+  {
+      int avResult = avcodec_send_frame(codecCtx, frame);
+      if (avResult < 0 && avResult != AVERROR_EOF)
+      {
+          return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+      }
+      for (;;)
+      {
+          avResult = avcodec_receive_packet(codecCtx, &packet);
+          if (avResult == AVERROR(EAGAIN) || avResult == AVERROR_EOF)
+          {
+              return S_OK;
+          }
+          if (avResult < 0)
+          {
+              return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+          }
+          av_packet_rescale_ts(&packet, codecCtx->time_base, stream->time_base);
+          packet.stream_index = stream->index;
+
+          // Takes over the packet's reference, and leaves it blank
+          avResult = av_interleaved_write_frame(formatCtx, &packet);
+          if (avResult < 0)
+          {
+              return FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+          }
+      }
+  }
+
+  HRESULT FFMPEGWriterNative::Encode(EncodeQueueEntry *entry)
+  {
+      if (entry->frameType == 0)
+      {
+          return EncodeVideo(entry->timestamp, entry->buffer->data, entry->width, entry->height, entry->stride, entry->pixelFormat);
+      }
+      return EncodeAudio(entry->timestamp, entry->buffer->data, entry->size);
+  }
+
+  //**********************************************************************
+  // Enqueue() hands an entry (and its buffer reference) to the encode
+  // thread. Returns S_FALSE if the entry was dropped, and the encode
+  // thread's error if it has failed.
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::Enqueue(EncodeQueueEntry *entry, bool droppable)
+  {
+      std::unique_lock<std::mutex> lock(encodeQueue->mutex);
+      if (droppable && dropFramesWhenQueueFull && (int)encodeQueue->entries.size() >= writeQueueSize)
+      {
+          encodeQueue->numFramesDropped++;
+          lock.unlock();
+          FFMPEGFramePool::Release(entry->buffer);
+          return S_FALSE;
+      }
+      encodeQueue->notFull.wait(lock, [this] { return (int)encodeQueue->entries.size() < writeQueueSize || FAILED(encodeQueue->result); });
+      HRESULT hr = encodeQueue->result;
+      if (FAILED(hr))
+      {
+          lock.unlock();
+          FFMPEGFramePool::Release(entry->buffer);
+          return hr;
+      }
+      encodeQueue->entries.push_back(*entry);
+      lock.unlock();
+      encodeQueue->notEmpty.notify_one();
+      return S_OK;
+  }
+
+  HRESULT FFMPEGWriterNative::StartEncodeThread()
+  {
+      encodeQueue = new EncodeQueue();
+      encodeQueue->stopRequested = false;
+      encodeQueue->result = S_OK;
+      encodeQueue->numFramesDropped = 0;
+      encodeQueue->thread = std::thread(&FFMPEGWriterNative::EncodeThreadProc, this);
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // StopEncodeThread() lets the encode thread finish what is queued and
+  // waits for it to exit. Returns the first error it hit.
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::StopEncodeThread()
+  {
+      if (encodeQueue == nullptr)
+      {
+          return S_OK;
+      }
+      {
+          std::lock_guard<std::mutex> lock(encodeQueue->mutex);
+          encodeQueue->stopRequested = true;
+      }
+      encodeQueue->notEmpty.notify_all();
+      if (encodeQueue->thread.joinable())
+      {
+          encodeQueue->thread.join();
+      }
+
+      // Anything left over is there because the thread failed
+      HRESULT hr = encodeQueue->result;
+      for (size_t i = 0; i < encodeQueue->entries.size(); i++)
+      {
+          FFMPEGFramePool::Release(encodeQueue->entries[i].buffer);
+      }
+      delete encodeQueue;
+      encodeQueue = nullptr;
+      return hr;
+  }
+
+  void FFMPEGWriterNative::EncodeThreadProc()
+  {
+      EncodeQueue *queue = encodeQueue;
+      if (!Media::Threading::IsDefaultThreadPolicy(encodeThreadPolicy))
+      {
+          Media::Threading::ApplyThreadPolicy(encodeThreadPolicy);
+      }
+      for (;;)
+      {
+          EncodeQueueEntry entry;
+          {
+              std::unique_lock<std::mutex> lock(queue->mutex);
+              queue->notEmpty.wait(lock, [queue] { return !queue->entries.empty() || queue->stopRequested; });
+              if (queue->entries.empty())
+              {
+                  break;
+              }
+              entry = queue->entries.front();
+              queue->entries.pop_front();
+          }
+          queue->notFull.notify_one();
+
+          HRESULT hr = Encode(&entry);
+          FFMPEGFramePool::Release(entry.buffer);
+          if (FAILED(hr))
+          {
+              // Writers waiting for room get the error instead
+              {
+                  std::lock_guard<std::mutex> lock(queue->mutex);
+                  queue->result = hr;
+              }
+              queue->notFull.notify_all();
+              break;
+          }
+      }
+      Media::Threading::RevertThreadPolicy();
+  }
+
+  int FFMPEGWriterNative::GetQueueDepth()
+  {
+      if (encodeQueue == nullptr)
+      {
+          return 0;
+      }
+      std::lock_guard<std::mutex> lock(encodeQueue->mutex);
+      return (int)encodeQueue->entries.size();
+  }
+
+  int FFMPEGWriterNative::GetNumFramesDropped()
+  {
+      if (encodeQueue == nullptr)
+      {
+          return 0;
+      }
+      std::lock_guard<std::mutex> lock(encodeQueue->mutex);
+      return encodeQueue->numFramesDropped;
+  }
+
+  //**********************************************************************
+  // GetEncoderName() returns the FFMPEG name of the video encoder in use
+  // (e.g. "h264_nvenc"), or the one requested before Open()
+  //**********************************************************************
+  const char *FFMPEGWriterNative::GetEncoderName()
+  {
+      return encoderName.c_str();
+  }
+
+  bool FFMPEGWriterNative::IsHardwareAccelerated()
+  {
+      return videoCtx != nullptr && (hwDeviceCtx != nullptr || encoderName.find("_nvenc") != std::string::npos);
+  }
+
+  //**********************************************************************
+  // Close() encodes whatever is still queued, flushes the encoders and
+  // finishes the file. Returns the first error hit since Open(), but
+  // finishes the file regardless so what was written stays playable.
+  //**********************************************************************
+  HRESULT FFMPEGWriterNative::Close()
+  {
+      if (!opened)
+      {
+          FreeOutput();
+          return S_OK;
+      }
+      opened = false;
+
+      HRESULT hr = StopEncodeThread();
+      if (audioCtx != nullptr)
+      {
+          // Drain the resampler's own delay line, then the FIFO
+          HRESULT audioResult = audioPtsValid ? EncodeAudio(0, nullptr, 0) : S_OK;
+          if (SUCCEEDED(audioResult))
+          {
+              audioResult = EncodeAudioFrames(true);
+          }
+          if (SUCCEEDED(audioResult))
+          {
+              audioResult = SendFrame(audioCtx, audioStream, nullptr);
+          }
+          hr = FAILED(hr) ? hr : audioResult;
+      }
+      HRESULT videoResult = SendFrame(videoCtx, videoStream, nullptr);
+      hr = FAILED(hr) ? hr : videoResult;
+
+      int avResult = av_write_trailer(formatCtx);
+      if (avResult < 0 && SUCCEEDED(hr))
+      {
+          hr = FFMPEGReaderNative::ConvertFFMPEGError(avResult);
+      }
+      FreeOutput();
+      return hr;
+  }
+}}}}}
+#pragma warning(pop)
+#endif // USE_FFMPEG
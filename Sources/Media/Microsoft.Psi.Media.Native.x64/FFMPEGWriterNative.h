@@ -0,0 +1,131 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#ifdef USE_FFMPEG
+
+#include "FFMPEGReaderNative.h"
+#include "ThreadPolicy.h"
+
+#pragma warning(push)
+#pragma warning(disable:4634 4635 4244 4996)
+extern "C" {
+#include <libavutil/audio_fifo.h>
+}
+#pragma warning(pop)
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Native {
+namespace Windows {
+
+  //**********************************************************************
+  // Input pixel formats accepted by FFMPEGWriterNative. NOTE: These must
+  // match Microsoft.Psi.Imaging.PixelFormat.
+  //**********************************************************************
+  static const int FFMPEGWriterPixelFormat_Gray_8bpp = 1;
+  static const int FFMPEGWriterPixelFormat_BGR_24bpp = 3;
+  static const int FFMPEGWriterPixelFormat_BGRX_32bpp = 4;
+  static const int FFMPEGWriterPixelFormat_BGRA_32bpp = 5;
+
+  // State for the encode thread and its queue. Defined in FFMPEGWriterNative.cpp.
+  struct EncodeQueue;
+  struct EncodeQueueEntry;
+
+  //**********************************************************************
+  // FFMPEGWriterNative encodes video (H.264 or HEVC) and, optionally, AAC
+  // audio and muxes them into an MP4, MKV or any other container FFMPEG
+  // picks from the output file name. It is the encoding counterpart of
+  // FFMPEGReaderNative, with the same C ABI conventions.
+  // Video is encoded with the first encoder out of NVENC, VAAPI and the
+  // software encoder (libx264/libx265) that opens, unless one is named
+  // explicitly. With a write queue, frames are converted, encoded and muxed
+  // on a background thread, and the caller only pays for queueing them.
+  // Timestamps are in 100ns ticks; the first one written becomes time 0.
+  //**********************************************************************
+  class __declspec(dllexport) FFMPEGWriterNative
+  {
+      // Software encoders default to this preset when none is given. x264's
+      // own default (medium) can't keep up with 1080p30 on most machines.
+      static const char *DefaultSoftwarePreset;
+
+      // Frames buffered by the hardware frame pool for VAAPI encoders
+      static const int HardwareFramePoolSize = 20;
+
+      AVFormatContext *formatCtx;
+      AVCodecContext *videoCtx;
+      AVStream *videoStream;
+      AVCodecContext *audioCtx;
+      AVStream *audioStream;
+      AVBufferRef *hwDeviceCtx;             /* Hardware device the video encoder runs on (nullptr in software) */
+      AVFrame *videoFrame;                  /* Converted frame handed to the video encoder */
+      AVFrame *hwFrame;                     /* videoFrame uploaded to the hardware device (VAAPI only) */
+      AVFrame *audioFrame;                  /* Frame of AAC encoder input */
+      AVPacket packet;                      /* Encoded packet on its way to the muxer */
+      SwsContext *convertorCtx;             /* Converts input images to the encoder's pixel format */
+      SwrContext *resampleCtx;              /* Converts input PCM to the AAC encoder's sample format, rate and layout */
+      AVAudioFifo *audioFifo;               /* Resampled audio waiting to fill a full encoder frame */
+      uint8_t **resampleBuffer;             /* Planes resampleCtx converts into, on their way to audioFifo */
+      int resampleBufferSamples;            /* Capacity of resampleBuffer in samples */
+      FFMPEGFramePool *framePool;           /* Buffers queued frames and audio are copied into */
+      std::string videoCodecName;           /* "h264" or "hevc" */
+      std::string encoderName;              /* Requested encoder ("auto" = first that opens), then the one in use */
+      std::string preset;                   /* Encoder preset ("" = DefaultSoftwarePreset for software encoders, encoder default otherwise) */
+      int videoBitrate;                     /* Target video bitrate in bits/sec */
+      int gopSize;                          /* Frames from one keyframe to the next (-1 = encoder default) */
+      int bFrames;                          /* B frames between reference frames (-1 = encoder default) */
+      int width;                            /* Encoded frame size (input frames of other sizes are scaled) */
+      int height;
+      AVRational frameRate;
+      bool hasAudio;
+      int audioInputSampleRate;             /* Input PCM is interleaved 16-bit at this rate */
+      int audioInputChannels;
+      int audioBitrate;                     /* AAC bitrate in bits/sec */
+      int64_t firstTimestamp;               /* Timestamp (ticks) that becomes time 0 (-1 until the first sample) */
+      int64_t lastVideoPts;                 /* pts of the last video frame encoded, in videoCtx->time_base */
+      int64_t audioPts;                     /* pts of the next audio frame, in samples at the output rate */
+      bool audioPtsValid;                   /* Set once audioPts is synced to the first audio timestamp */
+      int writeQueueSize;                   /* Entries in the encode queue (0 = encode on the caller's thread) */
+      bool dropFramesWhenQueueFull;         /* If true video frames arriving at a full queue are dropped, otherwise the caller waits */
+      EncodeQueue *encodeQueue;             /* Encode thread and its queue (nullptr when encoding synchronously) */
+      Media::Threading::ThreadPolicy encodeThreadPolicy; /* Scheduling of the encode thread */
+      bool opened;
+
+      HRESULT OpenVideoEncoder(const AVCodec *codec);
+      HRESULT InitializeHardwareEncoder(const AVCodec *codec);
+      HRESULT OpenAudioEncoder();
+      void FreeVideoEncoder();
+      void FreeOutput();
+      int64_t TicksToPts(int64_t timestamp, AVRational timeBase);
+      HRESULT EncodeVideo(int64_t timestamp, const uint8_t *data, int frameWidth, int frameHeight, int stride, int pixelFormat);
+      HRESULT EncodeAudio(int64_t timestamp, const uint8_t *pcmData, int numBytes);
+      HRESULT EncodeAudioFrames(bool flush);
+      HRESULT SendFrame(AVCodecContext *codecCtx, AVStream *stream, AVFrame *frame);
+      HRESULT Encode(EncodeQueueEntry *entry);
+      HRESULT Enqueue(EncodeQueueEntry *entry, bool droppable);
+      HRESULT StartEncodeThread();
+      HRESULT StopEncodeThread();
+      void EncodeThreadProc();
+      static AVPixelFormat GetInputPixelFormat(int pixelFormat);
+      static bool IsValidFrameLayout(int frameWidth, int frameHeight, int stride, int pixelFormat);
+  public:
+      FFMPEGWriterNative();
+      ~FFMPEGWriterNative();
+      HRESULT SetVideoEncoder(const char *codec, const char *encoder, int bitrate, int gopSize, int bFrames, const char *preset);
+      HRESULT SetAudio(int inputSampleRate, int inputChannels, int bitrate);
+      HRESULT SetWriteQueue(int queueSize, bool dropWhenFull);
+      HRESULT SetThreadPolicy(int priority, uint64_t affinityMask);
+      HRESULT Open(const char *filename, int width, int height, int frameRateNum, int frameRateDenom);
+      HRESULT WriteVideoFrame(int64_t timestamp, const uint8_t *data, int frameWidth, int frameHeight, int stride, int pixelFormat);
+      HRESULT WriteVideoFrameBuffer(int64_t timestamp, FFMPEGFrameBufferNative *buffer, int frameWidth, int frameHeight, int stride, int pixelFormat);
+      HRESULT WriteAudio(int64_t timestamp, const uint8_t *pcmData, int numBytes);
+      int GetQueueDepth();
+      int GetNumFramesDropped();
+      const char *GetEncoderName();
+      bool IsHardwareAccelerated();
+      HRESULT Close();
+  };
+}}}}}
+#endif // USE_FFMPEG
@@ -0,0 +1,926 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "stdafx.h"
+#ifdef LINUX
+#include "V4L2CaptureNative.h"
+#include "MediaConversion.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Native {
+namespace Windows {
+
+extern "C" {
+    void *V4L2CaptureNative_Alloc()
+    {
+        return new V4L2CaptureNative();
+    }
+
+    void V4L2CaptureNative_Dealloc(void *obj)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        delete pObj;
+    }
+
+    int V4L2CaptureNative_Open(void *obj, char *device)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->Open(device);
+    }
+
+    int V4L2CaptureNative_Close(void *obj)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->Close();
+    }
+
+    int V4L2CaptureNative_GetFd(void *obj)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->GetFd();
+    }
+
+    int V4L2CaptureNative_GetLastError(void *obj)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->GetLastError();
+    }
+
+    const char *V4L2CaptureNative_GetDriver(void *obj)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->GetDriver();
+    }
+
+    const char *V4L2CaptureNative_GetCard(void *obj)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->GetCard();
+    }
+
+    const char *V4L2CaptureNative_GetBus(void *obj)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->GetBus();
+    }
+
+    int V4L2CaptureNative_EnumerateFormat(void *obj, int index, unsigned int *pixelFormat, unsigned int *flags)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->EnumerateFormat(index, pixelFormat, flags);
+    }
+
+    int V4L2CaptureNative_SetFormat(void *obj, int width, int height, unsigned int pixelFormat)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->SetFormat(width, height, pixelFormat);
+    }
+
+    int V4L2CaptureNative_GetFormat(void *obj, int *width, int *height, unsigned int *pixelFormat, int *stride, int *imageSize)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->GetFormat(width, height, pixelFormat, stride, imageSize);
+    }
+
+    int V4L2CaptureNative_SetFrameRate(void *obj, int numerator, int denominator)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->SetFrameRate(numerator, denominator);
+    }
+
+    int V4L2CaptureNative_SetThreadPolicy(void *obj, int priority, uint64_t affinityMask)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->SetThreadPolicy(priority, affinityMask);
+    }
+
+    int V4L2CaptureNative_Start(void *obj, int bufferCount, int exportDmabuf)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->Start(bufferCount, exportDmabuf != 0);
+    }
+
+    int V4L2CaptureNative_Stop(void *obj)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->Stop();
+    }
+
+    int V4L2CaptureNative_AcquireFrame(void *obj, int timeoutMs, V4L2FrameNative *frame, bool *acquired)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->AcquireFrame(timeoutMs, frame, acquired);
+    }
+
+    int V4L2CaptureNative_ReleaseFrame(void *obj, int index)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->ReleaseFrame(index);
+    }
+
+    int V4L2CaptureNative_ConvertFrame(void *obj, V4L2FrameNative *frame, void *output, int outputStride, int outputSize)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->ConvertFrame(frame, (uint8_t*)output, outputStride, outputSize);
+    }
+
+    int V4L2CaptureNative_ReadFrame(void *obj, int timeoutMs, void *output, int outputStride, int outputSize, V4L2FrameNative *frame, bool *frameRead)
+    {
+        V4L2CaptureNative *pObj = (V4L2CaptureNative*)obj;
+        return pObj->ReadFrame(timeoutMs, (uint8_t*)output, outputStride, outputSize, frame, frameRead);
+    }
+
+    void *V4L2CapturePollerNative_Alloc()
+    {
+        return new V4L2CapturePollerNative();
+    }
+
+    void V4L2CapturePollerNative_Dealloc(void *obj)
+    {
+        V4L2CapturePollerNative *pObj = (V4L2CapturePollerNative*)obj;
+        delete pObj;
+    }
+
+    int V4L2CapturePollerNative_Add(void *obj, void *capture, int tag)
+    {
+        V4L2CapturePollerNative *pObj = (V4L2CapturePollerNative*)obj;
+        return pObj->Add((V4L2CaptureNative*)capture, tag);
+    }
+
+    int V4L2CapturePollerNative_Remove(void *obj, void *capture)
+    {
+        V4L2CapturePollerNative *pObj = (V4L2CapturePollerNative*)obj;
+        return pObj->Remove((V4L2CaptureNative*)capture);
+    }
+
+    int V4L2CapturePollerNative_Wait(void *obj, int timeoutMs, int *tags, int maxTags, int *count)
+    {
+        V4L2CapturePollerNative *pObj = (V4L2CapturePollerNative*)obj;
+        return pObj->Wait(timeoutMs, tags, maxTags, count);
+    }
+}
+
+  V4L2CaptureNative::V4L2CaptureNative() :
+      fd(-1),
+      epollFd(-1),
+      lastError(0),
+      width(0),
+      height(0),
+      stride(0),
+      imageSize(0),
+      pixelFormat(0),
+      streaming(false)
+#ifdef USE_FFMPEG
+      , mjpegCtx(nullptr),
+      decodedFrame(nullptr),
+      convertorCtx(nullptr)
+#endif
+  {
+      threadPolicy = Media::Threading::MakeThreadPolicy(Media::Threading::ThreadPriority_Normal, Media::Threading::ThreadTask_Capture, 0);
+  }
+
+  V4L2CaptureNative::~V4L2CaptureNative()
+  {
+      Close();
+  }
+
+  //**********************************************************************
+  // ioctl(), retried when a signal interrupts it
+  //**********************************************************************
+  int V4L2CaptureNative::Ioctl(unsigned long request, void *arg)
+  {
+      int result;
+      do
+      {
+          result = ioctl(fd, request, arg);
+      } while (result == -1 && errno == EINTR);
+      return result;
+  }
+
+  //**********************************************************************
+  // Records errno for GetLastError() and returns the failure
+  //**********************************************************************
+  HRESULT V4L2CaptureNative::Fail()
+  {
+      lastError = errno;
+      return E_FAIL;
+  }
+
+  HRESULT V4L2CaptureNative::Open(const char *device)
+  {
+      if (fd != -1)
+      {
+          return E_UNEXPECTED;
+      }
+
+      // Non-blocking, so VIDIOC_DQBUF returns EAGAIN and we wait in epoll instead
+      fd = open(device, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+      if (fd == -1)
+      {
+          return Fail();
+      }
+
+      v4l2_capability caps;
+      memset(&caps, 0, sizeof(caps));
+      if (Ioctl(VIDIOC_QUERYCAP, &caps) == -1)
+      {
+          HRESULT hr = Fail();
+          Close();
+          return hr;
+      }
+
+      unsigned int deviceCaps = (caps.capabilities & V4L2_CAP_DEVICE_CAPS) ? caps.device_caps : caps.capabilities;
+      if (!(deviceCaps & V4L2_CAP_VIDEO_CAPTURE) || !(deviceCaps & V4L2_CAP_STREAMING))
+      {
+          Close();
+          lastError = ENODEV;
+          return E_INVALIDARG;
+      }
+      driver = (const char*)caps.driver;
+      card = (const char*)caps.card;
+      bus = (const char*)caps.bus_info;
+
+      epollFd = epoll_create1(EPOLL_CLOEXEC);
+      epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      if (epollFd == -1 || epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+      {
+          HRESULT hr = Fail();
+          Close();
+          return hr;
+      }
+
+      return GetFormat(nullptr, nullptr, nullptr, nullptr, nullptr);
+  }
+
+  HRESULT V4L2CaptureNative::Close()
+  {
+      Stop();
+      if (epollFd != -1)
+      {
+          close(epollFd);
+          epollFd = -1;
+      }
+      if (fd != -1)
+      {
+          close(fd);
+          fd = -1;
+      }
+#ifdef USE_FFMPEG
+      if (mjpegCtx != nullptr)
+      {
+          avcodec_free_context(&mjpegCtx);
+      }
+      if (decodedFrame != nullptr)
+      {
+          av_frame_free(&decodedFrame);
+      }
+      if (convertorCtx != nullptr)
+      {
+          sws_freeContext(convertorCtx);
+          convertorCtx = nullptr;
+      }
+#endif
+      return S_OK;
+  }
+
+  int V4L2CaptureNative::GetFd()
+  {
+      return fd;
+  }
+
+  int V4L2CaptureNative::GetLastError()
+  {
+      return lastError;
+  }
+
+  const char *V4L2CaptureNative::GetDriver()
+  {
+      return driver.c_str();
+  }
+
+  const char *V4L2CaptureNative::GetCard()
+  {
+      return card.c_str();
+  }
+
+  const char *V4L2CaptureNative::GetBus()
+  {
+      return bus.c_str();
+  }
+
+  //**********************************************************************
+  // Returns S_FALSE once 'index' is past the last format the device has
+  //**********************************************************************
+  HRESULT V4L2CaptureNative::EnumerateFormat(int index, unsigned int *pixelFormat, unsigned int *flags)
+  {
+      v4l2_fmtdesc desc;
+      memset(&desc, 0, sizeof(desc));
+      desc.index = index;
+      desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      if (Ioctl(VIDIOC_ENUM_FMT, &desc) == -1)
+      {
+          return (errno == EINVAL) ? S_FALSE : Fail();
+      }
+      *pixelFormat = desc.pixelformat;
+      *flags = desc.flags;
+      return S_OK;
+  }
+
+  HRESULT V4L2CaptureNative::SetFormat(int width, int height, unsigned int pixelFormat)
+  {
+      if (streaming)
+      {
+          return E_UNEXPECTED;
+      }
+
+      v4l2_format format;
+      memset(&format, 0, sizeof(format));
+      format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      format.fmt.pix.width = width;
+      format.fmt.pix.height = height;
+      format.fmt.pix.pixelformat = pixelFormat;
+      format.fmt.pix.field = V4L2_FIELD_NONE;
+      if (Ioctl(VIDIOC_S_FMT, &format) == -1)
+      {
+          return Fail();
+      }
+
+      // The driver may have picked the nearest format it supports
+      return GetFormat(nullptr, nullptr, nullptr, nullptr, nullptr);
+  }
+
+  HRESULT V4L2CaptureNative::GetFormat(int *width, int *height, unsigned int *pixelFormat, int *stride, int *imageSize)
+  {
+      v4l2_format format;
+      memset(&format, 0, sizeof(format));
+      format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      if (Ioctl(VIDIOC_G_FMT, &format) == -1)
+      {
+          return Fail();
+      }
+
+      this->width = format.fmt.pix.width;
+      this->height = format.fmt.pix.height;
+      this->pixelFormat = format.fmt.pix.pixelformat;
+      this->stride = format.fmt.pix.bytesperline;
+      this->imageSize = format.fmt.pix.sizeimage;
+      if (width != nullptr) *width = this->width;
+      if (height != nullptr) *height = this->height;
+      if (pixelFormat != nullptr) *pixelFormat = this->pixelFormat;
+      if (stride != nullptr) *stride = this->stride;
+      if (imageSize != nullptr) *imageSize = this->imageSize;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // Requests numerator/denominator frames per second. Returns S_FALSE if
+  // the driver doesn't let us pick the frame rate.
+  //**********************************************************************
+  HRESULT V4L2CaptureNative::SetFrameRate(int numerator, int denominator)
+  {
+      if (numerator <= 0 || denominator <= 0)
+      {
+          return E_INVALIDARG;
+      }
+
+      v4l2_streamparm parm;
+      memset(&parm, 0, sizeof(parm));
+      parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      if (Ioctl(VIDIOC_G_PARM, &parm) == -1)
+      {
+          return Fail();
+      }
+      if (!(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
+      {
+          return S_FALSE;
+      }
+
+      parm.parm.capture.timeperframe.numerator = denominator;
+      parm.parm.capture.timeperframe.denominator = numerator;
+      if (Ioctl(VIDIOC_S_PARM, &parm) == -1)
+      {
+          return Fail();
+      }
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // Sets the scheduling of the thread capturing from the device (see
+  // ThreadPolicy.h). It is applied to whichever thread calls AcquireFrame()
+  // or ReadFrame(), the first time it does. Priority is a
+  // System.Threading.ThreadPriority value; bit n of 'affinityMask' lets the
+  // thread run on CPU n (0 for any).
+  //**********************************************************************
+  HRESULT V4L2CaptureNative::SetThreadPolicy(int priority, uint64_t affinityMask)
+  {
+      if (priority < Media::Threading::ThreadPriority_Lowest || priority > Media::Threading::ThreadPriority_Highest)
+      {
+          return E_INVALIDARG;
+      }
+      threadPolicy = Media::Threading::MakeThreadPolicy(priority, Media::Threading::ThreadTask_Capture, affinityMask);
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // Maps 'bufferCount' driver buffers (the driver may adjust the number),
+  // queues them all and starts streaming. With 'exportDmabuf' each buffer
+  // also gets a DMABUF descriptor, where the driver supports VIDIOC_EXPBUF
+  // (otherwise frames report -1).
+  //**********************************************************************
+  HRESULT V4L2CaptureNative::Start(int bufferCount, bool exportDmabuf)
+  {
+      if (fd == -1)
+      {
+          return E_UNEXPECTED;
+      }
+      if (streaming)
+      {
+          return S_OK;
+      }
+      if (bufferCount < 1)
+      {
+          return E_INVALIDARG;
+      }
+
+      v4l2_requestbuffers request;
+      memset(&request, 0, sizeof(request));
+      request.count = bufferCount;
+      request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      request.memory = V4L2_MEMORY_MMAP;
+      if (Ioctl(VIDIOC_REQBUFS, &request) == -1)
+      {
+          return Fail();
+      }
+      if (request.count == 0)
+      {
+          lastError = ENOMEM;
+          return E_OUTOFMEMORY;
+      }
+
+      HRESULT hr = S_OK;
+      buffers.resize(request.count);
+      for (unsigned int i = 0; i < request.count; i++)
+      {
+          buffers[i].start = MAP_FAILED;
+          buffers[i].length = 0;
+          buffers[i].dmabufFd = -1;
+      }
+
+      for (unsigned int i = 0; i < request.count && SUCCEEDED(hr); i++)
+      {
+          v4l2_buffer buffer;
+          memset(&buffer, 0, sizeof(buffer));
+          buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+          buffer.memory = V4L2_MEMORY_MMAP;
+          buffer.index = i;
+          if (Ioctl(VIDIOC_QUERYBUF, &buffer) == -1)
+          {
+              hr = Fail();
+              break;
+          }
+
+          buffers[i].start = mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffer.m.offset);
+          if (buffers[i].start == MAP_FAILED)
+          {
+              hr = Fail();
+              break;
+          }
+          buffers[i].length = buffer.length;
+
+          if (exportDmabuf)
+          {
+              v4l2_exportbuffer exportBuffer;
+              memset(&exportBuffer, 0, sizeof(exportBuffer));
+              exportBuffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+              exportBuffer.index = i;
+              exportBuffer.flags = O_RDONLY | O_CLOEXEC;
+              if (Ioctl(VIDIOC_EXPBUF, &exportBuffer) == 0)
+              {
+                  buffers[i].dmabufFd = exportBuffer.fd;
+              }
+          }
+
+          if (Ioctl(VIDIOC_QBUF, &buffer) == -1)
+          {
+              hr = Fail();
+          }
+      }
+
+      int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      if (SUCCEEDED(hr) && Ioctl(VIDIOC_STREAMON, &type) == -1)
+      {
+          hr = Fail();
+      }
+
+      if (FAILED(hr))
+      {
+          FreeBuffers();
+          return hr;
+      }
+      streaming = true;
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // Stops streaming and unmaps the buffers. Frames still acquired are no
+  // longer valid afterwards.
+  //**********************************************************************
+  HRESULT V4L2CaptureNative::Stop()
+  {
+      if (!streaming)
+      {
+          return S_OK;
+      }
+
+      int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      Ioctl(VIDIOC_STREAMOFF, &type);
+      streaming = false;
+      FreeBuffers();
+      return S_OK;
+  }
+
+  void V4L2CaptureNative::FreeBuffers()
+  {
+      for (size_t i = 0; i < buffers.size(); i++)
+      {
+          if (buffers[i].dmabufFd != -1)
+          {
+              close(buffers[i].dmabufFd);
+          }
+          if (buffers[i].start != MAP_FAILED)
+          {
+              munmap(buffers[i].start, buffers[i].length);
+          }
+      }
+      buffers.clear();
+
+      // Releases the driver's buffers
+      v4l2_requestbuffers request;
+      memset(&request, 0, sizeof(request));
+      request.count = 0;
+      request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      request.memory = V4L2_MEMORY_MMAP;
+      Ioctl(VIDIOC_REQBUFS, &request);
+  }
+
+  //**********************************************************************
+  // Dequeues the next frame, waiting up to 'timeoutMs' (-1 for ever) for
+  // one. Frames the driver flags as corrupt are requeued and skipped. The
+  // frame must be handed back with ReleaseFrame(); the driver drops frames
+  // once all of its buffers are out.
+  //**********************************************************************
+  HRESULT V4L2CaptureNative::AcquireFrame(int timeoutMs, V4L2FrameNative *frame, bool *acquired)
+  {
+      if (frame == nullptr || acquired == nullptr)
+      {
+          return E_INVALIDARG;
+      }
+      *acquired = false;
+      if (!streaming)
+      {
+          return E_UNEXPECTED;
+      }
+      if (!Media::Threading::IsDefaultThreadPolicy(threadPolicy))
+      {
+          Media::Threading::ApplyThreadPolicy(threadPolicy);
+      }
+
+      for (int attempt = 0; attempt < 2; attempt++)
+      {
+          v4l2_buffer buffer;
+          memset(&buffer, 0, sizeof(buffer));
+          buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+          buffer.memory = V4L2_MEMORY_MMAP;
+          if (Ioctl(VIDIOC_DQBUF, &buffer) == 0)
+          {
+              if (buffer.flags & V4L2_BUF_FLAG_ERROR)
+              {
+                  Ioctl(VIDIOC_QBUF, &buffer);
+                  return S_OK;
+              }
+
+              frame->index = buffer.index;
+              frame->bytesUsed = buffer.bytesused;
+              frame->timestampMicrosecs = (long long)buffer.timestamp.tv_sec * 1000000 + buffer.timestamp.tv_usec;
+              frame->sequence = buffer.sequence;
+              frame->dmabufFd = buffers[buffer.index].dmabufFd;
+              frame->data = buffers[buffer.index].start;
+              *acquired = true;
+              return S_OK;
+          }
+          if (errno != EAGAIN)
+          {
+              return Fail();
+          }
+          if (attempt > 0)
+          {
+              break;
+          }
+
+          epoll_event event;
+          int ready = epoll_wait(epollFd, &event, 1, timeoutMs);
+          if (ready == -1 && errno != EINTR)
+          {
+              return Fail();
+          }
+          if (ready <= 0)
+          {
+              break;
+          }
+      }
+      return S_OK;
+  }
+
+  HRESULT V4L2CaptureNative::ReleaseFrame(int index)
+  {
+      if (!streaming || index < 0 || index >= (int)buffers.size())
+      {
+          return E_INVALIDARG;
+      }
+
+      v4l2_buffer buffer;
+      memset(&buffer, 0, sizeof(buffer));
+      buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      buffer.memory = V4L2_MEMORY_MMAP;
+      buffer.index = index;
+      if (Ioctl(VIDIOC_QBUF, &buffer) == -1)
+      {
+          return Fail();
+      }
+      return S_OK;
+  }
+
+  //**********************************************************************
+  // Converts a frame to BGR24 in 'output', whose rows are 'outputStride'
+  // bytes apart. YUYV, UYVY, RGB24 and BGR24 are converted directly with
+  // the shared conversion kernels; MJPEG frames are decoded first. The
+  // frame must be one AcquireFrame() returned that hasn't been released;
+  // its data is read from our own mapping of the driver buffer, so a
+  // stale or made up frame can't point us outside of it.
+  //**********************************************************************
+  HRESULT V4L2CaptureNative::ConvertFrame(const V4L2FrameNative *frame, uint8_t *output, int outputStride, int outputSize)
+  {
+      if (frame == nullptr || output == nullptr || outputStride < width * 3 || outputSize < outputStride * height)
+      {
+          return E_INVALIDARG;
+      }
+      if (!streaming || frame->index < 0 || frame->index >= (int)buffers.size() ||
+          frame->bytesUsed < 0 || (size_t)frame->bytesUsed > buffers[frame->index].length)
+      {
+          return E_INVALIDARG;
+      }
+
+      int bytesPerPixel;
+      switch (pixelFormat)
+      {
+      case V4L2_PIX_FMT_YUYV:
+      case V4L2_PIX_FMT_UYVY:
+          bytesPerPixel = 2;
+          break;
+      case V4L2_PIX_FMT_RGB24:
+      case V4L2_PIX_FMT_BGR24:
+          bytesPerPixel = 3;
+          break;
+      case V4L2_PIX_FMT_MJPEG:
+      case V4L2_PIX_FMT_JPEG:
+      {
+#ifdef USE_FFMPEG
+          HRESULT hr = DecodeMJPEG(frame);
+          if (FAILED(hr))
+          {
+              return hr;
+          }
+          if (decodedFrame->width != width || decodedFrame->height != height)
+          {
+              lastError = EBADMSG;
+              return E_FAIL;
+          }
+          return ConvertToBGR24(decodedFrame->data, decodedFrame->linesize, (AVPixelFormat)decodedFrame->format, width, height, output, outputStride);
+#else
+          lastError = ENOTSUP;
+          return E_INVALIDARG;
+#endif
+      }
+      default:
+          lastError = ENOTSUP;
+          return E_INVALIDARG;
+      }
+
+      int rowBytes = width * bytesPerPixel;
+      int sourceStride = (stride > 0) ? stride : rowBytes;
+      if (frame->bytesUsed < sourceStride * (height - 1) + rowBytes)
+      {
+          lastError = EBADMSG;
+          return E_FAIL;
+      }
+
+      const uint8_t *data = (const uint8_t*)buffers[frame->index].start;
+      switch (pixelFormat)
+      {
+      case V4L2_PIX_FMT_YUYV:
+          Conversion::ConvertYUY2ToBGR24(data, sourceStride, output, outputStride, width, height);
+          break;
+      case V4L2_PIX_FMT_UYVY:
+          Conversion::ConvertUYVYToBGR24(data, sourceStride, output, outputStride, width, height);
+          break;
+      case V4L2_PIX_FMT_RGB24:
+          Conversion::ConvertRGB24ToBGR24(data, sourceStride, output, outputStride, width, height);
+          break;
+      default:
+          Conversion::CopyRows(data, sourceStride, output, outputStride, rowBytes, height);
+          break;
+      }
+      return S_OK;
+  }
+
+#ifdef USE_FFMPEG
+  HRESULT V4L2CaptureNative::DecodeMJPEG(const V4L2FrameNative *frame)
+  {
+      if (mjpegCtx == nullptr)
+      {
+          AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+          if (codec == nullptr)
+          {
+              lastError = ENOTSUP;
+              return E_FAIL;
+          }
+          mjpegCtx = avcodec_alloc_context3(codec);
+          decodedFrame = av_frame_alloc();
+          // Both are freed (and nulled) on failure, so the next frame tries again from scratch
+          if (mjpegCtx == nullptr || decodedFrame == nullptr)
+          {
+              avcodec_free_context(&mjpegCtx);
+              av_frame_free(&decodedFrame);
+              lastError = ENOMEM;
+              return E_OUTOFMEMORY;
+          }
+          if (avcodec_open2(mjpegCtx, codec, nullptr) < 0)
+          {
+              avcodec_free_context(&mjpegCtx);
+              av_frame_free(&decodedFrame);
+              lastError = ENOTSUP;
+              return E_FAIL;
+          }
+      }
+
+      // The decoder may read up to AV_INPUT_BUFFER_PADDING_SIZE bytes past the end of the data;
+      // driver buffers are sized for the largest frame, so compressed frames nearly always leave room
+      AVPacket packet;
+      av_init_packet(&packet);
+      const uint8_t *data = (const uint8_t*)buffers[frame->index].start;
+      packet.data = (uint8_t*)data;
+      packet.size = frame->bytesUsed;
+      std::vector<uint8_t> padded;
+      if ((size_t)frame->bytesUsed + AV_INPUT_BUFFER_PADDING_SIZE > buffers[frame->index].length)
+      {
+          padded.resize(frame->bytesUsed + AV_INPUT_BUFFER_PADDING_SIZE);
+          memcpy(&padded[0], data, frame->bytesUsed);
+          memset(&padded[frame->bytesUsed], 0, AV_INPUT_BUFFER_PADDING_SIZE);
+          packet.data = &padded[0];
+      }
+
+      int gotFrame = 0;
+      if (avcodec_decode_video2(mjpegCtx, decodedFrame, &gotFrame, &packet) < 0 || !gotFrame)
+      {
+          lastError = EBADMSG;
+          return E_FAIL;
+      }
+      return S_OK;
+  }
+
+  HRESULT V4L2CaptureNative::ConvertToBGR24(const uint8_t *const *planes, const int *strides, AVPixelFormat format, int frameWidth, int frameHeight, uint8_t *output, int outputStride)
+  {
+      // The JPEG decoder reports the deprecated full range formats; convert from their
+      // limited range equivalents and tell swscale the source is full range instead
+      bool fullRange = true;
+      switch (format)
+      {
+      case AV_PIX_FMT_YUVJ420P: format = AV_PIX_FMT_YUV420P; break;
+      case AV_PIX_FMT_YUVJ422P: format = AV_PIX_FMT_YUV422P; break;
+      case AV_PIX_FMT_YUVJ444P: format = AV_PIX_FMT_YUV444P; break;
+      case AV_PIX_FMT_YUVJ440P: format = AV_PIX_FMT_YUV440P; break;
+      default: fullRange = false; break;
+      }
+
+      // sws_getCachedContext() frees the old context if it can't be reused
+      convertorCtx = sws_getCachedContext(convertorCtx, frameWidth, frameHeight, format,
+          frameWidth, frameHeight, AV_PIX_FMT_BGR24, SWS_POINT, nullptr, nullptr, nullptr);
+      if (convertorCtx == nullptr)
+      {
+          lastError = ENOTSUP;
+          return E_FAIL;
+      }
+      if (fullRange)
+      {
+          const int *coefficients = sws_getCoefficients(SWS_CS_ITU601);
+          sws_setColorspaceDetails(convertorCtx, coefficients, 1, coefficients, 1, 0, 1 << 16, 1 << 16);
+      }
+
+      uint8_t *outputPlanes[4] = { output, nullptr, nullptr, nullptr };
+      int outputStrides[4] = { outputStride, 0, 0, 0 };
+      sws_scale(convertorCtx, planes, strides, 0, frameHeight, outputPlanes, outputStrides);
+      return S_OK;
+  }
+#endif
+
+  //**********************************************************************
+  // Acquires a frame, converts it to BGR24 and releases it again, so a
+  // frame costs one call across the managed/native boundary
+  //**********************************************************************
+  HRESULT V4L2CaptureNative::ReadFrame(int timeoutMs, uint8_t *output, int outputStride, int outputSize, V4L2FrameNative *frame, bool *frameRead)
+  {
+      HRESULT hr = AcquireFrame(timeoutMs, frame, frameRead);
+      if (FAILED(hr) || !*frameRead)
+      {
+          return hr;
+      }
+
+      hr = ConvertFrame(frame, output, outputStride, outputSize);
+      ReleaseFrame(frame->index);
+      frame->data = nullptr;
+      if (FAILED(hr))
+      {
+          *frameRead = false;
+      }
+      return hr;
+  }
+
+  V4L2CapturePollerNative::V4L2CapturePollerNative()
+  {
+      epollFd = epoll_create1(EPOLL_CLOEXEC);
+  }
+
+  V4L2CapturePollerNative::~V4L2CapturePollerNative()
+  {
+      if (epollFd != -1)
+      {
+          close(epollFd);
+      }
+  }
+
+  HRESULT V4L2CapturePollerNative::Add(V4L2CaptureNative *capture, int tag)
+  {
+      if (epollFd == -1 || capture == nullptr || capture->GetFd() == -1)
+      {
+          return E_INVALIDARG;
+      }
+
+      epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.u32 = (uint32_t)tag;
+      return (epoll_ctl(epollFd, EPOLL_CTL_ADD, capture->GetFd(), &event) == 0) ? S_OK : E_FAIL;
+  }
+
+  HRESULT V4L2CapturePollerNative::Remove(V4L2CaptureNative *capture)
+  {
+      if (epollFd == -1 || capture == nullptr || capture->GetFd() == -1)
+      {
+          return E_INVALIDARG;
+      }
+
+      epoll_event event;
+      memset(&event, 0, sizeof(event));
+      return (epoll_ctl(epollFd, EPOLL_CTL_DEL, capture->GetFd(), &event) == 0) ? S_OK : E_FAIL;
+  }
+
+  //**********************************************************************
+  // Waits up to 'timeoutMs' (-1 for ever) for any of the devices to have a
+  // frame, returning the tags of at most 'maxTags' that do in 'tags'
+  //**********************************************************************
+  HRESULT V4L2CapturePollerNative::Wait(int timeoutMs, int *tags, int maxTags, int *count)
+  {
+      if (epollFd == -1 || tags == nullptr || count == nullptr || maxTags < 1)
+      {
+          return E_INVALIDARG;
+      }
+      *count = 0;
+
+      const int MaxEvents = 64;
+      epoll_event events[MaxEvents];
+      int ready = epoll_wait(epollFd, events, (maxTags < MaxEvents) ? maxTags : MaxEvents, timeoutMs);
+      if (ready == -1)
+      {
+          return (errno == EINTR) ? S_OK : E_FAIL;
+      }
+      for (int i = 0; i < ready; i++)
+      {
+          tags[i] = (int)events[i].data.u32;
+      }
+      *count = ready;
+      return S_OK;
+  }
+}}}}}
+#endif // LINUX
@@ -0,0 +1,139 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#ifdef LINUX
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "ThreadPolicy.h"
+
+#ifdef USE_FFMPEG
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+// Same definitions as FFMPEGReaderNative.h, which not every user of this header includes
+#define HRESULT int
+#define S_OK 0
+#define S_FALSE 1
+#define E_FAIL -100
+#define E_OUTOFMEMORY -101
+#define E_UNEXPECTED -102
+#define E_INVALIDARG -103
+#define SUCCEEDED(hr) ((hr) >= 0)
+#define FAILED(hr) ((hr) < 0)
+
+namespace Microsoft {
+namespace Psi {
+namespace Media {
+namespace Native {
+namespace Windows {
+
+  //**********************************************************************
+  // Describes a frame returned by V4L2CaptureNative::AcquireFrame(). The
+  // data is the driver's memory mapped buffer, which stays valid (and out
+  // of the driver's hands) until the frame is passed to ReleaseFrame().
+  // Shared with the managed wrappers, so the layout must not change.
+  //**********************************************************************
+  struct V4L2FrameNative
+  {
+      int index;                      /* Driver buffer index, passed back to ReleaseFrame() */
+      int bytesUsed;                  /* Number of bytes of frame data */
+      long long timestampMicrosecs;   /* Driver timestamp (CLOCK_MONOTONIC for most drivers) */
+      unsigned int sequence;          /* Driver frame counter; gaps mean dropped frames */
+      int dmabufFd;                   /* DMABUF file descriptor exported for the buffer, or -1 */
+      void *data;                     /* Start of the frame data */
+  };
+
+  //**********************************************************************
+  // V4L2CaptureNative captures from one V4L2 device with streaming I/O: a
+  // ring of memory mapped driver buffers that frames are dequeued from and
+  // requeued to, so frame data is never copied by the engine itself. Each
+  // buffer can optionally be exported as a DMABUF for zero-copy hand off to
+  // encoders or GPUs. Waits use epoll, so they time out instead of blocking
+  // in VIDIOC_DQBUF, and devices can be waited on together with
+  // V4L2CapturePollerNative. ReadFrame() dequeues a frame, converts YUYV or
+  // MJPEG to BGR24 and requeues it in one call. Not thread safe, except that
+  // ReleaseFrame() may be called from any thread.
+  //**********************************************************************
+  class V4L2CaptureNative
+  {
+      struct MappedBuffer
+      {
+          void *start;
+          size_t length;
+          int dmabufFd;               /* -1 unless exported */
+      };
+
+      int fd;                         /* Device file descriptor (-1 when closed) */
+      int epollFd;                    /* Waits for this device alone in AcquireFrame() */
+      int lastError;                  /* errno of the last failed system call */
+      std::string driver;
+      std::string card;
+      std::string bus;
+      int width;
+      int height;
+      int stride;                     /* Bytes per row of uncompressed formats */
+      int imageSize;                  /* Largest frame the driver will produce */
+      unsigned int pixelFormat;       /* V4L2_PIX_FMT_* fourcc */
+      std::vector<MappedBuffer> buffers;
+      bool streaming;
+      Media::Threading::ThreadPolicy threadPolicy; /* Applied to the thread calling AcquireFrame() */
+#ifdef USE_FFMPEG
+      AVCodecContext *mjpegCtx;       /* Created on the first MJPEG frame */
+      AVFrame *decodedFrame;
+      SwsContext *convertorCtx;       /* Cached converter to BGR24 */
+#endif
+
+      int Ioctl(unsigned long request, void *arg);
+      HRESULT Fail();
+      void FreeBuffers();
+#ifdef USE_FFMPEG
+      HRESULT DecodeMJPEG(const V4L2FrameNative *frame);
+      HRESULT ConvertToBGR24(const uint8_t *const *planes, const int *strides, AVPixelFormat format, int frameWidth, int frameHeight, uint8_t *output, int outputStride);
+#endif
+  public:
+      V4L2CaptureNative();
+      ~V4L2CaptureNative();
+      HRESULT Open(const char *device);
+      HRESULT Close();
+      int GetFd();
+      int GetLastError();
+      const char *GetDriver();
+      const char *GetCard();
+      const char *GetBus();
+      HRESULT EnumerateFormat(int index, unsigned int *pixelFormat, unsigned int *flags);
+      HRESULT SetFormat(int width, int height, unsigned int pixelFormat);
+      HRESULT GetFormat(int *width, int *height, unsigned int *pixelFormat, int *stride, int *imageSize);
+      HRESULT SetFrameRate(int numerator, int denominator);
+      HRESULT SetThreadPolicy(int priority, uint64_t affinityMask);
+      HRESULT Start(int bufferCount, bool exportDmabuf);
+      HRESULT Stop();
+      HRESULT AcquireFrame(int timeoutMs, V4L2FrameNative *frame, bool *acquired);
+      HRESULT ReleaseFrame(int index);
+      HRESULT ConvertFrame(const V4L2FrameNative *frame, uint8_t *output, int outputStride, int outputSize);
+      HRESULT ReadFrame(int timeoutMs, uint8_t *output, int outputStride, int outputSize, V4L2FrameNative *frame, bool *frameRead);
+  };
+
+  //**********************************************************************
+  // V4L2CapturePollerNative waits on several capture devices at once from
+  // a single thread. Devices are added with a caller chosen tag, and Wait()
+  // returns the tags of those that have a frame ready to acquire.
+  //**********************************************************************
+  class V4L2CapturePollerNative
+  {
+      int epollFd;
+  public:
+      V4L2CapturePollerNative();
+      ~V4L2CapturePollerNative();
+      HRESULT Add(V4L2CaptureNative *capture, int tag);
+      HRESULT Remove(V4L2CaptureNative *capture);
+      HRESULT Wait(int timeoutMs, int *tags, int maxTags, int *count);
+  };
+}}}}}
+#endif // LINUX
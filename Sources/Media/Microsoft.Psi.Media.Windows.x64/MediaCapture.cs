@@ -194,6 +194,7 @@ namespace Microsoft.Psi.Media
             CaptureFormat found = null;
             foreach (var device in MediaCaptureDevice.AllDevices)
             {
+                device.SetThreadPolicy(this.configuration.CaptureThreadPriority, this.configuration.CaptureThreadAffinity);
                 if (!device.Attach(this.configuration.UseInSharedMode))
                 {
                     continue;
@@ -254,13 +255,13 @@ namespace Microsoft.Psi.Media
 
                 this.SetDeviceConfiguration(this.configuration);
 
-                this.camera.CaptureSample((data, length, timestamp) =>
+                // The corrected time is the device timestamp mapped onto the QPC clock, without the jitter of the frame arrival times
+                this.camera.CaptureStream(this.camera.FirstVideoStreamIndex, (stream, data, length, timestamp, arrivalTime, correctedTime) =>
                 {
-                    var time = DateTime.FromFileTimeUtc(timestamp);
                     using var sharedImage = ImagePool.GetOrCreate(this.configuration.Width, this.configuration.Height, PixelFormat.BGR_24bpp);
                     sharedImage.Resource.CopyFrom(data);
 
-                    var originatingTime = this.pipeline.GetCurrentTimeFromElapsedTicks(timestamp);
+                    var originatingTime = this.pipeline.GetCurrentTimeFromElapsedTicks(correctedTime);
                     this.Out.Post(sharedImage, originatingTime);
                 });
             }
@@ -3,6 +3,8 @@
 
 namespace Microsoft.Psi.Media
 {
+    using System.Threading;
+
     /// <summary>
     /// Encapsulates configuration for Video Camera component.
     /// </summary>
@@ -80,6 +82,18 @@ namespace Microsoft.Psi.Media
         /// </summary>
         public bool UseInSharedMode { get; set; } = false;
 
+        /// <summary>
+        /// Gets or sets the priority of the threads frames are captured on. AboveNormal and Highest
+        /// register them with the Multimedia Class Scheduler Service (MMCSS) "Capture" task.
+        /// </summary>
+        public ThreadPriority CaptureThreadPriority { get; set; } = ThreadPriority.Normal;
+
+        /// <summary>
+        /// Gets or sets the logical processors the capture threads may run on, as a bit mask
+        /// (bit n for processor n). Zero lets them run on any processor.
+        /// </summary>
+        public ulong CaptureThreadAffinity { get; set; } = 0;
+
         /// <summary>
         /// Gets or sets the camera resolution width.
         /// </summary>
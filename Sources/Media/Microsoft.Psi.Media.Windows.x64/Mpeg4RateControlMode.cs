@@ -0,0 +1,52 @@
+﻿// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+namespace Microsoft.Psi.Media
+{
+    /// <summary>
+    /// Rate control modes for the Mpeg4Writer's video encoder. The values match
+    /// Media Foundation's eAVEncCommonRateControlMode.
+    /// </summary>
+    public enum Mpeg4RateControlMode
+    {
+        /// <summary>
+        /// Use the encoder's default rate control
+        /// </summary>
+        Default = -1,
+
+        /// <summary>
+        /// Constant bitrate
+        /// </summary>
+        ConstantBitrate = 0,
+
+        /// <summary>
+        /// Variable bitrate with a peak constraint
+        /// </summary>
+        PeakConstrainedVariableBitrate = 1,
+
+        /// <summary>
+        /// Variable bitrate
+        /// </summary>
+        UnconstrainedVariableBitrate = 2,
+
+        /// <summary>
+        /// Constant quality (see <see cref="Mpeg4WriterConfiguration.Quality"/>)
+        /// </summary>
+        Quality = 3,
+
+        /// <summary>
+        /// Low-delay variable bitrate
+        /// </summary>
+        LowDelayVariableBitrate = 5,
+
+        /// <summary>
+        /// Global variable bitrate
+        /// </summary>
+        GlobalVariableBitrate = 6,
+
+        /// <summary>
+        /// Global low-delay variable bitrate
+        /// </summary>
+        GlobalLowDelayVariableBitrate = 7,
+    }
+}
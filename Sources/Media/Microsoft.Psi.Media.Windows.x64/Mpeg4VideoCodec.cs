@@ -0,0 +1,21 @@
+﻿// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+namespace Microsoft.Psi.Media
+{
+    /// <summary>
+    /// Video codecs the Mpeg4Writer can encode to.
+    /// </summary>
+    public enum Mpeg4VideoCodec
+    {
+        /// <summary>
+        /// H.264 / AVC
+        /// </summary>
+        H264 = 0,
+
+        /// <summary>
+        /// H.265 / HEVC
+        /// </summary>
+        Hevc = 1,
+    }
+}
@@ -4,6 +4,7 @@
 namespace Microsoft.Psi.Media
 {
     using System;
+    using System.Runtime.InteropServices;
     using Microsoft.Psi;
     using Microsoft.Psi.Audio;
     using Microsoft.Psi.Imaging;
@@ -85,6 +86,21 @@ namespace Microsoft.Psi.Media
         /// </summary>
         public Receiver<Shared<Image>> In => this.ImageIn;
 
+        /// <summary>
+        /// Gets the number of samples waiting to be encoded (see <see cref="Mpeg4WriterConfiguration.WriteQueueSize"/>).
+        /// </summary>
+        public uint QueueDepth => (this.writer != null) ? this.writer.QueueDepth : 0;
+
+        /// <summary>
+        /// Gets the number of images dropped because the write queue was full.
+        /// </summary>
+        public uint DroppedFrames => (this.writer != null) ? this.writer.DroppedFrames : 0;
+
+        /// <summary>
+        /// Gets the number of files written so far, including the current one (see <see cref="Mpeg4WriterConfiguration.SegmentDuration"/>).
+        /// </summary>
+        public uint SegmentCount => (this.writer != null) ? this.writer.SegmentCount : 0;
+
         /// <summary>
         /// Dispose method.
         /// </summary>
@@ -107,15 +123,33 @@ namespace Microsoft.Psi.Media
         {
             MP4Writer.Startup();
             this.writer = new MP4Writer();
+            if (this.configuration.ZeroCopy)
+            {
+                this.writer.BufferReleased = this.OnBufferReleased;
+            }
+
             this.writer.Open(this.filename, this.configuration.Config);
         }
 
         private void ReceiveImage(Shared<Image> image, Envelope e)
         {
-            if (this.writer != null)
+            if (this.writer != null && this.configuration.ZeroCopy)
             {
-                this.writer.WriteVideoFrame(e.OriginatingTime.Ticks, image.Resource.ImageData, (uint)image.Resource.Width, (uint)image.Resource.Height, (int)image.Resource.PixelFormat);
+                // The writer hangs on to the image until OnBufferReleased is called
+                var handle = GCHandle.Alloc(image.AddRef());
+                this.writer.WriteVideoFrameNoCopy(e.OriginatingTime.Ticks, image.Resource.ImageData, (uint)image.Resource.Width, (uint)image.Resource.Height, image.Resource.Stride, (int)image.Resource.PixelFormat, GCHandle.ToIntPtr(handle));
             }
+            else if (this.writer != null)
+            {
+                this.writer.WriteVideoFrame(e.OriginatingTime.Ticks, image.Resource.ImageData, (uint)image.Resource.Width, (uint)image.Resource.Height, image.Resource.Stride, (int)image.Resource.PixelFormat);
+            }
+        }
+
+        private void OnBufferReleased(IntPtr context)
+        {
+            var handle = GCHandle.FromIntPtr(context);
+            ((Shared<Image>)handle.Target).Dispose();
+            handle.Free();
         }
 
         private void ReceiveAudio(AudioBuffer audioBuffer, Envelope env)
@@ -3,6 +3,8 @@
 
 namespace Microsoft.Psi.Media
 {
+    using System;
+    using System.Threading;
     using Microsoft.Psi.Media_Interop;
 
     /// <summary>
@@ -18,6 +20,8 @@ namespace Microsoft.Psi.Media
             ImageWidth = 1920,
             ImageHeight = 1080,
             PixelFormat = Imaging.PixelFormat.BGR_24bpp,
+            ConvertToNV12 = false,
+            ZeroCopy = false,
             FrameRateNumerator = 30,
             FrameRateDenominator = 1,
             TargetBitrate = 10000000,
@@ -25,6 +29,26 @@ namespace Microsoft.Psi.Media
             AudioBitsPerSample = 16,
             AudioSamplesPerSecond = 48000,
             AudioChannels = 2,
+            AudioOutputSampleRate = 0,
+            AudioOutputChannels = 0,
+            AudioBitrate = 192000,
+            WriteQueueSize = 0,
+            DropFramesWhenQueueFull = false,
+            VideoCodec = Mpeg4VideoCodec.H264,
+            UseHardwareEncoder = false,
+            DisableThrottling = false,
+            LowLatency = false,
+            RateControlMode = Mpeg4RateControlMode.Default,
+            GopSize = -1,
+            BFrameCount = -1,
+            QualityVsSpeed = -1,
+            Quality = -1,
+            Fragmented = false,
+            FragmentDuration = TimeSpan.FromSeconds(2),
+            SegmentDuration = TimeSpan.Zero,
+            SegmentMaxBytes = 0,
+            EncodeThreadPriority = ThreadPriority.Normal,
+            EncodeThreadAffinity = 0,
         };
 
         /// <summary>
@@ -75,6 +99,30 @@ namespace Microsoft.Psi.Media
             }
         }
 
+        /// <summary>
+        /// Gets or sets a value indicating whether color images are converted to NV12 by the writer
+        /// (rather than by the encoder pipeline). Gray images are always converted.
+        /// </summary>
+        public bool ConvertToNV12
+        {
+            get
+            {
+                return this.Config.convertToNV12;
+            }
+
+            set
+            {
+                this.Config.convertToNV12 = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets a value indicating whether images are handed to the encoder without being copied.
+        /// The writer then holds a reference to each image until the encoder is done with it. Only images
+        /// with packed rows that need no conversion (see <see cref="ConvertToNV12"/>) avoid the copy.
+        /// </summary>
+        public bool ZeroCopy { get; set; } = false;
+
         /// <summary>
         /// Gets or sets a value that defines the output frame rate's numerator.
         /// </summary>
@@ -172,7 +220,7 @@ namespace Microsoft.Psi.Media
         }
 
         /// <summary>
-        /// Gets or sets a value that defines number of audio channels in the output file (should be set to 1 or 2).
+        /// Gets or sets a value that defines number of channels of the input audio (typically 1 or 2).
         /// </summary>
         public uint AudioChannels
         {
@@ -187,6 +235,338 @@ namespace Microsoft.Psi.Media
             }
         }
 
+        /// <summary>
+        /// Gets or sets the sample rate of the AAC audio in the output file, 44100 or 48000 (0 to use the input's
+        /// sample rate if the encoder supports it, otherwise 48000). Input audio is resampled as needed.
+        /// </summary>
+        public uint AudioOutputSampleRate
+        {
+            get
+            {
+                return this.Config.audioOutputSampleRate;
+            }
+
+            set
+            {
+                this.Config.audioOutputSampleRate = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the number of channels of the AAC audio in the output file, 1, 2 or 6 (0 to use the input's
+        /// channel count if the encoder supports it, otherwise 2). Input audio is up or downmixed as needed.
+        /// </summary>
+        public uint AudioOutputChannels
+        {
+            get
+            {
+                return this.Config.audioOutputChannels;
+            }
+
+            set
+            {
+                this.Config.audioOutputChannels = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the bitrate of the AAC audio in bits per second (96000, 128000, 160000 or 192000).
+        /// </summary>
+        public uint AudioBitrate
+        {
+            get
+            {
+                return this.Config.audioBitrate;
+            }
+
+            set
+            {
+                this.Config.audioBitrate = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the number of samples that may be queued for a background encode thread.
+        /// With 0 (the default) samples are encoded on the pipeline thread that receives them.
+        /// </summary>
+        public uint WriteQueueSize
+        {
+            get
+            {
+                return this.Config.writeQueueSize;
+            }
+
+            set
+            {
+                this.Config.writeQueueSize = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets a value indicating whether images are dropped when the write queue is full.
+        /// If false the pipeline waits for the encoder to catch up. Audio is never dropped.
+        /// </summary>
+        public bool DropFramesWhenQueueFull
+        {
+            get
+            {
+                return this.Config.dropFramesWhenQueueFull;
+            }
+
+            set
+            {
+                this.Config.dropFramesWhenQueueFull = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the codec used for the video stream.
+        /// </summary>
+        public Mpeg4VideoCodec VideoCodec
+        {
+            get
+            {
+                return (Mpeg4VideoCodec)this.Config.videoCodec;
+            }
+
+            set
+            {
+                this.Config.videoCodec = (int)value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets a value indicating whether a hardware encoder (NVENC, QuickSync, AMF, ...) may be used when one is available.
+        /// </summary>
+        public bool UseHardwareEncoder
+        {
+            get
+            {
+                return this.Config.useHardwareEncoder;
+            }
+
+            set
+            {
+                this.Config.useHardwareEncoder = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets a value indicating whether the writer should stop throttling the caller when the encoder falls behind.
+        /// </summary>
+        public bool DisableThrottling
+        {
+            get
+            {
+                return this.Config.disableThrottling;
+            }
+
+            set
+            {
+                this.Config.disableThrottling = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets a value indicating whether the encoder is tuned for latency rather than throughput.
+        /// </summary>
+        public bool LowLatency
+        {
+            get
+            {
+                return this.Config.lowLatency;
+            }
+
+            set
+            {
+                this.Config.lowLatency = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the encoder's rate control mode.
+        /// </summary>
+        public Mpeg4RateControlMode RateControlMode
+        {
+            get
+            {
+                return (Mpeg4RateControlMode)this.Config.rateControlMode;
+            }
+
+            set
+            {
+                this.Config.rateControlMode = (int)value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the number of frames from one key frame to the next (-1 for the encoder's default).
+        /// </summary>
+        public int GopSize
+        {
+            get
+            {
+                return this.Config.gopSize;
+            }
+
+            set
+            {
+                this.Config.gopSize = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the number of B frames between reference frames (-1 for the encoder's default).
+        /// </summary>
+        public int BFrameCount
+        {
+            get
+            {
+                return this.Config.bFrameCount;
+            }
+
+            set
+            {
+                this.Config.bFrameCount = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the encoder's trade-off between speed (0) and quality (100) (-1 for the encoder's default).
+        /// </summary>
+        public int QualityVsSpeed
+        {
+            get
+            {
+                return this.Config.qualityVsSpeed;
+            }
+
+            set
+            {
+                this.Config.qualityVsSpeed = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the target quality (0 to 100) for the quality rate control mode (-1 for the encoder's default).
+        /// </summary>
+        public int Quality
+        {
+            get
+            {
+                return this.Config.quality;
+            }
+
+            set
+            {
+                this.Config.quality = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets a value indicating whether to write fragmented MP4. A fragmented file is
+        /// playable while it is being written and is left intact up to its last fragment if the
+        /// process dies before the writer is closed.
+        /// </summary>
+        public bool Fragmented
+        {
+            get
+            {
+                return this.Config.fragmented;
+            }
+
+            set
+            {
+                this.Config.fragmented = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the length of each fragment when writing fragmented MP4. Fragments start at
+        /// key frames, so unless <see cref="GopSize"/> is set this determines the key frame interval.
+        /// </summary>
+        public TimeSpan FragmentDuration
+        {
+            get
+            {
+                return TimeSpan.FromTicks(this.Config.fragmentDuration);
+            }
+
+            set
+            {
+                this.Config.fragmentDuration = value.Ticks;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the amount of video after which the writer rolls over to a new file
+        /// (<see cref="TimeSpan.Zero"/> to never roll over on time). When segmenting, files are named
+        /// by inserting the segment number before the extension (e.g. video_0000.mp4, video_0001.mp4).
+        /// </summary>
+        public TimeSpan SegmentDuration
+        {
+            get
+            {
+                return TimeSpan.FromTicks(this.Config.segmentDuration);
+            }
+
+            set
+            {
+                this.Config.segmentDuration = value.Ticks;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the file size in bytes at which the writer rolls over to a new file (0 to never roll over on size).
+        /// </summary>
+        public ulong SegmentMaxBytes
+        {
+            get
+            {
+                return this.Config.segmentMaxBytes;
+            }
+
+            set
+            {
+                this.Config.segmentMaxBytes = value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the priority of the encode threads. AboveNormal and Highest register the sink
+        /// writer's threads, and the background encode thread (see <see cref="WriteQueueSize"/>), with
+        /// the Multimedia Class Scheduler Service (MMCSS) "Capture" task.
+        /// </summary>
+        public ThreadPriority EncodeThreadPriority
+        {
+            get
+            {
+                return (ThreadPriority)this.Config.threadPriority;
+            }
+
+            set
+            {
+                this.Config.threadPriority = (int)value;
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the logical processors the background encode thread (see <see cref="WriteQueueSize"/>)
+        /// may run on, as a bit mask (bit n for processor n). Zero lets it run on any processor.
+        /// </summary>
+        public ulong EncodeThreadAffinity
+        {
+            get
+            {
+                return this.Config.threadAffinityMask;
+            }
+
+            set
+            {
+                this.Config.threadAffinityMask = value;
+            }
+        }
+
         /// <summary>
         /// Gets or sets the native MP4Writer's configuration object.
         /// </summary>
@@ -18,3 +18,4 @@ using namespace System::Security::Permissions;
 [assembly:AssemblyVersionAttribute("0.15.49.1")];
 [assembly:AssemblyFileVersionAttribute("0.15.49.1")];
 [assembly:AssemblyInformationalVersionAttribute("0.15.49.1-beta")];
+[assembly:InternalsVisibleTo("Test.Psi.Media.Windows.x64")];
@@ -0,0 +1,106 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "StdAfx.h"
+#include "CaptureClockCorrelator.h"
+
+namespace Microsoft {
+    namespace Psi {
+        namespace Media_Interop {
+
+            // Weight kept by older frames each time a frame is added. About the last
+            // 256 frames (several seconds of video) contribute to the fit.
+            static const double FitDecay = 255.0 / 256.0;
+
+            CaptureClockCorrelator::CaptureClockCorrelator()
+            {
+                Reset();
+            }
+
+            //**********************************************************************
+            // Forgets everything learnt about the clocks. The next frame starts a
+            // new fit.
+            //**********************************************************************
+            void CaptureClockCorrelator::Reset()
+            {
+                numSamples = 0;
+                deviceOrigin = 0;
+                arrivalOrigin = 0;
+                sumWeights = 0;
+                meanX = 0;
+                meanY = 0;
+                varianceX = 0;
+                covarianceXY = 0;
+            }
+
+            //**********************************************************************
+            // Adds a frame to the fit and returns its corrected time on the arrival
+            // (QPC) clock.
+            //**********************************************************************
+            LONGLONG CaptureClockCorrelator::AddSample(LONGLONG deviceTime, LONGLONG arrivalTime)
+            {
+                if (numSamples == 0)
+                {
+                    deviceOrigin = deviceTime;
+                    arrivalOrigin = arrivalTime;
+                }
+
+                // Fit in coordinates relative to the first frame, so the doubles keep
+                // sub-tick precision for years of capture
+                double x = (double)(deviceTime - deviceOrigin);
+                double y = (double)(arrivalTime - arrivalOrigin);
+
+                // Weighted Welford update: the raw sums of x * x and x * y would grow
+                // with the square of the capture's length, and the difference the
+                // slope is computed from would cancel away to nothing
+                sumWeights = sumWeights * FitDecay + 1;
+                double deltaX = x - meanX;
+                meanX += deltaX / sumWeights;
+                meanY += (y - meanY) / sumWeights;
+                varianceX = varianceX * FitDecay + deltaX * (x - meanX);
+                covarianceXY = covarianceXY * FitDecay + deltaX * (y - meanY);
+                numSamples++;
+
+                // Until there are enough frames to estimate the drift, assume the clocks
+                // run at the same rate and only estimate the offset
+                double slope = 1;
+                if (numSamples >= MinSamplesForDrift && varianceX > 0)
+                {
+                    slope = covarianceXY / varianceX;
+                }
+
+                double fitted = meanY + slope * (x - meanX);
+                double residual = y - fitted;
+
+                // A jump that large is a clock discontinuity (device reset, timestamps
+                // restarting, system sleep) rather than latency; start over from this frame
+                if (residual > ResetThreshold || residual < -ResetThreshold)
+                {
+                    Reset();
+                    return AddSample(deviceTime, arrivalTime);
+                }
+
+                // Shift the line down to the least delayed of the recent frames. The
+                // residuals are recomputed against the current line, since the line
+                // itself moves as the fit converges.
+                recentX[(numSamples - 1) % EnvelopeWindow] = x;
+                recentY[(numSamples - 1) % EnvelopeWindow] = y;
+                int numRecent = numSamples < EnvelopeWindow ? numSamples : EnvelopeWindow;
+                double minResidual = residual;
+                for (int i = 0; i < numRecent; i++)
+                {
+                    double recentResidual = recentY[i] - (meanY + slope * (recentX[i] - meanX));
+                    if (recentResidual < minResidual)
+                    {
+                        minResidual = recentResidual;
+                    }
+                }
+
+                LONGLONG correctedTime = arrivalOrigin + (LONGLONG)(fitted + minResidual);
+
+                // A frame can't have been captured after it arrived
+                return correctedTime < arrivalTime ? correctedTime : arrivalTime;
+            }
+        }
+    }
+}
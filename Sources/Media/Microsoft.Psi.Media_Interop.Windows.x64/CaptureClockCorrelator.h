@@ -0,0 +1,47 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+namespace Microsoft {
+    namespace Psi {
+        namespace Media_Interop {
+
+            //**********************************************************************
+            // CaptureClockCorrelator maps a capture device's sample times onto the
+            // host's QPC clock (in 100ns units). For each frame it is given the
+            // device time and the QPC time the frame arrived at, and keeps a
+            // running, exponentially weighted linear fit of arrival time against
+            // device time (offset plus drift). Arrival times carry a variable
+            // delivery latency, so the fitted line is then shifted down to the
+            // least delayed of the recent arrivals. The corrected time of a frame is its
+            // device time mapped through that line: free of arrival jitter, and as
+            // close to the moment of capture as the arrivals allow.
+            //**********************************************************************
+            class CaptureClockCorrelator
+            {
+            public:
+                CaptureClockCorrelator();
+
+                void Reset();
+                LONGLONG AddSample(LONGLONG deviceTime, LONGLONG arrivalTime);
+
+            private:
+                static const int MinSamplesForDrift = 8;          /* Frames needed before the drift is estimated */
+                static const LONGLONG ResetThreshold = 10000000;  /* A residual above this (1s) means a clock discontinuity */
+                static const int EnvelopeWindow = 64;             /* Number of recent frames the lower envelope is taken over */
+
+                int numSamples;             /* Frames seen since the last reset */
+                LONGLONG deviceOrigin;      /* Device time of the first frame (fit coordinates are relative to it) */
+                LONGLONG arrivalOrigin;     /* Arrival time of the first frame */
+                double sumWeights;          /* Exponentially weighted statistics for the least squares fit */
+                double meanX;
+                double meanY;
+                double varianceX;           /* Weighted sums of squared deviations from the means */
+                double covarianceXY;
+                double recentX[EnvelopeWindow]; /* Fit coordinates of the most recent frames (ring buffer) */
+                double recentY[EnvelopeWindow];
+            };
+        }
+    }
+}
@@ -0,0 +1,136 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "StdAfx.h"
+#include "CaptureStatistics.h"
+
+namespace Microsoft {
+namespace Psi {
+namespace Media_Interop {
+
+#pragma managed(push, off)
+
+    //**********************************************************************
+    // Clears all counters
+    //**********************************************************************
+    void CaptureStatisticsNative::Reset()
+    {
+        framesArrived = 0;
+        framesDelivered = 0;
+        framesDropped = 0;
+        gaps = 0;
+        streamTicks = 0;
+        errors = 0;
+        bytesCopied = 0;
+        conversionTime = 0;
+        handlerTime = 0;
+        maxHandlerTime = 0;
+        latencyTime = 0;
+        maxLatency = 0;
+        for (int i = 0; i < NumInterArrivalBins; i++)
+        {
+            interArrivalHistogram[i] = 0;
+        }
+        lastArrivalTime = 0;
+        lastDeviceTime = 0;
+        averageDeviceInterval = 0;
+    }
+
+    //**********************************************************************
+    // Records a frame received from the source reader
+    //**********************************************************************
+    void CaptureStatisticsNative::RecordArrival(LONGLONG deviceTime, LONGLONG arrivalTime, LONGLONG correctedTime, bool discontinuity)
+    {
+        Add(&framesArrived, 1);
+
+        LONGLONG latency = arrivalTime - correctedTime;
+        Add(&latencyTime, latency);
+        Max(&maxLatency, latency);
+
+        if (lastArrivalTime != 0)
+        {
+            LONGLONG interval = arrivalTime - lastArrivalTime;
+            int bin = 0;
+            for (LONGLONG limit = 10000; bin < NumInterArrivalBins - 1 && interval >= limit; limit *= 2)
+            {
+                bin++;
+            }
+            Add(&interArrivalHistogram[bin], 1);
+
+            // The usual frame interval is a running average of the device's, so
+            // a gap is detected whatever rate the stream runs at. Long intervals
+            // still feed the average (clamped, so one stall barely moves it) or a
+            // lasting drop in frame rate would count every frame as a gap.
+            LONGLONG deviceInterval = deviceTime - lastDeviceTime;
+            if (discontinuity || (averageDeviceInterval > 0 && deviceInterval > 2 * averageDeviceInterval))
+            {
+                Add(&gaps, 1);
+            }
+
+            if (!discontinuity && deviceInterval > 0)
+            {
+                if (averageDeviceInterval > 0 && deviceInterval > 4 * averageDeviceInterval)
+                {
+                    deviceInterval = 4 * averageDeviceInterval;
+                }
+
+                averageDeviceInterval = averageDeviceInterval == 0 ? deviceInterval : (averageDeviceInterval * 15 + deviceInterval) / 16;
+            }
+        }
+        else if (discontinuity)
+        {
+            Add(&gaps, 1);
+        }
+
+        lastArrivalTime = arrivalTime;
+        lastDeviceTime = deviceTime;
+    }
+
+    //**********************************************************************
+    // Records a call to a handler
+    //**********************************************************************
+    void CaptureStatisticsNative::RecordHandler(LONGLONG elapsed)
+    {
+        Add(&handlerTime, elapsed);
+        Max(&maxHandlerTime, elapsed);
+    }
+
+    //**********************************************************************
+    // Records the conversion of a frame
+    //**********************************************************************
+    void CaptureStatisticsNative::RecordConversion(LONGLONG elapsed, DWORD bytes)
+    {
+        Add(&conversionTime, elapsed);
+        Add(&bytesCopied, bytes);
+    }
+
+#pragma managed(pop)
+
+    /// <summary>
+    /// Takes a snapshot of native statistics. The counters are read one by one while capture
+    /// goes on, so they may be a frame apart from each other.
+    /// </summary>
+    /// <param name="stats">The native statistics</param>
+    CaptureStatistics^ CaptureStatistics::FromNative(const CaptureStatisticsNative &stats)
+    {
+        CaptureStatistics^ snapshot = gcnew CaptureStatistics();
+        snapshot->FramesArrived = stats.framesArrived;
+        snapshot->FramesDelivered = stats.framesDelivered;
+        snapshot->FramesDropped = stats.framesDropped;
+        snapshot->Gaps = stats.gaps;
+        snapshot->StreamTicks = stats.streamTicks;
+        snapshot->Errors = stats.errors;
+        snapshot->BytesCopied = stats.bytesCopied;
+        snapshot->ConversionTime = stats.conversionTime;
+        snapshot->HandlerTime = stats.handlerTime;
+        snapshot->MaxHandlerTime = stats.maxHandlerTime;
+        snapshot->AverageLatency = snapshot->FramesArrived > 0 ? stats.latencyTime / snapshot->FramesArrived : 0;
+        snapshot->MaxLatency = stats.maxLatency;
+        snapshot->InterArrivalHistogram = gcnew array<long long>(CaptureStatisticsNative::NumInterArrivalBins);
+        for (int i = 0; i < CaptureStatisticsNative::NumInterArrivalBins; i++)
+        {
+            snapshot->InterArrivalHistogram[i] = stats.interArrivalHistogram[i];
+        }
+        return snapshot;
+    }
+}}}
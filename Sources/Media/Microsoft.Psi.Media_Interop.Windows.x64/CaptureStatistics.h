@@ -0,0 +1,161 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "Managed.h"
+
+namespace Microsoft {
+namespace Psi {
+namespace Media_Interop {
+
+    //**********************************************************************
+    // CaptureStatisticsNative holds the counters kept for a captured stream.
+    // It is written by the source reader's callback thread only, with
+    // interlocked operations, so it can be read from any thread (e.g. via
+    // MediaCaptureDevice::GetStatistics) while capture is running. All times
+    // are in 100ns units.
+    //**********************************************************************
+    struct CaptureStatisticsNative
+    {
+        // Bin i of the inter-arrival histogram counts intervals in [2^(i-1), 2^i) ms,
+        // bin 0 those under 1ms and the last bin everything longer
+        static const int NumInterArrivalBins = 10;
+
+        volatile LONGLONG framesArrived;        // Frames received from the source reader
+        volatile LONGLONG framesDelivered;      // Frames handed to the handlers (once per frame, however many handlers)
+        volatile LONGLONG framesDropped;        // Frames dropped to bring the stream down to its requested rate
+        volatile LONGLONG gaps;                 // Discontinuities, stream ticks and device time gaps of over twice the usual frame interval
+        volatile LONGLONG streamTicks;          // MF_SOURCE_READERF_STREAMTICK notifications (the source had no data)
+        volatile LONGLONG errors;               // Failed reads and samples that couldn't be delivered
+        volatile LONGLONG bytesCopied;          // Bytes written into conversion buffers
+        volatile LONGLONG conversionTime;       // Total time spent converting frames to RGB
+        volatile LONGLONG handlerTime;          // Total time spent in the handlers
+        volatile LONGLONG maxHandlerTime;       // Longest single handler call
+        volatile LONGLONG latencyTime;          // Total of arrival time - corrected capture time
+        volatile LONGLONG maxLatency;           // Largest arrival time - corrected capture time
+        volatile LONGLONG interArrivalHistogram[NumInterArrivalBins];
+
+        void Reset();
+        void RecordArrival(LONGLONG deviceTime, LONGLONG arrivalTime, LONGLONG correctedTime, bool discontinuity);
+        void RecordHandler(LONGLONG elapsed);
+        void RecordConversion(LONGLONG elapsed, DWORD bytes);
+        void RecordDelivery() { Add(&framesDelivered, 1); }
+        void RecordDrop() { Add(&framesDropped, 1); }
+        void RecordStreamTick() { Add(&streamTicks, 1); Add(&gaps, 1); }
+        void RecordError() { Add(&errors, 1); }
+
+    private:
+        // Only touched by the writer
+        LONGLONG lastArrivalTime;
+        LONGLONG lastDeviceTime;
+        LONGLONG averageDeviceInterval;
+
+        static void Add(volatile LONGLONG *counter, LONGLONG value) { InterlockedExchangeAdd64(counter, value); }
+        static void Max(volatile LONGLONG *counter, LONGLONG value) { if (value > *counter) InterlockedExchange64(counter, value); }
+    };
+
+    /// <summary>
+    /// Snapshot of the statistics of a captured stream. All times are TimeSpan ticks (100ns).
+    /// </summary>
+    public ref struct CaptureStatistics
+    {
+    internal:
+        static CaptureStatistics^ FromNative(const CaptureStatisticsNative &stats);
+
+    public:
+        /// <summary>
+        /// Gets or sets the number of frames received from the device.
+        /// </summary>
+        property long long FramesArrived;
+
+        /// <summary>
+        /// Gets or sets the number of frames handed to the stream's handlers.
+        /// </summary>
+        property long long FramesDelivered;
+
+        /// <summary>
+        /// Gets or sets the number of frames dropped to bring the stream down to its requested frame rate.
+        /// </summary>
+        property long long FramesDropped;
+
+        /// <summary>
+        /// Gets or sets the number of gaps in the stream (discontinuities, stream ticks and unusually long frame intervals).
+        /// </summary>
+        property long long Gaps;
+
+        /// <summary>
+        /// Gets or sets the number of stream ticks, i.e. times the device had no data to deliver.
+        /// </summary>
+        property long long StreamTicks;
+
+        /// <summary>
+        /// Gets or sets the number of failed reads and undeliverable samples.
+        /// </summary>
+        property long long Errors;
+
+        /// <summary>
+        /// Gets or sets the number of bytes written by the native color conversion.
+        /// </summary>
+        property long long BytesCopied;
+
+        /// <summary>
+        /// Gets or sets the total time spent converting frames.
+        /// </summary>
+        property long long ConversionTime;
+
+        /// <summary>
+        /// Gets or sets the total time spent in the stream's handlers.
+        /// </summary>
+        property long long HandlerTime;
+
+        /// <summary>
+        /// Gets or sets the longest single call to a handler.
+        /// </summary>
+        property long long MaxHandlerTime;
+
+        /// <summary>
+        /// Gets or sets the average time from capture to arrival, which grows as frames queue up before delivery.
+        /// </summary>
+        property long long AverageLatency;
+
+        /// <summary>
+        /// Gets or sets the longest time from capture to arrival.
+        /// </summary>
+        property long long MaxLatency;
+
+        /// <summary>
+        /// Gets or sets the histogram of frame inter-arrival times. Element 0 counts intervals under 1ms,
+        /// element i intervals from 2^(i-1) to 2^i ms, and the last element all longer intervals.
+        /// </summary>
+        property array<long long>^ InterArrivalHistogram;
+    };
+
+    /// <summary>
+    /// Feeds frame arrivals to native statistics from managed code, so tests can drive
+    /// the gap detection without a capture device.
+    /// </summary>
+    private ref class CaptureStatisticsRecorder
+    {
+    public:
+        CaptureStatisticsRecorder() : stats(new CaptureStatisticsNative()) { stats->Reset(); }
+        ~CaptureStatisticsRecorder() { this->!CaptureStatisticsRecorder(); }
+        !CaptureStatisticsRecorder() { delete stats; stats = nullptr; }
+
+        /// <summary>
+        /// Records a frame that arrived when it was captured.
+        /// </summary>
+        /// <param name="deviceTime">The device timestamp of the frame</param>
+        /// <param name="discontinuity">Whether the source flagged a discontinuity before the frame</param>
+        void RecordArrival(long long deviceTime, bool discontinuity) { stats->RecordArrival(deviceTime, deviceTime, deviceTime, discontinuity); }
+
+        /// <summary>
+        /// Gets a snapshot of the statistics recorded so far.
+        /// </summary>
+        /// <returns>The statistics</returns>
+        CaptureStatistics^ GetStatistics() { return CaptureStatistics::FromNative(*stats); }
+
+    private:
+        CaptureStatisticsNative *stats;
+    };
+}}}
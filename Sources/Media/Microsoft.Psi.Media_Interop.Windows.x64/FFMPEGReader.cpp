@@ -24,8 +24,9 @@ namespace Microsoft {
                     //**********************************************************************
                     // Opens a MP4 file for writing.
                     //**********************************************************************
-                    void FFMPEGReader::Open(String ^fn, FFMPEGReaderConfiguration^ /*config*/)
+                    void FFMPEGReader::Open(String ^fn, FFMPEGReaderConfiguration^ config)
                     {
+                        Configure(config);
                         IntPtr ptrToNativeString = Marshal::StringToHGlobalUni(fn);
 						std::wstring wstr(static_cast<wchar_t*>(ptrToNativeString.ToPointer()));
 						std::string str(wstr.begin(), wstr.end());
@@ -39,6 +40,172 @@ namespace Microsoft {
                         }
                     }
 
+                    //**********************************************************************
+                    // Opens a file read from a stream (e.g. a MemoryStream over a message
+                    // from a Psi store) without going through a temporary file. The stream
+                    // is read on the thread doing the demuxing and must stay open until
+                    // the reader is closed. Streams that can't seek are read front to back.
+                    //**********************************************************************
+                    void FFMPEGReader::Open(Stream ^stream, FFMPEGReaderConfiguration^ config)
+                    {
+                        Configure(config);
+                        FFMPEGStreamInput^ input = gcnew FFMPEGStreamInput(stream);
+                        FFMPEGReadCallback read = reinterpret_cast<FFMPEGReadCallback>(Marshal::GetFunctionPointerForDelegate(input->Read).ToPointer());
+                        FFMPEGSeekCallback seek = (input->Seek == nullptr) ? nullptr : reinterpret_cast<FFMPEGSeekCallback>(Marshal::GetFunctionPointerForDelegate(input->Seek).ToPointer());
+                        HRESULT hr = unmanagedData->OpenWithCallbacks(read, seek, nullptr);
+                        if (FAILED(hr))
+                        {
+                            char buffer[512];
+                            sprintf(buffer, "Failed to open stream. HRESULT=0x%x", hr);
+                            throw gcnew Exception(gcnew System::String(buffer));
+                        }
+                        streamInput = input;
+                    }
+
+                    //**********************************************************************
+                    // Opens a file held in memory. The caller keeps ownership of the
+                    // memory, which must stay valid (e.g. pinned) until the reader is closed.
+                    //**********************************************************************
+                    void FFMPEGReader::OpenFromBuffer(IntPtr data, Int64 size, FFMPEGReaderConfiguration^ config)
+                    {
+                        Configure(config);
+                        HRESULT hr = unmanagedData->OpenFromBuffer(static_cast<const uint8_t*>(data.ToPointer()), size);
+                        if (FAILED(hr))
+                        {
+                            char buffer[512];
+                            sprintf(buffer, "Failed to open buffer. HRESULT=0x%x", hr);
+                            throw gcnew Exception(gcnew System::String(buffer));
+                        }
+                    }
+
+                    //**********************************************************************
+                    // Opens a file by memory mapping it, so it is read ahead of the demuxer
+                    // in large requests (which suits network shares).
+                    //**********************************************************************
+                    void FFMPEGReader::OpenMappedFile(String ^fn, FFMPEGReaderConfiguration^ config)
+                    {
+                        Configure(config);
+                        IntPtr ptrToNativeString = Marshal::StringToHGlobalAnsi(fn);
+                        HRESULT hr = unmanagedData->OpenMappedFile(static_cast<char*>(ptrToNativeString.ToPointer()));
+                        Marshal::FreeHGlobal(ptrToNativeString);
+                        if (FAILED(hr))
+                        {
+                            char buffer[512];
+                            sprintf(buffer, "Failed to open mapped file. HRESULT=0x%x", hr);
+                            throw gcnew Exception(gcnew System::String(buffer));
+                        }
+                    }
+
+                    //**********************************************************************
+                    // Applies the configuration to the native reader before it is opened
+                    //**********************************************************************
+                    void FFMPEGReader::Configure(FFMPEGReaderConfiguration^ config)
+                    {
+                        if (config != nullptr && config->HardwareAcceleration != nullptr)
+                        {
+                            IntPtr ptrToDeviceType = Marshal::StringToHGlobalAnsi(config->HardwareAcceleration);
+                            unmanagedData->SetHardwareAcceleration(static_cast<char*>(ptrToDeviceType.ToPointer()));
+                            Marshal::FreeHGlobal(ptrToDeviceType);
+                        }
+                        if (config != nullptr)
+                        {
+                            unmanagedData->SetPlanarOutput(config->PlanarOutput);
+                            unmanagedData->SetDecodeAheadDepth(config->DecodeAheadDepth);
+                            unmanagedData->SetFramePoolCapacity(config->FramePoolCapacity);
+                            unmanagedData->SetIOBufferSize(config->IOBufferSize);
+                            unmanagedData->SetKeyframesOnly(config->KeyframesOnly);
+                            unmanagedData->SetOutputSize(config->MaxOutputWidth, config->MaxOutputHeight);
+
+                            IntPtr ptrToTransport = (config->LiveTransport != nullptr) ? Marshal::StringToHGlobalAnsi(config->LiveTransport) : IntPtr::Zero;
+                            unmanagedData->SetLiveMode(config->LiveMode, static_cast<char*>(ptrToTransport.ToPointer()), config->LiveProbeSize, config->LiveAnalyzeDurationMs, config->LiveTimeoutMs, config->LiveMaxReconnects);
+                            Marshal::FreeHGlobal(ptrToTransport);
+                        }
+                    }
+
+                    //**********************************************************************
+                    // GetStreamInfo() describes one of the streams in the opened file,
+                    // whether or not it is selected.
+                    //**********************************************************************
+                    FFMPEGStreamInfo^ FFMPEGReader::GetStreamInfo(int streamId)
+                    {
+                        int frameType;
+                        int width;
+                        int height;
+                        int sampleRate;
+                        int numChannels;
+                        HRESULT hr = unmanagedData->GetStreamInfo(streamId, &frameType, &width, &height, &sampleRate, &numChannels);
+                        if (FAILED(hr))
+                        {
+                            char buffer[512];
+                            sprintf(buffer, "Failed to get stream info. HRESULT=0x%x", hr);
+                            throw gcnew Exception(gcnew System::String(buffer));
+                        }
+                        FFMPEGStreamInfo^ info = gcnew FFMPEGStreamInfo();
+                        info->StreamId = streamId;
+                        info->FrameType = frameType;
+                        const char *codecName = unmanagedData->GetStreamCodecName(streamId);
+                        info->CodecName = (codecName == nullptr) ? nullptr : gcnew System::String(codecName);
+                        info->Width = width;
+                        info->Height = height;
+                        info->AudioSampleRate = sampleRate;
+                        info->AudioNumChannels = numChannels;
+                        return info;
+                    }
+
+                    //**********************************************************************
+                    // SelectStreams() selects which audio and video streams are decoded
+                    // (by default the last audio and the last video stream in the file).
+                    // All other streams are dropped by the demuxer. FFMPEGFrameInfo's
+                    // StreamId says which stream each frame came from.
+                    //**********************************************************************
+                    void FFMPEGReader::SelectStreams(array<int>^ streamIds)
+                    {
+                        if (streamIds->Length == 0)
+                        {
+                            throw gcnew ArgumentException("At least one stream must be selected");
+                        }
+                        pin_ptr<int> pinnedStreamIds = &streamIds[0];
+                        HRESULT hr = unmanagedData->SelectStreams(pinnedStreamIds, streamIds->Length);
+                        if (FAILED(hr))
+                        {
+                            char buffer[512];
+                            sprintf(buffer, "Failed to select streams. HRESULT=0x%x", hr);
+                            throw gcnew Exception(gcnew System::String(buffer));
+                        }
+                    }
+
+                    //**********************************************************************
+                    // Seek() repositions playback so the next frame returned is the first
+                    // one at or after 'timestampMillisecs' (measured from the start of the
+                    // file, like the timestamps returned by ReadFrameData()).
+                    //**********************************************************************
+                    void FFMPEGReader::Seek(double timestampMillisecs)
+                    {
+                        HRESULT hr = unmanagedData->Seek(timestampMillisecs);
+                        if (FAILED(hr))
+                        {
+                            char buffer[512];
+                            sprintf(buffer, "Failed to seek. HRESULT=0x%x", hr);
+                            throw gcnew Exception(gcnew System::String(buffer));
+                        }
+                    }
+
+                    //**********************************************************************
+                    // SetReadRange() limits playback to [startMillisecs, endMillisecs).
+                    // NextFrame() reports end of stream once the range has been read.
+                    // Pass a negative 'endMillisecs' to read to the end of the file.
+                    //**********************************************************************
+                    void FFMPEGReader::SetReadRange(double startMillisecs, double endMillisecs)
+                    {
+                        HRESULT hr = unmanagedData->SetReadRange(startMillisecs, endMillisecs);
+                        if (FAILED(hr))
+                        {
+                            char buffer[512];
+                            sprintf(buffer, "Failed to set read range. HRESULT=0x%x", hr);
+                            throw gcnew Exception(gcnew System::String(buffer));
+                        }
+                    }
+
                     //**********************************************************************
                     // NextFrame() advances the playback engine to the next audio or video
                     // packet to be processed. This method will fill in 'info' with the type
@@ -65,6 +232,7 @@ namespace Microsoft {
                         }
                         info->FrameType = frameType;
                         info->BufferSize = requiredBufferSize;
+                        info->StreamId = unmanagedData->GetFrameStreamId();
                         if (FAILED(hr))
                         {
                             char buffer[512];
@@ -101,6 +269,98 @@ namespace Microsoft {
                         return false;
                     }
 
+                    //**********************************************************************
+                    // ReadFrameBuffer() is ReadFrameData() without the copy: the frame is
+                    // decoded into a pooled buffer owned by the reader, which is returned
+                    // to the pool when 'frameBuffer' is disposed. In planar mode video
+                    // frames have no data and 'frameBuffer' is nullptr.
+                    // Return true if we successfully decoded a frame
+                    //**********************************************************************
+                    bool FFMPEGReader::ReadFrameBuffer([Out] FFMPEGFrameBuffer ^%frameBuffer)
+                    {
+                        FFMPEGFrameBufferNative *buffer;
+                        uint8_t *data;
+                        int bytesRead = 0;
+                        double ts = 0.0;
+                        frameBuffer = nullptr;
+                        HRESULT hr = unmanagedData->ReadFrameBuffer(&buffer, &data, &bytesRead, &ts);
+                        if (FAILED(hr))
+                        {
+                            char msg[512];
+                            sprintf(msg, "Failed to read video frame. HRESULT=0x%x", hr);
+                            throw gcnew Exception(gcnew System::String(msg));
+                        }
+                        if (hr == S_FALSE)
+                        {
+                            return false;
+                        }
+                        if (buffer != nullptr)
+                        {
+                            frameBuffer = gcnew FFMPEGFrameBuffer(buffer, IntPtr(data), bytesRead, ts);
+                        }
+                        return true; // Successfully decoded frame
+                    }
+
+                    //**********************************************************************
+                    // GetFramePlanes() returns the planes of the video frame decoded by the
+                    // last call to ReadFrameData(). Only valid in planar output mode. The
+                    // data is not copied; the pointers are valid until the next call to
+                    // ReadFrameData().
+                    //**********************************************************************
+                    void FFMPEGReader::GetFramePlanes(FFMPEGFramePlanes ^%planes)
+                    {
+                        uint8_t *framePlanes[4];
+                        int strides[4];
+                        int pixelFormat;
+                        int width;
+                        int height;
+                        HRESULT hr = unmanagedData->GetFramePlanes(framePlanes, strides, &pixelFormat, &width, &height);
+                        if (FAILED(hr))
+                        {
+                            char buffer[512];
+                            sprintf(buffer, "Failed to get video frame planes. HRESULT=0x%x", hr);
+                            throw gcnew Exception(gcnew System::String(buffer));
+                        }
+                        for (int i = 0; i < 4; i++)
+                        {
+                            planes->Planes[i] = IntPtr(framePlanes[i]);
+                            planes->Strides[i] = strides[i];
+                        }
+                        planes->PixelFormat = pixelFormat;
+                        const char *name = unmanagedData->GetFramePixelFormatName();
+                        planes->PixelFormatName = (name == nullptr) ? nullptr : gcnew System::String(name);
+                        planes->Width = width;
+                        planes->Height = height;
+                    }
+
+                    //**********************************************************************
+                    // ReadFrames() decodes as many frames as fit in 'arena' (up to the length
+                    // of 'descriptors') in one call into the native reader, and returns the
+                    // number of frames read. Each frame is described by the matching entry
+                    // in 'descriptors'. Throws if the arena can't hold even one frame; the
+                    // frame is kept, and NextFrame() reports the buffer size it needs.
+                    //**********************************************************************
+                    int FFMPEGReader::ReadFrames(IntPtr arena, int arenaSize, array<FFMPEGFrameDescriptor>^ descriptors, [Out] bool %endOfStream)
+                    {
+                        endOfStream = false;
+                        if (descriptors->Length == 0)
+                        {
+                            return 0;
+                        }
+                        pin_ptr<FFMPEGFrameDescriptor> pinnedDescriptors = &descriptors[0];
+                        int framesRead = 0;
+                        bool eos = false;
+                        HRESULT hr = unmanagedData->ReadFrames((byte*)arena.ToPointer(), arenaSize, (FFMPEGFrameDescriptorNative*)pinnedDescriptors, descriptors->Length, &framesRead, &eos);
+                        if (FAILED(hr))
+                        {
+                            char buffer[512];
+                            sprintf(buffer, "Failed to read frames. HRESULT=0x%x", hr);
+                            throw gcnew Exception(gcnew System::String(buffer));
+                        }
+                        endOfStream = eos;
+                        return framesRead;
+                    }
+
                     //**********************************************************************
                     void FFMPEGReader::Close()
                     {
@@ -111,6 +371,7 @@ namespace Microsoft {
                             delete unmanagedData;
                             unmanagedData = nullptr;
                         }
+                        streamInput = nullptr;
                         if (FAILED(hr))
                         {
                             char buffer[512];
@@ -118,6 +379,48 @@ namespace Microsoft {
                             throw gcnew Exception(gcnew System::String(buffer));
                         }
                     }
+
+                    FFMPEGStreamInput::FFMPEGStreamInput(Stream^ stream) :
+                        stream(stream),
+                        buffer(gcnew array<Byte>(0))
+                    {
+                        Read = gcnew ReadDelegate(this, &FFMPEGStreamInput::ReadStream);
+                        Seek = stream->CanSeek ? gcnew SeekDelegate(this, &FFMPEGStreamInput::SeekStream) : nullptr;
+                    }
+
+                    //**********************************************************************
+                    // The callbacks. Exceptions must not unwind into the native reader, so
+                    // failures are reported as -1.
+                    //**********************************************************************
+                    int FFMPEGStreamInput::ReadStream(IntPtr opaque, IntPtr data, int size)
+                    {
+                        try
+                        {
+                            if (buffer->Length < size)
+                            {
+                                buffer = gcnew array<Byte>(size);
+                            }
+                            int bytesRead = stream->Read(buffer, 0, size);
+                            Marshal::Copy(buffer, 0, data, bytesRead);
+                            return bytesRead;
+                        }
+                        catch (Exception^)
+                        {
+                            return -1;
+                        }
+                    }
+
+                    Int64 FFMPEGStreamInput::SeekStream(IntPtr opaque, Int64 offset, int whence)
+                    {
+                        try
+                        {
+                            return (whence == FFMPEGSeekSize) ? stream->Length : stream->Seek(offset, static_cast<SeekOrigin>(whence));
+                        }
+                        catch (Exception^)
+                        {
+                            return -1;
+                        }
+                    }
                 }
             }
         }
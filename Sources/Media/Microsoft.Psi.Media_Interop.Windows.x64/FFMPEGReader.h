@@ -31,6 +31,45 @@ namespace Microsoft {
                     public ref class FFMPEGReaderConfiguration
                     {
                     public:
+                        static int ThreadTypeFrame = 1; // Decode multiple frames in parallel (adds latency)
+                        static int ThreadTypeSlice = 2; // Decode slices of a single frame in parallel
+
+                        FFMPEGReaderConfiguration()
+                        {
+                            DecodingThreads = 1;
+                            DecodingThreadType = 0;
+                            HardwareAcceleration = nullptr;
+                            PlanarOutput = false;
+                            DecodeAheadDepth = 0;
+                            FramePoolCapacity = 8;
+                            IOBufferSize = 0;
+                            LiveMode = false;
+                            LiveTransport = nullptr;
+                            LiveProbeSize = 0;
+                            LiveAnalyzeDurationMs = 0;
+                            LiveTimeoutMs = 0;
+                            LiveMaxReconnects = 10;
+                            KeyframesOnly = false;
+                            MaxOutputWidth = 0;
+                            MaxOutputHeight = 0;
+                        }
+
+                        property int DecodingThreads; // Number of video decoding threads (0 = one per core, 1 = single threaded)
+                        property int DecodingThreadType; // Combination of ThreadTypeFrame/ThreadTypeSlice (0 = codec default)
+                        property String^ HardwareAcceleration; // Video decode device: null (software), "auto", or an FFMPEG device type (e.g. "d3d11va")
+                        property bool PlanarOutput; // If true video is not converted to RGB; use FFMPEGReader::GetFramePlanes() instead
+                        property int DecodeAheadDepth; // Number of frames decoded ahead on a background thread (0 = decode on the caller's thread)
+                        property int FramePoolCapacity; // Number of released frame buffers kept for reuse by FFMPEGReader::ReadFrameBuffer()
+                        property int IOBufferSize; // Buffer size for files opened from streams, memory or mappings (0 = 64KB, or 1MB for mapped files)
+                        property bool LiveMode; // If true the file name is the URL of a live stream (RTSP, RTP, SRT, ...), ingested with low latency and reconnected when it drops out
+                        property String^ LiveTransport; // RTSP transport in live mode: "tcp", "udp", "udp_multicast" or "http" (null = FFMPEG's default)
+                        property int LiveProbeSize; // Bytes of a live stream probed for stream info when it is opened (0 = 32KB)
+                        property int LiveAnalyzeDurationMs; // Length of a live stream analyzed for stream info when it is opened (0 = 500ms)
+                        property int LiveTimeoutMs; // Longest a read from a live stream may block before reconnecting (0 = 5s)
+                        property bool KeyframesOnly; // If true only video keyframes are decoded (for fast scrubbing and thumbnails; seeks land on the keyframe at or before the target)
+                        property int MaxOutputWidth; // Video frames are scaled down to fit within MaxOutputWidth x MaxOutputHeight, keeping their aspect ratio (0 = unconstrained)
+                        property int MaxOutputHeight;
+                        property int LiveMaxReconnects; // Attempts made to reconnect a live stream that drops out (-1 = keep trying, 0 = never)
                     };
 
                     /// <summary>
@@ -44,6 +83,123 @@ namespace Microsoft {
                         static int FrameTypeAudio = 1;
                         property int FrameType; // Type of data to be returned next by call to ReadFrameData
                         property int BufferSize; // The size of the buffer required to hold the decompressed data
+                        property int StreamId; // Index of the stream the frame came from (see FFMPEGReader::SelectStreams)
+                    };
+
+                    /// <summary>
+                    /// Class used for describing one of the streams in an opened file.
+                    /// </summary>
+                    public ref class FFMPEGStreamInfo
+                    {
+                    public:
+                        property int StreamId; // Index of the stream in the file
+                        property int FrameType; // FFMPEGFrameInfo::FrameTypeVideo, FFMPEGFrameInfo::FrameTypeAudio or -1 for other streams
+                        property String^ CodecName; // FFMPEG's name for the stream's codec (e.g. "h264")
+                        property int Width; // Width of the video in pixels (0 for audio)
+                        property int Height; // Height of the video in pixels (0 for audio)
+                        property int AudioSampleRate; // Audio sample rate (0 for video)
+                        property int AudioNumChannels; // Number of audio channels (0 for video)
+                    };
+
+                    /// <summary>
+                    /// Class used for returning the planes of a video frame decoded
+                    /// in planar output mode. The plane pointers are owned by the
+                    /// reader and are only valid until the next call to ReadFrameData().
+                    /// </summary>
+                    public ref class FFMPEGFramePlanes
+                    {
+                    public:
+                        FFMPEGFramePlanes()
+                        {
+                            Planes = gcnew array<IntPtr>(4);
+                            Strides = gcnew array<int>(4);
+                        }
+
+                        property array<IntPtr>^ Planes; // Pointer to each plane (IntPtr::Zero if unused)
+                        property array<int>^ Strides; // Stride in bytes of each plane
+                        property int PixelFormat; // FFMPEG's AVPixelFormat for the frame
+                        property String^ PixelFormatName; // FFMPEG's name for the pixel format (e.g. "yuv420p")
+                        property int Width; // Width of the frame in pixels
+                        property int Height; // Height of the frame in pixels
+                    };
+
+                    /// <summary>
+                    /// Class holding a frame decoded by FFMPEGReader::ReadFrameBuffer(). The
+                    /// data lives in a buffer owned by the reader's frame pool and stays
+                    /// valid until the object is disposed, which hands the buffer back to
+                    /// the pool. Disposing after the reader has been closed is fine.
+                    /// </summary>
+                    public ref class FFMPEGFrameBuffer
+                    {
+                    private:
+                        FFMPEGFrameBufferNative *buffer;
+                    internal:
+                        FFMPEGFrameBuffer(FFMPEGFrameBufferNative *buffer, IntPtr data, int size, double timestamp) :
+                            buffer(buffer)
+                        {
+                            Data = data;
+                            Size = size;
+                            Timestamp = timestamp;
+                        }
+                    public:
+                        ~FFMPEGFrameBuffer()
+                        {
+                            this->!FFMPEGFrameBuffer();
+                        }
+
+                        !FFMPEGFrameBuffer()
+                        {
+                            if (buffer != nullptr)
+                            {
+                                FFMPEGReaderNative::ReleaseFrameBuffer(buffer);
+                                buffer = nullptr;
+                            }
+                            Data = IntPtr::Zero;
+                        }
+
+                        property IntPtr Data; // Pointer to the decoded (and converted) frame data
+                        property int Size; // Number of bytes of frame data
+                        property double Timestamp; // Presentation time of the frame in milliseconds
+                    };
+
+                    /// <summary>
+                    /// Describes one frame decoded by FFMPEGReader::ReadFrames(). The
+                    /// layout matches FFMPEGFrameDescriptorNative so arrays of these can
+                    /// be handed to the native reader directly.
+                    /// </summary>
+                    [StructLayout(LayoutKind::Sequential)]
+                    public value struct FFMPEGFrameDescriptor
+                    {
+                    public:
+                        int FrameType; // FFMPEGFrameInfo::FrameTypeVideo or FFMPEGFrameInfo::FrameTypeAudio
+                        int StreamId; // Index of the stream the frame came from
+                        int Offset; // Byte offset of the frame's data in the arena
+                        int Size; // Number of bytes of frame data
+                        double Timestamp; // Presentation time of the frame in milliseconds
+                        Int64 ArrivalMicrosecs; // Wall clock arrival time of the frame, in microseconds since 1/1/1970 UTC (see FFMPEGReader::FrameArrivalTime)
+                    };
+
+                    /// <summary>
+                    /// Adapts a Stream to the read/seek callbacks of
+                    /// FFMPEGReaderNative::OpenWithCallbacks(). The reader holds on to it
+                    /// (and so to the delegates the callbacks call) until it is closed.
+                    /// </summary>
+                    ref class FFMPEGStreamInput
+                    {
+                    private:
+                        Stream^ stream;
+                        array<Byte>^ buffer;
+                        int ReadStream(IntPtr opaque, IntPtr data, int size);
+                        Int64 SeekStream(IntPtr opaque, Int64 offset, int whence);
+                    public:
+                        [UnmanagedFunctionPointer(CallingConvention::Cdecl)]
+                        delegate int ReadDelegate(IntPtr opaque, IntPtr data, int size);
+                        [UnmanagedFunctionPointer(CallingConvention::Cdecl)]
+                        delegate Int64 SeekDelegate(IntPtr opaque, Int64 offset, int whence);
+
+                        FFMPEGStreamInput(Stream^ stream);
+                        property ReadDelegate^ Read;
+                        property SeekDelegate^ Seek; // nullptr if the stream can't seek
                     };
 
                     /// <summary>
@@ -53,12 +209,21 @@ namespace Microsoft {
                     {
                     private:
                         FFMPEGReaderNative * unmanagedData;
+                        FFMPEGStreamInput^ streamInput; // Input of a file opened with Open(Stream)
+                        void Configure(FFMPEGReaderConfiguration^ config);
                     public:
                         FFMPEGReader(int imageDepth) :
                             unmanagedData(nullptr)
                         {
                             unmanagedData = new FFMPEGReaderNative();
-                            unmanagedData->Initialize(imageDepth);
+                            unmanagedData->Initialize(imageDepth, 1, 0);
+                        }
+
+                        FFMPEGReader(int imageDepth, FFMPEGReaderConfiguration^ config) :
+                            unmanagedData(nullptr)
+                        {
+                            unmanagedData = new FFMPEGReaderNative();
+                            unmanagedData->Initialize(imageDepth, config->DecodingThreads, config->DecodingThreadType);
                         }
 
                         ~FFMPEGReader()
@@ -95,10 +260,89 @@ namespace Microsoft {
                             int get() { return (unmanagedData == nullptr) ? 0 : unmanagedData->GetAudioNumChannels(); }
                         }
 
+                        property bool IsHardwareAccelerated
+                        {
+                            bool get() { return (unmanagedData == nullptr) ? false : unmanagedData->IsHardwareAccelerated(); }
+                        }
+
+                        // Wall clock time (UTC) at which the last frame read arrived. For live streams this is when the
+                        // frame was received, which unlike the stream's own timestamps can be compared with local sensors.
+                        property DateTime FrameArrivalTime
+                        {
+                            DateTime get()
+                            {
+                                Int64 micros = (unmanagedData == nullptr) ? 0 : unmanagedData->GetFrameArrivalTime();
+                                return DateTime(1970, 1, 1, 0, 0, 0, DateTimeKind::Utc).AddTicks(micros * 10);
+                            }
+                        }
+
+                        property int ReconnectCount
+                        {
+                            int get() { return (unmanagedData == nullptr) ? 0 : unmanagedData->GetReconnectCount(); }
+                        }
+
+                        // Cost of converting decoded video frames to the output pixel format since Open()
+                        property Int64 ScaledFrameCount
+                        {
+                            Int64 get()
+                            {
+                                int64_t frames = 0, micros = 0;
+                                int rebuilds = 0;
+                                if (unmanagedData != nullptr)
+                                {
+                                    unmanagedData->GetScalerStats(&frames, &micros, &rebuilds);
+                                }
+                                return frames;
+                            }
+                        }
+
+                        property TimeSpan ScaleTime
+                        {
+                            TimeSpan get()
+                            {
+                                int64_t frames = 0, micros = 0;
+                                int rebuilds = 0;
+                                if (unmanagedData != nullptr)
+                                {
+                                    unmanagedData->GetScalerStats(&frames, &micros, &rebuilds);
+                                }
+                                return TimeSpan::FromTicks(micros * 10);
+                            }
+                        }
+
+                        property int ScalerRebuildCount
+                        {
+                            int get()
+                            {
+                                int64_t frames = 0, micros = 0;
+                                int rebuilds = 0;
+                                if (unmanagedData != nullptr)
+                                {
+                                    unmanagedData->GetScalerStats(&frames, &micros, &rebuilds);
+                                }
+                                return rebuilds;
+                            }
+                        }
+
+                        property int StreamCount
+                        {
+                            int get() { return (unmanagedData == nullptr) ? 0 : unmanagedData->GetStreamCount(); }
+                        }
+
                         void Open(String ^fn, FFMPEGReaderConfiguration^ config);
+                        void Open(Stream ^stream, FFMPEGReaderConfiguration^ config);
+                        void OpenFromBuffer(IntPtr data, Int64 size, FFMPEGReaderConfiguration^ config);
+                        void OpenMappedFile(String ^fn, FFMPEGReaderConfiguration^ config);
+                        FFMPEGStreamInfo^ GetStreamInfo(int streamId);
+                        void SelectStreams(array<int>^ streamIds);
                         void Close();
+                        void Seek(double timestampMillisecs);
+                        void SetReadRange(double startMillisecs, double endMillisecs);
                         bool NextFrame(FFMPEGFrameInfo ^%info, [Out] bool %eos);
                         bool ReadFrameData(IntPtr dataBuffer, int %bufferSize, double %timestamp);
+                        bool ReadFrameBuffer([Out] FFMPEGFrameBuffer ^%frameBuffer);
+                        void GetFramePlanes(FFMPEGFramePlanes ^%planes);
+                        int ReadFrames(IntPtr arena, int arenaSize, array<FFMPEGFrameDescriptor>^ descriptors, [Out] bool %eos);
                     };
 
                 }
@@ -4,7 +4,11 @@
 #include "StdAfx.h"
 #include <atlbase.h>
 #include <mmreg.h>
+#include <codecapi.h>
+#include <new>
 #include "MP4Writer.h"
+#include "MediaConversion.h"
+#include "MediaTrace.h"
 
 using namespace System::Runtime::InteropServices;
 
@@ -14,6 +18,71 @@ namespace Microsoft {
 
 #define IFS(expr) do { if (SUCCEEDED(hr)) hr = expr; } while(0)
 
+            // Number of returned samples each sample pool keeps for reuse, on top
+            // of the write queue's size. Covers the frames the encoder holds on to.
+            static const UINT32 SamplePoolSize = 8;
+
+            // Default AAC bitrate (in bits/sec), and how far (in 100ns units) the
+            // timestamps of audio buffers may drift from the number of samples
+            // written before we resynchronize to them
+            static const UINT32 DefaultAACBitrate = 192000;
+            static const LONGLONG AudioResyncThreshold = 2000000;
+
+            //**********************************************************************
+            // Per-level limits from the H.264 (Table A-1) and H.265 (Table A.8)
+            // specifications. For H.264 the frame size and rate limits are in
+            // 16x16 macroblocks, for H.265 in luma samples. Bitrates are the Main
+            // profile (main tier) limits in kbit/s. 'level' is the value MF expects
+            // in MF_MT_MPEG2_LEVEL (eAVEncH264VLevel* / eAVEncH265VLevel*).
+            //**********************************************************************
+            struct CodecLevelLimits
+            {
+                UINT32 level;
+                UINT64 maxFrameSize;
+                UINT64 maxRate;
+                UINT32 maxBitrateKbps;
+            };
+
+            static const CodecLevelLimits H264Levels[] =
+            {
+                { eAVEncH264VLevel1,   99,     1485,     64 },
+                { eAVEncH264VLevel1_1, 396,    3000,     192 },
+                { eAVEncH264VLevel1_2, 396,    6000,     384 },
+                { eAVEncH264VLevel1_3, 396,    11880,    768 },
+                { eAVEncH264VLevel2,   396,    11880,    2000 },
+                { eAVEncH264VLevel2_1, 792,    19800,    4000 },
+                { eAVEncH264VLevel2_2, 1620,   20250,    4000 },
+                { eAVEncH264VLevel3,   1620,   40500,    10000 },
+                { eAVEncH264VLevel3_1, 3600,   108000,   14000 },
+                { eAVEncH264VLevel3_2, 5120,   216000,   20000 },
+                { eAVEncH264VLevel4,   8192,   245760,   20000 },
+                { eAVEncH264VLevel4_1, 8192,   245760,   50000 },
+                { eAVEncH264VLevel4_2, 8704,   522240,   50000 },
+                { eAVEncH264VLevel5,   22080,  589824,   135000 },
+                { eAVEncH264VLevel5_1, 36864,  983040,   240000 },
+                { eAVEncH264VLevel5_2, 36864,  2073600,  240000 },
+                { 60,                  139264, 4177920,  240000 },  // Levels 6 to 6.2 are missing from older SDKs' eAVEncH264VLevel
+                { 61,                  139264, 8355840,  480000 },
+                { 62,                  139264, 16711680, 800000 },
+            };
+
+            static const CodecLevelLimits H265Levels[] =
+            {
+                { eAVEncH265VLevel1,   36864,    552960,     128 },
+                { eAVEncH265VLevel2,   122880,   3686400,    1500 },
+                { eAVEncH265VLevel2_1, 245760,   7372800,    3000 },
+                { eAVEncH265VLevel3,   552960,   16588800,   6000 },
+                { eAVEncH265VLevel3_1, 983040,   33177600,   10000 },
+                { eAVEncH265VLevel4,   2228224,  66846720,   12000 },
+                { eAVEncH265VLevel4_1, 2228224,  133693440,  20000 },
+                { eAVEncH265VLevel5,   8912896,  267386880,  25000 },
+                { eAVEncH265VLevel5_1, 8912896,  534773760,  40000 },
+                { eAVEncH265VLevel5_2, 8912896,  1069547520, 60000 },
+                { eAVEncH265VLevel6,   35651584, 1069547520, 60000 },
+                { eAVEncH265VLevel6_1, 35651584, 2139095040, 120000 },
+                { eAVEncH265VLevel6_2, 35651584, 4278190080, 240000 },
+            };
+
             //**********************************************************************  
             // Define ctor for object that contains the unmanaged data associated
             // with a MP4Writer object
@@ -23,6 +92,9 @@ namespace Microsoft {
                 numFramesWritten(0),
                 outputWidth(0),
                 outputHeight(0),
+                inputBytesPerPixel(0),
+                frameBufferSize(0),
+                convertToNV12(false),
                 frameRateNumerator(0),
                 frameRateDenominator(0),
                 targetBitrate(0),
@@ -31,66 +103,374 @@ namespace Microsoft {
                 audioStreamIndex(0),
                 lastVideoTimestamp(0),
                 lastAudioTimestamp(0),
-                numAudioSamplesWritten(0)
+                numAudioSamplesWritten(0),
+                writeQueue(nullptr),
+                writeQueueSize(0),
+                writeQueueHead(0),
+                writeQueueCount(0),
+                dropFramesWhenQueueFull(false),
+                stopWriting(false),
+                writeError(S_OK),
+                numFramesDropped(0),
+                writeThread(nullptr),
+                videoSamplePool(nullptr),
+                audioSamplePool(nullptr),
+                segmentIndex(0),
+                segmentStartTime(0),
+                audioOutputSampleRate(0),
+                audioOutputChannels(0),
+                audioResampler(nullptr),
+                audioInputBaseTime(0),
+                audioInputFrames(0),
+                audioOutputBaseTime(0),
+                audioOutputFrames(0)
+            {
+                encoderSettings.videoCodec = NativeVideoCodec_H264;
+                encoderSettings.useHardwareEncoder = false;
+                encoderSettings.disableThrottling = false;
+                encoderSettings.lowLatency = false;
+                encoderSettings.rateControlMode = -1;
+                encoderSettings.gopSize = -1;
+                encoderSettings.bFrameCount = -1;
+                encoderSettings.qualityVsSpeed = -1;
+                encoderSettings.quality = -1;
+                outputSettings.fragmented = false;
+                outputSettings.fragmentDuration = 0;
+                outputSettings.segmentDuration = 0;
+                outputSettings.segmentMaxBytes = 0;
+                audioSettings.outputSampleRate = 0;
+                audioSettings.outputChannels = 0;
+                audioSettings.bitrate = 0;
+                threadPolicy = Media::Threading::MakeThreadPolicy(Media::Threading::ThreadPriority_Normal, Media::Threading::ThreadTask_Capture, 0);
+                InitializeCriticalSection(&writeQueueLock);
+                InitializeConditionVariable(&writeQueueNotEmpty);
+                InitializeConditionVariable(&writeQueueNotFull);
+            }
+
+            //**********************************************************************
+            MP4WriterUnmanagedData::~MP4WriterUnmanagedData()
+            {
+                StopWriteThread();
+                FreeAudioResampler();
+                FreeSamplePools();
+                DeleteCriticalSection(&writeQueueLock);
+            }
+
+            //**********************************************************************
+            // SetEncoderSettings() selects the output codec and tunes the encoder.
+            // It must be called before Open().
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::SetEncoderSettings(const MP4WriterEncoderSettings &settings)
+            {
+                if (!closed)
+                {
+                    return E_UNEXPECTED;
+                }
+                if (settings.videoCodec != NativeVideoCodec_H264 && settings.videoCodec != NativeVideoCodec_HEVC)
+                {
+                    return E_INVALIDARG;
+                }
+                if (settings.qualityVsSpeed > 100 || settings.quality > 100)
+                {
+                    return E_INVALIDARG;
+                }
+                encoderSettings = settings;
+                return S_OK;
+            }
+
+            //**********************************************************************
+            // SetOutputSettings() selects fragmented output and segment rollover.
+            // It must be called before Open().
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::SetOutputSettings(const MP4WriterOutputSettings &settings)
+            {
+                if (!closed)
+                {
+                    return E_UNEXPECTED;
+                }
+                if (settings.fragmentDuration < 0 || settings.segmentDuration < 0)
+                {
+                    return E_INVALIDARG;
+                }
+                outputSettings = settings;
+                return S_OK;
+            }
+
+            //**********************************************************************
+            // SetAudioSettings() selects the AAC output format. It must be called
+            // before Open(). The values are those the MF AAC encoder supports.
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::SetAudioSettings(const MP4WriterAudioSettings &settings)
             {
+                if (!closed)
+                {
+                    return E_UNEXPECTED;
+                }
+                if ((settings.outputSampleRate != 0 && settings.outputSampleRate != 44100 && settings.outputSampleRate != 48000) ||
+                    (settings.outputChannels != 0 && settings.outputChannels != 1 && settings.outputChannels != 2 && settings.outputChannels != 6) ||
+                    (settings.bitrate != 0 && settings.bitrate != 96000 && settings.bitrate != 128000 && settings.bitrate != 160000 && settings.bitrate != 192000))
+                {
+                    return E_INVALIDARG;
+                }
+                audioSettings = settings;
+                return S_OK;
+            }
+
+            //**********************************************************************
+            // SetThreadPolicy() sets the scheduling of the threads doing the
+            // encoding (see ThreadPolicy.h): the sink writer's work queue threads
+            // are registered with the matching MMCSS task, and the background
+            // encode thread (see StartWriteThread()) gets the priority and the
+            // affinity. It must be called before Open().
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::SetThreadPolicy(int priority, UINT64 affinityMask)
+            {
+                if (!closed)
+                {
+                    return E_UNEXPECTED;
+                }
+                if (priority < Media::Threading::ThreadPriority_Lowest || priority > Media::Threading::ThreadPriority_Highest)
+                {
+                    return E_INVALIDARG;
+                }
+                threadPolicy = Media::Threading::MakeThreadPolicy(priority, Media::Threading::ThreadTask_Capture, affinityMask);
+                return S_OK;
+            }
+
+            //**********************************************************************
+            // Picks the lowest level of the selected codec that can carry video of
+            // the given size, frame rate and bitrate. Fails with E_INVALIDARG if
+            // not even the highest level can. Both specs also bound each
+            // dimension by sqrt(8 * maxFrameSize), which rules out extreme aspect
+            // ratios. H.264 streams above level 4.2 (i.e. larger than 1080p) use
+            // the High profile, and are held to its bitrate limits; otherwise we
+            // leave the profile to the encoder and hold them to Main's.
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::SelectProfileAndLevel(int videoCodec, UINT32 width, UINT32 height, UINT32 frameRateNum, UINT32 frameRateDenom, UINT32 bitrate,
+                UINT32 *profile, UINT32 *level)
+            {
+                const CodecLevelLimits *levels;
+                size_t numLevels;
+                UINT64 frameWidth;
+                UINT64 frameHeight;
+                if (videoCodec == NativeVideoCodec_HEVC)
+                {
+                    levels = H265Levels;
+                    numLevels = ARRAYSIZE(H265Levels);
+                    frameWidth = width;
+                    frameHeight = height;
+                }
+                else
+                {
+                    levels = H264Levels;
+                    numLevels = ARRAYSIZE(H264Levels);
+                    frameWidth = (width + 15) / 16;
+                    frameHeight = (height + 15) / 16;
+                }
+
+                UINT64 frameSize = frameWidth * frameHeight;
+                UINT64 rate = (frameRateDenom == 0) ? 0 : (frameSize * frameRateNum + frameRateDenom - 1) / frameRateDenom;
+                for (size_t i = 0; i < numLevels; i++)
+                {
+                    const CodecLevelLimits &limits = levels[i];
+                    UINT32 levelProfile;
+                    UINT64 maxBitrate = (UINT64)limits.maxBitrateKbps * 1000;
+                    if (videoCodec == NativeVideoCodec_HEVC)
+                    {
+                        levelProfile = eAVEncH265VProfile_Main_420_8;
+                    }
+                    else if (limits.level > (UINT32)eAVEncH264VLevel4_2)
+                    {
+                        // High profile allows 1.25x the Main profile bitrate (Table A-2, cpbBrNalFactor)
+                        levelProfile = eAVEncH264VProfile_High;
+                        maxBitrate = maxBitrate * 5 / 4;
+                    }
+                    else
+                    {
+                        levelProfile = 0;
+                    }
+
+                    if (frameSize <= limits.maxFrameSize &&
+                        frameWidth * frameWidth <= 8 * limits.maxFrameSize &&
+                        frameHeight * frameHeight <= 8 * limits.maxFrameSize &&
+                        rate <= limits.maxRate &&
+                        bitrate <= maxBitrate)
+                    {
+                        *level = limits.level;
+                        *profile = levelProfile;
+                        return S_OK;
+                    }
+                }
+                return E_INVALIDARG;
+            }
+
+            //**********************************************************************
+            // Builds the encoding parameters handed to the sink writer along with
+            // the video input type. The sink writer applies these to the encoder
+            // MFT through ICodecAPI before it starts streaming, which is the only
+            // point at which encoders are guaranteed to accept them.
+            // The fragmented MP4 sink closes a fragment at each key frame, so in
+            // fragmented mode the GOP size (unless set explicitly) is derived from
+            // the fragment duration.
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::CreateEncodingParameters(IMFAttributes **encodingParameters)
+            {
+                CComPtr<IMFAttributes> parameters;
+                HRESULT hr = S_OK;
+                IFS(MFCreateAttributes(&parameters, 6));
+                if (encoderSettings.lowLatency)
+                {
+                    IFS(parameters->SetUINT32(CODECAPI_AVLowLatencyMode, TRUE));
+                }
+                if (encoderSettings.rateControlMode >= 0)
+                {
+                    IFS(parameters->SetUINT32(CODECAPI_AVEncCommonRateControlMode, (UINT32)encoderSettings.rateControlMode));
+                    IFS(parameters->SetUINT32(CODECAPI_AVEncCommonMeanBitRate, targetBitrate));
+                }
+                if (encoderSettings.gopSize >= 0)
+                {
+                    IFS(parameters->SetUINT32(CODECAPI_AVEncMPVGOPSize, (UINT32)encoderSettings.gopSize));
+                }
+                else if (outputSettings.fragmented && outputSettings.fragmentDuration > 0 && frameRateDenominator != 0)
+                {
+                    UINT64 gopSize = (UINT64)outputSettings.fragmentDuration * frameRateNumerator / ((UINT64)frameRateDenominator * 10000000);
+                    IFS(parameters->SetUINT32(CODECAPI_AVEncMPVGOPSize, (gopSize == 0) ? 1 : (gopSize > UINT_MAX) ? UINT_MAX : (UINT32)gopSize));
+                }
+                if (encoderSettings.bFrameCount >= 0)
+                {
+                    IFS(parameters->SetUINT32(CODECAPI_AVEncMPVDefaultBPictureCount, (UINT32)encoderSettings.bFrameCount));
+                }
+                if (encoderSettings.qualityVsSpeed >= 0)
+                {
+                    IFS(parameters->SetUINT32(CODECAPI_AVEncCommonQualityVsSpeed, (UINT32)encoderSettings.qualityVsSpeed));
+                }
+                if (encoderSettings.quality >= 0)
+                {
+                    IFS(parameters->SetUINT32(CODECAPI_AVEncCommonQuality, (UINT32)encoderSettings.quality));
+                }
+                if (SUCCEEDED(hr))
+                {
+                    *encodingParameters = parameters.Detach();
+                }
+                return hr;
+            }
+
+            //**********************************************************************
+            // Builds an uncompressed PCM audio media type
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::CreatePCMMediaType(UINT32 bitsPerSample, UINT32 samplesPerSecond, UINT32 numChannels, IMFMediaType **mediaType)
+            {
+                CComPtr<IMFMediaType> type;
+                UINT32 blockAlignment = numChannels * (bitsPerSample / 8);
+                HRESULT hr = MFCreateMediaType(&type);
+                IFS(type->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio));
+                IFS(type->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM));
+                IFS(type->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, bitsPerSample));
+                IFS(type->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, samplesPerSecond));
+                IFS(type->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, numChannels));
+                IFS(type->SetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT, blockAlignment));
+                IFS(type->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, blockAlignment * samplesPerSecond));
+                IFS(type->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE));
+                IFS(type->SetUINT32(MF_MT_FIXED_SIZE_SAMPLES, TRUE));
+                if (SUCCEEDED(hr))
+                {
+                    *mediaType = type.Detach();
+                }
+                return hr;
             }
 
             //**********************************************************************
-            // Sets up our Media Foundation writer for handling audio. This code always generates
-            // AAC for the audio output and assumes the audio input is always PCM
+            // Builds the media types of the audio stream. The output is always AAC
+            // and the input is always PCM. The AAC encoder only takes 16-bit audio
+            // at 44.1 or 48 kHz with 1, 2 or 6 channels, so unless the output
+            // format is configured (see SetAudioSettings()) we keep as much of the
+            // input format as it allows, and if the input still doesn't match we
+            // put a resampler in front of the encoder.
             //**********************************************************************
             HRESULT MP4WriterUnmanagedData::SetupAudio(UINT32 bitsPerSample, UINT32 samplesPerSecond, UINT32 numChannels)
             {
-                CComPtr<IMFMediaType> audioMediaOutputType;
+                if (bitsPerSample == 0 || bitsPerSample % 8 != 0 || samplesPerSecond == 0 || numChannels == 0)
+                {
+                    return E_INVALIDARG;
+                }
 
-                // Add audio output
+                audioOutputSampleRate = audioSettings.outputSampleRate;
+                if (audioOutputSampleRate == 0)
+                {
+                    audioOutputSampleRate = (samplesPerSecond == 44100) ? 44100 : 48000;
+                }
+                audioOutputChannels = audioSettings.outputChannels;
+                if (audioOutputChannels == 0)
+                {
+                    audioOutputChannels = (numChannels == 1 || numChannels == 6) ? numChannels : 2;
+                }
+                UINT32 bitrate = (audioSettings.bitrate != 0) ? audioSettings.bitrate : DefaultAACBitrate;
+
+                // AAC profile level 2 covers up to 2 channels at 48 kHz, level 4 up to 5.1
+                UINT32 profileLevel = (audioOutputChannels > 2) ? 0x2A : 0x29;
+
+                // Define audio output
                 // For complete description of these parameters see:
                 //           http://msdn.microsoft.com/en-us/library/windows/desktop/dd742785(v=vs.85).aspx
+                CComPtr<IMFMediaType> audioMediaOutputType;
                 HRESULT hr = S_OK;
                 IFS(MFCreateMediaType(&audioMediaOutputType));
                 IFS(audioMediaOutputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio));
                 IFS(audioMediaOutputType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_AAC));
                 IFS(audioMediaOutputType->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, 16));
-                IFS(audioMediaOutputType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, 48000));
-                IFS(audioMediaOutputType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, 24000));
-                IFS(audioMediaOutputType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, 2));
-                IFS(audioMediaOutputType->SetUINT32(MF_MT_AAC_AUDIO_PROFILE_LEVEL_INDICATION, 0x29));
+                IFS(audioMediaOutputType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, audioOutputSampleRate));
+                IFS(audioMediaOutputType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, bitrate / 8));
+                IFS(audioMediaOutputType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, audioOutputChannels));
+                IFS(audioMediaOutputType->SetUINT32(MF_MT_AAC_AUDIO_PROFILE_LEVEL_INDICATION, profileLevel));
                 IFS(audioMediaOutputType->SetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT, 1));
                 IFS(audioMediaOutputType->SetUINT32(MF_MT_FIXED_SIZE_SAMPLES, TRUE));
 
                 //**********************************************************************
                 // MF's handling of MPEG is different. We have to include the following
-                // block of data. This block represents the AudioSpecificConfig() portion of MP4.
+                // block of data: the rest of the HEAACWAVEINFO structure (payload type
+                // and profile level), followed by the AudioSpecificConfig() portion of MP4.
                 // See the following articles for more details:
                 //  http://msdn.microsoft.com/en-us/library/windows/desktop/dd742784(v=vs.85).aspx
                 //  http://www.wiki.multimedia.cx/index.php?title=MPEG-4_Audio#Sampling_Frequencies
-                // The upshot is that the important bits are the last two bytes, which are defined
-                // as (in bits):
+                // AudioSpecificConfig() is two bytes, defined as (in bits):
                 //    00010             : AAC LC (Low Complexity)
-                //         0011         : Index 3, which is 48KHz
-                //             0010     : 2 Channels
+                //         xxxx         : Sampling frequency index (3 = 48KHz, 4 = 44.1KHz)
+                //             xxxx     : Channel configuration (1, 2 or 6 channels)
                 //                  000 : Reserved stuff
-                // ============================================
-                //    0001 0001 1001 0000 = 0x11 0x90
-                // The MSDN documentation shows this as 0x11, 0xb0, but this is for 48000Hz, with 6 channel audio
+                // e.g. 48KHz stereo is 0001 0001 1001 0000 = 0x11 0x90
                 //**********************************************************************
-                BYTE buffer[] = { 0x00, 0x00, 0x29, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x11, 0x90 };
+                UINT32 frequencyIndex = (audioOutputSampleRate == 44100) ? 4 : 3;
+                BYTE buffer[] = { 0x00, 0x00, (BYTE)profileLevel, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                    (BYTE)((2 << 3) | (frequencyIndex >> 1)), (BYTE)(((frequencyIndex & 1) << 7) | (audioOutputChannels << 3)) };
                 IFS(audioMediaOutputType->SetBlob(MF_MT_USER_DATA, buffer, sizeof(buffer)));
-                IFS(writer->AddStream(audioMediaOutputType, &audioStreamIndex));
 
+                // The encoder is fed 16-bit PCM in the output format. If the input
+                // is in some other format it goes through the resampler first.
                 CComPtr<IMFMediaType> audioMediaInputType;
-                IFS(MFCreateMediaType(&audioMediaInputType));
-                IFS(audioMediaInputType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio));
-                IFS(audioMediaInputType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM));
-                IFS(audioMediaInputType->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, bitsPerSample));
-                IFS(audioMediaInputType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, samplesPerSecond));
-                IFS(audioMediaInputType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, numChannels));
-                IFS(audioMediaInputType->SetUINT32(MF_MT_FIXED_SIZE_SAMPLES, TRUE));
-
-                IFS(writer->SetInputMediaType(audioStreamIndex, audioMediaInputType, nullptr));
+                IFS(CreatePCMMediaType(16, audioOutputSampleRate, audioOutputChannels, &audioMediaInputType));
+                if (SUCCEEDED(hr) && (bitsPerSample != 16 || samplesPerSecond != audioOutputSampleRate || numChannels != audioOutputChannels))
+                {
+                    CComPtr<IMFMediaType> sourceMediaType;
+                    IFS(CreatePCMMediaType(bitsPerSample, samplesPerSecond, numChannels, &sourceMediaType));
+                    IFS(MP4WriterAudioResampler::CreateInstance(sourceMediaType, audioMediaInputType, &audioResampler));
+                }
+                if (SUCCEEDED(hr))
+                {
+                    audioOutputMediaType = audioMediaOutputType;
+                    audioInputMediaType = audioMediaInputType;
+                }
                 return hr;
             }
 
+            //**********************************************************************
+            // Releases the audio resampler (if any)
+            //**********************************************************************
+            void MP4WriterUnmanagedData::FreeAudioResampler()
+            {
+                delete audioResampler;
+                audioResampler = nullptr;
+            }
+
             //**********************************************************************
             // Open() must be called before adding image or audio samples to
             // the final MP4 file.
@@ -107,16 +487,20 @@ namespace Microsoft {
             //           128000, 384000, 528560, 4000000, or 10000000
             //   pixelFormat - is the pixel format that each input image (passed to WriteVideoFrame)
             //           is assumed to be
+            //   toNV12 - if true color images are converted to NV12 before they are passed to the
+            //           encoder (gray images always are)
             //   containsAudio - if true then the MP4 file will have an audio stream (filled
             //           by the client by calling WriteAudioSample)
             //   bitsPerSample - Bits per audio sample for the input audio. Typically this is 16.
             //   samplesPerSample - Bitrate of the input audio. Typically this is 48000.
-            //   numChannels - Number of audio channels. This is assumed to be either 1 or 2.
-            //   outputFilename - name of the output file for the generated .mp4 file
+            //   numChannels - Number of audio channels. Typically this is 1 or 2.
+            //           (audio is resampled and remixed as needed, see SetupAudio())
+            //   filename - name of the output file for the generated .mp4 file (see
+            //           GetSegmentFilename() for how segments are named)
             //**********************************************************************
-            HRESULT MP4WriterUnmanagedData::Open(UINT32 imageWidth, UINT32 imageHeight, UINT32 frameRateNum, UINT32 frameRateDenom, UINT32 bitrate, int pixelFormat,
+            HRESULT MP4WriterUnmanagedData::Open(UINT32 imageWidth, UINT32 imageHeight, UINT32 frameRateNum, UINT32 frameRateDenom, UINT32 bitrate, int pixelFormat, bool toNV12,
                 bool containsAudio, UINT32 bitsPerSample, UINT32 samplesPerSecond, UINT32 numChannels,
-                wchar_t *outputFilename)
+                wchar_t *filename)
             {
                 hasAudio = containsAudio;
                 outputWidth = imageWidth;
@@ -130,126 +514,502 @@ namespace Microsoft {
                 audioSamplesPerSecond = samplesPerSecond;
                 audioNumChannels = numChannels;
                 firstTimestamp = 0;
+                outputFilename = filename;
+                segmentIndex = 0;
+                segmentStartTime = 0;
 
-                // H264 only supports even pixel dimensions and formats up to 2048. For HD video we would need
-                // to switch to H265 or some other encoding method.
-                if (outputWidth % 2 != 0 || outputHeight % 2 != 0 || outputWidth > 2048 || outputHeight > 2048)
+                // Both codecs only support even pixel dimensions, and the frame size and rate must
+                // fit within one of the codec's levels
+                if (outputWidth % 2 != 0 || outputHeight % 2 != 0)
                 {
                     return E_INVALIDARG;
                 }
-
-                HRESULT hr = S_OK;
-                IFS(MFCreateSinkWriterFromURL(outputFilename, nullptr, nullptr, &writer));
+                UINT32 profile = 0;
+                UINT32 level = 0;
+                HRESULT hr = SelectProfileAndLevel(encoderSettings.videoCodec, outputWidth, outputHeight, frameRateNumerator, frameRateDenominator, targetBitrate,
+                    &profile, &level);
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
 
                 // Define our output media type
+                outputMediaType = nullptr;
                 IFS(MFCreateMediaType(&outputMediaType));
                 IFS(outputMediaType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
-                IFS(outputMediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264));
+                IFS(outputMediaType->SetGUID(MF_MT_SUBTYPE, (encoderSettings.videoCodec == NativeVideoCodec_HEVC) ? MFVideoFormat_HEVC : MFVideoFormat_H264));
                 IFS(MFSetAttributeRatio(outputMediaType, MF_MT_FRAME_RATE, frameRateNumerator, frameRateDenominator));
                 IFS(MFSetAttributeSize(outputMediaType, MF_MT_FRAME_SIZE, outputWidth, outputHeight));
                 IFS(MFSetAttributeRatio(outputMediaType, MF_MT_PIXEL_ASPECT_RATIO, 1, 1));
                 IFS(outputMediaType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
                 IFS(outputMediaType->SetUINT32(MF_MT_AVG_BITRATE, targetBitrate));
-                IFS(writer->AddStream(outputMediaType, &videoStreamIndex));
+                IFS(outputMediaType->SetUINT32(MF_MT_MPEG2_LEVEL, level));
+                if (profile != 0)
+                {
+                    IFS(outputMediaType->SetUINT32(MF_MT_MPEG2_PROFILE, profile));
+                }
 
                 // Define the input media type
+                inputMediaType = nullptr;
                 IFS(MFCreateMediaType(&inputMediaType));
                 IFS(inputMediaType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video));
+                convertToNV12 = toNV12;
                 switch (pixelFormat)
                 {
                 case NativePixelFormat_Undefined:
-                case NativePixelFormat_Gray_8bpp:
-                case NativePixelFormat_Gray_16bpp:
                 case NativePixelFormat_RGBA_64bpp:
                     hr = E_NOTIMPL;
                     break;
+                case NativePixelFormat_Gray_8bpp:
+                    // MF has no gray input format for the encoders, so gray is always converted
+                    convertToNV12 = true;
+                    inputBytesPerPixel = 1;
+                    break;
+                case NativePixelFormat_Gray_16bpp:
+                    convertToNV12 = true;
+                    inputBytesPerPixel = 2;
+                    break;
                 case NativePixelFormat_BGRA_32bpp:
                 case NativePixelFormat_BGRX_32bpp:
                     IFS(inputMediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB32));
+                    inputBytesPerPixel = 4;
                     break;
                 case NativePixelFormat_BGR_24bpp:
                     IFS(inputMediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB24));
+                    inputBytesPerPixel = 3;
                     break;
                 }
+                frameBufferSize = outputWidth * outputHeight * inputBytesPerPixel;
+                if (convertToNV12)
+                {
+                    // Our converter produces BT.709 limited range, top-down NV12
+                    IFS(inputMediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12));
+                    IFS(inputMediaType->SetUINT32(MF_MT_DEFAULT_STRIDE, outputWidth));
+                    IFS(inputMediaType->SetUINT32(MF_MT_YUV_MATRIX, MFVideoTransferMatrix_BT709));
+                    IFS(inputMediaType->SetUINT32(MF_MT_VIDEO_NOMINAL_RANGE, MFNominalRange_16_235));
+                    frameBufferSize = outputWidth * outputHeight * 3 / 2;
+                }
                 IFS(MFSetAttributeRatio(inputMediaType, MF_MT_FRAME_RATE, frameRateNumerator, frameRateDenominator));
                 IFS(MFSetAttributeSize(inputMediaType, MF_MT_FRAME_SIZE, outputWidth, outputHeight));
                 IFS(inputMediaType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive));
                 IFS(MFSetAttributeRatio(inputMediaType, MF_MT_PIXEL_ASPECT_RATIO, 1, 1));
-                IFS(writer->SetInputMediaType(videoStreamIndex, inputMediaType, nullptr));
+                encodingParameters = nullptr;
+                IFS(CreateEncodingParameters(&encodingParameters));
 
+                audioOutputMediaType = nullptr;
+                audioInputMediaType = nullptr;
+                FreeAudioResampler();
+                audioInputBaseTime = 0;
+                audioInputFrames = 0;
+                audioOutputBaseTime = 0;
+                audioOutputFrames = 0;
                 if (containsAudio)
                 {
                     IFS(SetupAudio(bitsPerSample, samplesPerSecond, numChannels));
                 }
 
-                IFS(writer->BeginWriting());
+                // Frames and audio buffers are written from recycled samples rather
+                // than allocating a fresh COM buffer per sample
+                IFS(MP4WriterSamplePool::CreateInstance(SamplePoolSize, &videoSamplePool));
+                IFS(MP4WriterSamplePool::CreateInstance(SamplePoolSize, &audioSamplePool));
+
+                IFS(OpenSegment());
                 closed = false;
                 return hr;
             }
 
             //**********************************************************************
-            // Copies the image data (from our managed Microsoft::Psi::Image object)
-            // to the media buffer provided by MF.
+            // StartWriteThread() switches the writer to asynchronous mode: from here
+            // on WriteVideoFrame() and WriteAudioSample() only prepare the sample
+            // and queue it, and a dedicated encode thread feeds the queue to the
+            // sink writer. This keeps the caller (typically a Psi pipeline thread)
+            // from stalling whenever the encoder does.
+            // Parameters:
+            //   queueSize - maximum number of samples that may be waiting to be encoded
+            //   dropWhenFull - if true a video frame that arrives while the queue is
+            //           full is dropped (and counted, see GetNumFramesDropped()),
+            //           otherwise the caller waits for room. Audio is never dropped.
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::StartWriteThread(UINT32 queueSize, bool dropWhenFull)
+            {
+                if (closed || writeThread != nullptr || queueSize == 0)
+                {
+                    return E_UNEXPECTED;
+                }
+
+                writeQueue = new (std::nothrow) MP4WriterQueuedSample[queueSize];
+                if (writeQueue == nullptr)
+                {
+                    return E_OUTOFMEMORY;
+                }
+                writeQueueSize = queueSize;
+                videoSamplePool->SetMaxFreeSamples(SamplePoolSize + queueSize);
+                audioSamplePool->SetMaxFreeSamples(SamplePoolSize + queueSize);
+                writeQueueHead = 0;
+                writeQueueCount = 0;
+                dropFramesWhenQueueFull = dropWhenFull;
+                stopWriting = false;
+                writeError = S_OK;
+
+                writeThread = CreateThread(nullptr, 0, WriteThreadProc, this, 0, nullptr);
+                if (writeThread == nullptr)
+                {
+                    delete[] writeQueue;
+                    writeQueue = nullptr;
+                    return HRESULT_FROM_WIN32(GetLastError());
+                }
+                return S_OK;
+            }
+
             //**********************************************************************
-            HRESULT MP4WriterUnmanagedData::CopyImageDataToMediaBuffer(IntPtr imageData, int pixelFormat, BYTE *outputBuffer)
+            // Tells the encode thread to finish the samples still queued, waits
+            // for it to exit and frees the queue.
+            //**********************************************************************
+            void MP4WriterUnmanagedData::StopWriteThread()
             {
-                BYTE *dstRow = outputBuffer;
-                BYTE *srcRow = (BYTE*)imageData.ToPointer();
-                BYTE *srcCol;
-                BYTE *dstCol;
-                for (UINT32 y = 0; y < outputHeight; y++)
+                if (writeThread == nullptr)
                 {
-                    switch (pixelFormat)
+                    return;
+                }
+
+                EnterCriticalSection(&writeQueueLock);
+                stopWriting = true;
+                LeaveCriticalSection(&writeQueueLock);
+                WakeConditionVariable(&writeQueueNotEmpty);
+
+                WaitForSingleObject(writeThread, INFINITE);
+                CloseHandle(writeThread);
+                writeThread = nullptr;
+                delete[] writeQueue;
+                writeQueue = nullptr;
+                writeQueueCount = 0;
+            }
+
+            //**********************************************************************
+            // Releases the sample pools. Samples the sink writer still holds are
+            // freed when it lets go of them.
+            //**********************************************************************
+            void MP4WriterUnmanagedData::FreeSamplePools()
+            {
+                if (videoSamplePool != nullptr)
+                {
+                    videoSamplePool->Shutdown();
+                    videoSamplePool->Release();
+                    videoSamplePool = nullptr;
+                }
+                if (audioSamplePool != nullptr)
+                {
+                    audioSamplePool->Shutdown();
+                    audioSamplePool->Release();
+                    audioSamplePool = nullptr;
+                }
+            }
+
+            //**********************************************************************
+            // Hands a finished sample to the sink writer, either directly or, when
+            // the encode thread is running, by adding it to the write queue (waiting
+            // for room if the queue is full).
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::SubmitSample(DWORD streamIndex, IMFSample *sample)
+            {
+                if (writeThread == nullptr)
+                {
+                    return WriteSampleToSink(streamIndex, sample);
+                }
+
+                EnterCriticalSection(&writeQueueLock);
+                while (writeQueueCount == writeQueueSize && SUCCEEDED(writeError))
+                {
+                    SleepConditionVariableCS(&writeQueueNotFull, &writeQueueLock, INFINITE);
+                }
+
+                // Once the sink writer has failed there is no point queuing more
+                // samples; report the failure to the caller instead.
+                HRESULT hr = writeError;
+                if (SUCCEEDED(hr))
+                {
+                    MP4WriterQueuedSample &entry = writeQueue[(writeQueueHead + writeQueueCount) % writeQueueSize];
+                    entry.sample = sample;
+                    entry.sample->AddRef();
+                    entry.streamIndex = streamIndex;
+                    writeQueueCount++;
+                }
+                LeaveCriticalSection(&writeQueueLock);
+                WakeConditionVariable(&writeQueueNotEmpty);
+                return hr;
+            }
+
+#pragma managed(push, off)
+            //**********************************************************************
+            // Body of the encode thread. Compiled as native code so the thread
+            // never has to enter the CLR. Pulls samples off the write queue and
+            // passes them to the sink writer until Close() asks us to stop and the
+            // queue has drained.
+            //**********************************************************************
+            DWORD WINAPI MP4WriterUnmanagedData::WriteThreadProc(LPVOID param)
+            {
+                MP4WriterUnmanagedData *self = static_cast<MP4WriterUnmanagedData*>(param);
+                if (!Media::Threading::IsDefaultThreadPolicy(self->threadPolicy))
+                {
+                    Media::Threading::ApplyThreadPolicy(self->threadPolicy);
+                }
+                EnterCriticalSection(&self->writeQueueLock);
+                for (;;)
+                {
+                    while (self->writeQueueCount == 0 && !self->stopWriting)
+                    {
+                        SleepConditionVariableCS(&self->writeQueueNotEmpty, &self->writeQueueLock, INFINITE);
+                    }
+                    if (self->writeQueueCount == 0)
                     {
-                    case NativePixelFormat_BGR_24bpp:
-                        srcCol = srcRow;
-                        dstCol = dstRow;
-                        for (UINT32 x = 0; x < outputWidth; x++)
-                        {
-                            dstCol[0] = srcCol[0];
-                            dstCol[1] = srcCol[1];
-                            dstCol[2] = srcCol[2];
-                            srcCol += 3;
-                            dstCol += 3;
-                        }
-                        srcRow += outputWidth * 3;
-                        dstRow += outputWidth * 3;
                         break;
+                    }
 
-                    case NativePixelFormat_BGRA_32bpp:
-                    case NativePixelFormat_BGRX_32bpp:
-                        srcCol = srcRow;
-                        dstCol = dstRow;
-                        for (UINT32 x = 0; x < outputWidth; x++)
-                        {
-                            dstCol[0] = srcCol[0];
-                            dstCol[1] = srcCol[1];
-                            dstCol[2] = srcCol[2];
-                            dstCol[3] = srcCol[3];
-                            srcCol += 4;
-                            dstCol += 4;
-                        }
-                        srcRow += outputWidth * 4;
-                        dstRow += outputWidth * 4;
-                        break;
+                    MP4WriterQueuedSample entry = self->writeQueue[self->writeQueueHead];
+                    self->writeQueueHead = (self->writeQueueHead + 1) % self->writeQueueSize;
+                    self->writeQueueCount--;
+                    HRESULT hr = self->writeError;
+                    LeaveCriticalSection(&self->writeQueueLock);
+                    WakeConditionVariable(&self->writeQueueNotFull);
+
+                    // After a failure we keep draining the queue, but only to
+                    // release the samples
+                    if (SUCCEEDED(hr))
+                    {
+                        hr = self->WriteSampleToSink(entry.streamIndex, entry.sample);
+                    }
+                    entry.sample->Release();
+
+                    EnterCriticalSection(&self->writeQueueLock);
+                    if (FAILED(hr) && SUCCEEDED(self->writeError))
+                    {
+                        self->writeError = hr;
+                        WakeAllConditionVariable(&self->writeQueueNotFull);
+                    }
+                }
+                LeaveCriticalSection(&self->writeQueueLock);
+                Media::Threading::RevertThreadPolicy();
+                return 0;
+            }
+
+            //**********************************************************************
+            // Returns true if the output is split across several files
+            //**********************************************************************
+            bool MP4WriterUnmanagedData::IsSegmented()
+            {
+                return outputSettings.segmentDuration > 0 || outputSettings.segmentMaxBytes > 0;
+            }
+
+            //**********************************************************************
+            // Returns the name of a segment's file. Without segmentation this is
+            // the filename passed to Open(); otherwise the segment number is
+            // inserted before the extension ("out.mp4" becomes "out_0000.mp4").
+            //**********************************************************************
+            std::wstring MP4WriterUnmanagedData::GetSegmentFilename(LONG index)
+            {
+                if (!IsSegmented())
+                {
+                    return outputFilename;
+                }
+
+                size_t extension = outputFilename.find_last_of(L'.');
+                size_t directory = outputFilename.find_last_of(L"\\/");
+                if (extension == std::wstring::npos || (directory != std::wstring::npos && extension < directory))
+                {
+                    extension = outputFilename.length();
+                }
+
+                wchar_t suffix[16];
+                swprintf_s(suffix, L"_%04d", index);
+                return outputFilename.substr(0, extension) + suffix + outputFilename.substr(extension);
+            }
+
+            //**********************************************************************
+            // Creates the file, media sink and sink writer for the next segment.
+            // A fragmented MP4 file is written as an initial moov followed by
+            // self-contained moof/mdat fragments, so it can be read while it is
+            // being written, survives a crash up to the last complete fragment,
+            // and the sink doesn't accumulate sample tables for the whole file.
+            // Hardware encoders and the low latency/throttling options are
+            // properties of the sink writer itself.
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::OpenSegment()
+            {
+                std::wstring filename = GetSegmentFilename(segmentIndex);
+                HRESULT hr = MFCreateFile(MF_ACCESSMODE_READWRITE, MF_OPENMODE_DELETE_IF_EXIST, MF_FILEFLAGS_NONE, filename.c_str(), &outputStream);
+                if (outputSettings.fragmented)
+                {
+                    IFS(MFCreateFMPEG4MediaSink(outputStream, outputMediaType, audioOutputMediaType, &mediaSink));
+                }
+                else
+                {
+                    IFS(MFCreateMPEG4MediaSink(outputStream, outputMediaType, audioOutputMediaType, &mediaSink));
+                }
+
+                CComPtr<IMFAttributes> writerAttributes;
+                IFS(MFCreateAttributes(&writerAttributes, 5));
+                IFS(writerAttributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS, encoderSettings.useHardwareEncoder ? TRUE : FALSE));
+                IFS(writerAttributes->SetUINT32(MF_SINK_WRITER_DISABLE_THROTTLING, encoderSettings.disableThrottling ? TRUE : FALSE));
+                IFS(writerAttributes->SetUINT32(MF_LOW_LATENCY, encoderSettings.lowLatency ? TRUE : FALSE));
+                const wchar_t *mmcssTask = Media::Threading::GetMmcssTaskName(threadPolicy);
+                if (mmcssTask != nullptr)
+                {
+                    IFS(writerAttributes->SetString(MF_READWRITE_MMCSS_CLASS, mmcssTask));
+                    IFS(writerAttributes->SetUINT32(MF_READWRITE_MMCSS_PRIORITY, (UINT32)Media::Threading::GetMmcssPriority(threadPolicy)));
+                }
+                IFS(MFCreateSinkWriterFromMediaSink(mediaSink, writerAttributes, &writer));
+
+                // The sink's streams are in the order of the media types we gave it
+                videoStreamIndex = 0;
+                audioStreamIndex = 1;
+                IFS(writer->SetInputMediaType(videoStreamIndex, inputMediaType, encodingParameters));
+                if (hasAudio)
+                {
+                    IFS(writer->SetInputMediaType(audioStreamIndex, audioInputMediaType, nullptr));
+                }
+                IFS(writer->BeginWriting());
+                if (FAILED(hr))
+                {
+                    writer = nullptr;
+                    (void)CloseSegment();
+                }
+                return hr;
+            }
+
+            //**********************************************************************
+            // Finalizes the current segment and closes its file
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::CloseSegment()
+            {
+                HRESULT hr = S_OK;
+                if (writer)
+                {
+                    hr = writer->Finalize();
+                    writer = nullptr;
+                }
+                if (mediaSink)
+                {
+                    mediaSink->Shutdown();
+                    mediaSink = nullptr;
+                }
+                if (outputStream)
+                {
+                    outputStream->Close();
+                    outputStream = nullptr;
+                }
+                return hr;
+            }
 
-                    default:
-                        return E_UNEXPECTED;
+            //**********************************************************************
+            // Passes a sample to the sink writer. When the output is segmented this
+            // is also where we roll over: the first video frame past the current
+            // segment's duration or size limit starts a new file (with a new
+            // encoder, so the segment begins with a key frame), and sample times
+            // are made relative to the start of their segment. Audio that belongs
+            // before the frame that started the segment is dropped.
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::WriteSampleToSink(DWORD streamIndex, IMFSample *sample)
+            {
+                // A rollover whose new segment failed to open leaves no sink writer
+                // (the failure was returned for the sample that triggered it)
+                if (writer == nullptr)
+                {
+                    return FAILED(writeError) ? writeError : E_UNEXPECTED;
+                }
+
+                if (!IsSegmented())
+                {
+                    return writer->WriteSample(streamIndex, sample);
+                }
+
+                LONGLONG sampleTime = 0;
+                HRESULT hr = sample->GetSampleTime(&sampleTime);
+                if (SUCCEEDED(hr) && streamIndex == videoStreamIndex && sampleTime > segmentStartTime)
+                {
+                    QWORD segmentBytes = 0;
+                    bool segmentFull = outputSettings.segmentDuration > 0 && sampleTime - segmentStartTime >= outputSettings.segmentDuration;
+                    if (!segmentFull && outputSettings.segmentMaxBytes > 0 && SUCCEEDED(outputStream->GetLength(&segmentBytes)))
+                    {
+                        segmentFull = segmentBytes >= outputSettings.segmentMaxBytes;
                     }
+                    if (segmentFull)
+                    {
+                        hr = CloseSegment();
+                        InterlockedIncrement(&segmentIndex);
+                        segmentStartTime = sampleTime;
+                        IFS(OpenSegment());
+                    }
+                }
+                if (SUCCEEDED(hr) && sampleTime < segmentStartTime)
+                {
+                    return S_OK;
+                }
+                IFS(sample->SetSampleTime(sampleTime - segmentStartTime));
+                IFS(writer->WriteSample(streamIndex, sample));
+                return hr;
+            }
+#pragma managed(pop)
+
+            //**********************************************************************
+            // Returns the number of samples waiting for the encode thread
+            //**********************************************************************
+            UINT32 MP4WriterUnmanagedData::GetQueueDepth()
+            {
+                EnterCriticalSection(&writeQueueLock);
+                UINT32 depth = writeQueueCount;
+                LeaveCriticalSection(&writeQueueLock);
+                return depth;
+            }
+
+            //**********************************************************************
+            // Returns the number of video frames dropped because the write queue
+            // was full
+            //**********************************************************************
+            UINT32 MP4WriterUnmanagedData::GetNumFramesDropped()
+            {
+                return (UINT32)numFramesDropped;
+            }
+
+            //**********************************************************************
+            // Returns the number of files written so far, including the current one
+            //**********************************************************************
+            UINT32 MP4WriterUnmanagedData::GetNumSegments()
+            {
+                return closed ? 0 : (UINT32)segmentIndex + 1;
+            }
+
+            //**********************************************************************
+            // Copies the image data (from our managed Microsoft::Psi::Image object)
+            // to the media buffer provided by MF, converting it to NV12 if that is
+            // what we told the encoder to expect. 'stride' is the number of bytes
+            // between the starts of consecutive source rows.
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::CopyImageDataToMediaBuffer(IntPtr imageData, int stride, int pixelFormat, BYTE *outputBuffer)
+            {
+                const BYTE *src = (const BYTE*)imageData.ToPointer();
+                if (!convertToNV12)
+                {
+                    // One memcpy per row (or a single one if both sides are packed)
+                    Media::Conversion::CopyRows(src, stride, outputBuffer, outputWidth * inputBytesPerPixel, outputWidth * inputBytesPerPixel, outputHeight);
+                    return S_OK;
+                }
+
+                // NativePixelFormat_* values are also ConversionPixelFormat_* values
+                BYTE *dstY = outputBuffer;
+                BYTE *dstUV = outputBuffer + outputWidth * outputHeight;
+                if (!Media::Conversion::ConvertToNV12(src, stride, pixelFormat, dstY, outputWidth, dstUV, outputWidth, outputWidth, outputHeight))
+                {
+                    return E_UNEXPECTED;
                 }
                 return S_OK;
             }
 
             //**********************************************************************
-            // Writes an image into our video stream
-            // Parameters:
-            //   timestamp - timestamp (in 100 nanoseconds) for this video frame
-            //   imageData - buffer containing our image data
-            //   imageWidth - width of image data in pixels
-            //   imageHeight - height of image data in pixels
-            //   pixelFormat - format of the pixels in imageData
+            // Checks that a frame can be written (see WriteVideoFrame() for the
+            // parameters) and fills in a packed stride if none was given. Returns
+            // S_FALSE if the frame should be dropped.
             //**********************************************************************
-            HRESULT MP4WriterUnmanagedData::WriteVideoFrame(LONGLONG timestamp, IntPtr imageData, UINT32 imageWidth, UINT32 imageHeight, int pixelFormat)
+            HRESULT MP4WriterUnmanagedData::CheckVideoFrame(LONGLONG timestamp, UINT32 imageWidth, UINT32 imageHeight, int *stride, int pixelFormat)
             {
                 // Have we already closed the stream?
                 if (closed)
@@ -263,55 +1023,92 @@ namespace Microsoft {
                     return E_INVALIDARG;
                 }
 
-                if (firstTimestamp == 0)
+                // With a full queue and the drop policy there is no point copying
+                // the frame. Only this thread adds to the queue, so if it isn't
+                // full now it won't be by the time we submit the sample.
+                if (writeThread != nullptr && dropFramesWhenQueueFull && GetQueueDepth() == writeQueueSize)
                 {
-                    firstTimestamp = timestamp;
+                    InterlockedIncrement(&numFramesDropped);
+                    return S_FALSE;
                 }
 
-                HRESULT hr = S_OK;
-                CComPtr<IMFSample> sample;
-                IFS(MFCreateSample(&sample));
+                // The frame must match the input media type set up by Open()
+                UINT32 bytesPerPixel = 0;
+                switch (pixelFormat)
+                {
+                case NativePixelFormat_Undefined:
+                case NativePixelFormat_RGBA_64bpp:
+                    return E_NOTIMPL;
+                case NativePixelFormat_Gray_8bpp:
+                    bytesPerPixel = 1;
+                    break;
+                case NativePixelFormat_Gray_16bpp:
+                    bytesPerPixel = 2;
+                    break;
+                case NativePixelFormat_BGRA_32bpp:
+                case NativePixelFormat_BGRX_32bpp:
+                    bytesPerPixel = 4;
+                    break;
+                case NativePixelFormat_BGR_24bpp:
+                    bytesPerPixel = 3;
+                    break;
+                default:
+                    return E_UNEXPECTED;
+                }
+                if (bytesPerPixel != inputBytesPerPixel || imageWidth != outputWidth || imageHeight != outputHeight)
+                {
+                    return E_UNEXPECTED;
+                }
+                if (*stride == 0)
+                {
+                    *stride = (int)(imageWidth * bytesPerPixel);
+                }
+                else if (*stride < (int)(imageWidth * bytesPerPixel))
+                {
+                    return E_INVALIDARG;
+                }
+                return S_OK;
+            }
 
+            //**********************************************************************
+            // Copies (or converts) a frame into a sample from our pool
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::CreateVideoSample(IntPtr imageData, int stride, int pixelFormat, IMFSample **sample)
+            {
+                HRESULT hr = S_OK;
+                CComPtr<IMFSample> pooledSample;
                 CComPtr<IMFMediaBuffer> buffer;
-                ULONGLONG frameDuration = 10000000L * frameRateDenominator / frameRateNumerator;
-                IFS(MFCreateMediaBufferFromMediaType(inputMediaType, frameDuration, 0, 0, &buffer));
+                IFS(videoSamplePool->GetSample(frameBufferSize, &pooledSample, &buffer));
 
                 BYTE *rawBuffer = nullptr;
-                DWORD bufferLength = 0;
-                IFS(buffer->Lock(&rawBuffer, nullptr, &bufferLength));
+                IFS(buffer->Lock(&rawBuffer, nullptr, nullptr));
                 if (SUCCEEDED(hr))
                 {
-                    switch (pixelFormat)
-                    {
-                    case NativePixelFormat_Undefined:
-                    case NativePixelFormat_Gray_8bpp:
-                    case NativePixelFormat_Gray_16bpp:
-                    case NativePixelFormat_RGBA_64bpp:
-                        hr = E_NOTIMPL;
-                        break;
-                    case NativePixelFormat_BGRA_32bpp:
-                    case NativePixelFormat_BGRX_32bpp:
-                        if (bufferLength != imageWidth * imageHeight * 4)
-                        {
-                            hr = E_UNEXPECTED;
-                        }
-                        break;
-                    case NativePixelFormat_BGR_24bpp:
-                        if (bufferLength != imageWidth * imageHeight * 3)
-                        {
-                            hr = E_UNEXPECTED;
-                        }
-                    }
-                    IFS(CopyImageDataToMediaBuffer(imageData, pixelFormat, rawBuffer));
+                    hr = CopyImageDataToMediaBuffer(imageData, stride, pixelFormat, rawBuffer);
                     (void)buffer->Unlock();
                 }
+                if (SUCCEEDED(hr))
+                {
+                    *sample = pooledSample.Detach();
+                }
+                return hr;
+            }
+
+            //**********************************************************************
+            // Timestamps a finished video sample and hands it to the sink writer
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::SubmitVideoSample(LONGLONG timestamp, IMFSample *sample)
+            {
+                if (firstTimestamp == 0)
+                {
+                    firstTimestamp = timestamp;
+                }
 
-                IFS(buffer->SetCurrentLength(bufferLength));
-                IFS(sample->AddBuffer(buffer));
+                HRESULT hr = S_OK;
+                ULONGLONG frameDuration = 10000000L * frameRateDenominator / frameRateNumerator;
                 IFS(sample->SetSampleTime(timestamp - firstTimestamp));
                 IFS(sample->SetSampleDuration(frameDuration));
-
-                IFS(writer->WriteSample(videoStreamIndex, sample));
+                IFS(SubmitSample(videoStreamIndex, sample));
                 if (SUCCEEDED(hr))
                 {
                     lastVideoTimestamp = timestamp;
@@ -320,6 +1117,72 @@ namespace Microsoft {
                 return hr;
             }
 
+            //**********************************************************************
+            // Writes an image into our video stream
+            // Parameters:
+            //   timestamp - timestamp (in 100 nanoseconds) for this video frame
+            //   imageData - buffer containing our image data
+            //   imageWidth - width of image data in pixels
+            //   imageHeight - height of image data in pixels
+            //   stride - number of bytes between the starts of consecutive rows (0 if the rows are packed)
+            //   pixelFormat - format of the pixels in imageData
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::WriteVideoFrame(LONGLONG timestamp, IntPtr imageData, UINT32 imageWidth, UINT32 imageHeight, int stride, int pixelFormat)
+            {
+                Media::Tracing::TraceScope trace(Media::Tracing::TraceEvent_WriterWriteVideoFrame);
+                trace.SetFrame((int)videoStreamIndex, timestamp);
+                HRESULT hr = CheckVideoFrame(timestamp, imageWidth, imageHeight, &stride, pixelFormat);
+                if (hr != S_OK)
+                {
+                    return hr;
+                }
+
+                CComPtr<IMFSample> sample;
+                IFS(CreateVideoSample(imageData, stride, pixelFormat, &sample));
+                IFS(SubmitVideoSample(timestamp, sample));
+                return hr;
+            }
+
+            //**********************************************************************
+            // Same as WriteVideoFrame(), except that when the frame can go to the
+            // encoder as is (packed rows, no NV12 conversion) it isn't copied: the
+            // sample references imageData directly, and 'released' is called with
+            // 'context' once the encoder is done with it. Otherwise the frame is
+            // copied as usual. Either way 'released' is called exactly once, even
+            // if the frame is dropped or an error is returned; until then the
+            // caller must keep imageData alive and unchanged.
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::WriteVideoFrameNoCopy(LONGLONG timestamp, IntPtr imageData, UINT32 imageWidth, UINT32 imageHeight, int stride, int pixelFormat,
+                MP4WriterBufferReleasedHandler released, void *context)
+            {
+                Media::Tracing::TraceScope trace(Media::Tracing::TraceEvent_WriterWriteVideoFrame);
+                trace.SetFrame((int)videoStreamIndex, timestamp);
+                HRESULT hr = CheckVideoFrame(timestamp, imageWidth, imageHeight, &stride, pixelFormat);
+                CComPtr<IMFSample> sample;
+                if (hr != S_OK || convertToNV12 || stride != (int)(imageWidth * inputBytesPerPixel))
+                {
+                    if (hr == S_OK)
+                    {
+                        hr = CreateVideoSample(imageData, stride, pixelFormat, &sample);
+                    }
+                    released(context);
+                    if (hr != S_OK)
+                    {
+                        return hr;
+                    }
+                }
+                else
+                {
+                    // From here on the wrapped buffer is responsible for calling 'released'
+                    CComPtr<IMFMediaBuffer> buffer;
+                    hr = MP4WriterWrappedBuffer::CreateInstance((BYTE*)imageData.ToPointer(), frameBufferSize, released, context, &buffer);
+                    IFS(MFCreateSample(&sample));
+                    IFS(sample->AddBuffer(buffer));
+                }
+                IFS(SubmitVideoSample(timestamp, sample));
+                return hr;
+            }
+
             //**********************************************************************
             // Writes an audio sample into our MP4 file
             // Parameters:
@@ -329,6 +1192,8 @@ namespace Microsoft {
             //**********************************************************************
             HRESULT MP4WriterUnmanagedData::WriteAudioSample(LONGLONG timestamp, IntPtr pcmData, UINT32 numDataBytes, IntPtr waveFormat)
             {
+                Media::Tracing::TraceScope trace(Media::Tracing::TraceEvent_WriterWriteAudioSample);
+                trace.SetFrame((int)audioStreamIndex, timestamp);
                 if (closed || !hasAudio)
                 {
                     return E_UNEXPECTED;
@@ -355,50 +1220,115 @@ namespace Microsoft {
                     return E_UNEXPECTED;
                 }
 
+                UINT32 blockAlignment = wavefmt.nChannels * (wavefmt.wBitsPerSample / 8);
+                if (numDataBytes % blockAlignment != 0)
+                {
+                    return E_INVALIDARG;
+                }
+
+                // Audio sample times are derived from the number of audio frames
+                // written rather than from each buffer's timestamp, so that buffer
+                // durations add up exactly over long recordings. We only go back to
+                // the buffer timestamps when they move more than AudioResyncThreshold
+                // away from that count (e.g. after a gap in the input).
+                LONGLONG time = timestamp - firstTimestamp;
+                LONGLONG expectedTime = audioInputBaseTime + MFllMulDiv((LONGLONG)audioInputFrames, 10000000, audioSamplesPerSecond, 0);
+                if (numAudioSamplesWritten == 0 || time - expectedTime > AudioResyncThreshold || expectedTime - time > AudioResyncThreshold)
+                {
+                    audioInputBaseTime = time;
+                    audioInputFrames = 0;
+                    audioOutputBaseTime = time;
+                    audioOutputFrames = 0;
+                }
+                LONGLONG sampleTime = audioInputBaseTime + MFllMulDiv((LONGLONG)audioInputFrames, 10000000, audioSamplesPerSecond, 0);
+                audioInputFrames += numDataBytes / blockAlignment;
+                LONGLONG sampleEndTime = audioInputBaseTime + MFllMulDiv((LONGLONG)audioInputFrames, 10000000, audioSamplesPerSecond, 0);
+
                 CComPtr<IMFSample> sample;
-                HRESULT hr = MFCreateSample(&sample);
+                CComPtr<IMFMediaBuffer> mediaBuffer;
+                HRESULT hr = audioSamplePool->GetSample(numDataBytes, &sample, &mediaBuffer);
                 if (SUCCEEDED(hr))
                 {
-                    CComPtr<IMFMediaBuffer> mediaBuffer;
-                    hr = MFCreateMemoryBuffer(numDataBytes, &mediaBuffer);
+                    BYTE *buffer;
+                    hr = mediaBuffer->Lock(&buffer, nullptr, nullptr);
                     if (SUCCEEDED(hr))
                     {
-                        BYTE *buffer;
-                        DWORD bufferLength;
-                        hr = mediaBuffer->Lock(&buffer, nullptr, &bufferLength);
-                        if (SUCCEEDED(hr))
-                        {
-                            memcpy(buffer, (BYTE*)pcmData.ToPointer(), numDataBytes);
-                            (void)mediaBuffer->Unlock();
-                        }
-                        IFS(mediaBuffer->SetCurrentLength(DWORD(numDataBytes)));
-                        IFS(sample->AddBuffer(mediaBuffer));
-
-                        DWORD oneSecWorthOfData = wavefmt.nChannels * (wavefmt.wBitsPerSample / 8) * wavefmt.nSamplesPerSec;
-                        MFTIME sampleDurationIn100Ns = 10000 * ((1000 * numDataBytes) / oneSecWorthOfData);
-                        IFS(sample->SetSampleDuration(sampleDurationIn100Ns));
-                        IFS(sample->SetSampleTime(timestamp - firstTimestamp));
-                        IFS(writer->WriteSample(audioStreamIndex, sample));
-                        numAudioSamplesWritten++;
-                        lastAudioTimestamp = timestamp;
+                        memcpy(buffer, (BYTE*)pcmData.ToPointer(), numDataBytes);
+                        (void)mediaBuffer->Unlock();
                     }
+
+                    if (audioResampler == nullptr)
+                    {
+                        IFS(SubmitAudioSample(sample, numDataBytes));
+                    }
+                    else
+                    {
+                        IFS(sample->SetSampleTime(sampleTime));
+                        IFS(sample->SetSampleDuration(sampleEndTime - sampleTime));
+                        IFS(audioResampler->ProcessInput(sample));
+                        IFS(WriteResampledAudio());
+                    }
+                    numAudioSamplesWritten++;
+                    lastAudioTimestamp = timestamp;
                 }
                 return hr;
             }
 
+            //**********************************************************************
+            // Stamps a buffer of encoder input audio (16-bit PCM in the output
+            // format) with its time and duration, counted in audio frames from
+            // audioOutputBaseTime, and submits it
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::SubmitAudioSample(IMFSample *sample, DWORD numBytes)
+            {
+                LONGLONG sampleTime = audioOutputBaseTime + MFllMulDiv((LONGLONG)audioOutputFrames, 10000000, audioOutputSampleRate, 0);
+                audioOutputFrames += numBytes / (audioOutputChannels * 2);
+                LONGLONG sampleEndTime = audioOutputBaseTime + MFllMulDiv((LONGLONG)audioOutputFrames, 10000000, audioOutputSampleRate, 0);
+
+                HRESULT hr = sample->SetSampleTime(sampleTime);
+                IFS(sample->SetSampleDuration(sampleEndTime - sampleTime));
+                IFS(SubmitSample(audioStreamIndex, sample));
+                return hr;
+            }
+
+            //**********************************************************************
+            // Submits all the audio the resampler has ready
+            //**********************************************************************
+            HRESULT MP4WriterUnmanagedData::WriteResampledAudio()
+            {
+                HRESULT hr = S_OK;
+                while (hr == S_OK)
+                {
+                    CComPtr<IMFSample> sample;
+                    DWORD numBytes = 0;
+                    hr = audioResampler->ProcessOutput(audioSamplePool, &sample, &numBytes);
+                    if (hr == S_OK)
+                    {
+                        hr = SubmitAudioSample(sample, numBytes);
+                    }
+                }
+                return SUCCEEDED(hr) ? S_OK : hr;
+            }
+
             //**********************************************************************
             // Closes the current file. This must be called to ensure the MP4 file
-            // is written properly.
+            // is written properly. Any samples still queued for the encode thread
+            // are written before the file is finalized.
             //**********************************************************************
             HRESULT MP4WriterUnmanagedData::Close()
             {
-                if (writer)
+                // Flush the audio still inside the resampler before the queue stops
+                if (audioResampler != nullptr && !closed && SUCCEEDED(audioResampler->Drain()))
                 {
-                    writer->Finalize();
-                    writer = nullptr;
+                    (void)WriteResampledAudio();
                 }
+                FreeAudioResampler();
+                StopWriteThread();
+                HRESULT hr = writeError;
+                (void)CloseSegment();
+                FreeSamplePools();
                 closed = true;
-                return S_OK;
+                return hr;
             }
 
             //**********************************************************************
@@ -407,26 +1337,104 @@ namespace Microsoft {
             HRESULT MP4Writer::Open(String ^fn, MP4WriterConfiguration^ config)
             {
                 unmanagedData = new MP4WriterUnmanagedData();
+
+                MP4WriterEncoderSettings settings;
+                settings.videoCodec = config->videoCodec;
+                settings.useHardwareEncoder = config->useHardwareEncoder;
+                settings.disableThrottling = config->disableThrottling;
+                settings.lowLatency = config->lowLatency;
+                settings.rateControlMode = config->rateControlMode;
+                settings.gopSize = config->gopSize;
+                settings.bFrameCount = config->bFrameCount;
+                settings.qualityVsSpeed = config->qualityVsSpeed;
+                settings.quality = config->quality;
+                HRESULT hr = unmanagedData->SetEncoderSettings(settings);
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+
+                MP4WriterOutputSettings outputSettings;
+                outputSettings.fragmented = config->fragmented;
+                outputSettings.fragmentDuration = config->fragmentDuration;
+                outputSettings.segmentDuration = config->segmentDuration;
+                outputSettings.segmentMaxBytes = config->segmentMaxBytes;
+                hr = unmanagedData->SetOutputSettings(outputSettings);
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+
+                MP4WriterAudioSettings audioSettings;
+                audioSettings.outputSampleRate = config->audioOutputSampleRate;
+                audioSettings.outputChannels = config->audioOutputChannels;
+                audioSettings.bitrate = config->audioBitrate;
+                hr = unmanagedData->SetAudioSettings(audioSettings);
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+
+                hr = unmanagedData->SetThreadPolicy(config->threadPriority, config->threadAffinityMask);
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+
                 IntPtr ptrToNativeString = Marshal::StringToHGlobalUni(fn);
-                HRESULT hr = unmanagedData->Open(config->imageWidth, config->imageHeight, config->frameRateNumerator, config->frameRateDenominator, config->targetBitrate,
-                    config->pixelFormat, config->containsAudio, config->bitsPerSample, config->samplesPerSecond, config->numChannels,
+                hr = unmanagedData->Open(config->imageWidth, config->imageHeight, config->frameRateNumerator, config->frameRateDenominator, config->targetBitrate,
+                    config->pixelFormat, config->convertToNV12, config->containsAudio, config->bitsPerSample, config->samplesPerSecond, config->numChannels,
                     static_cast<wchar_t*>(ptrToNativeString.ToPointer()));
                 Marshal::FreeHGlobal(ptrToNativeString);
+                if (SUCCEEDED(hr) && config->writeQueueSize > 0)
+                {
+                    hr = unmanagedData->StartWriteThread(config->writeQueueSize, config->dropFramesWhenQueueFull);
+                }
                 return hr;
             }
 
             //**********************************************************************
             HRESULT MP4Writer::WriteVideoFrame(LONGLONG timestamp, IntPtr imageData, UINT32 imgWidth, UINT32 imgHeight, int pixelFormat)
             {
+                return WriteVideoFrame(timestamp, imageData, imgWidth, imgHeight, 0, pixelFormat);
+            }
+
+            //**********************************************************************
+            HRESULT MP4Writer::WriteVideoFrame(LONGLONG timestamp, IntPtr imageData, UINT32 imgWidth, UINT32 imgHeight, int stride, int pixelFormat)
+            {
+                if (imageData.ToPointer() == nullptr)
+                {
+                    return E_POINTER;
+                }
+                if (imgWidth != (int)unmanagedData->outputWidth || imgHeight != (int)unmanagedData->outputHeight)
+                {
+                    return E_INVALIDARG;
+                }
+                return unmanagedData->WriteVideoFrame(timestamp, imageData, imgWidth, imgHeight, stride, pixelFormat);
+            }
+
+            //**********************************************************************
+            // Writes a frame without copying it if possible. The writer holds on to
+            // imageData until BufferReleased is raised with 'context'.
+            //**********************************************************************
+            HRESULT MP4Writer::WriteVideoFrameNoCopy(LONGLONG timestamp, IntPtr imageData, UINT32 imgWidth, UINT32 imgHeight, int stride, int pixelFormat, IntPtr context)
+            {
+                if (bufferReleased == nullptr)
+                {
+                    return E_UNEXPECTED;
+                }
+                MP4WriterBufferReleasedHandler released = (MP4WriterBufferReleasedHandler)Marshal::GetFunctionPointerForDelegate(bufferReleased).ToPointer();
                 if (imageData.ToPointer() == nullptr)
                 {
+                    released(context.ToPointer());
                     return E_POINTER;
                 }
                 if (imgWidth != (int)unmanagedData->outputWidth || imgHeight != (int)unmanagedData->outputHeight)
                 {
+                    released(context.ToPointer());
                     return E_INVALIDARG;
                 }
-                return unmanagedData->WriteVideoFrame(timestamp, imageData, imgWidth, imgHeight, pixelFormat);
+                return unmanagedData->WriteVideoFrameNoCopy(timestamp, imageData, imgWidth, imgHeight, stride, pixelFormat, released, context.ToPointer());
             }
 
             //**********************************************************************
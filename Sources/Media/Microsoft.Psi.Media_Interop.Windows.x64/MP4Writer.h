@@ -11,6 +11,10 @@
 #include "ManagedCameraControlProperty.h"
 #include "SourceReaderCallback.h"
 #include "MediaFoundationUtility.h"
+#include "MP4WriterSamplePool.h"
+#include "MP4WriterWrappedBuffer.h"
+#include "MP4WriterAudioResampler.h"
+#include <string>
 
 namespace Microsoft {
     namespace Psi {
@@ -30,6 +34,63 @@ namespace Microsoft {
             const int NativePixelFormat_BGRA_32bpp = 5;
             const int NativePixelFormat_RGBA_64bpp = 6;
 
+            //**********************************************************************
+            // Defines the video codecs the MP4 writer can produce. NOTE: This list
+            // must match Microsoft.Psi.Media.Mpeg4VideoCodec.
+            //**********************************************************************
+            const int NativeVideoCodec_H264 = 0;
+            const int NativeVideoCodec_HEVC = 1;
+
+            //**********************************************************************
+            // Encoder options for MP4WriterUnmanagedData. A value of -1 leaves the
+            // corresponding ICodecAPI property at the encoder's default.
+            //**********************************************************************
+            struct MP4WriterEncoderSettings
+            {
+                int videoCodec;                        /* Output video codec (see NativeVideoCodec_*) */
+                bool useHardwareEncoder;               /* Let MF pick a hardware encoder MFT (NVENC, QuickSync, AMF, ...) when one is available */
+                bool disableThrottling;                /* Don't make WriteSample() wait when the encoder falls behind */
+                bool lowLatency;                       /* Tune the encoder (and sink writer) for latency rather than throughput */
+                int rateControlMode;                   /* eAVEncCommonRateControlMode (CBR, VBR, quality, ...) */
+                int gopSize;                           /* Number of frames from one key frame to the next */
+                int bFrameCount;                       /* Number of B frames between reference frames */
+                int qualityVsSpeed;                    /* 0 (fastest) .. 100 (best quality) */
+                int quality;                           /* 0 .. 100, used by the quality-based rate control modes */
+            };
+
+            //**********************************************************************
+            // AAC output options for MP4WriterUnmanagedData. A value of 0 picks a
+            // default based on the input audio (see SetupAudio()).
+            //**********************************************************************
+            struct MP4WriterAudioSettings
+            {
+                UINT32 outputSampleRate;               /* AAC sample rate (44100 or 48000) */
+                UINT32 outputChannels;                 /* AAC channel count (1, 2 or 6) */
+                UINT32 bitrate;                        /* AAC bitrate in bits/sec (96000, 128000, 160000 or 192000) */
+            };
+
+            //**********************************************************************
+            // Output file options for MP4WriterUnmanagedData. Durations are in
+            // 100ns units; a duration or size of 0 disables the corresponding
+            // segment threshold.
+            //**********************************************************************
+            struct MP4WriterOutputSettings
+            {
+                bool fragmented;                       /* Write fragmented MP4 (moof/mdat pairs) that is readable while it is being written */
+                LONGLONG fragmentDuration;             /* Length of each fragment (sets the GOP size unless gopSize says otherwise) */
+                LONGLONG segmentDuration;              /* Start a new file once the current one holds this much video */
+                UINT64 segmentMaxBytes;                /* Start a new file once the current one reaches this size */
+            };
+
+            //**********************************************************************
+            // A sample waiting in the write queue for the encode thread
+            //**********************************************************************
+            struct MP4WriterQueuedSample
+            {
+                IMFSample *sample;                     /* Sample to hand to the sink writer (we hold a reference) */
+                DWORD streamIndex;                     /* Stream the sample belongs to */
+            };
+
             //**********************************************************************
             // Define our unmanaged data associated with the MP4Writer object
             //**********************************************************************
@@ -37,12 +98,20 @@ namespace Microsoft {
             {
             public:
                 CComPtr<IMFSinkWriter> writer;         /* MP4 sink to write frames to */
+                CComPtr<IMFMediaSink> mediaSink;       /* MP4 (or fragmented MP4) media sink behind the writer */
+                CComPtr<IMFByteStream> outputStream;   /* File the current segment is written to */
                 DWORD videoStreamIndex;                /* stream index containing video stream */
                 UINT32 numFramesWritten;               /* Number of image frames added thus far */
                 CComPtr<IMFMediaType> outputMediaType; /* Output media type */
                 CComPtr<IMFMediaType> inputMediaType;  /* Input media type of each image frame */
+                CComPtr<IMFMediaType> audioOutputMediaType; /* AAC output media type (nullptr without audio) */
+                CComPtr<IMFMediaType> audioInputMediaType;  /* PCM input media type (nullptr without audio) */
+                CComPtr<IMFAttributes> encodingParameters;  /* Encoder settings applied to each segment's encoder */
                 UINT32 outputWidth;                    /* Width of output image frames */
                 UINT32 outputHeight;                   /* Height of output image frames */
+                UINT32 inputBytesPerPixel;             /* Bytes per pixel of the input image frames */
+                UINT32 frameBufferSize;                /* Size of the buffer each frame is copied (or converted) into */
+                bool convertToNV12;                    /* If true frames are converted to NV12 before they reach the encoder */
                 UINT32 frameRateNumerator;             /* Numerator of framerate (typically 30) */
                 UINT32 frameRateDenominator;           /* Denominator of framerate (typically 1) */
                 UINT32 targetBitrate;                  /* Target bitrate (typically 128000,384000,528560,4000000,or 10000000) */
@@ -55,17 +124,75 @@ namespace Microsoft {
                 UINT32 audioBitsPerSample;             /* Number of bits per audio sample (typically 16) */
                 UINT32 audioSamplesPerSecond;          /* Audio's sample rate (typically 48000) */
                 UINT32 audioNumChannels;               /* Number of audio channels (typically 1 or 2) */
+                MP4WriterAudioSettings audioSettings;  /* AAC output options (see SetAudioSettings()) */
+                UINT32 audioOutputSampleRate;          /* Sample rate of the audio passed to the AAC encoder */
+                UINT32 audioOutputChannels;            /* Number of channels of the audio passed to the AAC encoder */
+                MP4WriterAudioResampler *audioResampler; /* Converts the input audio for the AAC encoder (nullptr if it can take it as is) */
+                LONGLONG audioInputBaseTime;           /* Time of the input audio sample audioInputFrames is counted from */
+                UINT64 audioInputFrames;               /* Number of input audio frames since audioInputBaseTime */
+                LONGLONG audioOutputBaseTime;          /* Time of the encoder input sample audioOutputFrames is counted from */
+                UINT64 audioOutputFrames;              /* Number of audio frames passed to the encoder since audioOutputBaseTime */
                 LONGLONG firstTimestamp;               /* Initial timestamp received by component. Subtracted from all times written to the file */
+                MP4WriterEncoderSettings encoderSettings; /* Codec and encoder options (see SetEncoderSettings()) */
+                MP4WriterOutputSettings outputSettings; /* Fragmentation and segmentation options (see SetOutputSettings()) */
+                Media::Threading::ThreadPolicy threadPolicy; /* Scheduling of the encode threads (see SetThreadPolicy()) */
+                std::wstring outputFilename;           /* Filename passed to Open() (segment names are derived from it) */
+                volatile LONG segmentIndex;            /* Index of the segment being written */
+                LONGLONG segmentStartTime;             /* Time (relative to firstTimestamp) of the first video frame in the current segment */
+                MP4WriterSamplePool *videoSamplePool;  /* Recycled samples for video frames */
+                MP4WriterSamplePool *audioSamplePool;  /* Recycled samples for audio buffers */
+                MP4WriterQueuedSample *writeQueue;     /* Ring buffer of samples waiting for the encode thread (nullptr when writing synchronously) */
+                UINT32 writeQueueSize;                 /* Number of entries in writeQueue */
+                UINT32 writeQueueHead;                 /* Index of the oldest queued sample */
+                UINT32 writeQueueCount;                /* Number of samples currently queued */
+                bool dropFramesWhenQueueFull;          /* If true video frames arriving at a full queue are dropped, otherwise the caller waits */
+                bool stopWriting;                      /* Set by Close() to tell the encode thread to exit once the queue is empty */
+                HRESULT writeError;                    /* First error returned by the sink writer on the encode thread */
+                volatile LONG numFramesDropped;        /* Number of video frames dropped because the queue was full */
+                HANDLE writeThread;                    /* Encode thread (owns all calls to writer->WriteSample) */
+                CRITICAL_SECTION writeQueueLock;       /* Guards the queue state above */
+                CONDITION_VARIABLE writeQueueNotEmpty; /* Signaled when a sample is queued or stopWriting is set */
+                CONDITION_VARIABLE writeQueueNotFull;  /* Signaled when the encode thread takes a sample off the queue */
 
-                HRESULT CopyImageDataToMediaBuffer(IntPtr imageData, int format, BYTE *outputBuffer);
+                HRESULT CopyImageDataToMediaBuffer(IntPtr imageData, int stride, int format, BYTE *outputBuffer);
+                HRESULT CheckVideoFrame(LONGLONG timestamp, UINT32 imageWidth, UINT32 imageHeight, int *stride, int pixelFormat);
+                HRESULT CreateVideoSample(IntPtr imageData, int stride, int pixelFormat, IMFSample **sample);
+                HRESULT SubmitVideoSample(LONGLONG timestamp, IMFSample *sample);
                 HRESULT SetupAudio(UINT32 bitsPerSample, UINT32 samplesPerSecond, UINT32 numChannels);
+                static HRESULT CreatePCMMediaType(UINT32 bitsPerSample, UINT32 samplesPerSecond, UINT32 numChannels, IMFMediaType **mediaType);
+                HRESULT SubmitAudioSample(IMFSample *sample, DWORD numBytes);
+                HRESULT WriteResampledAudio();
+                void FreeAudioResampler();
+                bool IsSegmented();
+                std::wstring GetSegmentFilename(LONG index);
+                HRESULT OpenSegment();
+                HRESULT CloseSegment();
+                HRESULT WriteSampleToSink(DWORD streamIndex, IMFSample *sample);
+                HRESULT CreateEncodingParameters(IMFAttributes **encodingParameters);
+                static HRESULT SelectProfileAndLevel(int videoCodec, UINT32 width, UINT32 height, UINT32 frameRateNum, UINT32 frameRateDenom, UINT32 bitrate,
+                    UINT32 *profile, UINT32 *level);
+                HRESULT SubmitSample(DWORD streamIndex, IMFSample *sample);
+                void FreeSamplePools();
+                void StopWriteThread();
+                static DWORD WINAPI WriteThreadProc(LPVOID param);
             public:
                 MP4WriterUnmanagedData();
-                HRESULT Open(UINT32 imageWidth, UINT32 imageHeight, UINT32 frameRateNum, UINT32 frameRateDenom, UINT32 bitrate, int pixelFormat,
+                ~MP4WriterUnmanagedData();
+                HRESULT SetEncoderSettings(const MP4WriterEncoderSettings &settings);
+                HRESULT SetOutputSettings(const MP4WriterOutputSettings &settings);
+                HRESULT SetAudioSettings(const MP4WriterAudioSettings &settings);
+                HRESULT SetThreadPolicy(int priority, UINT64 affinityMask);
+                HRESULT Open(UINT32 imageWidth, UINT32 imageHeight, UINT32 frameRateNum, UINT32 frameRateDenom, UINT32 bitrate, int pixelFormat, bool toNV12,
                     bool containsAudio, UINT32 bitsPerSample, UINT32 samplesPerSecond, UINT32 numChannels,
-                    wchar_t *outputFilename);
-                HRESULT WriteVideoFrame(LONGLONG timestamp, IntPtr imageData, UINT32 imageWidth, UINT32 imageHeight, int pixelFormat);
+                    wchar_t *filename);
+                HRESULT WriteVideoFrame(LONGLONG timestamp, IntPtr imageData, UINT32 imageWidth, UINT32 imageHeight, int stride, int pixelFormat);
+                HRESULT WriteVideoFrameNoCopy(LONGLONG timestamp, IntPtr imageData, UINT32 imageWidth, UINT32 imageHeight, int stride, int pixelFormat,
+                    MP4WriterBufferReleasedHandler released, void *context);
                 HRESULT WriteAudioSample(LONGLONG timestamp, IntPtr pcmData, UINT32 numDataBytes, IntPtr waveFormat);
+                HRESULT StartWriteThread(UINT32 queueSize, bool dropWhenFull);
+                UINT32 GetQueueDepth();
+                UINT32 GetNumFramesDropped();
+                UINT32 GetNumSegments();
                 HRESULT Close();
             };
 
@@ -81,12 +208,51 @@ namespace Microsoft {
                 UINT32 frameRateDenominator; /* Denominator of framerate (typically 1) */
                 UINT32 targetBitrate;        /* Target bitrate (typically 128000,384000,528560,4000000,or 10000000) */
                 int pixelFormat;             /* Input image's native pixel format (see NativePixelFormat_*) */
+                bool convertToNV12;          /* Convert color images to NV12 ourselves instead of leaving it to MF (gray images always are) */
                 bool containsAudio;          /* Does the output .mp4 contain audio stream */
                 UINT32 bitsPerSample;        /* Number of bits per audio sample (typically 16) */
                 UINT32 samplesPerSecond;     /* Audio's sample rate (typically 48000) */
                 UINT32 numChannels;          /* Number of audio channels (typically 1 or 2) */
+                UINT32 audioOutputSampleRate; /* AAC sample rate, 44100 or 48000 (0 = the input's if possible) */
+                UINT32 audioOutputChannels;  /* AAC channel count, 1, 2 or 6 (0 = the input's if possible) */
+                UINT32 audioBitrate;         /* AAC bitrate in bits/sec, 96000, 128000, 160000 or 192000 (0 = 192000) */
+                UINT32 writeQueueSize;       /* Number of samples queued for a background encode thread (0 = encode on the caller's thread) */
+                bool dropFramesWhenQueueFull; /* If true video frames are dropped when the write queue is full, otherwise the caller blocks */
+                int videoCodec;              /* Output video codec (see NativeVideoCodec_*) */
+                bool useHardwareEncoder;     /* Allow a hardware encoder MFT to be used */
+                bool disableThrottling;      /* Disable sink writer throttling */
+                bool lowLatency;             /* Enable low-latency encoding */
+                int rateControlMode;         /* eAVEncCommonRateControlMode value (-1 = encoder default) */
+                int gopSize;                 /* Frames between key frames (-1 = encoder default) */
+                int bFrameCount;             /* B frames between reference frames (-1 = encoder default) */
+                int qualityVsSpeed;          /* 0 (fastest) .. 100 (best quality) (-1 = encoder default) */
+                int quality;                 /* 0 .. 100 for quality rate control (-1 = encoder default) */
+                bool fragmented;             /* Write fragmented MP4 */
+                LONGLONG fragmentDuration;   /* Fragment length in 100ns units */
+                LONGLONG segmentDuration;    /* Roll over to a new file after this much video, in 100ns units (0 = never) */
+                UINT64 segmentMaxBytes;      /* Roll over to a new file at this size (0 = never) */
+                int threadPriority;          /* Priority of the encode threads (a System.Threading.ThreadPriority value) */
+                UINT64 threadAffinityMask;   /* Logical processors the encode thread may run on (0 = any) */
+
+                MP4WriterConfiguration() :
+                    videoCodec(NativeVideoCodec_H264),
+                    rateControlMode(-1),
+                    gopSize(-1),
+                    bFrameCount(-1),
+                    qualityVsSpeed(-1),
+                    quality(-1),
+                    fragmentDuration(20000000),
+                    threadPriority(Media::Threading::ThreadPriority_Normal)
+                {
+                }
             };
 
+            /// <summary>
+            /// Raised when the writer no longer needs a frame passed to MP4Writer::WriteVideoFrameNoCopy()
+            /// </summary>
+            /// <param name="context">The context passed along with the frame</param>
+            public delegate void MP4WriterBufferReleasedDelegate(IntPtr context);
+
             /// <summary>
             /// Class for recording video to an MPEG file via Media Foundation
             /// </summary>
@@ -94,12 +260,31 @@ namespace Microsoft {
             {
             private:
                 MP4WriterUnmanagedData * unmanagedData;
+                MP4WriterBufferReleasedDelegate^ bufferReleased; /* Holding the delegate keeps its native thunk alive */
             public:
                 MP4Writer() :
-                    unmanagedData(nullptr)
+                    unmanagedData(nullptr),
+                    bufferReleased(nullptr)
                 {
                 }
 
+                /// <summary>
+                /// Gets or sets the handler called (possibly on an encoder thread) once a frame passed
+                /// to WriteVideoFrameNoCopy() may be freed. Must be set before frames are written.
+                /// </summary>
+                property MP4WriterBufferReleasedDelegate^ BufferReleased
+                {
+                    MP4WriterBufferReleasedDelegate^ get()
+                    {
+                        return bufferReleased;
+                    }
+
+                    void set(MP4WriterBufferReleasedDelegate^ value)
+                    {
+                        bufferReleased = value;
+                    }
+                }
+
                 ~MP4Writer()
                 {
                     Close();
@@ -107,9 +292,44 @@ namespace Microsoft {
 
                 HRESULT Open(String ^fn, MP4WriterConfiguration^ config);
                 HRESULT WriteVideoFrame(LONGLONG timestamp, IntPtr imageData, UINT32 imgWidth, UINT32 imgHeight, int pixelFormat);
+                HRESULT WriteVideoFrame(LONGLONG timestamp, IntPtr imageData, UINT32 imgWidth, UINT32 imgHeight, int stride, int pixelFormat);
+                HRESULT WriteVideoFrameNoCopy(LONGLONG timestamp, IntPtr imageData, UINT32 imgWidth, UINT32 imgHeight, int stride, int pixelFormat, IntPtr context);
                 HRESULT WriteAudioSample(LONGLONG timestamp, IntPtr pcmData, UINT32 numDataBytes, IntPtr waveFormat);
                 HRESULT Close();
 
+                /// <summary>
+                /// Gets the number of samples waiting to be encoded (always 0 when writing synchronously)
+                /// </summary>
+                property UINT32 QueueDepth
+                {
+                    UINT32 get()
+                    {
+                        return (unmanagedData != nullptr) ? unmanagedData->GetQueueDepth() : 0;
+                    }
+                }
+
+                /// <summary>
+                /// Gets the number of video frames dropped because the write queue was full
+                /// </summary>
+                property UINT32 DroppedFrames
+                {
+                    UINT32 get()
+                    {
+                        return (unmanagedData != nullptr) ? unmanagedData->GetNumFramesDropped() : 0;
+                    }
+                }
+
+                /// <summary>
+                /// Gets the number of files written so far, including the current one
+                /// </summary>
+                property UINT32 SegmentCount
+                {
+                    UINT32 get()
+                    {
+                        return (unmanagedData != nullptr) ? unmanagedData->GetNumSegments() : 0;
+                    }
+                }
+
                 static HRESULT Startup();
                 static HRESULT Shutdown();
             };
@@ -0,0 +1,140 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "StdAfx.h"
+#include <atlbase.h>
+#include <new>
+#include "MP4WriterAudioResampler.h"
+
+#pragma comment(lib, "wmcodecdspuuid.lib")
+
+namespace Microsoft {
+    namespace Psi {
+        namespace Media_Interop {
+
+#define IFS(expr) do { if (SUCCEEDED(hr)) hr = expr; } while(0)
+
+            // Half length of the resampler's filter (1 .. 60). Longer filters
+            // give better quality for more CPU; 60 is the DSP's best.
+            static const LONG ResamplerHalfFilterLength = 60;
+
+            //**********************************************************************
+            // Creates a resampler converting from 'inputType' to 'outputType'
+            // (both uncompressed PCM or float audio types)
+            //**********************************************************************
+            HRESULT MP4WriterAudioResampler::CreateInstance(IMFMediaType *inputType, IMFMediaType *outputType, MP4WriterAudioResampler **resampler)
+            {
+                if (resampler == nullptr)
+                {
+                    return E_POINTER;
+                }
+
+                CComPtr<IMFTransform> transform;
+                HRESULT hr = CoCreateInstance(CLSID_CResamplerMediaObject, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&transform));
+                CComPtr<IWMResamplerProps> properties;
+                if (SUCCEEDED(hr) && SUCCEEDED(transform->QueryInterface(IID_PPV_ARGS(&properties))))
+                {
+                    (void)properties->SetHalfFilterLength(ResamplerHalfFilterLength);
+                }
+                IFS(transform->SetInputType(0, inputType, 0));
+                IFS(transform->SetOutputType(0, outputType, 0));
+                IFS(transform->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, 0));
+                IFS(transform->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, 0));
+
+                // Pull the output in blocks of roughly 100ms
+                UINT32 blockAlignment = 0;
+                UINT32 bytesPerSecond = 0;
+                IFS(outputType->GetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT, &blockAlignment));
+                IFS(outputType->GetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, &bytesPerSecond));
+                if (SUCCEEDED(hr) && blockAlignment == 0)
+                {
+                    hr = E_INVALIDARG;
+                }
+
+                if (SUCCEEDED(hr))
+                {
+                    *resampler = new (std::nothrow) MP4WriterAudioResampler();
+                    if (*resampler == nullptr)
+                    {
+                        return E_OUTOFMEMORY;
+                    }
+                    (*resampler)->transform = transform;
+                    UINT32 framesPerBuffer = bytesPerSecond / 10 / blockAlignment;
+                    (*resampler)->outputBufferSize = ((framesPerBuffer > 0) ? framesPerBuffer : 1) * blockAlignment;
+                }
+                return hr;
+            }
+
+            //**********************************************************************
+            MP4WriterAudioResampler::MP4WriterAudioResampler() :
+                outputBufferSize(0)
+            {
+            }
+
+            //**********************************************************************
+            MP4WriterAudioResampler::~MP4WriterAudioResampler()
+            {
+                if (transform)
+                {
+                    (void)transform->ProcessMessage(MFT_MESSAGE_NOTIFY_END_STREAMING, 0);
+                }
+            }
+
+            //**********************************************************************
+            // Hands a buffer of input audio to the resampler
+            //**********************************************************************
+            HRESULT MP4WriterAudioResampler::ProcessInput(IMFSample *sample)
+            {
+                return transform->ProcessInput(0, sample, 0);
+            }
+
+            //**********************************************************************
+            // Retrieves the next block of converted audio into a sample taken from
+            // 'pool'. Returns S_FALSE (and no sample) once the resampler needs more
+            // input.
+            //**********************************************************************
+            HRESULT MP4WriterAudioResampler::ProcessOutput(MP4WriterSamplePool *pool, IMFSample **sample, DWORD *numBytes)
+            {
+                CComPtr<IMFSample> outputSample;
+                CComPtr<IMFMediaBuffer> mediaBuffer;
+                HRESULT hr = pool->GetSample(outputBufferSize, &outputSample, &mediaBuffer);
+                IFS(mediaBuffer->SetCurrentLength(0));
+
+                MFT_OUTPUT_DATA_BUFFER output = {};
+                output.pSample = outputSample;
+                DWORD status = 0;
+                IFS(transform->ProcessOutput(0, 1, &output, &status));
+                if (output.pEvents != nullptr)
+                {
+                    output.pEvents->Release();
+                }
+                if (hr == MF_E_TRANSFORM_NEED_MORE_INPUT)
+                {
+                    return S_FALSE;
+                }
+
+                DWORD length = 0;
+                IFS(mediaBuffer->GetCurrentLength(&length));
+                if (SUCCEEDED(hr) && length == 0)
+                {
+                    return S_FALSE;
+                }
+                if (SUCCEEDED(hr))
+                {
+                    *sample = outputSample.Detach();
+                    *numBytes = length;
+                }
+                return hr;
+            }
+
+            //**********************************************************************
+            // Tells the resampler there is no more input, so that ProcessOutput()
+            // returns the audio it is still holding on to
+            //**********************************************************************
+            HRESULT MP4WriterAudioResampler::Drain()
+            {
+                return transform->ProcessMessage(MFT_MESSAGE_COMMAND_DRAIN, 0);
+            }
+        }
+    }
+}
@@ -0,0 +1,38 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "MP4WriterSamplePool.h"
+
+namespace Microsoft {
+    namespace Psi {
+        namespace Media_Interop {
+
+            //**********************************************************************
+            // MP4WriterAudioResampler converts the PCM audio handed to the MP4
+            // writer into the sample rate, channel count and sample size the AAC
+            // encoder accepts. It wraps the Windows audio resampler DSP
+            // (CLSID_CResamplerMediaObject), which also up/downmixes channels.
+            // Input is pushed with ProcessInput() and the converted audio pulled
+            // with ProcessOutput() until it reports S_FALSE.
+            //**********************************************************************
+            class MP4WriterAudioResampler
+            {
+            public:
+                static HRESULT CreateInstance(IMFMediaType *inputType, IMFMediaType *outputType, MP4WriterAudioResampler **resampler);
+                ~MP4WriterAudioResampler();
+
+                HRESULT ProcessInput(IMFSample *sample);
+                HRESULT ProcessOutput(MP4WriterSamplePool *pool, IMFSample **sample, DWORD *numBytes);
+                HRESULT Drain();
+
+            private:
+                MP4WriterAudioResampler();
+
+                CComPtr<IMFTransform> transform;        /* The resampler DSP */
+                DWORD outputBufferSize;                 /* Size of the buffers we ask the resampler to fill */
+            };
+        }
+    }
+}
@@ -0,0 +1,192 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "StdAfx.h"
+#include <atlbase.h>
+#include <new>
+#include "MP4WriterSamplePool.h"
+
+namespace Microsoft {
+    namespace Psi {
+        namespace Media_Interop {
+
+#define IFS(expr) do { if (SUCCEEDED(hr)) hr = expr; } while(0)
+
+            //**********************************************************************
+            // Creates an empty pool. Up to 'maxFreeSamples' returned samples are
+            // kept for reuse.
+            //**********************************************************************
+            HRESULT MP4WriterSamplePool::CreateInstance(UINT32 maxFreeSamples, MP4WriterSamplePool **pool)
+            {
+                if (pool == nullptr)
+                {
+                    return E_POINTER;
+                }
+
+                // The ctor sets the ref count to 1
+                *pool = new (std::nothrow) MP4WriterSamplePool(maxFreeSamples);
+                return (*pool != nullptr) ? S_OK : E_OUTOFMEMORY;
+            }
+
+            //**********************************************************************
+            MP4WriterSamplePool::MP4WriterSamplePool(UINT32 maxFreeSamples) :
+                refCount(1),
+                maxFreeSamples(maxFreeSamples),
+                shutdown(false)
+            {
+                InitializeCriticalSection(&lock);
+            }
+
+            //**********************************************************************
+            MP4WriterSamplePool::~MP4WriterSamplePool()
+            {
+                Shutdown();
+                DeleteCriticalSection(&lock);
+            }
+
+            //**********************************************************************
+            ULONG MP4WriterSamplePool::AddRef()
+            {
+                return InterlockedIncrement(&refCount);
+            }
+
+            //**********************************************************************
+            ULONG MP4WriterSamplePool::Release()
+            {
+                ULONG count = InterlockedDecrement(&refCount);
+                if (count == 0)
+                {
+                    delete this;
+                }
+                return count;
+            }
+
+            //**********************************************************************
+            HRESULT MP4WriterSamplePool::QueryInterface(REFIID riid, void** ppv)
+            {
+                if (riid == __uuidof(IMFAsyncCallback) || riid == __uuidof(IUnknown))
+                {
+                    *ppv = static_cast<IMFAsyncCallback*>(this);
+                    AddRef();
+                    return S_OK;
+                }
+                *ppv = nullptr;
+                return E_NOINTERFACE;
+            }
+
+            //**********************************************************************
+            HRESULT MP4WriterSamplePool::GetParameters(DWORD *flags, DWORD *queue)
+            {
+                UNREFERENCED_PARAMETER(flags);
+                UNREFERENCED_PARAMETER(queue);
+                return E_NOTIMPL;
+            }
+
+            //**********************************************************************
+            // Called by Media Foundation once the last reference to one of our
+            // tracked samples has been released. The result's object is the sample.
+            //**********************************************************************
+            HRESULT MP4WriterSamplePool::Invoke(IMFAsyncResult *result)
+            {
+                CComPtr<IUnknown> object;
+                CComPtr<IMFSample> sample;
+                HRESULT hr = result->GetObject(&object);
+                IFS(object->QueryInterface(IID_PPV_ARGS(&sample)));
+                if (FAILED(hr))
+                {
+                    return hr;
+                }
+
+                // Drop whatever attributes the previous user left on the sample
+                (void)sample->DeleteAllItems();
+
+                EnterCriticalSection(&lock);
+                if (!shutdown && freeSamples.size() < maxFreeSamples)
+                {
+                    freeSamples.push_back(sample.Detach());
+                }
+                LeaveCriticalSection(&lock);
+                return S_OK;
+            }
+
+            //**********************************************************************
+            // Returns a sample with a buffer of at least 'size' bytes attached,
+            // with the buffer's current length set to 'size'. We reuse the most
+            // recently returned sample that is big enough (the video and audio
+            // streams each have a pool, so in practice all samples in a pool are
+            // the same size) and only allocate when there is none. Each time a
+            // sample is handed out we have to re-arm its release notification.
+            //**********************************************************************
+            HRESULT MP4WriterSamplePool::GetSample(DWORD size, IMFSample **sample, IMFMediaBuffer **buffer)
+            {
+                HRESULT hr = S_OK;
+                CComPtr<IMFSample> recycled;
+                CComPtr<IMFMediaBuffer> mediaBuffer;
+                EnterCriticalSection(&lock);
+                for (size_t i = freeSamples.size(); i-- > 0 && !recycled;)
+                {
+                    CComPtr<IMFMediaBuffer> candidate;
+                    DWORD maxLength = 0;
+                    if (SUCCEEDED(freeSamples[i]->GetBufferByIndex(0, &candidate)) &&
+                        SUCCEEDED(candidate->GetMaxLength(&maxLength)) &&
+                        maxLength >= size)
+                    {
+                        recycled.Attach(freeSamples[i]);
+                        freeSamples.erase(freeSamples.begin() + i);
+                        mediaBuffer = candidate;
+                    }
+                }
+                LeaveCriticalSection(&lock);
+
+                if (!recycled)
+                {
+                    CComPtr<IMFTrackedSample> trackedSample;
+                    IFS(MFCreateTrackedSample(&trackedSample));
+                    IFS(trackedSample->QueryInterface(IID_PPV_ARGS(&recycled)));
+                    IFS(MFCreateAlignedMemoryBuffer(size, MF_64_BYTE_ALIGNMENT, &mediaBuffer));
+                    IFS(recycled->AddBuffer(mediaBuffer));
+                }
+                IFS(mediaBuffer->SetCurrentLength(size));
+
+                CComPtr<IMFTrackedSample> trackedSample;
+                IFS(recycled->QueryInterface(IID_PPV_ARGS(&trackedSample)));
+                IFS(trackedSample->SetAllocator(this, nullptr));
+                if (SUCCEEDED(hr))
+                {
+                    *sample = recycled.Detach();
+                    *buffer = mediaBuffer.Detach();
+                }
+                return hr;
+            }
+
+            //**********************************************************************
+            // Changes the number of returned samples kept for reuse. Should be at
+            // least the number of samples that can be in flight at once (queued
+            // for the encode thread plus held by the encoder).
+            //**********************************************************************
+            void MP4WriterSamplePool::SetMaxFreeSamples(UINT32 maxSamples)
+            {
+                EnterCriticalSection(&lock);
+                maxFreeSamples = maxSamples;
+                LeaveCriticalSection(&lock);
+            }
+
+            //**********************************************************************
+            // Frees the samples waiting for reuse. Samples still held by the sink
+            // writer are freed (rather than recycled) when it releases them.
+            //**********************************************************************
+            void MP4WriterSamplePool::Shutdown()
+            {
+                std::vector<IMFSample*> samples;
+                EnterCriticalSection(&lock);
+                shutdown = true;
+                samples.swap(freeSamples);
+                LeaveCriticalSection(&lock);
+                for (IMFSample *sample : samples)
+                {
+                    sample->Release();
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,51 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <vector>
+
+namespace Microsoft {
+    namespace Psi {
+        namespace Media_Interop {
+
+            //**********************************************************************
+            // MP4WriterSamplePool recycles the samples (and the memory buffers
+            // attached to them) that MP4WriterUnmanagedData hands to the sink
+            // writer, so that in steady state no frame or audio buffer has to be
+            // allocated. Samples are created with MFCreateTrackedSample, so Media
+            // Foundation calls us back through IMFAsyncCallback::Invoke() once the
+            // encoder has released its last reference, at which point the sample
+            // goes back on our free list instead of being destroyed.
+            //**********************************************************************
+            class MP4WriterSamplePool : public IMFAsyncCallback
+            {
+            public:
+                static HRESULT CreateInstance(UINT32 maxFreeSamples, MP4WriterSamplePool **pool);
+
+                // IUnknown methods
+                STDMETHODIMP QueryInterface(REFIID iid, void** ppv);
+                STDMETHODIMP_(ULONG) AddRef();
+                STDMETHODIMP_(ULONG) Release();
+
+                // IMFAsyncCallback methods
+                STDMETHODIMP GetParameters(DWORD *flags, DWORD *queue);
+                STDMETHODIMP Invoke(IMFAsyncResult *result);
+
+                HRESULT GetSample(DWORD size, IMFSample **sample, IMFMediaBuffer **buffer);
+                void SetMaxFreeSamples(UINT32 maxSamples);
+                void Shutdown();
+
+            protected:
+                MP4WriterSamplePool(UINT32 maxFreeSamples);
+                virtual ~MP4WriterSamplePool();
+
+                long refCount;                          /* COM reference count */
+                UINT32 maxFreeSamples;                  /* Number of returned samples we keep; any beyond that are freed */
+                bool shutdown;                          /* Set once the owner is done with us. Returned samples are freed */
+                std::vector<IMFSample*> freeSamples;    /* Samples ready for reuse (we hold a reference on each) */
+                CRITICAL_SECTION lock;                  /* Guards freeSamples and shutdown */
+            };
+        }
+    }
+}
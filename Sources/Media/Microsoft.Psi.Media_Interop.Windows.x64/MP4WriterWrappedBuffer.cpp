@@ -0,0 +1,149 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "StdAfx.h"
+#include <new>
+#include "MP4WriterWrappedBuffer.h"
+
+namespace Microsoft {
+    namespace Psi {
+        namespace Media_Interop {
+
+            //**********************************************************************
+            // Wraps 'length' bytes at 'data'. Once created the buffer owns the
+            // release: 'handler' is called when the buffer is destroyed. If we fail
+            // to create it the handler is called right away, so the caller never
+            // has to tell the two cases apart.
+            //**********************************************************************
+            HRESULT MP4WriterWrappedBuffer::CreateInstance(BYTE *data, DWORD length, MP4WriterBufferReleasedHandler handler, void *context, IMFMediaBuffer **buffer)
+            {
+                if (buffer == nullptr)
+                {
+                    if (handler != nullptr)
+                    {
+                        handler(context);
+                    }
+                    return E_POINTER;
+                }
+
+                // The ctor sets the ref count to 1
+                MP4WriterWrappedBuffer *wrapped = new (std::nothrow) MP4WriterWrappedBuffer(data, length, handler, context);
+                if (wrapped == nullptr)
+                {
+                    if (handler != nullptr)
+                    {
+                        handler(context);
+                    }
+                    return E_OUTOFMEMORY;
+                }
+                *buffer = wrapped;
+                return S_OK;
+            }
+
+            //**********************************************************************
+            MP4WriterWrappedBuffer::MP4WriterWrappedBuffer(BYTE *data, DWORD length, MP4WriterBufferReleasedHandler handler, void *context) :
+                refCount(1),
+                data(data),
+                length(length),
+                handler(handler),
+                context(context)
+            {
+            }
+
+            //**********************************************************************
+            MP4WriterWrappedBuffer::~MP4WriterWrappedBuffer()
+            {
+                if (handler != nullptr)
+                {
+                    handler(context);
+                }
+            }
+
+            //**********************************************************************
+            ULONG MP4WriterWrappedBuffer::AddRef()
+            {
+                return InterlockedIncrement(&refCount);
+            }
+
+            //**********************************************************************
+            ULONG MP4WriterWrappedBuffer::Release()
+            {
+                ULONG count = InterlockedDecrement(&refCount);
+                if (count == 0)
+                {
+                    delete this;
+                }
+                return count;
+            }
+
+            //**********************************************************************
+            HRESULT MP4WriterWrappedBuffer::QueryInterface(REFIID riid, void** ppv)
+            {
+                if (riid == __uuidof(IMFMediaBuffer) || riid == __uuidof(IUnknown))
+                {
+                    *ppv = static_cast<IMFMediaBuffer*>(this);
+                    AddRef();
+                    return S_OK;
+                }
+                *ppv = nullptr;
+                return E_NOINTERFACE;
+            }
+
+            //**********************************************************************
+            HRESULT MP4WriterWrappedBuffer::Lock(BYTE **buffer, DWORD *maxLength, DWORD *currentLength)
+            {
+                if (buffer == nullptr)
+                {
+                    return E_POINTER;
+                }
+                *buffer = data;
+                if (maxLength != nullptr)
+                {
+                    *maxLength = length;
+                }
+                if (currentLength != nullptr)
+                {
+                    *currentLength = length;
+                }
+                return S_OK;
+            }
+
+            //**********************************************************************
+            HRESULT MP4WriterWrappedBuffer::Unlock()
+            {
+                return S_OK;
+            }
+
+            //**********************************************************************
+            HRESULT MP4WriterWrappedBuffer::GetCurrentLength(DWORD *currentLength)
+            {
+                if (currentLength == nullptr)
+                {
+                    return E_POINTER;
+                }
+                *currentLength = length;
+                return S_OK;
+            }
+
+            //**********************************************************************
+            // The wrapped frame is always full, so the only length we accept is
+            // the one we already have
+            //**********************************************************************
+            HRESULT MP4WriterWrappedBuffer::SetCurrentLength(DWORD currentLength)
+            {
+                return (currentLength == length) ? S_OK : E_INVALIDARG;
+            }
+
+            //**********************************************************************
+            HRESULT MP4WriterWrappedBuffer::GetMaxLength(DWORD *maxLength)
+            {
+                if (maxLength == nullptr)
+                {
+                    return E_POINTER;
+                }
+                *maxLength = length;
+                return S_OK;
+            }
+        }
+    }
+}
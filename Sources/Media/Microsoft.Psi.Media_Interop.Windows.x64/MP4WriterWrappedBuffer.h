@@ -0,0 +1,52 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+namespace Microsoft {
+    namespace Psi {
+        namespace Media_Interop {
+
+            //**********************************************************************
+            // Called once the encoder no longer needs memory handed to
+            // MP4WriterUnmanagedData::WriteVideoFrameNoCopy().
+            //**********************************************************************
+            typedef void (__stdcall *MP4WriterBufferReleasedHandler)(void *context);
+
+            //**********************************************************************
+            // MP4WriterWrappedBuffer is an IMFMediaBuffer over memory owned by the
+            // caller, so a frame can be passed to the sink writer without copying
+            // it. When Media Foundation drops its last reference the caller's
+            // release handler is invoked, on whatever thread that happens to be.
+            // The memory is treated as read-only.
+            //**********************************************************************
+            class MP4WriterWrappedBuffer : public IMFMediaBuffer
+            {
+            public:
+                static HRESULT CreateInstance(BYTE *data, DWORD length, MP4WriterBufferReleasedHandler handler, void *context, IMFMediaBuffer **buffer);
+
+                // IUnknown methods
+                STDMETHODIMP QueryInterface(REFIID iid, void** ppv);
+                STDMETHODIMP_(ULONG) AddRef();
+                STDMETHODIMP_(ULONG) Release();
+
+                // IMFMediaBuffer methods
+                STDMETHODIMP Lock(BYTE **buffer, DWORD *maxLength, DWORD *currentLength);
+                STDMETHODIMP Unlock();
+                STDMETHODIMP GetCurrentLength(DWORD *currentLength);
+                STDMETHODIMP SetCurrentLength(DWORD currentLength);
+                STDMETHODIMP GetMaxLength(DWORD *maxLength);
+
+            protected:
+                MP4WriterWrappedBuffer(BYTE *data, DWORD length, MP4WriterBufferReleasedHandler handler, void *context);
+                virtual ~MP4WriterWrappedBuffer();
+
+                long refCount;                          /* COM reference count */
+                BYTE *data;                             /* Caller's memory */
+                DWORD length;                           /* Number of valid bytes at data */
+                MP4WriterBufferReleasedHandler handler; /* Called (with context) when we are destroyed */
+                void *context;                          /* Caller's cookie for the handler */
+            };
+        }
+    }
+}
@@ -12,6 +12,8 @@ using namespace System::Runtime::InteropServices;
 #include "ks.h"
 #include "ksmedia.h"
 
+using namespace System::Threading::Tasks;
+
 namespace Microsoft {
 namespace Psi {
 namespace Media_Interop {
@@ -27,8 +29,15 @@ MediaCaptureDevice::MediaCaptureDevice(IMFActivate *pActivate)
     
     m_pSourceReader = NULL;
     _pMediaSource = NULL;
+    m_pAudioSource = NULL;
+    m_pAggregateSource = NULL;
+    m_pD3DDevice = NULL;
+    m_pDXGIManager = NULL;
+    m_pStagingTexture = NULL;
     
     m_readSampleHandlerHandle = nullptr;
+    m_threadPriority = System::Threading::ThreadPriority::Normal;
+    m_threadAffinityMask = 0;
 
     InitializeFromActivate(pActivate, nullptr);
 
@@ -45,6 +54,13 @@ MediaCaptureDevice::MediaCaptureDevice(String^ name, String^ symbolicLink, bool
 {
     m_pSourceReader = NULL;
     _pMediaSource = NULL;
+    m_pAudioSource = NULL;
+    m_pAggregateSource = NULL;
+    m_pD3DDevice = NULL;
+    m_pDXGIManager = NULL;
+    m_pStagingTexture = NULL;
+    m_threadPriority = System::Threading::ThreadPriority::Normal;
+    m_threadAffinityMask = 0;
 
     IMFActivate *pActivate = NULL;
 
@@ -151,11 +167,133 @@ IMFActivate *MediaCaptureDevice::GetActivate(String^ symbolicLink, bool useInSha
     return pActivate;
 }
 
+/// <summary>
+/// Creates the media source for an audio capture endpoint.
+/// </summary>
+/// <param name="audioEndpointId"> Endpoint ID of the audio capture device </param>
+IMFMediaSource *MediaCaptureDevice::CreateAudioSource(String^ audioEndpointId)
+{
+    HRESULT hr = S_OK;
+    IMFAttributes *pAttributes = NULL;
+    IMFMediaSource *pSource = NULL;
+    IntPtr id = IntPtr::Zero;
+
+    try
+    {
+        hr = MFCreateAttributes(&pAttributes, 2);
+        MF_THROWHR(hr);
+
+        hr = pAttributes->SetGUID(
+            MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE,
+            MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_AUDCAP_GUID);
+        MF_THROWHR(hr);
+
+        id = Marshal::StringToCoTaskMemUni(audioEndpointId);
+
+        hr = pAttributes->SetString(
+            MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_AUDCAP_ENDPOINT_ID,
+            (LPCWSTR)id.ToPointer());
+        MF_THROWHR(hr);
+
+        hr = MFCreateDeviceSource(pAttributes, &pSource);
+        MF_THROWHR(hr);
+    }
+    finally
+    {
+        Marshal::FreeCoTaskMem(id);
+        MF_RELEASE(pAttributes);
+    }
+
+    return pSource;
+}
+
 /// <summary>
 ///  Attaches to the underlying device.
 /// </summary>
 /// <returns>True if succesfully attached, false otherwise</returns>
 bool MediaCaptureDevice::Attach(bool useInSharedMode)
+{
+    return Attach(useInSharedMode, nullptr, false);
+}
+
+/// <summary>
+///  Attaches to the underlying device, optionally together with an audio capture device.
+/// </summary>
+/// <param name="useInSharedMode"> Is the device to be used in shared mode? </param>
+/// <param name="audioEndpointId"> Endpoint ID of the audio capture device to aggregate, or null for none </param>
+/// <returns>True if succesfully attached, false otherwise</returns>
+bool MediaCaptureDevice::Attach(bool useInSharedMode, String^ audioEndpointId)
+{
+    return Attach(useInSharedMode, audioEndpointId, false);
+}
+
+/// <summary>
+///  Creates the D3D11 device and the DXGI device manager the source reader decodes
+///  and converts frames with when capturing on the GPU.
+/// </summary>
+void MediaCaptureDevice::CreateD3DManager()
+{
+    HRESULT hr = S_OK;
+    ID3D11Device *pDevice = NULL;
+    ID3D10Multithread *pMultithread = NULL;
+    IMFDXGIDeviceManager *pManager = NULL;
+    UINT resetToken = 0;
+
+    try
+    {
+        D3D_FEATURE_LEVEL featureLevels[] = { D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0, D3D_FEATURE_LEVEL_10_1, D3D_FEATURE_LEVEL_10_0 };
+        hr = D3D11CreateDevice(
+            NULL,
+            D3D_DRIVER_TYPE_HARDWARE,
+            NULL,
+            D3D11_CREATE_DEVICE_VIDEO_SUPPORT | D3D11_CREATE_DEVICE_BGRA_SUPPORT,
+            featureLevels,
+            ARRAYSIZE(featureLevels),
+            D3D11_SDK_VERSION,
+            &pDevice,
+            NULL,
+            NULL);
+        MF_THROWHR(hr);
+
+        // MF uses the device from its own threads, as do the consumers of the frames
+        hr = pDevice->QueryInterface(IID_PPV_ARGS(&pMultithread));
+        MF_THROWHR(hr);
+        pMultithread->SetMultithreadProtected(TRUE);
+
+        hr = MFCreateDXGIDeviceManager(&resetToken, &pManager);
+        MF_THROWHR(hr);
+
+        hr = pManager->ResetDevice(pDevice, resetToken);
+        MF_THROWHR(hr);
+
+        m_pD3DDevice = pDevice;
+        m_pD3DDevice->AddRef();
+
+        m_pDXGIManager = pManager;
+        m_pDXGIManager->AddRef();
+    }
+    finally
+    {
+        MF_RELEASE(pMultithread);
+        MF_RELEASE(pManager);
+        MF_RELEASE(pDevice);
+    }
+}
+
+/// <summary>
+///  Attaches to the underlying device, optionally together with an audio capture device
+///  (typically the camera's built-in microphone). Both are read through one source reader,
+///  so all of their streams are delivered on the same callback thread with timestamps from
+///  the same clock.
+/// </summary>
+/// <param name="useInSharedMode"> Is the device to be used in shared mode? </param>
+/// <param name="audioEndpointId"> Endpoint ID of the audio capture device to aggregate, or null for none </param>
+/// <param name="useGpuFrames">
+/// If true, video frames are decoded and converted on the GPU and delivered as D3D11 textures
+/// (see CaptureStreamTextures). CPU handlers then get RGB32 frames read back by MF. Requires Windows 8 or later.
+/// </param>
+/// <returns>True if succesfully attached, false otherwise</returns>
+bool MediaCaptureDevice::Attach(bool useInSharedMode, String^ audioEndpointId, bool useGpuFrames)
 {
     if (m_pSourceReader != NULL)
     {
@@ -166,6 +304,9 @@ bool MediaCaptureDevice::Attach(bool useInSharedMode)
     HRESULT hr = S_OK;
     IMFActivate *pActivate = NULL;
     IMFMediaSource *pMediaSource = NULL;
+    IMFMediaSource *pAudioSource = NULL;
+    IMFMediaSource *pReaderSource = NULL;
+    IMFCollection *pSources = NULL;
     IMFSourceReader *pSourceReader = NULL;
     IMFAttributes *pAttributes = NULL;
 
@@ -175,11 +316,17 @@ bool MediaCaptureDevice::Attach(bool useInSharedMode)
         hr = SourceReaderCallback::CreateInstance(p);
         MF_THROWHR(hr);
 
-        m_readSampleDelegateInternal = gcnew ReadSampleDelegate(this, &MediaCaptureDevice::ReadSampleThunk);
+        Media::Threading::ThreadPolicy threadPolicy = GetThreadPolicy();
+        m_callback->SetThreadPolicy(threadPolicy);
+
+        m_readSampleDelegateInternal = gcnew ReadStreamSampleDelegate(this, &MediaCaptureDevice::ReadSampleThunk);
 
         // pin this callback in memory
         m_readSampleHandlerHandle = GCHandle::Alloc(m_readSampleDelegateInternal);
 
+        m_readTextureDelegateInternal = gcnew ReadTextureSampleDelegate(this, &MediaCaptureDevice::ReadTextureThunk);
+        m_readTextureHandlerHandle = GCHandle::Alloc(m_readTextureDelegateInternal);
+
         pActivate = GetActivate(m_symbolicLink, useInSharedMode);
 
         hr = MFCreateAttributes(&pAttributes, 2);
@@ -192,41 +339,123 @@ bool MediaCaptureDevice::Attach(bool useInSharedMode)
 			MF_THROWHR(hr);
 			hr = pAttributes->SetUINT32(MF_READWRITE_DISABLE_CONVERTERS, FALSE);
 			MF_THROWHR(hr);
+
+			// Puts the source reader's own work queue threads (decoding, color conversion)
+			// under the same MMCSS task as the thread we process samples on
+			const wchar_t *mmcssTask = Media::Threading::GetMmcssTaskName(threadPolicy);
+			if (mmcssTask != nullptr)
+			{
+				hr = pAttributes->SetString(MF_READWRITE_MMCSS_CLASS, mmcssTask);
+				MF_THROWHR(hr);
+				hr = pAttributes->SetUINT32(MF_READWRITE_MMCSS_PRIORITY, (UINT32)Media::Threading::GetMmcssPriority(threadPolicy));
+				MF_THROWHR(hr);
+			}
+
+			if (useGpuFrames)
+			{
+				CreateD3DManager();
+
+				hr = pAttributes->SetUnknown(MF_SOURCE_READER_D3D_MANAGER, m_pDXGIManager);
+				MF_THROWHR(hr);
+			}
 		}
 		else
 		{
+			if (useGpuFrames)
+			{
+				hr = MF_E_UNSUPPORTED_D3D_TYPE;
+				MF_THROWHR(hr);
+			}
+
 			hr = pAttributes->SetUINT32(MF_SOURCE_READER_ENABLE_VIDEO_PROCESSING, TRUE);
 			MF_THROWHR(hr);
 		}
 
 
-		hr = pAttributes->SetUnknown(MF_SOURCE_READER_ASYNC_CALLBACK, m_callback);
+		hr = pAttributes->SetUnknown(MF_SOURCE_READER_ASYNC_CALLBACK, static_cast<IMFSourceReaderCallback*>(m_callback));
         MF_THROWHR(hr);
 
         hr = pActivate->ActivateObject(IID_IMFMediaSource, (void **)&pMediaSource);
         MF_THROWHR(hr);
 
-        hr = MFCreateSourceReaderFromMediaSource(pMediaSource, pAttributes, &pSourceReader);
+        if (!String::IsNullOrEmpty(audioEndpointId))
+        {
+            pAudioSource = CreateAudioSource(audioEndpointId);
+
+            hr = MFCreateCollection(&pSources);
+            MF_THROWHR(hr);
+
+            hr = pSources->AddElement(pMediaSource);
+            MF_THROWHR(hr);
+
+            hr = pSources->AddElement(pAudioSource);
+            MF_THROWHR(hr);
+
+            hr = MFCreateAggregateSource(pSources, &pReaderSource);
+            MF_THROWHR(hr);
+        }
+        else
+        {
+            pReaderSource = pMediaSource;
+            pReaderSource->AddRef();
+        }
+
+        hr = MFCreateSourceReaderFromMediaSource(pReaderSource, pAttributes, &pSourceReader);
+        MF_THROWHR(hr);
+
+        // Streams are only read once something captures them, so don't let the
+        // source produce samples for the others
+        hr = pSourceReader->SetStreamSelection((DWORD)MF_SOURCE_READER_ALL_STREAMS, FALSE);
         MF_THROWHR(hr);
 
         hr = pSourceReader->SetStreamSelection((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, TRUE);
         MF_THROWHR(hr);
 
-        m_callback->SetSourceReader(pSourceReader);
+        hr = m_callback->SetSourceReader(pSourceReader);
+        MF_THROWHR(hr);
 
         m_pSourceReader = pSourceReader;
         m_pSourceReader->AddRef();
 
+        // Reading the native types is one of the slower parts of attaching, and they don't
+        // change, so a reattach reuses them
+        if (m_nativeFormats == nullptr)
+        {
+            LoadNativeFormats();
+        }
+
+        m_streamSampleCallbacks = gcnew array<ReadStreamSampleDelegate^>((int)m_callback->GetStreamCount());
+        m_streamTextureCallbacks = gcnew array<ReadTextureSampleDelegate^>((int)m_callback->GetStreamCount());
+
         _pMediaSource = pMediaSource;
         _pMediaSource->AddRef();
 
+        if (pAudioSource != NULL)
+        {
+            m_pAudioSource = pAudioSource;
+            m_pAudioSource->AddRef();
+
+            m_pAggregateSource = pReaderSource;
+            m_pAggregateSource->AddRef();
+        }
+
         m_pActivate = pActivate;
         m_pActivate->AddRef();
 
-        m_lastFrameTime = 0;
+        m_attachSharedMode = useInSharedMode;
+        m_attachAudioEndpointId = audioEndpointId;
+        m_attachGpuFrames = useGpuFrames;
     }
     catch (Object^)
     {
+        if (pAudioSource != NULL && m_pAudioSource == NULL)
+        {
+            pAudioSource->Shutdown();
+        }
+        if (pMediaSource != NULL && _pMediaSource == NULL)
+        {
+            pMediaSource->Shutdown();
+        }
         Shutdown();
         return false;
     }
@@ -234,41 +463,220 @@ bool MediaCaptureDevice::Attach(bool useInSharedMode)
     {
         MF_RELEASE(pAttributes);
         MF_RELEASE(pActivate);
+        MF_RELEASE(pSources);
+        MF_RELEASE(pReaderSource);
+        MF_RELEASE(pAudioSource);
         MF_RELEASE(pMediaSource);
         MF_RELEASE(pSourceReader);
     }
     return true;
 }
 
+/// <summary>
+///  Sets the scheduling of the threads capture runs on: the device's own thread samples are
+///  processed on, and the source reader's own work queue threads. Above normal priorities
+///  register the threads with the MMCSS "Capture" task (at high priority for Highest), lower
+///  ones just lower them. Call before Attach: the source reader's threads are set up when it
+///  is created, while the delivery thread picks up a new policy with its next sample.
+/// </summary>
+/// <param name="priority"> Priority of the capture threads (Normal leaves them as they are) </param>
+/// <param name="affinityMask"> Bit n lets the delivery thread run on logical processor n (0 for any) </param>
+void MediaCaptureDevice::SetThreadPolicy(System::Threading::ThreadPriority priority, UInt64 affinityMask)
+{
+    m_threadPriority = priority;
+    m_threadAffinityMask = affinityMask;
+    if (m_callback != NULL)
+    {
+        m_callback->SetThreadPolicy(GetThreadPolicy());
+    }
+}
+
+/// <summary>
+///  Returns the native form of the policy set with SetThreadPolicy
+/// </summary>
+Media::Threading::ThreadPolicy MediaCaptureDevice::GetThreadPolicy()
+{
+    return Media::Threading::MakeThreadPolicy((int)m_threadPriority, Media::Threading::ThreadTask_Capture, m_threadAffinityMask);
+}
+
+/// <summary>
+///  Detaches and attaches again with the options of the last Attach, e.g. after a USB reset.
+///  The device is opened directly from its symbolic link, without enumerating devices, its
+///  cached native formats are reused, and the last format set is applied again. Capture started
+///  with CaptureSample is restarted; streams started with CaptureStream must be captured again.
+/// </summary>
+/// <returns>True if succesfully reattached, false otherwise</returns>
+bool MediaCaptureDevice::Reattach()
+{
+    Shutdown();
+
+    if (!Attach(m_attachSharedMode, m_attachAudioEndpointId, m_attachGpuFrames))
+    {
+        return false;
+    }
+
+    try
+    {
+        if (m_lastFormat != nullptr)
+        {
+            CurrentFormat = m_lastFormat;
+        }
+
+        if (m_readSampleCallback != nullptr)
+        {
+            CaptureSample(m_readSampleCallback);
+        }
+    }
+    catch (Exception^)
+    {
+        Shutdown();
+        return false;
+    }
+
+    return true;
+}
+
+/// <summary>
+///  Attaches one device of a batch, on a thread of the parallel loop
+/// </summary>
+ref class ParallelAttach
+{
+public:
+    array<MediaCaptureDevice^>^ devices;
+    array<bool>^ results;
+    bool useInSharedMode;
+
+    void AttachDevice(int index)
+    {
+        results[index] = devices[index]->Attach(useInSharedMode);
+    }
+};
+
+/// <summary>
+///  Attaches several devices concurrently. Activating a device, creating its source reader
+///  and reading its native formats each take a while, so on rigs with many cameras doing
+///  them in parallel shortens startup considerably.
+/// </summary>
+/// <param name="devices">The devices to attach</param>
+/// <param name="useInSharedMode">Are the devices to be used in shared mode?</param>
+/// <returns>For each device, true if it was attached</returns>
+array<bool>^ MediaCaptureDevice::Attach(array<MediaCaptureDevice^>^ devices, bool useInSharedMode)
+{
+    ParallelAttach^ attach = gcnew ParallelAttach();
+    attach->devices = devices;
+    attach->results = gcnew array<bool>(devices->Length);
+    attach->useInSharedMode = useInSharedMode;
+
+    Parallel::For(0, devices->Length, gcnew Action<int>(attach, &ParallelAttach::AttachDevice));
+
+    return attach->results;
+}
+
+/// <summary>
+///  Enumerates all video capture devices once and attaches all of them concurrently.
+/// </summary>
+/// <param name="useInSharedMode">Are the devices to be used in shared mode?</param>
+/// <returns>The devices that could be attached</returns>
+array<MediaCaptureDevice^>^ MediaCaptureDevice::AttachAll(bool useInSharedMode)
+{
+    List<MediaCaptureDevice^>^ devices = gcnew List<MediaCaptureDevice^>(AllDevices);
+    array<MediaCaptureDevice^>^ candidates = devices->ToArray();
+    array<bool>^ attached = Attach(candidates, useInSharedMode);
+
+    List<MediaCaptureDevice^>^ result = gcnew List<MediaCaptureDevice^>();
+    for (int i = 0; i < candidates->Length; i++)
+    {
+        if (attached[i])
+        {
+            result->Add(candidates[i]);
+        }
+    }
+    return result->ToArray();
+}
+
 /// <summary>
 /// Thunks from Managed to unmanaged code
 /// </summary>
-/// <param name="data"> Image data as RGB24 byte array </param>
-/// <param name="cbLength"> Length of Image data in bytes </param>
+/// <param name="streamIndex"> Source reader index of the stream the sample belongs to </param>
+/// <param name="data"> Sample data </param>
+/// <param name="cbLength"> Length of sample data in bytes </param>
 /// <param name="timestamp"> Timestamp of sample </param>
-void MediaCaptureDevice::ReadSampleThunk(IntPtr pbData, int cbLength, LONGLONG timestamp)
+/// <param name="arrivalTime"> QPC time the sample arrived at </param>
+/// <param name="correctedTime"> Device timestamp mapped onto the QPC clock </param>
+void MediaCaptureDevice::ReadSampleThunk(int streamIndex, IntPtr pbData, int cbLength, LONGLONG timestamp, LONGLONG arrivalTime, LONGLONG correctedTime)
 {
-    if (m_readSampleCallback != nullptr)
+    array<ReadStreamSampleDelegate^>^ streamCallbacks = m_streamSampleCallbacks;
+    if (streamCallbacks != nullptr && streamIndex >= 0 && streamIndex < streamCallbacks->Length && streamCallbacks[streamIndex] != nullptr)
+    {
+        streamCallbacks[streamIndex](streamIndex, pbData, cbLength, timestamp, arrivalTime, correctedTime);
+    }
+    else if (m_readSampleCallback != nullptr)
     {
         m_readSampleCallback(pbData, cbLength, timestamp);
     }
 }
 
 
+/// <summary>
+/// Thunks texture samples from unmanaged to managed code
+/// </summary>
+/// <param name="streamIndex"> Source reader index of the stream the frame belongs to </param>
+/// <param name="texture"> The ID3D11Texture2D holding the frame </param>
+/// <param name="subresource"> Index of the frame's subresource in the texture </param>
+/// <param name="timestamp"> Timestamp of sample </param>
+/// <param name="arrivalTime"> QPC time the sample arrived at </param>
+/// <param name="correctedTime"> Device timestamp mapped onto the QPC clock </param>
+void MediaCaptureDevice::ReadTextureThunk(int streamIndex, IntPtr texture, int subresource, LONGLONG timestamp, LONGLONG arrivalTime, LONGLONG correctedTime)
+{
+    array<ReadTextureSampleDelegate^>^ textureCallbacks = m_streamTextureCallbacks;
+    if (textureCallbacks != nullptr && streamIndex >= 0 && streamIndex < textureCallbacks->Length && textureCallbacks[streamIndex] != nullptr)
+    {
+        textureCallbacks[streamIndex](streamIndex, texture, subresource, timestamp, arrivalTime, correctedTime);
+    }
+}
+
 /// <summary>
 ///  Detaches from the underlying source reader device.
 /// </summary>  
 void MediaCaptureDevice::Shutdown()
 {
+    if (m_pAggregateSource)
+    {
+        m_pAggregateSource->Shutdown();
+    }
+
+    if (m_pAudioSource)
+    {
+        m_pAudioSource->Shutdown();
+    }
+
     if (_pMediaSource)
     {
         _pMediaSource->Shutdown();
     }
 
     MF_RELEASE(m_pSourceReader);
+    MF_RELEASE(m_pAggregateSource);
+    MF_RELEASE(m_pAudioSource);
     MF_RELEASE(_pMediaSource);
     MF_RELEASE(m_pActivate);
+    if (m_callback)
+    {
+        m_callback->ReleaseWorkQueue();
+    }
     MF_RELEASE(m_callback);
+    MF_RELEASE(m_pStagingTexture);
+    MF_RELEASE(m_pDXGIManager);
+    MF_RELEASE(m_pD3DDevice);
+
+    m_streamSampleCallbacks = nullptr;
+    m_streamTextureCallbacks = nullptr;
+
+    if (m_readTextureHandlerHandle != nullptr)
+    {
+        m_readTextureHandlerHandle->Free();
+        m_readTextureHandlerHandle = nullptr;
+    }
 
     if (m_readSampleHandlerHandle != nullptr)
     {
@@ -284,16 +692,51 @@ void MediaCaptureDevice::Shutdown()
 /// <returns>List of supported capture formats</returns>
 IEnumerable<CaptureFormat^>^ MediaCaptureDevice::Formats::get()
 {
-    HRESULT hr = S_OK;
-    IMFMediaType *pMediaType = NULL;
     List<CaptureFormat^>^ list = gcnew List<CaptureFormat^>();
-    CaptureFormat^ curr = nullptr;
 
     if (!fAttached)
     {
         return list;
     }
 
+    for each (CaptureFormat^ curr in m_nativeFormats)
+    {
+        if (curr == nullptr)
+        {
+            continue;
+        }
+
+        bool fExists = false;
+        for each (CaptureFormat^ existing in list)
+        {
+            if (existing->nWidth == curr->nWidth &&
+                existing->nHeight == curr->nHeight &&
+                existing->nFrameRateNumerator == curr->nFrameRateNumerator &&
+                existing->nFrameRateDenominator == curr->nFrameRateDenominator &&
+                existing->subType->Guid == curr->subType->Guid)
+            {
+                fExists = true;
+                break;
+            }
+        }
+        if (!fExists)
+        {
+            list->Add(curr);
+        }
+    }
+
+    return list;
+}
+
+/// <summary>
+///  Reads the native media types of the first video stream into m_nativeFormats.
+/// </summary>
+void MediaCaptureDevice::LoadNativeFormats()
+{
+    HRESULT hr = S_OK;
+    IMFMediaType *pMediaType = NULL;
+    List<CaptureFormat^>^ formats = gcnew List<CaptureFormat^>();
+
     try
     {
         for (DWORD dwType = 0; ; dwType++)
@@ -306,30 +749,20 @@ IEnumerable<CaptureFormat^>^ MediaCaptureDevice::Formats::get()
                 &pMediaType);
             if (hr == MF_E_NO_MORE_TYPES)
             {
-                hr = S_OK;
                 break;
             }
             MF_THROWHR(hr);
 
-            curr = CaptureFormat::FromMediaType(pMediaType);
-
-            bool fExists = false;
-            for each (CaptureFormat^ existing in list)
+            // Keep the list indexed by native type, even for the types we can't describe
+            CaptureFormat^ format = nullptr;
+            try
             {
-                if (existing->nWidth == curr->nWidth &&
-                    existing->nHeight == curr->nHeight &&
-                    existing->nFrameRateNumerator == curr->nFrameRateNumerator &&
-                    existing->nFrameRateDenominator == curr->nFrameRateDenominator &&
-                    existing->subType->Guid == curr->subType->Guid)
-                {
-                    fExists = true;
-                    break;
-                }
+                format = CaptureFormat::FromMediaType(pMediaType);
             }
-            if (!fExists)
+            catch (Exception^)
             {
-                list->Add(curr);
             }
+            formats->Add(format);
         }
     }
     finally
@@ -337,7 +770,7 @@ IEnumerable<CaptureFormat^>^ MediaCaptureDevice::Formats::get()
         MF_RELEASE(pMediaType);
     }
 
-    return list;
+    m_nativeFormats = formats->ToArray();
 }
 
 /// <summary>
@@ -719,7 +1152,7 @@ CaptureFormat^ MediaCaptureDevice::CurrentFormat::get()
             &pMediaType);
         MF_THROWHR(hr);
 
-        // Return the user requested frame rate since this class will downsample
+        // Return the user requested frame rate since the callback decimates to it
         hr = MFSetAttributeRatio(pMediaType, MF_MT_FRAME_RATE, m_desiredRateNumerator, m_desiredRateDenominator);
         MF_THROWHR(hr);
         
@@ -731,6 +1164,58 @@ CaptureFormat^ MediaCaptureDevice::CurrentFormat::get()
     }
 }
 
+/// <summary>
+///  Finds the native media type of the first video stream to capture a format with. Rates
+///  within FrameRateTolerance of the requested one (e.g. 29.97 for 30) count as a match, and
+///  the closest of those is preferred; otherwise the slowest type faster than the requested
+///  rate is used, and the callback drops the extra frames.
+/// </summary>
+/// <param name="width">Requested width in pixels</param>
+/// <param name="height">Requested height in pixels</param>
+/// <param name="subtype">Requested native subtype</param>
+/// <param name="desiredRate">Requested frame rate</param>
+/// <returns>Index of the native media type, or -1 if there is none</returns>
+int MediaCaptureDevice::FindNativeMediaType(int width, int height, Guid subtype, double desiredRate)
+{
+    int matchIndex = -1;
+    double matchError = 0;
+    int fasterIndex = -1;
+    double fasterRate = 0;
+
+    for (int nTypeIndex = 0; nTypeIndex < m_nativeFormats->Length; nTypeIndex++)
+    {
+        CaptureFormat^ format = m_nativeFormats[nTypeIndex];
+
+        // Avoid divide by zero exception. We are being extra cautious here since MF shouldn't return a denominatorRate of 0.
+        if (format == nullptr ||
+            format->nFrameRateDenominator == 0 ||
+            format->nWidth != width ||
+            format->nHeight != height ||
+            format->subType->Guid != subtype)
+        {
+            continue;
+        }
+
+        double frameRate = ((double)format->nFrameRateNumerator) / format->nFrameRateDenominator;
+        double error = Math::Abs(frameRate - desiredRate);
+        if (error <= desiredRate * FrameRateTolerance)
+        {
+            if (matchIndex < 0 || error < matchError)
+            {
+                matchIndex = nTypeIndex;
+                matchError = error;
+            }
+        }
+        else if (frameRate > desiredRate && (fasterIndex < 0 || frameRate < fasterRate))
+        {
+            fasterIndex = nTypeIndex;
+            fasterRate = frameRate;
+        }
+    }
+
+    return matchIndex >= 0 ? matchIndex : fasterIndex;
+}
+
 /// <summary>
 ///  Sets the capture format currently used by the device.
 /// </summary>
@@ -765,14 +1250,20 @@ void MediaCaptureDevice::CurrentFormat::set(CaptureFormat ^value)
     IMFMediaType *pMediaType = NULL;
     bool found = false;
 
-    for (int nTypeIndex = 0; !found ;nTypeIndex++)
+    double desiredRate = ((double)value->nFrameRateNumerator) / value->nFrameRateDenominator;
+    int matchIndex = FindNativeMediaType(value->nWidth, value->nHeight, value->subType->Guid, desiredRate);
+    if (matchIndex < 0)
+    {
+        hr = MF_E_UNSUPPORTED_FORMAT;
+        MF_THROWHR(hr);
+    }
+
+    for (int nTypeIndex = matchIndex; !found ;nTypeIndex++)
     {
-        GUID nativeSubType;
         UINT32 resWidth = 0;
         UINT32 resHeight = 0;
         UINT32 numeratorRate = 0;
         UINT32 denominatorRate = 0;
-        double desiredRate = ((double)value->nFrameRateNumerator) / value->nFrameRateDenominator;
         try
         {
 
@@ -780,9 +1271,6 @@ void MediaCaptureDevice::CurrentFormat::set(CaptureFormat ^value)
             hr = m_pSourceReader->GetNativeMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, nTypeIndex, &pMediaType);
             MF_THROWHR(hr);
 
-            hr = pMediaType->GetGUID(MF_MT_SUBTYPE, &nativeSubType);
-            MF_THROWHR(hr);
-
             UINT64 res;
             hr = pMediaType->GetUINT64(MF_MT_FRAME_SIZE, &res);
             MF_THROWHR(hr);
@@ -793,19 +1281,8 @@ void MediaCaptureDevice::CurrentFormat::set(CaptureFormat ^value)
             MF_THROWHR(hr);
             Unpack2UINT32AsUINT64(rate, &numeratorRate, &denominatorRate);
 
-            // Avoid divide by zero exception. We are being extra cautious here since MF shouldn't return a denominatorRate of 0.
-            if (denominatorRate == 0)
-            {
-                continue;
-            }
-
-            double frameRate = ((double)numeratorRate) / denominatorRate;
-            
             // Find a media match
-            if (resWidth == (UINT32)value->nWidth &&
-                resHeight == (UINT32)value->nHeight &&
-				frameRate == desiredRate &&
-				nativeSubType == subtype)
+            if (nTypeIndex == matchIndex)
             {   
                 hr = pMediaType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
                 MF_THROWHR(hr);
@@ -817,34 +1294,62 @@ void MediaCaptureDevice::CurrentFormat::set(CaptureFormat ^value)
                 hr = MFSetAttributeRatio(pMediaType, MF_MT_FRAME_RATE, numeratorRate, denominatorRate);
                 MF_THROWHR(hr);
 
-				if (IsWindows8OrGreater())
+				// YUY2 and NV12 are delivered as is and converted to RGB24 by the callback,
+				// which is considerably cheaper than MF's video processor. MJPG is decoded
+				// by MF into YUY2 and converted the same way. On Windows 8 and later any
+				// other format is left to MF to convert to RGB24.
+				GUID outputSubtype = GUID_NULL;
+				if (subtype == MFVideoFormat_YUY2 || subtype == MFVideoFormat_NV12)
 				{
-					hr = pMediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB24);
-					MF_THROWHR(hr);
+					outputSubtype = subtype;
+				}
+				else if (subtype == MFVideoFormat_MJPG)
+				{
+					// The WMV reader does not support mjpg as an input format. However, MF
+					// will transcode if we set all of the other parameters up, but make the video type
+					// YUY2.
+					outputSubtype = MFVideoFormat_YUY2;
+				}
+				else if (IsWindows8OrGreater())
+				{
+					outputSubtype = MFVideoFormat_RGB24;
 				}
 				else
 				{
-					// We only support MJPG, YUY2  formats
-					if (subtype == MFVideoFormat_MJPG || subtype == MFVideoFormat_YUY2)
-					{
-						// The WMV reader does not support mjpg as an input format. However, MF
-						// will transcode if we set all of the other parameters up, but make the video type
-						// YUY2.
-				
-						// Set the image frame format to YUY2
-						hr = pMediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_YUY2);
-						MF_THROWHR(hr);
-					}
-					else
-					{
-						hr = MF_E_UNSUPPORTED_FORMAT;
-						MF_THROWHR(hr);
-					}
+					hr = MF_E_UNSUPPORTED_FORMAT;
+					MF_THROWHR(hr);
 				}
 
+				// On the GPU MF's video processor does all of the decoding and conversion, and
+				// D3D has no 24 bit formats
+				if (UsesGpuFrames)
+				{
+					outputSubtype = MFVideoFormat_RGB32;
+				}
+
+				hr = pMediaType->SetGUID(MF_MT_SUBTYPE, outputSubtype);
+				MF_THROWHR(hr);
 
                 // Saves the callback from having to read this from the media format which can be expensive.
-                m_callback->SetFormat(resWidth, resHeight);
+                m_callback->SetFormat(m_callback->GetFirstVideoStream(), resWidth, resHeight, outputSubtype);
+
+                // A native rate that only matched within the tolerance is captured as is, since
+                // decimating 29.97 to 30 would drop a frame every few seconds
+                UINT32 outputNumerator = (UINT32)value->nFrameRateNumerator;
+                UINT32 outputDenominator = (UINT32)value->nFrameRateDenominator;
+                double nativeRate = ((double)numeratorRate) / denominatorRate;
+                if (Math::Abs(nativeRate - desiredRate) <= desiredRate * FrameRateTolerance)
+                {
+                    outputNumerator = numeratorRate;
+                    outputDenominator = denominatorRate;
+                }
+
+                m_callback->SetFrameRate(
+                    m_callback->GetFirstVideoStream(),
+                    outputNumerator,
+                    outputDenominator,
+                    numeratorRate,
+                    denominatorRate);
 
                 hr = m_pSourceReader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, NULL, pMediaType);
                 MF_THROWHR(hr);
@@ -869,10 +1374,13 @@ void MediaCaptureDevice::CurrentFormat::set(CaptureFormat ^value)
         hr = MF_E_UNSUPPORTED_FORMAT;
         MF_THROWHR(hr);
     }
+
+    m_lastFormat = value;
 }
 
 /// <summary>
 ///  Sets up the capture pipeline if required and sets up async sample capture
+///  on the first video stream
 /// </summary>        
 /// <param name="handler">Handler to call after completing read sample</param>
 void MediaCaptureDevice::CaptureSample(ReadSampleDelegate^ handler)
@@ -885,7 +1393,336 @@ void MediaCaptureDevice::CaptureSample(ReadSampleDelegate^ handler)
     m_readSampleCallback = handler;
 
     IntPtr ip = Marshal::GetFunctionPointerForDelegate(m_readSampleDelegateInternal);
-    m_callback->CaptureSample((ReadSampleHandlerForDevice)ip.ToPointer());
+    HRESULT hr = m_callback->CaptureSample(m_callback->GetFirstVideoStream(), (ReadSampleHandlerForDevice)ip.ToPointer());
+    MF_THROWHR(hr);
+}
+
+/// <summary>
+///  Throws if the device isn't attached or the stream index is out of range
+/// </summary>        
+/// <param name="streamIndex">Source reader index of the stream</param>
+void MediaCaptureDevice::CheckStreamIndex(int streamIndex)
+{
+    if (!fAttached)
+    {
+        throw gcnew InvalidOperationException();
+    }
+
+    if (streamIndex < 0 || streamIndex >= (int)m_callback->GetStreamCount())
+    {
+        throw gcnew ArgumentOutOfRangeException("streamIndex");
+    }
+}
+
+/// <summary>
+///  Selects a stream and starts capturing it. Each captured stream is read independently
+///  of the others, and all of them are delivered on the source reader's callback thread.
+///  Audio streams are delivered as 16 bit PCM (see GetAudioFormat), YUY2, NV12 and MJPG
+///  video streams as RGB24, and any other stream (depth, infrared, ...) in its native format.
+/// </summary>        
+/// <param name="streamIndex">Source reader index of the stream (0 to StreamCount - 1)</param>
+/// <param name="handler">Handler to call with each sample of the stream</param>
+void MediaCaptureDevice::CaptureStream(int streamIndex, ReadStreamSampleDelegate^ handler)
+{
+    CheckStreamIndex(streamIndex);
+
+    HRESULT hr = S_OK;
+    IMFMediaType *pNativeType = NULL;
+    IMFMediaType *pMediaType = NULL;
+    DWORD index = (DWORD)streamIndex;
+
+    try
+    {
+        // The output format can only be changed before the stream is being read
+        if (!m_callback->IsCapturing(index))
+        {
+            if (IsAudioStream(streamIndex))
+            {
+                UINT32 sampleRate = 0;
+                UINT32 channels = 0;
+
+                hr = m_pSourceReader->GetNativeMediaType(index, 0, &pNativeType);
+                MF_THROWHR(hr);
+
+                hr = pNativeType->GetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, &sampleRate);
+                MF_THROWHR(hr);
+
+                hr = pNativeType->GetUINT32(MF_MT_AUDIO_NUM_CHANNELS, &channels);
+                MF_THROWHR(hr);
+
+                hr = MFCreateMediaType(&pMediaType);
+                MF_THROWHR(hr);
+
+                hr = pMediaType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio);
+                MF_THROWHR(hr);
+
+                hr = pMediaType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM);
+                MF_THROWHR(hr);
+
+                hr = pMediaType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, sampleRate);
+                MF_THROWHR(hr);
+
+                hr = pMediaType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, channels);
+                MF_THROWHR(hr);
+
+                hr = pMediaType->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, 16);
+                MF_THROWHR(hr);
+
+                hr = pMediaType->SetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT, channels * 2);
+                MF_THROWHR(hr);
+
+                hr = pMediaType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, sampleRate * channels * 2);
+                MF_THROWHR(hr);
+
+                hr = m_pSourceReader->SetCurrentMediaType(index, NULL, pMediaType);
+                MF_THROWHR(hr);
+            }
+            else if (IsVideoStream(streamIndex))
+            {
+                GUID subtype = GUID_NULL;
+                UINT32 width = 0;
+                UINT32 height = 0;
+
+                hr = m_pSourceReader->GetCurrentMediaType(index, &pMediaType);
+                MF_THROWHR(hr);
+
+                hr = pMediaType->GetGUID(MF_MT_SUBTYPE, &subtype);
+                MF_THROWHR(hr);
+
+                // MF decodes MJPG to YUY2 for us, which we then convert like any other YUY2 stream
+                if (subtype == MFVideoFormat_MJPG)
+                {
+                    subtype = MFVideoFormat_YUY2;
+
+                    hr = pMediaType->SetGUID(MF_MT_SUBTYPE, subtype);
+                    MF_THROWHR(hr);
+
+                    hr = m_pSourceReader->SetCurrentMediaType(index, NULL, pMediaType);
+                    MF_THROWHR(hr);
+                }
+
+                hr = MFGetAttributeSize(pMediaType, MF_MT_FRAME_SIZE, &width, &height);
+                MF_THROWHR(hr);
+
+                m_callback->SetFormat(index, width, height, subtype);
+            }
+        }
+
+        m_streamSampleCallbacks[streamIndex] = handler;
+
+        IntPtr ip = Marshal::GetFunctionPointerForDelegate(m_readSampleDelegateInternal);
+        hr = m_callback->CaptureSample(index, (ReadSampleHandlerForDevice)ip.ToPointer());
+        MF_THROWHR(hr);
+    }
+    finally
+    {
+        MF_RELEASE(pNativeType);
+        MF_RELEASE(pMediaType);
+    }
+}
+
+/// <summary>
+///  Selects a stream and starts capturing the D3D11 textures its frames are delivered in.
+///  Only available when attached with useGpuFrames. A stream may be captured both with
+///  this and with CaptureStream, in which case the texture handler is called first.
+/// </summary>        
+/// <param name="streamIndex">Source reader index of the video stream (0 to StreamCount - 1)</param>
+/// <param name="handler">Handler to call with the texture of each frame</param>
+void MediaCaptureDevice::CaptureStreamTextures(int streamIndex, ReadTextureSampleDelegate^ handler)
+{
+    CheckStreamIndex(streamIndex);
+
+    if (!UsesGpuFrames)
+    {
+        throw gcnew InvalidOperationException("The device was not attached with GPU frames enabled");
+    }
+
+    if (!IsVideoStream(streamIndex))
+    {
+        throw gcnew ArgumentException("Not a video stream", "streamIndex");
+    }
+
+    m_streamTextureCallbacks[streamIndex] = handler;
+
+    IntPtr ip = Marshal::GetFunctionPointerForDelegate(m_readTextureDelegateInternal);
+    HRESULT hr = m_callback->CaptureTextures((DWORD)streamIndex, (ReadTextureHandlerForDevice)ip.ToPointer());
+    MF_THROWHR(hr);
+}
+
+/// <summary>
+///  Copies a frame texture (as passed to a ReadTextureSampleDelegate) to CPU memory. This
+///  is the explicit readback for consumers of GPU frames that also need their pixels, and
+///  should be called from the delegate, while the texture is still valid.
+/// </summary>        
+/// <param name="texture">The ID3D11Texture2D holding the frame</param>
+/// <param name="subresource">Index of the frame's subresource in the texture</param>
+/// <param name="destination">Buffer to copy the pixels to</param>
+/// <param name="destinationStride">Bytes per row in the destination buffer</param>
+/// <param name="destinationSize">Size of the destination buffer in bytes</param>
+/// <returns>Number of bytes written</returns>
+int MediaCaptureDevice::ReadbackTexture(IntPtr texture, int subresource, IntPtr destination, int destinationStride, int destinationSize)
+{
+    if (!UsesGpuFrames)
+    {
+        throw gcnew InvalidOperationException("The device was not attached with GPU frames enabled");
+    }
+
+    HRESULT hr = S_OK;
+    ID3D11Texture2D *pTexture = (ID3D11Texture2D *)texture.ToPointer();
+    ID3D11DeviceContext *pContext = NULL;
+    D3D11_TEXTURE2D_DESC desc;
+    MF_THROWPTR(pTexture);
+
+    pTexture->GetDesc(&desc);
+
+    // Bytes per row and number of rows of the formats MF delivers video frames in
+    UINT rowBytes = 0;
+    UINT rows = desc.Height;
+    switch (desc.Format)
+    {
+    case DXGI_FORMAT_B8G8R8A8_UNORM:
+    case DXGI_FORMAT_B8G8R8X8_UNORM:
+    case DXGI_FORMAT_R8G8B8A8_UNORM:
+    case DXGI_FORMAT_YUY2:
+        rowBytes = desc.Format == DXGI_FORMAT_YUY2 ? desc.Width * 2 : desc.Width * 4;
+        break;
+    case DXGI_FORMAT_NV12:
+        rowBytes = desc.Width;
+        rows = desc.Height + desc.Height / 2;
+        break;
+    case DXGI_FORMAT_R16_UNORM:
+    case DXGI_FORMAT_R16_UINT:
+        rowBytes = desc.Width * 2;
+        break;
+    case DXGI_FORMAT_R8_UNORM:
+        rowBytes = desc.Width;
+        break;
+    default:
+        throw gcnew NotSupportedException("Unsupported texture format");
+    }
+
+    if (destinationStride < (int)rowBytes || (LONGLONG)destinationStride * (rows - 1) + rowBytes > destinationSize)
+    {
+        throw gcnew ArgumentException("Destination buffer is too small", "destinationSize");
+    }
+
+    try
+    {
+        // The staging texture is kept across frames and only recreated when the frame size or format changes
+        if (m_pStagingTexture != NULL)
+        {
+            D3D11_TEXTURE2D_DESC stagingDesc;
+            m_pStagingTexture->GetDesc(&stagingDesc);
+            if (stagingDesc.Width != desc.Width || stagingDesc.Height != desc.Height || stagingDesc.Format != desc.Format)
+            {
+                MF_RELEASE(m_pStagingTexture);
+            }
+        }
+
+        if (m_pStagingTexture == NULL)
+        {
+            D3D11_TEXTURE2D_DESC stagingDesc = desc;
+            stagingDesc.MipLevels = 1;
+            stagingDesc.ArraySize = 1;
+            stagingDesc.Usage = D3D11_USAGE_STAGING;
+            stagingDesc.BindFlags = 0;
+            stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+            stagingDesc.MiscFlags = 0;
+
+            ID3D11Texture2D *pStagingTexture = NULL;
+            hr = m_pD3DDevice->CreateTexture2D(&stagingDesc, NULL, &pStagingTexture);
+            MF_THROWHR(hr);
+            m_pStagingTexture = pStagingTexture;
+        }
+
+        m_pD3DDevice->GetImmediateContext(&pContext);
+        pContext->CopySubresourceRegion(m_pStagingTexture, 0, 0, 0, 0, pTexture, (UINT)subresource, NULL);
+
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        hr = pContext->Map(m_pStagingTexture, 0, D3D11_MAP_READ, 0, &mapped);
+        MF_THROWHR(hr);
+
+        const BYTE *pSrc = (const BYTE *)mapped.pData;
+        BYTE *pDst = (BYTE *)destination.ToPointer();
+        for (UINT row = 0; row < rows; row++)
+        {
+            memcpy(pDst, pSrc, rowBytes);
+            pSrc += mapped.RowPitch;
+            pDst += destinationStride;
+        }
+
+        pContext->Unmap(m_pStagingTexture, 0);
+    }
+    finally
+    {
+        MF_RELEASE(pContext);
+    }
+
+    return (int)((LONGLONG)destinationStride * (rows - 1) + rowBytes);
+}
+
+/// <summary>
+///  Gets a boolean indicating if a stream carries video (color, depth, infrared, ...)
+/// </summary>        
+/// <param name="streamIndex">Source reader index of the stream</param>
+bool MediaCaptureDevice::IsVideoStream(int streamIndex)
+{
+    CheckStreamIndex(streamIndex);
+    return m_callback->GetStreamMajorType((DWORD)streamIndex) == MFMediaType_Video;
+}
+
+/// <summary>
+///  Gets a boolean indicating if a stream carries audio
+/// </summary>        
+/// <param name="streamIndex">Source reader index of the stream</param>
+bool MediaCaptureDevice::IsAudioStream(int streamIndex)
+{
+    CheckStreamIndex(streamIndex);
+    return m_callback->GetStreamMajorType((DWORD)streamIndex) == MFMediaType_Audio;
+}
+
+/// <summary>
+///  Gets a snapshot of the statistics of a stream. Can be called at any time, without
+///  stopping capture.
+/// </summary>        
+/// <param name="streamIndex">Source reader index of the stream</param>
+/// <returns>The stream's statistics since the device was attached</returns>
+CaptureStatistics^ MediaCaptureDevice::GetStatistics(int streamIndex)
+{
+    CheckStreamIndex(streamIndex);
+    return CaptureStatistics::FromNative(*m_callback->GetStatistics((DWORD)streamIndex));
+}
+
+/// <summary>
+///  Gets the format of the samples delivered for an audio stream
+/// </summary>        
+/// <param name="streamIndex">Source reader index of the stream</param>
+/// <param name="sampleRate">Sample rate in Hz</param>
+/// <param name="channels">Number of channels</param>
+/// <param name="bitsPerSample">Bits per sample</param>
+void MediaCaptureDevice::GetAudioFormat(int streamIndex, int% sampleRate, int% channels, int% bitsPerSample)
+{
+    if (!IsAudioStream(streamIndex))
+    {
+        throw gcnew ArgumentException("Not an audio stream", "streamIndex");
+    }
+
+    HRESULT hr = S_OK;
+    IMFMediaType *pMediaType = NULL;
+
+    try
+    {
+        hr = m_pSourceReader->GetCurrentMediaType((DWORD)streamIndex, &pMediaType);
+        MF_THROWHR(hr);
+
+        sampleRate = (int)MFGetAttributeUINT32(pMediaType, MF_MT_AUDIO_SAMPLES_PER_SECOND, 0);
+        channels = (int)MFGetAttributeUINT32(pMediaType, MF_MT_AUDIO_NUM_CHANNELS, 0);
+        bitsPerSample = (int)MFGetAttributeUINT32(pMediaType, MF_MT_AUDIO_BITS_PER_SAMPLE, 0);
+    }
+    finally
+    {
+        MF_RELEASE(pMediaType);
+    }
 }
 
 /// <summary>
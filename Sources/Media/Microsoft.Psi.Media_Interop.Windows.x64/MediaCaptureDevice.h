@@ -72,6 +72,31 @@ namespace Media_Interop {
         /// </summary>
         IMFMediaSource *_pMediaSource;
 
+        /// <summary>
+        /// The audio capture device aggregated with the video device (NULL if none)
+        /// </summary>
+        IMFMediaSource *m_pAudioSource;
+
+        /// <summary>
+        /// The aggregate of the video and audio sources the source reader reads from (NULL if no audio device)
+        /// </summary>
+        IMFMediaSource *m_pAggregateSource;
+
+        /// <summary>
+        /// The D3D11 device frames are captured on (NULL unless attached with useGpuFrames)
+        /// </summary>
+        ID3D11Device *m_pD3DDevice;
+
+        /// <summary>
+        /// The DXGI device manager handed to the source reader (NULL unless attached with useGpuFrames)
+        /// </summary>
+        IMFDXGIDeviceManager *m_pDXGIManager;
+
+        /// <summary>
+        /// Staging texture ReadbackTexture copies frames through (created on first use)
+        /// </summary>
+        ID3D11Texture2D *m_pStagingTexture;
+
         /// <summary>
         /// The underlying MF Activate
         /// </summary>
@@ -82,11 +107,6 @@ namespace Media_Interop {
         /// </summary>
         SourceReaderCallback* m_callback;
 
-        /// <summary>
-        /// The time the last frame arrived
-        /// </summary>
-        LONGLONG m_lastFrameTime;
-
         /// <summary>
         /// Frequency of the performance counter
         /// </summary>
@@ -102,11 +122,42 @@ namespace Media_Interop {
         /// </summary>
         int m_desiredRateDenominator;
 
+        /// <summary>
+        /// Native formats of the first video stream, indexed by native media type index (entries
+        /// are null for types that aren't video formats). Read once, on the first Attach.
+        /// </summary>
+        array<CaptureFormat^>^ m_nativeFormats;
+
+        /// <summary>
+        /// Relative difference under which a native frame rate counts as the requested one (e.g. 29.97 for 30)
+        /// </summary>
+        literal double FrameRateTolerance = 0.01;
+
+        /// <summary>
+        /// Options of the last Attach and the last format set, for Reattach
+        /// </summary>
+        bool m_attachSharedMode;
+        String^ m_attachAudioEndpointId;
+        bool m_attachGpuFrames;
+        CaptureFormat^ m_lastFormat;
+
+        /// <summary>
+        /// Scheduling policy for the capture threads (see SetThreadPolicy)
+        /// </summary>
+        System::Threading::ThreadPriority m_threadPriority;
+        UInt64 m_threadAffinityMask;
+
     internal:
         MediaCaptureDevice(IMFActivate *pActivate);
         void InitializeFromActivate(IMFActivate *pActivate, String^ name);
         void InitilaizePerformanceCounterFrequency();
         IMFActivate *GetActivate(String^ symbolicLink, bool useInSharedMode);
+        IMFMediaSource *CreateAudioSource(String^ audioEndpointId);
+        void CreateD3DManager();
+        void CheckStreamIndex(int streamIndex);
+        int FindNativeMediaType(int width, int height, Guid subtype, double desiredRate);
+        void LoadNativeFormats();
+        Media::Threading::ThreadPolicy GetThreadPolicy();
 
         /// <summary>
         /// Handler for read sample completion
@@ -118,12 +169,34 @@ namespace Media_Interop {
         /// </summary>
         GCHandle^ m_readSampleHandlerHandle;
 
+        /// <summary>
+        /// Handlers for streams captured with CaptureStream, indexed by stream index
+        /// </summary>
+        array<ReadStreamSampleDelegate^>^ m_streamSampleCallbacks;
+
         /// <summary>
         /// Internal pinned managed Handler for read sample completion
         /// </summary>
-        ReadSampleDelegate^ m_readSampleDelegateInternal;
+        ReadStreamSampleDelegate^ m_readSampleDelegateInternal;
 
-        void ReadSampleThunk(IntPtr data, int cbLength, LONGLONG timestamp);
+        void ReadSampleThunk(int streamIndex, IntPtr data, int cbLength, LONGLONG timestamp, LONGLONG arrivalTime, LONGLONG correctedTime);
+
+        /// <summary>
+        /// Handlers for streams captured with CaptureStreamTextures, indexed by stream index
+        /// </summary>
+        array<ReadTextureSampleDelegate^>^ m_streamTextureCallbacks;
+
+        /// <summary>
+        /// GC Handle for read texture completion
+        /// </summary>
+        GCHandle^ m_readTextureHandlerHandle;
+
+        /// <summary>
+        /// Internal pinned managed Handler for read texture completion
+        /// </summary>
+        ReadTextureSampleDelegate^ m_readTextureDelegateInternal;
+
+        void ReadTextureThunk(int streamIndex, IntPtr texture, int subresource, LONGLONG timestamp, LONGLONG arrivalTime, LONGLONG correctedTime);
 
     public:
         MediaCaptureDevice(String^ name, String^ symbolicLink, bool useInSharedMode);
@@ -158,8 +231,21 @@ namespace Media_Interop {
 
         
         bool Attach(bool useInSharedMode);
+        bool Attach(bool useInSharedMode, String^ audioEndpointId);
+        bool Attach(bool useInSharedMode, String^ audioEndpointId, bool useGpuFrames);
+        bool Reattach();
+        void SetThreadPolicy(System::Threading::ThreadPriority priority, UInt64 affinityMask);
+        static array<bool>^ Attach(array<MediaCaptureDevice^>^ devices, bool useInSharedMode);
+        static array<MediaCaptureDevice^>^ AttachAll(bool useInSharedMode);
         void Shutdown();
         void CaptureSample(ReadSampleDelegate^ handler);
+        void CaptureStream(int streamIndex, ReadStreamSampleDelegate^ handler);
+        void CaptureStreamTextures(int streamIndex, ReadTextureSampleDelegate^ handler);
+        int ReadbackTexture(IntPtr texture, int subresource, IntPtr destination, int destinationStride, int destinationSize);
+        bool IsVideoStream(int streamIndex);
+        bool IsAudioStream(int streamIndex);
+        void GetAudioFormat(int streamIndex, int% sampleRate, int% channels, int% bitsPerSample);
+        CaptureStatistics^ GetStatistics(int streamIndex);
         bool SetProperty(VideoProperty prop, int nValue, VideoPropertyFlags flags);
         bool GetProperty(VideoProperty prop, int% nValue, int% flags);
         bool SetProperty(ManagedCameraControlProperty prop, int nValue, ManagedCameraControlPropertyFlags flags);
@@ -224,6 +310,68 @@ namespace Media_Interop {
         }
 #endif
 
+        /// <summary>
+        ///  Gets a boolean indicating if video frames are captured into D3D11 textures.
+        /// </summary>        
+        property bool UsesGpuFrames
+#ifdef DOXYGEN
+	  ;
+#else
+        {
+            bool get()
+            {
+                return m_pD3DDevice != NULL;
+            }
+        }
+#endif
+
+        /// <summary>
+        ///  Gets the ID3D11Device frames are captured on (IntPtr.Zero unless attached with useGpuFrames).
+        ///  GPU consumers should create the resources they copy frames into on this device.
+        /// </summary>        
+        property IntPtr D3DDevice
+#ifdef DOXYGEN
+	  ;
+#else
+        {
+            IntPtr get()
+            {
+                return IntPtr(m_pD3DDevice);
+            }
+        }
+#endif
+
+        /// <summary>
+        ///  Gets the number of streams (video, audio, depth, infrared, ...) exposed by the device.
+        ///  All of them are read by the same source reader and share its clock.
+        /// </summary>        
+        property int StreamCount
+#ifdef DOXYGEN
+	  ;
+#else
+        {
+            int get()
+            {
+                return fAttached ? (int)m_callback->GetStreamCount() : 0;
+            }
+        }
+#endif
+
+        /// <summary>
+        ///  Gets the stream index of the first video stream, the one CurrentFormat and CaptureSample apply to (-1 if not attached).
+        /// </summary>        
+        property int FirstVideoStreamIndex
+#ifdef DOXYGEN
+	  ;
+#else
+        {
+            int get()
+            {
+                return fAttached ? (int)m_callback->GetFirstVideoStream() : -1;
+            }
+        }
+#endif
+
         /// <summary>
         ///  Gets the list of capture formats supported
         /// </summary> 
@@ -5,6 +5,8 @@
 using namespace System::Runtime::InteropServices;
 
 #include "SourceReaderCallback.h"
+#include "MediaConversion.h"
+#include "MediaTrace.h"
 #include "ks.h"
 #include "ksmedia.h"
 #include <stdio.h>
@@ -14,6 +16,87 @@ namespace Microsoft {
 namespace Psi {
 namespace Media_Interop {
 
+/// <summary>
+/// A sample handed over from the Media Foundation thread it was delivered on to our own work queue,
+/// or a marker that signals an event once everything queued before it has been processed
+/// </summary>
+class PendingSample : public IUnknown
+{
+public:
+    PendingSample(HRESULT hrStatus, DWORD streamIndex, DWORD streamFlags, LONGLONG timestamp, IMFSample *pSample, LONGLONG arrivalTime)
+    : m_lRefCount(1)
+    , hrStatus(hrStatus)
+    , streamIndex(streamIndex)
+    , streamFlags(streamFlags)
+    , timestamp(timestamp)
+    , pSample(pSample)
+    , arrivalTime(arrivalTime)
+    , hDrained(NULL)
+    {
+        if (pSample)
+        {
+            pSample->AddRef();
+        }
+    }
+
+    PendingSample(HANDLE hDrained)
+    : m_lRefCount(1)
+    , hrStatus(S_OK)
+    , streamIndex(0)
+    , streamFlags(0)
+    , timestamp(0)
+    , pSample(NULL)
+    , arrivalTime(0)
+    , hDrained(hDrained)
+    {
+    }
+
+    STDMETHODIMP QueryInterface(REFIID riid, void** ppv)
+    {
+        if (riid == __uuidof(IUnknown))
+        {
+            *ppv = this;
+            AddRef();
+            return S_OK;
+        }
+        return E_NOINTERFACE;
+    }
+
+    STDMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&m_lRefCount);
+    }
+
+    STDMETHODIMP_(ULONG) Release()
+    {
+        ULONG ulCount = InterlockedDecrement(&m_lRefCount);
+        if (ulCount == 0)
+        {
+            delete this;
+        }
+        return ulCount;
+    }
+
+    // The arguments OnReadSample was called with
+    HRESULT    hrStatus;
+    DWORD      streamIndex;
+    DWORD      streamFlags;
+    LONGLONG   timestamp;
+    IMFSample *pSample;
+    LONGLONG   arrivalTime;
+
+    // Set for a marker, the event to signal instead of processing a sample
+    HANDLE     hDrained;
+
+private:
+    ~PendingSample()
+    {
+        MF_RELEASE(pSample);
+    }
+
+    long m_lRefCount;
+};
+
 /// <summary>
 /// Creates an instance of the capture device which implements <c> IMFSourceReaderCallback </c>
 /// </summary>
@@ -45,10 +128,16 @@ HRESULT SourceReaderCallback::CreateInstance(SourceReaderCallback **ppCapture)
 SourceReaderCallback::SourceReaderCallback() 
 : m_pReader(NULL)
 , m_lRefCount(1)
-, m_readSampleHandler(NULL)
-, m_pRgbBuffer(NULL)
-, m_rgbBufSize(0)
+, m_streams(NULL)
+, m_numStreams(0)
+, m_firstVideoStream((DWORD)MF_SOURCE_READER_INVALID_STREAM_INDEX)
+, m_qpcFrequency(0)
+, m_workQueue(0)
 {
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    m_qpcFrequency = frequency.QuadPart;
+    m_threadPolicy = Media::Threading::MakeThreadPolicy(Media::Threading::ThreadPriority_Normal, Media::Threading::ThreadTask_Capture, 0);
 }
 
 /// <summary>
@@ -56,13 +145,150 @@ SourceReaderCallback::SourceReaderCallback()
 /// </summary>
 SourceReaderCallback::~SourceReaderCallback()
 {
-    if (m_pRgbBuffer)
+    // Every queued sample holds a reference on us, so none can be left by now
+    if (m_workQueue != 0)
+    {
+        MFUnlockWorkQueue(m_workQueue);
+        m_workQueue = 0;
+    }
+    FreeStreams();
+    MF_RELEASE(m_pReader);
+}
+
+/// <summary>
+/// Frees the per stream state
+/// </summary>
+void SourceReaderCallback::FreeStreams()
+{
+    if (m_streams)
+    {
+        for (DWORD i = 0; i < m_numStreams; i++)
+        {
+            if (m_streams[i].pRgbBuffer)
+            {
+                delete[] m_streams[i].pRgbBuffer;
+            }
+        }
+        delete[] m_streams;
+        m_streams = NULL;
+    }
+    m_numStreams = 0;
+    m_firstVideoStream = (DWORD)MF_SOURCE_READER_INVALID_STREAM_INDEX;
+}
+
+/// <summary>
+/// Sets the scheduling policy for the threads samples are processed on. MF delivers samples on
+/// its shared work queue threads, which other devices and MF itself also run on, so a policy other
+/// than the default moves processing onto a private work queue whose one thread takes the policy.
+/// The queue is kept if the policy later goes back to the default; its thread then reverts.
+/// </summary>        
+/// <param name="policy">Priority and core affinity for the threads</param>
+void SourceReaderCallback::SetThreadPolicy(const Media::Threading::ThreadPolicy &policy)
+{
+    m_threadPolicy = policy;
+    if (m_workQueue == 0 && !Media::Threading::IsDefaultThreadPolicy(policy))
+    {
+        DWORD workQueue = 0;
+        if (SUCCEEDED(MFAllocateWorkQueueEx(MF_STANDARD_WORKQUEUE, &workQueue)))
+        {
+            m_workQueue = workQueue;
+        }
+    }
+}
+
+/// <summary>
+/// Releases the private work queue, if any. Later samples are processed on the thread MF
+/// delivers them on. Samples already queued are processed first, since dropping them would
+/// leak their references and leave their streams without a read pending; the queue runs
+/// its items in order on one thread, so a marker queued behind them tells when they're done.
+/// </summary>
+void SourceReaderCallback::ReleaseWorkQueue()
+{
+    DWORD workQueue = m_workQueue;
+    if (workQueue != 0)
     {
-        delete m_pRgbBuffer;
-        m_pRgbBuffer = NULL;
+        m_workQueue = 0;
+
+        HANDLE hDrained = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (hDrained != NULL)
+        {
+            PendingSample *pMarker = new PendingSample(hDrained);
+            if (pMarker != NULL)
+            {
+                HRESULT hr = MFPutWorkItem2(workQueue, 0, static_cast<IMFAsyncCallback*>(this), pMarker);
+                pMarker->Release();
+                if (SUCCEEDED(hr))
+                {
+                    WaitForSingleObject(hDrained, INFINITE);
+                }
+            }
+            CloseHandle(hDrained);
+        }
+
+        MFUnlockWorkQueue(workQueue);
     }
 }
 
+/// <summary>
+/// Sets the source reader and discovers its streams
+/// </summary>        
+/// <param name="pReader">The MF source reader being wrapped by this class</param>
+/// <returns> S_OK if succeeded. Error code if not.</returns>
+HRESULT SourceReaderCallback::SetSourceReader(IMFSourceReader *pReader)
+{
+    HRESULT hr = S_OK;
+    IMFMediaType *pMediaType = NULL;
+
+    MF_RELEASE(m_pReader);
+    FreeStreams();
+
+    m_pReader = pReader;
+    m_pReader->AddRef();
+
+    // The source reader has no stream count, so probe until it runs out of streams
+    DWORD numStreams = 0;
+    while (SUCCEEDED(m_pReader->GetCurrentMediaType(numStreams, &pMediaType)))
+    {
+        MF_RELEASE(pMediaType);
+        numStreams++;
+    }
+
+    m_streams = new StreamState[numStreams];
+    m_numStreams = numStreams;
+    for (DWORD i = 0; i < m_numStreams; i++)
+    {
+        StreamState &stream = m_streams[i];
+        stream.majorType = GUID_NULL;
+        stream.width = 0;
+        stream.height = 0;
+        stream.subtype = GUID_NULL;
+        stream.handler = NULL;
+        stream.textureHandler = NULL;
+        stream.pRgbBuffer = NULL;
+        stream.rgbBufSize = 0;
+        stream.frameInterval = 0;
+        stream.frameTolerance = 0;
+        stream.nextFrameTime = 0;
+        stream.stats.Reset();
+
+        hr = m_pReader->GetCurrentMediaType(i, &pMediaType);
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        pMediaType->GetGUID(MF_MT_MAJOR_TYPE, &stream.majorType);
+        MF_RELEASE(pMediaType);
+
+        if (stream.majorType == MFMediaType_Video && m_firstVideoStream == (DWORD)MF_SOURCE_READER_INVALID_STREAM_INDEX)
+        {
+            m_firstVideoStream = i;
+        }
+    }
+
+    return hr;
+}
+
 /// <remarks>IUnknown methods</remarks>
 
 /// <summary>
@@ -98,7 +324,14 @@ HRESULT SourceReaderCallback::QueryInterface(REFIID riid, void** ppv)
 {
     if (riid == __uuidof(IMFSourceReaderCallback) || riid == __uuidof(IUnknown))
     {
-        *ppv = this;
+        *ppv = static_cast<IMFSourceReaderCallback*>(this);
+        AddRef();
+        return S_OK;
+    }
+
+    if (riid == __uuidof(IMFAsyncCallback))
+    {
+        *ppv = static_cast<IMFAsyncCallback*>(this);
         AddRef();
         return S_OK;
     }
@@ -106,60 +339,121 @@ HRESULT SourceReaderCallback::QueryInterface(REFIID riid, void** ppv)
     return E_NOINTERFACE;
 }
 
-__forceinline BYTE SourceReaderCallback::Clip(int clr)
+/// <summary>
+/// Sets the video format of a stream.
+/// </summary>        
+/// <param name="streamIndex">Source reader index of the stream</param>
+/// <param name="width">Width in pixels </param>
+/// <param name="height">Height in pixels </param>
+/// <param name="subtype">
+/// Format the source reader delivers samples in. YUY2 and NV12 are converted to RGB24 here, anything else
+/// is passed through as is.
+/// </param>
+void SourceReaderCallback::SetFormat(DWORD streamIndex, size_t width, size_t height, REFGUID subtype)
 {
-    return (BYTE)(clr < 0 ? 0 : ( clr > 255 ? 255 : clr ));
+    if (streamIndex >= m_numStreams)
+    {
+        return;
+    }
+
+    StreamState &stream = m_streams[streamIndex];
+    stream.width = width;
+    stream.height = height;
+    stream.subtype = subtype;
+
+    // The conversion buffer is allocated once per format rather than per frame
+    if (stream.pRgbBuffer)
+    {
+        delete[] stream.pRgbBuffer;
+        stream.pRgbBuffer = NULL;
+        stream.rgbBufSize = 0;
+    }
+    if (stream.NeedsConversion())
+    {
+        stream.rgbBufSize = (DWORD)(width * height * 3);
+        stream.pRgbBuffer = new BYTE[stream.rgbBufSize];
+    }
 }
 
-__forceinline RGBTRIPLE SourceReaderCallback::ConvertYCrCbToRGB(
-    int y,
-    int cr,
-    int cb
-    )
+/// <summary>
+/// Sets the rate frames of a stream are delivered at. Frames arriving faster than that are
+/// dropped here, before they are converted or handed to managed code.
+/// </summary>        
+/// <param name="streamIndex">Source reader index of the stream</param>
+/// <param name="numerator">Numerator of the requested frame rate</param>
+/// <param name="denominator">Denominator of the requested frame rate</param>
+/// <param name="nativeNumerator">Numerator of the rate the device captures at</param>
+/// <param name="nativeDenominator">Denominator of the rate the device captures at</param>
+void SourceReaderCallback::SetFrameRate(DWORD streamIndex, UINT32 numerator, UINT32 denominator, UINT32 nativeNumerator, UINT32 nativeDenominator)
 {
-    RGBTRIPLE rgbt;
+    if (streamIndex >= m_numStreams)
+    {
+        return;
+    }
 
-    int c = y - 16;
-    int d = cb - 128;
-    int e = cr - 128;
+    StreamState &stream = m_streams[streamIndex];
+    stream.frameInterval = 0;
+    stream.frameTolerance = 0;
+    stream.nextFrameTime = 0;
 
-    rgbt.rgbtRed =   Clip(( 298 * c           + 409 * e + 128) >> 8);
-    rgbt.rgbtGreen = Clip(( 298 * c - 100 * d - 208 * e + 128) >> 8);
-    rgbt.rgbtBlue =  Clip(( 298 * c + 516 * d           + 128) >> 8);
+    if (numerator == 0 || nativeNumerator == 0)
+    {
+        return;
+    }
 
-    return rgbt;
+    LONGLONG interval = (LONGLONG)MFllMulDiv(10000000, denominator, numerator, 0);
+    LONGLONG nativeInterval = (LONGLONG)MFllMulDiv(10000000, nativeDenominator, nativeNumerator, 0);
+    if (interval > nativeInterval)
+    {
+        stream.frameInterval = interval;
+        stream.frameTolerance = nativeInterval / 2;
+    }
 }
 
-void SourceReaderCallback::TransformImage_YUY2_to_RGB24(
-    BYTE*       pDest,
-    LONG        lDestStride,
-    const BYTE* pSrc,
-    LONG        lSrcStride,
-    size_t      dwWidthInPixels,
-    size_t      dwHeightInPixels
-    )
+/// <summary>
+/// Decides whether a frame is delivered or dropped to bring the stream down to its requested rate
+/// </summary>        
+/// <param name="stream">State of the stream</param>
+/// <param name="timestamp">Device timestamp of the frame</param>
+/// <returns>True if the frame is to be delivered</returns>
+bool SourceReaderCallback::ShouldDeliver(StreamState &stream, LONGLONG timestamp)
 {
-    for (DWORD y = 0; y < dwHeightInPixels; y++)
+    if (stream.frameInterval == 0)
     {
-        RGBTRIPLE *pDestPel = (RGBTRIPLE*)pDest;
-        WORD    *pSrcPel = (WORD*)pSrc;
+        return true;
+    }
 
-        for (DWORD x = 0; x < dwWidthInPixels; x += 2)
-        {
-            // Byte order is U0 Y0 V0 Y1
+    // Frames are due on a fixed schedule so the delivered rate doesn't drift, with
+    // half a native frame of slack for timestamp jitter. A frame from before the
+    // last delivered one means the timestamps went backwards (e.g. the device was
+    // reset), so it restarts the schedule rather than being dropped until they catch up.
+    bool backwards = timestamp < stream.nextFrameTime - stream.frameInterval;
+    if (stream.nextFrameTime != 0 && !backwards && timestamp < stream.nextFrameTime - stream.frameTolerance)
+    {
+        return false;
+    }
 
-            int y0 = (int)LOBYTE(pSrcPel[x]);
-            int u0 = (int)HIBYTE(pSrcPel[x]);
-            int y1 = (int)LOBYTE(pSrcPel[x + 1]);
-            int v0 = (int)HIBYTE(pSrcPel[x + 1]);
+    // Restart the schedule on the first frame and after a gap (e.g. dropped frames or a stall)
+    if (stream.nextFrameTime == 0 || backwards || timestamp - stream.nextFrameTime > stream.frameInterval)
+    {
+        stream.nextFrameTime = timestamp + stream.frameInterval;
+    }
+    else
+    {
+        stream.nextFrameTime += stream.frameInterval;
+    }
 
-            pDestPel[x] = ConvertYCrCbToRGB(y0, v0, u0);
-            pDestPel[x + 1] = ConvertYCrCbToRGB(y1, v0, u0);
-        }
+    return true;
+}
 
-        pSrc += lSrcStride;
-        pDest += lDestStride;
-    }
+/// <summary>
+/// Gets the current QPC time in 100ns units
+/// </summary>        
+LONGLONG SourceReaderCallback::GetQpcTime()
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (LONGLONG)MFllMulDiv(counter.QuadPart, 10000000, m_qpcFrequency, 0);
 }
 
 /// <summary>
@@ -179,119 +473,456 @@ void SourceReaderCallback::TransformImage_YUY2_to_RGB24(
 /// <returns> S_OK if succeeded. Error code if not.</returns>
 HRESULT SourceReaderCallback::OnReadSample(
     _In_ HRESULT hrStatus,
-    _In_ DWORD,  // dwStreamIndex
-    _In_ DWORD,  // dwStreamFlags
+    _In_ DWORD dwStreamIndex,
+    _In_ DWORD dwStreamFlags,
     _In_ LONGLONG llTimeStamp,
     _In_opt_ IMFSample *pSample)      // Can be NULL
 {
-    UNREFERENCED_PARAMETER(llTimeStamp);
+    // Note the arrival time first thing, so it carries as little of our own latency as possible
+    LONGLONG arrivalTime = GetQpcTime();
+
+    // The thread we're called on belongs to one of MF's shared work queues, so it is left as it
+    // is: under a thread policy the sample is processed on our own work queue instead
+    DWORD workQueue = m_workQueue;
+    if (workQueue != 0)
+    {
+        PendingSample *pPending = new PendingSample(hrStatus, dwStreamIndex, dwStreamFlags, llTimeStamp, pSample, arrivalTime);
+        if (pPending != NULL)
+        {
+            HRESULT hr = MFPutWorkItem2(workQueue, 0, static_cast<IMFAsyncCallback*>(this), pPending);
+            pPending->Release();
+            if (SUCCEEDED(hr))
+            {
+                return S_OK;
+            }
+        }
+    }
+
+    return ProcessSample(hrStatus, dwStreamIndex, dwStreamFlags, llTimeStamp, pSample, arrivalTime);
+}
+
+/// <summary>
+/// Called on our own work queue with a sample OnReadSample handed over
+/// </summary>
+/// <param name="pResult">Result whose state is the PendingSample</param>
+/// <returns> S_OK if succeeded. Error code if not.</returns>
+HRESULT SourceReaderCallback::Invoke(IMFAsyncResult *pResult)
+{
+    IUnknown *pState = NULL;
+    HRESULT hr = pResult->GetState(&pState);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // The queue's thread is ours alone, so the policy never has to be undone for anyone else.
+    // Applying it costs a comparison once the thread has it.
+    if (Media::Threading::IsDefaultThreadPolicy(m_threadPolicy))
+    {
+        Media::Threading::RevertThreadPolicy();
+    }
+    else
+    {
+        Media::Threading::ApplyThreadPolicy(m_threadPolicy);
+    }
+
+    PendingSample *pPending = static_cast<PendingSample*>(pState);
+    if (pPending->hDrained != NULL)
+    {
+        SetEvent(pPending->hDrained);
+        MF_RELEASE(pState);
+        return S_OK;
+    }
+
+    hr = ProcessSample(pPending->hrStatus, pPending->streamIndex, pPending->streamFlags, pPending->timestamp, pPending->pSample, pPending->arrivalTime);
+    MF_RELEASE(pState);
+    return hr;
+}
+
+/// <summary>
+/// Lets MF pick the dispatch parameters; the queue is the one given to MFPutWorkItem2
+/// </summary>
+/// <returns> E_NOTIMPL </returns>
+HRESULT SourceReaderCallback::GetParameters(DWORD *pdwFlags, DWORD *pdwQueue)
+{
+    UNREFERENCED_PARAMETER(pdwFlags);
+    UNREFERENCED_PARAMETER(pdwQueue);
+    return E_NOTIMPL;
+}
 
+/// <summary>
+/// Records, converts and delivers a sample, then re-arms its stream
+/// </summary>
+/// <param name="hrStatus">The status code the source reader completed the read with</param>
+/// <param name="dwStreamIndex">The zero-based index of the stream that delivered the sample</param>
+/// <param name="dwStreamFlags">A bitwise OR of zero or more flags from the MF_SOURCE_READER_FLAG enumeration</param>
+/// <param name="llTimeStamp">The time stamp of the sample, in 100-nanosecond units</param>
+/// <param name="pSample">The sample. This parameter might be NULL.</param>
+/// <param name="arrivalTime">QPC time the sample arrived at</param>
+/// <returns> S_OK if succeeded. Error code if not.</returns>
+HRESULT SourceReaderCallback::ProcessSample(HRESULT hrStatus, DWORD dwStreamIndex, DWORD dwStreamFlags, LONGLONG llTimeStamp, IMFSample *pSample, LONGLONG arrivalTime)
+{
     HRESULT hr = S_FALSE;
-    DWORD count = 0;
-    DWORD cbLength = 0;
-    IMFMediaBuffer *pBuffer = NULL;
+
+    Media::Tracing::TraceScope trace(Media::Tracing::TraceEvent_CaptureReadSample);
+    trace.SetFrame((int)dwStreamIndex, pSample ? llTimeStamp : -1);
+
+    if (dwStreamIndex >= m_numStreams)
+    {
+        return S_OK;
+    }
+
+    StreamState &stream = m_streams[dwStreamIndex];
 
 	__try{
 
-        if (FAILED(hrStatus))
+        if (dwStreamFlags & MF_SOURCE_READERF_STREAMTICK)
+        {
+            stream.stats.RecordStreamTick();
+            stream.nextFrameTime = 0;
+        }
+
+        if (FAILED(hrStatus) || (dwStreamFlags & MF_SOURCE_READERF_ERROR))
         {
-            hr = hrStatus;
+            stream.stats.RecordError();
+            hr = FAILED(hrStatus) ? hrStatus : E_FAIL;
             MF_CHKHR(hr);
         }
 
-        if (pSample)
+        if (pSample && stream.IsCapturing())
         {
-            LONGLONG timestamp;
-            pSample->GetSampleTime(&timestamp);
+            // Every frame, dropped or not, goes into the clock fit
+            SampleTimes times;
+            times.deviceTime = llTimeStamp;
+            times.arrivalTime = arrivalTime;
+            times.correctedTime = stream.clock.AddSample(times.deviceTime, times.arrivalTime);
+
+            bool discontinuity = MFGetAttributeUINT32(pSample, MFSampleExtension_Discontinuity, FALSE) != FALSE;
+            stream.stats.RecordArrival(times.deviceTime, times.arrivalTime, times.correctedTime, discontinuity);
+            if (discontinuity)
+            {
+                // The timestamps may have jumped either way, so start the rate schedule over
+                stream.nextFrameTime = 0;
+            }
 
-            // If we have a sample handler, setup the call
-            if (m_readSampleHandler != NULL)
+            // Frames above the requested rate are dropped before anything is locked, converted or marshalled
+            if (!ShouldDeliver(stream, llTimeStamp))
             {
-                hr = pSample->GetBufferCount(&count);
-                MF_CHKHR(hr);
+                stream.stats.RecordDrop();
+            }
+            else
+            {
+                // A frame counts as delivered once, even if it goes to both handlers
+                bool delivered = false;
 
-                if (count > 1)
+                // If we have a sample handler, setup the call
+                if (stream.textureHandler != NULL)
                 {
-                    hr = E_INVALIDARG;
-                    MF_CHKHR(hr);
+                    hr = DeliverTexture(dwStreamIndex, stream, pSample, times);
+                    if (FAILED(hr))
+                    {
+                        stream.stats.RecordError();
+                    }
+                    else
+                    {
+                        delivered = true;
+                    }
                 }
 
-                hr = pSample->GetBufferByIndex(0, &pBuffer);
-                MF_CHKHR(hr);
+                // CPU handlers of streams captured on the GPU get the frame read back by MF's DXGI buffer
+                if (stream.handler != NULL)
+                {
+                    hr = DeliverSample(dwStreamIndex, stream, pSample, times);
+                    if (FAILED(hr))
+                    {
+                        stream.stats.RecordError();
+                    }
+                    else
+                    {
+                        delivered = true;
+                    }
+                }
 
-                hr = pBuffer->GetCurrentLength(&cbLength);
-                MF_CHKHR(hr);
+                if (delivered)
+                {
+                    stream.stats.RecordDelivery();
+                }
+            }
+        }
+    }
+    __finally
+    {        
+        //The first time you call ReadSample, we likely won't get a sample, so setup again       
+        // Read another sample from the same stream. Each stream is re-armed on its own so
+        // a slow or stalled stream doesn't hold up the others.
+        if (stream.IsCapturing() &&
+            (dwStreamFlags & (MF_SOURCE_READERF_ERROR | MF_SOURCE_READERF_ENDOFSTREAM)) == 0)
+        {
+            m_pReader->ReadSample(
+                dwStreamIndex,
+                0,
+                NULL,   // actual
+                NULL,   // flags
+                NULL,   // timestamp
+                NULL);  // sample
+        }
+    }
+    return hr;
+}
+
+/// <summary>
+/// Hands the D3D11 texture holding a sample to its stream's texture handler
+/// </summary>
+/// <param name="dwStreamIndex">The zero-based index of the stream that delivered the sample</param>
+/// <param name="stream">State of that stream</param>
+/// <param name="pSample">The sample</param>
+/// <param name="times">The sample's timestamps</param>
+/// <returns> S_OK if succeeded. Error code if not.</returns>
+HRESULT SourceReaderCallback::DeliverTexture(DWORD dwStreamIndex, StreamState &stream, IMFSample *pSample, const SampleTimes &times)
+{
+    HRESULT hr = S_OK;
+    IMFMediaBuffer *pBuffer = NULL;
+    IMFDXGIBuffer *pDXGIBuffer = NULL;
+    ID3D11Texture2D *pTexture = NULL;
+
+    __try
+    {
+        hr = pSample->GetBufferByIndex(0, &pBuffer);
+        MF_CHKHR(hr);
+
+        // Only samples from a reader with a D3D manager are backed by textures
+        hr = pBuffer->QueryInterface(IID_PPV_ARGS(&pDXGIBuffer));
+        MF_CHKHR(hr);
+
+        hr = pDXGIBuffer->GetResource(IID_PPV_ARGS(&pTexture));
+        MF_CHKHR(hr);
+
+        UINT subresource = 0;
+        hr = pDXGIBuffer->GetSubresourceIndex(&subresource);
+        MF_CHKHR(hr);
+
+        LONGLONG start = GetQpcTime();
+        (*stream.textureHandler)(dwStreamIndex, pTexture, subresource, times.deviceTime, times.arrivalTime, times.correctedTime);
+        stream.stats.RecordHandler(GetQpcTime() - start);
+    }
+    __finally
+    {
+        MF_RELEASE(pTexture);
+        MF_RELEASE(pDXGIBuffer);
+        MF_RELEASE(pBuffer);
+    }
+    return hr;
+}
+
+/// <summary>
+/// Hands a sample to its stream's handler, converting it to RGB24 first if needed
+/// </summary>
+/// <param name="dwStreamIndex">The zero-based index of the stream that delivered the sample</param>
+/// <param name="stream">State of that stream</param>
+/// <param name="pSample">The sample</param>
+/// <param name="times">The sample's timestamps</param>
+/// <returns> S_OK if succeeded. Error code if not.</returns>
+HRESULT SourceReaderCallback::DeliverSample(DWORD dwStreamIndex, StreamState &stream, IMFSample *pSample, const SampleTimes &times)
+{
+    HRESULT hr = S_OK;
+    DWORD count = 0;
+    DWORD cbLength = 0;
+    IMFMediaBuffer *pBuffer = NULL;
+    IMF2DBuffer *p2DBuffer = NULL;
 
-                if (cbLength > 0)
+    __try
+    {
+        hr = pSample->GetBufferCount(&count);
+        MF_CHKHR(hr);
+
+        // Audio samples may span several buffers; video samples never do
+        if (stream.majorType == MFMediaType_Video && count > 1)
+        {
+            hr = E_INVALIDARG;
+            MF_CHKHR(hr);
+        }
+
+        if (count > 1)
+        {
+            hr = pSample->ConvertToContiguousBuffer(&pBuffer);
+            MF_CHKHR(hr);
+        }
+        else
+        {
+            hr = pSample->GetBufferByIndex(0, &pBuffer);
+            MF_CHKHR(hr);
+        }
+
+        hr = pBuffer->GetCurrentLength(&cbLength);
+        MF_CHKHR(hr);
+
+        if (cbLength > 0)
+        {
+            // The handler is called with the sample's own memory, which stays
+            // locked (and so owned by us) until it returns. This keeps the
+            // capture callback free of per-frame allocations and copies.
+            BYTE *pbData = NULL;
+            LONG lPitch = 0;
+            bool locked2D = false;
+
+            // Lock() on a 2D buffer may copy the frame into a contiguous
+            // buffer inside MF; Lock2D() never does, so prefer it whenever
+            // we can deal with its pitch: always when we convert the frame,
+            // otherwise only if the rows are packed the way the handler expects.
+            if (SUCCEEDED(pBuffer->QueryInterface(IID_PPV_ARGS(&p2DBuffer))))
+            {
+                BYTE *pbScanline0 = NULL;
+                if (SUCCEEDED(p2DBuffer->Lock2D(&pbScanline0, &lPitch)))
                 {
-                    BYTE *pbData = NULL;
-
-                    hr = pBuffer->Lock(&pbData, NULL, NULL);
-                    MF_CHKHR(hr);
-                    BYTE* pbYUY2 = NULL;
-                    int cbYUY2Length = cbLength;
-                    
-                    pbYUY2 = new BYTE[cbYUY2Length]; 
-                    memcpy_s(pbYUY2, cbYUY2Length, pbData, cbLength);
-
-                    // initialize m_pRgbBuffer if necessary
-                    if (!m_pRgbBuffer)
+                    if ((stream.NeedsConversion() && lPitch > 0) ||
+                        (stream.height > 0 && lPitch > 0 && (size_t)lPitch * stream.height == cbLength))
+                    {
+                        pbData = pbScanline0;
+                        locked2D = true;
+                    }
+                    else
                     {
-                        // conversion to RGB24 from YUY2 is 3:2
-                        m_rgbBufSize = (DWORD)(cbYUY2Length * 1.5);
-                        m_pRgbBuffer = new BYTE[m_rgbBufSize];
+                        p2DBuffer->Unlock2D();
                     }
+                }
+            }
 
-					if (IsWindows8OrGreater())
-					{
-						(*m_readSampleHandler)(pbYUY2, cbYUY2Length, timestamp);
-					}
-					else
-					{
-						TransformImage_YUY2_to_RGB24(
-							m_pRgbBuffer,
-							(DWORD)(m_width * 3),
-							pbYUY2,
-							(DWORD)(m_width * 2),
-							m_width,
-							m_height);
-						(*m_readSampleHandler)(m_pRgbBuffer, m_rgbBufSize, timestamp);
-					}
-
-                    SAFE_DELETE_ARRAY(pbYUY2);
-
-                    pBuffer->Unlock();
+            if (!locked2D)
+            {
+                hr = pBuffer->Lock(&pbData, NULL, NULL);
+                MF_CHKHR(hr);
+                lPitch = (LONG)((stream.subtype == MFVideoFormat_YUY2) ? stream.width * 2 : stream.width);
+            }
+
+            // A contiguous buffer shorter than the frame format describes can't be converted safely
+            size_t frameBytes = (size_t)lPitch * stream.height;
+            if (stream.subtype == MFVideoFormat_NV12)
+            {
+                frameBytes += frameBytes / 2;
+            }
+
+            if (stream.NeedsConversion() && !locked2D && cbLength < frameBytes)
+            {
+                hr = MF_E_INVALID_FORMAT;
+            }
+            else if (stream.NeedsConversion())
+            {
+                LONGLONG start = GetQpcTime();
+                if (stream.subtype == MFVideoFormat_YUY2)
+                {
+                    Media::Conversion::ConvertYUY2ToBGR24(pbData, lPitch, stream.pRgbBuffer, (int)(stream.width * 3), (int)stream.width, (int)stream.height);
+                }
+                else
+                {
+                    // The chroma plane follows the luma plane
+                    Media::Conversion::ConvertNV12ToBGR24(pbData, lPitch, pbData + lPitch * stream.height, lPitch, stream.pRgbBuffer, (int)(stream.width * 3), (int)stream.width, (int)stream.height);
                 }
+                LONGLONG converted = GetQpcTime();
+                stream.stats.RecordConversion(converted - start, stream.rgbBufSize);
+
+                (*stream.handler)(dwStreamIndex, stream.pRgbBuffer, stream.rgbBufSize, times.deviceTime, times.arrivalTime, times.correctedTime);
+                stream.stats.RecordHandler(GetQpcTime() - converted);
+            }
+            else
+            {
+                LONGLONG start = GetQpcTime();
+                (*stream.handler)(dwStreamIndex, pbData, (int)cbLength, times.deviceTime, times.arrivalTime, times.correctedTime);
+                stream.stats.RecordHandler(GetQpcTime() - start);
+            }
+
+            if (locked2D)
+            {
+                p2DBuffer->Unlock2D();
+            }
+            else
+            {
+                pBuffer->Unlock();
             }
         }
     }
     __finally
-    {        
+    {
+        MF_RELEASE(p2DBuffer);
         MF_RELEASE(pBuffer);
-        //The first time you call ReadSample, we likely won't get a sample, so setup again       
-        // Read another sample.
-        m_pReader->ReadSample(
-            (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
-            0,
-            NULL,   // actual
-            NULL,   // flags
-            NULL,   // timestamp
-            NULL);  // sample
     }
     return hr;
 }
 
 /// <summary>
-///  Sets up the capture pipeline if required and sets up async sample capture
+///  Selects a stream and sets up async sample capture on it
 /// </summary>        
+/// <param name="streamIndex">Source reader index of the stream to capture</param>
 /// <param name="handler">Handler to call after completing read sample</param>
-void SourceReaderCallback::CaptureSample(ReadSampleHandlerForDevice handler)
+/// <returns> S_OK if succeeded. Error code if not.</returns>
+HRESULT SourceReaderCallback::CaptureSample(DWORD streamIndex, ReadSampleHandlerForDevice handler)
 {
-    m_readSampleHandler = handler;
+    if (streamIndex >= m_numStreams)
+    {
+        return MF_E_INVALIDSTREAMNUMBER;
+    }
+
+    bool wasCapturing = m_streams[streamIndex].IsCapturing();
+    m_streams[streamIndex].handler = handler;
+    if (wasCapturing)
+    {
+        // A read is already outstanding on this stream
+        return S_OK;
+    }
+
+    HRESULT hr = StartCapture(streamIndex);
+    if (FAILED(hr))
+    {
+        m_streams[streamIndex].handler = NULL;
+    }
+    return hr;
+}
+
+/// <summary>
+///  Selects a stream and sets up async capture of its D3D11 textures. Only valid for
+///  source readers created with a D3D manager.
+/// </summary>        
+/// <param name="streamIndex">Source reader index of the stream to capture</param>
+/// <param name="handler">Handler to call with the texture of each sample</param>
+/// <returns> S_OK if succeeded. Error code if not.</returns>
+HRESULT SourceReaderCallback::CaptureTextures(DWORD streamIndex, ReadTextureHandlerForDevice handler)
+{
+    if (streamIndex >= m_numStreams)
+    {
+        return MF_E_INVALIDSTREAMNUMBER;
+    }
+
+    bool wasCapturing = m_streams[streamIndex].IsCapturing();
+    m_streams[streamIndex].textureHandler = handler;
+    if (wasCapturing)
+    {
+        // A read is already outstanding on this stream
+        return S_OK;
+    }
+
+    HRESULT hr = StartCapture(streamIndex);
+    if (FAILED(hr))
+    {
+        m_streams[streamIndex].textureHandler = NULL;
+    }
+    return hr;
+}
+
+/// <summary>
+///  Selects a stream and issues its first read
+/// </summary>        
+/// <param name="streamIndex">Source reader index of the stream to capture</param>
+/// <returns> S_OK if succeeded. Error code if not.</returns>
+HRESULT SourceReaderCallback::StartCapture(DWORD streamIndex)
+{
+    HRESULT hr = m_pReader->SetStreamSelection(streamIndex, TRUE);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
 
     // We have to tickle the reader
-    m_pReader->ReadSample(
-        (DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM,
+    return m_pReader->ReadSample(
+        streamIndex,
         0,
         NULL,
         NULL,
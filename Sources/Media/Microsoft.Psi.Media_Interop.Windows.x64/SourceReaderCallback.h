@@ -4,6 +4,9 @@
 #pragma once
 
 #include "Managed.h"
+#include "CaptureClockCorrelator.h"
+#include "CaptureStatistics.h"
+#include "ThreadPolicy.h"
 
 namespace Microsoft {
 namespace Psi {
@@ -11,24 +14,78 @@ namespace Media_Interop {
 
     /// <summary>
     /// Read sample delegate which is called back for each image.
+    /// The data points into the captured sample and is only valid until the delegate returns.
     /// </summary>
     /// <param name="data"> Image data as RGB24 byte array </param>
     /// <param name="cbLength"> Length of Image data in bytes </param>
     /// <param name="timestamp"> Sample timestamp </param>
     public delegate void ReadSampleDelegate(IntPtr data, int cbLength, LONGLONG timestamp);
 
+    /// <summary>
+    /// Read sample delegate which is called back for each sample of a captured stream.
+    /// The data points into the captured sample and is only valid until the delegate returns.
+    /// </summary>
+    /// <param name="streamIndex"> Source reader index of the stream the sample belongs to </param>
+    /// <param name="data"> Sample data (RGB24 for YUY2/NV12/MJPG video streams, 16 bit PCM for audio streams, native format otherwise) </param>
+    /// <param name="cbLength"> Length of sample data in bytes </param>
+    /// <param name="timestamp"> Sample timestamp, as given by the device </param>
+    /// <param name="arrivalTime"> QPC time (in 100ns units) the sample arrived at </param>
+    /// <param name="correctedTime"> Device timestamp mapped onto the QPC clock (in 100ns units), free of arrival jitter </param>
+    public delegate void ReadStreamSampleDelegate(int streamIndex, IntPtr data, int cbLength, LONGLONG timestamp, LONGLONG arrivalTime, LONGLONG correctedTime);
+
     /// <summary>
     /// CABI for read sample handler.
     /// </summary>
-    /// <param name="data"> Image data as RGB24 byte array </param>
-    /// <param name="cbLength"> Length of Image data in bytes </param>
-    /// <param name="timestamp"> Sample timestamp </param>
-    typedef void (__stdcall *ReadSampleHandlerForDevice)(BYTE* data, int cbLength, LONGLONG timestamp);
+    /// <param name="streamIndex"> Source reader index of the stream the sample belongs to </param>
+    /// <param name="data"> Sample data </param>
+    /// <param name="cbLength"> Length of sample data in bytes </param>
+    /// <param name="timestamp"> Sample timestamp, as given by the device </param>
+    /// <param name="arrivalTime"> QPC time the sample arrived at </param>
+    /// <param name="correctedTime"> Device timestamp mapped onto the QPC clock </param>
+    typedef void (__stdcall *ReadSampleHandlerForDevice)(DWORD streamIndex, BYTE* data, int cbLength, LONGLONG timestamp, LONGLONG arrivalTime, LONGLONG correctedTime);
+
+    /// <summary>
+    /// Read sample delegate which is called back for each frame of a stream captured on the GPU.
+    /// The texture belongs to the source reader's sample pool and is only valid until the delegate
+    /// returns, so consumers that need the frame afterwards should copy it on the GPU.
+    /// </summary>
+    /// <param name="streamIndex"> Source reader index of the stream the frame belongs to </param>
+    /// <param name="texture"> The ID3D11Texture2D holding the frame </param>
+    /// <param name="subresource"> Index of the frame's subresource in the texture (textures may be arrays) </param>
+    /// <param name="timestamp"> Sample timestamp, as given by the device </param>
+    /// <param name="arrivalTime"> QPC time (in 100ns units) the sample arrived at </param>
+    /// <param name="correctedTime"> Device timestamp mapped onto the QPC clock (in 100ns units), free of arrival jitter </param>
+    public delegate void ReadTextureSampleDelegate(int streamIndex, IntPtr texture, int subresource, LONGLONG timestamp, LONGLONG arrivalTime, LONGLONG correctedTime);
+
+    /// <summary>
+    /// CABI for read texture handler.
+    /// </summary>
+    /// <param name="streamIndex"> Source reader index of the stream the frame belongs to </param>
+    /// <param name="texture"> The texture holding the frame </param>
+    /// <param name="subresource"> Index of the frame's subresource in the texture </param>
+    /// <param name="timestamp"> Sample timestamp, as given by the device </param>
+    /// <param name="arrivalTime"> QPC time the sample arrived at </param>
+    /// <param name="correctedTime"> Device timestamp mapped onto the QPC clock </param>
+    typedef void (__stdcall *ReadTextureHandlerForDevice)(DWORD streamIndex, ID3D11Texture2D* texture, UINT subresource, LONGLONG timestamp, LONGLONG arrivalTime, LONGLONG correctedTime);
+
+    /// <summary>
+    /// The clocks a sample is stamped with
+    /// </summary>
+    struct SampleTimes
+    {
+        LONGLONG deviceTime;     // Sample time given by the device
+        LONGLONG arrivalTime;    // QPC time the sample arrived at (100ns units)
+        LONGLONG correctedTime;  // Device time mapped onto the QPC clock
+    };
 
     /// <summary>
     /// Class used to represent a capture device which can receive asynchronous notifications.
+    /// All of the source reader's streams are served by this one callback, each stream being
+    /// read (and re-armed) independently of the others. Under a thread policy other than the
+    /// default, samples are processed on a work queue of our own (see SetThreadPolicy), which
+    /// is what the IMFAsyncCallback half of the class serves.
     /// </summary>
-    class SourceReaderCallback : public IMFSourceReaderCallback
+    class SourceReaderCallback : public IMFSourceReaderCallback, public IMFAsyncCallback
     {
     public:
         static HRESULT CreateInstance(SourceReaderCallback **ppPlayer);
@@ -77,27 +134,65 @@ namespace Media_Interop {
             return S_OK;
         }
 
+        // IMFAsyncCallback methods
+        STDMETHODIMP GetParameters(DWORD *pdwFlags, DWORD *pdwQueue);
+        STDMETHODIMP Invoke(IMFAsyncResult *pResult);
+
+        void SetFormat(DWORD streamIndex, size_t width, size_t height, REFGUID subtype);
+
+        void SetFrameRate(DWORD streamIndex, UINT32 numerator, UINT32 denominator, UINT32 nativeNumerator, UINT32 nativeDenominator);
+
+        HRESULT CaptureSample(DWORD streamIndex, ReadSampleHandlerForDevice handler);
+
+        HRESULT CaptureTextures(DWORD streamIndex, ReadTextureHandlerForDevice handler);
+
+        HRESULT SetSourceReader(IMFSourceReader *pReader);
+
+        void SetThreadPolicy(const Media::Threading::ThreadPolicy &policy);
+
+        void ReleaseWorkQueue();
+
         /// <summary>
-        /// Sets the video format.
+        /// Gets the number of streams the source reader exposes
         /// </summary>        
-        /// <param name="width">Width in pixels </param>
-        /// <param name="height">Height in pixels </param>
-        void SetFormat(size_t width, size_t height)
+        DWORD GetStreamCount()
         {
-            m_width = width;
-            m_height = height;
+            return m_numStreams;
         }
 
-        void CaptureSample(ReadSampleHandlerForDevice handler);
+        /// <summary>
+        /// Gets the major type (MFMediaType_Video, MFMediaType_Audio, ...) of a stream
+        /// </summary>        
+        /// <param name="streamIndex">Source reader index of the stream</param>
+        GUID GetStreamMajorType(DWORD streamIndex)
+        {
+            return streamIndex < m_numStreams ? m_streams[streamIndex].majorType : GUID_NULL;
+        }
+
+        /// <summary>
+        /// Gets the statistics of a stream (NULL if there is no such stream). They can be read while capture is running.
+        /// </summary>        
+        /// <param name="streamIndex">Source reader index of the stream</param>
+        const CaptureStatisticsNative *GetStatistics(DWORD streamIndex)
+        {
+            return streamIndex < m_numStreams ? &m_streams[streamIndex].stats : NULL;
+        }
+
+        /// <summary>
+        /// Returns true if samples of the stream are being delivered to a handler
+        /// </summary>        
+        /// <param name="streamIndex">Source reader index of the stream</param>
+        bool IsCapturing(DWORD streamIndex)
+        {
+            return streamIndex < m_numStreams && m_streams[streamIndex].IsCapturing();
+        }
 
         /// <summary>
-        /// Sets the source reader
+        /// Gets the source reader index of the first video stream (MF_SOURCE_READER_INVALID_STREAM_INDEX if none)
         /// </summary>        
-        /// <param name="pReader">The MF source reader being wrapped by this class</param>
-        void SetSourceReader(IMFSourceReader *pReader)
+        DWORD GetFirstVideoStream()
         {
-            m_pReader = pReader;
-            m_pReader->AddRef();
+            return m_firstVideoStream;
         }
 
     protected:
@@ -115,41 +210,73 @@ namespace Media_Interop {
         IMFSourceReader         *m_pReader;
 
         /// <summary>
-        /// Width in pixels
+        /// State kept for each of the source reader's streams
         /// </summary> 
-        size_t                   m_width;
+        struct StreamState
+        {
+            GUID                       majorType;    // MFMediaType_Video, MFMediaType_Audio, ...
+            size_t                     width;        // Width in pixels (video only)
+            size_t                     height;       // Height in pixels (video only)
+            GUID                       subtype;      // Format of the samples delivered by the source reader
+            ReadSampleHandlerForDevice handler;      // Called for each sample with CPU memory, NULL if none
+            ReadTextureHandlerForDevice textureHandler; // Called for each sample with its D3D11 texture, NULL if none
+            BYTE                      *pRgbBuffer;   // Buffer for YUY2/NV12 -> RGB24 conversion
+            DWORD                      rgbBufSize;
+            LONGLONG                   frameInterval;  // Minimum time between delivered frames (0 = deliver every frame)
+            LONGLONG                   frameTolerance; // How early a frame may arrive and still be delivered (half the native frame interval)
+            LONGLONG                   nextFrameTime;  // Time the next frame is due (0 = deliver the next one)
+            CaptureClockCorrelator     clock;          // Maps the stream's device times onto the QPC clock
+            CaptureStatisticsNative    stats;          // Counters for the stream
+
+            /// <summary>
+            /// Returns true if samples are converted to RGB24 by us rather than delivered as RGB24 by MF
+            /// </summary>
+            bool NeedsConversion()
+            {
+                return subtype == MFVideoFormat_YUY2 || subtype == MFVideoFormat_NV12;
+            }
+
+            /// <summary>
+            /// Returns true if samples are being delivered to a handler
+            /// </summary>
+            bool IsCapturing()
+            {
+                return handler != NULL || textureHandler != NULL;
+            }
+        };
 
         /// <summary>
-        /// Height in pixels
+        /// One entry per source reader stream, indexed by stream index
         /// </summary> 
-        size_t                   m_height;
+        StreamState             *m_streams;
+        DWORD                    m_numStreams;
 
         /// <summary>
-        /// Callback to call to handle read sample completion.
+        /// Source reader index of the first video stream
         /// </summary> 
-        ReadSampleHandlerForDevice m_readSampleHandler;
+        DWORD                    m_firstVideoStream;
 
         /// <summary>
-        /// Buffer for YUY2 -> RGB24 conversion
-        /// </summary>
-        BYTE                    *m_pRgbBuffer;
-        DWORD                    m_rgbBufSize;
-
-        void TransformImage_YUY2_to_RGB24(
-            BYTE*       pDest,
-            LONG        lDestStride,
-            const BYTE* pSrc,
-            LONG        lSrcStride,
-            size_t      dwWidthInPixels,
-            size_t      dwHeightInPixels
-            );
-
-        RGBTRIPLE ConvertYCrCbToRGB(
-            int y,
-            int cr,
-            int cb
-            );
-
-         BYTE Clip(int clr);
+        /// Frequency of the performance counter
+        /// </summary> 
+        LONGLONG                 m_qpcFrequency;
+
+        /// <summary>
+        /// Scheduling policy applied to the private work queue's thread samples are processed on
+        /// </summary> 
+        Media::Threading::ThreadPolicy m_threadPolicy;
+
+        /// <summary>
+        /// Private work queue samples are processed on (0 while samples are processed on MF's threads)
+        /// </summary> 
+        DWORD                    m_workQueue;
+
+        void FreeStreams();
+        HRESULT ProcessSample(HRESULT hrStatus, DWORD dwStreamIndex, DWORD dwStreamFlags, LONGLONG llTimeStamp, IMFSample *pSample, LONGLONG arrivalTime);
+        HRESULT StartCapture(DWORD streamIndex);
+        LONGLONG GetQpcTime();
+        bool ShouldDeliver(StreamState &stream, LONGLONG timestamp);
+        HRESULT DeliverSample(DWORD dwStreamIndex, StreamState &stream, IMFSample *pSample, const SampleTimes &times);
+        HRESULT DeliverTexture(DWORD dwStreamIndex, StreamState &stream, IMFSample *pSample, const SampleTimes &times);
     };
 }}}
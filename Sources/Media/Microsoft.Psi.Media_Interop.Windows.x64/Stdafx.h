@@ -13,6 +13,7 @@
 #pragma comment(lib, "mfuuid.lib")
 #pragma comment(lib, "mfplay.lib")
 #pragma comment(lib, "mfreadwrite.lib")
+#pragma comment(lib, "d3d11.lib")
 
 #include <mfapi.h>
 #include <mfidl.h>
@@ -22,5 +23,6 @@
 #include <vcclr.h>
 #include <wmcontainer.h>
 #include <Wmcodecdsp.h>
+#include <d3d11.h>
 
 #include "macros.h"
\ No newline at end of file
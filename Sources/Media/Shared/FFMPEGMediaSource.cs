@@ -40,7 +40,8 @@ namespace Microsoft.Psi.Media
         /// <param name="pipeline">The pipeline to add the component to.</param>
         /// <param name="filename">Name of media file to play</param>
         /// <param name="format">Output format for images</param>
-        public FFMPEGMediaSource(Pipeline pipeline, string filename, PixelFormat format = PixelFormat.BGRX_32bpp)
+        /// <param name="config">Optional configuration for the reader (e.g. decoding threads)</param>
+        public FFMPEGMediaSource(Pipeline pipeline, string filename, PixelFormat format = PixelFormat.BGRX_32bpp, FFMPEGReaderConfiguration config = null)
            : base(pipeline)
         {
             FileInfo info = new FileInfo(filename);
@@ -49,8 +50,9 @@ namespace Microsoft.Psi.Media
             this.filename = filename;
             this.Image = pipeline.CreateEmitter<Shared<Image>>(this, nameof(this.Image));
             this.Audio = pipeline.CreateEmitter<AudioBuffer>(this, nameof(this.Audio));
-            this.mpegReader = new FFMPEGReader((format == PixelFormat.BGRX_32bpp) ? 32 : 24);
-            this.mpegReader.Open(filename, new FFMPEGReaderConfiguration());
+            config = config ?? new FFMPEGReaderConfiguration();
+            this.mpegReader = new FFMPEGReader((format == PixelFormat.BGRX_32bpp) ? 32 : 24, config);
+            this.mpegReader.Open(filename, config);
             this.waveFormat = WaveFormat.CreatePcm(this.mpegReader.AudioSampleRate, this.mpegReader.AudioBitsPerSample, this.mpegReader.AudioNumChannels);
             this.outputFormat = format;
             this.audioBufferSize = 0;
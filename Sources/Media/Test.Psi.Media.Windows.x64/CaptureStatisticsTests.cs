@@ -0,0 +1,86 @@
+﻿// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+namespace Test.Psi.Media
+{
+    using Microsoft.Psi.Media_Interop;
+    using Microsoft.VisualStudio.TestTools.UnitTesting;
+
+    /// <summary>
+    /// Capture statistics tests.
+    /// </summary>
+    [TestClass]
+    public class CaptureStatisticsTests
+    {
+        private const long Ticks33ms = 330000;
+        private const long Ticks67ms = 670000;
+
+        /// <summary>
+        /// A lasting drop in frame rate counts as a gap once, not on every frame.
+        /// </summary>
+        [TestMethod]
+        [Timeout(60000)]
+        public void CaptureStatistics_FrameRateDropStopsCountingGaps()
+        {
+            using (var recorder = new CaptureStatisticsRecorder())
+            {
+                long time = Ticks33ms;
+                for (int i = 0; i < 100; i++)
+                {
+                    recorder.RecordArrival(time, false);
+                    time += Ticks33ms;
+                }
+
+                Assert.AreEqual(0, recorder.GetStatistics().Gaps);
+
+                for (int i = 0; i < 50; i++)
+                {
+                    recorder.RecordArrival(time, false);
+                    time += Ticks67ms;
+                }
+
+                long gaps = recorder.GetStatistics().Gaps;
+                Assert.IsTrue(gaps > 0 && gaps < 5);
+
+                for (int i = 0; i < 100; i++)
+                {
+                    recorder.RecordArrival(time, false);
+                    time += Ticks67ms;
+                }
+
+                Assert.AreEqual(gaps, recorder.GetStatistics().Gaps);
+            }
+        }
+
+        /// <summary>
+        /// A single stall counts as a gap without hiding the next one.
+        /// </summary>
+        [TestMethod]
+        [Timeout(60000)]
+        public void CaptureStatistics_StallCountsAsGap()
+        {
+            using (var recorder = new CaptureStatisticsRecorder())
+            {
+                long time = Ticks33ms;
+                for (int i = 0; i < 100; i++)
+                {
+                    recorder.RecordArrival(time, false);
+                    time += Ticks33ms;
+                }
+
+                // One second without frames, then back to the usual rate, then another stall
+                time += 10000000;
+                for (int i = 0; i < 10; i++)
+                {
+                    recorder.RecordArrival(time, false);
+                    time += Ticks33ms;
+                }
+
+                time += 10000000;
+                recorder.RecordArrival(time, false);
+
+                Assert.AreEqual(2, recorder.GetStatistics().Gaps);
+            }
+        }
+    }
+}
@@ -0,0 +1,44 @@
+﻿// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+namespace Microsoft.Psi.RealSense.Windows
+{
+    using System.IO;
+    using Microsoft.Psi.Imaging;
+
+    /// <summary>
+    /// Implements a decoder for depth images encoded by <see cref="DepthImageToRvlStreamEncoder"/>.
+    /// </summary>
+    public class DepthImageFromRvlStreamDecoder : IDepthImageFromStreamDecoder
+    {
+        private readonly object bufferLock = new object();
+        private byte[] buffer;
+
+        /// <inheritdoc/>
+        public void DecodeFromStream(Stream stream, DepthImage depthImage)
+        {
+            lock (this.bufferLock)
+            {
+                int length = (int)(stream.Length - stream.Position);
+                if (this.buffer == null || this.buffer.Length < length)
+                {
+                    this.buffer = new byte[length];
+                }
+
+                int read = 0;
+                while (read < length)
+                {
+                    int count = stream.Read(this.buffer, read, length - read);
+                    if (count == 0)
+                    {
+                        break;
+                    }
+
+                    read += count;
+                }
+
+                RealSenseDepthCodec.Decode(this.buffer, read, depthImage.ImageData, depthImage.Width, depthImage.Height, depthImage.Stride);
+            }
+        }
+    }
+}
\ No newline at end of file
@@ -5,6 +5,7 @@ namespace Microsoft.Psi.RealSense.Windows
 {
     using System;
     using System.Threading;
+    using Microsoft.Win32.SafeHandles;
     using Microsoft.Psi;
     using Microsoft.Psi.Components;
     using Microsoft.Psi.Imaging;
@@ -17,6 +18,7 @@ namespace Microsoft.Psi.RealSense.Windows
         private bool shutdown;
         private Pipeline pipeline;
         private RealSenseDevice device;
+        private RealSenseConfiguration configuration;
         private Thread thread;
 
         /// <summary>
@@ -24,7 +26,18 @@ namespace Microsoft.Psi.RealSense.Windows
         /// </summary>
         /// <param name="pipeline">The pipeline to add the component to.</param>
         public RealSenseSensor(Pipeline pipeline)
+            : this(pipeline, null)
         {
+        }
+
+        /// <summary>
+        /// Initializes a new instance of the <see cref="RealSenseSensor"/> class.
+        /// </summary>
+        /// <param name="pipeline">The pipeline to add the component to.</param>
+        /// <param name="configuration">The device, streams and depth processing to use, or null for the defaults.</param>
+        public RealSenseSensor(Pipeline pipeline, RealSenseConfiguration configuration)
+        {
+            this.configuration = configuration;
             this.shutdown = false;
             this.ColorImage = pipeline.CreateEmitter<Shared<Image>>(this, "ColorImage");
             this.DepthImage = pipeline.CreateEmitter<Shared<DepthImage>>(this, "DepthImage");
@@ -59,7 +72,7 @@ namespace Microsoft.Psi.RealSense.Windows
             // notify that this is an infinite source component
             notifyCompletionTime(DateTime.MaxValue);
 
-            this.device = new RealSenseDevice();
+            this.device = (this.configuration != null) ? new RealSenseDevice(this.configuration) : new RealSenseDevice();
             this.thread = new Thread(new ThreadStart(this.ThreadProc));
             this.thread.Start();
         }
@@ -101,7 +114,8 @@ namespace Microsoft.Psi.RealSense.Windows
             }
 
             var colorImage = ImagePool.GetOrCreate((int)this.device.GetColorWidth(), (int)this.device.GetColorHeight(), pixelFormat);
-            uint colorImageSize = this.device.GetColorHeight() * this.device.GetColorStride();
+            uint colorImageStride = (uint)colorImage.Resource.Stride;
+            uint colorImageSize = (uint)colorImage.Resource.Size;
             switch (this.device.GetDepthBpp())
             {
                 case 16:
@@ -115,13 +129,40 @@ namespace Microsoft.Psi.RealSense.Windows
             }
 
             var depthImage = DepthImagePool.GetOrCreate((int)this.device.GetDepthWidth(), (int)this.device.GetDepthHeight());
-            uint depthImageSize = this.device.GetDepthHeight() * this.device.GetDepthStride();
-            while (!this.shutdown)
+            uint depthImageStride = (uint)depthImage.Resource.Stride;
+            uint depthImageSize = (uint)depthImage.Resource.Size;
+
+            // Let the device queue framesets as they arrive and wait on its event, rather than
+            // blocking in ReadFrame, so that Stop doesn't have to abort the thread
+            uint hr = this.device.StartAsync(2);
+            if (hr != 0)
+            {
+                throw new InvalidOperationException(string.Format("Failed to start the RealSense device (0x{0:X8})", hr));
+            }
+
+            using (var frameEvent = new FrameEventWaitHandle(this.device.GetFrameEvent()))
+            {
+                while (!this.shutdown)
+                {
+                    if (frameEvent.WaitOne(100) &&
+                        this.device.TryReadFrame(colorImage.Resource.ImageData, colorImageSize, colorImageStride, depthImage.Resource.ImageData, depthImageSize, depthImageStride))
+                    {
+                        DateTime t = DateTime.UtcNow;
+                        this.ColorImage.Post(colorImage, t);
+                        this.DepthImage.Post(depthImage, t);
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Waits on the device's frame event. The event is owned by the device, so it is not closed with this handle.
+        /// </summary>
+        private class FrameEventWaitHandle : WaitHandle
+        {
+            public FrameEventWaitHandle(IntPtr handle)
             {
-                this.device.ReadFrame(colorImage.Resource.ImageData, colorImageSize, depthImage.Resource.ImageData, depthImageSize);
-                DateTime t = DateTime.UtcNow;
-                this.ColorImage.Post(colorImage, t);
-                this.DepthImage.Post(depthImage, t);
+                this.SafeWaitHandle = new SafeWaitHandle(handle, false);
             }
         }
     }
@@ -3,14 +3,113 @@
 
 #pragma once
 
+//**********************************************************************
+// Counters kept by the unmanaged side of the device. They are updated by
+// the threads reading and receiving frames with interlocked operations, so
+// they can be read from any thread while frames are being read. Times are
+// in 100ns units.
+//**********************************************************************
+struct RealSenseStatisticsUnmanaged
+{
+	// Bin i of the inter-arrival histogram counts intervals in [2^(i-1), 2^i) ms,
+	// bin 0 those under 1ms and the last bin everything longer
+	static const int NumInterArrivalBins = 10;
+
+	volatile long long framesDelivered;     // Framesets read by ReadFrame()
+	volatile long long framesDropped;       // Frames the device produced that we never saw (from gaps in the frame numbers)
+	volatile long long queueOverflows;      // Framesets discarded unread because the delivery queue was full, or by a device manager because no other device had a match (asynchronous delivery only)
+	volatile long long gaps;                // Framesets that followed dropped frames
+	volatile long long errors;              // Failed reads
+	volatile long long bytesCopied;         // Bytes copied into the caller's buffers
+	volatile long long copyTime;            // Total time spent converting and copying frames
+	volatile long long waitTime;            // Total time spent waiting for framesets (near zero when frames queue up)
+	volatile long long consumerTime;        // Total time between ReadFrame() calls, i.e. spent by the caller on each frame
+	volatile long long maxConsumerTime;     // Longest time between ReadFrame() calls
+	volatile long long interArrivalHistogram[NumInterArrivalBins];
+};
+
+//**********************************************************************
+// Configuration passed to Initialize(). Zero requests librealsense's
+// default for any of the stream settings; formats are rs2_format values.
+// Depth filters run in the order librealsense recommends (decimation,
+// spatial, temporal, hole filling), followed by alignment.
+//**********************************************************************
+struct RealSenseConfigurationUnmanaged
+{
+	const char *serialNumber;       // Device to open, or nullptr for the first one found
+	int colorWidth;
+	int colorHeight;
+	int colorFps;
+	int colorFormat;                // RS2_FORMAT_ANY prefers BGR8, which needs no swizzling
+	int depthWidth;
+	int depthHeight;
+	int depthFps;
+	int depthFormat;
+	int warmupFrames;               // Most framesets discarded at startup (0 for none)
+	bool endWarmupOnAutoExposure;   // End the warm-up as soon as the color exposure stops changing
+	bool alignDepthToColor;         // Map depth into the color camera's viewpoint (rs2::align)
+	int decimationMagnitude;        // Depth decimation factor, 2 to 8 (0 or 1 for none)
+	bool spatialFilter;
+	bool temporalFilter;
+	bool holeFillingFilter;
+	int interCamSyncMode;           // RS2_OPTION_INTER_CAM_SYNC_MODE for the sensors that support it (0 default, 1 master, 2 slave, ...), or -1 to leave it
+	bool globalTimestamps;          // Timestamp frames on the host clock (RS2_OPTION_GLOBAL_TIME_ENABLED), so they compare across devices
+	int threadPriority;             // Priority of the threads frames are received and read on (a System.Threading.ThreadPriority value, see ThreadPolicy.h)
+	unsigned long long threadAffinityMask; // Logical processors those threads may run on (0 = any)
+};
+
+//**********************************************************************
+// Describes a frame returned by AcquireFrames(). The frame's memory belongs
+// to librealsense and stays valid until the handle is passed to
+// ReleaseFrame(). Frames come from a small pool inside librealsense, so
+// holding on to them stalls the device; copy the data if it is to be kept.
+//**********************************************************************
+struct RealSenseFrameUnmanaged
+{
+	void *handle;                   // Keeps the frame alive until ReleaseFrame()
+	const void *data;               // First pixel of the first row
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;            // Bytes per row
+	unsigned int bpp;               // Bits per pixel
+	int format;                     // rs2_format of the data (e.g. RS2_FORMAT_RGB8, RS2_FORMAT_Z16)
+	unsigned long long frameNumber;
+	double timestamp;               // Device timestamp in milliseconds
+};
+
+//**********************************************************************
+// Structure-of-arrays point cloud filled by ComputePointCloud(), with one
+// point per sampled depth pixel in row order (width by height of them).
+// Points are in meters in the depth camera's frame; pixels without depth
+// come out as (0, 0, 0), with texture coordinates of -1. The arrays are
+// the caller's and hold 'capacity' points each.
+//**********************************************************************
+struct RealSensePointCloudUnmanaged
+{
+	float *x;
+	float *y;
+	float *z;
+	float *u;                       // Normalized texture coordinates into the color frame, or nullptr to skip them
+	float *v;
+	unsigned int capacity;
+	unsigned int width;             // Set to the size of the sampled grid (also when capacity is too small)
+	unsigned int height;
+};
+
 //**********************************************************************
 // Define the interface that our managed code (RealSenseDevice) uses to
 // talk to the unmanaged side of the component.
 //**********************************************************************
 struct IRealSenseDeviceUnmanaged
 {
-	virtual unsigned int Initialize() = 0;
-	virtual unsigned int ReadFrame(char *colorBuffer, unsigned int colorBufferLen, char *depthBuffer, unsigned int depthBufferLen) = 0;
+	virtual unsigned int Initialize(const RealSenseConfigurationUnmanaged *configuration) = 0;
+	virtual unsigned int ReadFrame(char *colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, char *depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride) = 0;
+	virtual unsigned int StartAsync(unsigned int queueCapacity) = 0;
+	virtual unsigned int TryReadFrame(char *colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, char *depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride, bool *frameRead) = 0;
+	virtual void *GetFrameEvent() = 0;
+	virtual unsigned int AcquireFrames(RealSenseFrameUnmanaged *colorFrame, RealSenseFrameUnmanaged *depthFrame, unsigned int timeoutMs, bool *framesAcquired) = 0;
+	virtual void ReleaseFrame(void *handle) = 0;
+	virtual unsigned int ComputePointCloud(void *depthHandle, void *colorHandle, unsigned int decimation, RealSensePointCloudUnmanaged *cloud) = 0;
 	virtual unsigned int GetColorWidth() = 0;
 	virtual unsigned int GetColorHeight() = 0;
 	virtual unsigned int GetColorBpp() = 0;
@@ -19,12 +118,34 @@ struct IRealSenseDeviceUnmanaged
 	virtual unsigned int GetDepthHeight() = 0;
 	virtual unsigned int GetDepthBpp() = 0;
 	virtual unsigned int GetDepthStride() = 0;
+	virtual unsigned int GetStatistics(RealSenseStatisticsUnmanaged *stats) = 0;
+	virtual unsigned int AddRef() = 0;
+	virtual unsigned int Release() = 0;
+};
+
+//**********************************************************************
+// Interface to the unmanaged device manager (RealSenseDeviceManager). It
+// shares one rs2::context between the devices it opens, and hands out
+// framesets from all of them that were captured at the same time.
+//**********************************************************************
+struct IRealSenseDeviceManagerUnmanaged
+{
+	virtual unsigned int GetDeviceCount() = 0;
+	virtual unsigned int GetDeviceSerialNumber(unsigned int index, char *buffer, unsigned int bufferLen) = 0;
+	virtual unsigned int OpenDevice(const RealSenseConfigurationUnmanaged *configuration, IRealSenseDeviceUnmanaged **device) = 0;
+	virtual unsigned int GetOpenDeviceCount() = 0;
+	virtual unsigned int AcquireAlignedFrames(RealSenseFrameUnmanaged *colorFrames, RealSenseFrameUnmanaged *depthFrames, unsigned int timeoutMs, double toleranceMs, bool *framesAcquired) = 0;
 	virtual unsigned int AddRef() = 0;
 	virtual unsigned int Release() = 0;
 };
 
+unsigned int CreateRealSenseDeviceManagerUnmanaged(IRealSenseDeviceManagerUnmanaged **manager);
+
 //**********************************************************************
 // CreateRealSenseDeviceUnmanaged creates the unmanaged side of our
-// RealSenseDevice.
+// RealSenseDevice and initializes it with the given configuration
+// (nullptr for the defaults). The device is returned even if it fails to
+// initialize; the result is Initialize()'s.
 //**********************************************************************
-unsigned int CreateRealSenseDeviceUnmanaged(IRealSenseDeviceUnmanaged **device);
+void GetDefaultRealSenseConfiguration(RealSenseConfigurationUnmanaged *configuration);
+unsigned int CreateRealSenseDeviceUnmanaged(const RealSenseConfigurationUnmanaged *configuration, IRealSenseDeviceUnmanaged **device);
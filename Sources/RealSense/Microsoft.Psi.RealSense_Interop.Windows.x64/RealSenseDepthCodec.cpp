@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+#include "RealSenseDepthCodec.h"
+#include "RealSenseDepthCompression.h"
+
+namespace Microsoft {
+	namespace Psi {
+		namespace RealSense {
+			namespace Windows {
+				int RealSenseDepthCodec::GetMaxEncodedSize(int width, int height)
+				{
+					return GetMaxDepthEncodedSize(width, height);
+				}
+
+				int RealSenseDepthCodec::Encode(System::IntPtr depthData, int width, int height, int stride, array<unsigned char>^ output)
+				{
+					if (output == nullptr || output->Length == 0)
+					{
+						throw gcnew System::ArgumentException("An output buffer is required", "output");
+					}
+
+					pin_ptr<unsigned char> pOutput = &output[0];
+					int size = EncodeDepthRVL((const unsigned char*)depthData.ToPointer(), stride, width, height, pOutput, output->Length);
+					if (size < 0)
+					{
+						throw gcnew System::ArgumentException("The output buffer is too small (see GetMaxEncodedSize)", "output");
+					}
+					return size;
+				}
+
+				void RealSenseDepthCodec::Decode(array<unsigned char>^ input, int length, System::IntPtr depthData, int width, int height, int stride)
+				{
+					if (input == nullptr || length <= 0 || length > input->Length)
+					{
+						throw gcnew System::ArgumentOutOfRangeException("length");
+					}
+
+					pin_ptr<unsigned char> pInput = &input[0];
+					if (!DecodeDepthRVL(pInput, length, (unsigned char*)depthData.ToPointer(), stride, width, height))
+					{
+						throw gcnew System::IO::InvalidDataException("The encoded depth data is truncated, corrupt or of a different size");
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,30 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+namespace Microsoft {
+    namespace Psi {
+        namespace RealSense {
+            namespace Windows {
+                //**********************************************************************
+                // Managed entry points to the native RVL depth codec (see
+                // RealSenseDepthCompression.h). Works on any 16-bit depth buffer, so the
+                // depth image encoders can use it for RealSense and Kinect streams alike.
+                //**********************************************************************
+                public ref class RealSenseDepthCodec abstract sealed
+                {
+                public:
+                    // Upper bound on the encoded size of a width by height image, in bytes
+                    static int GetMaxEncodedSize(int width, int height);
+
+                    // Encodes 16-bit depth pixels into 'output', returning the encoded size in bytes
+                    static int Encode(System::IntPtr depthData, int width, int height, int stride, array<unsigned char>^ output);
+
+                    // Decodes 'length' bytes of 'input' into 16-bit depth pixels
+                    static void Decode(array<unsigned char>^ input, int length, System::IntPtr depthData, int width, int height, int stride);
+                };
+            }
+        }
+    }
+}
@@ -0,0 +1,382 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include <string.h>
+#include <intrin.h>
+#include <emmintrin.h>
+#include "RealSenseDepthCompression.h"
+
+// SIMD intrinsics can't be compiled to MSIL, so all of this is native code
+#pragma managed(push, off)
+
+namespace Microsoft {
+	namespace Psi {
+		namespace RealSense {
+			namespace Windows {
+
+				static const int HeaderSize = 8;
+
+				//**********************************************************************
+				// Returns how many of the 'count' pixels at 'p' are zero (or non-zero)
+				// before the first that isn't. SSE2 is part of x64, so there is no
+				// scalar variant to dispatch to, only a tail loop.
+				//**********************************************************************
+				static int CountZeros(const unsigned short *p, int count)
+				{
+					const __m128i zero = _mm_setzero_si128();
+					int i = 0;
+					for (; i + 8 <= count; i += 8)
+					{
+						int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(p + i)), zero));
+						if (mask != 0xFFFF)
+						{
+							unsigned long index;
+							_BitScanForward(&index, ~mask & 0xFFFF);
+							return i + (int)(index / 2);
+						}
+					}
+					while (i < count && p[i] == 0)
+					{
+						i++;
+					}
+					return i;
+				}
+
+				static int CountNonZeros(const unsigned short *p, int count)
+				{
+					const __m128i zero = _mm_setzero_si128();
+					int i = 0;
+					for (; i + 8 <= count; i += 8)
+					{
+						int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(p + i)), zero));
+						if (mask != 0)
+						{
+							unsigned long index;
+							_BitScanForward(&index, mask);
+							return i + (int)(index / 2);
+						}
+					}
+					while (i < count && p[i] != 0)
+					{
+						i++;
+					}
+					return i;
+				}
+
+				//**********************************************************************
+				// Variable length nibble coding: 3 value bits per nibble, low bits
+				// first, with the high bit set on every nibble but the last. Nibbles
+				// are packed into 32-bit words from the most significant end. Both
+				// sides stage nibbles in a 64-bit register so a whole value moves in
+				// one shift instead of one nibble at a time.
+				//**********************************************************************
+				struct NibbleWriter
+				{
+					unsigned int *out;
+					unsigned int *end;
+					unsigned long long bits;
+					int nibbles;
+
+					bool Write(unsigned int value)
+					{
+						unsigned long long code = value & 0x7;
+						int count = 1;
+						while ((value >>= 3) != 0)
+						{
+							code = ((code | 0x8) << 4) | (value & 0x7);
+							count++;
+						}
+
+						// Only run lengths over 2^24 pixels need more than 8 nibbles
+						if (count > 8)
+						{
+							if (!Append(code >> 32, count - 8))
+							{
+								return false;
+							}
+							code &= 0xFFFFFFFF;
+							count = 8;
+						}
+						return Append(code, count);
+					}
+
+					bool Append(unsigned long long code, int count)
+					{
+						bits = (bits << (4 * count)) | code;
+						nibbles += count;
+						if (nibbles >= 8)
+						{
+							if (out == end)
+							{
+								return false;
+							}
+							nibbles -= 8;
+							*out++ = (unsigned int)(bits >> (4 * nibbles));
+						}
+						return true;
+					}
+
+					bool Flush()
+					{
+						if (nibbles != 0)
+						{
+							if (out == end)
+							{
+								return false;
+							}
+							*out++ = (unsigned int)(bits << (4 * (8 - nibbles)));
+						}
+						return true;
+					}
+				};
+
+				struct NibbleReader
+				{
+					const unsigned int *in;
+					const unsigned int *end;
+					unsigned long long bits;    // Unread nibbles, left aligned
+					int nibbles;
+
+					bool Read(unsigned int *value)
+					{
+						// Top up once per value; only values over 24 bits can run dry
+						if (nibbles < 8 && in != end)
+						{
+							bits |= (unsigned long long)*in++ << (32 - 4 * nibbles);
+							nibbles += 8;
+						}
+
+						unsigned int result = 0;
+						int shift = 0;
+						for (;;)
+						{
+							if (nibbles == 0)
+							{
+								if (in == end)
+								{
+									return false;
+								}
+								bits = (unsigned long long)*in++ << 32;
+								nibbles = 8;
+							}
+
+							unsigned int nibble = (unsigned int)(bits >> 60);
+							bits <<= 4;
+							nibbles--;
+							result |= (nibble & 0x7) << shift;
+							if ((nibble & 0x8) == 0)
+							{
+								*value = result;
+								return true;
+							}
+							if ((shift += 3) > 30)
+							{
+								return false;
+							}
+						}
+					}
+				};
+
+				int GetMaxDepthEncodedSize(int width, int height)
+				{
+					// A zigzagged delta takes at most 6 nibbles, and the two run lengths
+					// in front of each run of valid pixels add at most 2 per pixel
+					return HeaderSize + 4 * width * height + 4;
+				}
+
+				int EncodeDepthRVL(const unsigned char *src, int srcStride, int width, int height, unsigned char *dst, int dstSize)
+				{
+					if (width <= 0 || height <= 0 || dstSize < HeaderSize)
+					{
+						return -1;
+					}
+
+					memcpy(dst, &width, sizeof(int));
+					memcpy(dst + sizeof(int), &height, sizeof(int));
+
+					NibbleWriter writer;
+					writer.out = (unsigned int*)(dst + HeaderSize);
+					writer.end = writer.out + (dstSize - HeaderSize) / sizeof(unsigned int);
+					writer.bits = 0;
+					writer.nibbles = 0;
+
+					const unsigned short *row = (const unsigned short*)src;
+					int x = 0;
+					int y = 0;
+					int previous = 0;
+					while (y < height)
+					{
+						int zeros = 0;
+						while (y < height)
+						{
+							int count = CountZeros(row + x, width - x);
+							zeros += count;
+							x += count;
+							if (x < width)
+							{
+								break;
+							}
+							x = 0;
+							y++;
+							row = (const unsigned short*)((const unsigned char*)row + srcStride);
+						}
+
+						// Measure the valid run before writing it, as its length goes first
+						int nonZeros = 0;
+						const unsigned short *scanRow = row;
+						int scanX = x;
+						int scanY = y;
+						while (scanY < height)
+						{
+							int count = CountNonZeros(scanRow + scanX, width - scanX);
+							nonZeros += count;
+							scanX += count;
+							if (scanX < width)
+							{
+								break;
+							}
+							scanX = 0;
+							scanY++;
+							scanRow = (const unsigned short*)((const unsigned char*)scanRow + srcStride);
+						}
+
+						if (!writer.Write((unsigned int)zeros) || !writer.Write((unsigned int)nonZeros))
+						{
+							return -1;
+						}
+
+						while (nonZeros > 0)
+						{
+							int count = width - x < nonZeros ? width - x : nonZeros;
+							for (const unsigned short *p = row + x, *rowEnd = p + count; p != rowEnd; p++)
+							{
+								int current = *p;
+								int delta = current - previous;
+								if (!writer.Write(((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31)))
+								{
+									return -1;
+								}
+								previous = current;
+							}
+							nonZeros -= count;
+							x += count;
+							if (x == width)
+							{
+								x = 0;
+								y++;
+								row = (const unsigned short*)((const unsigned char*)row + srcStride);
+							}
+						}
+					}
+
+					if (!writer.Flush())
+					{
+						return -1;
+					}
+					return (int)((unsigned char*)writer.out - dst);
+				}
+
+				bool DecodeDepthRVL(const unsigned char *src, int srcSize, unsigned char *dst, int dstStride, int width, int height)
+				{
+					if (width <= 0 || height <= 0 || srcSize < HeaderSize)
+					{
+						return false;
+					}
+
+					int encodedWidth;
+					int encodedHeight;
+					memcpy(&encodedWidth, src, sizeof(int));
+					memcpy(&encodedHeight, src + sizeof(int), sizeof(int));
+					if (encodedWidth != width || encodedHeight != height)
+					{
+						return false;
+					}
+
+					NibbleReader reader;
+					reader.in = (const unsigned int*)(src + HeaderSize);
+					reader.end = reader.in + (srcSize - HeaderSize) / sizeof(unsigned int);
+					reader.bits = 0;
+					reader.nibbles = 0;
+
+					unsigned short *row = (unsigned short*)dst;
+					int x = 0;
+					int y = 0;
+					int previous = 0;
+					while (y < height)
+					{
+						unsigned int zeros;
+						unsigned int nonZeros;
+						if (!reader.Read(&zeros) || !reader.Read(&nonZeros))
+						{
+							return false;
+						}
+
+						while (zeros > 0)
+						{
+							if (y == height)
+							{
+								return false;
+							}
+							int count = width - x;
+							if ((unsigned int)count > zeros)
+							{
+								count = (int)zeros;
+							}
+							memset(row + x, 0, count * sizeof(unsigned short));
+							zeros -= count;
+							x += count;
+							if (x == width)
+							{
+								x = 0;
+								y++;
+								row = (unsigned short*)((unsigned char*)row + dstStride);
+							}
+						}
+
+						while (nonZeros > 0)
+						{
+							if (y == height)
+							{
+								return false;
+							}
+							int count = width - x;
+							if ((unsigned int)count > nonZeros)
+							{
+								count = (int)nonZeros;
+							}
+							for (unsigned short *p = row + x, *rowEnd = p + count; p != rowEnd; p++)
+							{
+								unsigned int positive;
+								if (!reader.Read(&positive))
+								{
+									return false;
+								}
+								// Undo the zigzag in 64 bits, so that no corrupt delta can
+								// overflow, and reject any pixel it takes out of 16-bit range
+								long long delta = (positive & 1) ? -(long long)(positive >> 1) - 1 : (long long)(positive >> 1);
+								long long value = previous + delta;
+								if (value < 0 || value > 0xFFFF)
+								{
+									return false;
+								}
+								previous = (int)value;
+								*p = (unsigned short)previous;
+							}
+							nonZeros -= count;
+							x += count;
+							if (x == width)
+							{
+								x = 0;
+								y++;
+								row = (unsigned short*)((unsigned char*)row + dstStride);
+							}
+						}
+					}
+					return true;
+				}
+			}
+		}
+	}
+}
+
+#pragma managed(pop)
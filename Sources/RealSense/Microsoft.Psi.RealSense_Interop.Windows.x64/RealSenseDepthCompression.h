@@ -0,0 +1,33 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+namespace Microsoft {
+	namespace Psi {
+		namespace RealSense {
+			namespace Windows {
+
+				//**********************************************************************
+				// Lossless compression for 16-bit depth images, using the RVL scheme
+				// (A. Wilson, "Fast Lossless Depth Image Compression", ISS 2017). Runs
+				// of zero (invalid) pixels and runs of valid pixels alternate; the run
+				// lengths and the zigzagged deltas between consecutive valid pixels are
+				// written as variable length nibbles, packed 8 to a 32-bit word. Runs
+				// are found 8 pixels at a time with SSE2. Rows are treated as one
+				// continuous sequence, so runs can cross rows and strides may be padded.
+				// An encoded image starts with its width and height (32 bits each).
+				//**********************************************************************
+
+				// Upper bound on the encoded size of an image, in bytes
+				int GetMaxDepthEncodedSize(int width, int height);
+
+				// Returns the encoded size in bytes, or -1 if 'dstSize' is too small
+				int EncodeDepthRVL(const unsigned char *src, int srcStride, int width, int height, unsigned char *dst, int dstSize);
+
+				// Returns false if the data is truncated, corrupt or not 'width' by 'height'
+				bool DecodeDepthRVL(const unsigned char *src, int srcSize, unsigned char *dst, int dstStride, int width, int height);
+			}
+		}
+	}
+}
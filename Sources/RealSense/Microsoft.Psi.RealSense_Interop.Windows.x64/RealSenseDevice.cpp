@@ -8,13 +8,116 @@ namespace Microsoft {
 	namespace Psi {
 		namespace RealSense {
 			namespace Windows {
+				RealSenseFrame::RealSenseFrame(IRealSenseDeviceUnmanaged *device, const RealSenseFrameUnmanaged &frame)
+				{
+					// The device has to outlive its frames
+					m_device = device;
+					m_device->AddRef();
+					m_handle = frame.handle;
+					m_data = System::IntPtr(const_cast<void*>(frame.data));
+					m_width = frame.width;
+					m_height = frame.height;
+					m_stride = frame.stride;
+					m_bpp = frame.bpp;
+					m_format = frame.format;
+					m_frameNumber = frame.frameNumber;
+					m_timestamp = frame.timestamp;
+				}
+
+				RealSenseFrame::~RealSenseFrame()
+				{
+					this->!RealSenseFrame();
+				}
+
+				RealSenseFrame::!RealSenseFrame()
+				{
+					if (m_handle != nullptr)
+					{
+						m_device->ReleaseFrame(m_handle);
+						m_handle = nullptr;
+						m_data = System::IntPtr::Zero;
+						m_device->Release();
+						m_device = nullptr;
+					}
+				}
+
+				RealSenseConfiguration::RealSenseConfiguration()
+				{
+					RealSenseConfigurationUnmanaged defaults;
+					GetDefaultRealSenseConfiguration(&defaults);
+					ColorFormat = defaults.colorFormat;
+					DepthFormat = defaults.depthFormat;
+					WarmupFrames = defaults.warmupFrames;
+					EndWarmupOnAutoExposure = defaults.endWarmupOnAutoExposure;
+					InterCamSyncMode = defaults.interCamSyncMode;
+					ThreadPriority = (System::Threading::ThreadPriority)defaults.threadPriority;
+				}
+
+				void RealSenseConfiguration::ToUnmanaged(RealSenseConfigurationUnmanaged *config)
+				{
+					GetDefaultRealSenseConfiguration(config);
+					config->colorWidth = ColorWidth;
+					config->colorHeight = ColorHeight;
+					config->colorFps = ColorFps;
+					config->colorFormat = ColorFormat;
+					config->depthWidth = DepthWidth;
+					config->depthHeight = DepthHeight;
+					config->depthFps = DepthFps;
+					config->depthFormat = DepthFormat;
+					config->warmupFrames = WarmupFrames;
+					config->endWarmupOnAutoExposure = EndWarmupOnAutoExposure;
+					config->alignDepthToColor = AlignDepthToColor;
+					config->decimationMagnitude = DecimationMagnitude;
+					config->spatialFilter = SpatialFilter;
+					config->temporalFilter = TemporalFilter;
+					config->holeFillingFilter = HoleFillingFilter;
+					config->interCamSyncMode = InterCamSyncMode;
+					config->globalTimestamps = GlobalTimestamps;
+					config->threadPriority = (int)ThreadPriority;
+					config->threadAffinityMask = ThreadAffinityMask;
+				}
+
 				RealSenseDevice::RealSenseDevice()
 				{
 					IRealSenseDeviceUnmanaged *pDevice;
-					CreateRealSenseDeviceUnmanaged(&pDevice);
+					CreateRealSenseDeviceUnmanaged(nullptr, &pDevice);
+					m_device = pDevice;
+				}
+
+				RealSenseDevice::RealSenseDevice(RealSenseConfiguration^ configuration)
+				{
+					RealSenseConfigurationUnmanaged config;
+					configuration->ToUnmanaged(&config);
+
+					System::IntPtr serialNumber = System::Runtime::InteropServices::Marshal::StringToHGlobalAnsi(configuration->SerialNumber);
+					IRealSenseDeviceUnmanaged *pDevice = nullptr;
+					unsigned int hr;
+					try
+					{
+						config.serialNumber = (const char*)serialNumber.ToPointer();
+						hr = CreateRealSenseDeviceUnmanaged(&config, &pDevice);
+					}
+					finally
+					{
+						System::Runtime::InteropServices::Marshal::FreeHGlobal(serialNumber);
+					}
+
+					if (hr != 0)
+					{
+						if (pDevice != nullptr)
+						{
+							pDevice->Release();
+						}
+						throw gcnew System::InvalidOperationException(System::String::Format("Failed to start the RealSense device (0x{0:X8})", hr));
+					}
 					m_device = pDevice;
 				}
 
+				RealSenseDevice::RealSenseDevice(IRealSenseDeviceUnmanaged *device)
+				{
+					m_device = device;
+				}
+
 				RealSenseDevice::~RealSenseDevice()
 				{
 					if (m_device != nullptr)
@@ -25,10 +128,135 @@ namespace Microsoft {
 				}
 
 				unsigned int RealSenseDevice::ReadFrame(System::IntPtr colorBuffer, unsigned int colorBufferLen, System::IntPtr depthBuffer, unsigned int depthBufferLen)
+				{
+					return ReadFrame(colorBuffer, colorBufferLen, 0, depthBuffer, depthBufferLen, 0);
+				}
+
+				unsigned int RealSenseDevice::ReadFrame(System::IntPtr colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, System::IntPtr depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride)
+				{
+					pin_ptr<char> colorBuf = (char*)colorBuffer.ToPointer();
+					pin_ptr<char> depthBuf = (char*)depthBuffer.ToPointer();
+					return m_device->ReadFrame(colorBuf, colorBufferLen, colorBufferStride, depthBuf, depthBufferLen, depthBufferStride);
+				}
+
+				unsigned int RealSenseDevice::StartAsync(unsigned int queueCapacity)
+				{
+					return m_device->StartAsync(queueCapacity);
+				}
+
+				bool RealSenseDevice::TryReadFrame(System::IntPtr colorBuffer, unsigned int colorBufferLen, System::IntPtr depthBuffer, unsigned int depthBufferLen)
+				{
+					return TryReadFrame(colorBuffer, colorBufferLen, 0, depthBuffer, depthBufferLen, 0);
+				}
+
+				bool RealSenseDevice::TryReadFrame(System::IntPtr colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, System::IntPtr depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride)
 				{
 					pin_ptr<char> colorBuf = (char*)colorBuffer.ToPointer();
 					pin_ptr<char> depthBuf = (char*)depthBuffer.ToPointer();
-					return m_device->ReadFrame(colorBuf, colorBufferLen, depthBuf, depthBufferLen);
+					bool frameRead = false;
+					m_device->TryReadFrame(colorBuf, colorBufferLen, colorBufferStride, depthBuf, depthBufferLen, depthBufferStride, &frameRead);
+					return frameRead;
+				}
+
+				System::IntPtr RealSenseDevice::GetFrameEvent()
+				{
+					return System::IntPtr(m_device->GetFrameEvent());
+				}
+
+				bool RealSenseDevice::AcquireFrames(unsigned int timeoutMs, RealSenseFrame^% colorFrame, RealSenseFrame^% depthFrame)
+				{
+					colorFrame = nullptr;
+					depthFrame = nullptr;
+
+					RealSenseFrameUnmanaged color;
+					RealSenseFrameUnmanaged depth;
+					bool framesAcquired = false;
+					m_device->AcquireFrames(&color, &depth, timeoutMs, &framesAcquired);
+					if (!framesAcquired)
+					{
+						return false;
+					}
+
+					colorFrame = gcnew RealSenseFrame(m_device, color);
+					depthFrame = gcnew RealSenseFrame(m_device, depth);
+					return true;
+				}
+
+				void RealSensePointCloud::Allocate(int count, bool textureCoordinates)
+				{
+					if (m_x == nullptr || m_x->Length != count)
+					{
+						m_x = gcnew array<float>(count);
+						m_y = gcnew array<float>(count);
+						m_z = gcnew array<float>(count);
+						m_u = nullptr;
+						m_v = nullptr;
+					}
+					if (textureCoordinates && m_u == nullptr)
+					{
+						m_u = gcnew array<float>(count);
+						m_v = gcnew array<float>(count);
+					}
+				}
+
+				void RealSensePointCloud::SetSize(unsigned int width, unsigned int height, bool textureCoordinates)
+				{
+					m_width = width;
+					m_height = height;
+					m_hasTextureCoordinates = textureCoordinates;
+				}
+
+				void RealSenseDevice::ComputePointCloud(RealSenseFrame^ depthFrame, RealSenseFrame^ colorFrame, unsigned int decimation, RealSensePointCloud^ cloud)
+				{
+					if (depthFrame == nullptr)
+					{
+						throw gcnew System::ArgumentNullException("depthFrame");
+					}
+					if (cloud == nullptr)
+					{
+						throw gcnew System::ArgumentNullException("cloud");
+					}
+					bool textureCoordinates = colorFrame != nullptr;
+					if (depthFrame->Handle == nullptr || (textureCoordinates && colorFrame->Handle == nullptr))
+					{
+						throw gcnew System::ObjectDisposedException("RealSenseFrame");
+					}
+
+					unsigned int step = decimation == 0 ? 1 : decimation;
+					unsigned int width = (depthFrame->Width + step - 1) / step;
+					unsigned int height = (depthFrame->Height + step - 1) / step;
+					cloud->Allocate((int)(width * height), textureCoordinates);
+					if (cloud->X->Length == 0)
+					{
+						// An empty depth frame has no points, and nothing to pin
+						cloud->SetSize(width, height, textureCoordinates);
+						return;
+					}
+
+					pin_ptr<float> x = &cloud->X[0];
+					pin_ptr<float> y = &cloud->Y[0];
+					pin_ptr<float> z = &cloud->Z[0];
+					pin_ptr<float> u = nullptr;
+					pin_ptr<float> v = nullptr;
+					if (textureCoordinates)
+					{
+						u = &cloud->U[0];
+						v = &cloud->V[0];
+					}
+
+					RealSensePointCloudUnmanaged points;
+					points.x = x;
+					points.y = y;
+					points.z = z;
+					points.u = u;
+					points.v = v;
+					points.capacity = width * height;
+					unsigned int hr = m_device->ComputePointCloud(depthFrame->Handle, textureCoordinates ? colorFrame->Handle : nullptr, step, &points);
+					if (hr != 0)
+					{
+						throw gcnew System::InvalidOperationException(System::String::Format("Failed to compute the point cloud (0x{0:X8})", hr));
+					}
+					cloud->SetSize(points.width, points.height, textureCoordinates);
 				}
 
 				unsigned int RealSenseDevice::GetColorWidth()
@@ -70,6 +298,30 @@ namespace Microsoft {
 				{
 					return m_device->GetDepthStride();
 				}
+
+				RealSenseStatistics^ RealSenseDevice::GetStatistics()
+				{
+					RealSenseStatisticsUnmanaged stats;
+					m_device->GetStatistics(&stats);
+
+					RealSenseStatistics^ snapshot = gcnew RealSenseStatistics();
+					snapshot->FramesDelivered = stats.framesDelivered;
+					snapshot->FramesDropped = stats.framesDropped;
+					snapshot->QueueOverflows = stats.queueOverflows;
+					snapshot->Gaps = stats.gaps;
+					snapshot->Errors = stats.errors;
+					snapshot->BytesCopied = stats.bytesCopied;
+					snapshot->CopyTime = stats.copyTime;
+					snapshot->WaitTime = stats.waitTime;
+					snapshot->ConsumerTime = stats.consumerTime;
+					snapshot->MaxConsumerTime = stats.maxConsumerTime;
+					snapshot->InterArrivalHistogram = gcnew array<long long>(RealSenseStatisticsUnmanaged::NumInterArrivalBins);
+					for (int i = 0; i < RealSenseStatisticsUnmanaged::NumInterArrivalBins; i++)
+					{
+						snapshot->InterArrivalHistogram[i] = stats.interArrivalHistogram[i];
+					}
+					return snapshot;
+				}
 			}
 		}
 	}
@@ -8,6 +8,129 @@ namespace Microsoft {
     namespace Psi {
         namespace RealSense {
             namespace Windows {
+                //**********************************************************************
+                // RealSenseStatistics is a snapshot of the counters kept while reading
+                // frames from a RealSense device. All times are TimeSpan ticks (100ns).
+                //**********************************************************************
+                public ref struct RealSenseStatistics
+                {
+                    property long long FramesDelivered;         // Framesets read
+                    property long long FramesDropped;           // Frames the device produced that were never read
+                    property long long QueueOverflows;          // Framesets discarded unread because the delivery queue was full (asynchronous delivery only)
+                    property long long Gaps;                    // Framesets that followed dropped frames
+                    property long long Errors;                  // Failed reads
+                    property long long BytesCopied;             // Bytes copied into the caller's buffers
+                    property long long CopyTime;                // Total time spent converting and copying frames
+                    property long long WaitTime;                // Total time spent waiting for framesets (near zero when frames queue up)
+                    property long long ConsumerTime;            // Total time the caller spent between reads
+                    property long long MaxConsumerTime;         // Longest time the caller spent between reads
+                    property array<long long>^ InterArrivalHistogram; // Element 0 counts intervals under 1ms, element i intervals from 2^(i-1) to 2^i ms, the last one longer intervals
+                };
+
+                //**********************************************************************
+                // RealSenseConfiguration selects the device and the streams a
+                // RealSenseDevice opens, how it warms up and which depth processing it
+                // does natively. Zero for a stream setting leaves it to librealsense;
+                // formats are rs2_format values (0 is RS2_FORMAT_ANY).
+                //**********************************************************************
+                public ref class RealSenseConfiguration
+                {
+                public:
+                    RealSenseConfiguration();
+
+                    property System::String^ SerialNumber;      // Device to open, or null for the first one found
+                    property int ColorWidth;
+                    property int ColorHeight;
+                    property int ColorFps;
+                    property int ColorFormat;                   // Any format prefers BGR8, which needs no swizzling
+                    property int DepthWidth;
+                    property int DepthHeight;
+                    property int DepthFps;
+                    property int DepthFormat;
+                    property int WarmupFrames;                  // Most framesets discarded at startup (defaults to 30; 0 for none)
+                    property bool EndWarmupOnAutoExposure;      // End the warm-up once the color exposure stops changing (defaults to true)
+                    property bool AlignDepthToColor;            // Map depth into the color camera's viewpoint
+                    property int DecimationMagnitude;           // Depth decimation factor, 2 to 8 (0 or 1 for none)
+                    property bool SpatialFilter;
+                    property bool TemporalFilter;
+                    property bool HoleFillingFilter;
+                    property int InterCamSyncMode;              // RS2_OPTION_INTER_CAM_SYNC_MODE (0 default, 1 master, 2 slave, ...), or -1 to leave it (the default)
+                    property bool GlobalTimestamps;             // Timestamp frames on the host clock, so they compare across devices
+                    property System::Threading::ThreadPriority ThreadPriority; // Priority of the threads frames are received and read on; AboveNormal and Highest register them with the MMCSS "Capture" task (defaults to Normal)
+                    property unsigned long long ThreadAffinityMask; // Logical processors those threads may run on, bit n for processor n (0, the default, for any)
+
+                internal:
+                    void ToUnmanaged(RealSenseConfigurationUnmanaged *config);  // Everything but the serial number
+                };
+
+                //**********************************************************************
+                // RealSenseFrame is a frame acquired with RealSenseDevice::AcquireFrames.
+                // Data points straight at librealsense's memory, which stays valid until
+                // the frame is disposed. Dispose frames promptly: they come from a small
+                // pool and the device stalls once it runs out.
+                //**********************************************************************
+                public ref class RealSenseFrame sealed
+                {
+                private:
+                    IRealSenseDeviceUnmanaged *m_device;
+                    void *m_handle;
+                    System::IntPtr m_data;
+                    unsigned int m_width;
+                    unsigned int m_height;
+                    unsigned int m_stride;
+                    unsigned int m_bpp;
+                    int m_format;
+                    unsigned long long m_frameNumber;
+                    double m_timestamp;
+                internal:
+                    RealSenseFrame(IRealSenseDeviceUnmanaged *device, const RealSenseFrameUnmanaged &frame);
+                    property void *Handle { void *get() { return m_handle; } }  // nullptr once disposed
+                public:
+                    ~RealSenseFrame();
+                    !RealSenseFrame();
+
+                    property System::IntPtr Data { System::IntPtr get() { return m_data; } }
+                    property unsigned int Width { unsigned int get() { return m_width; } }
+                    property unsigned int Height { unsigned int get() { return m_height; } }
+                    property unsigned int Stride { unsigned int get() { return m_stride; } }
+                    property unsigned int Bpp { unsigned int get() { return m_bpp; } }
+                    property int Format { int get() { return m_format; } }  // The rs2_format of the data
+                    property unsigned long long FrameNumber { unsigned long long get() { return m_frameNumber; } }
+                    property double Timestamp { double get() { return m_timestamp; } }  // Device timestamp in milliseconds
+                };
+
+                //**********************************************************************
+                // RealSensePointCloud holds the output of RealSenseDevice::ComputePointCloud
+                // as separate arrays per coordinate, one entry per sampled depth pixel in
+                // row order. Points are in meters in the depth camera's frame; pixels
+                // without depth are (0, 0, 0) with texture coordinates of -1. Reusing an
+                // instance across frames reuses its arrays.
+                //**********************************************************************
+                public ref class RealSensePointCloud sealed
+                {
+                private:
+                    array<float>^ m_x;
+                    array<float>^ m_y;
+                    array<float>^ m_z;
+                    array<float>^ m_u;
+                    array<float>^ m_v;
+                    unsigned int m_width;
+                    unsigned int m_height;
+                    bool m_hasTextureCoordinates;
+                internal:
+                    void Allocate(int count, bool textureCoordinates);
+                    void SetSize(unsigned int width, unsigned int height, bool textureCoordinates);
+                public:
+                    property array<float>^ X { array<float>^ get() { return m_x; } }
+                    property array<float>^ Y { array<float>^ get() { return m_y; } }
+                    property array<float>^ Z { array<float>^ get() { return m_z; } }
+                    property array<float>^ U { array<float>^ get() { return m_u; } }  // Normalized texture coordinates into the color frame
+                    property array<float>^ V { array<float>^ get() { return m_v; } }
+                    property unsigned int Width { unsigned int get() { return m_width; } }
+                    property unsigned int Height { unsigned int get() { return m_height; } }
+                    property bool HasTextureCoordinates { bool get() { return m_hasTextureCoordinates; } }
+                };
+
                 //**********************************************************************
                 // RealSenseDevice defines a managed wrapper around the unmanaged side
                 // of our RealSense device.
@@ -16,11 +139,31 @@ namespace Microsoft {
                 {
                 private:
                     IRealSenseDeviceUnmanaged *m_device; // The actual unmanaged device code
+                internal:
+                    RealSenseDevice(IRealSenseDeviceUnmanaged *device);  // Takes over the caller's reference
+                    property IRealSenseDeviceUnmanaged *Unmanaged { IRealSenseDeviceUnmanaged *get() { return m_device; } }
                 public:
                     RealSenseDevice();
+                    RealSenseDevice(RealSenseConfiguration^ configuration);
                     ~RealSenseDevice();
 
+                    // Color is copied in BGR order with GetColorBpp() bits per pixel. Without strides rows are packed
                     unsigned int ReadFrame(System::IntPtr colorBuffer, unsigned int colorBufferLen, System::IntPtr depthBuffer, unsigned int depthBufferLen);
+                    unsigned int ReadFrame(System::IntPtr colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, System::IntPtr depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride);
+
+                    // Switches to asynchronous delivery: framesets are queued as they arrive (up to
+                    // queueCapacity, dropping the oldest) and read with TryReadFrame or ReadFrame
+                    unsigned int StartAsync(unsigned int queueCapacity);
+                    bool TryReadFrame(System::IntPtr colorBuffer, unsigned int colorBufferLen, System::IntPtr depthBuffer, unsigned int depthBufferLen);
+                    bool TryReadFrame(System::IntPtr colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, System::IntPtr depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride);
+                    System::IntPtr GetFrameEvent(); // Manual reset event, set while framesets are queued. Owned by the device
+
+                    // Gets the next frameset without copying it. Returns false if none arrived within the timeout
+                    bool AcquireFrames(unsigned int timeoutMs, [System::Runtime::InteropServices::Out] RealSenseFrame^% colorFrame, [System::Runtime::InteropServices::Out] RealSenseFrame^% depthFrame);
+
+                    // Deprojects an acquired depth frame, sampling every decimation-th pixel (0 or 1 for all of
+                    // them). With a color frame, texture coordinates into it are computed as well. Not thread safe
+                    void ComputePointCloud(RealSenseFrame^ depthFrame, RealSenseFrame^ colorFrame, unsigned int decimation, RealSensePointCloud^ cloud);
                     unsigned int GetColorWidth();
                     unsigned int GetColorHeight();
                     unsigned int GetColorBpp();
@@ -29,6 +172,7 @@ namespace Microsoft {
                     unsigned int GetDepthHeight();
                     unsigned int GetDepthBpp();
                     unsigned int GetDepthStride();
+                    RealSenseStatistics^ GetStatistics();
                 };
             }
         }
@@ -0,0 +1,111 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+#include "RealSenseDeviceManager.h"
+
+namespace Microsoft {
+	namespace Psi {
+		namespace RealSense {
+			namespace Windows {
+				RealSenseDeviceManager::RealSenseDeviceManager()
+				{
+					IRealSenseDeviceManagerUnmanaged *pManager;
+					CreateRealSenseDeviceManagerUnmanaged(&pManager);
+					m_manager = pManager;
+					m_devices = gcnew System::Collections::Generic::List<RealSenseDevice^>();
+				}
+
+				RealSenseDeviceManager::~RealSenseDeviceManager()
+				{
+					if (m_manager != nullptr)
+					{
+						m_manager->Release();
+						m_manager = nullptr;
+					}
+				}
+
+				array<System::String^>^ RealSenseDeviceManager::GetSerialNumbers()
+				{
+					unsigned int count = m_manager->GetDeviceCount();
+					System::Collections::Generic::List<System::String^>^ serialNumbers = gcnew System::Collections::Generic::List<System::String^>();
+					for (unsigned int i = 0; i < count; i++)
+					{
+						char serialNumber[64];
+						if (m_manager->GetDeviceSerialNumber(i, serialNumber, sizeof(serialNumber)) == 0)
+						{
+							serialNumbers->Add(gcnew System::String(serialNumber));
+						}
+					}
+					return serialNumbers->ToArray();
+				}
+
+				RealSenseDevice^ RealSenseDeviceManager::OpenDevice(RealSenseConfiguration^ configuration)
+				{
+					RealSenseConfigurationUnmanaged config;
+					configuration->ToUnmanaged(&config);
+
+					System::IntPtr serialNumber = System::Runtime::InteropServices::Marshal::StringToHGlobalAnsi(configuration->SerialNumber);
+					IRealSenseDeviceUnmanaged *pDevice = nullptr;
+					unsigned int hr;
+					try
+					{
+						config.serialNumber = (const char*)serialNumber.ToPointer();
+						hr = m_manager->OpenDevice(&config, &pDevice);
+					}
+					finally
+					{
+						System::Runtime::InteropServices::Marshal::FreeHGlobal(serialNumber);
+					}
+
+					if (hr != 0)
+					{
+						throw gcnew System::InvalidOperationException(System::String::Format("Failed to start the RealSense device (0x{0:X8})", hr));
+					}
+
+					RealSenseDevice^ device = gcnew RealSenseDevice(pDevice);
+					m_devices->Add(device);
+					return device;
+				}
+
+				bool RealSenseDeviceManager::AcquireAlignedFrames(unsigned int timeoutMs, double toleranceMs, array<RealSenseFrame^>^% colorFrames, array<RealSenseFrame^>^% depthFrames)
+				{
+					colorFrames = nullptr;
+					depthFrames = nullptr;
+
+					int count = m_devices->Count;
+					if (count == 0)
+					{
+						return false;
+					}
+
+					RealSenseFrameUnmanaged *colors = new RealSenseFrameUnmanaged[count];
+					RealSenseFrameUnmanaged *depths = new RealSenseFrameUnmanaged[count];
+					try
+					{
+						bool framesAcquired = false;
+						m_manager->AcquireAlignedFrames(colors, depths, timeoutMs, toleranceMs, &framesAcquired);
+						if (!framesAcquired)
+						{
+							return false;
+						}
+
+						colorFrames = gcnew array<RealSenseFrame^>(count);
+						depthFrames = gcnew array<RealSenseFrame^>(count);
+						for (int i = 0; i < count; i++)
+						{
+							colorFrames[i] = gcnew RealSenseFrame(m_devices[i]->Unmanaged, colors[i]);
+							depthFrames[i] = gcnew RealSenseFrame(m_devices[i]->Unmanaged, depths[i]);
+						}
+					}
+					finally
+					{
+						delete[] colors;
+						delete[] depths;
+					}
+					return true;
+				}
+			}
+		}
+	}
+}
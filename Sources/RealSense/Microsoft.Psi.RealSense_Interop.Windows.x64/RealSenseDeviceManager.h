@@ -0,0 +1,40 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+#include "IRealSenseDeviceUnmanaged.h"
+#include "RealSenseDevice.h"
+
+namespace Microsoft {
+    namespace Psi {
+        namespace RealSense {
+            namespace Windows {
+                //**********************************************************************
+                // RealSenseDeviceManager opens several RealSense devices through one
+                // shared librealsense context and reads framesets from all of them that
+                // were captured at the same time. For hardware sync, open one device with
+                // InterCamSyncMode 1 (master) and the others with 2 (slave). Devices are
+                // opened for asynchronous delivery with global timestamps, and keep
+                // running until the manager is disposed.
+                //**********************************************************************
+                public ref class RealSenseDeviceManager sealed
+                {
+                private:
+                    IRealSenseDeviceManagerUnmanaged *m_manager;
+                    System::Collections::Generic::List<RealSenseDevice^>^ m_devices;
+                public:
+                    RealSenseDeviceManager();
+                    ~RealSenseDeviceManager();
+
+                    array<System::String^>^ GetSerialNumbers();     // Serial numbers of the connected devices
+                    RealSenseDevice^ OpenDevice(RealSenseConfiguration^ configuration);
+
+                    // Gets one frameset per opened device (in the order they were opened) whose color
+                    // timestamps are within toleranceMs of each other, dropping older unmatched ones.
+                    // Returns false if no match was found within the timeout
+                    bool AcquireAlignedFrames(unsigned int timeoutMs, double toleranceMs, [System::Runtime::InteropServices::Out] array<RealSenseFrame^>^% colorFrames, [System::Runtime::InteropServices::Out] array<RealSenseFrame^>^% depthFrames);
+                };
+            }
+        }
+    }
+}
@@ -0,0 +1,252 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "RealSenseDeviceManagerUnmanaged.h"
+#include "RealSenseDeviceUnmanaged.h"
+
+#pragma managed(push, off)
+RealSenseDeviceManagerUnmanaged::RealSenseDeviceManagerUnmanaged()
+{
+	refCount = 0;
+}
+
+RealSenseDeviceManagerUnmanaged::~RealSenseDeviceManagerUnmanaged()
+{
+	for (RealSenseDeviceUnmanaged *device : devices)
+	{
+		device->Release();
+	}
+}
+
+unsigned int RealSenseDeviceManagerUnmanaged::GetDeviceCount()
+{
+	try
+	{
+		return context.query_devices().size();
+	}
+	catch (...)
+	{
+		return 0;
+	}
+}
+
+unsigned int RealSenseDeviceManagerUnmanaged::GetDeviceSerialNumber(unsigned int index, char *buffer, unsigned int bufferLen)
+{
+	if (buffer == nullptr || bufferLen == 0)
+	{
+		return E_POINTER;
+	}
+
+	try
+	{
+		rs2::device_list deviceList = context.query_devices();
+		if (index >= deviceList.size())
+		{
+			return E_INVALIDARG;
+		}
+
+		const char *serialNumber = deviceList[index].get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+		if (strlen(serialNumber) >= bufferLen)
+		{
+			return E_INVALIDARG;
+		}
+		strcpy_s(buffer, bufferLen, serialNumber);
+	}
+	catch (...)
+	{
+		return E_UNEXPECTED;
+	}
+	return S_OK;
+}
+
+unsigned int RealSenseDeviceManagerUnmanaged::OpenDevice(const RealSenseConfigurationUnmanaged *configuration, IRealSenseDeviceUnmanaged **device)
+{
+	if (configuration == nullptr || device == nullptr)
+	{
+		return E_POINTER;
+	}
+	*device = nullptr;
+
+	// WaitForMultipleObjects() in AcquireAlignedFrames() takes at most this many events
+	if (devices.size() >= MAXIMUM_WAIT_OBJECTS)
+	{
+		return E_INVALIDARG;
+	}
+
+	RealSenseConfigurationUnmanaged deviceConfiguration = *configuration;
+	deviceConfiguration.globalTimestamps = true;
+
+	RealSenseDeviceUnmanaged *dev = new RealSenseDeviceUnmanaged(context);
+	if (dev == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+	dev->AddRef();
+
+	unsigned int hr = dev->Initialize(&deviceConfiguration);
+	if (hr == S_OK)
+	{
+		hr = dev->StartAsync(QueueCapacity);
+	}
+	if (hr != S_OK)
+	{
+		dev->Release();
+		return hr;
+	}
+
+	devices.push_back(dev);
+	dev->AddRef();
+	*device = dev;
+	return S_OK;
+}
+
+unsigned int RealSenseDeviceManagerUnmanaged::AcquireAlignedFrames(RealSenseFrameUnmanaged *colorFrames, RealSenseFrameUnmanaged *depthFrames, unsigned int timeoutMs, double toleranceMs, bool *framesAcquired)
+{
+	if (colorFrames == nullptr || depthFrames == nullptr || framesAcquired == nullptr)
+	{
+		return E_POINTER;
+	}
+	*framesAcquired = false;
+	if (devices.empty())
+	{
+		return E_NOT_VALID_STATE;
+	}
+
+	std::vector<HANDLE> events;
+	for (RealSenseDeviceUnmanaged *device : devices)
+	{
+		events.push_back(device->GetFrameEvent());
+	}
+
+	ULONGLONG deadline = GetTickCount64() + timeoutMs;
+	for (;;)
+	{
+		// Wait until every device has a frameset queued
+		ULONGLONG now = GetTickCount64();
+		DWORD remaining = now < deadline ? (DWORD)(deadline - now) : 0;
+		DWORD waitResult = WaitForMultipleObjects((DWORD)events.size(), events.data(), TRUE, remaining);
+		if (waitResult == WAIT_FAILED)
+		{
+			return HRESULT_FROM_WIN32(GetLastError());
+		}
+		if (waitResult >= WAIT_OBJECT_0 + events.size())
+		{
+			return S_OK;
+		}
+
+		// The newest of the oldest framesets is the earliest time all devices can
+		// match; drop whatever is queued before it on the others. A device's next
+		// frameset may then be too new for the rest, so repeat until all of them
+		// are within the tolerance of the newest.
+		bool allQueued = true;
+		bool aligned = false;
+		while (allQueued && !aligned)
+		{
+			double newest = 0;
+			for (size_t i = 0; i < devices.size() && allQueued; i++)
+			{
+				double timestamp;
+				allQueued = devices[i]->PeekFramesetTimestamp(&timestamp);
+				if (allQueued && (i == 0 || timestamp > newest))
+				{
+					newest = timestamp;
+				}
+			}
+
+			aligned = true;
+			for (size_t i = 0; i < devices.size() && allQueued; i++)
+			{
+				double timestamp;
+				while ((allQueued = devices[i]->PeekFramesetTimestamp(&timestamp)) && timestamp < newest - toleranceMs)
+				{
+					devices[i]->DiscardFrameset();
+				}
+				if (allQueued && timestamp > newest + toleranceMs)
+				{
+					aligned = false;
+				}
+			}
+		}
+
+		if (!allQueued)
+		{
+			// Some device ran dry while we were matching; wait for it again
+			continue;
+		}
+
+		size_t count = 0;
+		for (; count < devices.size(); count++)
+		{
+			bool acquired = false;
+			devices[count]->AcquireFrames(&colorFrames[count], &depthFrames[count], 0, &acquired);
+			if (!acquired)
+			{
+				// Someone else read from the device
+				break;
+			}
+		}
+
+		// A device's queue may have overflowed between peeking and popping, handing
+		// us a newer frameset than the one matched, so check what we actually got
+		bool matched = count == devices.size();
+		if (matched)
+		{
+			double oldest = colorFrames[0].timestamp;
+			double newest = colorFrames[0].timestamp;
+			for (size_t i = 1; i < count; i++)
+			{
+				if (colorFrames[i].timestamp < oldest)
+				{
+					oldest = colorFrames[i].timestamp;
+				}
+				if (colorFrames[i].timestamp > newest)
+				{
+					newest = colorFrames[i].timestamp;
+				}
+			}
+			matched = newest - oldest <= toleranceMs;
+		}
+
+		if (matched)
+		{
+			*framesAcquired = true;
+			return S_OK;
+		}
+
+		// Give back what we have and start over
+		for (size_t i = 0; i < count; i++)
+		{
+			devices[i]->ReleaseFrame(colorFrames[i].handle);
+			devices[i]->ReleaseFrame(depthFrames[i].handle);
+		}
+	}
+}
+
+unsigned int RealSenseDeviceManagerUnmanaged::AddRef()
+{
+	return (unsigned int)InterlockedIncrement(&refCount);
+}
+
+unsigned int RealSenseDeviceManagerUnmanaged::Release()
+{
+	unsigned int refcnt = (unsigned int)InterlockedDecrement(&refCount);
+	if (refcnt == 0)
+	{
+		delete this;
+	}
+	return refcnt;
+}
+
+unsigned int CreateRealSenseDeviceManagerUnmanaged(IRealSenseDeviceManagerUnmanaged **manager)
+{
+	RealSenseDeviceManagerUnmanaged *mgr = new RealSenseDeviceManagerUnmanaged();
+	if (mgr == nullptr)
+	{
+		return E_OUTOFMEMORY;
+	}
+	mgr->AddRef();
+	*manager = mgr;
+	return S_OK;
+}
+
+#pragma managed(pop)
@@ -0,0 +1,40 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+#pragma managed(push, off)
+#include <librealsense2/rs.hpp>
+#include <windows.h>
+#include <vector>
+#include "IRealSenseDeviceUnmanaged.h"
+
+class RealSenseDeviceUnmanaged;
+
+//**********************************************************************
+// Opens several RealSense devices through one shared rs2::context, and
+// matches their framesets by timestamp. Devices are opened in asynchronous
+// mode with global timestamps, so their queued framesets can be compared
+// directly; with hardware sync the matches are exact to within the
+// trigger jitter.
+//**********************************************************************
+class RealSenseDeviceManagerUnmanaged : public IRealSenseDeviceManagerUnmanaged
+{
+private:
+	rs2::context context;
+	std::vector<RealSenseDeviceUnmanaged*> devices;  // Opened devices, each holding a reference
+	volatile long refCount;
+
+	// Framesets queued per opened device; enough to cover the skew between devices
+	static const unsigned int QueueCapacity = 4;
+public:
+	RealSenseDeviceManagerUnmanaged();
+	~RealSenseDeviceManagerUnmanaged();
+	virtual unsigned int GetDeviceCount();
+	virtual unsigned int GetDeviceSerialNumber(unsigned int index, char *buffer, unsigned int bufferLen);
+	virtual unsigned int OpenDevice(const RealSenseConfigurationUnmanaged *configuration, IRealSenseDeviceUnmanaged **device);
+	virtual unsigned int GetOpenDeviceCount() { return (unsigned int)devices.size(); }
+	virtual unsigned int AcquireAlignedFrames(RealSenseFrameUnmanaged *colorFrames, RealSenseFrameUnmanaged *depthFrames, unsigned int timeoutMs, double toleranceMs, bool *framesAcquired);
+	virtual unsigned int AddRef();
+	virtual unsigned int Release();
+};
+#pragma managed(pop)
@@ -2,17 +2,75 @@
 // Licensed under the MIT license.
 
 #include "RealSenseDeviceUnmanaged.h"
+#include "MediaConversion.h"
+#include "ThreadPolicy.h"
+#include "MediaTrace.h"
 #include "librealsense2\h\rs_sensor.h"
 
+using namespace Microsoft::Psi::RealSense::Windows;
+using namespace Microsoft::Psi::Media::Conversion;
+
 #pragma managed(push, off)
 RealSenseDeviceUnmanaged::RealSenseDeviceUnmanaged()
+	: align(RS2_STREAM_COLOR)
+{
+	Construct();
+}
+
+RealSenseDeviceUnmanaged::RealSenseDeviceUnmanaged(const rs2::context &context)
+	: pipeline(context), align(RS2_STREAM_COLOR)
+{
+	Construct();
+}
+
+void RealSenseDeviceUnmanaged::Construct()
 {
 	refCount = 0;
+	started = false;
+	memset(&stats, 0, sizeof(stats));
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	qpcFrequency = frequency.QuadPart;
+	lastReadEndTime = 0;
+	lastArrivalTime = 0;
+	lastColorFrameNumber = 0;
+	lastDepthFrameNumber = 0;
+	asyncMode = false;
+	InitializeCriticalSection(&queueLock);
+	frameEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+	queue = nullptr;
+	queueCapacity = 0;
+	queueHead = 0;
+	queueCount = 0;
+	alignDepthToColor = false;
+	useDecimation = false;
+	useSpatial = false;
+	useTemporal = false;
+	useHoleFilling = false;
+	threadPolicy = Microsoft::Psi::Media::Threading::MakeThreadPolicy(Microsoft::Psi::Media::Threading::ThreadPriority_Normal, Microsoft::Psi::Media::Threading::ThreadTask_Capture, 0);
 }
 
 RealSenseDeviceUnmanaged::~RealSenseDeviceUnmanaged()
 {
-	pipeline.stop();
+	// Stopping the pipeline waits for the callback, so the queue can go after it.
+	// Initialize() may have failed before starting it, and nothing may escape here.
+	if (started)
+	{
+		try
+		{
+			pipeline.stop();
+		}
+		catch (...)
+		{
+		}
+		started = false;
+	}
+	delete[] queue;
+	DeleteCriticalSection(&queueLock);
+	if (frameEvent != nullptr)
+	{
+		CloseHandle(frameEvent);
+	}
 }
 
 #ifdef DUMP_DEVICE_INFO
@@ -64,28 +122,183 @@ void RealSenseDeviceUnmanaged::DumpDeviceInfo()
 }
 #endif // DUMP_DEVICE_INFO
 
-unsigned int RealSenseDeviceUnmanaged::Initialize()
+void GetDefaultRealSenseConfiguration(RealSenseConfigurationUnmanaged *configuration)
 {
-	try
+	memset(configuration, 0, sizeof(*configuration));
+	configuration->colorFormat = RS2_FORMAT_ANY;
+	configuration->depthFormat = RS2_FORMAT_ANY;
+	configuration->warmupFrames = 30;
+	configuration->endWarmupOnAutoExposure = true;
+	configuration->interCamSyncMode = -1;
+	configuration->threadPriority = Microsoft::Psi::Media::Threading::ThreadPriority_Normal;
+}
+
+// Puts the calling thread under the configured policy. Cheap once it has been
+// applied, so it's done on every frame rather than tracking which threads we've seen
+void RealSenseDeviceUnmanaged::ApplyThreadPolicy()
+{
+	if (!Microsoft::Psi::Media::Threading::IsDefaultThreadPolicy(threadPolicy))
 	{
-		rs2::config config;
-		config.enable_all_streams();
-		rs2::pipeline_profile pipeprof = pipeline.start();
+		Microsoft::Psi::Media::Threading::ApplyThreadPolicy(threadPolicy);
+	}
+}
 
-		// Read 30 frames so that things like autoexposure settle
-		for (int i = 0; i < 30; i++)
+unsigned int RealSenseDeviceUnmanaged::ConfigureStreams(const RealSenseConfigurationUnmanaged &configuration)
+{
+	bool colorConfigured = configuration.colorWidth != 0 || configuration.colorHeight != 0 || configuration.colorFps != 0 || configuration.colorFormat != RS2_FORMAT_ANY;
+	bool depthConfigured = configuration.depthWidth != 0 || configuration.depthHeight != 0 || configuration.depthFps != 0 || configuration.depthFormat != RS2_FORMAT_ANY;
+
+	int attempts = configuration.colorFormat == RS2_FORMAT_ANY ? 2 : 1;
+	for (int attempt = 0; attempt < attempts; attempt++)
+	{
+		// Ask for BGR color first, which we can pass on without swapping the
+		// channels, unless a format was asked for
+		rs2_format colorFormat = (rs2_format)configuration.colorFormat;
+		if (colorFormat == RS2_FORMAT_ANY && attempt == 0)
 		{
-			try
+			colorFormat = RS2_FORMAT_BGR8;
+		}
+
+		config = rs2::config();
+		if (configuration.serialNumber != nullptr && configuration.serialNumber[0] != '\0')
+		{
+			config.enable_device(configuration.serialNumber);
+		}
+		config.enable_stream(RS2_STREAM_COLOR, configuration.colorWidth, configuration.colorHeight, colorFormat, configuration.colorFps);
+		config.enable_stream(RS2_STREAM_DEPTH, configuration.depthWidth, configuration.depthHeight, (rs2_format)configuration.depthFormat, configuration.depthFps);
+		if (config.can_resolve(pipeline))
+		{
+			return S_OK;
+		}
+	}
+
+	// Devices that can't deliver BGR keep their default streams, as long as
+	// nothing specific was asked for
+	if (colorConfigured || depthConfigured)
+	{
+		return E_INVALIDARG;
+	}
+	config = rs2::config();
+	if (configuration.serialNumber != nullptr && configuration.serialNumber[0] != '\0')
+	{
+		config.enable_device(configuration.serialNumber);
+	}
+	return S_OK;
+}
+
+void RealSenseDeviceUnmanaged::WarmUp(const RealSenseConfigurationUnmanaged &configuration)
+{
+	// Give things like auto-exposure time to settle. Where the color frames carry
+	// their exposure, stop once it has stopped changing rather than after a fixed
+	// number of frames
+	long long lastExposure = -1;
+	int stableFrames = 0;
+	for (int i = 0; i < configuration.warmupFrames; i++)
+	{
+		rs2::frameset frame;
+		if (!pipeline.try_wait_for_frames(&frame))
+		{
+			continue;
+		}
+
+		if (configuration.endWarmupOnAutoExposure)
+		{
+			rs2::video_frame colorFrame = frame.get_color_frame();
+			if (colorFrame && colorFrame.supports_frame_metadata(RS2_FRAME_METADATA_ACTUAL_EXPOSURE))
 			{
-				pipeline.wait_for_frames();
+				long long exposure = colorFrame.get_frame_metadata(RS2_FRAME_METADATA_ACTUAL_EXPOSURE);
+				long long change = exposure > lastExposure ? exposure - lastExposure : lastExposure - exposure;
+				stableFrames = (lastExposure >= 0 && change * 100 <= lastExposure) ? stableFrames + 1 : 0;
+				lastExposure = exposure;
+				if (stableFrames >= AutoExposureStableFrames)
+				{
+					break;
+				}
 			}
-			catch (...)
+		}
+	}
+}
+
+rs2::frameset RealSenseDeviceUnmanaged::ProcessFrameset(const rs2::frameset &frameset)
+{
+	// The filters only process the depth frame of the set and pass the rest through
+	rs2::frameset processed = frameset;
+	if (useDecimation)
+	{
+		processed = decimation.process(processed);
+	}
+	if (useSpatial)
+	{
+		processed = spatial.process(processed);
+	}
+	if (useTemporal)
+	{
+		processed = temporal.process(processed);
+	}
+	if (useHoleFilling)
+	{
+		processed = holeFilling.process(processed);
+	}
+	if (alignDepthToColor)
+	{
+		processed = align.process(processed);
+	}
+	return processed;
+}
+
+unsigned int RealSenseDeviceUnmanaged::Initialize(const RealSenseConfigurationUnmanaged *configuration)
+{
+	RealSenseConfigurationUnmanaged defaults;
+	if (configuration == nullptr)
+	{
+		GetDefaultRealSenseConfiguration(&defaults);
+		configuration = &defaults;
+	}
+
+	try
+	{
+		unsigned int hr = ConfigureStreams(*configuration);
+		if (hr != S_OK)
+		{
+			return hr;
+		}
+
+		useDecimation = configuration->decimationMagnitude > 1;
+		if (useDecimation)
+		{
+			decimation.set_option(RS2_OPTION_FILTER_MAGNITUDE, (float)configuration->decimationMagnitude);
+		}
+		useSpatial = configuration->spatialFilter;
+		useTemporal = configuration->temporalFilter;
+		useHoleFilling = configuration->holeFillingFilter;
+		alignDepthToColor = configuration->alignDepthToColor;
+		threadPolicy = Microsoft::Psi::Media::Threading::MakeThreadPolicy(configuration->threadPriority, Microsoft::Psi::Media::Threading::ThreadTask_Capture, configuration->threadAffinityMask);
+
+		// Sync and timestamp options have to be set before streaming starts
+		if (configuration->interCamSyncMode >= 0 || configuration->globalTimestamps)
+		{
+			rs2::device device = config.resolve(pipeline).get_device();
+			for (rs2::sensor sensor : device.query_sensors())
 			{
+				if (configuration->interCamSyncMode >= 0 && sensor.supports(RS2_OPTION_INTER_CAM_SYNC_MODE))
+				{
+					sensor.set_option(RS2_OPTION_INTER_CAM_SYNC_MODE, (float)configuration->interCamSyncMode);
+				}
+				if (configuration->globalTimestamps && sensor.supports(RS2_OPTION_GLOBAL_TIME_ENABLED))
+				{
+					sensor.set_option(RS2_OPTION_GLOBAL_TIME_ENABLED, 1.0f);
+				}
 			}
 		}
 
+		rs2::pipeline_profile pipeprof = pipeline.start(config);
+		started = true;
+
+		WarmUp(*configuration);
 
-		rs2::frameset frame = pipeline.wait_for_frames();
+		// The frame sizes are read from a processed frameset, since decimation and
+		// alignment change them
+		rs2::frameset frame = ProcessFrameset(pipeline.wait_for_frames());
 		rs2::video_frame colorFrame = frame.get_color_frame();
 		if (colorFrame)
 		{
@@ -110,61 +323,492 @@ unsigned int RealSenseDeviceUnmanaged::Initialize()
 	return 0;
 }
 
-unsigned int RealSenseDeviceUnmanaged::ReadFrame(char *colorBuffer, unsigned int colorBufferLen, char *depthBuffer, unsigned int depthBufferLen)
+long long RealSenseDeviceUnmanaged::GetQpcTime()
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (counter.QuadPart / qpcFrequency) * 10000000 + (counter.QuadPart % qpcFrequency) * 10000000 / qpcFrequency;
+}
+
+void RealSenseDeviceUnmanaged::CountDroppedFrames(unsigned long long frameNumber, unsigned long long &lastFrameNumber, long long &dropped)
 {
+	// Frame numbers restart when the stream does, so only count forward jumps
+	if (lastFrameNumber != 0 && frameNumber > lastFrameNumber + 1)
+	{
+		dropped += (long long)(frameNumber - lastFrameNumber - 1);
+	}
+	lastFrameNumber = frameNumber;
+}
+
+unsigned int RealSenseDeviceUnmanaged::GetStatistics(RealSenseStatisticsUnmanaged *snapshot)
+{
+	if (snapshot == nullptr)
+	{
+		return E_POINTER;
+	}
+
+	// The counters are read one by one while frames are being read, so may be a frame apart from each other
+	snapshot->framesDelivered = stats.framesDelivered;
+	snapshot->framesDropped = stats.framesDropped;
+	snapshot->queueOverflows = stats.queueOverflows;
+	snapshot->gaps = stats.gaps;
+	snapshot->errors = stats.errors;
+	snapshot->bytesCopied = stats.bytesCopied;
+	snapshot->copyTime = stats.copyTime;
+	snapshot->waitTime = stats.waitTime;
+	snapshot->consumerTime = stats.consumerTime;
+	snapshot->maxConsumerTime = stats.maxConsumerTime;
+	for (int i = 0; i < RealSenseStatisticsUnmanaged::NumInterArrivalBins; i++)
+	{
+		snapshot->interArrivalHistogram[i] = stats.interArrivalHistogram[i];
+	}
+	return S_OK;
+}
+
+void RealSenseDeviceUnmanaged::RecordFrameNumbers(const rs2::video_frame &colorFrame, const rs2::video_frame &depthFrame)
+{
+	long long dropped = 0;
+	CountDroppedFrames(colorFrame.get_frame_number(), lastColorFrameNumber, dropped);
+	CountDroppedFrames(depthFrame.get_frame_number(), lastDepthFrameNumber, dropped);
+	if (dropped > 0)
+	{
+		InterlockedExchangeAdd64(&stats.framesDropped, dropped);
+		InterlockedIncrement64(&stats.gaps);
+	}
+}
+
+void RealSenseDeviceUnmanaged::RecordArrival(long long arrivalTime)
+{
+	if (lastArrivalTime != 0)
+	{
+		long long interval = arrivalTime - lastArrivalTime;
+		int bin = 0;
+		for (long long limit = 10000; bin < RealSenseStatisticsUnmanaged::NumInterArrivalBins - 1 && interval >= limit; limit *= 2)
+		{
+			bin++;
+		}
+		InterlockedIncrement64(&stats.interArrivalHistogram[bin]);
+	}
+	lastArrivalTime = arrivalTime;
+}
+
+void RealSenseDeviceUnmanaged::RecordConsumerTime(long long readStartTime)
+{
+	if (lastReadEndTime != 0)
+	{
+		long long consumerTime = readStartTime - lastReadEndTime;
+		InterlockedExchangeAdd64(&stats.consumerTime, consumerTime);
+		if (consumerTime > stats.maxConsumerTime)
+		{
+			InterlockedExchange64(&stats.maxConsumerTime, consumerTime);
+		}
+	}
+}
+
+unsigned int RealSenseDeviceUnmanaged::CopyFrameset(const rs2::frameset &frame, char *colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, char *depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride)
+{
+	long long copyStartTime = GetQpcTime();
+
+	// Color is delivered with the device's bytes per pixel (see GetColorBpp()) in
+	// BGR order, so RGB formats are swapped and BGR ones only copied. A stride of
+	// 0 means packed rows.
+	auto colorFrame = frame.get_color_frame();
+	int w = colorFrame.get_width();
+	int h = colorFrame.get_height();
+	int stride = colorFrame.get_stride_in_bytes();
+	int bpp = colorFrame.get_bytes_per_pixel();
+	int dstStride = colorBufferStride != 0 ? (int)colorBufferStride : w * bpp;
+	if (dstStride < w * bpp || (unsigned long long)h * dstStride > colorBufferLen)
+	{
+		return E_UNEXPECTED;
+	}
+	const unsigned char *src = (const unsigned char*)colorFrame.get_data();
+	unsigned char *dst = (unsigned char*)colorBuffer;
+	switch (colorFrame.get_profile().format())
+	{
+	case RS2_FORMAT_RGB8:
+		ConvertRGB24ToBGR24(src, stride, dst, dstStride, w, h);
+		break;
+	case RS2_FORMAT_RGBA8:
+		ConvertRGBA32ToBGRA32(src, stride, dst, dstStride, w, h);
+		break;
+	case RS2_FORMAT_BGR8:
+	case RS2_FORMAT_BGRA8:
+		CopyRows(src, stride, dst, dstStride, w * bpp, h);
+		break;
+	default:
+		return E_UNEXPECTED;
+	}
+
+	auto depthFrame = frame.get_depth_frame();
+	int depthRowBytes = depthFrame.get_width() * depthFrame.get_bytes_per_pixel();
+	int depthDstStride = depthBufferStride != 0 ? (int)depthBufferStride : depthRowBytes;
+	unsigned long long depthFrameSize = (unsigned long long)depthFrame.get_height() * depthDstStride;
+	if (depthDstStride < depthRowBytes || depthFrameSize > depthBufferLen)
+	{
+		return E_UNEXPECTED;
+	}
+	CopyRows((const unsigned char*)depthFrame.get_data(), depthFrame.get_stride_in_bytes(), (unsigned char*)depthBuffer, depthDstStride, depthRowBytes, depthFrame.get_height());
+
+	RecordFrameNumbers(colorFrame, depthFrame);
+
+	InterlockedExchangeAdd64(&stats.copyTime, GetQpcTime() - copyStartTime);
+	InterlockedExchangeAdd64(&stats.bytesCopied, (long long)w * h * bpp + (long long)depthRowBytes * depthFrame.get_height());
+	InterlockedIncrement64(&stats.framesDelivered);
+	return S_OK;
+}
+
+unsigned int RealSenseDeviceUnmanaged::ReadFrame(char *colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, char *depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride)
+{
+	ApplyThreadPolicy();
+	Microsoft::Psi::Media::Tracing::TraceScope trace(Microsoft::Psi::Media::Tracing::TraceEvent_RealSenseReadFrame);
+	long long readStartTime = GetQpcTime();
+	RecordConsumerTime(readStartTime);
+
 	try
 	{
-		rs2::frameset frame = pipeline.wait_for_frames();
-		auto colorFrame = frame.get_color_frame();
-		int w = colorFrame.get_width();
-		int h = colorFrame.get_height();
-		int stride = colorFrame.get_stride_in_bytes();
-		int bpp = colorFrame.get_bytes_per_pixel();
-		unsigned int colorFrameSize = h * stride;
-		if (colorFrameSize > colorBufferLen)
+		rs2::frameset frame;
+		if (asyncMode)
 		{
-			return E_UNEXPECTED;
+			// Wait as long as wait_for_frames() would
+			if (WaitForSingleObject(frameEvent, 5000) != WAIT_OBJECT_0 || !PopFrameset(frame))
+			{
+				InterlockedIncrement64(&stats.errors);
+				lastReadEndTime = GetQpcTime();
+				return S_OK;
+			}
+			InterlockedExchangeAdd64(&stats.waitTime, GetQpcTime() - readStartTime);
 		}
-		char *srcRow = (char*)colorFrame.get_data();
-		char *dstRow = colorBuffer;
-		for (int y = 0; y < h; y++)
+		else
 		{
-			char *srcCol = srcRow;
-			char *dstCol = dstRow;
-			for (int x = 0; x < w; x++)
+			frame = ProcessFrameset(pipeline.wait_for_frames());
+
+			long long arrivalTime = GetQpcTime();
+			InterlockedExchangeAdd64(&stats.waitTime, arrivalTime - readStartTime);
+			RecordArrival(arrivalTime);
+		}
+
+		if (trace.IsActive())
+		{
+			rs2::video_frame colorFrame = frame.get_color_frame();
+			if (colorFrame)
 			{
-				dstCol[2] = srcCol[0];
-				dstCol[1] = srcCol[1];
-				dstCol[0] = srcCol[2];
-				srcCol += bpp;
-				dstCol += 3;
+				trace.SetFrameMillisecs(colorFrame.get_profile().unique_id(), colorFrame.get_timestamp());
 			}
-			srcRow += stride;
-			dstRow += w * 3;
 		}
 
-		auto depthFrame = frame.get_depth_frame();
-		unsigned int depthFrameSize = depthFrame.get_height() * depthFrame.get_stride_in_bytes();
-		if (depthFrameSize > depthBufferLen)
+		unsigned int hr = CopyFrameset(frame, colorBuffer, colorBufferLen, colorBufferStride, depthBuffer, depthBufferLen, depthBufferStride);
+		if (hr != S_OK)
 		{
-			return E_UNEXPECTED;
+			return hr;
 		}
-		memcpy(depthBuffer, depthFrame.get_data(), depthFrameSize);
 	}
 	catch (...)
 	{
+		InterlockedIncrement64(&stats.errors);
 	}
+	lastReadEndTime = GetQpcTime();
 	return S_OK;
 }
 
+unsigned int RealSenseDeviceUnmanaged::TryReadFrame(char *colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, char *depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride, bool *frameRead)
+{
+	if (frameRead == nullptr)
+	{
+		return E_POINTER;
+	}
+	*frameRead = false;
+
+	if (!asyncMode)
+	{
+		return E_NOT_VALID_STATE;
+	}
+	ApplyThreadPolicy();
+
+	rs2::frameset frame;
+	if (!PopFrameset(frame))
+	{
+		return S_OK;
+	}
+
+	RecordConsumerTime(GetQpcTime());
+
+	unsigned int hr = S_OK;
+	try
+	{
+		hr = CopyFrameset(frame, colorBuffer, colorBufferLen, colorBufferStride, depthBuffer, depthBufferLen, depthBufferStride);
+		*frameRead = (hr == S_OK);
+	}
+	catch (...)
+	{
+		InterlockedIncrement64(&stats.errors);
+	}
+	lastReadEndTime = GetQpcTime();
+	return hr;
+}
+
+void RealSenseDeviceUnmanaged::DescribeFrame(const rs2::video_frame &frame, RealSenseFrameUnmanaged *desc)
+{
+	desc->handle = new rs2::frame(frame);
+	desc->data = frame.get_data();
+	desc->width = frame.get_width();
+	desc->height = frame.get_height();
+	desc->stride = frame.get_stride_in_bytes();
+	desc->bpp = frame.get_bits_per_pixel();
+	desc->format = frame.get_profile().format();
+	desc->frameNumber = frame.get_frame_number();
+	desc->timestamp = frame.get_timestamp();
+}
+
+unsigned int RealSenseDeviceUnmanaged::AcquireFrames(RealSenseFrameUnmanaged *colorFrame, RealSenseFrameUnmanaged *depthFrame, unsigned int timeoutMs, bool *framesAcquired)
+{
+	if (colorFrame == nullptr || depthFrame == nullptr || framesAcquired == nullptr)
+	{
+		return E_POINTER;
+	}
+	memset(colorFrame, 0, sizeof(*colorFrame));
+	memset(depthFrame, 0, sizeof(*depthFrame));
+	*framesAcquired = false;
+
+	ApplyThreadPolicy();
+	long long readStartTime = GetQpcTime();
+	RecordConsumerTime(readStartTime);
+
+	try
+	{
+		rs2::frameset frame;
+		if (asyncMode)
+		{
+			if (WaitForSingleObject(frameEvent, timeoutMs) != WAIT_OBJECT_0 || !PopFrameset(frame))
+			{
+				lastReadEndTime = GetQpcTime();
+				return S_OK;
+			}
+			InterlockedExchangeAdd64(&stats.waitTime, GetQpcTime() - readStartTime);
+		}
+		else
+		{
+			if (!pipeline.try_wait_for_frames(&frame, timeoutMs))
+			{
+				lastReadEndTime = GetQpcTime();
+				return S_OK;
+			}
+
+			long long arrivalTime = GetQpcTime();
+			InterlockedExchangeAdd64(&stats.waitTime, arrivalTime - readStartTime);
+			RecordArrival(arrivalTime);
+			frame = ProcessFrameset(frame);
+		}
+
+		rs2::video_frame color = frame.get_color_frame();
+		rs2::depth_frame depth = frame.get_depth_frame();
+		if (!color || !depth)
+		{
+			InterlockedIncrement64(&stats.errors);
+			lastReadEndTime = GetQpcTime();
+			return S_OK;
+		}
+
+		DescribeFrame(color, colorFrame);
+		DescribeFrame(depth, depthFrame);
+		RecordFrameNumbers(color, depth);
+		InterlockedIncrement64(&stats.framesDelivered);
+		*framesAcquired = true;
+	}
+	catch (...)
+	{
+		ReleaseFrame(colorFrame->handle);
+		ReleaseFrame(depthFrame->handle);
+		colorFrame->handle = nullptr;
+		depthFrame->handle = nullptr;
+		InterlockedIncrement64(&stats.errors);
+	}
+	lastReadEndTime = GetQpcTime();
+	return S_OK;
+}
+
+void RealSenseDeviceUnmanaged::ReleaseFrame(void *handle)
+{
+	// Returns the frame to librealsense's pool
+	delete (rs2::frame*)handle;
+}
+
+unsigned int RealSenseDeviceUnmanaged::ComputePointCloud(void *depthHandle, void *colorHandle, unsigned int decimation, RealSensePointCloudUnmanaged *cloud)
+{
+	if (depthHandle == nullptr || cloud == nullptr || cloud->x == nullptr || cloud->y == nullptr || cloud->z == nullptr)
+	{
+		return E_POINTER;
+	}
+	bool textureCoordinates = cloud->u != nullptr && cloud->v != nullptr;
+	if (textureCoordinates && colorHandle == nullptr)
+	{
+		return E_INVALIDARG;
+	}
+	if (decimation == 0)
+	{
+		decimation = 1;
+	}
+
+	try
+	{
+		// Intrinsics come from the frame's own profile, so aligned and decimated depth is handled too
+		rs2::depth_frame depth(*(rs2::frame*)depthHandle);
+		if (!depth || depth.get_profile().format() != RS2_FORMAT_Z16)
+		{
+			return E_INVALIDARG;
+		}
+		rs2::video_stream_profile depthProfile = depth.get_profile().as<rs2::video_stream_profile>();
+		rs2_intrinsics depthIntrinsics = depthProfile.get_intrinsics();
+
+		unsigned int width = depth.get_width();
+		unsigned int height = depth.get_height();
+		cloud->width = (width + decimation - 1) / decimation;
+		cloud->height = (height + decimation - 1) / decimation;
+		if (cloud->capacity < cloud->width * cloud->height)
+		{
+			return E_NOT_SUFFICIENT_BUFFER;
+		}
+
+		rs2_intrinsics colorIntrinsics;
+		rs2_extrinsics depthToColor;
+		if (textureCoordinates)
+		{
+			rs2::video_stream_profile colorProfile = ((rs2::frame*)colorHandle)->get_profile().as<rs2::video_stream_profile>();
+			colorIntrinsics = colorProfile.get_intrinsics();
+			depthToColor = depthProfile.get_extrinsics_to(colorProfile);
+		}
+
+		pointCloud.Compute((const unsigned short*)depth.get_data(), depth.get_stride_in_bytes(), width, height, depthIntrinsics, depth.get_units(), decimation,
+			textureCoordinates ? &colorIntrinsics : nullptr, textureCoordinates ? &depthToColor : nullptr, cloud);
+	}
+	catch (...)
+	{
+		return E_UNEXPECTED;
+	}
+	return S_OK;
+}
+
+unsigned int RealSenseDeviceUnmanaged::StartAsync(unsigned int capacity)
+{
+	if (asyncMode)
+	{
+		return S_OK;
+	}
+	if (capacity == 0)
+	{
+		return E_INVALIDARG;
+	}
+
+	queue = new rs2::frameset[capacity];
+	queueCapacity = capacity;
+	queueHead = 0;
+	queueCount = 0;
+	lastArrivalTime = 0;
+
+	try
+	{
+		// A pipeline either delivers to a callback or through wait_for_frames(), so restart it
+		pipeline.stop();
+		started = false;
+		pipeline.start(config, [this](rs2::frame frame) { OnFrame(frame); });
+		started = true;
+	}
+	catch (...)
+	{
+		delete[] queue;
+		queue = nullptr;
+		return E_UNEXPECTED;
+	}
+
+	asyncMode = true;
+	return S_OK;
+}
+
+void RealSenseDeviceUnmanaged::OnFrame(rs2::frame frame)
+{
+	// Called on librealsense's thread. With more than one stream the pipeline's
+	// syncer hands us framesets; anything else is a stream we don't read
+	rs2::frameset frameset = frame.as<rs2::frameset>();
+	if (!frameset)
+	{
+		return;
+	}
+
+	ApplyThreadPolicy();
+	RecordArrival(GetQpcTime());
+	frameset = ProcessFrameset(frameset);
+
+	// The discarded frameset is released outside the lock, since that returns
+	// its frames to librealsense's pool
+	rs2::frameset discarded;
+	EnterCriticalSection(&queueLock);
+	if (queueCount == queueCapacity)
+	{
+		discarded = queue[queueHead];
+		queue[queueHead] = rs2::frameset();
+		queueHead = (queueHead + 1) % queueCapacity;
+		queueCount--;
+		InterlockedIncrement64(&stats.queueOverflows);
+	}
+	queue[(queueHead + queueCount) % queueCapacity] = frameset;
+	queueCount++;
+	SetEvent(frameEvent);
+	LeaveCriticalSection(&queueLock);
+}
+
+bool RealSenseDeviceUnmanaged::PopFrameset(rs2::frameset &frame)
+{
+	bool found = false;
+	EnterCriticalSection(&queueLock);
+	if (queueCount > 0)
+	{
+		frame = queue[queueHead];
+		queue[queueHead] = rs2::frameset();
+		queueHead = (queueHead + 1) % queueCapacity;
+		queueCount--;
+		found = true;
+	}
+	if (queueCount == 0)
+	{
+		ResetEvent(frameEvent);
+	}
+	LeaveCriticalSection(&queueLock);
+	return found;
+}
+
+bool RealSenseDeviceUnmanaged::PeekFramesetTimestamp(double *timestamp)
+{
+	bool found = false;
+	EnterCriticalSection(&queueLock);
+	if (queueCount > 0)
+	{
+		rs2::frameset &frame = queue[queueHead];
+		rs2::video_frame colorFrame = frame.get_color_frame();
+		*timestamp = colorFrame ? colorFrame.get_timestamp() : frame.get_timestamp();
+		found = true;
+	}
+	LeaveCriticalSection(&queueLock);
+	return found;
+}
+
+void RealSenseDeviceUnmanaged::DiscardFrameset()
+{
+	rs2::frameset frame;
+	if (PopFrameset(frame))
+	{
+		InterlockedIncrement64(&stats.queueOverflows);
+	}
+}
+
 unsigned int RealSenseDeviceUnmanaged::AddRef()
 {
-	return refCount++;
+	// Frames hold a reference and may be finalized on another thread
+	return (unsigned int)InterlockedIncrement(&refCount);
 }
 
 unsigned int RealSenseDeviceUnmanaged::Release()
 {
-	unsigned int refcnt = --refCount;
+	unsigned int refcnt = (unsigned int)InterlockedDecrement(&refCount);
 	if (refcnt == 0)
 	{
 		delete this;
@@ -172,17 +816,17 @@ unsigned int RealSenseDeviceUnmanaged::Release()
 	return refcnt;
 }
 
-unsigned int CreateRealSenseDeviceUnmanaged(IRealSenseDeviceUnmanaged **device)
+unsigned int CreateRealSenseDeviceUnmanaged(const RealSenseConfigurationUnmanaged *configuration, IRealSenseDeviceUnmanaged **device)
 {
 	RealSenseDeviceUnmanaged *dev = new RealSenseDeviceUnmanaged();
 	if (dev == nullptr)
 	{
 		return E_OUTOFMEMORY;
 	}
-	dev->Initialize();
+	unsigned int hr = dev->Initialize(configuration);
 	dev->AddRef();
 	*device = dev;
-	return S_OK;
+	return hr;
 }
 
 #pragma managed(pop)
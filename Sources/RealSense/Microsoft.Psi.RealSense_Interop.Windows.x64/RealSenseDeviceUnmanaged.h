@@ -6,11 +6,15 @@
 #include <librealsense2/rs.hpp>
 #include <windows.h>
 #include "IRealSenseDeviceUnmanaged.h"
+#include "RealSensePointCloud.h"
+#include "ThreadPolicy.h"
 
 class RealSenseDeviceUnmanaged : public IRealSenseDeviceUnmanaged
 {
 private:
 	rs2::pipeline pipeline;
+	rs2::config config;                   // The streams the pipeline was started with
+	bool started;                         // Set while the pipeline runs (stop() throws if it doesn't)
 	unsigned int colorWidth;
 	unsigned int colorHeight;
 	unsigned int colorBpp;
@@ -19,14 +23,76 @@ private:
 	unsigned int depthHeight;
 	unsigned int depthBpp;
 	unsigned int depthStride;
-	unsigned int refCount;
+	volatile long refCount;
+	RealSenseStatisticsUnmanaged stats;
+	long long qpcFrequency;
+	long long lastReadEndTime;            // When the last ReadFrame() returned (0 before the first)
+	long long lastArrivalTime;            // When the last frameset arrived (0 before the first)
+	unsigned long long lastColorFrameNumber;
+	unsigned long long lastDepthFrameNumber;
 
+	// Asynchronous delivery. Framesets pushed by the pipeline's callback are kept in
+	// a ring buffer; when it is full the oldest one is discarded, so a slow reader
+	// gets the latest frames instead of falling further behind
+	volatile bool asyncMode;
+	CRITICAL_SECTION queueLock;
+	HANDLE frameEvent;                    // Manual reset, set while the queue holds framesets
+	rs2::frameset *queue;
+	unsigned int queueCapacity;
+	unsigned int queueHead;
+	unsigned int queueCount;
+
+	// Optional processing, applied to each frameset before it is handed out (on
+	// librealsense's thread in asynchronous mode, since the temporal filter needs
+	// framesets in order)
+	rs2::align align;
+	rs2::decimation_filter decimation;
+	rs2::spatial_filter spatial;
+	rs2::temporal_filter temporal;
+	rs2::hole_filling_filter holeFilling;
+	bool alignDepthToColor;
+	bool useDecimation;
+	bool useSpatial;
+	bool useTemporal;
+	bool useHoleFilling;
+
+	// Scheduling of librealsense's frame thread and of the threads reading frames.
+	// Applied by each of them as it hands us a frameset or asks for one
+	Microsoft::Psi::Media::Threading::ThreadPolicy threadPolicy;
+
+	// Keeps the rays for the depth intrinsics seen last, so ComputePointCloud() isn't thread safe
+	Microsoft::Psi::RealSense::Windows::PointCloudGenerator pointCloud;
+
+	// Warm-up ends once this many consecutive color frames have an exposure within 1% of the previous one's
+	static const int AutoExposureStableFrames = 3;
+
+	void Construct();
 	void DumpDeviceInfo();
+	unsigned int ConfigureStreams(const RealSenseConfigurationUnmanaged &configuration);
+	void WarmUp(const RealSenseConfigurationUnmanaged &configuration);
+	rs2::frameset ProcessFrameset(const rs2::frameset &frameset);
+	long long GetQpcTime();
+	void CountDroppedFrames(unsigned long long frameNumber, unsigned long long &lastFrameNumber, long long &dropped);
+	void RecordFrameNumbers(const rs2::video_frame &colorFrame, const rs2::video_frame &depthFrame);
+	void RecordArrival(long long arrivalTime);
+	static void DescribeFrame(const rs2::video_frame &frame, RealSenseFrameUnmanaged *desc);
+	void RecordConsumerTime(long long readStartTime);
+	unsigned int CopyFrameset(const rs2::frameset &frame, char *colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, char *depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride);
+	void OnFrame(rs2::frame frame);
+	void ApplyThreadPolicy();
+	bool PopFrameset(rs2::frameset &frame);
 public:
 	RealSenseDeviceUnmanaged();
+	RealSenseDeviceUnmanaged(const rs2::context &context);
 	~RealSenseDeviceUnmanaged();
-	virtual unsigned int Initialize();
-	virtual unsigned int ReadFrame(char *colorBuffer, unsigned int colorBufferLen, char *depthBuffer, unsigned int depthBufferLen);
+	virtual unsigned int Initialize(const RealSenseConfigurationUnmanaged *configuration);
+	virtual unsigned int ReadFrame(char *colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, char *depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride);
+	virtual unsigned int StartAsync(unsigned int queueCapacity);
+	virtual unsigned int TryReadFrame(char *colorBuffer, unsigned int colorBufferLen, unsigned int colorBufferStride, char *depthBuffer, unsigned int depthBufferLen, unsigned int depthBufferStride, bool *frameRead);
+	virtual void *GetFrameEvent() { return frameEvent; }
+	virtual unsigned int AcquireFrames(RealSenseFrameUnmanaged *colorFrame, RealSenseFrameUnmanaged *depthFrame, unsigned int timeoutMs, bool *framesAcquired);
+	virtual void ReleaseFrame(void *handle);
+	virtual unsigned int ComputePointCloud(void *depthHandle, void *colorHandle, unsigned int decimation, RealSensePointCloudUnmanaged *cloud);
 	virtual unsigned int GetColorWidth() { return colorWidth; }
 	virtual unsigned int GetColorHeight() { return colorHeight; }
 	virtual unsigned int GetColorBpp() { return colorBpp; }
@@ -35,7 +101,12 @@ public:
 	virtual unsigned int GetDepthHeight() { return depthHeight; }
 	virtual unsigned int GetDepthBpp() { return depthBpp; }
 	virtual unsigned int GetDepthStride() { return depthStride; }
+	virtual unsigned int GetStatistics(RealSenseStatisticsUnmanaged *stats);
 	virtual unsigned int AddRef();
 	virtual unsigned int Release();
+
+	// For RealSenseDeviceManagerUnmanaged, which matches queued framesets across devices
+	bool PeekFramesetTimestamp(double *timestamp);
+	void DiscardFrameset();
 };
 #pragma managed(pop)
@@ -0,0 +1,319 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include <math.h>
+#include <float.h>
+#include <string.h>
+#include <immintrin.h>
+#include "RealSensePointCloud.h"
+#include "MediaConversion.h"
+
+// SIMD intrinsics can't be compiled to MSIL, so all of this is native code
+#pragma managed(push, off)
+
+namespace Microsoft {
+	namespace Psi {
+		namespace RealSense {
+			namespace Windows {
+
+				//**********************************************************************
+				// Ray (x and y at unit depth) through a pixel, as computed by
+				// rs2_deproject_pixel_to_point() in librealsense 2.50's rsutil.h, the
+				// version ProjectPoints follows too
+				//**********************************************************************
+				static void DeprojectPixel(const rs2_intrinsics &intrinsics, float px, float py, float *rayX, float *rayY)
+				{
+					const float *c = intrinsics.coeffs;
+					float x = (px - intrinsics.ppx) / intrinsics.fx;
+					float y = (py - intrinsics.ppy) / intrinsics.fy;
+					switch (intrinsics.model)
+					{
+					case RS2_DISTORTION_INVERSE_BROWN_CONRADY:
+					case RS2_DISTORTION_BROWN_CONRADY:
+					{
+						// No closed form for the inverse; iterate like librealsense does
+						float x0 = x;
+						float y0 = y;
+						for (int i = 0; i < 10; i++)
+						{
+							float r2 = x * x + y * y;
+							float icdist = 1 / (1 + ((c[4] * r2 + c[1]) * r2 + c[0]) * r2);
+							float xq = x / icdist;
+							float yq = y / icdist;
+							float deltaX = 2 * c[2] * xq * yq + c[3] * (r2 + 2 * xq * xq);
+							float deltaY = 2 * c[3] * xq * yq + c[2] * (r2 + 2 * yq * yq);
+							x = (x0 - deltaX) * icdist;
+							y = (y0 - deltaY) * icdist;
+						}
+						break;
+					}
+					case RS2_DISTORTION_FTHETA:
+					{
+						float rd = sqrtf(x * x + y * y);
+						if (rd < FLT_EPSILON)
+						{
+							rd = FLT_EPSILON;
+						}
+						float r = (float)(tan(c[0] * rd) / atan(2 * tan(c[0] / 2.0f)));
+						x *= r / rd;
+						y *= r / rd;
+						break;
+					}
+					default:
+						break;
+					}
+					*rayX = x;
+					*rayY = y;
+				}
+
+				//**********************************************************************
+				// What ProjectRow needs to map depth camera points to normalized
+				// texture coordinates, as rs2_transform_point_to_point() followed by
+				// rs2_project_point_to_pixel() would
+				//**********************************************************************
+				struct Projection
+				{
+					float rotation[9];      // Column major, as in rs2_extrinsics
+					float translation[3];
+					float fx;
+					float fy;
+					float ppx;
+					float ppy;
+					float invWidth;
+					float invHeight;
+					float coeffs[5];
+					bool distorted;
+					bool modified;          // Modified (or inverse) Brown-Conrady: tangential terms use the radially distorted point
+				};
+
+				static void ProjectPoints(const Projection &p, const float *x, const float *y, const float *z, float *u, float *v, unsigned int start, unsigned int count)
+				{
+					for (unsigned int i = start; i < count; i++)
+					{
+						if (z[i] <= 0)
+						{
+							u[i] = -1;
+							v[i] = -1;
+							continue;
+						}
+
+						const float *r = p.rotation;
+						float cx = r[0] * x[i] + r[3] * y[i] + r[6] * z[i] + p.translation[0];
+						float cy = r[1] * x[i] + r[4] * y[i] + r[7] * z[i] + p.translation[1];
+						float cz = r[2] * x[i] + r[5] * y[i] + r[8] * z[i] + p.translation[2];
+						float px = cx / cz;
+						float py = cy / cz;
+						if (p.distorted)
+						{
+							const float *c = p.coeffs;
+							float r2 = px * px + py * py;
+							float f = 1 + r2 * (c[0] + r2 * (c[1] + r2 * c[4]));
+							float xf = px * f;
+							float yf = py * f;
+							float bx = p.modified ? xf : px;
+							float by = p.modified ? yf : py;
+							px = xf + 2 * c[2] * bx * by + c[3] * (r2 + 2 * bx * bx);
+							py = yf + 2 * c[3] * bx * by + c[2] * (r2 + 2 * by * by);
+						}
+						u[i] = (px * p.fx + p.ppx) * p.invWidth;
+						v[i] = (py * p.fy + p.ppy) * p.invHeight;
+					}
+				}
+
+				static void ProjectPointsAVX2(const Projection &p, const float *x, const float *y, const float *z, float *u, float *v, unsigned int count)
+				{
+					const __m256 r0 = _mm256_set1_ps(p.rotation[0]);
+					const __m256 r1 = _mm256_set1_ps(p.rotation[1]);
+					const __m256 r2 = _mm256_set1_ps(p.rotation[2]);
+					const __m256 r3 = _mm256_set1_ps(p.rotation[3]);
+					const __m256 r4 = _mm256_set1_ps(p.rotation[4]);
+					const __m256 r5 = _mm256_set1_ps(p.rotation[5]);
+					const __m256 r6 = _mm256_set1_ps(p.rotation[6]);
+					const __m256 r7 = _mm256_set1_ps(p.rotation[7]);
+					const __m256 r8 = _mm256_set1_ps(p.rotation[8]);
+					const __m256 t0 = _mm256_set1_ps(p.translation[0]);
+					const __m256 t1 = _mm256_set1_ps(p.translation[1]);
+					const __m256 t2 = _mm256_set1_ps(p.translation[2]);
+					const __m256 fx = _mm256_set1_ps(p.fx * p.invWidth);
+					const __m256 fy = _mm256_set1_ps(p.fy * p.invHeight);
+					const __m256 ppx = _mm256_set1_ps(p.ppx * p.invWidth);
+					const __m256 ppy = _mm256_set1_ps(p.ppy * p.invHeight);
+					const __m256 c0 = _mm256_set1_ps(p.coeffs[0]);
+					const __m256 c1 = _mm256_set1_ps(p.coeffs[1]);
+					const __m256 c2x2 = _mm256_set1_ps(2 * p.coeffs[2]);
+					const __m256 c3x2 = _mm256_set1_ps(2 * p.coeffs[3]);
+					const __m256 c2 = _mm256_set1_ps(p.coeffs[2]);
+					const __m256 c3 = _mm256_set1_ps(p.coeffs[3]);
+					const __m256 c4 = _mm256_set1_ps(p.coeffs[4]);
+					const __m256 one = _mm256_set1_ps(1.0f);
+					const __m256 two = _mm256_set1_ps(2.0f);
+					const __m256 invalid = _mm256_set1_ps(-1.0f);
+					const __m256 zero = _mm256_setzero_ps();
+
+					unsigned int i = 0;
+					for (; i + 8 <= count; i += 8)
+					{
+						__m256 px = _mm256_loadu_ps(x + i);
+						__m256 py = _mm256_loadu_ps(y + i);
+						__m256 pz = _mm256_loadu_ps(z + i);
+
+						__m256 cx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r0, px), _mm256_mul_ps(r3, py)), _mm256_add_ps(_mm256_mul_ps(r6, pz), t0));
+						__m256 cy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r1, px), _mm256_mul_ps(r4, py)), _mm256_add_ps(_mm256_mul_ps(r7, pz), t1));
+						__m256 cz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r2, px), _mm256_mul_ps(r5, py)), _mm256_add_ps(_mm256_mul_ps(r8, pz), t2));
+						__m256 invZ = _mm256_div_ps(one, cz);
+						__m256 nx = _mm256_mul_ps(cx, invZ);
+						__m256 ny = _mm256_mul_ps(cy, invZ);
+						if (p.distorted)
+						{
+							__m256 rr = _mm256_add_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny));
+							__m256 f = _mm256_add_ps(one, _mm256_mul_ps(rr, _mm256_add_ps(c0, _mm256_mul_ps(rr, _mm256_add_ps(c1, _mm256_mul_ps(rr, c4))))));
+							__m256 xf = _mm256_mul_ps(nx, f);
+							__m256 yf = _mm256_mul_ps(ny, f);
+							__m256 bx = p.modified ? xf : nx;
+							__m256 by = p.modified ? yf : ny;
+							__m256 bxy = _mm256_mul_ps(bx, by);
+							nx = _mm256_add_ps(_mm256_add_ps(xf, _mm256_mul_ps(c2x2, bxy)), _mm256_mul_ps(c3, _mm256_add_ps(rr, _mm256_mul_ps(two, _mm256_mul_ps(bx, bx)))));
+							ny = _mm256_add_ps(_mm256_add_ps(yf, _mm256_mul_ps(c3x2, bxy)), _mm256_mul_ps(c2, _mm256_add_ps(rr, _mm256_mul_ps(two, _mm256_mul_ps(by, by)))));
+						}
+
+						// Points without depth get -1 (the division above left them as NaN or inf)
+						__m256 valid = _mm256_cmp_ps(pz, zero, _CMP_GT_OQ);
+						_mm256_storeu_ps(u + i, _mm256_blendv_ps(invalid, _mm256_add_ps(_mm256_mul_ps(nx, fx), ppx), valid));
+						_mm256_storeu_ps(v + i, _mm256_blendv_ps(invalid, _mm256_add_ps(_mm256_mul_ps(ny, fy), ppy), valid));
+					}
+					ProjectPoints(p, x, y, z, u, v, i, count);
+				}
+
+				//**********************************************************************
+				// Scales the rays of a row of pixels by their depth
+				//**********************************************************************
+				static void DeprojectPoints(const unsigned short *depth, const float *rayX, const float *rayY, float units, float *x, float *y, float *z, unsigned int start, unsigned int count)
+				{
+					for (unsigned int i = start; i < count; i++)
+					{
+						float d = depth[i] * units;
+						x[i] = d * rayX[i];
+						y[i] = d * rayY[i];
+						z[i] = d;
+					}
+				}
+
+				static void DeprojectPointsAVX2(const unsigned short *depth, const float *rayX, const float *rayY, float units, float *x, float *y, float *z, unsigned int count)
+				{
+					const __m256 scale = _mm256_set1_ps(units);
+					unsigned int i = 0;
+					for (; i + 8 <= count; i += 8)
+					{
+						__m256i d16 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(depth + i)));
+						__m256 d = _mm256_mul_ps(_mm256_cvtepi32_ps(d16), scale);
+						_mm256_storeu_ps(x + i, _mm256_mul_ps(d, _mm256_loadu_ps(rayX + i)));
+						_mm256_storeu_ps(y + i, _mm256_mul_ps(d, _mm256_loadu_ps(rayY + i)));
+						_mm256_storeu_ps(z + i, d);
+					}
+					DeprojectPoints(depth, rayX, rayY, units, x, y, z, i, count);
+				}
+
+				PointCloudGenerator::PointCloudGenerator() :
+					rayDecimation(0)
+				{
+					memset(&rayIntrinsics, 0, sizeof(rayIntrinsics));
+				}
+
+				void PointCloudGenerator::ComputeRays(const rs2_intrinsics &intrinsics, unsigned int decimation, unsigned int width, unsigned int height)
+				{
+					rayX.resize((size_t)width * height);
+					rayY.resize((size_t)width * height);
+					for (unsigned int j = 0; j < height; j++)
+					{
+						for (unsigned int i = 0; i < width; i++)
+						{
+							size_t index = (size_t)j * width + i;
+							DeprojectPixel(intrinsics, (float)(i * decimation), (float)(j * decimation), &rayX[index], &rayY[index]);
+						}
+					}
+					rayIntrinsics = intrinsics;
+					rayDecimation = decimation;
+				}
+
+				void PointCloudGenerator::Compute(const unsigned short *depth, unsigned int depthStride, unsigned int width, unsigned int height, const rs2_intrinsics &depthIntrinsics, float depthUnits, unsigned int decimation,
+					const rs2_intrinsics *colorIntrinsics, const rs2_extrinsics *depthToColor, RealSensePointCloudUnmanaged *cloud)
+				{
+					unsigned int gridWidth = (width + decimation - 1) / decimation;
+					unsigned int gridHeight = (height + decimation - 1) / decimation;
+					cloud->width = gridWidth;
+					cloud->height = gridHeight;
+
+					if (decimation != rayDecimation || memcmp(&depthIntrinsics, &rayIntrinsics, sizeof(rs2_intrinsics)) != 0)
+					{
+						ComputeRays(depthIntrinsics, decimation, gridWidth, gridHeight);
+					}
+
+					bool textureCoordinates = colorIntrinsics != nullptr && depthToColor != nullptr && cloud->u != nullptr && cloud->v != nullptr;
+					Projection projection;
+					if (textureCoordinates)
+					{
+						memcpy(projection.rotation, depthToColor->rotation, sizeof(projection.rotation));
+						memcpy(projection.translation, depthToColor->translation, sizeof(projection.translation));
+						projection.fx = colorIntrinsics->fx;
+						projection.fy = colorIntrinsics->fy;
+						projection.ppx = colorIntrinsics->ppx;
+						projection.ppy = colorIntrinsics->ppy;
+						projection.invWidth = 1.0f / colorIntrinsics->width;
+						projection.invHeight = 1.0f / colorIntrinsics->height;
+						memcpy(projection.coeffs, colorIntrinsics->coeffs, sizeof(projection.coeffs));
+						// rs2_project_point_to_pixel() projects with the inverse model the same way as the modified one
+						projection.modified = colorIntrinsics->model == RS2_DISTORTION_MODIFIED_BROWN_CONRADY ||
+							colorIntrinsics->model == RS2_DISTORTION_INVERSE_BROWN_CONRADY;
+						projection.distorted = projection.modified || colorIntrinsics->model == RS2_DISTORTION_BROWN_CONRADY;
+					}
+
+					if (decimation > 1)
+					{
+						decimatedRow.resize(gridWidth);
+					}
+
+					bool avx2 = Media::Conversion::GetCpuLevel() >= Media::Conversion::CpuLevel_AVX2;
+					for (unsigned int j = 0; j < gridHeight; j++)
+					{
+						const unsigned short *row = (const unsigned short*)((const unsigned char*)depth + (size_t)j * decimation * depthStride);
+						if (decimation > 1)
+						{
+							for (unsigned int i = 0; i < gridWidth; i++)
+							{
+								decimatedRow[i] = row[i * decimation];
+							}
+							row = &decimatedRow[0];
+						}
+
+						size_t offset = (size_t)j * gridWidth;
+						float *x = cloud->x + offset;
+						float *y = cloud->y + offset;
+						float *z = cloud->z + offset;
+						if (avx2)
+						{
+							DeprojectPointsAVX2(row, &rayX[offset], &rayY[offset], depthUnits, x, y, z, gridWidth);
+						}
+						else
+						{
+							DeprojectPoints(row, &rayX[offset], &rayY[offset], depthUnits, x, y, z, 0, gridWidth);
+						}
+
+						if (textureCoordinates)
+						{
+							if (avx2)
+							{
+								ProjectPointsAVX2(projection, x, y, z, cloud->u + offset, cloud->v + offset, gridWidth);
+							}
+							else
+							{
+								ProjectPoints(projection, x, y, z, cloud->u + offset, cloud->v + offset, 0, gridWidth);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+#pragma managed(pop)
@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+#pragma managed(push, off)
+#include <vector>
+#include <librealsense2/h/rs_sensor.h>
+#include "IRealSenseDeviceUnmanaged.h"
+
+namespace Microsoft {
+	namespace Psi {
+		namespace RealSense {
+			namespace Windows {
+
+				//**********************************************************************
+				// Deprojects Z16 depth frames into RealSensePointCloudUnmanaged, with
+				// the same math as rs2_deproject_pixel_to_point() and, for texture
+				// coordinates, rs2_project_point_to_pixel(). The (distortion corrected)
+				// ray through each sampled pixel is computed once per set of intrinsics,
+				// which leaves a multiply per coordinate for the AVX2 row kernels.
+				// Decimation takes every n-th pixel of every n-th row; use the device's
+				// decimation filter instead when the depth should also be smoothed.
+				// Distortion models other than the Brown-Conrady variants (and F-theta
+				// for deprojection) are treated as undistorted. Not thread safe.
+				//**********************************************************************
+				class PointCloudGenerator
+				{
+				private:
+					std::vector<float> rayX;
+					std::vector<float> rayY;
+					std::vector<unsigned short> decimatedRow;
+					rs2_intrinsics rayIntrinsics;     // What the rays were computed for
+					unsigned int rayDecimation;       // 0 before the first frame
+
+					void ComputeRays(const rs2_intrinsics &intrinsics, unsigned int decimation, unsigned int width, unsigned int height);
+				public:
+					PointCloudGenerator();
+
+					// The cloud must have room for the decimated grid. Without color intrinsics
+					// and extrinsics (or without u and v arrays) texture coordinates are skipped.
+					void Compute(const unsigned short *depth, unsigned int depthStride, unsigned int width, unsigned int height, const rs2_intrinsics &depthIntrinsics, float depthUnits, unsigned int decimation,
+						const rs2_intrinsics *colorIntrinsics, const rs2_extrinsics *depthToColor, RealSensePointCloudUnmanaged *cloud);
+				};
+			}
+		}
+	}
+}
+#pragma managed(pop)
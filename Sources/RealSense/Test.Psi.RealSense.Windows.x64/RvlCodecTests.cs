@@ -0,0 +1,177 @@
+﻿// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+namespace Test.Psi.RealSense
+{
+    using System;
+    using System.IO;
+    using Microsoft.Psi.Imaging;
+    using Microsoft.Psi.RealSense.Windows;
+    using Microsoft.VisualStudio.TestTools.UnitTesting;
+
+    /// <summary>
+    /// Tests for the RVL depth image codec.
+    /// </summary>
+    [TestClass]
+    public class RvlCodecTests
+    {
+        /// <summary>
+        /// Random depth images, with runs of invalid pixels, survive an encode/decode round trip.
+        /// </summary>
+        [TestMethod]
+        [Timeout(60000)]
+        public void RvlRoundTrip()
+        {
+            var random = new Random(1);
+            for (int i = 0; i < 50; i++)
+            {
+                int width = 1 + random.Next(200);
+                int height = 1 + random.Next(100);
+                using (var image = new DepthImage(width, height))
+                {
+                    // Mix runs of zeros, small deltas and full range jumps
+                    Fill(image, (x, y) =>
+                    {
+                        int kind = random.Next(4);
+                        return (ushort)(kind == 0 ? 0 : kind == 1 ? random.Next(65536) : 1000 + random.Next(16));
+                    });
+                    AssertRoundTrip(image);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Images that are all invalid, or that swing between the extremes of the range, survive a round trip.
+        /// </summary>
+        [TestMethod]
+        [Timeout(60000)]
+        public void RvlRoundTripExtremes()
+        {
+            using (var image = new DepthImage(64, 48))
+            {
+                Fill(image, (x, y) => 0);
+                AssertRoundTrip(image);
+
+                Fill(image, (x, y) => ((x + y) & 1) == 0 ? (ushort)0xFFFF : (ushort)1);
+                AssertRoundTrip(image);
+            }
+        }
+
+        /// <summary>
+        /// Rows are decoded into the destination's stride, which may be padded.
+        /// </summary>
+        [TestMethod]
+        [Timeout(60000)]
+        public void RvlRoundTripPaddedStride()
+        {
+            using (var image = new DepthImage(30, 20, 30 * 2 + 8))
+            {
+                Fill(image, (x, y) => (ushort)((x * 7 + y * 13) % 5 == 0 ? 0 : 500 + x + y));
+                AssertRoundTrip(image);
+            }
+        }
+
+        /// <summary>
+        /// Truncated data is rejected rather than decoded.
+        /// </summary>
+        [TestMethod]
+        [Timeout(60000)]
+        public void RvlRejectsTruncatedData()
+        {
+            using (var image = new DepthImage(32, 32))
+            {
+                Fill(image, (x, y) => (ushort)(1000 + x + y));
+                byte[] encoded = Encode(image);
+                foreach (int length in new[] { 4, 8, 12, encoded.Length / 2, encoded.Length - 4 })
+                {
+                    byte[] truncated = new byte[length];
+                    Array.Copy(encoded, truncated, length);
+                    AssertRejected(truncated, image.Width, image.Height);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Data encoded for another image size is rejected.
+        /// </summary>
+        [TestMethod]
+        [Timeout(60000)]
+        public void RvlRejectsWrongSize()
+        {
+            using (var image = new DepthImage(16, 8))
+            {
+                Fill(image, (x, y) => (ushort)(x * y));
+                byte[] encoded = Encode(image);
+                AssertRejected(encoded, 8, 16);
+                AssertRejected(encoded, 16, 9);
+            }
+        }
+
+        /// <summary>
+        /// Deltas that take a pixel out of the 16-bit range are rejected.
+        /// </summary>
+        [TestMethod]
+        [Timeout(60000)]
+        public void RvlRejectsOutOfRangeDeltas()
+        {
+            // A 1x1 image: no zeros, one valid pixel, then its zigzagged delta from 0.
+            // Nibbles are packed from the most significant end of each 32-bit word.
+            AssertRejected(MakeOneWordImage(0x01100000), 1, 1);  // Delta -1
+            AssertRejected(MakeOneWordImage(0x01888884), 1, 1);  // Delta +65536
+        }
+
+        private static void Fill(DepthImage image, Func<int, int, ushort> pixel)
+        {
+            for (int y = 0; y < image.Height; y++)
+            {
+                for (int x = 0; x < image.Width; x++)
+                {
+                    image.SetPixel(x, y, pixel(x, y));
+                }
+            }
+        }
+
+        private static byte[] Encode(DepthImage image)
+        {
+            using (var stream = new MemoryStream())
+            {
+                new DepthImageToRvlStreamEncoder().EncodeToStream(image, stream);
+                return stream.ToArray();
+            }
+        }
+
+        private static byte[] MakeOneWordImage(uint word)
+        {
+            byte[] data = new byte[12];
+            BitConverter.GetBytes(1).CopyTo(data, 0);
+            BitConverter.GetBytes(1).CopyTo(data, 4);
+            BitConverter.GetBytes(word).CopyTo(data, 8);
+            return data;
+        }
+
+        private static void AssertRejected(byte[] encoded, int width, int height)
+        {
+            using (var image = new DepthImage(width, height))
+            using (var stream = new MemoryStream(encoded))
+            {
+                Assert.ThrowsException<InvalidDataException>(() => new DepthImageFromRvlStreamDecoder().DecodeFromStream(stream, image));
+            }
+        }
+
+        private static void AssertRoundTrip(DepthImage image)
+        {
+            using (var decoded = new DepthImage(image.Width, image.Height, image.Stride))
+            using (var stream = new MemoryStream(Encode(image)))
+            {
+                new DepthImageFromRvlStreamDecoder().DecodeFromStream(stream, decoded);
+                for (int y = 0; y < image.Height; y++)
+                {
+                    for (int x = 0; x < image.Width; x++)
+                    {
+                        Assert.AreEqual(image.GetPixel(x, y), decoded.GetPixel(x, y), $"Pixel ({x}, {y}) of a {image.Width}x{image.Height} image");
+                    }
+                }
+            }
+        }
+    }
+}